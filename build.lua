@@ -22,6 +22,15 @@ local options = {
 	cuik          = false,
 	tb            = false,
 	tests         = false,
+	jit_bench     = false,
+	x64_bench     = false,
+	switch_test   = false,
+	tailcall_test = false,
+	regalloc_test = false,
+	convert_test  = false,
+	bulk_test     = false,
+	a64_jit_test  = false,
+	wasm_test     = false,
 	driver        = false,
 	shared        = false,
 	test          = false,
@@ -51,13 +60,31 @@ local modules = {
 			"tb/src/libtb.c",
 			-- archictectures
 			"tb/src/x64/x64_target.c", "tb/src/aarch64/aarch64_target.c", "tb/src/mips/mips_target.c", "tb/src/wasm/wasm_target.c"
-		}, flags="-I tb/include -DCUIK_USE_TB -DTB_HAS_X64", deps={"common"}
+		}, flags="-I tb/include -DCUIK_USE_TB -DTB_HAS_X64 -DTB_HAS_AARCH64 -DTB_HAS_WASM -DTB_HAS_MIPS", deps={"common"}
 	},
 	-- executables:
 	--   Cuik command line
 	driver       = { is_exe=true, srcs={"main/main_driver.c"}, deps={"common", "cuik", "tb"} },
 	--   TB unittests
 	tests        = { is_exe=true, srcs={"tb/tests/cg_test.c"}, deps={"tb", "common"} },
+	--   multi-threaded JIT placement benchmark
+	jit_bench    = { is_exe=true, srcs={"tb/tests/jit_bench.c"}, deps={"tb", "common"} },
+	--   x64 codegen benchmark
+	x64_bench    = { is_exe=true, srcs={"tb/tests/x64_bench.c"}, deps={"tb", "common"} },
+	--   switch lowering tests
+	switch_test  = { is_exe=true, srcs={"tb/tests/switch_test.c"}, deps={"tb", "common"} },
+	--   tail call tests
+	tailcall_test = { is_exe=true, srcs={"tb/tests/tailcall_test.c"}, deps={"tb", "common"} },
+	--   register allocator regressions
+	regalloc_test = { is_exe=true, srcs={"tb/tests/regalloc_test.c"}, deps={"tb", "common"} },
+	--   GPR <-> XMM conversions & bitcasts
+	convert_test  = { is_exe=true, srcs={"tb/tests/convert_test.c"}, deps={"tb", "common"} },
+	--   memcpy/memset lowering, checked against tb/tests/bulk_test.x64.gold
+	bulk_test     = { is_exe=true, srcs={"tb/tests/bulk_test.c"}, deps={"tb", "common"} },
+	--   aarch64 JIT relocations & veneers, checked against tb/tests/a64_jit_test.gold
+	a64_jit_test  = { is_exe=true, srcs={"tb/tests/a64_jit_test.c"}, deps={"tb", "common"} },
+	--   wasm imports, function table & data layout
+	wasm_test    = { is_exe=true, srcs={"tb/tests/wasm_test.c"}, deps={"tb", "common"} },
 
 	-- external dependencies
 	mimalloc = { srcs={"mimalloc/src/static.c"} }
@@ -133,7 +160,7 @@ if is_windows then
 else
 	ld = cc
 	cflags = cflags.." -D_GNU_SOURCE"
-	ldflags = ldflags.." -g -lc -lm "
+	ldflags = ldflags.." -g -lc -lm -ldl "
 
 	if options.lld then
 		ldflags = ldflags.." -fuse-ld=lld"
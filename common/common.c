@@ -125,7 +125,20 @@ void* tb_arena_unaligned_alloc(TB_Arena* restrict arena, size_t size) {
         size_t chunk_size = tb_arena_chunk_size(arena);
 
         TB_Arena* c = top->next;
-        if (c != NULL) {
+        if (UNLIKELY(size >= chunk_size - sizeof(TB_Arena))) {
+            // too big for a normal chunk, give it a dedicated one spliced in after
+            // the top (any leftover space is still usable by later allocations)
+            size_t big_size = (sizeof(TB_Arena) + size + 4095) & ~(size_t) 4095;
+            c = cuik__valloc(big_size);
+            c->next    = top->next;
+            c->avail   = c->data + size;
+            c->limit   = &c->data[big_size - sizeof(TB_Arena)];
+            #ifndef NDEBUG
+            c->highest = c->avail;
+            #endif
+
+            top->next = c;
+        } else if (c != NULL) {
             assert(tb_arena_chunk_size(arena));
             c->avail   = c->data + size;
             #ifndef NDEBUG
@@ -155,14 +168,14 @@ TB_API void* tb_arena_realloc(TB_Arena* restrict arena, void* old, size_t old_si
     size = (size + TB_ARENA_ALIGNMENT - 1) & ~(TB_ARENA_ALIGNMENT - 1);
 
     char* p = old;
-    if (p + old_size == arena->avail) {
+    if (p + old_size == arena->top->avail) {
         // try to resize
-        arena->avail = old;
+        arena->top->avail = old;
     }
 
     char* dst = tb_arena_unaligned_alloc(arena, size);
     if (dst != p && old) {
-        memcpy(dst, old, size);
+        memcpy(dst, old, old_size < size ? old_size : size);
     }
     return dst;
 }
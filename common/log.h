@@ -39,13 +39,16 @@ enum { LOG_TRACE, LOG_DEBUG, LOG_INFO, LOG_WARN, LOG_ERROR, LOG_FATAL };
 #define log_fatal(...) log_log(LOG_FATAL, __FILE__, __LINE__, __VA_ARGS__)
 #define log_watch(fmt, var) log_log(LOG_DEBUG, __FILE__, __LINE__, #var " = " fmt, (uint64_t)var)
 #else
-#define log_trace(...) (__VA_ARGS__, 0)
-#define log_debug(...) (__VA_ARGS__, 0)
-#define log_info(...)  (__VA_ARGS__, 0)
-#define log_warn(...)  (__VA_ARGS__, 0)
-#define log_error(...) (__VA_ARGS__, 0)
-#define log_fatal(...) (__VA_ARGS__, 0)
-#define log_watch(fmt, var) (var, 0)
+// the arguments are still evaluated, just not printed. it's a call rather than a
+// comma expression so the format strings don't trip -Wunused-value.
+static inline void log_nop(const char *fmt, ...) { }
+#define log_trace(...) log_nop(__VA_ARGS__)
+#define log_debug(...) log_nop(__VA_ARGS__)
+#define log_info(...)  log_nop(__VA_ARGS__)
+#define log_warn(...)  log_nop(__VA_ARGS__)
+#define log_error(...) log_nop(__VA_ARGS__)
+#define log_fatal(...) log_nop(__VA_ARGS__)
+#define log_watch(fmt, var) log_nop(fmt, var)
 #endif
 
 const char* log_level_string(int level);
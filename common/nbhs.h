@@ -79,8 +79,7 @@ typedef struct NBHS_HazardEntry {
     _Atomic(NBHS_Table*) ptr[5];
 } NBHS_HazardEntry;
 
-static _Thread_local bool nbhs_hazard_init;
-static _Thread_local NBHS_HazardEntry nbhs_hazard;
+static _Thread_local NBHS_HazardEntry* nbhs_hazard;
 static _Atomic(NBHS_HazardEntry*) nbhs_hazard_list;
 
 static void* nbhs__alloc_zero_mem(size_t s) { return calloc(1, s); }
@@ -128,7 +127,7 @@ static NBHS_Table* nbhs_hazard_access(_Atomic(NBHS_Table*)* table, int slot) {
     NBHS_Table* val = atomic_load(table);
     for (;;) {
         // mark as hazard
-        nbhs_hazard.ptr[slot] = val;
+        nbhs_hazard->ptr[slot] = val;
         // check if it's been invalidated since the previous load, if so
         // then undo hazard and try load again.
         NBHS_Table* after = atomic_load(table);
@@ -157,7 +156,7 @@ static void* nbhs_raw_intern(NBHS* hs, NBHS_Table* latest, void* val, int hazard
             latest = new_top;
         }
 
-        nbhs_hazard.ptr[hazard_slot] = latest;
+        nbhs_hazard->ptr[hazard_slot] = latest;
     }
 
     // actually lookup & insert
@@ -185,7 +184,7 @@ static void* nbhs_raw_intern(NBHS* hs, NBHS_Table* latest, void* val, int hazard
                         assert(curr->prev == NULL);
 
                         old = nbhs_raw_lookup(hs, curr, h, val);
-                        nbhs_hazard.ptr[hazard_slot + 1] = NULL;
+                        nbhs_hazard->ptr[hazard_slot + 1] = NULL;
                     }
 
                     // count doesn't care that it's a migration, it's at least not replacing an existing
@@ -216,14 +215,14 @@ static void* nbhs_raw_intern(NBHS* hs, NBHS_Table* latest, void* val, int hazard
         // but it just means we need to retry
         NBHS_Table* new_latest = nbhs_hazard_access(&hs->latest, 4);
         if (latest == new_latest && result != NULL) {
-            nbhs_hazard.ptr[hazard_slot] = NULL;
-            nbhs_hazard.ptr[4] = NULL;
+            nbhs_hazard->ptr[hazard_slot] = NULL;
+            nbhs_hazard->ptr[4] = NULL;
             return result;
         }
 
         // move to the correct hazard slot
-        nbhs_hazard.ptr[hazard_slot] = new_latest;
-        nbhs_hazard.ptr[4] = NULL;
+        nbhs_hazard->ptr[hazard_slot] = new_latest;
+        nbhs_hazard->ptr[4] = NULL;
         latest = new_latest;
     }
 }
@@ -278,16 +277,17 @@ void nbhs_raw_insert(NBHS* hs, void* val) {
 
 void* nbhs_intern(NBHS* hs, void* val) {
     NBHS__BEGIN("intern");
-    if (!nbhs_hazard_init) {
+    if (nbhs_hazard == NULL) {
         NBHS__BEGIN("init");
-        nbhs_hazard_init = true;
+        // add to hazard list, it's on the heap since the thread might exit while others
+        // are still walking the list. we never free this because i don't care
+        nbhs_hazard = nbhs__alloc_zero_mem(sizeof(NBHS_HazardEntry));
 
-        // add to hazard list, we never free this because i don't care
         NBHS_HazardEntry* old;
         do {
             old = atomic_load_explicit(&nbhs_hazard_list, memory_order_relaxed);
-            nbhs_hazard.next = old;
-        } while (!atomic_compare_exchange_strong(&nbhs_hazard_list, &old, &nbhs_hazard));
+            nbhs_hazard->next = old;
+        } while (!atomic_compare_exchange_strong(&nbhs_hazard_list, &old, nbhs_hazard));
         NBHS__END();
     }
 
@@ -336,7 +336,7 @@ void* nbhs_intern(NBHS* hs, void* val) {
 
             NBHS__BEGIN("scan");
             // wait for all refs to stop holding on (just read the hazards until they don't match)
-            NBHS_HazardEntry* us = &nbhs_hazard;
+            NBHS_HazardEntry* us = nbhs_hazard;
             for (NBHS_HazardEntry* list = atomic_load(&nbhs_hazard_list); list; list = list->next) {
                 // mark sure no ptrs refer to prev
                 if (us != list) for (size_t i = 0; i < (sizeof(list->ptr)/sizeof(void*)); i++) {
@@ -353,9 +353,15 @@ void* nbhs_intern(NBHS* hs, void* val) {
         }
         skip:;
     }
-    nbhs_hazard.ptr[1] = NULL; // ok it can be freed now
+    nbhs_hazard->ptr[1] = NULL; // ok it can be freed now
 
     void* result = nbhs_raw_intern(hs, latest, val, 0);
+
+    // early outs can leave hazards behind, a thread which never comes back
+    // would have the resizes waiting on it forever.
+    for (size_t i = 0; i < (sizeof(nbhs_hazard->ptr)/sizeof(void*)); i++) {
+        nbhs_hazard->ptr[i] = NULL;
+    }
     NBHS__END();
     return result;
 }
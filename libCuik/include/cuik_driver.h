@@ -24,6 +24,8 @@ struct Cuik_DriverArgs {
 
     #ifdef CUIK_USE_TB
     TB_OutputFlavor flavor;
+    TB_FeatureSet features;
+    TB_CodeLayout layout;
     #endif
 
     Cuik_Target* target;
@@ -33,6 +35,11 @@ struct Cuik_DriverArgs {
     const char* output_name;
     const char* entrypoint;
     const char* dep_file;
+    // NULL means the default cache directory
+    const char* run_cache;
+    // arguments after the program name when -run calls main
+    int run_argc;
+    const char** run_argv;
 
     void* diag_userdata;
     Cuik_DiagCallback diag_callback;
@@ -49,12 +56,14 @@ struct Cuik_DriverArgs {
     bool assembly        : 1;
     bool ast             : 1;
     bool run             : 1;
+    bool run_profile     : 1;
     bool bake            : 1;
     bool nocrt           : 1;
     bool live            : 1;
     bool write_deps      : 1;
     bool optimize        : 1;
     bool time            : 1;
+    bool ra_stats        : 1;
     bool verbose         : 1;
     bool syntax_only     : 1;
     bool test_preproc    : 1;
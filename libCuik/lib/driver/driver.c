@@ -194,8 +194,7 @@ static void apply_func(TB_Function* f, void* arg) {
             CUIK_TIMED_BLOCK("codegen") {
                 tb_function_set_arenas(f, arenas->a[arena_i], arenas->a[!arena_i]);
 
-                TB_FeatureSet features = { 0 };
-                TB_FunctionOutput* out = tb_codegen(f, ir_worklist, arenas->code, &features, print_asm);
+                TB_FunctionOutput* out = tb_codegen(f, ir_worklist, arenas->code, &args->features, print_asm);
                 if (print_asm) {
                     tb_output_print_asm(out, stdout);
                     printf("\n\n");
@@ -361,6 +360,281 @@ static void cc_invoke(BuildStepInfo* restrict info) {
     done_no_cpp: step_done(s);
 }
 
+#ifdef CUIK_USE_TB
+static bool jit_is_host(const Cuik_Target* target) {
+    #if defined(__x86_64__) || defined(_M_X64)
+    TB_Arch arch = TB_ARCH_X86_64;
+    #elif defined(__aarch64__) || defined(_M_ARM64)
+    TB_Arch arch = TB_ARCH_AARCH64;
+    #else
+    TB_Arch arch = TB_ARCH_UNKNOWN;
+    #endif
+
+    #if defined(_WIN32)
+    Cuik_System sys = CUIK_SYSTEM_WINDOWS;
+    #elif defined(__APPLE__)
+    Cuik_System sys = CUIK_SYSTEM_MACOS;
+    #else
+    Cuik_System sys = CUIK_SYSTEM_LINUX;
+    #endif
+
+    return target->arch == arch && cuik_get_target_system(target) == sys;
+}
+
+static bool jit_load_library(TB_JIT* jit, const char* name) {
+    if (tb_jit_load_library(jit, name)) {
+        return true;
+    }
+
+    // -lfoo means libfoo.so (or foo.dll)
+    char path[FILENAME_MAX];
+    #ifdef _WIN32
+    snprintf(path, sizeof(path), "%s.dll", name);
+    #else
+    snprintf(path, sizeof(path), "lib%s.so", name);
+    #endif
+    return tb_jit_load_library(jit, path);
+}
+
+// -run keeps every compiled function on disk keyed by its IR (along with the
+// target & flags) so rerunning an unchanged program skips the backend.
+typedef struct {
+    char dir[FILENAME_MAX];
+
+    // parallel to the CU's worklist, store is false for hits & whatever
+    // couldn't be hashed.
+    size_t count;
+    TB_CacheKey* keys;
+    bool* store;
+
+    // worklist indices of the functions each one refers to
+    size_t* callee_count;
+    size_t** callees;
+    uint32_t* visited;
+
+    // these still need to go through codegen
+    DynArray(TB_Function*) misses;
+    // with -O, the misses and everything they might inline
+    DynArray(TB_Function*) to_opt;
+} RunCache;
+
+static bool run_cache_dir(Cuik_DriverArgs* args, char dir[FILENAME_MAX]) {
+    if (args->run_cache) {
+        if (strcmp(args->run_cache, "none") == 0) {
+            return false;
+        }
+
+        snprintf(dir, FILENAME_MAX, "%s", args->run_cache);
+        return true;
+    }
+
+    #ifdef _WIN32
+    const char* base = getenv("LOCALAPPDATA");
+    if (base == NULL) {
+        return false;
+    }
+    snprintf(dir, FILENAME_MAX, "%s\\cuik\\jit", base);
+    #else
+    const char* base = getenv("XDG_CACHE_HOME");
+    if (base != NULL && base[0]) {
+        snprintf(dir, FILENAME_MAX, "%s/cuik/jit", base);
+    } else if ((base = getenv("HOME")) != NULL) {
+        snprintf(dir, FILENAME_MAX, "%s/.cache/cuik/jit", base);
+    } else {
+        return false;
+    }
+    #endif
+    return true;
+}
+
+// list starts out with the roots (already stamped), it grows into everything they can reach
+static size_t run_cache_reach(RunCache* rc, uint32_t stamp, size_t* list, size_t len) {
+    for (size_t k = 0; k < len; k++) {
+        size_t i = list[k];
+        for (size_t j = 0; j < rc->callee_count[i]; j++) {
+            size_t c = rc->callees[i][j];
+            if (rc->visited[c] != stamp) {
+                rc->visited[c] = stamp;
+                list[len++] = c;
+            }
+        }
+    }
+    return len;
+}
+
+// hashes the IR before it's optimized, anything which didn't come out of the
+// cache ends up in rc->misses.
+static void run_cache_load(Cuik_DriverArgs* args, CompilationUnit* cu, RunCache* rc) {
+    TB_Arena* arena = get_ir_arena()->code;
+    size_t count = rc->count = dyn_array_length(cu->worklist);
+    rc->keys = tb_arena_alloc(arena, count * sizeof(TB_CacheKey));
+    rc->store = tb_arena_alloc(arena, count * sizeof(bool));
+
+    // -O is the only flag which changes the code without being in the IR or the module
+    uint8_t salt = args->optimize;
+    CUIK_TIMED_BLOCK("cache keys") {
+        for (size_t i = 0; i < count; i++) {
+            rc->store[i] = tb_cache_key(cu->worklist[i], arena, &args->features, &rc->keys[i]);
+            if (rc->store[i]) {
+                tb_cache_key_salt(&rc->keys[i], 1, &salt);
+            }
+        }
+    }
+
+    size_t* list = NULL;
+    if (args->optimize) {
+        // the inliner pulls callees into their callers (based on nothing but the
+        // callee) so each key also covers every function it can reach.
+        NL_Map(TB_Symbol*, size_t) index = NULL;
+        for (size_t i = 0; i < count; i++) {
+            TB_Symbol* sym = (TB_Symbol*) cu->worklist[i];
+            nl_map_put(index, sym, i);
+        }
+
+        rc->callee_count = tb_arena_alloc(arena, count * sizeof(size_t));
+        rc->callees = tb_arena_alloc(arena, count * sizeof(size_t*));
+        for (size_t i = 0; i < count; i++) {
+            TB_CacheKey* key = &rc->keys[i];
+            rc->callee_count[i] = 0;
+            rc->callees[i] = tb_arena_alloc(arena, (rc->store[i] ? key->sym_count : 0) * sizeof(size_t));
+
+            for (size_t j = 0; rc->store[i] && j < key->sym_count; j++) {
+                ptrdiff_t search = nl_map_get(index, key->syms[j]);
+                if (search >= 0) {
+                    rc->callees[i][rc->callee_count[i]++] = index[search].v;
+                }
+            }
+        }
+        nl_map_free(index);
+
+        uint8_t (*own)[16] = tb_arena_alloc(arena, count * sizeof(*own));
+        bool* own_ok = tb_arena_alloc(arena, count * sizeof(bool));
+        for (size_t i = 0; i < count; i++) {
+            memcpy(own[i], rc->keys[i].hash, sizeof(own[i]));
+            own_ok[i] = rc->store[i];
+        }
+
+        rc->visited = tb_arena_alloc(arena, count * sizeof(uint32_t));
+        memset(rc->visited, 0, count * sizeof(uint32_t));
+        list = tb_arena_alloc(arena, count * sizeof(size_t));
+        for (size_t i = 0; i < count; i++) {
+            if (!own_ok[i]) continue;
+
+            list[0] = i, rc->visited[i] = i + 1;
+            size_t len = run_cache_reach(rc, i + 1, list, 1);
+            for (size_t k = 1; k < len; k++) {
+                rc->store[i] &= own_ok[list[k]];
+                tb_cache_key_salt(&rc->keys[i], sizeof(own[0]), own[list[k]]);
+            }
+        }
+    }
+
+    size_t hits = 0, miss_count = 0;
+    CUIK_TIMED_BLOCK("cache load") {
+        for (size_t i = 0; i < count; i++) {
+            TB_Function* f = cu->worklist[i];
+            if (rc->store[i] && tb_cache_load(rc->dir, &rc->keys[i], f, arena)) {
+                rc->store[i] = false;
+                hits++;
+            } else {
+                dyn_array_put(rc->misses, f);
+                if (list) { list[miss_count] = i, rc->visited[i] = count + 1; }
+                miss_count++;
+            }
+        }
+    }
+    log_debug("run-cache: %zu/%zu functions cached (%s)", hits, count, rc->dir);
+
+    if (list) {
+        // optimizing a miss needs whatever it can inline to be optimized too
+        size_t len = run_cache_reach(rc, count + 1, list, miss_count);
+        for (size_t k = 0; k < len; k++) {
+            dyn_array_put(rc->to_opt, cu->worklist[list[k]]);
+        }
+    }
+}
+
+static void run_cache_store(CompilationUnit* cu, RunCache* rc) {
+    CUIK_TIMED_BLOCK("cache store") {
+        for (size_t i = 0; i < rc->count; i++) {
+            if (rc->store[i] && !tb_cache_store(rc->dir, &rc->keys[i], cu->worklist[i])) {
+                log_debug("run-cache: couldn't store %s", ((TB_Symbol*) cu->worklist[i])->name);
+            }
+        }
+    }
+}
+
+// runs main in-process, the C runtime (and any -l libraries) come straight
+// from the host so there's no object file or linker involved. exits with
+// main's return value.
+static void jit_run(Cuik_DriverArgs* args, TB_Module* mod, const char* program_name) {
+    if (!jit_is_host(args->target)) {
+        fprintf(stderr, "error: can only JIT for the host target\n");
+        return;
+    }
+
+    TB_Function* entry = NULL;
+    TB_SymbolIter it = tb_symbol_iter(mod);
+    for (TB_Symbol* sym; entry == NULL && (sym = tb_symbol_iter_next(&it));) {
+        if (sym->name && strcmp(sym->name, "main") == 0) {
+            entry = tb_symbol_as_function(sym);
+        }
+    }
+
+    if (entry == NULL) {
+        fprintf(stderr, "error: no main function to run\n");
+        return;
+    }
+
+    TB_JIT* jit;
+    if (args->run_profile) {
+        // same heap tb_jit_begin would pick, perf & gdb just get told about it
+        TB_JITFlags flags = TB_JIT_PERF_MAP | TB_JIT_PERF_JITDUMP | TB_JIT_GDB;
+        #if defined(__aarch64__) || defined(_M_ARM64)
+        flags |= TB_JIT_DUAL_MAP;
+        #endif
+        jit = tb_jit_begin_flags(mod, 0, flags);
+    } else {
+        jit = tb_jit_begin(mod, 0);
+    }
+
+    if (jit == NULL) {
+        fprintf(stderr, "error: could not allocate JIT heap\n");
+        return;
+    }
+
+    // libc & libm are already in the host (and libm.so tends to be a linker
+    // script anyways), anything that's really missing fails when it's resolved.
+    dyn_array_for(i, args->libraries) {
+        if (!jit_load_library(jit, args->libraries[i]->data)) {
+            fprintf(stderr, "warning: could not load library: %s\n", args->libraries[i]->data);
+        }
+    }
+
+    int (*main_fn)(int, char**) = tb_jit_place_function(jit, entry);
+    if (main_fn == NULL) {
+        fprintf(stderr, "cuik: undefined symbol '%s'\n", tb_jit_get_undefined(jit));
+        exit(1);
+    }
+
+    // argv[0] is the output name, then whatever came after -- (argv[argc] is NULL)
+    int argc = 1 + args->run_argc;
+    char** argv = cuik_malloc((argc + 1) * sizeof(char*));
+    argv[0] = (char*) program_name;
+    for (int i = 0; i < args->run_argc; i++) {
+        argv[1 + i] = (char*) args->run_argv[i];
+    }
+    argv[argc] = NULL;
+
+    fflush(stdout);
+    fflush(stderr);
+
+    // the JIT stays up, atexit handlers (and whatever stdio buffers) might
+    // still point into it.
+    exit(main_fn(argc, argv));
+}
+#endif
+
 static void ld_invoke(BuildStepInfo* info) {
     Cuik_BuildStep* s = info->step;
     Cuik_DriverArgs* args = s->ld.args;
@@ -376,8 +650,20 @@ static void ld_invoke(BuildStepInfo* info) {
     #ifdef CUIK_USE_TB
     TB_Module* mod = s->ld.cu->ir_mod;
 
+    RunCache rc = { 0 };
+    // hits don't have line info (it's not part of the key either) so anything
+    // which wants it skips the cache.
+    bool use_cache = args->run && !args->emit_ir && !args->assembly && !args->run_profile && !args->debug_info && run_cache_dir(args, rc.dir);
     CUIK_TIMED_BLOCK("Backend") {
-        if (args->optimize) {
+        // only the misses (and whatever they can inline) go through the backend,
+        // when everything's cached that's nothing.
+        DynArray(TB_Function*) all = s->ld.cu->worklist;
+        if (use_cache) {
+            run_cache_load(args, s->ld.cu, &rc);
+            s->ld.cu->worklist = rc.to_opt;
+        }
+
+        if (args->optimize && dyn_array_length(s->ld.cu->worklist) > 0) {
             int t = 0;
             do {
                 CUIK_TIMED_BLOCK("Local opts") {
@@ -394,7 +680,27 @@ static void ld_invoke(BuildStepInfo* info) {
             // printf("%s", pre);
         }
 
+        if (use_cache) {
+            s->ld.cu->worklist = rc.misses;
+        }
         cuiksched_per_function(s->tp, args->threads, s->ld.cu, mod, args, apply_func);
+        s->ld.cu->worklist = all;
+
+        if (use_cache) {
+            run_cache_store(s->ld.cu, &rc);
+            dyn_array_destroy(rc.misses);
+            dyn_array_destroy(rc.to_opt);
+        }
+
+        if (args->ra_stats && !args->emit_ir) {
+            TB_RegAllocStats stats;
+            size_t count = tb_module_get_ra_stats(mod, &stats);
+
+            mtx_lock(info->mutex);
+            printf("RA stats (%zu functions):\n", count);
+            tb_ra_stats_print(&stats, stdout);
+            mtx_unlock(info->mutex);
+        }
     }
 
     // Once the frontend is complete we don't need this... unless we wanna keep it
@@ -420,7 +726,9 @@ static void ld_invoke(BuildStepInfo* info) {
     }
 
     if (args->run) {
-        fprintf(stderr, "C JIT unsupported here :(\n");
+        // doesn't come back unless we couldn't run it
+        jit_run(args, mod, output_path.data);
+        step_error(s);
         goto done;
     }
 
@@ -576,6 +884,7 @@ Cuik_BuildStep* cuik_driver_ld(Cuik_DriverArgs* args, int dep_count, Cuik_BuildS
     s->ld.cu->ir_mod = tb_module_create(
         args->target->arch, (TB_System) cuik_get_target_system(args->target), args->run
     );
+    tb_module_set_code_layout(s->ld.cu->ir_mod, &args->layout);
     #endif
 
     for (size_t i = 0; i < dep_count; i++) {
@@ -52,13 +52,17 @@ struct Cuik_Arguments {
     // _[0] is for non-flag arguments
     size_t count[ARG_DESC_COUNT];
     Cuik_Arg* _[ARG_DESC_COUNT];
+
+    // everything after --
+    int run_argc;
+    const char** run_argv;
 };
 
 #define FOR_ARGS(a, arg_i) for (Cuik_Arg* a = args->_[arg_i]; a; a = a->prev)
 
 static void print_help(void) {
     printf("OVERVIEW: Cuik C compiler (built on " __DATE__ ")\n\n");
-    printf("USAGE: cuik [options] file...\n\n");
+    printf("USAGE: cuik [options] file... [-- args...]\n\n");
     printf("OPTIONS:\n");
 
     size_t split = 24;
@@ -121,6 +125,13 @@ CUIK_API void cuik_parse_args(Cuik_Arguments* restrict args, int argc, const cha
             continue;
         }
 
+        // the rest belongs to the program, -run hands it to main
+        if (strcmp("--", first) == 0) {
+            args->run_argc = argc - (i + 1);
+            args->run_argv = &argv[i + 1];
+            break;
+        }
+
         // non-flag argument
         if (first[0] != '-') {
             insert_arg(args, 0)->value = first;
@@ -291,6 +302,15 @@ CUIK_API bool cuik_args_to_driver(Cuik_DriverArgs* comp_args, Cuik_Arguments* re
         comp_args->dep_file = mf->value;
     }
 
+    Cuik_Arg* run_cache = args->_[ARG_RUNCACHE];
+    if (run_cache) {
+        const char* v = run_cache->value;
+        comp_args->run_cache = v[0] == '=' ? v + 1 : v;
+    }
+
+    comp_args->run_argc = args->run_argc;
+    comp_args->run_argv = args->run_argv;
+
     Cuik_Arg* threads = args->_[ARG_THREADS];
     if (threads) {
         if (threads->value != arg_is_set) {
@@ -316,6 +336,37 @@ CUIK_API bool cuik_args_to_driver(Cuik_DriverArgs* comp_args, Cuik_Arguments* re
     #ifdef CUIK_USE_TB
     if (args->_[ARG_OBJECT]) comp_args->flavor = TB_FLAVOR_OBJECT;
     if (args->_[ARG_ASSEMBLY]) comp_args->assembly = true;
+
+    Cuik_Arg* march = args->_[ARG_MARCH];
+    if (march) {
+        // accept both -march=haswell and -march haswell
+        const char* name = march->value;
+        if (name[0] == '=') name += 1;
+
+        TB_Arch arch = comp_args->target ? comp_args->target->arch : TB_ARCH_X86_64;
+        if (!tb_features_from_march(arch, name, &comp_args->features)) {
+            fprintf(stderr, "unknown -march: %s\n", name);
+            return false;
+        }
+    }
+
+    Cuik_Arg* align_funcs = args->_[ARG_ALIGNFUNCS];
+    Cuik_Arg* align_loops = args->_[ARG_ALIGNLOOPS];
+    if (align_funcs) {
+        const char* v = align_funcs->value;
+        comp_args->layout.func_align = atoi(v[0] == '=' ? v + 1 : v);
+    }
+    if (align_loops) {
+        const char* v = align_loops->value;
+        comp_args->layout.loop_align = atoi(v[0] == '=' ? v + 1 : v);
+    }
+    if ((comp_args->layout.func_align & (comp_args->layout.func_align - 1)) || (comp_args->layout.loop_align & (comp_args->layout.loop_align - 1))) {
+        fprintf(stderr, "-falign-functions and -falign-loops need a power of two\n");
+        return false;
+    }
+    if (args->_[ARG_JCCERRATUM]) {
+        comp_args->layout.avoid_jcc_erratum = true;
+    }
     #endif
 
     TOGGLE(ARG_DEPS, write_deps);
@@ -323,6 +374,7 @@ CUIK_API bool cuik_args_to_driver(Cuik_DriverArgs* comp_args, Cuik_Arguments* re
     TOGGLE(ARG_PP, preprocess);
     TOGGLE(ARG_PPTEST, test_preproc);
     TOGGLE(ARG_RUN, run);
+    TOGGLE(ARG_RUNPROFILE, run_profile);
     TOGGLE(ARG_LIVE, live);
     TOGGLE(ARG_AST, ast);
     TOGGLE(ARG_SYNTAX, syntax_only);
@@ -330,6 +382,7 @@ CUIK_API bool cuik_args_to_driver(Cuik_DriverArgs* comp_args, Cuik_Arguments* re
     TOGGLE(ARG_THINK, think);
     TOGGLE(ARG_BASED, based);
     TOGGLE(ARG_TIME, time);
+    TOGGLE(ARG_RASTATS, ra_stats);
     TOGGLE(ARG_DEBUG, debug_info);
     TOGGLE(ARG_EMITIR, emit_ir);
     TOGGLE(ARG_NOLIBC, nocrt);
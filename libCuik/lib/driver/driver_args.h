@@ -31,9 +31,16 @@ X(SUBSYSTEM,   "subsystem",true,  "set windows subsystem (windows only... of cou
 X(ENTRY,       "e",        true,  "set entrypoint")
 // misc
 X(TARGET,      "target",   true,  "change the target system and arch")
+X(MARCH,       "march",    true,  "pick the CPU to tune for (haswell, skylake, znver1...)")
+X(ALIGNFUNCS,  "falign-functions", true, "align function entries to N bytes")
+X(ALIGNLOOPS,  "falign-loops",     true, "align loop headers to N bytes")
+X(JCCERRATUM,  "mbranches-within-32B-boundaries", false, "keep jumps off of 32 byte boundaries (Intel's JCC erratum)")
 X(THREADS,     "j",        false, "enabled multithreaded compilation")
 X(TIME,        "T",        false, "profile the compile times")
+X(RASTATS,     "ra-stats", false, "print register allocator stats (summed across functions)")
 X(THINK,       "think",    false, "aids in thinking about serious problems")
 // run
-X(RUN,         "r",        false, "JIT the executable (NOT READY)")
+X(RUNCACHE,    "run-cache",true,  "where -run caches compiled functions (default ~/.cache/cuik/jit, 'none' disables, so do -g & -run-profile)")
+X(RUNPROFILE,  "run-profile", false, "let perf & gdb see the code -run JITs (perf map, jitdump & GDB's JIT interface)")
+X(RUN,         "r",        false, "JIT the executable and run it in-process")
 #undef X
@@ -2,7 +2,7 @@
 #include "../front/sema.h"
 
 static void set_defines(const Cuik_Target* target, Cuik_CPP* cpp) {
-    target_generic_set_defines(cpp, target->system, true, true);
+    target_generic_set_defines(cpp, target->system, target->pointer_byte_size == 8, true);
 
     cuikpp_define_cstr(cpp, "mips",     "1");
     cuikpp_define_cstr(cpp, "__mips",   "1");
@@ -47,8 +47,9 @@ static Cuik_Target* cuik_target_mips(Cuik_System system, Cuik_Environment env, b
         .env = env,
         .system = system,
 
-        .int_bits = { 8, 16, 32, 64, 64 },
-        .pointer_byte_size = 8,
+        // o32 is ILP32, n64 is LP64
+        .int_bits = { 8, 16, 32, is64bit ? 64 : 32, 64 },
+        .pointer_byte_size = is64bit ? 8 : 4,
 
         #ifdef CUIK_USE_TB
         .arch = is64bit ? TB_ARCH_MIPS64 : TB_ARCH_MIPS32,
@@ -63,11 +64,12 @@ static Cuik_Target* cuik_target_mips(Cuik_System system, Cuik_Environment env, b
 
     cuik_target_build(t);
 
-    // bake out size_t and ptrdiff_t after long long is ready
-    t->size_type = t->unsigned_ints[CUIK_BUILTIN_LLONG];
+    // bake out size_t and ptrdiff_t after the pointer sized int is ready
+    int size_kind = is64bit ? CUIK_BUILTIN_LLONG : CUIK_BUILTIN_INT;
+    t->size_type = t->unsigned_ints[size_kind];
     t->size_type.also_known_as = "size_t";
 
-    t->ptrdiff_type = t->signed_ints[CUIK_BUILTIN_LLONG];
+    t->ptrdiff_type = t->signed_ints[size_kind];
     t->ptrdiff_type.also_known_as = "ptrdiff_t";
 
     return t;
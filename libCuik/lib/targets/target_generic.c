@@ -33,6 +33,10 @@ void target_generic_fill_builtin_table(BuiltinTable* builtins) {
     X(__builtin_trap, " v");
     X(__builtin_clz, "i i");
     X(__builtin_clzll, "L i");
+    X(__builtin_ctz, "i i");
+    X(__builtin_ctzll, "L i");
+    X(__builtin_popcount, "i i");
+    X(__builtin_popcountll, "L i");
     X(__builtin_mul_overflow, ". v");
 
     X(__builtin_unreachable, " v");
@@ -188,6 +192,12 @@ BuiltinResult target_generic_compile_builtin(TranslationUnit* tu, TB_Function* f
     } else if (strcmp(name, "__builtin_clzll") == 0) {
         TB_Node* src = RVAL(1);
         return ZZZ(tb_inst_clz(func, src));
+    } else if (strcmp(name, "__builtin_ctz") == 0 || strcmp(name, "__builtin_ctzll") == 0) {
+        TB_Node* src = RVAL(1);
+        return ZZZ(tb_inst_ctz(func, src));
+    } else if (strcmp(name, "__builtin_popcount") == 0 || strcmp(name, "__builtin_popcountll") == 0) {
+        TB_Node* src = RVAL(1);
+        return ZZZ(tb_inst_popcount(func, src));
     } else if (strcmp(name, "__c11_atomic_exchange") == 0) {
         TB_Node* dst = RVAL(1);
         TB_Node* src = RVAL(2);
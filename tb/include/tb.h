@@ -139,15 +139,33 @@ typedef enum TB_FeatureSet_X64 {
 
     TB_FEATURE_X64_AVX    = (1u << 10u),
     TB_FEATURE_X64_AVX2   = (1u << 11u),
+
+    // F, BW, DQ & VL (x86-64-v4), gives us EVEX and XMM16 - XMM31
+    TB_FEATURE_X64_AVX512 = (1u << 12u),
 } TB_FeatureSet_X64;
 
 typedef enum TB_FeatureSet_Generic {
     TB_FEATURE_FRAME_PTR  = (1u << 0u),
+    // cheaper codegen for code that's expected to be thrown away (JIT's first tier),
+    // skips constant hoisting, list scheduling & the post-RA peepholes.
+    TB_FEATURE_BASELINE   = (1u << 1u),
 } TB_FeatureSet_Generic;
 
+// picks which pipeline model the x64 list scheduler uses (ports, latencies
+// and throughputs), it doesn't change which instructions are legal.
+typedef enum TB_X64Model {
+    TB_X64_MODEL_GENERIC,
+    TB_X64_MODEL_HASWELL,
+    TB_X64_MODEL_SKYLAKE,
+    TB_X64_MODEL_ZEN,
+
+    TB_X64_MODEL_COUNT,
+} TB_X64Model;
+
 typedef struct TB_FeatureSet {
-    uint32_t gen; // TB_FeatureSet_Generic
-    uint32_t x64; // TB_FeatureSet_X64
+    uint32_t gen;       // TB_FeatureSet_Generic
+    uint32_t x64;       // TB_FeatureSet_X64
+    uint32_t x64_model; // TB_X64Model
 } TB_FeatureSet;
 
 typedef enum TB_Linkage {
@@ -470,6 +488,8 @@ typedef enum TB_NodeTypeEnum {
     // each family of machine nodes gets 256 nodes
     // first machine op, we have some generic ops here:
     TB_MACH_X86 = TB_ARCH_X86_64 * 0x100,
+    TB_MACH_A64 = TB_ARCH_AARCH64 * 0x100,
+    TB_MACH_MIPS = TB_ARCH_MIPS32 * 0x100,
 
     // limit on generic nodes
     TB_NODE_TYPE_MAX = TB_ARCH_MAX * 0x100,
@@ -845,6 +865,10 @@ TB_API TB_Module* tb_module_create(TB_Arch arch, TB_System sys, bool is_jit);
 // Creates a module but defaults on the architecture and system based on the host machine
 TB_API TB_Module* tb_module_create_for_host(bool is_jit);
 
+// Fills in the feature bits and scheduling model for a -march style name (haswell,
+// skylake, znver1...), returns false if the name isn't known for that arch.
+TB_API bool tb_features_from_march(TB_Arch arch, const char* name, TB_FeatureSet* out);
+
 // Frees all resources for the TB_Module and it's functions, globals and
 // compiled code.
 TB_API void tb_module_destroy(TB_Module* m);
@@ -854,6 +878,25 @@ TB_API void tb_module_destroy(TB_Module* m);
 // dont and the tls_index is used, it'll crash
 TB_API void tb_module_set_tls_index(TB_Module* m, ptrdiff_t len, const char* name);
 
+// Controls where code is placed, applies to both object files and the JIT. All
+// alignments are in bytes (powers of two), 0 leaves it up to the target.
+typedef struct TB_CodeLayout {
+    // function entry points, it's raised to fit the loop and JCC erratum
+    // alignment since we can only align those relative to the function start.
+    uint32_t func_align;
+    // loop headers get NOP padded onto this alignment...
+    uint32_t loop_align;
+    // ...unless it'd take more than this many bytes (0 means always pad).
+    uint32_t loop_max_pad;
+    // Skylake through Cascade Lake can't cache the decoded uops for jumps (and
+    // macro-fused CMP+Jcc pairs) which cross or end on a 32 byte boundary, this
+    // NOP pads them off of it. x64 only.
+    bool avoid_jcc_erratum;
+} TB_CodeLayout;
+
+// not thread-safe, set it before compiling any functions.
+TB_API void tb_module_set_code_layout(TB_Module* m, const TB_CodeLayout* layout);
+
 // not thread-safe
 TB_API TB_ModuleSectionHandle tb_module_create_section(TB_Module* m, ptrdiff_t len, const char* name, TB_ModuleSectionFlags flags, TB_ComdatType comdat);
 
@@ -883,6 +926,55 @@ struct TB_Assembly {
 // this is where the machine code and other relevant pieces go.
 typedef struct TB_FunctionOutput TB_FunctionOutput;
 
+// number of register classes a target can have (the stack counts as one)
+#define TB_MAX_REG_CLASSES 8
+
+// register allocator & local scheduler bookkeeping for a single function, it's
+// always collected (it's a handful of counters) so you can aggregate it across
+// a module to see how much pressure the codegen is under.
+typedef struct TB_RegAllocStats {
+    // max number of simultaneously live values per register class (indexed
+    // by the target's reg classes, 0 is the stack and is ignored)
+    int max_pressure[TB_MAX_REG_CLASSES];
+
+    // spills: values split onto the stack.
+    // reloads: copies inserted to get spilled values back into registers.
+    // folded_reloads: reloads which piggybacked on an existing copy.
+    // remats: use sites which recomputed the value instead of reloading it.
+    int spills, reloads, folded_reloads, remats;
+
+    // copies: real moves left after RA (spill & reload moves included, same-register
+    //   copies don't count).
+    // coalesced: phi copies deleted before allocation.
+    int copies, coalesced;
+
+    // allocation passes, 1 means we never had to restart because of a spill
+    int rounds;
+
+    // sum of (block_freq * uses_in_block) over everything we spilled
+    float spill_cost;
+
+    // estimated cycles across all blocks according to the list scheduler
+    int sched_cycles;
+
+    // post-RA peepholes (the counters are instructions removed, except for folds
+    // which merge a reload into its user):
+    //   peep_copies: moves into a location which already held the value.
+    //   peep_zexts: zero extensions the previous op already did.
+    //   peep_folds: reloads folded into a memory operand.
+    //   peep_flags: test/cmp against zero after an op which set the flags.
+    int peep_copies, peep_zexts, peep_folds, peep_flags;
+
+    // branch delay slots (MIPS) and how many got something useful instead of a nop
+    int delay_slots, delay_slots_filled;
+
+    // wasm has no registers, locals play that role:
+    //   wasm_insts: instructions in the function bodies.
+    //   wasm_local_ops: how many of those are local.get/set/tee.
+    //   wasm_stackified: values which never touched a local.
+    int wasm_insts, wasm_local_ops, wasm_stackified;
+} TB_RegAllocStats;
+
 TB_API void tb_output_print_asm(TB_FunctionOutput* out, FILE* fp);
 
 TB_API uint8_t* tb_output_get_code(TB_FunctionOutput* out, size_t* out_length);
@@ -893,6 +985,15 @@ TB_API TB_Location* tb_output_get_locations(TB_FunctionOutput* out, size_t* out_
 // returns NULL if no assembly was generated
 TB_API TB_Assembly* tb_output_get_asm(TB_FunctionOutput* out);
 
+TB_API TB_RegAllocStats* tb_output_get_ra_stats(TB_FunctionOutput* out);
+
+// sums up b into a (pressure is max'd since it's not additive)
+TB_API void tb_ra_stats_accumulate(TB_RegAllocStats* a, const TB_RegAllocStats* b);
+TB_API void tb_ra_stats_print(const TB_RegAllocStats* stats, FILE* fp);
+
+// aggregate of every compiled function in the module, returns the number of functions counted
+TB_API size_t tb_module_get_ra_stats(TB_Module* m, TB_RegAllocStats* out);
+
 // this is relative to the start of the function (the start of the prologue)
 TB_API TB_Safepoint* tb_safepoint_get(TB_Function* f, uint32_t relative_ip);
 
@@ -911,15 +1012,120 @@ TB_API void* tb_jit_wasm_obj(TB_Arena* arena, TB_Function* f);
 #else
 typedef struct TB_CPUContext TB_CPUContext;
 
-// passing 0 to jit_heap_capacity will default to 4MiB
+typedef enum {
+    // W^X: back the heap with a memfd that's mapped twice, code and data get written
+    // through the RW view while everything runs (and gets relocated) in the RX one.
+    // Linux only, elsewhere (or if it fails) we go back to RXW pages.
+    TB_JIT_DUAL_MAP = 1,
+
+    // tell profilers & debuggers about every placed function (Linux only, these
+    // are ignored elsewhere):
+    //   PERF_MAP:     appends "start size name" to /tmp/perf-<pid>.map
+    //   PERF_JITDUMP: writes jit-<pid>.dump to $JITDUMPDIR (or the working directory)
+    //                 with code & line tables, for `perf record -k 1` + `perf inject --jit`
+    //   GDB:          registers an ELF with the symbol & DWARF line table through
+    //                 GDB's __jit_debug_register_code, they're dropped at tb_jit_end.
+    TB_JIT_PERF_MAP     = 2,
+    TB_JIT_PERF_JITDUMP = 4,
+    TB_JIT_GDB          = 8,
+} TB_JITFlags;
+
+typedef enum {
+    TB_JIT_TIER_NONE,      // not called yet (or not tiered)
+    TB_JIT_TIER_BASELINE,
+    TB_JIT_TIER_OPTIMIZED,
+} TB_JITTier;
+
+// jit_heap_capacity is how much gets mapped at a time (passing 0 will default to 2MiB),
+// the heap grows by that much whenever it runs out.
+TB_API TB_JIT* tb_jit_begin_flags(TB_Module* m, size_t jit_heap_capacity, TB_JITFlags flags);
+// same as above, dual mapped on ARM64 and RXW everywhere else.
 TB_API TB_JIT* tb_jit_begin(TB_Module* m, size_t jit_heap_capacity);
+// placing fails (NULL) if anything it would place along with it refers to an
+// external which none of the resolvers, the host or the loaded libraries have,
+// tb_jit_get_undefined says which. lazily placed code panics instead.
 TB_API void* tb_jit_place_function(TB_JIT* jit, TB_Function* f);
 TB_API void* tb_jit_place_global(TB_JIT* jit, TB_Global* g);
+TB_API const char* tb_jit_get_undefined(TB_JIT* jit);
+// lazy binding: callees which aren't placed yet get a stub that compiles (tb_opt if
+// optimize, then tb_codegen into code_arena) and places them on their first call, so
+// placing a function doesn't drag the rest of the call graph along. compiles are
+// serialized and use the function's own arenas, don't touch those while the JIT's
+// running. features may be NULL.
+TB_API void tb_jit_enable_lazy(TB_JIT* jit, TB_Arena* code_arena, const TB_FeatureSet* features, bool optimize);
+// tiered compilation: lazy binding where the first call only gets baseline code (no
+// tb_opt, TB_FEATURE_BASELINE) which counts calls & loop trips. a background thread
+// recompiles functions which pass hot_threshold with tb_opt into code_arena and swaps
+// their stub over, calls always go through the stub so the optimized code is picked
+// up on the next call (loops which are already running stay in the baseline code).
+// functions which were compiled beforehand are placed as-is. if lazy binding is already
+// on tiering takes it over (anything it compiled so far stays as it is), enabling
+// tiering twice is an error.
+TB_API void tb_jit_enable_tiering(TB_JIT* jit, TB_Arena* code_arena, const TB_FeatureSet* features, uint32_t hot_threshold);
+TB_API TB_JITTier tb_jit_get_tier(TB_JIT* jit, TB_Function* f);
 TB_API void* tb_jit_alloc_obj(TB_JIT* jit, size_t size, size_t align);
 TB_API void tb_jit_free_obj(TB_JIT* jit, void* ptr);
-TB_API void tb_jit_dump_heap(TB_JIT* jit);
 TB_API void tb_jit_end(TB_JIT* jit);
 
+// unplacing: the function's code (and its baseline when tiered) is retired, placed
+// callers which called it directly are patched to go through its stub which places
+// it again on the next call (so its output has to stick around while anything that
+// calls it is placed). pointers to it in placed globals get the stub too, addresses
+// which escaped any other way aren't tracked. don't unplace a function while something
+// which refers to it is being placed.
+//
+// retired memory is only reused once no thread could still be running it: threads
+// calling JIT code directly bracket those calls with tb_jit_enter & tb_jit_exit,
+// TB_CPUContexts do it on their own from tb_jit_thread_call until the call returns
+// (a thread stopped at a safepoint or breakpoint still counts as running). nothing
+// ever waits on them, whatever's been retired is checked on the next retire and
+// tb_jit_collect.
+TB_API void tb_jit_unplace_function(TB_JIT* jit, TB_Function* f);
+// tb_jit_free_obj but deferred like unplaced code.
+TB_API void tb_jit_retire_obj(TB_JIT* jit, void* ptr);
+// frees whatever's safe to, returns how many retired objects are still waiting.
+TB_API size_t tb_jit_collect(TB_JIT* jit);
+TB_API uint32_t tb_jit_enter(TB_JIT* jit);
+TB_API void tb_jit_exit(TB_JIT* jit, uint32_t epoch);
+
+typedef struct {
+    size_t reserved, mapped;
+    // whole free chunks, the longest run of them and 1 - largest/free (0 when
+    // it's all in one piece, closer to 1 the more scattered it is).
+    size_t free_bytes, largest_free;
+    double fragmentation;
+    // chunks in use by size classed objects, code (& aligned objects) and big objects
+    size_t small_bytes, code_bytes, large_bytes;
+    // live allocations in small chunks and in code/large chunks
+    size_t small_objects, code_objects;
+    // placed code, a tiered function counts its baseline too
+    size_t placed_functions;
+    // unplaced/retired allocations which are waiting on a tb_jit_exit
+    size_t retired_objects;
+} TB_JITHeapStats;
+
+TB_API void tb_jit_heap_stats(TB_JIT* jit, TB_JITHeapStats* out);
+// the stats and every chunk in the heap
+TB_API void tb_jit_dump_heap(TB_JIT* jit);
+
+// host symbols: externals which weren't bound with tb_symbol_bind_ptr get looked up
+// in the symbol tables & resolvers (in the order they were added), then the host
+// process (dlsym(RTLD_DEFAULT) or the usual Windows DLLs) and then the loaded
+// libraries. hits are cached, targets outside of rel32 range get a far thunk.
+typedef struct {
+    const char* name;
+    void* address;
+} TB_JITSymbol;
+
+typedef void* (*TB_JITResolver)(void* user_data, const char* name);
+
+// the table isn't copied, it needs to outlive the JIT.
+TB_API void tb_jit_add_symbols(TB_JIT* jit, size_t count, const TB_JITSymbol* syms);
+TB_API void tb_jit_add_resolver(TB_JIT* jit, TB_JITResolver fn, void* user_data);
+// dlopen/LoadLibrary, returns false if the library couldn't be loaded.
+TB_API bool tb_jit_load_library(TB_JIT* jit, const char* path);
+TB_API void* tb_jit_resolve_symbol(TB_JIT* jit, const char* name);
+
 typedef struct {
     void* tag;
     uint32_t offset;
@@ -929,26 +1135,44 @@ TB_API void* tb_jit_resolve_addr(TB_JIT* jit, void* ptr, uint32_t* offset);
 TB_API void* tb_jit_get_code_ptr(TB_Function* f);
 
 // you can take an tag an allocation, fresh space for random userdata :)
+// resolving doesn't take any locks (it's meant for symbolizing profiler samples),
+// freeing an object drops its tag.
 TB_API void tb_jit_tag_object(TB_JIT* jit, void* ptr, void* tag);
+TB_API void tb_jit_untag_object(TB_JIT* jit, void* ptr);
 
 // Debugger stuff
 //   creates a new context we can run JIT code in, you don't
 //   technically need this but it's a nice helper for writing
 //   JITs especially when it comes to breakpoints (and eventually
 //   safepoints)
+//
+//   on Linux (x64) it's signal based: breakpoints & single-stepping are SIGTRAPs,
+//   safepoint polls read the poll site and a SIGSEGV there stops the thread.
+//   the handlers are installed the first time a thread runs JIT code and pass
+//   along anything that isn't ours.
 TB_API TB_CPUContext* tb_jit_thread_create(TB_JIT* jit, size_t ud_size);
+TB_API void tb_jit_thread_destroy(TB_CPUContext* cpu);
 TB_API void* tb_jit_thread_get_userdata(TB_CPUContext* cpu);
 TB_API void tb_jit_breakpoint(TB_JIT* jit, void* addr);
 
-// offsetof pollsite in the CPUContext
+// offsetof pollsite in the CPUContext, that's the address a TB_SAFEPOINT_POLL
+// should read.
 TB_API size_t tb_jit_thread_pollsite(void);
 
+// the thread stops at the next safepoint poll it runs, can be called from any
+// thread. the poll site is disarmed again once it's stopped.
+TB_API void tb_jit_thread_interrupt(TB_CPUContext* cpu);
+
 // Only relevant when you're pausing the thread
 TB_API void* tb_jit_thread_pc(TB_CPUContext* cpu);
 TB_API void* tb_jit_thread_sp(TB_CPUContext* cpu);
 
+// returns true if it stopped (breakpoint, safepoint) before returning
 TB_API bool tb_jit_thread_call(TB_CPUContext* cpu, void* pc, uint64_t* ret, size_t arg_count, void** args);
 
+// continues a stopped thread, same deal as tb_jit_thread_call
+TB_API bool tb_jit_thread_resume(TB_CPUContext* cpu, uint64_t* ret);
+
 // returns true if we stepped off the end and returned through the trampoline
 TB_API bool tb_jit_thread_step(TB_CPUContext* cpu, uint64_t* ret, uintptr_t pc_start, uintptr_t pc_end);
 #endif
@@ -1453,6 +1677,32 @@ TB_API void *tb_gcc_function_ptr(TB_GCCJIT_Function *func);
 //   if code_arena is NULL, the IR arena will be used.
 TB_API TB_FunctionOutput* tb_codegen(TB_Function* f, TB_Worklist* ws, TB_Arena* code_arena, const TB_FeatureSet* features, bool emit_asm);
 
+// code cache:
+//   on-disk cache of compiled functions, the key is a hash of the function's IR
+//   (before tb_opt) along with the target, features & code layout and each entry is
+//   the relocatable machine code in dir/<hex of hash>. A hit sets up the function's
+//   output like tb_codegen would minus the assembly & line info, which is all the
+//   JIT needs. Line info isn't part of the key either (moving code around shouldn't
+//   miss) so anything which wants it (TB_JIT_PERF_JITDUMP, TB_JIT_GDB) has to skip
+//   the cache.
+typedef struct {
+    uint8_t hash[16];
+
+    // symbols in the order the IR referenced them, cached relocations are
+    // stored as indices into this.
+    size_t sym_count;
+    TB_Symbol** syms;
+} TB_CacheKey;
+
+// returns false if the function can't be cached (inline asm, no IR...), syms go into the arena.
+TB_API bool tb_cache_key(TB_Function* f, TB_Arena* arena, const TB_FeatureSet* features, TB_CacheKey* out_key);
+// rehashes the key with some extra bytes (compiler flags, the rest of the module...)
+TB_API void tb_cache_key_salt(TB_CacheKey* key, size_t len, const void* salt);
+// returns false on a miss (or a broken entry).
+TB_API bool tb_cache_load(const char* dir, const TB_CacheKey* key, TB_Function* f, TB_Arena* code_arena);
+// call after tb_codegen, dir is created if it's missing.
+TB_API bool tb_cache_store(const char* dir, const TB_CacheKey* key, TB_Function* f);
+
 // interprocedural optimizer iter
 TB_API bool tb_module_ipo(TB_Module* m);
 
@@ -1545,7 +1795,7 @@ TB_API int tb_builder_label_pred_count(TB_GraphBuilder* g, TB_Node* label);
 //   kill node
 TB_API void tb_builder_label_kill(TB_GraphBuilder* g, TB_Node* label);
 //   returns an array of TB_GraphCtrl which represent each path on the
-//   branch, [0] is the false case and [1] is the true case.
+//   branch, [0] is the true case and [1] is the false case.
 TB_API void tb_builder_if(TB_GraphBuilder* g, TB_Node* cond, TB_Node* paths[2]);
 //   unconditional jump to target
 TB_API void tb_builder_br(TB_GraphBuilder* g, TB_Node* target);
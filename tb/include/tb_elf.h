@@ -33,6 +33,10 @@
 #define TB_EM_X86_64  62  /* Advanced Micro Devices x86-64 */
 #define TB_EM_AARCH64 183 /* AArch64 (64-bit ARM) */
 
+/* Values for e_flags on MIPS. */
+#define TB_EF_MIPS_NOREORDER 0x00000001 /* delay slots are already filled */
+#define TB_EF_MIPS_ARCH_64R2 0x80000000 /* MIPS64 Release 2 */
+
 /* sh_type */
 #define TB_SHT_NULL     0 /* inactive */
 #define TB_SHT_PROGBITS 1 /* program defined information */
@@ -80,6 +84,17 @@ typedef enum {
     TB_ELF_X86_64_GOT32    = 3,
     TB_ELF_X86_64_PLT32    = 4,
     TB_ELF_X86_64_GOTPCREL = 9,
+
+    TB_ELF_AARCH64_ABS64            = 257,
+    TB_ELF_AARCH64_PREL32           = 261,
+    TB_ELF_AARCH64_ADR_PREL_PG_HI21 = 275,
+    TB_ELF_AARCH64_ADD_ABS_LO12_NC  = 277,
+    TB_ELF_AARCH64_JUMP26           = 282,
+    TB_ELF_AARCH64_CALL26           = 283,
+
+    TB_ELF_MIPS_26   = 4,
+    TB_ELF_MIPS_HI16 = 5,
+    TB_ELF_MIPS_LO16 = 6,
 } TB_ELF_RelocType;
 
 // ST_TYPE
@@ -34,11 +34,17 @@ typedef enum {
     // set if the r/m can be found on the right hand side
     TB_X86_INSTR_DIRECTION = (1u << 3u),
 
+    // VEX (or EVEX) encoded, the extra reg (if not 0xFF) is the vvvv operand
+    TB_X86_INSTR_VEX = (1u << 4u),
+
     // REP prefix is present
     TB_X86_INSTR_REP = (1u << 5u),
 
     // REPNE prefix is present
     TB_X86_INSTR_REPNE = (1u << 6u),
+
+    // VEX.L is set, the vector operands are ymm
+    TB_X86_INSTR_VEX256 = (1u << 7u),
 } TB_X86_InstFlags;
 
 typedef enum {
@@ -73,19 +79,20 @@ typedef enum {
     TB_X86_F64x2,   // pd
 
     TB_X86_XMMWORD, // the generic idea of them
+    TB_X86_YMMWORD,
 } TB_X86_DataType;
 
 typedef struct {
     uint16_t opcode;
 
-    // packed 16bits
-    uint16_t scale  : 2;
-    uint16_t flags  : 6;
-    uint16_t dt     : 4;
-    uint16_t dt2    : 4;
+    // packed 32bits
+    uint32_t scale  : 2;
+    uint32_t flags  : 8;
+    uint32_t dt     : 4;
+    uint32_t dt2    : 4;
 
     // each 8bits are a different reg (lowest bits to higher):
-    //   base, index, rx, extra
+    //   base, index, rx, extra (VEX.vvvv)
     uint32_t regs;
     int32_t disp;
 
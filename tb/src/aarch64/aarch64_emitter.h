@@ -1,4 +1,14 @@
 
+typedef union {
+    float f;
+    uint32_t i;
+} Cvt_F32U32;
+
+typedef union {
+    double f;
+    uint64_t i;
+} Cvt_F64U64;
+
 // Xn refers to the 64bit variants of the registers,
 // usually the 32bit aliases are Wn (we don't have enums
 // for them because it's not that important, they're equal)
@@ -8,6 +18,9 @@ typedef enum {
     X16, X17, X18, X19, X20, X21, X22, X23,
     X24, X25, X26, X27, X28, X29, X30,
 
+    // intra-procedure scratch, the linker veneers are allowed to clobber
+    // these so they're never allocated, we use them for big immediates.
+    IP0 = 16, IP1 = 17,
     // frame pointer
     FP = 29,
     // link register is basically just the RPC
@@ -19,65 +32,94 @@ typedef enum {
     GPR_NONE = -1,
 } GPR;
 
-// refers to the data processing immediate operand.
-// Aarch64 has a bunch of weird immediate fields so
-// we might wanna rename this later.
-typedef struct {
-    uint16_t imm;
-    uint8_t shift;
-} Immediate;
-
+// condition codes, flipping the bottom bit inverts them (except AL/NV)
 typedef enum {
-    ADD,
-    SUB,
-    EOR,
-    UDIV,
-    SDIV,
-} DPOpcode;
+    EQ, NE, HS, LO, MI, PL, VS, VC,
+    HI, LS, GE, LT, GT, LE, AL, NV,
+} Cond;
 
 enum {
     SHIFT_LSL,
     SHIFT_LSR,
     SHIFT_ASR,
-    SHIFT_RESERVED,
+    SHIFT_ROR,
 };
 
-typedef struct {
-    uint32_t r, i;
-} DPInst;
-
-// op0  30-29
-// op1  28
-// 101  27-25
-// op2  24-21
-// op3  15-10
-#define DPR(op0, op1, op2, op3) ((op0 << 29u) | (op1 << 28) | (0b101 << 25) | (op2 << 21) | (op3 << 10))
-// op   30
-// 100  28-26
-// op0  25-23
-#define DPI(op, op0) ((op << 30u) | (0b100 << 26u) | (op0 << 23u))
-
-#define DP3(op0, op1, op2) ((op0 << 30u) | (op1 << 28u) | (0b101 << 25u) | (op2 << 21u))
-
-static const DPInst inst_table[] = {
-    //         register                     immediate
-    [ADD]  = { DPR(0, 0, 0b1000, 0),        DPI(0, 0b010) },
-    [SUB]  = { DPR(2, 0, 0b1000, 0),        DPI(1, 0b010) },
-    [EOR]  = { 0b01001010000 << 21u,         0 },
-
-    [UDIV] = { DPR(0, 1, 0b0110, 0b000010) },
-    [SDIV] = { DPR(0, 1, 0b0110, 0b000011) },
+// logical ops (the opc field), with N set they invert the second operand
+// so AND -> BIC, ORR -> ORN, EOR -> EON.
+enum {
+    LOGIC_AND,
+    LOGIC_ORR,
+    LOGIC_EOR,
+    LOGIC_ANDS,
+};
+
+// move wide (the opc field)
+enum {
+    MOVN = 0,
+    MOVZ = 2,
+    MOVK = 3,
+};
+
+// bitfield moves (the opc field)
+enum {
+    SBFM = 0,
+    BFM  = 1,
+    UBFM = 2,
+};
+
+// data processing, 1 source (the opcode field)
+enum {
+    DP1_RBIT  = 0,
+    DP1_REV16 = 1,
+    DP1_REV32 = 2, // REV on the 32bit variant
+    DP1_REV64 = 3,
+    DP1_CLZ   = 4,
 };
 
+// data processing, 2 source (the opcode field)
 enum {
-    UBFM = DPI(0, 0b110) | (0b10 << 29u),
+    DP2_UDIV = 0b000010,
+    DP2_SDIV = 0b000011,
+    DP2_LSLV = 0b001000,
+    DP2_LSRV = 0b001001,
+    DP2_ASRV = 0b001010,
+    DP2_RORV = 0b001011,
+};
 
+enum {
     //                       op0
     //                       V
     MADD = 0b00011011000000000000000000000000,
     MSUB = 0b00011011000000001000000000000000,
 };
 
+// float ops, 2 source (the opcode field)
+enum {
+    FP2_FMUL, FP2_FDIV, FP2_FADD, FP2_FSUB,
+    FP2_FMAX, FP2_FMIN, FP2_FMAXNM, FP2_FMINNM,
+};
+
+// float ops, 1 source (the opcode field)
+enum {
+    FP1_FMOV  = 0,
+    FP1_FABS  = 1,
+    FP1_FNEG  = 2,
+    FP1_FSQRT = 3,
+    FP1_FCVT_S = 4, // to single
+    FP1_FCVT_D = 5, // to double
+};
+
+// int <-> float conversions & moves, (rmode << 3) | opcode
+enum {
+    FCVT_SCVTF  = 0b00010,
+    FCVT_UCVTF  = 0b00011,
+    FCVT_FMOV_I = 0b00111, // gpr -> fpr
+    FCVT_FMOV_F = 0b00110, // fpr -> gpr
+    FCVT_FCVTZS = 0b11000,
+    FCVT_FCVTZU = 0b11001,
+};
+
 static void emit_ret(TB_CGEmitter* restrict e, GPR rn) {
     // 1101 0110 0101 1111 0000 00NN NNN0 0000
     //
@@ -88,6 +130,69 @@ static void emit_ret(TB_CGEmitter* restrict e, GPR rn) {
     EMIT4(e, inst);
 }
 
+// 'br rn', like ret but without the return hint
+static void emit_br(TB_CGEmitter* restrict e, GPR rn) {
+    // 1101 0110 0001 1111 0000 00NN NNN0 0000
+    uint32_t inst = 0b11010110000111110000000000000000;
+    inst |= (rn & 0b11111) << 5u;
+    EMIT4(e, inst);
+}
+
+// 'blr rn'
+static void emit_blr(TB_CGEmitter* restrict e, GPR rn) {
+    // 1101 0110 0011 1111 0000 00NN NNN0 0000
+    uint32_t inst = 0b11010110001111110000000000000000;
+    inst |= (rn & 0b11111) << 5u;
+    EMIT4(e, inst);
+}
+
+// 'b imm26', the displacement is in words relative to the branch
+static void emit_b(TB_CGEmitter* restrict e, int32_t disp) {
+    // 0001 01II IIII IIII IIII IIII IIII IIII
+    uint32_t inst = 0b00010100000000000000000000000000;
+    inst |= disp & 0x3FFFFFF;
+    EMIT4(e, inst);
+}
+
+// 'bl imm26'
+static void emit_bl(TB_CGEmitter* restrict e, int32_t disp) {
+    // 1001 01II IIII IIII IIII IIII IIII IIII
+    uint32_t inst = 0b10010100000000000000000000000000;
+    inst |= disp & 0x3FFFFFF;
+    EMIT4(e, inst);
+}
+
+// 'b.cond imm19'
+static void emit_bcond(TB_CGEmitter* restrict e, Cond cc, int32_t disp) {
+    // 0101 0100 IIII IIII IIII IIII III0 CCCC
+    uint32_t inst = 0b01010100000000000000000000000000;
+    inst |= (disp & 0x7FFFF) << 5u;
+    inst |= cc & 0xF;
+    EMIT4(e, inst);
+}
+
+// 'cbz rt, imm19' or 'cbnz rt, imm19'
+static void emit_cbz(TB_CGEmitter* restrict e, bool nz, GPR rt, int32_t disp, bool _64bit) {
+    // A011 010Z IIII IIII IIII IIII IIIT TTTT
+    uint32_t inst = 0b00110100000000000000000000000000 | (_64bit ? (1u << 31u) : 0);
+    inst |= (nz ? 1 : 0) << 24u;
+    inst |= (disp & 0x7FFFF) << 5u;
+    inst |= rt & 0x1F;
+    EMIT4(e, inst);
+}
+
+// 'tbz rt, #bit, imm14' or 'tbnz rt, #bit, imm14'
+static void emit_tbz(TB_CGEmitter* restrict e, bool nz, GPR rt, int bit, int32_t disp) {
+    // B011 011Z BBBB BIII IIII IIII IIIT TTTT
+    uint32_t inst = 0b00110110000000000000000000000000;
+    inst |= ((bit >> 5) & 1) << 31u;
+    inst |= (nz ? 1 : 0) << 24u;
+    inst |= (bit & 0x1F) << 19u;
+    inst |= (disp & 0x3FFF) << 5u;
+    inst |= rt & 0x1F;
+    EMIT4(e, inst);
+}
+
 // OP Rd, Rn, Rm, Ra
 static void emit_dp3(TB_CGEmitter* restrict e, uint32_t inst, GPR d, GPR n, GPR m, GPR a, bool _64bit) {
     inst |= (_64bit ? (1u << 31u) : 0);
@@ -98,37 +203,115 @@ static void emit_dp3(TB_CGEmitter* restrict e, uint32_t inst, GPR d, GPR n, GPR
     EMIT4(e, inst);
 }
 
-// data processing instruction
-//   OP dst, src, imm
+// OP Rd, Rn, Rm
+static void emit_dp2(TB_CGEmitter* restrict e, int op, GPR d, GPR n, GPR m, bool _64bit) {
+    // A001 1010 110M MMMM OOOO OONN NNND DDDD
+    uint32_t inst = 0b00011010110000000000000000000000 | (_64bit ? (1u << 31u) : 0);
+    inst |= (m & 0x1F) << 16u;
+    inst |= (op & 0x3F) << 10u;
+    inst |= (n & 0x1F) << 5u;
+    inst |= (d & 0x1F) << 0u;
+    EMIT4(e, inst);
+}
+
+// OP Rd, Rn
+static void emit_dp1(TB_CGEmitter* restrict e, int op, GPR d, GPR n, bool _64bit) {
+    // A101 1010 1100 0000 00OO OONN NNND DDDD
+    uint32_t inst = 0b01011010110000000000000000000000 | (_64bit ? (1u << 31u) : 0);
+    inst |= (op & 0x3F) << 10u;
+    inst |= (n & 0x1F) << 5u;
+    inst |= (d & 0x1F) << 0u;
+    EMIT4(e, inst);
+}
+
+// add/sub (immediate)
+//   OP Rd, Rn, imm12 {, lsl 12}
 //
-// 0000 0000 0000 0000 0000 0000 0000 0000
-// AOOO OOOO SSII IIII IIII IINN NNND DDDD
+// ASS1 0001 0HII IIII IIII IINN NNND DDDD
 //
 // A - set when we're doing the 64bit variant of the instruction
-// O - is the opcode
-// S - shift
+// S - sub & setflags bits
+// H - shift the immediate by 12
 // I - immediate
-// N - source
-// D - destination
-static void emit_dp_imm(TB_CGEmitter* restrict e, DPOpcode op, GPR dst, GPR src, uint16_t imm, uint8_t shift, bool _64bit) {
-    uint32_t inst = inst_table[op].i | (_64bit ? (1u << 31u) : 0);
-
-    if (op == ADD || op == SUB) {
-        assert(shift == 0 || shift == 12);
-        inst |= (1 << 22u);
-    } else if (op == UBFM) {
-        inst |= (1 << 22u);
-    }
-
+// N - source (SP when it's 31)
+// D - destination (SP when it's 31 unless it sets flags)
+static void emit_addsub_imm(TB_CGEmitter* restrict e, bool sub, bool set_flags, GPR d, GPR n, uint32_t imm, bool lsl12, bool _64bit) {
+    assert(imm < 4096);
+    uint32_t inst = 0b00010001000000000000000000000000 | (_64bit ? (1u << 31u) : 0);
+    inst |= (sub ? 1u : 0) << 30u;
+    inst |= (set_flags ? 1u : 0) << 29u;
+    inst |= (lsl12 ? 1u : 0) << 22u;
     inst |= (imm & 0xFFF) << 10u;
-    inst |= (src & 0x1F) << 5u;
-    inst |= (dst & 0x1F) << 0u;
+    inst |= (n & 0x1F) << 5u;
+    inst |= (d & 0x1F) << 0u;
+    EMIT4(e, inst);
+}
+
+// add/sub (shifted register)
+//   OP Rd, Rn, Rm {, shift amount}
+//
+// ASS0 1011 HH0M MMMM IIII IINN NNND DDDD
+static void emit_addsub_reg(TB_CGEmitter* restrict e, bool sub, bool set_flags, GPR d, GPR n, GPR m, int shift, int amount, bool _64bit) {
+    assert(shift != SHIFT_ROR);
+    uint32_t inst = 0b00001011000000000000000000000000 | (_64bit ? (1u << 31u) : 0);
+    inst |= (sub ? 1u : 0) << 30u;
+    inst |= (set_flags ? 1u : 0) << 29u;
+    inst |= (shift & 3) << 22u;
+    inst |= (m & 0x1F) << 16u;
+    inst |= (amount & 0x3F) << 10u;
+    inst |= (n & 0x1F) << 5u;
+    inst |= (d & 0x1F) << 0u;
+    EMIT4(e, inst);
+}
+
+// add/sub (extended register), we only use it with UXTX since that's
+// the flavor which is allowed to touch SP.
+//   OP Xd|SP, Xn|SP, Xm
+static void emit_addsub_ext(TB_CGEmitter* restrict e, bool sub, GPR d, GPR n, GPR m) {
+    // 1S00 1011 001M MMMM 0110 00NN NNND DDDD
+    uint32_t inst = 0b10001011001000000110000000000000;
+    inst |= (sub ? 1u : 0) << 30u;
+    inst |= (m & 0x1F) << 16u;
+    inst |= (n & 0x1F) << 5u;
+    inst |= (d & 0x1F) << 0u;
+    EMIT4(e, inst);
+}
+
+// logical (shifted register)
+//   OP Rd, Rn, Rm {, shift amount}
+//
+// AOO0 1010 HHIM MMMM SSSS SSNN NNND DDDD
+//
+// I - inverts Rm (bic, orn, eon, bics)
+static void emit_logic_reg(TB_CGEmitter* restrict e, int op, bool invert, GPR d, GPR n, GPR m, int shift, int amount, bool _64bit) {
+    uint32_t inst = 0b00001010000000000000000000000000 | (_64bit ? (1u << 31u) : 0);
+    inst |= (op & 3) << 29u;
+    inst |= (shift & 3) << 22u;
+    inst |= (invert ? 1u : 0) << 21u;
+    inst |= (m & 0x1F) << 16u;
+    inst |= (amount & 0x3F) << 10u;
+    inst |= (n & 0x1F) << 5u;
+    inst |= (d & 0x1F) << 0u;
+    EMIT4(e, inst);
+}
+
+// logical (immediate), the immediate is pre-encoded as N:immr:imms (see encode_logical_imm)
+//
+// AOO1 0010 0NRR RRRR SSSS SSNN NNND DDDD
+static void emit_logic_imm(TB_CGEmitter* restrict e, int op, GPR d, GPR n, uint32_t bitmask, bool _64bit) {
+    uint32_t inst = 0b00010010000000000000000000000000 | (_64bit ? (1u << 31u) : 0);
+    inst |= (op & 3) << 29u;
+    inst |= (bitmask & 0x1FFF) << 10u;
+    inst |= (n & 0x1F) << 5u;
+    inst |= (d & 0x1F) << 0u;
     EMIT4(e, inst);
 }
 
 // bitfield
-static void emit_bitfield(TB_CGEmitter* restrict e, uint32_t op, GPR dst, GPR src, uint8_t immr, uint8_t imms, bool _64bit) {
-    uint32_t inst = op | (_64bit ? (1u << 31u) : 0);
+static void emit_bitfield(TB_CGEmitter* restrict e, int op, GPR dst, GPR src, uint8_t immr, uint8_t imms, bool _64bit) {
+    // AOO1 0011 0NRR RRRR SSSS SSNN NNND DDDD
+    uint32_t inst = 0b00010011000000000000000000000000 | (_64bit ? (1u << 31u) | (1u << 22u) : 0);
+    inst |= (op & 3) << 29u;
     inst |= (immr & 0b111111) << 16u;
     inst |= (imms & 0b111111) << 10u;
     inst |= (src  & 0b11111) << 5u;
@@ -136,26 +319,26 @@ static void emit_bitfield(TB_CGEmitter* restrict e, uint32_t op, GPR dst, GPR sr
     EMIT4(e, inst);
 }
 
-// data processing instruction
-//   OP dst, a, b
-//
-// 0000 0000 0000 0000 0000 0000 0000 0000
-// AOOO OOOO SS_M MMMM IIII IINN NNND DDDD
-// x101 1110 xx1m mmmm x000 01nn nnnd dddd  -  add Sd Sn Sm
-static void emit_dp_r(TB_CGEmitter* restrict e, DPOpcode op, GPR dst, GPR a, GPR b, uint16_t imm, uint8_t shift, bool _64bit) {
-    uint32_t inst = inst_table[op].r | (_64bit ? (1u << 31u) : 0);
-
-    if (op == ADD || op == SUB) {
-        assert(shift == 0 || shift == 12);
-        inst |= (1 << 22u);
-    } else if (op == UBFM) {
-        if (shift) inst |= (1 << 22u);
-    }
+// 'extr rd, rn, rm, #lsb', with rn == rm it's a rotate right
+static void emit_extr(TB_CGEmitter* restrict e, GPR d, GPR n, GPR m, int lsb, bool _64bit) {
+    // A001 0011 1N0M MMMM SSSS SSNN NNND DDDD
+    uint32_t inst = 0b00010011100000000000000000000000 | (_64bit ? (1u << 31u) | (1u << 22u) : 0);
+    inst |= (m & 0x1F) << 16u;
+    inst |= (lsb & 0x3F) << 10u;
+    inst |= (n & 0x1F) << 5u;
+    inst |= (d & 0x1F) << 0u;
+    EMIT4(e, inst);
+}
 
-    inst |= (b & 0b11111) << 16u;
-    inst |= (imm & 0xFFF) << 10u;
-    inst |= (a & 0b11111) << 5u;
-    inst |= (dst & 0b11111) << 0u;
+// 'csel rd, rn, rm, cond' (or csinc with inc set)
+static void emit_csel(TB_CGEmitter* restrict e, bool inc, GPR d, GPR n, GPR m, Cond cc, bool _64bit) {
+    // A001 1010 100M MMMM CCCC 0INN NNND DDDD
+    uint32_t inst = 0b00011010100000000000000000000000 | (_64bit ? (1u << 31u) : 0);
+    inst |= (m & 0x1F) << 16u;
+    inst |= (cc & 0xF) << 12u;
+    inst |= (inc ? 1u : 0) << 10u;
+    inst |= (n & 0x1F) << 5u;
+    inst |= (d & 0x1F) << 0u;
     EMIT4(e, inst);
 }
 
@@ -169,18 +352,325 @@ static void emit_mov(TB_CGEmitter* restrict e, uint8_t dst, uint8_t src, bool _6
     EMIT4(e, inst);
 }
 
-// clear means movz, else movk
-static void emit_movimm(TB_CGEmitter* restrict e, uint8_t dst, uint16_t imm, uint8_t shift, bool _64bit, bool clear) {
-    uint32_t inst = (_64bit ? (1 << 31u) : 0);
+// move wide (immediate)
+//   OP Rd, imm16 {, lsl hw*16}
+static void emit_movw(TB_CGEmitter* restrict e, int op, GPR dst, uint16_t imm, int hw, bool _64bit) {
+    // AOO1 0010 1HHI IIII IIII IIII IIID DDDD
+    uint32_t inst = 0b00010010100000000000000000000000 | (_64bit ? (1u << 31u) : 0);
+    inst |= (op & 3) << 29u;
+    inst |= (hw & 3) << 21u;
+    inst |= imm << 5u;
+    inst |= (dst & 0b11111) << 0u;
+    EMIT4(e, inst);
+}
+
+// 'adr rd, imm21', pc relative (filled in by patch_jump_table)
+static void emit_adr(TB_CGEmitter* restrict e, GPR dst) {
+    // 0II1 0000 IIII IIII IIII IIII IIID DDDD
+    EMIT4(e, 0b00010000000000000000000000000000 | (dst & 0x1F));
+}
+
+// 'adrp rd, imm21', page relative (the linker fills it)
+static void emit_adrp(TB_CGEmitter* restrict e, GPR dst) {
+    // 1II1 0000 IIII IIII IIII IIII IIID DDDD
+    EMIT4(e, 0b10010000000000000000000000000000 | (dst & 0x1F));
+}
+
+// load/store register (unsigned immediate)
+//   OP Rt, [Rn, #imm12 * size]
+//
+// ZZ11 1V01 OOII IIII IIII IINN NNNT TTTT
+//
+// Z - log2 of the access size
+// V - it's a float register
+// O - opc, 0 store, 1 zero-extended load, 2 sign-extended load into 64bit,
+//     3 sign-extended load into 32bit.
+static void emit_ldst_imm(TB_CGEmitter* restrict e, int size, bool v, int opc, int t, GPR n, uint32_t imm12) {
+    assert(imm12 < 4096);
+    uint32_t inst = 0b00111001000000000000000000000000;
+    inst |= (size & 3) << 30u;
+    inst |= (v ? 1u : 0) << 26u;
+    inst |= (opc & 3) << 22u;
+    inst |= imm12 << 10u;
+    inst |= (n & 0x1F) << 5u;
+    inst |= (t & 0x1F) << 0u;
+    EMIT4(e, inst);
+}
 
-    if (clear) {
-        inst |= (0b010100101 << 23u);
+// load/store register (unscaled immediate), ldur/stur
+//   OP Rt, [Rn, #simm9]
+static void emit_ldst_unscaled(TB_CGEmitter* restrict e, int size, bool v, int opc, int t, GPR n, int32_t imm9) {
+    // ZZ11 1V00 OO0I IIII IIII 00NN NNNT TTTT
+    assert(imm9 >= -256 && imm9 < 256);
+    uint32_t inst = 0b00111000000000000000000000000000;
+    inst |= (size & 3) << 30u;
+    inst |= (v ? 1u : 0) << 26u;
+    inst |= (opc & 3) << 22u;
+    inst |= (imm9 & 0x1FF) << 12u;
+    inst |= (n & 0x1F) << 5u;
+    inst |= (t & 0x1F) << 0u;
+    EMIT4(e, inst);
+}
+
+// load/store register (post-indexed)
+//   OP Rt, [Rn], #simm9
+static void emit_ldst_post(TB_CGEmitter* restrict e, int size, bool v, int opc, int t, GPR n, int32_t imm9) {
+    // ZZ11 1V00 OO0I IIII IIII 01NN NNNT TTTT
+    assert(imm9 >= -256 && imm9 < 256);
+    uint32_t inst = 0b00111000000000000000010000000000;
+    inst |= (size & 3) << 30u;
+    inst |= (v ? 1u : 0) << 26u;
+    inst |= (opc & 3) << 22u;
+    inst |= (imm9 & 0x1FF) << 12u;
+    inst |= (n & 0x1F) << 5u;
+    inst |= (t & 0x1F) << 0u;
+    EMIT4(e, inst);
+}
+
+// load/store register (register offset), the index is 64bit
+//   OP Rt, [Rn, Rm {, lsl #size}]
+static void emit_ldst_reg(TB_CGEmitter* restrict e, int size, bool v, int opc, int t, GPR n, GPR m, bool scaled) {
+    // ZZ11 1V00 OO1M MMMM 011S 10NN NNNT TTTT
+    uint32_t inst = 0b00111000001000000110100000000000;
+    inst |= (size & 3) << 30u;
+    inst |= (v ? 1u : 0) << 26u;
+    inst |= (opc & 3) << 22u;
+    inst |= (m & 0x1F) << 16u;
+    inst |= (scaled ? 1u : 0) << 12u;
+    inst |= (n & 0x1F) << 5u;
+    inst |= (t & 0x1F) << 0u;
+    EMIT4(e, inst);
+}
+
+// load/store exclusive, we only do the acquire/release flavors (ldaxr/stlxr)
+// and ldar for atomic loads.
+enum {
+    LDST_STLXR = 0b00001000000000001111110000000000,
+    LDST_LDAXR = 0b00001000010111111111110000000000,
+    LDST_LDAR  = 0b00001000110111111111110000000000,
+};
+
+static void emit_ldst_excl(TB_CGEmitter* restrict e, uint32_t inst, int size, GPR s, GPR t, GPR n) {
+    if (inst == LDST_STLXR) {
+        inst |= (s & 0x1F) << 16u;
+    }
+    inst |= (size & 3) << 30u;
+    inst |= (n & 0x1F) << 5u;
+    inst |= (t & 0x1F) << 0u;
+    EMIT4(e, inst);
+}
+
+// float data processing (2 source)
+//   OP Vd, Vn, Vm
+static void emit_fp2(TB_CGEmitter* restrict e, int op, GPR d, GPR n, GPR m, bool is_f64) {
+    // 0001 1110 0T1M MMMM OOOO 10NN NNND DDDD
+    uint32_t inst = 0b00011110001000000000100000000000;
+    inst |= (is_f64 ? 1u : 0) << 22u;
+    inst |= (m & 0x1F) << 16u;
+    inst |= (op & 0xF) << 12u;
+    inst |= (n & 0x1F) << 5u;
+    inst |= (d & 0x1F) << 0u;
+    EMIT4(e, inst);
+}
+
+// float data processing (1 source)
+//   OP Vd, Vn
+static void emit_fp1(TB_CGEmitter* restrict e, int op, GPR d, GPR n, bool is_f64) {
+    // 0001 1110 0T10 00OO OOOO 10NN NNND DDDD
+    uint32_t inst = 0b00011110001000000100000000000000;
+    inst |= (is_f64 ? 1u : 0) << 22u;
+    inst |= (op & 0x3F) << 15u;
+    inst |= (n & 0x1F) << 5u;
+    inst |= (d & 0x1F) << 0u;
+    EMIT4(e, inst);
+}
+
+// 'fcmp vn, vm' (or 'fcmp vn, #0.0' when m is GPR_NONE)
+static void emit_fcmp(TB_CGEmitter* restrict e, GPR n, GPR m, bool is_f64) {
+    // 0001 1110 0T1M MMMM 0010 00NN NNN0 Z000
+    uint32_t inst = 0b00011110001000000010000000000000;
+    inst |= (is_f64 ? 1u : 0) << 22u;
+    if (m == GPR_NONE) {
+        inst |= 1u << 3u;
     } else {
-        inst |= (0b011100101 << 23u);
+        inst |= (m & 0x1F) << 16u;
     }
-    inst |= shift << 21u;
-    inst |= imm << 5u;
-    inst |= (dst & 0b11111) << 0u;
+    inst |= (n & 0x1F) << 5u;
     EMIT4(e, inst);
 }
 
+// 'fcsel vd, vn, vm, cond'
+static void emit_fcsel(TB_CGEmitter* restrict e, GPR d, GPR n, GPR m, Cond cc, bool is_f64) {
+    // 0001 1110 0T1M MMMM CCCC 11NN NNND DDDD
+    uint32_t inst = 0b00011110001000000000110000000000;
+    inst |= (is_f64 ? 1u : 0) << 22u;
+    inst |= (m & 0x1F) << 16u;
+    inst |= (cc & 0xF) << 12u;
+    inst |= (n & 0x1F) << 5u;
+    inst |= (d & 0x1F) << 0u;
+    EMIT4(e, inst);
+}
+
+// 'fmov vd, #imm8' (see encode_fp_imm8)
+static void emit_fmov_imm(TB_CGEmitter* restrict e, GPR d, uint8_t imm8, bool is_f64) {
+    // 0001 1110 0T1I IIII III1 0000 000D DDDD
+    uint32_t inst = 0b00011110001000000001000000000000;
+    inst |= (is_f64 ? 1u : 0) << 22u;
+    inst |= imm8 << 13u;
+    inst |= (d & 0x1F) << 0u;
+    EMIT4(e, inst);
+}
+
+// conversion between float and integer (also the raw fmov between register files)
+//   OP Rd, Vn / OP Vd, Rn
+static void emit_fcvt_int(TB_CGEmitter* restrict e, int op, GPR d, GPR n, bool is_f64, bool _64bit) {
+    // A001 1110 0T1R ROOO 0000 00NN NNND DDDD
+    uint32_t inst = 0b00011110001000000000000000000000 | (_64bit ? (1u << 31u) : 0);
+    inst |= (is_f64 ? 1u : 0) << 22u;
+    inst |= (op & 0x1F) << 16u;
+    inst |= (n & 0x1F) << 5u;
+    inst |= (d & 0x1F) << 0u;
+    EMIT4(e, inst);
+}
+
+// returns the N:immr:imms encoding for a logical immediate or -1 if it's not
+// representable, these are a rotated run of ones replicated across 2, 4, 8,
+// 16, 32 or 64bit elements.
+static int encode_logical_imm(uint64_t x, bool _64bit) {
+    if (!_64bit) {
+        x = (x & 0xFFFFFFFF) | (x << 32ull);
+    }
+
+    // all zeros & all ones aren't encodable
+    if (x == 0 || x == UINT64_MAX) {
+        return -1;
+    }
+
+    // find the smallest element size which the pattern repeats at
+    int size = 64;
+    while (size > 2) {
+        int half = size / 2;
+        uint64_t mask = (UINT64_C(1) << half) - 1;
+        if ((x & mask) != ((x >> half) & mask)) {
+            break;
+        }
+        size = half;
+    }
+
+    uint64_t mask = size == 64 ? UINT64_MAX : (UINT64_C(1) << size) - 1;
+    uint64_t elem = x & mask;
+
+    // rotate the element such that the run of ones starts at bit 0, we
+    // find a spot where a zero is followed by a one (going up).
+    int rot = 0;
+    FOR_N(i, 0, size) {
+        uint64_t r = ((elem >> i) | (elem << (size - i))) & mask;
+        if ((r & 1) && !((r >> (size - 1)) & 1)) {
+            rot = i;
+            break;
+        }
+    }
+
+    uint64_t run = ((elem >> rot) | (elem << (size - rot))) & mask;
+    int ones = tb_popcount64(run);
+    if (run != (UINT64_C(1) << ones) - 1) {
+        // not a single contiguous run
+        return -1;
+    }
+
+    // immr is how far right we rotate the run to get the element back
+    int immr = (size - rot) & (size - 1);
+    // imms has the element size encoded in the leading ones (NOT(size*2-1) in the top bits)
+    int imms = ((~(size - 1) << 1) & 0x3F) | (ones - 1);
+    int n = size == 64;
+    return (n << 12) | (immr << 6) | imms;
+}
+
+// fmov's 8bit float immediate: +/- (16 + [0,15]) / 16 * 2^[-3,4]
+static int encode_fp_imm8(uint64_t bits, bool is_f64) {
+    FOR_N(imm8, 0, 256) {
+        uint64_t sign = (imm8 >> 7) & 1, b6 = (imm8 >> 6) & 1;
+        uint64_t exp, x;
+        if (is_f64) {
+            exp = ((b6 ^ 1) << 10) | ((b6 ? 0xFF : 0) << 2) | ((imm8 >> 4) & 3);
+            x = (sign << 63) | (exp << 52) | ((uint64_t) (imm8 & 15) << 48);
+        } else {
+            exp = ((b6 ^ 1) << 7) | ((b6 ? 0x1F : 0) << 2) | ((imm8 >> 4) & 3);
+            x = (sign << 31) | (exp << 23) | ((uint64_t) (imm8 & 15) << 19);
+        }
+
+        if (x == bits) {
+            return imm8;
+        }
+    }
+    return -1;
+}
+
+// the branch families keep their word displacement in different spots:
+//   b, bl          imm26 @ 0
+//   b.cond, cb(n)z imm19 @ 5
+//   tb(n)z         imm14 @ 5
+static int branch_disp_bits(uint32_t inst, int* shift) {
+    if ((inst & 0x7C000000) == 0x14000000) {
+        *shift = 0;
+        return 26;
+    } else if ((inst & 0x7E000000) == 0x36000000) {
+        *shift = 5;
+        return 14;
+    } else {
+        *shift = 5;
+        return 19;
+    }
+}
+
+static int32_t branch_get_disp(uint32_t inst) {
+    int shift, bits = branch_disp_bits(inst, &shift);
+    return ((int32_t) ((inst >> shift) << (32 - bits))) >> (32 - bits);
+}
+
+static uint32_t branch_set_disp(uint32_t inst, int32_t disp) {
+    int shift, bits = branch_disp_bits(inst, &shift);
+    if (disp >= (1 << (bits - 1)) || disp < -(1 << (bits - 1))) {
+        tb_panic("aarch64: branch displacement out of range (%d words, %d bits)\n", disp, bits);
+    }
+
+    uint32_t mask = ((1u << bits) - 1) << shift;
+    return (inst & ~mask) | (((uint32_t) disp << shift) & mask);
+}
+
+// unlike x86 we can't stash the next link in the instruction as a raw offset, so
+// unresolved branches keep the word distance back to the previous unresolved branch
+// in their displacement (0 means end of chain). head is pos+4 so that a branch at
+// the very start doesn't look like an empty chain.
+static void tb_emit_branch(TB_CGEmitter* restrict e, uint32_t* head, uint32_t pos) {
+    uint32_t inst;
+    memcpy(&inst, &e->data[pos], 4);
+
+    uint32_t curr = *head;
+    if (curr & 0x80000000) {
+        // the label target is resolved, we need to do the relocation now
+        uint32_t target = curr & 0x7FFFFFFF;
+        inst = branch_set_disp(inst, ((int32_t) target - (int32_t) pos) / 4);
+    } else {
+        inst = branch_set_disp(inst, curr ? (pos - (curr - 4)) / 4 : 0);
+        *head = pos + 4;
+    }
+    PATCH4(e, pos, inst);
+}
+
+static void tb_resolve_branch(TB_CGEmitter* restrict e, uint32_t* head, uint32_t target) {
+    // walk previous relocations
+    uint32_t curr = *head;
+    while (curr != 0 && (curr & 0x80000000) == 0) {
+        uint32_t pos = curr - 4;
+
+        uint32_t inst;
+        memcpy(&inst, &e->data[pos], 4);
+        int32_t link = branch_get_disp(inst);
+        PATCH4(e, pos, branch_set_disp(inst, ((int32_t) target - (int32_t) pos) / 4));
+        curr = link ? (pos - link*4) + 4 : 0;
+    }
+
+    // store the target and mark it as resolved
+    *head = 0x80000000 | target;
+}
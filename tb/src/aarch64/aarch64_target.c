@@ -1,476 +1,2840 @@
 #include "../tb_internal.h"
 
 #ifdef TB_HAS_AARCH64
-// NOTE(NeGate): THIS IS VERY INCOMPLETE
 #include "../emitter.h"
 #include "aarch64_emitter.h"
 
 enum {
     // register classes
     REG_CLASS_GPR = 1,
+    REG_CLASS_FPR,
     REG_CLASS_COUNT,
 };
 
 enum {
-    ALL_GPRS = 0xFFFFFFFF & ~((1 << SP) | (1 << LR)),
+    // rough model of a little dual-issue core: two integer pipes, one
+    // load/store pipe & two FP/SIMD pipes.
+    FU_ALU0,
+    FU_ALU1,
+    FU_LDST,
+    FU_FP0,
+    FU_FP1,
+    FUNCTIONAL_UNIT_COUNT,
+};
+
+enum {
+    // x16 & x17 are scratch (the linker veneers can clobber them anyways),
+    // x18 is the platform register and x29, x30 & SP are the frame.
+    ALL_GPRS = 0x1FF8FFFF,
+    ALL_FPRS = 0xFFFFFFFF,
+
+    // AAPCS64, x0-x15 are volatile and x19-x28 are callee saved
+    CALLER_SAVED_GPRS = 0x0000FFFF,
+    CALLEE_SAVED_GPRS = 0x1FF80000,
+    // v8-v15 are callee saved (only the bottom 64bits but we don't do vectors)
+    CALLEE_SAVED_FPRS = 0x0000FF00,
 };
 
 #include "../codegen_impl.h"
+#include "../switch_lower.h"
+
+// flags setting flavors, shared by cmp, csel & cmpbr
+enum {
+    CMP_REG, // cmp a, b
+    CMP_IMM, // cmp a, #imm (cmn when it's negative)
+    CMP_TST, // tst a, b (or tst a, #imm without a b)
+    CMP_FP,  // fcmp a, b (or fcmp a, #0.0 without a b)
+};
+
+// most integer ops, the layout of inputs is:
+//   [1] lhs (NULL means ZR)
+//   [2] rhs (shifted by amount, or inverted for the logic ops)
+//
+// the immediate forms & bitfield moves only have [1], compares
+// put their operands in [1] & [2] and csel has the values in [3] & [4].
+typedef struct {
+    // width of the op, it's not always the node's type (zero extensions
+    // are 32bit ops, compares use the operand type).
+    TB_DataType dt;
+    uint8_t shift, amount;
+    bool invert;
+    uint8_t cmp, cc;
+    uint8_t immr, imms;
+    int64_t imm;
+} A64Op;
+
+// loads & stores:
+//   [0] ctrl
+//   [1] mem
+//   [2] base (the frame ptr or some GPR)
+//   [3] index (NULL if it's just the base + disp)
+//   [4] val (stores only, NULL means ZR)
+typedef struct {
+    TB_DataType mem_dt;
+    int32_t disp;
+    // index is shifted by the access size
+    bool scaled;
+    // sign extending loads (ldrsb, ldrsh, ldrsw)
+    bool sext;
+} A64MemOp;
+
+typedef struct {
+    TB_Symbol* sym;
+    uint32_t clobber_gpr;
+    uint32_t clobber_fpr;
+} A64Call;
+
+// machine node types
+typedef enum A64NodeType {
+    a64_nop = TB_MACH_A64,
+
+    #define X(name) a64_ ## name,
+    #include "aarch64_nodes.inc"
+} A64NodeType;
+
+static bool can_gvn(TB_Node* n) {
+    return true;
+}
+
+static uint32_t node_flags(TB_Node* n) {
+    A64NodeType type = n->type;
+    switch (type) {
+        case a64_cmpbr:
+        case a64_cbz:
+        case a64_tbz:
+        case a64_switch:
+        return NODE_CTRL | NODE_TERMINATOR | NODE_FORK_CTRL | NODE_BRANCH;
+
+        default: return 0;
+    }
+}
+
+static size_t extra_bytes(TB_Node* n) {
+    A64NodeType type = n->type;
+    switch (type) {
+        case a64_nop:
+        case a64_adr:
+        return 0;
+
+        case a64_add: case a64_sub: case a64_and: case a64_orr: case a64_eor:
+        case a64_addimm: case a64_andimm: case a64_orrimm: case a64_eorimm:
+        case a64_ubfm: case a64_sbfm: case a64_extr:
+        case a64_csel: case a64_cmp:
+        case a64_cmpbr: case a64_cbz: case a64_tbz:
+        return sizeof(A64Op);
+
+        case a64_ldr: case a64_str:
+        return sizeof(A64MemOp);
+
+        case a64_switch:
+        return sizeof(TB_NodeBranch);
+
+        case a64_call: case a64_static_call:
+        return sizeof(A64Call);
+
+        default:
+        tb_todo();
+    }
+}
+
+static const char* node_name(int n_type) {
+    switch (n_type) {
+        case a64_nop: return "nop";
+        #define X(name) case a64_ ## name: return STR(a64_ ## name);
+        #include "aarch64_nodes.inc"
+        default: return NULL;
+    }
+}
+
+static bool is_a64_op(TB_Node* n) {
+    switch (n->type) {
+        case a64_add: case a64_sub: case a64_and: case a64_orr: case a64_eor:
+        case a64_addimm: case a64_andimm: case a64_orrimm: case a64_eorimm:
+        case a64_ubfm: case a64_sbfm: case a64_extr:
+        case a64_csel: case a64_cmp:
+        case a64_cmpbr: case a64_cbz: case a64_tbz:
+        return true;
+
+        default:
+        return false;
+    }
+}
+
+static void print_extra(TB_Node* n) {
+    if (is_a64_op(n)) {
+        A64Op* op = TB_NODE_GET_EXTRA(n);
+        printf(", shift=%d, amount=%d, cc=%d, imm=%"PRId64, op->shift, op->amount, op->cc, op->imm);
+    } else if (n->type == a64_ldr || n->type == a64_str) {
+        A64MemOp* op = TB_NODE_GET_EXTRA(n);
+        printf(", disp=%d, scaled=%d, sext=%d", op->disp, op->scaled, op->sext);
+    }
+}
+
+static void print_dumb_extra(TB_Node* n) {
+    if (is_a64_op(n)) {
+        A64Op* op = TB_NODE_GET_EXTRA(n);
+        printf("shift=%d amount=%d cc=%d imm=%"PRId64" ", op->shift, op->amount, op->cc, op->imm);
+    } else if (n->type == a64_ldr || n->type == a64_str) {
+        A64MemOp* op = TB_NODE_GET_EXTRA(n);
+        printf("disp=%d scaled=%d sext=%d ", op->disp, op->scaled, op->sext);
+    }
+}
+
+// true for 64bit
+static bool legalize_int(TB_DataType dt) { return dt.type == TB_TAG_PTR || (dt.type == TB_TAG_INT && dt.data > 32); }
+
+static int int_bits(TB_DataType dt) { return dt.type == TB_TAG_PTR ? 64 : dt.data; }
+
+// log2 of the access size
+static int mem_size_log2(TB_DataType dt) {
+    switch (dt.type) {
+        case TB_TAG_F32: return 2;
+        case TB_TAG_F64: return 3;
+        case TB_TAG_PTR: return 3;
+        case TB_TAG_INT: return dt.data <= 8 ? 0 : dt.data <= 16 ? 1 : dt.data <= 32 ? 2 : 3;
+        default: tb_todo();
+    }
+}
+
+// add & sub immediates are 12bits, optionally shifted up by 12
+static bool fits_addsub_imm(int64_t x) {
+    return x >= 0 && (x < 4096 || ((x & 0xFFF) == 0 && x < (1 << 24)));
+}
+
+// sign extended value of the constant
+static bool get_iconst(TB_Node* n, int64_t* out_x) {
+    if (n->type != TB_ICONST) {
+        return false;
+    }
+
+    uint64_t x = TB_NODE_GET_EXTRA_T(n, TB_NodeInt)->value;
+    int shift = 64 - int_bits(n->dt);
+    *out_x = (int64_t) (x << shift) >> shift;
+    return true;
+}
+
+// +0.0 can just be stored from ZR
+static bool is_fzero(TB_Node* n) {
+    if (n->type == TB_F32CONST) {
+        return (Cvt_F32U32) { .f = TB_NODE_GET_EXTRA_T(n, TB_NodeFloat32)->value }.i == 0;
+    } else if (n->type == TB_F64CONST) {
+        return (Cvt_F64U64) { .f = TB_NODE_GET_EXTRA_T(n, TB_NodeFloat64)->value }.i == 0;
+    } else {
+        return false;
+    }
+}
+
+static Cond cond_for_cmp(int type) {
+    switch (type) {
+        case TB_CMP_EQ:  return EQ;
+        case TB_CMP_NE:  return NE;
+        case TB_CMP_SLT: return LT;
+        case TB_CMP_SLE: return LE;
+        case TB_CMP_ULT: return LO;
+        case TB_CMP_ULE: return LS;
+        // these are false when unordered
+        case TB_CMP_FLT: return MI;
+        case TB_CMP_FLE: return LS;
+        default: tb_unreachable(); return AL;
+    }
+}
+
+// the condition after swapping the operands (not the same as inverting it)
+static Cond swap_cond(Cond cc) {
+    switch (cc) {
+        case LT: return GT;
+        case GT: return LT;
+        case LE: return GE;
+        case GE: return LE;
+        case LO: return HI;
+        case HI: return LO;
+        case LS: return HS;
+        case HS: return LS;
+        default: return cc;
+    }
+}
+
+static int node_2addr(TB_Node* n) {
+    return -1;
+}
+
+static bool node_remat(TB_Node* n) {
+    return n->type == a64_adr || (n->type == a64_addimm && n->inputs[1]->type == TB_MACH_FRAME_PTR);
+}
+
+// constants which need a movz + 2 or more movks (see emit_movimm)
+static bool node_hoist(TB_Node* n) {
+    if (n->type != TB_ICONST) {
+        return false;
+    }
+
+    uint64_t x = TB_NODE_GET_EXTRA_T(n, TB_NodeInt)->value;
+    bool is_64bit = n->dt.type == TB_TAG_PTR || n->dt.data > 32;
+    if (!is_64bit || encode_logical_imm(x, true) >= 0) {
+        return false;
+    }
+
+    int zeros = 0, ones = 0;
+    FOR_N(i, 0, 4) {
+        uint16_t h = x >> (i*16);
+        zeros += h == 0;
+        ones  += h == 0xFFFF;
+    }
+    return 4 - (ones > zeros ? ones : zeros) > 2;
+}
+
+// AAPCS64 hands out x0-x7 & v0-v7 separately, anything past that goes
+// onto the stack in 8byte slots (in order). returns the register or the
+// stack slot when *on_stack is set.
+static int param_location(TB_DataType* dts, size_t count, size_t i, bool* on_stack) {
+    int gprs = 0, fprs = 0, stack = 0;
+    FOR_N(j, 0, i + 1) {
+        bool is_float = TB_IS_FLOAT_TYPE(dts[j]);
+        int* used = is_float ? &fprs : &gprs;
+        if (*used < 8) {
+            *on_stack = false;
+            *used += 1;
+        } else {
+            *on_stack = true;
+            stack += 1;
+        }
+    }
+
+    bool is_float = TB_IS_FLOAT_TYPE(dts[i]);
+    return *on_stack ? stack - 1 : (is_float ? fprs : gprs) - 1;
+}
+
+static int proto_param_location(TB_FunctionPrototype* proto, int i, bool* on_stack) {
+    TB_DataType dts[proto->param_count];
+    FOR_N(j, 0, proto->param_count) { dts[j] = proto->params[j].dt; }
+    return param_location(dts, proto->param_count, i, on_stack);
+}
+
+static void init_ctx(Ctx* restrict ctx, TB_ABI abi) {
+    ctx->num_regs[REG_CLASS_GPR] = 32;
+    ctx->num_regs[REG_CLASS_FPR] = 32;
+
+    ctx->normie_mask[REG_CLASS_GPR] = new_regmask(ctx->f, REG_CLASS_GPR, false, ALL_GPRS);
+    ctx->normie_mask[REG_CLASS_FPR] = new_regmask(ctx->f, REG_CLASS_FPR, false, ALL_FPRS);
+
+    // incoming stack params are the first few STK slots, outgoing ones
+    // start at param_count.
+    TB_FunctionPrototype* proto = ctx->f->prototype;
+    int stack_params = 0;
+    FOR_N(i, 0, proto->param_count) {
+        bool on_stack;
+        proto_param_location(proto, i, &on_stack);
+        stack_params += on_stack;
+    }
+    ctx->param_count = stack_params;
+    ctx->num_regs[REG_CLASS_STK] = stack_params;
+
+    // allocate all locals, they sit right below the frame record
+    TB_Node* root = ctx->f->root_node;
+    FOR_USERS(u, root) {
+        TB_Node* n = USERN(u);
+        if (n->type != TB_LOCAL) { continue; }
+        TB_NodeLocal* local = TB_NODE_GET_EXTRA(n);
+
+        // each stack slot is 8bytes
+        ctx->num_spills = align_up(ctx->num_spills + (local->size+7)/8, (local->align+7)/8);
+        local->stack_pos = -(ctx->num_spills*8);
+
+        if (local->type) {
+            assert(local->name);
+            TB_StackSlot s = {
+                .name = local->name,
+                .type = local->type,
+                .storage = { local->stack_pos },
+            };
+            dyn_array_put(ctx->debug_stack_slots, s);
+        }
+    }
+}
+
+static RegMask* normie_mask(Ctx* restrict ctx, TB_DataType dt) {
+    return ctx->normie_mask[TB_IS_FLOAT_TYPE(dt) ? REG_CLASS_FPR : REG_CLASS_GPR];
+}
+
+static TB_Node* mach_symbol(TB_Function* f, TB_Symbol* s) {
+    TB_Node* n = tb_alloc_node(f, TB_MACH_SYMBOL, TB_TYPE_PTR, 1, sizeof(TB_NodeMachSymbol));
+    set_input(f, n, f->root_node, 0);
+    TB_NODE_SET_EXTRA(n, TB_NodeMachSymbol, .sym = s);
+    return tb__gvn(f, n, sizeof(TB_NodeMachSymbol));
+}
+
+static bool is_tls_symbol(TB_Symbol* sym) {
+    // JIT modules don't have sections (nor TLS)
+    if (sym->tag == TB_SYMBOL_GLOBAL && !sym->module->is_jit) {
+        TB_Global* g = (TB_Global*) sym;
+        return sym->module->sections[g->parent].flags & TB_MODULE_SECTION_TLS;
+    } else {
+        return false;
+    }
+}
+
+// only used to build up the portable fallbacks during isel, they'll get selected
+// as we walk into them.
+static TB_Node* isel_iconst(TB_Function* f, TB_DataType dt, uint64_t x) {
+    TB_Node* n = tb_alloc_node(f, TB_ICONST, dt, 1, sizeof(TB_NodeInt));
+    set_input(f, n, f->root_node, 0);
+    TB_NODE_SET_EXTRA(n, TB_NodeInt, .value = dt.data < 64 ? x & ((1ull << dt.data) - 1) : x);
+    return tb__gvn(f, n, sizeof(TB_NodeInt));
+}
+
+// ints smaller than 32bits live in W registers with garbage up top, anything which
+// reads the whole register (compares, division, right shifts) extends them first.
+static TB_Node* isel_widen(TB_Function* f, TB_Node* n, bool is_signed) {
+    int bits = int_bits(n->dt);
+    if (bits >= 32) {
+        return n;
+    }
+
+    int64_t x;
+    if (get_iconst(n, &x)) {
+        return isel_iconst(f, TB_TYPE_I32, is_signed ? x : x & ((1ull << bits) - 1));
+    }
+
+    TB_Node* ext = tb_alloc_node(f, is_signed ? TB_SIGN_EXT : TB_ZERO_EXT, TB_TYPE_I32, 2, 0);
+    set_input(f, ext, n, 1);
+    return tb__gvn(f, ext, 0);
+}
+
+static TB_Node* isel_addimm(TB_Function* f, TB_DataType dt, TB_Node* src, int64_t imm) {
+    TB_Node* op = tb_alloc_node(f, a64_addimm, dt, 2, sizeof(A64Op));
+    set_input(f, op, src, 1);
+    TB_NODE_SET_EXTRA(op, A64Op, .dt = dt, .imm = imm);
+    return op;
+}
+
+static TB_Node* isel_bitfield(TB_Function* f, int type, TB_DataType dt, TB_Node* src, int immr, int imms) {
+    TB_Node* op = tb_alloc_node(f, type, dt, 2, sizeof(A64Op));
+    set_input(f, op, src, 1);
+    TB_NODE_SET_EXTRA(op, A64Op, .dt = dt, .immr = immr, .imms = imms);
+    return op;
+}
+
+// matches (xor x -1)
+static TB_Node* isel_not(TB_Node* n) {
+    int64_t x;
+    if (n->type == TB_XOR && get_iconst(n->inputs[2], &x) && x == -1) {
+        return n->inputs[1];
+    }
+    return NULL;
+}
+
+// the shifted register forms can fold a constant shift on the rhs, narrow
+// ints can only do left shifts since the top bits are garbage.
+static TB_Node* isel_shifted_operand(A64Op* op, TB_Node* n) {
+    if (n->type < TB_SHL || n->type > TB_SAR || !single_use(n) || n->inputs[2]->type != TB_ICONST) {
+        return NULL;
+    }
+
+    int bits = int_bits(n->dt);
+    uint64_t k = TB_NODE_GET_EXTRA_T(n->inputs[2], TB_NodeInt)->value;
+    if (k == 0 || k >= bits || (n->type != TB_SHL && bits < 32)) {
+        return NULL;
+    }
+
+    op->shift  = n->type == TB_SHL ? SHIFT_LSL : n->type == TB_SHR ? SHIFT_LSR : SHIFT_ASR;
+    op->amount = k;
+    return n->inputs[1];
+}
+
+// fills in the compare on a flags user (cmp, csel or cmpbr), returns the condition
+// for the compare being true.
+static Cond isel_flags(TB_Function* f, TB_Node* op, TB_Node* cmp) {
+    A64Op* op_extra = TB_NODE_GET_EXTRA(op);
+    TB_DataType cmp_dt = TB_NODE_GET_EXTRA_T(cmp, TB_NodeCompare)->cmp_dt;
+    TB_Node* a = cmp->inputs[1];
+    TB_Node* b = cmp->inputs[2];
+    Cond cc = cond_for_cmp(cmp->type);
+
+    op_extra->dt = cmp_dt;
+    if (TB_IS_FLOAT_TYPE(cmp_dt)) {
+        op_extra->cmp = CMP_FP;
+        set_input(f, op, a, 1);
+        if (!is_fzero(b)) {
+            set_input(f, op, b, 2);
+        }
+        return cc;
+    }
+
+    int64_t x;
+    int bits = int_bits(cmp_dt);
+    if (bits < 32) {
+        // equality against zero only cares about the low bits
+        if ((cc == EQ || cc == NE) && get_iconst(b, &x) && x == 0) {
+            op_extra->dt  = TB_TYPE_I32;
+            op_extra->cmp = CMP_TST;
+            op_extra->imm = (1ull << bits) - 1;
+            set_input(f, op, a, 1);
+            return cc;
+        }
+
+        bool is_signed = cmp->type == TB_CMP_SLT || cmp->type == TB_CMP_SLE;
+        a = isel_widen(f, a, is_signed);
+        b = isel_widen(f, b, is_signed);
+        op_extra->dt = TB_TYPE_I32;
+    }
+
+    if (a->type == TB_ICONST && b->type != TB_ICONST) {
+        SWAP(TB_Node*, a, b);
+        cc = swap_cond(cc);
+    }
+
+    if (get_iconst(b, &x) && (fits_addsub_imm(x) || fits_addsub_imm(-x))) {
+        op_extra->cmp = CMP_IMM;
+        op_extra->imm = x;
+    } else {
+        op_extra->cmp = CMP_REG;
+        set_input(f, op, b, 2);
+    }
+    set_input(f, op, a, 1);
+    return cc;
+}
+
+static TB_Node* isel_test_bit(TB_Function* f, TB_Node* src, int bit) {
+    TB_Node* op = tb_alloc_node(f, a64_tbz, TB_TYPE_TUPLE, 2, sizeof(A64Op));
+    set_input(f, op, src, 1);
+    TB_NODE_SET_EXTRA(op, A64Op, .dt = src->dt, .imm = bit);
+    return op;
+}
+
+// branches on zero (or a single bit) don't need the flags, that's cbz, cbnz, tbz & tbnz.
+static TB_Node* isel_branch_zero(TB_Function* f, TB_Node* cmp, Cond* out_cc) {
+    TB_DataType cmp_dt = TB_NODE_GET_EXTRA_T(cmp, TB_NodeCompare)->cmp_dt;
+    if (TB_IS_FLOAT_TYPE(cmp_dt)) {
+        return NULL;
+    }
+
+    TB_Node* a = cmp->inputs[1];
+    TB_Node* b = cmp->inputs[2];
+    bool is_eq = cmp->type == TB_CMP_EQ || cmp->type == TB_CMP_NE;
+    if (is_eq && a->type == TB_ICONST && b->type != TB_ICONST) {
+        SWAP(TB_Node*, a, b);
+    }
+
+    int64_t x;
+    if (!get_iconst(b, &x) || x != 0) {
+        return NULL;
+    }
+
+    int bits = int_bits(cmp_dt);
+    if (is_eq) {
+        *out_cc = cmp->type == TB_CMP_EQ ? EQ : NE;
+
+        // (x & pow2) ==/!= 0 only looks at one bit
+        if (a->type == TB_AND && a->inputs[2]->type == TB_ICONST) {
+            uint64_t mask = TB_NODE_GET_EXTRA_T(a->inputs[2], TB_NodeInt)->value;
+            if (mask && (mask & (mask - 1)) == 0) {
+                return isel_test_bit(f, a->inputs[1], __builtin_ctzll(mask));
+            }
+        }
+
+        if (bits >= 32) {
+            TB_Node* op = tb_alloc_node(f, a64_cbz, TB_TYPE_TUPLE, 2, sizeof(A64Op));
+            set_input(f, op, a, 1);
+            TB_NODE_SET_EXTRA(op, A64Op, .dt = cmp_dt);
+            return op;
+        }
+    } else if (cmp->type == TB_CMP_SLT) {
+        // x < 0 is just the sign bit
+        *out_cc = NE;
+        return isel_test_bit(f, a, bits - 1);
+    }
+
+    return NULL;
+}
+
+// folds the address into [base + disp] or [base + index {<< size}]
+static void isel_addr(Ctx* restrict ctx, TB_Function* f, TB_Node* op, TB_Node* addr) {
+    A64MemOp* op_extra = TB_NODE_GET_EXTRA(op);
+    int size = mem_size_log2(op_extra->mem_dt);
+
+    int64_t disp = 0, x;
+    while (addr->type == TB_PTR_OFFSET && get_iconst(addr->inputs[2], &x) && disp + x == (int32_t) (disp + x)) {
+        disp += x;
+        addr = addr->inputs[1];
+    }
+
+    TB_Node* base = addr;
+    TB_Node* index = NULL;
+    if (addr->type == TB_LOCAL) {
+        base  = ctx->frame_ptr;
+        disp += TB_NODE_GET_EXTRA_T(addr, TB_NodeLocal)->stack_pos;
+    } else if (addr->type == a64_addimm && addr->inputs[1]->type == TB_MACH_FRAME_PTR) {
+        base  = ctx->frame_ptr;
+        disp += TB_NODE_GET_EXTRA_T(addr, A64Op)->imm;
+    } else if (disp == 0 && addr->type == TB_PTR_OFFSET) {
+        base  = addr->inputs[1];
+        index = addr->inputs[2];
+
+        // the register offset form can scale by the access size
+        if (size > 0 && index->type == TB_SHL && index->inputs[2]->type == TB_ICONST &&
+            TB_NODE_GET_EXTRA_T(index->inputs[2], TB_NodeInt)->value == size) {
+            index = index->inputs[1];
+            op_extra->scaled = true;
+        }
+
+        // constant index (p[3]) just turns into a displacement
+        if (get_iconst(index, &x)) {
+            int64_t d = op_extra->scaled ? x << size : x;
+            if (d == (int32_t) d) {
+                disp  = d;
+                index = NULL;
+                op_extra->scaled = false;
+            }
+        }
+    }
+
+    op_extra->disp = disp;
+    set_input(f, op, base, 2);
+    set_input(f, op, index, 3);
+}
+
+static uint32_t callee_saved_gprs(Ctx* restrict ctx) { return CALLEE_SAVED_GPRS; }
+static uint32_t callee_saved_fprs(Ctx* restrict ctx) { return CALLEE_SAVED_FPRS; }
+
+static void add_to_exits(TB_Function* f, TB_Node* root, TB_Node* proj) {
+    FOR_N(i, 1, root->input_count) {
+        TB_Node* end = root->inputs[i];
+        if (end->type == TB_RETURN || end->type == TB_TAILCALL) {
+            add_input_late(f, end, proj);
+        }
+    }
+}
+
+static TB_Node* node_isel(Ctx* restrict ctx, TB_Function* f, TB_Node* n) {
+    if (n->type == TB_PROJ || n->type == TB_MACH_PROJ || n->type >= TB_MACH_MOVE) {
+        return n;
+    } else if (n->type == TB_ROOT) {
+        bool has_exit = false;
+        FOR_N(i, 1, n->input_count) {
+            has_exit |= n->inputs[i]->type == TB_RETURN || n->inputs[i]->type == TB_TAILCALL;
+        }
+
+        if (!has_exit) {
+            return n;
+        }
+
+        // add some callee-saved mach projections, every exit (returns & tailcalls)
+        // needs them back in place.
+        int j = 3 + f->prototype->param_count;
+        uint32_t callee_saved_gpr = callee_saved_gprs(ctx);
+        FOR_N(i, 0, ctx->num_regs[REG_CLASS_GPR]) {
+            if ((callee_saved_gpr >> i) & 1) {
+                RegMask* rm = intern_regmask(ctx, REG_CLASS_GPR, false, 1u << i);
+                TB_Node* proj = tb_alloc_node(f, TB_MACH_PROJ, TB_TYPE_I64, 1, sizeof(TB_NodeMachProj));
+                TB_NODE_SET_EXTRA(proj, TB_NodeMachProj, .index = j++, .def = rm);
+
+                set_input(f, proj, n, 0);
+                add_to_exits(f, n, proj);
+            }
+        }
+
+        uint32_t callee_saved_fpr = callee_saved_fprs(ctx);
+        FOR_N(i, 0, ctx->num_regs[REG_CLASS_FPR]) {
+            if ((callee_saved_fpr >> i) & 1) {
+                RegMask* rm = intern_regmask(ctx, REG_CLASS_FPR, false, 1u << i);
+                TB_Node* proj = tb_alloc_node(f, TB_MACH_PROJ, TB_TYPE_F64, 1, sizeof(TB_NodeMachProj));
+                TB_NODE_SET_EXTRA(proj, TB_NodeMachProj, .index = j++, .def = rm);
+
+                set_input(f, proj, n, 0);
+                add_to_exits(f, n, proj);
+            }
+        }
+
+        return n;
+    } else if (n->type == TB_PHI) {
+        if (TB_IS_SCALAR_TYPE(n->dt)) {
+            RegMask* rm = normie_mask(ctx, n->dt);
+
+            // same trick as x64, the phi gets a copy after it and moves on each
+            // of the data edges which RA will coalesce.
+            TB_Node* cpy = tb_alloc_node(f, TB_MACH_COPY, n->dt, 2, sizeof(TB_NodeMachCopy));
+            TB_NODE_SET_EXTRA(cpy, TB_NodeMachCopy, .def = rm, .use = rm);
+
+            subsume_node2(f, n, cpy);
+            set_input(f, cpy, n, 1);
+
+            FOR_N(i, 1, n->input_count) {
+                TB_Node* in = n->inputs[i];
+                assert(in->type != TB_MACH_MOVE);
+
+                TB_Node* move = tb_alloc_node(f, TB_MACH_MOVE, in->dt, 2, 0);
+                set_input(f, move, in, 1);
+                set_input(f, n, move, i);
+            }
+        }
+        return n;
+    } else if (n->type == TB_BITCAST || n->type == TB_TRUNCATE) {
+        TB_Node* in = n->inputs[1];
+        TB_Node* cpy = tb_alloc_node(f, TB_MACH_COPY, n->dt, 2, sizeof(TB_NodeMachCopy));
+        set_input(f, cpy, in, 1);
+        TB_NODE_SET_EXTRA(cpy, TB_NodeMachCopy, .def = normie_mask(ctx, n->dt), .use = normie_mask(ctx, in->dt));
+        return cpy;
+    } else if (n->type == TB_ZERO_EXT || n->type == TB_SIGN_EXT) {
+        bool is_signed = n->type == TB_SIGN_EXT;
+        TB_Node* src = n->inputs[1];
+        int src_bits = int_bits(src->dt);
+
+        // single use loads can do the extension themselves
+        if (src->type == TB_LOAD && single_use(src)) {
+            TB_Node* op = tb_alloc_node(f, a64_ldr, n->dt, 4, sizeof(A64MemOp));
+            set_input(f, op, src->inputs[0], 0);
+            set_input(f, op, src->inputs[1], 1);
+            TB_NODE_SET_EXTRA(op, A64MemOp, .mem_dt = src->dt, .sext = is_signed);
+            isel_addr(ctx, f, op, src->inputs[2]);
+            return op;
+        }
+
+        if (is_signed) {
+            // sxtb, sxth, sxtw
+            return isel_bitfield(f, a64_sbfm, n->dt, src, 0, src_bits - 1);
+        } else if (src->type >= TB_CMP_EQ && src->type <= TB_CMP_FLE) {
+            // cset already leaves a clean 0 or 1
+            RegMask* rm = ctx->normie_mask[REG_CLASS_GPR];
+            TB_Node* cpy = tb_alloc_node(f, TB_MACH_COPY, n->dt, 2, sizeof(TB_NodeMachCopy));
+            set_input(f, cpy, src, 1);
+            TB_NODE_SET_EXTRA(cpy, TB_NodeMachCopy, .def = rm, .use = rm);
+            return cpy;
+        } else if (src_bits == 32) {
+            // mov wd, wn clears the top half
+            TB_Node* op = tb_alloc_node(f, a64_orr, n->dt, 3, sizeof(A64Op));
+            set_input(f, op, src, 2);
+            TB_NODE_SET_EXTRA(op, A64Op, .dt = TB_TYPE_I32);
+            return op;
+        } else {
+            assert(src_bits < 32);
+            TB_Node* op = tb_alloc_node(f, a64_andimm, n->dt, 2, sizeof(A64Op));
+            set_input(f, op, src, 1);
+            TB_NODE_SET_EXTRA(op, A64Op, .dt = TB_TYPE_I32, .imm = (1ull << src_bits) - 1);
+            return op;
+        }
+    } else if (n->type == TB_LOCAL) {
+        // we don't directly ref the Local, this is the accessor op whenever we're
+        // not folding into some other op nicely.
+        TB_Node* op = isel_addimm(f, TB_TYPE_PTR, ctx->frame_ptr, TB_NODE_GET_EXTRA_T(n, TB_NodeLocal)->stack_pos);
+        subsume_node2(f, n, op);
+        return n;
+    } else if (n->type == TB_SYMBOL) {
+        TB_Symbol* sym = TB_NODE_GET_EXTRA_T(n, TB_NodeSymbol)->sym;
+        if (is_tls_symbol(sym)) {
+            tb_todo();
+        }
+
+        TB_Node* op = tb_alloc_node(f, a64_adr, TB_TYPE_PTR, 2, 0);
+        subsume_node2(f, n, op);
+        set_input(f, op, mach_symbol(f, sym), 1);
+        return n;
+    } else if (n->type == TB_LOAD) {
+        TB_Node* op = tb_alloc_node(f, a64_ldr, n->dt, 4, sizeof(A64MemOp));
+        set_input(f, op, n->inputs[0], 0);
+        set_input(f, op, n->inputs[1], 1);
+        TB_NODE_SET_EXTRA(op, A64MemOp, .mem_dt = n->dt);
+        isel_addr(ctx, f, op, n->inputs[2]);
+        return op;
+    } else if (n->type == TB_STORE) {
+        TB_Node* val = n->inputs[3];
+        TB_DataType mem_dt = val->dt;
+
+        // narrowing stores don't care about the top bits
+        if (val->type == TB_TRUNCATE && val->dt.type == TB_TAG_INT) {
+            val = val->inputs[1];
+        }
+
+        int64_t x;
+        if ((get_iconst(val, &x) && x == 0) || is_fzero(val)) {
+            val = NULL;
+        }
+
+        TB_Node* op = tb_alloc_node(f, a64_str, TB_TYPE_MEMORY, 5, sizeof(A64MemOp));
+        set_input(f, op, n->inputs[0], 0);
+        set_input(f, op, n->inputs[1], 1);
+        set_input(f, op, val, 4);
+        TB_NODE_SET_EXTRA(op, A64MemOp, .mem_dt = mem_dt);
+        isel_addr(ctx, f, op, n->inputs[2]);
+        return op;
+    } else if ((n->type >= TB_AND && n->type <= TB_SUB) || n->type == TB_PTR_OFFSET) {
+        bool is_64bit = legalize_int(n->dt);
+        int type = n->type == TB_PTR_OFFSET ? TB_ADD : n->type;
+        TB_Node* a = n->inputs[1];
+        TB_Node* b = n->inputs[2];
+
+        // constants go on the right (sub can't do that)
+        if (type != TB_SUB && a->type == TB_ICONST && b->type != TB_ICONST) {
+            SWAP(TB_Node*, a, b);
+        }
+
+        int64_t x;
+        if (get_iconst(b, &x)) {
+            if (type == TB_ADD || type == TB_SUB) {
+                if (type == TB_SUB) { x = -(uint64_t) x; }
+                if (fits_addsub_imm(x) || fits_addsub_imm(-x)) {
+                    return isel_addimm(f, n->dt, a, x);
+                }
+            } else if (type == TB_XOR && x == -1) {
+                // mvn
+                TB_Node* op = tb_alloc_node(f, a64_orr, n->dt, 3, sizeof(A64Op));
+                set_input(f, op, a, 2);
+                TB_NODE_SET_EXTRA(op, A64Op, .dt = n->dt, .invert = true);
+                return op;
+            } else if (encode_logical_imm(is_64bit ? x : (uint32_t) x, is_64bit) >= 0) {
+                int op_type = type == TB_AND ? a64_andimm : type == TB_OR ? a64_orrimm : a64_eorimm;
+                TB_Node* op = tb_alloc_node(f, op_type, n->dt, 2, sizeof(A64Op));
+                set_input(f, op, a, 1);
+                TB_NODE_SET_EXTRA(op, A64Op, .dt = n->dt, .imm = x);
+                return op;
+            }
+        }
+
+        int op_type = -1;
+        switch (type) {
+            case TB_AND: op_type = a64_and; break;
+            case TB_OR:  op_type = a64_orr; break;
+            case TB_XOR: op_type = a64_eor; break;
+            case TB_ADD: op_type = a64_add; break;
+            case TB_SUB: op_type = a64_sub; break;
+        }
+
+        TB_Node* op = tb_alloc_node(f, op_type, n->dt, 3, sizeof(A64Op));
+        A64Op* op_extra = TB_NODE_GET_EXTRA(op);
+        op_extra->dt = n->dt;
+
+        // 0 - x is neg
+        if (type == TB_SUB && get_iconst(a, &x) && x == 0) {
+            a = NULL;
+        }
+
+        bool commutes = type != TB_SUB;
+        if (type == TB_AND || type == TB_OR || type == TB_XOR) {
+            // bic, orn & eon
+            TB_Node* inv = isel_not(b);
+            if (inv == NULL && (inv = isel_not(a))) {
+                SWAP(TB_Node*, a, b);
+            }
+
+            if (inv) {
+                op_extra->invert = true;
+                b = inv;
+            }
+        }
+
+        TB_Node* shifted = isel_shifted_operand(op_extra, b);
+        if (shifted == NULL && commutes && !op_extra->invert && a && (shifted = isel_shifted_operand(op_extra, a))) {
+            a = b;
+        }
+
+        if (shifted) {
+            b = shifted;
+        }
+
+        set_input(f, op, a, 1);
+        set_input(f, op, b, 2);
+        return op;
+    } else if (n->type == TB_NEG) {
+        TB_Node* op = tb_alloc_node(f, a64_sub, n->dt, 3, sizeof(A64Op));
+        set_input(f, op, n->inputs[1], 2);
+        TB_NODE_SET_EXTRA(op, A64Op, .dt = n->dt);
+        return op;
+    } else if (n->type >= TB_SHL && n->type <= TB_ROR && n->inputs[2]->type == TB_ICONST) {
+        bool is_64bit = legalize_int(n->dt);
+        int bits = int_bits(n->dt);
+        int size = is_64bit ? 64 : 32;
+        uint64_t k = TB_NODE_GET_EXTRA_T(n->inputs[2], TB_NodeInt)->value;
+        TB_Node* src = n->inputs[1];
+
+        switch (n->type) {
+            case TB_SHL:
+            if (k >= bits) { return isel_iconst(f, n->dt, 0); }
+            return isel_bitfield(f, a64_ubfm, n->dt, src, (size - k) & (size - 1), size - 1 - k);
+
+            // the narrow ones extract [k, bits) which also takes care of the garbage
+            case TB_SHR:
+            if (k >= bits) { return isel_iconst(f, n->dt, 0); }
+            return isel_bitfield(f, a64_ubfm, n->dt, src, k, bits - 1);
+
+            case TB_SAR:
+            if (k >= bits) { k = bits - 1; }
+            return isel_bitfield(f, a64_sbfm, n->dt, src, k, bits - 1);
+
+            case TB_ROL:
+            case TB_ROR: {
+                if (bits < 32) {
+                    tb_todo();
+                }
+
+                k &= bits - 1;
+                if (n->type == TB_ROL) { k = (bits - k) & (bits - 1); }
+
+                // extr rd, rn, rn, #k
+                TB_Node* op = tb_alloc_node(f, a64_extr, n->dt, 2, sizeof(A64Op));
+                set_input(f, op, src, 1);
+                TB_NODE_SET_EXTRA(op, A64Op, .dt = n->dt, .imm = k);
+                return op;
+            }
+
+            default: tb_unreachable();
+        }
+    } else if (n->type >= TB_SHL && n->type <= TB_ROR) {
+        if ((n->type == TB_ROL || n->type == TB_ROR) && int_bits(n->dt) < 32) {
+            tb_todo();
+        }
+
+        // right shifts need a properly extended value
+        if (n->type == TB_SHR || n->type == TB_SAR) {
+            set_input(f, n, isel_widen(f, n->inputs[1], n->type == TB_SAR), 1);
+        }
+        return n;
+    } else if (n->type >= TB_UDIV && n->type <= TB_SMOD) {
+        bool is_signed = n->type == TB_SDIV || n->type == TB_SMOD;
+        set_input(f, n, isel_widen(f, n->inputs[1], is_signed), 1);
+        set_input(f, n, isel_widen(f, n->inputs[2], is_signed), 2);
+        return n;
+    } else if (n->type == TB_CLZ || n->type == TB_CTZ || n->type == TB_POPCNT) {
+        int bits = int_bits(n->inputs[1]->dt);
+        if (bits < 32) {
+            TB_Node* src = isel_widen(f, n->inputs[1], false);
+            if (n->type == TB_CLZ) {
+                // clz on the zero extended value counts (32 - bits) too many
+                TB_Node* clz = tb_alloc_node(f, TB_CLZ, TB_TYPE_I32, 2, 0);
+                set_input(f, clz, src, 1);
+                return isel_addimm(f, TB_TYPE_I32, clz, -(32 - bits));
+            }
+
+            set_input(f, n, src, 1);
+        }
+        return n;
+    } else if (n->type == TB_INT2FLOAT || n->type == TB_UINT2FLOAT) {
+        set_input(f, n, isel_widen(f, n->inputs[1], n->type == TB_INT2FLOAT), 1);
+        return n;
+    } else if (n->type >= TB_CMP_EQ && n->type <= TB_CMP_FLE) {
+        TB_Node* op = tb_alloc_node(f, a64_cmp, n->dt, 3, sizeof(A64Op));
+        Cond cc = isel_flags(f, op, n);
+        TB_NODE_GET_EXTRA_T(op, A64Op)->cc = cc;
+        return op;
+    } else if (n->type == TB_SELECT) {
+        TB_Node* op = tb_alloc_node(f, a64_csel, n->dt, 5, sizeof(A64Op));
+        A64Op* op_extra = TB_NODE_GET_EXTRA(op);
+
+        TB_Node* cond = n->inputs[1];
+        if (cond->type >= TB_CMP_EQ && cond->type <= TB_CMP_FLE) {
+            op_extra->cc = isel_flags(f, op, cond);
+        } else if (int_bits(cond->dt) >= 32) {
+            op_extra->dt  = cond->dt;
+            op_extra->cmp = CMP_IMM;
+            op_extra->cc  = NE;
+            set_input(f, op, cond, 1);
+        } else {
+            // bools have garbage above the first bit
+            op_extra->dt  = TB_TYPE_I32;
+            op_extra->cmp = CMP_TST;
+            op_extra->imm = (1ull << int_bits(cond->dt)) - 1;
+            op_extra->cc  = NE;
+            set_input(f, op, cond, 1);
+        }
+
+        set_input(f, op, n->inputs[2], 3);
+        set_input(f, op, n->inputs[3], 4);
+        return op;
+    } else if (n->type == TB_BRANCH || n->type == TB_AFFINE_LATCH) {
+        TB_Node* cond = n->inputs[1];
+        TB_NodeBranchProj* if_br = cfg_if_branch(n);
+        if (if_br == NULL) {
+            // switch, see switch_lower.h
+            n->type = a64_switch;
+            if (int_bits(cond->dt) < 32) {
+                switch_zext_keys(n, int_bits(cond->dt));
+            }
+            set_input(f, n, isel_widen(f, cond, false), 1);
+            return n;
+        }
+
+        Cond cc;
+        TB_Node* op = NULL;
+        if (cond->type >= TB_CMP_EQ && cond->type <= TB_CMP_FLE) {
+            op = isel_branch_zero(f, cond, &cc);
+            if (op == NULL) {
+                op = tb_alloc_node(f, a64_cmpbr, TB_TYPE_TUPLE, 3, sizeof(A64Op));
+                cc = isel_flags(f, op, cond);
+            }
+
+            // the key is the condition for taking the default (index 0) edge
+            cc ^= (if_br->key != 0);
+        } else if (if_br->key == 0) {
+            int bits = int_bits(cond->dt);
+            if (bits == 1) {
+                op = isel_test_bit(f, cond, 0);
+            } else if (bits >= 32) {
+                op = tb_alloc_node(f, a64_cbz, TB_TYPE_TUPLE, 2, sizeof(A64Op));
+                set_input(f, op, cond, 1);
+                TB_NODE_SET_EXTRA(op, A64Op, .dt = cond->dt);
+            } else {
+                op = tb_alloc_node(f, a64_cmpbr, TB_TYPE_TUPLE, 3, sizeof(A64Op));
+                set_input(f, op, cond, 1);
+                TB_NODE_SET_EXTRA(op, A64Op, .dt = TB_TYPE_I32, .cmp = CMP_TST, .imm = (1ull << bits) - 1);
+            }
+            cc = NE;
+        } else {
+            op = tb_alloc_node(f, a64_cmpbr, TB_TYPE_TUPLE, 3, sizeof(A64Op));
+            A64Op* op_extra = TB_NODE_GET_EXTRA(op);
+
+            TB_Node* key = isel_widen(f, cond, false);
+            int64_t x = if_br->key;
+            op_extra->dt = key->dt;
+            if (fits_addsub_imm(x)) {
+                op_extra->cmp = CMP_IMM;
+                op_extra->imm = x;
+            } else {
+                op_extra->cmp = CMP_REG;
+                set_input(f, op, isel_iconst(f, key->dt, x), 2);
+            }
+            set_input(f, op, key, 1);
+            cc = NE;
+        }
+
+        TB_NODE_GET_EXTRA_T(op, A64Op)->cc = cc;
+        set_input(f, op, n->inputs[0], 0);
+        return op;
+    } else if (n->type == TB_CALL) {
+        TB_Node* op = tb_alloc_node(f, a64_call, n->dt, n->input_count, sizeof(A64Call));
+        set_input(f, op, n->inputs[0], 0); // ctrl
+        set_input(f, op, n->inputs[1], 1); // mem
+        A64Call* op_extra = TB_NODE_GET_EXTRA(op);
+
+        // check for static call
+        if (n->inputs[2]->type == TB_SYMBOL) {
+            op->type = a64_static_call;
+            op_extra->sym = TB_NODE_GET_EXTRA_T(n->inputs[2], TB_NodeSymbol)->sym;
+        } else {
+            set_input(f, op, n->inputs[2], 2);
+        }
+
+        op_extra->clobber_gpr = CALLER_SAVED_GPRS;
+        op_extra->clobber_fpr = ~CALLEE_SAVED_FPRS;
+
+        int gprs_used = 0, fprs_used = 0, stack_used = 0;
+        FOR_N(i, 3, n->input_count) {
+            int* used = TB_IS_FLOAT_TYPE(n->inputs[i]->dt) ? &fprs_used : &gprs_used;
+            if (*used < 8) {
+                *used += 1;
+            } else {
+                stack_used += 1;
+            }
+
+            set_input(f, op, n->inputs[i], i);
+        }
+
+        // outgoing stack params sit at the bottom of our frame
+        if (ctx->param_count + stack_used > ctx->num_regs[REG_CLASS_STK]) {
+            ctx->num_regs[REG_CLASS_STK] = ctx->param_count + stack_used;
+        }
+        if (stack_used > ctx->call_usage) {
+            ctx->call_usage = stack_used;
+        }
+
+        return op;
+    } else if (n->type == TB_TAILCALL) {
+        // static targets get a direct B
+        if (n->inputs[2]->type == TB_SYMBOL) {
+            TB_Symbol* sym = TB_NODE_GET_EXTRA_T(n->inputs[2], TB_NodeSymbol)->sym;
+            set_input(f, n, mach_symbol(f, sym), 2);
+        }
+        return n;
+    } else if (n->type == TB_VA_START) {
+        tb_todo();
+    }
+
+    return NULL;
+}
+
+static int node_tmp_count(Ctx* restrict ctx, TB_Node* n) {
+    switch (n->type) {
+        case a64_call: case a64_static_call: {
+            A64Call* op_extra = TB_NODE_GET_EXTRA(n);
+            return tb_popcount(op_extra->clobber_gpr) + tb_popcount(op_extra->clobber_fpr);
+        }
+
+        // the byte loops walk x0, x1 & x2
+        case TB_MEMSET:
+        case TB_MEMCPY:
+        return 3;
+
+        // the old value in the LL/SC loops
+        case TB_ATOMIC_XCHG:
+        case TB_ATOMIC_ADD:
+        case TB_ATOMIC_AND:
+        case TB_ATOMIC_XOR:
+        case TB_ATOMIC_OR:
+        case TB_ATOMIC_PTROFF:
+        return 1;
+
+        // there's no scalar popcount, we go through the SIMD side
+        case TB_POPCNT:
+        return 1;
+
+        default: return 0;
+    }
+}
+
+// exits (returns & tailcalls) keep the callee-saved registers pinned from the
+// entry projections, starting at ins[j].
+static void callee_saved_constraints(Ctx* restrict ctx, RegMask** ins, size_t j) {
+    uint32_t callee_saved_gpr = callee_saved_gprs(ctx);
+    FOR_N(i, 0, ctx->num_regs[REG_CLASS_GPR]) {
+        if ((callee_saved_gpr >> i) & 1) {
+            ins[j++] = intern_regmask(ctx, REG_CLASS_GPR, false, 1u << i);
+        }
+    }
+
+    uint32_t callee_saved_fpr = callee_saved_fprs(ctx);
+    FOR_N(i, 0, ctx->num_regs[REG_CLASS_FPR]) {
+        if ((callee_saved_fpr >> i) & 1) {
+            ins[j++] = intern_regmask(ctx, REG_CLASS_FPR, false, 1u << i);
+        }
+    }
+}
+
+static RegMask* flags_constraint(Ctx* restrict ctx, TB_Node* n, RegMask** ins) {
+    A64Op* op = TB_NODE_GET_EXTRA(n);
+    RegMask* rm = ctx->normie_mask[op->cmp == CMP_FP ? REG_CLASS_FPR : REG_CLASS_GPR];
+    if (ins) {
+        ins[1] = rm;
+        ins[2] = n->inputs[2] ? rm : &TB_REG_EMPTY;
+    }
+    return rm;
+}
+
+static RegMask* node_constraint(Ctx* restrict ctx, TB_Node* n, RegMask** ins) {
+    switch (n->type) {
+        case TB_REGION:
+        case TB_SPLITMEM:
+        case TB_MERGEMEM:
+        case TB_TRAP:
+        case TB_UNREACHABLE:
+        case TB_DEBUGBREAK:
+        case TB_AFFINE_LOOP:
+        case TB_NATURAL_LOOP:
+        case TB_CALLGRAPH:
+        case TB_DEBUG_LOCATION:
+        if (ins) {
+            // region inputs are all control
+            FOR_N(i, 1, n->input_count) { ins[i] = &TB_REG_EMPTY; }
+        }
+        return &TB_REG_EMPTY;
+
+        case TB_POISON:
+        return normie_mask(ctx, n->dt);
+
+        case TB_LOCAL:
+        case TB_SYMBOL:
+        case TB_BRANCH_PROJ:
+        case TB_MACH_SYMBOL:
+        case TB_MACH_FRAME_PTR:
+        case TB_NEVER_BRANCH:
+        return &TB_REG_EMPTY;
+
+        case TB_MACH_COPY: {
+            TB_NodeMachCopy* move = TB_NODE_GET_EXTRA(n);
+            if (ins) { ins[1] = move->use; }
+            return move->def;
+        }
+
+        case TB_MACH_PROJ: {
+            return TB_NODE_GET_EXTRA_T(n, TB_NodeMachProj)->def;
+        }
+
+        case TB_MACH_MOVE: {
+            RegMask* rm = normie_mask(ctx, n->dt);
+            if (ins) { ins[1] = rm; }
+            return rm;
+        }
+
+        case TB_PHI: {
+            if (ins) {
+                FOR_N(i, 1, n->input_count) { ins[i] = &TB_REG_EMPTY; }
+            }
+
+            if (n->dt.type == TB_TAG_MEMORY) return &TB_REG_EMPTY;
+            return normie_mask(ctx, n->dt);
+        }
+
+        case TB_ICONST:
+        case TB_CYCLE_COUNTER:
+        return ctx->normie_mask[REG_CLASS_GPR];
+
+        case TB_SAFEPOINT_POLL: {
+            // only the poll address needs a register, the rest just needs to be alive
+            if (ins) {
+                FOR_N(i, 1, n->input_count) { ins[i] = &TB_REG_EMPTY; }
+                ins[2] = ctx->normie_mask[REG_CLASS_GPR];
+            }
+            return &TB_REG_EMPTY;
+        }
+
+        case TB_F32CONST:
+        case TB_F64CONST:
+        return ctx->normie_mask[REG_CLASS_FPR];
+
+        case TB_PROJ: {
+            if (n->dt.type == TB_TAG_MEMORY || n->dt.type == TB_TAG_CONTROL) {
+                return &TB_REG_EMPTY;
+            }
+
+            int i = TB_NODE_GET_EXTRA_T(n, TB_NodeProj)->index;
+            if (n->inputs[0]->type == TB_ROOT) {
+                assert(i >= 2);
+                if (i == 2) {
+                    // RPC is inaccessible for now
+                    return &TB_REG_EMPTY;
+                }
+
+                bool on_stack;
+                int loc = proto_param_location(ctx->f->prototype, i - 3, &on_stack);
+                if (on_stack) {
+                    return intern_regmask(ctx, REG_CLASS_STK, false, loc);
+                }
+                return intern_regmask(ctx, TB_IS_FLOAT_TYPE(n->dt) ? REG_CLASS_FPR : REG_CLASS_GPR, false, 1u << loc);
+            } else if (n->inputs[0]->type == a64_call || n->inputs[0]->type == a64_static_call) {
+                assert(i == 2 || i == 3);
+                return intern_regmask(ctx, TB_IS_FLOAT_TYPE(n->dt) ? REG_CLASS_FPR : REG_CLASS_GPR, false, 1u << (i - 2));
+            } else if (n->inputs[0]->type >= TB_ATOMIC_LOAD && n->inputs[0]->type <= TB_ATOMIC_PTROFF) {
+                return i == 1 && n->users ? ctx->normie_mask[REG_CLASS_GPR] : &TB_REG_EMPTY;
+            } else {
+                tb_todo();
+                return &TB_REG_EMPTY;
+            }
+        }
+
+        // FPR = OP(FPR, FPR)
+        case TB_FADD: case TB_FSUB: case TB_FMUL:
+        case TB_FDIV: case TB_FMIN: case TB_FMAX:
+        {
+            RegMask* rm = ctx->normie_mask[REG_CLASS_FPR];
+            if (ins) { ins[1] = ins[2] = rm; }
+            return rm;
+        }
+
+        // FPR = OP(FPR)
+        case TB_FNEG: case TB_FLOAT_EXT: case TB_FLOAT_TRUNC: {
+            RegMask* rm = ctx->normie_mask[REG_CLASS_FPR];
+            if (ins) { ins[1] = rm; }
+            return rm;
+        }
+
+        case TB_FLOAT2INT:
+        case TB_FLOAT2UINT: {
+            if (ins) { ins[1] = ctx->normie_mask[REG_CLASS_FPR]; }
+            return ctx->normie_mask[REG_CLASS_GPR];
+        }
+
+        case TB_INT2FLOAT:
+        case TB_UINT2FLOAT: {
+            if (ins) { ins[1] = ctx->normie_mask[REG_CLASS_GPR]; }
+            return ctx->normie_mask[REG_CLASS_FPR];
+        }
+
+        // GPR = OP(GPR, GPR)
+        case TB_MUL:
+        case TB_SHL: case TB_SHR: case TB_SAR: case TB_ROL: case TB_ROR:
+        case TB_UDIV: case TB_SDIV: case TB_UMOD: case TB_SMOD:
+        {
+            RegMask* rm = ctx->normie_mask[REG_CLASS_GPR];
+            if (ins) { ins[1] = ins[2] = rm; }
+            return rm;
+        }
+
+        // GPR = OP(GPR)
+        case TB_BSWAP: case TB_CLZ: case TB_CTZ: {
+            RegMask* rm = ctx->normie_mask[REG_CLASS_GPR];
+            if (ins) { ins[1] = rm; }
+            return rm;
+        }
+
+        case TB_POPCNT: {
+            RegMask* rm = ctx->normie_mask[REG_CLASS_GPR];
+            if (ins) {
+                ins[1] = rm;
+                ins[2] = ctx->normie_mask[REG_CLASS_FPR];
+            }
+            return rm;
+        }
+
+        // ANY_GPR = OP(ANY_GPR?, ANY_GPR)
+        case a64_add: case a64_sub: case a64_and: case a64_orr: case a64_eor:
+        // ANY_GPR = OP(ANY_GPR)
+        case a64_addimm: case a64_andimm: case a64_orrimm: case a64_eorimm:
+        case a64_ubfm: case a64_sbfm: case a64_extr:
+        {
+            RegMask* rm = ctx->normie_mask[REG_CLASS_GPR];
+            if (ins) {
+                FOR_N(i, 1, n->input_count) {
+                    ins[i] = n->inputs[i] ? rm : &TB_REG_EMPTY;
+                }
+
+                if (n->inputs[1] && n->inputs[1]->type == TB_MACH_FRAME_PTR) {
+                    ins[1] = &TB_REG_EMPTY;
+                }
+            }
+            return rm;
+        }
+
+        case a64_adr: {
+            if (ins) { ins[1] = &TB_REG_EMPTY; }
+            return ctx->normie_mask[REG_CLASS_GPR];
+        }
+
+        case a64_cmp: {
+            flags_constraint(ctx, n, ins);
+            return ctx->normie_mask[REG_CLASS_GPR];
+        }
+
+        case a64_csel: {
+            flags_constraint(ctx, n, ins);
+
+            RegMask* rm = normie_mask(ctx, n->dt);
+            if (ins) { ins[3] = ins[4] = rm; }
+            return rm;
+        }
+
+        case a64_cmpbr:
+        case a64_cbz:
+        case a64_tbz: {
+            flags_constraint(ctx, n, ins);
+            return &TB_REG_EMPTY;
+        }
+
+        case a64_switch: {
+            if (ins) { ins[1] = ctx->normie_mask[REG_CLASS_GPR]; }
+            return &TB_REG_EMPTY;
+        }
+
+        case a64_ldr:
+        case a64_str: {
+            A64MemOp* op = TB_NODE_GET_EXTRA(n);
+            if (ins) {
+                RegMask* rm = ctx->normie_mask[REG_CLASS_GPR];
+                ins[1] = &TB_REG_EMPTY;
+                ins[2] = n->inputs[2]->type == TB_MACH_FRAME_PTR ? &TB_REG_EMPTY : rm;
+                ins[3] = n->inputs[3] ? rm : &TB_REG_EMPTY;
+                if (n->type == a64_str) {
+                    ins[4] = n->inputs[4] ? normie_mask(ctx, op->mem_dt) : &TB_REG_EMPTY;
+                }
+            }
+            return n->type == a64_str ? &TB_REG_EMPTY : normie_mask(ctx, n->dt);
+        }
+
+        case TB_ATOMIC_LOAD:
+        case TB_ATOMIC_XCHG:
+        case TB_ATOMIC_ADD:
+        case TB_ATOMIC_AND:
+        case TB_ATOMIC_XOR:
+        case TB_ATOMIC_OR:
+        case TB_ATOMIC_PTROFF: {
+            if (ins) {
+                // x15 holds the old value in the loop
+                RegMask* rm = intern_regmask(ctx, REG_CLASS_GPR, false, ALL_GPRS & ~(1u << X15));
+                ins[0] = ins[1] = &TB_REG_EMPTY;
+                ins[2] = rm;
+                if (n->type != TB_ATOMIC_LOAD) {
+                    ins[3] = rm;
+                    ins[4] = intern_regmask(ctx, REG_CLASS_GPR, false, 1u << X15);
+                }
+            }
+            return &TB_REG_EMPTY;
+        }
+
+        case TB_MEMSET:
+        case TB_MEMCPY: {
+            if (ins) {
+                ins[1] = &TB_REG_EMPTY;
+                ins[2] = intern_regmask(ctx, REG_CLASS_GPR, false, 1u << X0);
+                ins[3] = intern_regmask(ctx, REG_CLASS_GPR, false, 1u << X1);
+                ins[4] = intern_regmask(ctx, REG_CLASS_GPR, false, 1u << X2);
+                ins[5] = intern_regmask(ctx, REG_CLASS_GPR, false, 1u << X0);
+                ins[6] = intern_regmask(ctx, REG_CLASS_GPR, false, 1u << X1);
+                ins[7] = intern_regmask(ctx, REG_CLASS_GPR, false, 1u << X2);
+            }
+            return &TB_REG_EMPTY;
+        }
+
+        case TB_RETURN: {
+            if (ins) {
+                ins[1] = &TB_REG_EMPTY; // mem
+                ins[2] = &TB_REG_EMPTY; // rpc
+
+                TB_FunctionPrototype* proto = ctx->f->prototype;
+                assert(proto->return_count <= 2 && "At most 2 return values :(");
+
+                int gprs_used = 0, fprs_used = 0;
+                FOR_N(i, 3, 3 + proto->return_count) {
+                    if (TB_IS_FLOAT_TYPE(n->inputs[i]->dt)) {
+                        ins[i] = intern_regmask(ctx, REG_CLASS_FPR, false, 1u << fprs_used++);
+                    } else {
+                        ins[i] = intern_regmask(ctx, REG_CLASS_GPR, false, 1u << gprs_used++);
+                    }
+                }
+
+                callee_saved_constraints(ctx, ins, 3 + proto->return_count);
+            }
+            return &TB_REG_EMPTY;
+        }
+
+        case TB_TAILCALL: {
+            if (ins) {
+                // the target can't be sitting in a param or callee-saved register
+                // since those get clobbered by the epilogue & the param moves, x8-x15
+                // are the volatile non-params.
+                ins[1] = &TB_REG_EMPTY;
+                ins[2] = n->inputs[2]->type == TB_MACH_SYMBOL ? &TB_REG_EMPTY : intern_regmask(ctx, REG_CLASS_GPR, false, 0xFF00);
+
+                // the callee-saved inputs come after the params
+                int callee_saved_count = tb_popcount(callee_saved_gprs(ctx)) + tb_popcount(callee_saved_fprs(ctx));
+                int param_end = n->input_count - callee_saved_count;
+
+                int gprs_used = 0, fprs_used = 0;
+                FOR_N(i, 3, param_end) {
+                    // tb_opt_tailcalls won't make tailcalls which need stack params
+                    if (TB_IS_FLOAT_TYPE(n->inputs[i]->dt)) {
+                        assert(fprs_used < 8 && "tailcalls can't pass params on the stack");
+                        ins[i] = intern_regmask(ctx, REG_CLASS_FPR, false, 1u << fprs_used++);
+                    } else {
+                        assert(gprs_used < 8 && "tailcalls can't pass params on the stack");
+                        ins[i] = intern_regmask(ctx, REG_CLASS_GPR, false, 1u << gprs_used++);
+                    }
+                }
+
+                callee_saved_constraints(ctx, ins, param_end);
+            }
+            return &TB_REG_EMPTY;
+        }
+
+        case a64_static_call:
+        case a64_call: {
+            if (ins) {
+                ins[1] = &TB_REG_EMPTY;
+                ins[2] = n->type == a64_static_call ? &TB_REG_EMPTY : ctx->normie_mask[REG_CLASS_GPR];
+
+                int gprs_used = 0, fprs_used = 0, stack_used = 0;
+                FOR_N(i, 3, n->input_count) {
+                    bool is_float = TB_IS_FLOAT_TYPE(n->inputs[i]->dt);
+                    int* used = is_float ? &fprs_used : &gprs_used;
+                    if (*used < 8) {
+                        ins[i] = intern_regmask(ctx, is_float ? REG_CLASS_FPR : REG_CLASS_GPR, false, 1u << *used);
+                        *used += 1;
+                    } else {
+                        ins[i] = intern_regmask(ctx, REG_CLASS_STK, false, ctx->param_count + stack_used);
+                        stack_used += 1;
+                    }
+                }
+
+                size_t j = n->input_count;
+                A64Call* op_extra = TB_NODE_GET_EXTRA(n);
+                for (uint64_t bits = op_extra->clobber_gpr, k = 0; bits; bits >>= 1, k++) {
+                    if (bits & 1) { ins[j++] = intern_regmask(ctx, REG_CLASS_GPR, false, 1u << k); }
+                }
+
+                for (uint64_t bits = op_extra->clobber_fpr, k = 0; bits; bits >>= 1, k++) {
+                    if (bits & 1) { ins[j++] = intern_regmask(ctx, REG_CLASS_FPR, false, 1u << k); }
+                }
+            }
+
+            // the tuple node doesn't itself produce the result
+            return &TB_REG_EMPTY;
+        }
+
+        default:
+        tb_todo();
+        return &TB_REG_EMPTY;
+    }
+}
+
+static int op_reg_at(Ctx* ctx, TB_Node* n, int class) {
+    assert(ctx->vreg_map[n->gvn] > 0);
+    VReg* vreg = &ctx->vregs[ctx->vreg_map[n->gvn]];
+    assert(vreg->assigned >= 0);
+    assert(vreg->class == class);
+    return vreg->assigned;
+}
+static int op_gpr_at(Ctx* ctx, TB_Node* n) { return op_reg_at(ctx, n, REG_CLASS_GPR); }
+static int op_fpr_at(Ctx* ctx, TB_Node* n) { return op_reg_at(ctx, n, REG_CLASS_FPR); }
+
+// NULL operands are ZR
+static int op_gpr_or_zr(Ctx* ctx, TB_Node* n) { return n ? op_gpr_at(ctx, n) : ZR; }
+
+static int stk_offset(Ctx* ctx, int reg) {
+    if (reg >= STACK_BASE_REG_NAMES) {
+        // spills (and locals) are right below the frame record
+        return ctx->stack_usage - ((reg - STACK_BASE_REG_NAMES) + 1)*8;
+    } else if (reg >= ctx->param_count) {
+        // param passing slots
+        return (reg - ctx->param_count)*8;
+    } else {
+        // argument slots, they're past the frame record
+        return ctx->stack_usage + ctx->stack_header + reg*8;
+    }
+}
+
+static int tmp_at(Ctx* ctx, TB_Node* n, int i) {
+    Tmps* tmps = nl_table_get(&ctx->tmps_map, n);
+    return ctx->vregs[tmps->elems[i]].assigned;
+}
+
+// uses whichever of movz or movn skips the most halfwords, anything which would
+// take more than one instruction tries the logical immediates first.
+static void emit_movimm(TB_CGEmitter* restrict e, GPR dst, uint64_t x, bool is_64bit) {
+    int chunks = is_64bit ? 4 : 2;
+    if (!is_64bit) { x &= 0xFFFFFFFF; }
+
+    int zeros = 0, ones = 0;
+    FOR_N(i, 0, chunks) {
+        uint16_t h = x >> (i*16);
+        zeros += h == 0;
+        ones  += h == 0xFFFF;
+    }
+
+    bool inv = ones > zeros;
+    if (chunks - (inv ? ones : zeros) > 1) {
+        int bitmask = encode_logical_imm(x, is_64bit);
+        if (bitmask >= 0) {
+            emit_logic_imm(e, LOGIC_ORR, dst, ZR, bitmask, is_64bit);
+            return;
+        }
+    }
+
+    bool first = true;
+    FOR_N(i, 0, chunks) {
+        uint16_t h = x >> (i*16);
+        if (h == (inv ? 0xFFFF : 0)) {
+            continue;
+        }
+
+        if (first) {
+            emit_movw(e, inv ? MOVN : MOVZ, dst, inv ? ~h : h, i, is_64bit);
+            first = false;
+        } else {
+            emit_movw(e, MOVK, dst, h, i, is_64bit);
+        }
+    }
+
+    if (first) {
+        emit_movw(e, inv ? MOVN : MOVZ, dst, 0, 0, is_64bit);
+    }
+}
+
+// d = n + x, either of them can be SP. big immediates go through x16.
+static void emit_addimm_any(TB_CGEmitter* restrict e, GPR d, GPR n, int64_t x, bool is_64bit) {
+    bool sub = x < 0;
+    uint64_t abs = sub ? -(uint64_t) x : x;
+    if (abs < 4096) {
+        if (d != n || abs != 0) {
+            emit_addsub_imm(e, sub, false, d, n, abs, false, is_64bit);
+        }
+    } else if (abs < (1 << 24)) {
+        emit_addsub_imm(e, sub, false, d, n, abs >> 12, true, is_64bit);
+        if (abs & 0xFFF) {
+            emit_addsub_imm(e, sub, false, d, d, abs & 0xFFF, false, is_64bit);
+        }
+    } else {
+        emit_movimm(e, IP0, abs, true);
+        if (is_64bit) {
+            emit_addsub_ext(e, sub, d, n, IP0);
+        } else {
+            emit_addsub_reg(e, sub, false, d, n, IP0, SHIFT_LSL, 0, false);
+        }
+    }
+}
+
+// cmp a, #x (or cmn)
+static void emit_cmp_imm(TB_CGEmitter* restrict e, GPR a, int64_t x, bool is_64bit) {
+    if (fits_addsub_imm(x)) {
+        emit_addsub_imm(e, true, true, ZR, a, x >= 4096 ? x >> 12 : x, x >= 4096, is_64bit);
+    } else if (fits_addsub_imm(-x)) {
+        emit_addsub_imm(e, false, true, ZR, a, -x >= 4096 ? -x >> 12 : -x, -x >= 4096, is_64bit);
+    } else {
+        emit_movimm(e, IP0, x, is_64bit);
+        emit_addsub_reg(e, true, true, ZR, a, IP0, SHIFT_LSL, 0, is_64bit);
+    }
+}
+
+// picks the addressing mode for [base + disp] or [base + index], x17 gets the
+// displacement when it doesn't fit either immediate form.
+static void emit_ldst(TB_CGEmitter* restrict e, int size, bool v, int opc, int t, GPR base, GPR index, bool scaled, int32_t disp) {
+    if (index != GPR_NONE) {
+        if (disp != 0) {
+            emit_addimm_any(e, IP1, base, disp, true);
+            base = IP1;
+        }
+        emit_ldst_reg(e, size, v, opc, t, base, index, scaled);
+    } else if (disp >= 0 && (disp & ((1 << size) - 1)) == 0 && (disp >> size) < 4096) {
+        emit_ldst_imm(e, size, v, opc, t, base, disp >> size);
+    } else if (disp >= -256 && disp < 256) {
+        emit_ldst_unscaled(e, size, v, opc, t, base, disp);
+    } else {
+        emit_movimm(e, IP1, disp, true);
+        emit_ldst_reg(e, size, v, opc, t, base, IP1, false);
+    }
+}
+
+// sets the flags for a cmp, csel or cmpbr
+static void emit_compare(Ctx* restrict ctx, TB_CGEmitter* e, TB_Node* n) {
+    A64Op* op = TB_NODE_GET_EXTRA(n);
+    bool is_64bit = legalize_int(op->dt);
+    switch (op->cmp) {
+        case CMP_REG:
+        emit_addsub_reg(e, true, true, ZR, op_gpr_at(ctx, n->inputs[1]), op_gpr_at(ctx, n->inputs[2]), SHIFT_LSL, 0, is_64bit);
+        break;
+
+        case CMP_IMM:
+        emit_cmp_imm(e, op_gpr_at(ctx, n->inputs[1]), op->imm, is_64bit);
+        break;
+
+        case CMP_TST:
+        if (n->inputs[2]) {
+            emit_logic_reg(e, LOGIC_ANDS, false, ZR, op_gpr_at(ctx, n->inputs[1]), op_gpr_at(ctx, n->inputs[2]), SHIFT_LSL, 0, is_64bit);
+        } else {
+            int bitmask = encode_logical_imm(is_64bit ? op->imm : (uint32_t) op->imm, is_64bit);
+            assert(bitmask >= 0);
+            emit_logic_imm(e, LOGIC_ANDS, ZR, op_gpr_at(ctx, n->inputs[1]), bitmask, is_64bit);
+        }
+        break;
+
+        case CMP_FP:
+        emit_fcmp(e, op_fpr_at(ctx, n->inputs[1]), n->inputs[2] ? op_fpr_at(ctx, n->inputs[2]) : GPR_NONE, op->dt.type == TB_TAG_F64);
+        break;
+    }
+}
+
+static void emit_goto(Ctx* ctx, TB_CGEmitter* e, MachineBB* succ) {
+    if (ctx->fallthrough != succ->id) {
+        size_t pos = e->count;
+        emit_b(e, 0);
+        tb_emit_branch(e, &e->labels[succ->id], pos);
+    }
+}
+
+////////////////////////////////
+// Switch lowering hooks (see switch_lower.h), tmp[0] is x16 which the immediate
+// helpers also clobber, tmp[1] (x17) holds the index.
+////////////////////////////////
+static void switch_bcond(TB_CGEmitter* e, Cond cc, uint32_t* label) {
+    size_t pos = e->count;
+    emit_bcond(e, cc, 0);
+    tb_emit_branch(e, label, pos);
+}
+
+// x17 = key - lo, zero extended to 64bits
+static void switch_index(TB_CGEmitter* e, SwitchEmit* s, uint64_t lo) {
+    emit_addimm_any(e, s->tmp[1], s->key, -(int64_t) lo, s->plan.is_64bit);
+}
+
+static void switch_cmp_branch(Ctx* restrict ctx, TB_CGEmitter* e, SwitchEmit* s, int cc, uint64_t x, uint32_t* label) {
+    static const Cond conds[] = { [SW_EQ] = EQ, [SW_LE] = LS, [SW_GE] = HS };
+    emit_cmp_imm(e, s->key, x, s->plan.is_64bit);
+    switch_bcond(e, conds[cc], label);
+}
+
+static void switch_range_branch(Ctx* restrict ctx, TB_CGEmitter* e, SwitchEmit* s, uint64_t lo, uint64_t hi, uint32_t* label) {
+    switch_index(e, s, lo);
+    emit_cmp_imm(e, s->tmp[1], hi - lo, s->plan.is_64bit);
+    switch_bcond(e, LS, label);
+}
+
+static void switch_bit_test(Ctx* restrict ctx, TB_CGEmitter* e, SwitchEmit* s, SwitchCluster* c, uint32_t* miss) {
+    switch_index(e, s, c->lo);
+    if (miss) {
+        emit_cmp_imm(e, s->tmp[1], c->hi - c->lo, true);
+        switch_bcond(e, HI, miss);
+    }
+
+    FOR_N(i, 0, c->count) {
+        // the mask shifted down by the index has the answer in the bottom bit
+        emit_movimm(e, s->tmp[0], c->masks[i], true);
+        emit_dp2(e, DP2_LSRV, s->tmp[0], s->tmp[0], s->tmp[1], true);
+
+        size_t pos = e->count;
+        emit_tbz(e, true, s->tmp[0], 0, 0);
+        tb_emit_branch(e, switch_target_label(ctx, e, c->targets[i]), pos);
+    }
+}
+
+static void switch_jump_table(Ctx* restrict ctx, TB_CGEmitter* e, SwitchEmit* s, SwitchCluster* c, uint32_t* miss) {
+    GPR base = s->tmp[0], idx = s->tmp[1];
+    switch_index(e, s, c->lo);
+    if (miss) {
+        emit_cmp_imm(e, idx, c->count - 1, true);
+        switch_bcond(e, HI, miss);
+    }
+
+    switch_add_table(ctx, e->count, c);
+    emit_adr(e, base);
+
+    // the entries are relative to the table
+    emit_ldst_reg(e, 2, false, 2, idx, base, idx, true);
+    emit_addsub_reg(e, false, false, base, base, idx, SHIFT_LSL, 0, true);
+    emit_br(e, base);
+}
+
+static void switch_jump(Ctx* restrict ctx, TB_CGEmitter* e, uint32_t* label) {
+    size_t pos = e->count;
+    emit_b(e, 0);
+    tb_emit_branch(e, label, pos);
+}
+
+static void switch_bind(Ctx* restrict ctx, TB_CGEmitter* e, uint32_t* label) {
+    tb_resolve_branch(e, label, e->count);
+}
+
+static void emit_epilogue(Ctx* restrict ctx, TB_CGEmitter* e) {
+    // we only have a frame record if we needed one
+    if (ctx->stack_header) {
+        if (ctx->stack_usage) {
+            EMIT4(e, 0x910003BF); // mov sp, x29
+        }
+        EMIT4(e, 0xA8C17BFD); // ldp x29, x30, [sp], #16
+    }
+}
+
+static void emit_two_way(Ctx* restrict ctx, TB_CGEmitter* e, TB_Node* n) {
+    A64Op* op = TB_NODE_GET_EXTRA(n);
+
+    int succ[2];
+    FOR_USERS(u, n) {
+        if (USERN(u)->type == TB_BRANCH_PROJ) {
+            int index = TB_NODE_GET_EXTRA_T(USERN(u), TB_NodeProj)->index;
+            succ[index] = node_to_bb(ctx, cfg_next_bb_after_cproj(USERN(u)))->id;
+        }
+    }
+
+    Cond cc = op->cc;
+    if (ctx->fallthrough == succ[0]) {
+        // if flipping avoids a jmp, do that
+        cc ^= 1;
+        SWAP(int, succ[0], succ[1]);
+    }
+
+    size_t pos = e->count;
+    if (n->type == a64_cbz) {
+        emit_cbz(e, cc == NE, op_gpr_at(ctx, n->inputs[1]), 0, legalize_int(op->dt));
+    } else if (n->type == a64_tbz) {
+        emit_tbz(e, cc == NE, op_gpr_at(ctx, n->inputs[1]), op->imm, 0);
+    } else {
+        emit_compare(ctx, e, n);
+        pos = e->count;
+        emit_bcond(e, cc, 0);
+    }
+    tb_emit_branch(e, &e->labels[succ[0]], pos);
+
+    if (ctx->fallthrough != succ[1]) {
+        pos = e->count;
+        emit_b(e, 0);
+        tb_emit_branch(e, &e->labels[succ[1]], pos);
+    }
+}
+
+static void node_emit(Ctx* restrict ctx, TB_CGEmitter* e, TB_Node* n, VReg* vreg) {
+    switch (n->type) {
+        // some ops don't do shit lmao
+        case TB_PHI:
+        case TB_POISON:
+        case TB_REGION:
+        case TB_AFFINE_LOOP:
+        case TB_NATURAL_LOOP:
+        case TB_PROJ:
+        case TB_BRANCH_PROJ:
+        case TB_MACH_PROJ:
+        case TB_LOCAL:
+        case TB_SPLITMEM:
+        case TB_MERGEMEM:
+        case TB_MACH_SYMBOL:
+        case TB_MACH_FRAME_PTR:
+        case TB_CALLGRAPH:
+        break;
+
+        case TB_NEVER_BRANCH: {
+            TB_Node* proj0 = USERN(proj_with_index(n, 0));
+            TB_Node* succ_n = cfg_next_bb_after_cproj(proj0);
+            emit_goto(ctx, e, node_to_bb(ctx, succ_n));
+            break;
+        }
+
+        case TB_ICONST: {
+            uint64_t x = TB_NODE_GET_EXTRA_T(n, TB_NodeInt)->value;
+            emit_movimm(e, op_gpr_at(ctx, n), x, legalize_int(n->dt));
+            break;
+        }
+
+        case TB_F32CONST:
+        case TB_F64CONST: {
+            bool is_f64 = n->type == TB_F64CONST;
+            uint64_t bits = is_f64
+                ? (Cvt_F64U64) { .f = TB_NODE_GET_EXTRA_T(n, TB_NodeFloat64)->value }.i
+                : (Cvt_F32U32) { .f = TB_NODE_GET_EXTRA_T(n, TB_NodeFloat32)->value }.i;
+
+            int dst = op_fpr_at(ctx, n);
+            int imm8 = encode_fp_imm8(bits, is_f64);
+            if (bits == 0) {
+                emit_fcvt_int(e, FCVT_FMOV_I, dst, ZR, is_f64, is_f64);
+            } else if (imm8 >= 0) {
+                emit_fmov_imm(e, dst, imm8, is_f64);
+            } else {
+                emit_movimm(e, IP0, bits, is_f64);
+                emit_fcvt_int(e, FCVT_FMOV_I, dst, IP0, is_f64, is_f64);
+            }
+            break;
+        }
+
+        case TB_MACH_MOVE:
+        case TB_MACH_COPY: {
+            VReg* src_vreg = &ctx->vregs[ctx->vreg_map[n->inputs[1]->gvn]];
+            int dst = vreg->assigned, dst_class = vreg->class;
+            int src = src_vreg->assigned, src_class = src_vreg->class;
+            if (dst == src && dst_class == src_class) {
+                break;
+            }
 
-enum {
-    //   OP reg, imm
-    TILE_HAS_IMM = 1
-};
+            COMMENT("%%%u = copy(%%%u)", n->gvn, n->inputs[1]->gvn);
 
-// true for 64bit
-static bool legalize_int(TB_DataType dt) { return dt.type == TB_TAG_PTR || (dt.type == TB_TAG_INT && dt.data > 32); }
+            // stack slots are always 8 bytes
+            if (dst_class == REG_CLASS_STK) {
+                assert(src_class != REG_CLASS_STK);
+                emit_ldst(e, 3, src_class == REG_CLASS_FPR, 0, src, SP, GPR_NONE, false, stk_offset(ctx, dst));
+            } else if (src_class == REG_CLASS_STK) {
+                emit_ldst(e, 3, dst_class == REG_CLASS_FPR, 1, dst, SP, GPR_NONE, false, stk_offset(ctx, src));
+            } else if (dst_class == REG_CLASS_GPR && src_class == REG_CLASS_GPR) {
+                emit_mov(e, dst, src, n->dt.type != TB_TAG_INT || n->dt.data > 32);
+            } else if (dst_class == REG_CLASS_FPR && src_class == REG_CLASS_FPR) {
+                emit_fp1(e, FP1_FMOV, dst, src, n->dt.type != TB_TAG_F32);
+            } else if (dst_class == REG_CLASS_FPR) {
+                bool is_64bit = n->dt.type != TB_TAG_F32;
+                emit_fcvt_int(e, FCVT_FMOV_I, dst, src, is_64bit, is_64bit);
+            } else {
+                bool is_64bit = n->inputs[1]->dt.type != TB_TAG_F32;
+                emit_fcvt_int(e, FCVT_FMOV_F, dst, src, is_64bit, is_64bit);
+            }
+            break;
+        }
 
-static bool try_for_imm12(int bits, TB_Node* n, int32_t* out_x) {
-    if (n->type != TB_ICONST) {
-        return false;
-    }
+        case TB_CYCLE_COUNTER: {
+            // mrs xd, cntvct_el0
+            EMIT4(e, 0xD53BE040 | op_gpr_at(ctx, n));
+            break;
+        }
 
-    TB_NodeInt* i = TB_NODE_GET_EXTRA(n);
-    if (bits > 12) {
-        bool sign = (i->value >> 11ull) & 1;
-        uint64_t top = i->value >> 12ull;
+        // unreachable blocks (like a switch's default when it can't happen) trap
+        // rather than running off into whatever comes next.
+        case TB_TRAP:
+        case TB_UNREACHABLE: {
+            EMIT4(e, 0xD4200020); // brk #1
+            break;
+        }
 
-        // if the sign matches the rest of the top bits, we can sign extend just fine
-        if (top != (sign ? 0xFFFFFFFFFFFFF : 0)) {
-            return false;
+        case TB_DEBUGBREAK: {
+            EMIT4(e, 0xD43E0000); // brk #0xf000
+            break;
         }
-    }
 
-    *out_x = i->value;
-    return true;
-}
+        // reads the poll page, when someone wants this thread to stop they protect
+        // the page and it'll fault here.
+        case TB_SAFEPOINT_POLL: {
+            emit_ldst(e, 2, false, 1, ZR, op_gpr_at(ctx, n->inputs[2]), GPR_NONE, false, 0); // ldr wzr, [xN]
+            break;
+        }
 
-static bool _2addr(TB_Node* n) { return false; }
-static void init_ctx(Ctx* restrict ctx, TB_ABI abi) {
-    ctx->sched = greedy_scheduler;
-    ctx->_2addr = _2addr;
-    ctx->regalloc = tb__lsra;
+        // epilogue
+        case TB_RETURN: {
+            size_t pos = e->count;
+            emit_epilogue(ctx, e);
+            emit_ret(e, LR);
+            ctx->epilogue_length = e->count - pos;
+            break;
+        }
 
-    uint32_t all_gprs = UINT32_MAX & ~(1u << SP);
-    if (ctx->features.gen & TB_FEATURE_FRAME_PTR) {
-        all_gprs &= ~(1u << FP);
-    }
-    ctx->num_regs[1] = 32;
-    ctx->normie_mask[1] = REGMASK(GPR, all_gprs);
+        case TB_TAILCALL: {
+            emit_epilogue(ctx, e);
+            if (n->inputs[2]->type == TB_MACH_SYMBOL) {
+                TB_Symbol* sym = TB_NODE_GET_EXTRA_T(n->inputs[2], TB_NodeMachSymbol)->sym;
+                tb_emit_symbol_patch(e->output, sym, e->count);
+                emit_b(e, 0);
+            } else {
+                emit_br(e, op_gpr_at(ctx, n->inputs[2]));
+            }
+            break;
+        }
 
-    // x19 - x29 are callee saved
-    ctx->callee_saved[0] = ((1u << 10u) - 1) << 19u;
-}
+        case a64_add:
+        case a64_sub: {
+            A64Op* op = TB_NODE_GET_EXTRA(n);
+            GPR dst = op_gpr_at(ctx, n);
+            GPR lhs = op_gpr_or_zr(ctx, n->inputs[1]);
+            GPR rhs = op_gpr_at(ctx, n->inputs[2]);
+            emit_addsub_reg(e, n->type == a64_sub, false, dst, lhs, rhs, op->shift, op->amount, legalize_int(op->dt));
+            break;
+        }
 
-static RegMask isel_node(Ctx* restrict ctx, Tile* dst, TB_Node* n) {
-    switch (n->type) {
-        case TB_ROOT: {
-            TileInput* ins = tile_set_ins(ctx, dst, n, 4, n->input_count);
-            int rets = n->input_count - 4;
+        case a64_and:
+        case a64_orr:
+        case a64_eor: {
+            static const int ops[] = { LOGIC_AND, LOGIC_ORR, LOGIC_EOR };
+            A64Op* op = TB_NODE_GET_EXTRA(n);
+            GPR dst = op_gpr_at(ctx, n);
+            GPR lhs = op_gpr_or_zr(ctx, n->inputs[1]);
+            GPR rhs = op_gpr_at(ctx, n->inputs[2]);
+            emit_logic_reg(e, ops[n->type - a64_and], op->invert, dst, lhs, rhs, op->shift, op->amount, legalize_int(op->dt));
+            break;
+        }
 
-            assert(rets <= 2 && "At most 2 return values :(");
-            FOR_N(i, 0, rets) {
-                ins[i].mask = REGMASK(GPR, 1 << i);
+        case a64_addimm: {
+            A64Op* op = TB_NODE_GET_EXTRA(n);
+            GPR dst = op_gpr_at(ctx, n);
+            if (n->inputs[1]->type == TB_MACH_FRAME_PTR) {
+                emit_addimm_any(e, dst, SP, ctx->stack_usage + op->imm, true);
+            } else {
+                emit_addimm_any(e, dst, op_gpr_at(ctx, n->inputs[1]), op->imm, legalize_int(op->dt));
             }
-            return REGEMPTY;
+            break;
         }
 
-        case TB_PROJ:
-        int i = TB_NODE_GET_EXTRA_T(n, TB_NodeProj)->index;
-        if (n->inputs[0]->type == TB_ROOT) {
-            return REGMASK(GPR, i >= 3 ? (1u << (i - 3)) : 0);
-        } else if (n->inputs[0]->type == TB_CALL) {
-            if (i == 2)      return REGMASK(GPR, 1 << X0);
-            else if (i == 3) return REGMASK(GPR, 1 << X1);
-            else return REGEMPTY;
-        } else if (n->inputs[0]->type == TB_BRANCH) {
-            return REGEMPTY;
-        } else {
-            tb_todo();
+        case a64_andimm:
+        case a64_orrimm:
+        case a64_eorimm: {
+            static const int ops[] = { LOGIC_AND, LOGIC_ORR, LOGIC_EOR };
+            A64Op* op = TB_NODE_GET_EXTRA(n);
+            bool is_64bit = legalize_int(op->dt);
+
+            int bitmask = encode_logical_imm(is_64bit ? op->imm : (uint32_t) op->imm, is_64bit);
+            assert(bitmask >= 0);
+            emit_logic_imm(e, ops[n->type - a64_andimm], op_gpr_at(ctx, n), op_gpr_at(ctx, n->inputs[1]), bitmask, is_64bit);
+            break;
         }
 
-        case TB_ARRAY_ACCESS:
-        tile_broadcast_ins(ctx, dst, n, 1, n->input_count, ctx->normie_mask[1]);
-        return ctx->normie_mask[1];
+        case a64_ubfm:
+        case a64_sbfm: {
+            A64Op* op = TB_NODE_GET_EXTRA(n);
+            emit_bitfield(e, n->type == a64_ubfm ? UBFM : SBFM, op_gpr_at(ctx, n), op_gpr_at(ctx, n->inputs[1]), op->immr, op->imms, legalize_int(op->dt));
+            break;
+        }
 
-        case TB_ICONST:
-        return ctx->normie_mask[1];
+        case a64_extr: {
+            A64Op* op = TB_NODE_GET_EXTRA(n);
+            GPR src = op_gpr_at(ctx, n->inputs[1]);
+            emit_extr(e, op_gpr_at(ctx, n), src, src, op->imm, legalize_int(op->dt));
+            break;
+        }
 
-        case TB_MUL:
-        case TB_UDIV:
-        case TB_SDIV:
-        case TB_XOR:
-        tile_broadcast_ins(ctx, dst, n, 1, n->input_count, ctx->normie_mask[1]);
-        return ctx->normie_mask[1];
+        case a64_adr: {
+            // adrp xd, sym
+            // add  xd, xd, :lo12:sym
+            TB_Symbol* sym = TB_NODE_GET_EXTRA_T(n->inputs[1], TB_NodeMachSymbol)->sym;
+            GPR dst = op_gpr_at(ctx, n);
+            tb_emit_symbol_patch(e->output, sym, e->count);
+            emit_adrp(e, dst);
+            tb_emit_symbol_patch(e->output, sym, e->count);
+            emit_addsub_imm(e, false, false, dst, dst, 0, false, true);
+            break;
+        }
 
-        // binary ops
-        case TB_SHL:
-        case TB_SHR:
-        case TB_ADD:
-        case TB_SUB: {
-            int32_t x;
-            if (try_for_imm12(n->dt.data, n->inputs[2], &x)) {
-                tile_broadcast_ins(ctx, dst, n, 1, 2, ctx->normie_mask[1]);
-                dst->flags |= TILE_HAS_IMM;
+        case a64_cmp: {
+            A64Op* op = TB_NODE_GET_EXTRA(n);
+            emit_compare(ctx, e, n);
+            // cset wd, cc
+            emit_csel(e, true, op_gpr_at(ctx, n), ZR, ZR, op->cc ^ 1, false);
+            break;
+        }
+
+        case a64_csel: {
+            A64Op* op = TB_NODE_GET_EXTRA(n);
+            emit_compare(ctx, e, n);
+            if (TB_IS_FLOAT_TYPE(n->dt)) {
+                emit_fcsel(e, op_fpr_at(ctx, n), op_fpr_at(ctx, n->inputs[3]), op_fpr_at(ctx, n->inputs[4]), op->cc, n->dt.type == TB_TAG_F64);
             } else {
-                tile_broadcast_ins(ctx, dst, n, 1, n->input_count, ctx->normie_mask[1]);
+                emit_csel(e, false, op_gpr_at(ctx, n), op_gpr_at(ctx, n->inputs[3]), op_gpr_at(ctx, n->inputs[4]), op->cc, legalize_int(n->dt));
             }
-            return ctx->normie_mask[1];
+            break;
         }
 
-        default:
-        tb_todo();
-    }
-}
+        case a64_cmpbr:
+        case a64_cbz:
+        case a64_tbz: {
+            emit_two_way(ctx, e, n);
+            break;
+        }
 
-static void pre_emit(Ctx* restrict ctx, TB_CGEmitter* e, TB_Node* n) {
-    // TODO(NeGate): optionally preserve the frame pointer
-    // TODO(NeGate): stack allocation
-    ctx->prologue_length = ctx->emit.count;
-}
+        case a64_switch: {
+            // the plan is cached so it has to be made outside of the labels' scratch
+            SwitchPlan* plan = switch_get_plan(ctx, n);
+            TB_Arena* arena = ctx->f->arena;
+            TB_ArenaSavepoint sp = tb_arena_save(arena);
 
-static GPR gpr_at(LiveInterval* l) { assert(l->class == REG_CLASS_GPR); return l->assigned; }
-static void emit_tile(Ctx* restrict ctx, TB_CGEmitter* e, Tile* t) {
-    if (t->tag == TILE_SPILL_MOVE) {
-        GPR dst = gpr_at(t->interval);
-        GPR src = gpr_at(t->ins[0].src);
-        if (dst != src) {
-            emit_mov(e, dst, src, true);
+            // no RA temps, x16 & x17 are always free for us
+            SwitchEmit s = { *plan, arena, op_gpr_at(ctx, n->inputs[1]), { IP0, IP1 } };
+            switch_emit(ctx, e, &s);
+            tb_arena_restore(arena, sp);
+            break;
         }
-    } else {
-        TB_Node* n = t->n;
-        switch (n->type) {
-            // projections don't manage their own work, that's the
-            // TUPLE node's job.
-            case TB_PROJ: break;
 
-            case TB_ROOT: {
-                emit_ret(e, LR);
-                break;
+        case a64_ldr:
+        case a64_str: {
+            A64MemOp* op = TB_NODE_GET_EXTRA(n);
+            int size = mem_size_log2(op->mem_dt);
+
+            int t, opc;
+            bool v = false;
+            if (n->type == a64_str) {
+                TB_Node* val = n->inputs[4];
+                v   = val && TB_IS_FLOAT_TYPE(op->mem_dt);
+                t   = val ? op_reg_at(ctx, val, v ? REG_CLASS_FPR : REG_CLASS_GPR) : ZR;
+                opc = 0;
+            } else {
+                v   = TB_IS_FLOAT_TYPE(op->mem_dt);
+                t   = op_reg_at(ctx, n, v ? REG_CLASS_FPR : REG_CLASS_GPR);
+                opc = op->sext ? (legalize_int(n->dt) ? 2 : 3) : 1;
+            }
+
+            GPR base;
+            int32_t disp = op->disp;
+            if (n->inputs[2]->type == TB_MACH_FRAME_PTR) {
+                base = SP;
+                disp += ctx->stack_usage;
+            } else {
+                base = op_gpr_at(ctx, n->inputs[2]);
             }
 
-            case TB_ICONST: {
-                bool is_64bit = false;
-                GPR dst = gpr_at(t->interval);
-                uint64_t imm = TB_NODE_GET_EXTRA_T(n, TB_NodeInt)->value;
+            GPR index = n->inputs[3] ? op_gpr_at(ctx, n->inputs[3]) : GPR_NONE;
+            emit_ldst(e, size, v, opc, t, base, index, op->scaled, disp);
+            break;
+        }
 
-                int shift = 0; bool first = true;
-                while (imm) {
-                    if (imm & 0xFFFF) {
-                        emit_movimm(e, dst, imm & 0xFFFF, shift / 16, is_64bit, first);
-                        first = false;
-                    }
-                    imm >>= 16, shift += 16;
-                }
-                break;
+        case TB_MUL: {
+            GPR dst = op_gpr_at(ctx, n);
+            emit_dp3(e, MADD, dst, op_gpr_at(ctx, n->inputs[1]), op_gpr_at(ctx, n->inputs[2]), ZR, legalize_int(n->dt));
+            break;
+        }
+
+        case TB_UDIV:
+        case TB_SDIV:
+        case TB_UMOD:
+        case TB_SMOD: {
+            bool is_64bit = legalize_int(n->dt);
+            bool is_signed = n->type == TB_SDIV || n->type == TB_SMOD;
+            GPR dst = op_gpr_at(ctx, n);
+            GPR lhs = op_gpr_at(ctx, n->inputs[1]);
+            GPR rhs = op_gpr_at(ctx, n->inputs[2]);
+            if (n->type == TB_UDIV || n->type == TB_SDIV) {
+                emit_dp2(e, is_signed ? DP2_SDIV : DP2_UDIV, dst, lhs, rhs, is_64bit);
+            } else {
+                // there's no remainder op, a - (a / b) * b
+                emit_dp2(e, is_signed ? DP2_SDIV : DP2_UDIV, IP0, lhs, rhs, is_64bit);
+                emit_dp3(e, MSUB, dst, IP0, rhs, lhs, is_64bit);
             }
+            break;
+        }
 
-            case TB_SDIV: {
-                bool is_64bit = legalize_int(n->dt);
-                GPR dst = gpr_at(t->interval);
-                GPR lhs = gpr_at(t->ins[0].src);
-                GPR rhs = gpr_at(t->ins[1].src);
-                emit_dp_r(e, SDIV, dst, lhs, rhs, 0, 0, is_64bit);
-                break;
+        case TB_SHL:
+        case TB_SHR:
+        case TB_SAR:
+        case TB_ROL:
+        case TB_ROR: {
+            static const int ops[] = { DP2_LSLV, DP2_LSRV, DP2_ASRV, DP2_RORV, DP2_RORV };
+            bool is_64bit = legalize_int(n->dt);
+            GPR dst = op_gpr_at(ctx, n);
+            GPR lhs = op_gpr_at(ctx, n->inputs[1]);
+            GPR rhs = op_gpr_at(ctx, n->inputs[2]);
+            if (n->type == TB_ROL) {
+                // rotate left is a rotate right by the negated amount
+                emit_addsub_reg(e, true, false, IP0, ZR, rhs, SHIFT_LSL, 0, is_64bit);
+                rhs = IP0;
             }
+            emit_dp2(e, ops[n->type - TB_SHL], dst, lhs, rhs, is_64bit);
+            break;
+        }
 
-            case TB_SHL:
-            case TB_SHR:
-            case TB_SAR: {
-                bool is_64bit = legalize_int(n->dt);
-                GPR dst = gpr_at(t->interval);
-                GPR lhs = gpr_at(t->ins[0].src);
-                if (t->flags & TILE_HAS_IMM) {
-                    assert(n->inputs[2]->type == TB_ICONST);
-                    TB_NodeInt* i = TB_NODE_GET_EXTRA(n->inputs[2]);
-
-                    int amt = 31 - i->value;
-                    emit_bitfield(e, UBFM, dst, lhs, amt + 1, amt, is_64bit);
-                } else {
-                    // GPR rhs = gpr_at(t->ins[1].src);
-                    tb_todo();
-                }
-                break;
+        case TB_BSWAP: {
+            int bits = int_bits(n->dt);
+            int op = bits == 16 ? DP1_REV16 : bits == 32 ? DP1_REV32 : DP1_REV64;
+            emit_dp1(e, op, op_gpr_at(ctx, n), op_gpr_at(ctx, n->inputs[1]), bits > 32);
+            break;
+        }
+
+        case TB_CLZ:
+        case TB_CTZ: {
+            bool is_64bit = legalize_int(n->inputs[1]->dt);
+            GPR dst = op_gpr_at(ctx, n);
+            GPR src = op_gpr_at(ctx, n->inputs[1]);
+            if (n->type == TB_CTZ) {
+                // ctz(x) = clz(rbit(x))
+                emit_dp1(e, DP1_RBIT, dst, src, is_64bit);
+                src = dst;
             }
+            emit_dp1(e, DP1_CLZ, dst, src, is_64bit);
+            break;
+        }
+
+        case TB_POPCNT: {
+            bool is_64bit = legalize_int(n->inputs[1]->dt);
+            GPR dst = op_gpr_at(ctx, n);
+            int tmp = tmp_at(ctx, n, 0);
+            // fmov dN, xN
+            // cnt  vN.8b, vN.8b
+            // addv bN, vN.8b
+            // fmov wD, sN
+            emit_fcvt_int(e, FCVT_FMOV_I, tmp, op_gpr_at(ctx, n->inputs[1]), is_64bit, is_64bit);
+            EMIT4(e, 0x0E205800 | (tmp << 5) | tmp);
+            EMIT4(e, 0x0E31B800 | (tmp << 5) | tmp);
+            emit_fcvt_int(e, FCVT_FMOV_F, dst, tmp, false, false);
+            break;
+        }
 
-            case TB_XOR:
-            case TB_ADD:
-            case TB_SUB: {
-                const static int ops[] = { -1, -1, EOR, ADD, SUB };
-                int op = ops[n->type - TB_AND];
+        case TB_FADD:
+        case TB_FSUB:
+        case TB_FMUL:
+        case TB_FDIV:
+        case TB_FMIN:
+        case TB_FMAX: {
+            static const int ops[] = { FP2_FADD, FP2_FSUB, FP2_FMUL, FP2_FDIV, FP2_FMIN, FP2_FMAX };
+            emit_fp2(e, ops[n->type - TB_FADD], op_fpr_at(ctx, n), op_fpr_at(ctx, n->inputs[1]), op_fpr_at(ctx, n->inputs[2]), n->dt.type == TB_TAG_F64);
+            break;
+        }
 
-                bool is_64bit = legalize_int(n->dt);
-                GPR dst = gpr_at(t->interval);
-                GPR lhs = gpr_at(t->ins[0].src);
+        case TB_FNEG: {
+            emit_fp1(e, FP1_FNEG, op_fpr_at(ctx, n), op_fpr_at(ctx, n->inputs[1]), n->dt.type == TB_TAG_F64);
+            break;
+        }
 
-                if (t->flags & TILE_HAS_IMM) {
-                    assert(n->inputs[2]->type == TB_ICONST);
-                    TB_NodeInt* i = TB_NODE_GET_EXTRA(n->inputs[2]);
-                    emit_dp_imm(e, op, dst, lhs, i->value, 0, is_64bit);
-                } else {
-                    GPR rhs = gpr_at(t->ins[1].src);
-                    emit_dp_r(e, op, dst, lhs, rhs, 0, 0, is_64bit);
-                }
+        case TB_FLOAT_EXT:
+        case TB_FLOAT_TRUNC: {
+            // the type is the source, the opcode picks the destination
+            int op = n->dt.type == TB_TAG_F64 ? FP1_FCVT_D : FP1_FCVT_S;
+            emit_fp1(e, op, op_fpr_at(ctx, n), op_fpr_at(ctx, n->inputs[1]), n->inputs[1]->dt.type == TB_TAG_F64);
+            break;
+        }
+
+        case TB_INT2FLOAT:
+        case TB_UINT2FLOAT: {
+            int op = n->type == TB_INT2FLOAT ? FCVT_SCVTF : FCVT_UCVTF;
+            emit_fcvt_int(e, op, op_fpr_at(ctx, n), op_gpr_at(ctx, n->inputs[1]), n->dt.type == TB_TAG_F64, legalize_int(n->inputs[1]->dt));
+            break;
+        }
+
+        case TB_FLOAT2INT:
+        case TB_FLOAT2UINT: {
+            int op = n->type == TB_FLOAT2INT ? FCVT_FCVTZS : FCVT_FCVTZU;
+            emit_fcvt_int(e, op, op_gpr_at(ctx, n), op_fpr_at(ctx, n->inputs[1]), n->inputs[1]->dt.type == TB_TAG_F64, legalize_int(n->dt));
+            break;
+        }
+
+        case TB_ATOMIC_LOAD:
+        case TB_ATOMIC_XCHG:
+        case TB_ATOMIC_ADD:
+        case TB_ATOMIC_AND:
+        case TB_ATOMIC_XOR:
+        case TB_ATOMIC_OR:
+        case TB_ATOMIC_PTROFF: {
+            TB_User* dproj_u = proj_with_index(n, 1);
+            TB_Node* dproj = dproj_u ? USERN(dproj_u) : NULL;
+            GPR dst = dproj && ctx->vreg_map[dproj->gvn] > 0 ? op_gpr_at(ctx, dproj) : GPR_NONE;
+            GPR addr = op_gpr_at(ctx, n->inputs[2]);
+
+            TB_DataType dt = n->type == TB_ATOMIC_LOAD ? (dproj ? dproj->dt : TB_TYPE_I64) : n->inputs[3]->dt;
+            bool is_64bit = legalize_int(dt);
+            int size = mem_size_log2(dt);
+
+            if (n->type == TB_ATOMIC_LOAD) {
+                emit_ldst_excl(e, LDST_LDAR, size, ZR, dst != GPR_NONE ? dst : ZR, addr);
                 break;
             }
 
-            case TB_MUL: {
-                GPR dst = gpr_at(t->interval);
-                GPR lhs = gpr_at(t->ins[0].src);
-                GPR rhs = gpr_at(t->ins[1].src);
+            // 1: ldaxr x15, [addr]
+            //    op    x16, x15, src
+            //    stlxr w17, x16, [addr]
+            //    cbnz  w17, 1b
+            GPR src = op_gpr_at(ctx, n->inputs[3]);
+            emit_ldst_excl(e, LDST_LDAXR, size, ZR, X15, addr);
+            GPR val = IP0;
+            switch (n->type) {
+                case TB_ATOMIC_XCHG:   val = src; break;
+                case TB_ATOMIC_ADD:    emit_addsub_reg(e, false, false, IP0, X15, src, SHIFT_LSL, 0, is_64bit); break;
+                case TB_ATOMIC_PTROFF: emit_addsub_reg(e, false, false, IP0, X15, src, SHIFT_LSL, 0, true); break;
+                case TB_ATOMIC_AND:    emit_logic_reg(e, LOGIC_AND, false, IP0, X15, src, SHIFT_LSL, 0, is_64bit); break;
+                case TB_ATOMIC_XOR:    emit_logic_reg(e, LOGIC_EOR, false, IP0, X15, src, SHIFT_LSL, 0, is_64bit); break;
+                case TB_ATOMIC_OR:     emit_logic_reg(e, LOGIC_ORR, false, IP0, X15, src, SHIFT_LSL, 0, is_64bit); break;
+                default: tb_unreachable();
+            }
+            emit_ldst_excl(e, LDST_STLXR, size, IP1, val, addr);
+            emit_cbz(e, true, IP1, val == src ? -2 : -3, false);
 
-                emit_dp3(e, MADD, dst, lhs, rhs, ZR, legalize_int(n->dt));
-                break;
+            if (dst != GPR_NONE) {
+                emit_mov(e, dst, X15, is_64bit);
             }
+            break;
+        }
+
+        case TB_MEMCPY: {
+            //    cbz   x2, 2f
+            // 1: ldrb  w16, [x1], #1
+            //    strb  w16, [x0], #1
+            //    subs  x2, x2, #1
+            //    b.ne  1b
+            // 2:
+            emit_cbz(e, false, X2, 5, true);
+            emit_ldst_post(e, 0, false, 1, IP0, X1, 1);
+            emit_ldst_post(e, 0, false, 0, IP0, X0, 1);
+            emit_addsub_imm(e, true, true, X2, X2, 1, false, true);
+            emit_bcond(e, NE, -3);
+            break;
+        }
+
+        case TB_MEMSET: {
+            //    cbz   x2, 2f
+            // 1: strb  w1, [x0], #1
+            //    subs  x2, x2, #1
+            //    b.ne  1b
+            // 2:
+            emit_cbz(e, false, X2, 4, true);
+            emit_ldst_post(e, 0, false, 0, X1, X0, 1);
+            emit_addsub_imm(e, true, true, X2, X2, 1, false, true);
+            emit_bcond(e, NE, -2);
+            break;
+        }
+
+        case a64_call: {
+            emit_blr(e, op_gpr_at(ctx, n->inputs[2]));
+            break;
+        }
+
+        case a64_static_call: {
+            A64Call* op_extra = TB_NODE_GET_EXTRA(n);
+            tb_emit_symbol_patch(e->output, op_extra->sym, e->count);
+            emit_bl(e, 0);
+            break;
+        }
+
+        case TB_DEBUG_LOCATION: {
+            TB_NodeDbgLoc* loc = TB_NODE_GET_EXTRA(n);
+            TB_Location l = {
+                .file = loc->file,
+                .line = loc->line,
+                .column = loc->column,
+                .pos = e->count
+            };
+            dyn_array_put(ctx->locations, l);
+            break;
+        }
+
+        default:
+        tb_todo();
+        break;
+    }
+}
+
+static uint64_t node_unit_mask(TB_Function* f, TB_Node* n) {
+    switch (n->type) {
+        case a64_ldr: case a64_str:
+        case TB_ATOMIC_LOAD: case TB_ATOMIC_XCHG: case TB_ATOMIC_ADD:
+        case TB_ATOMIC_AND: case TB_ATOMIC_XOR: case TB_ATOMIC_OR: case TB_ATOMIC_PTROFF:
+        case TB_MEMCPY: case TB_MEMSET:
+        return 1ull << FU_LDST;
+
+        case TB_F32CONST: case TB_F64CONST:
+        case TB_FADD: case TB_FSUB: case TB_FMUL: case TB_FDIV: case TB_FMIN: case TB_FMAX:
+        case TB_FNEG: case TB_FLOAT_EXT: case TB_FLOAT_TRUNC:
+        case TB_INT2FLOAT: case TB_UINT2FLOAT: case TB_FLOAT2INT: case TB_FLOAT2UINT:
+        return (1ull << FU_FP0) | (1ull << FU_FP1);
+
+        default:
+        return (1ull << FU_ALU0) | (1ull << FU_ALU1);
+    }
+}
+
+static int node_latency(TB_Function* f, TB_Node* n, TB_Node* end) {
+    switch (n->type) {
+        case TB_MACH_MOVE: return 0;
+
+        case TB_MUL: return 3;
+        case TB_UDIV: case TB_SDIV: case TB_UMOD: case TB_SMOD: return 12;
+
+        case a64_ldr: return 4;
+
+        case TB_FADD: case TB_FSUB: case TB_FMUL:
+        case TB_FMIN: case TB_FMAX:
+        case TB_INT2FLOAT: case TB_UINT2FLOAT: case TB_FLOAT2INT: case TB_FLOAT2UINT:
+        return 4;
+
+        case TB_FDIV: return 10;
+
+        default: return 1;
+    }
+}
+
+static int node_throughput(TB_Function* f, TB_Node* n) {
+    switch (n->type) {
+        case TB_UDIV: case TB_SDIV: case TB_UMOD: case TB_SMOD:
+        case TB_FDIV:
+        return 8;
 
-            default: tb_todo();
+        default: return 1;
+    }
+}
+
+static void post_ra_peephole(Ctx* restrict ctx) {
+}
+
+static void pre_emit(Ctx* restrict ctx, TB_CGEmitter* e, TB_Node* root) {
+    TB_FunctionPrototype* proto = ctx->f->prototype;
+
+    // non-leaf functions need to keep the LR around
+    bool has_calls = false;
+    FOR_N(i, 0, ctx->bb_count) {
+        MachineBB* mbb = &ctx->machine_bbs[i];
+        aarray_for(j, mbb->items) {
+            int type = mbb->items[j]->type;
+            has_calls |= type == a64_call || type == a64_static_call;
+        }
+    }
+
+    //   [FP + 16 + N*8]  PARAM
+    //   [FP + 8]         saved LR
+    //   [FP + 0]         saved FP
+    //   [FP - N*8]       LOCALS & SPILLS
+    //   [SP + N*8]       CALLEE PARAM
+    ctx->stack_usage = align_up((ctx->num_spills + ctx->call_usage) * 8, 16);
+    if (ctx->stack_usage > 0 || has_calls) {
+        ctx->stack_header = 16;
+
+        EMIT4(e, 0xA9BF7BFD); // stp x29, x30, [sp, #-16]!
+        EMIT4(e, 0x910003FD); // mov x29, sp
+        if (ctx->stack_usage > 0) {
+            emit_addimm_any(e, SP, SP, -ctx->stack_usage, true);
         }
+    } else {
+        ctx->stack_header = 0;
+    }
+
+    if (proto->has_varargs) {
+        // va_start isn't supported either
+        tb_todo();
+    }
+
+    ctx->prologue_length = e->count;
+}
+
+static void on_basic_block(Ctx* restrict ctx, TB_CGEmitter* e, int bb) {
+    tb_resolve_branch(e, &e->labels[bb], e->count);
+}
+
+static void emit_counter(Ctx* restrict ctx, TB_CGEmitter* e, TB_Symbol* counter) {
+    // adrp x16, sym; add x16, x16, :lo12:sym
+    tb_emit_symbol_patch(e->output, counter, e->count);
+    emit_adrp(e, IP0);
+    tb_emit_symbol_patch(e->output, counter, e->count);
+    emit_addsub_imm(e, false, false, IP0, IP0, 0, false, true);
+    // ldr w17, [x16]; add w17, w17, #1; str w17, [x16]
+    emit_ldst_imm(e, 2, false, 1, IP1, IP0, 0);
+    emit_addsub_imm(e, false, false, IP1, IP1, 1, false, false);
+    emit_ldst_imm(e, 2, false, 0, IP1, IP0, 0);
+}
+
+static void emit_nop_pad(Ctx* restrict ctx, TB_CGEmitter* e, size_t pad) {
+    for (size_t i = 0; i < pad; i += 4) {
+        EMIT4(e, 0xD503201F); // nop
+    }
+}
+
+static void patch_jump_table(Ctx* restrict ctx, TB_CGEmitter* e, uint32_t ref_pos, uint32_t table_pos) {
+    // adr has a +-1MiB reach
+    int32_t disp = table_pos - ref_pos;
+    if (disp >= (1 << 20)) {
+        tb_panic("aarch64: jump table out of adr range (%d bytes)\n", disp);
     }
+
+    uint32_t inst;
+    memcpy(&inst, &e->data[ref_pos], 4);
+    inst |= (disp & 3) << 29u;
+    inst |= ((disp >> 2) & 0x7FFFF) << 5u;
+    PATCH4(e, ref_pos, inst);
 }
 
 static void post_emit(Ctx* restrict ctx, TB_CGEmitter* e) {
 }
 
 #define E(fmt, ...) tb_asm_print(e, fmt, ## __VA_ARGS__)
-static void print_gpr_sp(TB_CGEmitter* e, int i, bool is_64bit) {
-    if (i == ZR) {
-        E("sp");
-    } else if (i == LR) {
-        E("lr");
+static const char* cond_names[] = {
+    "eq", "ne", "hs", "lo", "mi", "pl", "vs", "vc",
+    "hi", "ls", "ge", "lt", "gt", "le", "al", "nv",
+};
+
+static void print_gpr(TB_CGEmitter* e, int r, bool is_64bit) {
+    if (r == ZR) {
+        E("%s", is_64bit ? "xzr" : "wzr");
     } else {
-        E("%c%d", is_64bit["wx"], i);
+        E("%c%d", is_64bit ? 'x' : 'w', r);
     }
 }
 
-static void print_gpr(TB_CGEmitter* e, int i, bool is_64bit) {
-    if (i == ZR) {
-        E("zr");
-    } else if (i == LR) {
-        E("lr");
+// same as print_gpr but 31 is SP
+static void print_gpr_sp(TB_CGEmitter* e, int r, bool is_64bit) {
+    if (r == SP) {
+        E("%s", is_64bit ? "sp" : "wsp");
     } else {
-        E("%c%d", is_64bit["wx"], i);
+        E("%c%d", is_64bit ? 'x' : 'w', r);
     }
 }
 
-static void disassemble(TB_CGEmitter* e, Disasm* restrict d, int bb, size_t pos, size_t end) {
-    if (bb >= 0) {
-        E(".bb%d:\n", bb);
+static void print_fpr(TB_CGEmitter* e, int r, int size) {
+    E("%c%d", "bhsd"[size], r);
+}
+
+static void print_symbol(TB_CGEmitter* e, const TB_Symbol* target) {
+    if (target->name[0] == 0) {
+        E("sym%p", target);
+    } else {
+        E("%s", target->name);
     }
+}
 
-    static const char* dp_strs[] = { "add", "adds", "sub", "subs" };
-    static const char* sh_strs[] = { "lsl", "lsr", "asr", "ror" };
+static void print_branch_target(TB_CGEmitter* e, Disasm* restrict d, size_t pos, int32_t disp) {
+    if (d->patch && d->patch->pos == pos) {
+        print_symbol(e, d->patch->target);
+        d->patch = d->patch->next;
+        return;
+    }
 
-    while (pos < end) {
-        uint32_t inst = *((uint32_t*) &e->data[pos]);
-        pos += 4;
+    uint32_t target = pos + disp*4;
+    int bb = tb_emit_get_label(e, target);
+    uint32_t landed = e->labels[bb] & 0x7FFFFFFF;
+    if (landed != target) {
+        E(".bb%d + %d", bb, (int)target - (int)landed);
+    } else {
+        E(".bb%d", bb);
+    }
+}
 
-        bool is_64bit = inst >> 31u;
-        uint32_t family = (inst >> 25u) & 0xF;
-        switch (family) {
-            // Data processing (immediate)
-            case 0b1000:
-            case 0b1001: {
-                uint32_t op1 = (inst >> 23u) & 0b111;
-                uint32_t opc = (inst >> 29u) & 0b11;
-
-                if (op1 == 2) {
-                    uint32_t imm  = (inst >> 10u) & 0xFFF;
-                    uint32_t rn   = (inst >> 5u) & 0x1F;
-                    uint32_t rd   = (inst >> 0u) & 0x1F;
-
-                    E("  %s ", dp_strs[opc]);
-                    print_gpr(e, rd, is_64bit);
-                    E(", ");
-                    print_gpr(e, rn, is_64bit);
-                    E(", #%#x", imm);
-                } else if (op1 == 5) {
-                    // Move wide
-                    if (opc == 1) {
-                        E("  ERROR ");
-                    } else {
-                        const char* str = "n_zk";
-                        uint32_t hw  = (inst >> 21u) & 3;
-                        uint32_t imm = (inst >> 5u) & 0xFFFF;
-                        uint32_t rn  = inst & 0x1F;
-
-                        E("  mov%c ", str[opc]);
-                        print_gpr(e, rn, is_64bit);
-                        E(", #%#x", imm);
-                        if (hw) {
-                            E(", lsl #%d", hw*16);
-                        }
-                    }
-                } else if (op1 == 6) {
-                    // Bitfield
-                    static const char* strs[] = { "sbfm", "bfm", "ubfm", "error" };
-                    uint32_t immr = (inst >> 16u) & 0b111111;
-                    uint32_t imms = (inst >> 10u) & 0b111111;
-                    uint32_t rn   = (inst >> 5u) & 0x1F;
-                    uint32_t rd   = (inst >> 0u) & 0x1F;
-
-                    if (opc == 2 && immr == imms + 1) {
-                        // lsl
-                        int amt = (is_64bit ? 63 : 31) - imms;
-                        E("  lsl ");
-                        print_gpr(e, rd, is_64bit);
-                        E(", #%#x", amt);
-                    } else {
-                        E("  %s ", strs[opc]);
-                        print_gpr(e, rd, is_64bit);
-                        E(", ");
-                        print_gpr(e, rn, is_64bit);
-                        E(", #%#x, #%#x", immr, imms);
-                    }
-                } else {
-                    E("  DATA IMM ");
-                }
-                break;
-            }
+static uint64_t decode_logical_imm(int n, int immr, int imms, bool is_64bit) {
+    int len = 31 - __builtin_clz((n << 6) | (~imms & 0x3F));
+    int size = 1 << len;
+    uint64_t size_mask = size == 64 ? UINT64_MAX : (1ull << size) - 1;
+    int s = imms & (size - 1), r = immr & (size - 1);
 
-            // Data processing (register)
-            case 0b0101:
-            case 0b1101: {
-                uint32_t sf  = (inst >> 31u) & 1;
-                uint32_t op0 = (inst >> 30u) & 1;
-                uint32_t op1 = (inst >> 28u) & 1;
-                uint32_t op2 = (inst >> 21u) & 0xF;
-                uint32_t rm  = (inst >> 16u) & 0x1F;
-                uint32_t rn  = (inst >> 5u) & 0x1F;
-                uint32_t rd  = (inst >> 0u) & 0x1F;
+    uint64_t elem = s + 1 == 64 ? UINT64_MAX : (1ull << (s + 1)) - 1;
+    if (r) {
+        elem = ((elem >> r) | (elem << (size - r))) & size_mask;
+    }
 
-                __debugbreak();
+    uint64_t x = 0;
+    for (int i = 0; i < 64; i += size) {
+        x |= elem << i;
+    }
+    return is_64bit ? x : x & 0xFFFFFFFF;
+}
 
-                const char* mnemonic = NULL;
-                if (op1) { // op1=1
-                    if (op2 == 0b0110) {
+static double decode_fp_imm8(int imm8) {
+    int b5b4 = (imm8 >> 4) & 3;
+    int exp = (imm8 >> 6) & 1 ? b5b4 - 3 : b5b4 + 1;
+    double x = 1.0 + (imm8 & 15) / 16.0;
+    for (; exp > 0; exp--) x *= 2.0;
+    for (; exp < 0; exp++) x /= 2.0;
+    return imm8 & 0x80 ? -x : x;
+}
 
-                    }
+// mode: 0 unsigned imm, 1 unscaled, 2 post-indexed, 3 register offset
+static void disasm_ldst(TB_CGEmitter* e, uint32_t inst, int mode) {
+    int size = inst >> 30, v = (inst >> 26) & 1, opc = (inst >> 22) & 3;
+    int rt = inst & 0x1F, rn = (inst >> 5) & 0x1F;
 
-                    // Data processing (3 source)
-                    uint32_t ra = (inst >> 10u) & 0x1F;
+    // ldr, ldur, ldrsb, ldursb...
+    bool is_load = v ? opc & 1 : opc != 0;
+    E("  %s%s%s", is_load ? "ld" : "st", mode == 1 ? "ur" : "r", !v && opc >= 2 ? "s" : "");
+    if (!v) {
+        if (size == 0) E("b");
+        else if (size == 1) E("h");
+        else if (size == 2 && opc == 2) E("w");
+    }
+    E(" ");
 
-                    if ((inst >> 29u) & 3) {
-                        E("ERROR");
-                    } else {
-                        uint32_t opc = (((inst >> 21u) & 7) << 1) | ((inst >> 15u) & 1);
-                        switch (opc) {
-                            case 0b0000: E("  madd "); break;
-                            case 0b0001: E("  msub "); break;
-                            default: tb_todo();
-                        }
-                    }
-                    print_gpr(e, rd, is_64bit);
-                    E(", ");
-                    print_gpr(e, rn, is_64bit);
-                    E(", ");
-                    print_gpr(e, rm, is_64bit);
-                    E(", ");
-                    print_gpr(e, ra, is_64bit);
-
-                    /*if (op0 == 0 && op2 == 0b0110) {
-                        // uint32_t S = (inst >> 29u) & 1;
-                        uint32_t opc  = (inst >> 10u) & 0x3F;
-
-                        if (opc == 2) {
-                            E("  udiv ");
-                        } else if (opc == 3) {
-                            E("  sdiv ");
-                        } else {
-                            E("ERROR ");
-                        }
-                        print_gpr(e, rd, is_64bit);
-                        E(", ");
-                        print_gpr(e, rn, is_64bit);
-                        E(", ");
-                        print_gpr(e, rm, is_64bit);
-                    } else if (op2 >> 3) {
-                    } else {
-                        E("  DATA REG ");
-                    }*/
-                } else { // op1=0
-                    uint32_t imm  = (inst >> 10u) & 0x3F;
-                    uint32_t sh   = (inst >> 22u) & 3;
-
-                    if (op2 < 0b1000) { // op2=0xxx
-                        static const char* ops[] = {
-                            // Logical (shifted register)
-                            // n=0   n=1      opc
-                            "and",  "bic", // 00
-                            "orr",  "orn", // 01
-                            "eor",  "eon", // 10
-                            "ands", "bics" // 11
-                        };
-
-                        uint32_t opc = (((inst >> 29u) & 3) << 1) | ((inst >> 21) & 1);
-                        mnemonic = ops[opc];
-                    } else if (op2 & 1) { // op2=1xx1
-                        // Add/subtract (extended register)
-                        tb_todo();
-                    } else { // op2=1xx0
-                        // Add/subtract (shifted register)
-                        static const char* ops[] = {
-                            "add", "adds",
-                            "sub", "subs"
-                        };
-                        uint32_t opc = (inst >> 29u) & 3;
-                        mnemonic = ops[opc];
-                    }
+    if (v) {
+        print_fpr(e, rt, size);
+    } else {
+        print_gpr(e, rt, size == 3 || opc == 2);
+    }
 
-                    E("  %s ", mnemonic);
-                    print_gpr(e, rd, is_64bit);
-                    E(", ");
-                    print_gpr(e, rn, is_64bit);
-                    E(", ");
-                    print_gpr(e, rm, is_64bit);
-                    if (imm) {
-                        E(", %s #%#x", sh_strs[sh], imm);
-                    }
-                }
-                break;
-            }
+    E(", [");
+    print_gpr_sp(e, rn, true);
+    switch (mode) {
+        case 0: {
+            uint32_t imm = ((inst >> 10) & 0xFFF) << size;
+            if (imm) { E(", #%u", imm); }
+            E("]");
+            break;
+        }
 
-            // Branches, Exceptions, Syscalls
-            case 0b1010:
-            case 0b1011: {
-                uint32_t op0 = (inst >> 29u) & 0b111;
-                uint32_t op1 = (inst >> 12u) & 0b11111111111111;
-
-                if (op0 == 0b110 && op1 >> 13u) {
-                    // Unconditional
-                    //
-                    //    opc   op2    op3   op4
-                    //   0010 11111 000000 00000  RET
-                    uint32_t opc = (inst >> 21u) & 0xF;
-                    uint32_t op2 = (inst >> 16u) & 0x1F;
-                    uint32_t op3 = (inst >> 10u) & 0x1F;
-                    uint32_t rn  = (inst >>  5u) & 0x1F;
-                    uint32_t op4 = (inst >>  0u) & 0x1F;
-                    if (opc == 2 && op2 == 0x1F && op3 == 0 && op4 == 0) {
-                        if (rn == LR) { E("  ret"); }
-                        else  { E("  ret v%d", rn); }
-                    } else {
-                        tb_todo();
-                    }
-                } else {
-                    E("  BRANCH(op1=%#x) ", op1);
+        case 1: {
+            int32_t imm = ((int32_t) (inst << 11)) >> 23;
+            if (imm) { E(", #%d", imm); }
+            E("]");
+            break;
+        }
+
+        case 2: {
+            int32_t imm = ((int32_t) (inst << 11)) >> 23;
+            E("], #%d", imm);
+            break;
+        }
+
+        case 3: {
+            E(", ");
+            print_gpr(e, (inst >> 16) & 0x1F, true);
+            if ((inst >> 12) & 1) { E(", lsl #%d", size); }
+            E("]");
+            break;
+        }
+    }
+}
+
+static void disasm_inst(TB_CGEmitter* e, Disasm* restrict d, size_t pos, uint32_t inst) {
+    bool sf = inst >> 31;
+    int rd = inst & 0x1F, rn = (inst >> 5) & 0x1F, rm = (inst >> 16) & 0x1F;
+
+    if (inst == 0xA9BF7BFD) {
+        E("  stp x29, x30, [sp, #-16]!");
+    } else if (inst == 0xA8C17BFD) {
+        E("  ldp x29, x30, [sp], #16");
+    } else if ((inst & 0xFFFFFC1F) == 0xD65F0000) {
+        if (rn == LR) { E("  ret"); }
+        else { E("  ret "), print_gpr(e, rn, true); }
+    } else if ((inst & 0xFFFFFC1F) == 0xD61F0000) {
+        E("  br "), print_gpr(e, rn, true);
+    } else if ((inst & 0xFFFFFC1F) == 0xD63F0000) {
+        E("  blr "), print_gpr(e, rn, true);
+    } else if ((inst & 0x7C000000) == 0x14000000) {
+        E("  %s ", sf ? "bl" : "b");
+        print_branch_target(e, d, pos, branch_get_disp(inst));
+    } else if ((inst & 0xFF000010) == 0x54000000) {
+        E("  b.%s ", cond_names[inst & 0xF]);
+        print_branch_target(e, d, pos, branch_get_disp(inst));
+    } else if ((inst & 0x7E000000) == 0x34000000) {
+        E("  %s ", (inst >> 24) & 1 ? "cbnz" : "cbz");
+        print_gpr(e, rd, sf);
+        E(", ");
+        print_branch_target(e, d, pos, branch_get_disp(inst));
+    } else if ((inst & 0x7E000000) == 0x36000000) {
+        int bit = (sf << 5) | ((inst >> 19) & 0x1F);
+        E("  %s ", (inst >> 24) & 1 ? "tbnz" : "tbz");
+        print_gpr(e, rd, bit >= 32);
+        E(", #%d, ", bit);
+        print_branch_target(e, d, pos, branch_get_disp(inst));
+    } else if ((inst & 0xFFE0001F) == 0xD4200000) {
+        E("  brk #%#x", (inst >> 5) & 0xFFFF);
+    } else if ((inst & 0xFFFFFFE0) == 0xD53BE040) {
+        E("  mrs "), print_gpr(e, rd, true), E(", cntvct_el0");
+    } else if ((inst & 0x9F000000) == 0x10000000) {
+        int32_t imm = ((int32_t) (((inst >> 5) & 0x7FFFF) << 13) >> 11) | ((inst >> 29) & 3);
+        E("  adr "), print_gpr(e, rd, true), E(", #%d", imm);
+    } else if ((inst & 0x9F000000) == 0x90000000) {
+        E("  adrp "), print_gpr(e, rd, true), E(", ");
+        if (d->patch && d->patch->pos == pos) {
+            print_symbol(e, d->patch->target);
+            d->patch = d->patch->next;
+        } else {
+            int32_t imm = ((int32_t) (((inst >> 5) & 0x7FFFF) << 13) >> 11) | ((inst >> 29) & 3);
+            E("%d", imm);
+        }
+    } else if ((inst & 0x1F800000) == 0x11000000) {
+        // add/sub (immediate)
+        bool sub = (inst >> 30) & 1, s = (inst >> 29) & 1, sh = (inst >> 22) & 1;
+        uint32_t imm = (inst >> 10) & 0xFFF;
+        if (d->patch && d->patch->pos == pos) {
+            E("  add "), print_gpr_sp(e, rd, sf), E(", "), print_gpr_sp(e, rn, sf), E(", :lo12:");
+            print_symbol(e, d->patch->target);
+            d->patch = d->patch->next;
+        } else if (s && rd == ZR) {
+            E("  %s ", sub ? "cmp" : "cmn"), print_gpr_sp(e, rn, sf), E(", #%u", imm);
+            if (sh) { E(", lsl #12"); }
+        } else if (!sub && !s && !sh && imm == 0 && (rd == SP || rn == SP)) {
+            E("  mov "), print_gpr_sp(e, rd, sf), E(", "), print_gpr_sp(e, rn, sf);
+        } else {
+            E("  %s%s ", sub ? "sub" : "add", s ? "s" : "");
+            s ? print_gpr(e, rd, sf) : print_gpr_sp(e, rd, sf);
+            E(", "), print_gpr_sp(e, rn, sf), E(", #%u", imm);
+            if (sh) { E(", lsl #12"); }
+        }
+    } else if ((inst & 0x7FE0E000) == 0x0B206000) {
+        // add/sub (extended register), we only do UXTX
+        bool sub = (inst >> 30) & 1;
+        E("  %s ", sub ? "sub" : "add"), print_gpr_sp(e, rd, true), E(", "), print_gpr_sp(e, rn, true);
+        E(", "), print_gpr(e, rm, true);
+    } else if ((inst & 0x1F200000) == 0x0B000000) {
+        // add/sub (shifted register)
+        static const char* shifts[] = { "lsl", "lsr", "asr", "ror" };
+        bool sub = (inst >> 30) & 1, s = (inst >> 29) & 1;
+        int shift = (inst >> 22) & 3, amount = (inst >> 10) & 0x3F;
+        if (s && rd == ZR) {
+            E("  %s ", sub ? "cmp" : "cmn"), print_gpr(e, rn, sf);
+        } else if (sub && rn == ZR) {
+            E("  neg%s ", s ? "s" : ""), print_gpr(e, rd, sf);
+        } else {
+            E("  %s%s ", sub ? "sub" : "add", s ? "s" : ""), print_gpr(e, rd, sf), E(", "), print_gpr(e, rn, sf);
+        }
+        E(", "), print_gpr(e, rm, sf);
+        if (amount) { E(", %s #%d", shifts[shift], amount); }
+    } else if ((inst & 0x1F000000) == 0x0A000000) {
+        // logical (shifted register)
+        static const char* ops[2][4] = { { "and", "orr", "eor", "ands" }, { "bic", "orn", "eon", "bics" } };
+        static const char* shifts[] = { "lsl", "lsr", "asr", "ror" };
+        int opc = (inst >> 29) & 3, n = (inst >> 21) & 1;
+        int shift = (inst >> 22) & 3, amount = (inst >> 10) & 0x3F;
+        if (opc == LOGIC_ORR && rn == ZR && amount == 0) {
+            E("  %s ", n ? "mvn" : "mov"), print_gpr(e, rd, sf);
+        } else if (opc == LOGIC_ANDS && rd == ZR && !n) {
+            E("  tst "), print_gpr(e, rn, sf);
+        } else {
+            E("  %s ", ops[n][opc]), print_gpr(e, rd, sf), E(", "), print_gpr(e, rn, sf);
+        }
+        E(", "), print_gpr(e, rm, sf);
+        if (amount) { E(", %s #%d", shifts[shift], amount); }
+    } else if ((inst & 0x1F800000) == 0x12000000) {
+        // logical (immediate)
+        static const char* ops[] = { "and", "orr", "eor", "ands" };
+        int opc = (inst >> 29) & 3;
+        uint64_t imm = decode_logical_imm((inst >> 22) & 1, (inst >> 16) & 0x3F, (inst >> 10) & 0x3F, sf);
+        if (opc == LOGIC_ORR && rn == ZR) {
+            E("  mov "), print_gpr_sp(e, rd, sf);
+        } else if (opc == LOGIC_ANDS && rd == ZR) {
+            E("  tst "), print_gpr(e, rn, sf);
+        } else {
+            E("  %s ", ops[opc]);
+            opc == LOGIC_ANDS ? print_gpr(e, rd, sf) : print_gpr_sp(e, rd, sf);
+            E(", "), print_gpr(e, rn, sf);
+        }
+        E(", #%#"PRIx64, imm);
+    } else if ((inst & 0x1F800000) == 0x12800000) {
+        // move wide
+        static const char* ops[] = { "movn", "???", "movz", "movk" };
+        int opc = (inst >> 29) & 3, hw = (inst >> 21) & 3;
+        E("  %s ", ops[opc]), print_gpr(e, rd, sf), E(", #%#x", (inst >> 5) & 0xFFFF);
+        if (hw) { E(", lsl #%d", hw * 16); }
+    } else if ((inst & 0x1F800000) == 0x13000000) {
+        // bitfield
+        int opc = (inst >> 29) & 3, immr = (inst >> 16) & 0x3F, imms = (inst >> 10) & 0x3F;
+        int size = sf ? 64 : 32;
+        if (opc == UBFM && imms == size - 1) {
+            E("  lsr "), print_gpr(e, rd, sf), E(", "), print_gpr(e, rn, sf), E(", #%d", immr);
+        } else if (opc == UBFM && imms + 1 == immr) {
+            E("  lsl "), print_gpr(e, rd, sf), E(", "), print_gpr(e, rn, sf), E(", #%d", size - 1 - imms);
+        } else if (opc == UBFM && immr == 0 && !sf && (imms == 7 || imms == 15)) {
+            E("  uxt%c ", imms == 7 ? 'b' : 'h'), print_gpr(e, rd, false), E(", "), print_gpr(e, rn, false);
+        } else if (opc == SBFM && imms == size - 1) {
+            E("  asr "), print_gpr(e, rd, sf), E(", "), print_gpr(e, rn, sf), E(", #%d", immr);
+        } else if (opc == SBFM && immr == 0 && (imms == 7 || imms == 15 || imms == 31)) {
+            E("  sxt%c ", imms == 7 ? 'b' : imms == 15 ? 'h' : 'w'), print_gpr(e, rd, sf), E(", "), print_gpr(e, rn, false);
+        } else if (opc != BFM && imms >= immr) {
+            E("  %s ", opc == UBFM ? "ubfx" : "sbfx"), print_gpr(e, rd, sf), E(", "), print_gpr(e, rn, sf);
+            E(", #%d, #%d", immr, imms - immr + 1);
+        } else {
+            static const char* ops[] = { "sbfm", "bfm", "ubfm", "???" };
+            E("  %s ", ops[opc]), print_gpr(e, rd, sf), E(", "), print_gpr(e, rn, sf);
+            E(", #%d, #%d", immr, imms);
+        }
+    } else if ((inst & 0x7FA00000) == 0x13800000) {
+        // extr
+        int lsb = (inst >> 10) & 0x3F;
+        if (rn == rm) {
+            E("  ror "), print_gpr(e, rd, sf), E(", "), print_gpr(e, rn, sf), E(", #%d", lsb);
+        } else {
+            E("  extr "), print_gpr(e, rd, sf), E(", "), print_gpr(e, rn, sf), E(", "), print_gpr(e, rm, sf);
+            E(", #%d", lsb);
+        }
+    } else if ((inst & 0x7FE00800) == 0x1A800000) {
+        // conditional select
+        bool inc = (inst >> 10) & 1;
+        int cc = (inst >> 12) & 0xF;
+        if (inc && rn == ZR && rm == ZR) {
+            E("  cset "), print_gpr(e, rd, sf), E(", %s", cond_names[cc ^ 1]);
+        } else {
+            E("  %s ", inc ? "csinc" : "csel"), print_gpr(e, rd, sf), E(", "), print_gpr(e, rn, sf);
+            E(", "), print_gpr(e, rm, sf), E(", %s", cond_names[cc]);
+        }
+    } else if ((inst & 0x7FE00000) == 0x1AC00000) {
+        // data processing (2 source)
+        const char* name = "???";
+        switch ((inst >> 10) & 0x3F) {
+            case DP2_UDIV: name = "udiv"; break;
+            case DP2_SDIV: name = "sdiv"; break;
+            case DP2_LSLV: name = "lsl";  break;
+            case DP2_LSRV: name = "lsr";  break;
+            case DP2_ASRV: name = "asr";  break;
+            case DP2_RORV: name = "ror";  break;
+        }
+        E("  %s ", name), print_gpr(e, rd, sf), E(", "), print_gpr(e, rn, sf), E(", "), print_gpr(e, rm, sf);
+    } else if ((inst & 0x7FFFC000) == 0x5AC00000) {
+        // data processing (1 source)
+        static const char* ops[] = { "rbit", "rev16", "rev", "rev", "clz" };
+        int op = (inst >> 10) & 0x3F;
+        E("  %s ", op < 5 ? ops[op] : "???"), print_gpr(e, rd, sf), E(", "), print_gpr(e, rn, sf);
+    } else if ((inst & 0x7FE00000) == 0x1B000000) {
+        // data processing (3 source)
+        bool sub = (inst >> 15) & 1;
+        int ra = (inst >> 10) & 0x1F;
+        if (ra == ZR) {
+            E("  %s ", sub ? "mneg" : "mul"), print_gpr(e, rd, sf), E(", "), print_gpr(e, rn, sf), E(", "), print_gpr(e, rm, sf);
+        } else {
+            E("  %s ", sub ? "msub" : "madd"), print_gpr(e, rd, sf), E(", "), print_gpr(e, rn, sf), E(", "), print_gpr(e, rm, sf);
+            E(", "), print_gpr(e, ra, sf);
+        }
+    } else if ((inst & 0x3B000000) == 0x39000000) {
+        disasm_ldst(e, inst, 0);
+    } else if ((inst & 0x3B200C00) == 0x38000000) {
+        disasm_ldst(e, inst, 1);
+    } else if ((inst & 0x3B200C00) == 0x38000400) {
+        disasm_ldst(e, inst, 2);
+    } else if ((inst & 0x3B200C00) == 0x38200800) {
+        disasm_ldst(e, inst, 3);
+    } else if ((inst & 0x3FFFFC00) == LDST_LDAR || (inst & 0x3FFFFC00) == LDST_LDAXR) {
+        static const char* sizes[] = { "b", "h", "", "" };
+        int size = inst >> 30;
+        E("  %s%s ", (inst & 0x3FFFFC00) == LDST_LDAR ? "ldar" : "ldaxr", sizes[size]);
+        print_gpr(e, rd, size == 3), E(", ["), print_gpr_sp(e, rn, true), E("]");
+    } else if ((inst & 0x3FE0FC00) == LDST_STLXR) {
+        static const char* sizes[] = { "b", "h", "", "" };
+        int size = inst >> 30;
+        E("  stlxr%s ", sizes[size]), print_gpr(e, rm, false), E(", "), print_gpr(e, rd, size == 3);
+        E(", ["), print_gpr_sp(e, rn, true), E("]");
+    } else if ((inst & 0xFF200C00) == 0x1E200800) {
+        // float data processing (2 source)
+        static const char* ops[] = { "fmul", "fdiv", "fadd", "fsub", "fmax", "fmin", "fmaxnm", "fminnm" };
+        int size = (inst >> 22) & 1 ? 3 : 2, op = (inst >> 12) & 0xF;
+        E("  %s ", op < 8 ? ops[op] : "???"), print_fpr(e, rd, size), E(", "), print_fpr(e, rn, size), E(", "), print_fpr(e, rm, size);
+    } else if ((inst & 0xFFA07C00) == 0x1E204000) {
+        // float data processing (1 source)
+        static const char* ops[] = { "fmov", "fabs", "fneg", "fsqrt", "fcvt", "fcvt" };
+        int size = (inst >> 22) & 1 ? 3 : 2, op = (inst >> 15) & 0x3F;
+        int dst_size = op == FP1_FCVT_S ? 2 : op == FP1_FCVT_D ? 3 : size;
+        E("  %s ", op < 6 ? ops[op] : "???"), print_fpr(e, rd, dst_size), E(", "), print_fpr(e, rn, size);
+    } else if ((inst & 0xFFA0FC17) == 0x1E202000) {
+        int size = (inst >> 22) & 1 ? 3 : 2;
+        E("  fcmp "), print_fpr(e, rn, size), E(", ");
+        if (inst & 8) { E("#0.0"); } else { print_fpr(e, rm, size); }
+    } else if ((inst & 0xFFA00C00) == 0x1E200C00) {
+        int size = (inst >> 22) & 1 ? 3 : 2;
+        E("  fcsel "), print_fpr(e, rd, size), E(", "), print_fpr(e, rn, size), E(", "), print_fpr(e, rm, size);
+        E(", %s", cond_names[(inst >> 12) & 0xF]);
+    } else if ((inst & 0xFFA01FE0) == 0x1E201000) {
+        int size = (inst >> 22) & 1 ? 3 : 2;
+        E("  fmov "), print_fpr(e, rd, size), E(", #%.8f", decode_fp_imm8((inst >> 13) & 0xFF));
+    } else if ((inst & 0x7FA0FC00) == 0x1E200000) {
+        // conversion between float and integer
+        int size = (inst >> 22) & 1 ? 3 : 2, op = (inst >> 16) & 0x1F;
+        switch (op) {
+            case FCVT_SCVTF: case FCVT_UCVTF:
+            E("  %s ", op == FCVT_SCVTF ? "scvtf" : "ucvtf"), print_fpr(e, rd, size), E(", "), print_gpr(e, rn, sf);
+            break;
+
+            case FCVT_FCVTZS: case FCVT_FCVTZU:
+            E("  %s ", op == FCVT_FCVTZS ? "fcvtzs" : "fcvtzu"), print_gpr(e, rd, sf), E(", "), print_fpr(e, rn, size);
+            break;
+
+            case FCVT_FMOV_I:
+            E("  fmov "), print_fpr(e, rd, size), E(", "), print_gpr(e, rn, sf);
+            break;
+
+            case FCVT_FMOV_F:
+            E("  fmov "), print_gpr(e, rd, sf), E(", "), print_fpr(e, rn, size);
+            break;
+
+            default:
+            E("  .word %#08x", inst);
+            break;
+        }
+    } else if ((inst & 0xFFFFFC00) == 0x0E205800) {
+        E("  cnt v%d.8b, v%d.8b", rd, rn);
+    } else if ((inst & 0xFFFFFC00) == 0x0E31B800) {
+        E("  addv b%d, v%d.8b", rd, rn);
+    } else {
+        E("  .word %#08x", inst);
+    }
+}
+
+static void disassemble(TB_CGEmitter* e, Disasm* restrict d, int bb, size_t pos, size_t end) {
+    if (bb >= 0) {
+        E(".bb%d:\n", bb);
+    }
+
+    while (pos < end) {
+        while (d->loc != d->end && d->loc->pos == pos) {
+            E("  // %s : line %d\n", d->loc->file->path, d->loc->line);
+            d->loc++;
+        }
+
+        uint32_t inst;
+        memcpy(&inst, &e->data[pos], sizeof(uint32_t));
+
+        uint64_t line_start = e->total_asm;
+        disasm_inst(e, d, pos, inst);
+
+        int offset = e->total_asm - line_start;
+        if (d->comment && d->comment->pos == pos) {
+            TB_OPTDEBUG(ANSI)(E("\x1b[32m"));
+            E("%*s", 40 - offset, "// ");
+            bool out_of_line = false;
+            do {
+                if (out_of_line) {
+                    // tack on a newline
+                    E("%*s  // ", offset, "");
                 }
-                break;
-            }
 
-            default: tb_todo();
+                E("%.*s\n", d->comment->line_len, d->comment->line);
+                d->comment = d->comment->next;
+                out_of_line = true;
+            } while  (d->comment && d->comment->pos == pos);
+            TB_OPTDEBUG(ANSI)(E("\x1b[0m"));
+        } else {
+            E("\n");
         }
-        E("\n");
+
+        pos += 4;
     }
 }
 #undef E
 
 static size_t emit_call_patches(TB_Module* restrict m, TB_FunctionOutput* out_f) {
-    return 0;
+    size_t r = 0;
+    uint32_t src_section = out_f->section;
+
+    for (TB_SymbolPatch* patch = out_f->first_patch; patch; patch = patch->next) {
+        if (patch->target->tag == TB_SYMBOL_FUNCTION) {
+            uint32_t dst_section = ((TB_Function*) patch->target)->output->section;
+
+            uint32_t inst;
+            memcpy(&inst, &out_f->code[patch->pos], sizeof(uint32_t));
+
+            // you can't do relocations across sections, and only the B/BL
+            // ones are resolved here (ADRP & ADD are left to the linker).
+            if (src_section == dst_section && (inst & 0x7C000000) == 0x14000000) {
+                assert(patch->pos < out_f->code_size);
+
+                // B/BL displacements are in words relative to the branch itself
+                int32_t disp = ((TB_Function*) patch->target)->output->code_pos - (out_f->code_pos + patch->pos);
+                inst = (inst & 0xFC000000) | ((disp >> 2) & 0x3FFFFFF);
+                memcpy(&out_f->code[patch->pos], &inst, sizeof(uint32_t));
+
+                r += 1;
+                patch->internal = true;
+            }
+        }
+    }
+
+    return out_f->patch_count - r;
 }
 
 ICodeGen tb__aarch64_codegen = {
     .minimum_addressable_size = 8,
     .pointer_size = 64,
+    .can_gvn = can_gvn,
+    .node_name = node_name,
+    .print_extra = print_extra,
+    .print_dumb_extra = print_dumb_extra,
+    .flags = node_flags,
+    .extra_bytes = extra_bytes,
     .emit_win64eh_unwind_info = NULL,
     .emit_call_patches  = emit_call_patches,
     .get_data_type_size = get_data_type_size,
@@ -140,7 +140,14 @@ static bool ifg_empty(Chaitin* ra) {
 
 VReg* tb__set_node_vreg(Ctx* ctx, TB_Node* n) {
     int i = aarray_length(ctx->vregs);
-    aarray_insert(ctx->vreg_map, n->gvn, i);
+    // nodes made during RA are past the end of the map, grow it (zeroing the gap)
+    // so the length still covers every node we know about.
+    size_t old_len = aarray_length(ctx->vreg_map);
+    if (n->gvn >= old_len) {
+        aarray_reserve(ctx->vreg_map, n->gvn + 1);
+        FOR_N(j, old_len, n->gvn) { ctx->vreg_map[j] = 0; }
+    }
+    ctx->vreg_map[n->gvn] = i;
     aarray_push(ctx->vregs, (VReg){ .n = n, .assigned = -1, .spill_cost = NAN });
     return &ctx->vregs[i];
 }
@@ -0,0 +1,466 @@
+// Content addressed cache for compiled functions, the key is an md5 over everything
+// codegen reads (the IR, target, features, code layout & which symbols it refers to)
+// and the value is the machine code before any relocations are applied. Entries are
+// files named after the hash:
+//
+//   CacheHeader
+//   CachePatch[patch_count]
+//   code[code_size]
+//
+// Symbols aren't stored by name, the patches refer to the key's symbol list (the
+// order the hash walk saw them) so a hit binds against whatever those symbols are
+// in the current module.
+#include "tb_internal.h"
+
+#ifdef _WIN32
+#include <direct.h>
+#define cache_mkdir(path) _mkdir(path)
+#else
+#include <sys/stat.h>
+#define cache_mkdir(path) mkdir(path, 0755)
+#endif
+
+// bump whenever the entry layout or the hashing changes meaning
+#define CACHE_VERSION 1
+
+// bump whenever the backend starts producing different code for the same IR, it's
+// hashed in rather than the build time so rebuilding TB doesn't throw the cache out.
+#define CACHE_CODEGEN_VERSION 2
+
+// patch targets which aren't in the key are the backend's small constants (floats
+// and such), those get re-interned on load.
+#define CACHE_SMALL_DATA 0x80000000u
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint8_t hash[16];
+
+    uint32_t code_size;
+    uint32_t patch_count;
+    uint64_t stack_usage;
+
+    uint8_t prologue_length;
+    uint8_t epilogue_length;
+    uint8_t nop_pads;
+    uint8_t _pad[5];
+} CacheHeader;
+
+typedef struct {
+    uint32_t pos;
+    // key symbol index or CACHE_SMALL_DATA | len
+    uint32_t sym;
+    uint8_t data[16];
+} CachePatch;
+
+typedef struct {
+    TB_Emitter e;
+
+    // dense ids by gvn, UINT32_MAX if the node isn't reachable
+    uint32_t* ids;
+
+    NL_Map(TB_Symbol*, uint32_t) sym_ids;
+    DynArray(TB_Symbol*) syms;
+} CacheHasher;
+
+static void cache_hash_str(CacheHasher* h, const char* str) {
+    size_t len = str ? strlen(str) : 0;
+    tb_out4b(&h->e, len);
+    tb_outs(&h->e, len, str);
+}
+
+static void cache_hash_proto(CacheHasher* h, TB_FunctionPrototype* p) {
+    tb_out4b(&h->e, p->call_conv);
+    tb_out2b(&h->e, p->return_count);
+    tb_out2b(&h->e, p->param_count);
+    tb_out1b(&h->e, p->has_varargs);
+    FOR_N(i, 0, p->param_count + p->return_count) {
+        tb_out2b(&h->e, p->params[i].dt.raw);
+    }
+}
+
+static void cache_hash_symbol(CacheHasher* h, TB_Symbol* s) {
+    ptrdiff_t search = nl_map_get(h->sym_ids, s);
+    if (search >= 0) {
+        // already described, the index is enough
+        tb_out4b(&h->e, h->sym_ids[search].v);
+        return;
+    }
+
+    uint32_t id = dyn_array_length(h->syms);
+    nl_map_put(h->sym_ids, s, id);
+    dyn_array_put(h->syms, s);
+
+    tb_out4b(&h->e, id);
+    tb_out1b(&h->e, s->tag);
+    cache_hash_str(h, s->name);
+    if (s->tag == TB_SYMBOL_GLOBAL) {
+        // TLS globals need different code
+        TB_Global* g = (TB_Global*) s;
+        tb_out4b(&h->e, g->parent);
+        tb_out1b(&h->e, g->linkage);
+    } else if (s->tag == TB_SYMBOL_EXTERNAL) {
+        tb_out1b(&h->e, ((TB_External*) s)->type);
+    } else if (s->tag == TB_SYMBOL_FUNCTION) {
+        tb_out4b(&h->e, ((TB_Function*) s)->section);
+    }
+}
+
+static bool cache_hash_node(CacheHasher* h, TB_Node* n) {
+    tb_out2b(&h->e, n->type);
+    tb_out2b(&h->e, n->dt.raw);
+    tb_out2b(&h->e, n->input_count);
+    FOR_N(i, 0, n->input_count) {
+        tb_out4b(&h->e, n->inputs[i] ? h->ids[n->inputs[i]->gvn] : UINT32_MAX);
+    }
+
+    // anything with pointers (or padding) in the extra space is spelled out
+    switch (n->type) {
+        case TB_SYMBOL:
+        cache_hash_symbol(h, TB_NODE_GET_EXTRA_T(n, TB_NodeSymbol)->sym);
+        return true;
+
+        case TB_LOCAL: {
+            TB_NodeLocal* l = TB_NODE_GET_EXTRA(n);
+            tb_out4b(&h->e, l->size);
+            tb_out4b(&h->e, l->align);
+            tb_out4b(&h->e, l->alias_index);
+            return true;
+        }
+
+        case TB_CALL:
+        case TB_SYSCALL: {
+            TB_NodeCall* c = TB_NODE_GET_EXTRA(n);
+            cache_hash_proto(h, c->proto);
+            tb_out4b(&h->e, c->proj_count);
+            return true;
+        }
+
+        case TB_TAILCALL:
+        cache_hash_proto(h, TB_NODE_GET_EXTRA_T(n, TB_NodeTailcall)->proto);
+        return true;
+
+        case TB_SAFEPOINT_POLL:
+        tb_out4b(&h->e, TB_NODE_GET_EXTRA_T(n, TB_NodeSafepoint)->param_start);
+        return true;
+
+        case TB_BRANCH_PROJ: {
+            TB_NodeBranchProj* br = TB_NODE_GET_EXTRA(n);
+            tb_out4b(&h->e, br->index);
+            tb_out8b(&h->e, br->taken);
+            tb_out8b(&h->e, br->key);
+            return true;
+        }
+
+        case TB_SPLITMEM: {
+            TB_NodeMemSplit* s = TB_NODE_GET_EXTRA(n);
+            tb_out1b(&h->e, s->same_edges);
+            tb_out4b(&h->e, s->alias_cnt);
+            tb_outs(&h->e, s->alias_cnt * sizeof(int), s->alias_idx);
+            return true;
+        }
+
+        // line info doesn't make it into the code (so adding a comment up
+        // top doesn't invalidate everything after it)
+        case TB_DEBUG_LOCATION:
+        case TB_REGION:
+        case TB_NATURAL_LOOP:
+        case TB_AFFINE_LOOP:
+        return true;
+
+        // callbacks and machine nodes can't be described by their bytes
+        case TB_INLINE_ASM:
+        case TB_MACH_COPY:
+        case TB_MACH_PROJ:
+        case TB_MACH_SYMBOL:
+        return false;
+
+        default:
+        if (n->type >= 0x100) {
+            return false;
+        }
+
+        tb_outs(&h->e, extra_bytes(n), n->extra);
+        return true;
+    }
+}
+
+bool tb_cache_key(TB_Function* f, TB_Arena* arena, const TB_FeatureSet* features, TB_CacheKey* out_key) {
+    if (f->root_node == NULL) {
+        return false;
+    }
+
+    TB_Module* m = f->super.module;
+    CacheHasher h = { 0 };
+    bool ok = true;
+
+    tb_outs(&h.e, 4, "TBCK");
+    tb_out4b(&h.e, CACHE_VERSION);
+    tb_out4b(&h.e, CACHE_CODEGEN_VERSION);
+
+    tb_out4b(&h.e, m->target_arch);
+    tb_out4b(&h.e, m->target_system);
+    tb_out4b(&h.e, m->target_abi);
+    tb_out1b(&h.e, m->is_jit);
+    tb_out4b(&h.e, m->layout.func_align);
+    tb_out4b(&h.e, m->layout.loop_align);
+    tb_out4b(&h.e, m->layout.loop_max_pad);
+    tb_out1b(&h.e, m->layout.avoid_jcc_erratum);
+
+    TB_FeatureSet feats[2] = { m->features };
+    if (features) { feats[1] = *features; }
+    FOR_N(i, 0, 2) {
+        tb_out4b(&h.e, feats[i].gen);
+        tb_out4b(&h.e, feats[i].x64);
+        tb_out4b(&h.e, feats[i].x64_model);
+    }
+
+    tb_out4b(&h.e, f->section);
+    tb_out1b(&h.e, f->linkage);
+    cache_hash_proto(&h, f->prototype);
+
+    TB_ArenaSavepoint sp = tb_arena_save(arena);
+    CUIK_TIMED_BLOCK("cache key") {
+        // walk everything connected to the root, both directions since not every
+        // input is guarenteed to be reachable over users.
+        size_t cap = f->node_count;
+        TB_Node** nodes = tb_arena_alloc(arena, cap * sizeof(TB_Node*));
+        TB_Node** stack = tb_arena_alloc(arena, cap * sizeof(TB_Node*));
+        memset(nodes, 0, cap * sizeof(TB_Node*));
+
+        size_t top = 0;
+        nodes[f->root_node->gvn] = stack[top++] = f->root_node;
+        while (top > 0) {
+            TB_Node* n = stack[--top];
+            FOR_N(i, 0, n->input_count) {
+                TB_Node* in = n->inputs[i];
+                if (in && nodes[in->gvn] == NULL) {
+                    nodes[in->gvn] = stack[top++] = in;
+                }
+            }
+            FOR_USERS(u, n) {
+                TB_Node* un = USERN(u);
+                if (nodes[un->gvn] == NULL) {
+                    nodes[un->gvn] = stack[top++] = un;
+                }
+            }
+        }
+
+        // gvn order is the order they were built in, renumbering makes it
+        // independent of whatever got allocated and killed along the way.
+        h.ids = tb_arena_alloc(arena, cap * sizeof(uint32_t));
+        uint32_t count = 0;
+        FOR_N(i, 0, cap) {
+            h.ids[i] = nodes[i] ? count++ : UINT32_MAX;
+        }
+
+        tb_out4b(&h.e, count);
+        FOR_N(i, 0, cap) {
+            if (nodes[i] && !cache_hash_node(&h, nodes[i])) {
+                ok = false;
+                break;
+            }
+        }
+    }
+    tb_arena_restore(arena, sp);
+
+    if (ok) {
+        tb__md5sum(out_key->hash, h.e.data, h.e.count);
+
+        out_key->sym_count = dyn_array_length(h.syms);
+        out_key->syms = tb_arena_alloc(arena, out_key->sym_count * sizeof(TB_Symbol*));
+        memcpy(out_key->syms, h.syms, out_key->sym_count * sizeof(TB_Symbol*));
+    }
+
+    tb_platform_heap_free(h.e.data);
+    nl_map_free(h.sym_ids);
+    dyn_array_destroy(h.syms);
+    return ok;
+}
+
+void tb_cache_key_salt(TB_CacheKey* key, size_t len, const void* salt) {
+    uint8_t* buf = tb_platform_heap_alloc(sizeof(key->hash) + len);
+    memcpy(buf, key->hash, sizeof(key->hash));
+    memcpy(buf + sizeof(key->hash), salt, len);
+    tb__md5sum(key->hash, buf, sizeof(key->hash) + len);
+    tb_platform_heap_free(buf);
+}
+
+static void cache_path(const char* dir, const TB_CacheKey* key, char path[FILENAME_MAX]) {
+    char hex[33];
+    FOR_N(i, 0, 16) {
+        snprintf(&hex[i*2], 3, "%02x", key->hash[i]);
+    }
+    snprintf(path, FILENAME_MAX, "%s/%s", dir, hex);
+}
+
+bool tb_cache_load(const char* dir, const TB_CacheKey* key, TB_Function* f, TB_Arena* code_arena) {
+    char path[FILENAME_MAX];
+    cache_path(dir, key, path);
+
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        return false;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    rewind(file);
+
+    bool ok = false;
+    uint8_t* buf = size > (long) sizeof(CacheHeader) ? tb_platform_heap_alloc(size) : NULL;
+    if (buf && fread(buf, 1, size, file) == size) {
+        CacheHeader hdr;
+        memcpy(&hdr, buf, sizeof(hdr));
+
+        CachePatch* patches = (CachePatch*) &buf[sizeof(hdr)];
+        size_t code_pos = sizeof(hdr) + (size_t) hdr.patch_count * sizeof(CachePatch);
+
+        // anything off (half written, old version, hash collision on the name...) is a miss
+        ok = memcmp(hdr.magic, "TBCC", 4) == 0 && hdr.version == CACHE_VERSION
+            && memcmp(hdr.hash, key->hash, sizeof(hdr.hash)) == 0
+            && code_pos + hdr.code_size == (size_t) size;
+
+        for (size_t i = 0; ok && i < hdr.patch_count; i++) {
+            uint32_t sym = patches[i].sym;
+            if (sym & CACHE_SMALL_DATA) {
+                ok = (sym & ~CACHE_SMALL_DATA) <= 16;
+            } else {
+                ok = sym < key->sym_count;
+            }
+            ok = ok && (size_t) patches[i].pos + 4 <= hdr.code_size;
+        }
+
+        if (ok) {
+            TB_FunctionOutput* func_out = tb_arena_alloc(code_arena, sizeof(TB_FunctionOutput));
+            *func_out = (TB_FunctionOutput){
+                .parent          = f,
+                .section         = f->section,
+                .linkage         = f->linkage,
+                .stack_usage     = hdr.stack_usage,
+                .prologue_length = hdr.prologue_length,
+                .epilogue_length = hdr.epilogue_length,
+                .nop_pads        = hdr.nop_pads,
+                .code_size       = hdr.code_size,
+            };
+
+            func_out->code = tb_arena_alloc(code_arena, hdr.code_size);
+            memcpy(func_out->code, &buf[code_pos], hdr.code_size);
+
+            FOR_N(i, 0, hdr.patch_count) {
+                uint32_t sym = patches[i].sym;
+
+                TB_Symbol* target;
+                if (sym & CACHE_SMALL_DATA) {
+                    target = &tb__small_data_intern(f->super.module, sym & ~CACHE_SMALL_DATA, patches[i].data)->super;
+                } else {
+                    target = key->syms[sym];
+                }
+                tb_emit_symbol_patch(func_out, target, patches[i].pos);
+            }
+
+            f->output = func_out;
+        }
+    }
+
+    tb_platform_heap_free(buf);
+    fclose(file);
+    return ok;
+}
+
+// the anonymous rdata constants from tb__small_data_intern
+static bool cache_small_data(TB_Module* m, TB_Symbol* s, CachePatch* p) {
+    if (s->tag != TB_SYMBOL_GLOBAL || (s->name && s->name[0])) {
+        return false;
+    }
+
+    TB_Global* g = (TB_Global*) s;
+    if (g->parent != tb_module_get_rdata(m) || g->size > 16 || g->obj_count != 1) {
+        return false;
+    }
+
+    TB_InitObj* o = &g->objects[0];
+    if (o->type != TB_INIT_OBJ_REGION || o->offset != 0 || o->region.size != g->size) {
+        return false;
+    }
+
+    p->sym = CACHE_SMALL_DATA | g->size;
+    memcpy(p->data, o->region.ptr, g->size);
+    return true;
+}
+
+bool tb_cache_store(const char* dir, const TB_CacheKey* key, TB_Function* f) {
+    TB_FunctionOutput* func_out = f->output;
+    if (func_out == NULL) {
+        return false;
+    }
+
+    TB_Module* m = f->super.module;
+    TB_Emitter e = { 0 };
+
+    CacheHeader hdr = { .magic = "TBCC", .version = CACHE_VERSION };
+    memcpy(hdr.hash, key->hash, sizeof(hdr.hash));
+    hdr.code_size = func_out->code_size;
+    hdr.patch_count = func_out->patch_count;
+    hdr.stack_usage = func_out->stack_usage;
+    hdr.prologue_length = func_out->prologue_length;
+    hdr.epilogue_length = func_out->epilogue_length;
+    hdr.nop_pads = func_out->nop_pads;
+    tb_outs(&e, sizeof(hdr), &hdr);
+
+    bool ok = true;
+    for (TB_SymbolPatch* p = func_out->first_patch; ok && p; p = p->next) {
+        CachePatch cp = { .pos = p->pos, .sym = UINT32_MAX };
+
+        // there's not many symbols per function, a linear search is fine
+        FOR_N(i, 0, key->sym_count) {
+            if (key->syms[i] == p->target) { cp.sym = i; break; }
+        }
+
+        // the backend introduced some symbol we can't name, don't bother
+        if (cp.sym == UINT32_MAX && !cache_small_data(m, p->target, &cp)) {
+            ok = false;
+        }
+        tb_outs(&e, sizeof(cp), &cp);
+    }
+    tb_outs(&e, func_out->code_size, func_out->code);
+
+    if (ok) {
+        char path[FILENAME_MAX], tmp_path[FILENAME_MAX + 4];
+        cache_path(dir, key, path);
+        snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+        // written off to the side so readers never see half an entry, racing writers
+        // of the same key are writing the same bytes anyways.
+        FILE* file = fopen(tmp_path, "wb");
+        if (file == NULL) {
+            // mkdir -p and try again
+            char dir_path[FILENAME_MAX];
+            size_t dir_len = strlen(dir);
+            if (dir_len < FILENAME_MAX) {
+                memcpy(dir_path, dir, dir_len + 1);
+                FOR_N(i, 1, dir_len + 1) {
+                    if (dir_path[i] == '/' || dir_path[i] == '\\' || dir_path[i] == 0) {
+                        char ch = dir_path[i];
+                        dir_path[i] = 0;
+                        cache_mkdir(dir_path);
+                        dir_path[i] = ch;
+                    }
+                }
+            }
+            file = fopen(tmp_path, "wb");
+        }
+
+        ok = file != NULL && fwrite(e.data, 1, e.count, file) == e.count;
+        if (file) { ok &= fclose(file) == 0; }
+
+        #ifdef _WIN32
+        if (ok) { remove(path); }
+        #endif
+        ok = ok && rename(tmp_path, path) == 0;
+        if (!ok) { remove(tmp_path); }
+    }
+
+    tb_platform_heap_free(e.data);
+    return ok;
+}
@@ -45,7 +45,7 @@ enum {
     // all we can fit into 3bits, but also... 8 classes is a lot.
     //
     // * x86 has 3 currently: Stack, GPR, Vector.
-    MAX_REG_CLASSES = 8,
+    MAX_REG_CLASSES = TB_MAX_REG_CLASSES,
 };
 
 enum {
@@ -136,10 +136,16 @@ typedef bool (*NodeRemat)(TB_Node* n);
 // returns -1 if there's no edge btw.
 typedef int (*TB_2Addr)(TB_Node* n);
 
+// tables are placed after the function body, each entry is a 4byte offset from
+// the start of its table to the target BB.
 typedef struct {
-    uint32_t* pos;
-    uint32_t target;
-} JumpTablePatch;
+    // the instruction which refers to the table, see patch_jump_table
+    uint32_t ref_pos;
+    // where the table ended up
+    uint32_t pos;
+    // [start, start + count) in jump_table_entries (BB ids)
+    uint32_t start, count;
+} JumpTable;
 
 typedef struct {
     int count;
@@ -202,8 +208,17 @@ struct Ctx {
     NL_HashSet mask_intern;
     RegMask* normie_mask[MAX_REG_CLASSES];
 
+    // filled in by the RA & local scheduler, copied into TB_FunctionOutput
+    TB_RegAllocStats ra_stats;
+
     DynArray(TB_StackSlot) debug_stack_slots;
-    DynArray(JumpTablePatch) jump_table_patches;
+    DynArray(JumpTable) jump_tables;
+    DynArray(int) jump_table_entries;
+    DynArray(struct SwitchPlan*) switch_plans;
+
+    // branch (or the MachineBB for its trailing jump) -> node filling its delay
+    // slot, only MIPS has those (see post_ra_peephole in mips_target.c).
+    NL_Table delay_slots;
 
     // Line info
     MachineBB* current_emit_bb;
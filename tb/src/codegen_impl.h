@@ -26,6 +26,10 @@ static int node_tmp_count(Ctx* restrict ctx, TB_Node* n);
 static int node_2addr(TB_Node* n);
 //   returns true if it's possible to rematerialize rather than spill this node.
 static bool node_remat(TB_Node* n);
+//   rematerializable nodes which cost enough to build (big immediates, constant loads)
+//   that we'd rather do it once in a colder dominating block, if the register pressure
+//   can't afford keeping them live RA will just remat them back next to the uses.
+static bool node_hoist(TB_Node* n);
 
 // Code emit:
 //   finally write bytes, this is done post-RA so you're expected to use the VReg data
@@ -42,6 +46,18 @@ static void post_emit(Ctx* restrict ctx, TB_CGEmitter* e);
 //   called at the start of each BB, it's mostly for bookkeeping about where labels
 //   are placed.
 static void on_basic_block(Ctx* restrict ctx, TB_CGEmitter* e, int bb);
+//   writes pad bytes of NOPs, it's used to align loop headers (pad is always a multiple
+//   of the instruction size on fixed width targets).
+static void emit_nop_pad(Ctx* restrict ctx, TB_CGEmitter* e, size_t pad);
+//   jump tables go after the body (before post_emit), once one is placed the instruction
+//   at ref_pos which refers to it gets patched with the table's position.
+static void patch_jump_table(Ctx* restrict ctx, TB_CGEmitter* e, uint32_t ref_pos, uint32_t table_pos);
+//   cleanup over the allocated machine nodes right before emission, it can rewrite
+//   nodes in place or remove them from the MachineBB items entirely.
+static void post_ra_peephole(Ctx* restrict ctx);
+//   bumps the 32bit counter global at the top of a block (function entry & loop headers)
+//   for the JIT's tiering, it can't touch allocatable registers since everything's live.
+static void emit_counter(Ctx* restrict ctx, TB_CGEmitter* e, TB_Symbol* counter);
 
 // Scheduling bits:
 //   simple latency until the results of a node are useful (list scheduler will
@@ -51,14 +67,89 @@ static int node_latency(TB_Function* f, TB_Node* n, TB_Node* end);
 //   node can even run on, use the bits to represent that (at most you can make 64
 //   functional units in the current design but i don't think i need more than 10 rn)
 static uint64_t node_unit_mask(TB_Function* f, TB_Node* n);
+//   cycles the functional unit stays busy after dispatching the node, fully pipelined
+//   ops are 1 even if their latency is much higher.
+static int node_throughput(TB_Function* f, TB_Node* n);
 
 static void init_ctx(Ctx* restrict ctx, TB_ABI abi);
 static void disassemble(TB_CGEmitter* e, Disasm* restrict d, int bb, size_t pos, size_t end);
 
+// the baseline tier doesn't run loop analysis so the headers might be plain regions,
+// a predecessor at or after it in RPO means there's a backedge.
+static bool is_loop_header(TB_Function* f, TB_Node* n) {
+    if (cfg_is_natural_loop(n)) {
+        return true;
+    } else if (!cfg_is_region(n)) {
+        return false;
+    }
+
+    int id = f->scheduled[n->gvn]->id;
+    FOR_N(i, 0, n->input_count) {
+        TB_BasicBlock* pred = f->scheduled[n->inputs[i]->gvn];
+        if (pred && pred->id >= id) {
+            return true;
+        }
+    }
+    return false;
+}
+
 static void log_phase_end(TB_Function* f, size_t og_size, const char* label) {
     log_debug("%s: tmp_arena=%.1f KiB, ir_arena=%.1f KiB (post %s)", f->super.name, tb_arena_current_size(f->tmp_arena) / 1024.0f, (tb_arena_current_size(f->arena) - og_size) / 1024.0f, label);
 }
 
+// GCM places cheap nodes as late as it can which for a constant used in a loop means
+// rebuilding it every iteration, the expensive ones get moved up the dominator tree
+// to the coldest block between where their inputs are available and where they were.
+static bool hoist_constants(Ctx* restrict ctx, TB_Function* f, TB_CFG* cfg, TB_Node** rpo_nodes) {
+    TB_Arena* arena = f->tmp_arena;
+    TB_ArenaSavepoint sp = tb_arena_save(arena);
+
+    bool changes = false;
+    ArenaArray(TB_Node*) hoisted = aarray_create(arena, TB_Node*, 16);
+    FOR_N(i, 1, cfg->block_count) {
+        TB_BasicBlock* bb = f->scheduled[rpo_nodes[i]->gvn];
+
+        aarray_clear(hoisted);
+        nl_hashset_for(e, &bb->items) {
+            TB_Node* n = *e;
+            if (can_remat(ctx, n) && node_hoist(n)) {
+                aarray_push(hoisted, n);
+            }
+        }
+
+        aarray_for(j, hoisted) {
+            TB_Node* n = hoisted[j];
+
+            // we can't go above any of the inputs
+            TB_BasicBlock* early = f->scheduled[rpo_nodes[0]->gvn];
+            FOR_N(k, 1, n->input_count) {
+                TB_BasicBlock* in_bb = n->inputs[k] ? f->scheduled[n->inputs[k]->gvn] : NULL;
+                if (in_bb && in_bb->dom_depth > early->dom_depth) {
+                    early = in_bb;
+                }
+            }
+
+            TB_BasicBlock* best = bb;
+            for (TB_BasicBlock* dom = bb; dom != early && dom->dom_depth > early->dom_depth;) {
+                dom = dom->dom;
+                if (dom->freq < best->freq) { best = dom; }
+            }
+
+            if (best != bb) {
+                TB_OPTDEBUG(CODEGEN)(printf("HOIST %%%u: .bb%d => .bb%d\n", n->gvn, bb->id, best->id));
+
+                nl_hashset_remove2(&bb->items, n, tb__node_hash, tb__node_cmp);
+                nl_hashset_put2(&best->items, n, tb__node_hash, tb__node_cmp);
+                f->scheduled[n->gvn] = best;
+                changes = true;
+            }
+        }
+    }
+
+    tb_arena_restore(arena, sp);
+    return changes;
+}
+
 static void compile_function(TB_Function* restrict f, TB_FunctionOutput* restrict func_out, const TB_FeatureSet* features, TB_Arena* code_arena, bool emit_asm) {
     cuikperf_region_start("compile", f->super.name);
     TB_OPTDEBUG(CODEGEN)(tb_print_dumb(f, false));
@@ -94,6 +185,10 @@ static void compile_function(TB_Function* restrict f, TB_FunctionOutput* restric
     init_ctx(&ctx, f->super.module->target_abi);
     TB_Worklist* restrict ws = f->worklist;
 
+    // baseline tier cares about compile times more than the code, we skip the
+    // passes which only make the code nicer.
+    bool baseline = ctx.features.gen & TB_FEATURE_BASELINE;
+
     // legalize step takes out any of our 16bit and 8bit math ops
     // tb_pass_legalize(p, f->super.module->target_arch);
     size_t og_size = tb_arena_current_size(f->arena);
@@ -228,6 +323,13 @@ static void compile_function(TB_Function* restrict f, TB_FunctionOutput* restric
     memcpy(rpo_nodes, ws->items, cfg.block_count * sizeof(MachineBB));
     dyn_array_set_length(ws->items, 0);
 
+    if (!baseline) CUIK_TIMED_BLOCK("constant hoisting") {
+        if (hoist_constants(&ctx, f, &cfg, rpo_nodes)) {
+            // GCM's liveness doesn't know about the moves
+            tb_dataflow(f, arena, cfg, rpo_nodes);
+        }
+    }
+
     int stop_bb = -1;
     CUIK_TIMED_BLOCK("BB scheduling") {
         size_t cap = ((cfg.block_count * 4) / 3);
@@ -278,8 +380,11 @@ static void compile_function(TB_Function* restrict f, TB_FunctionOutput* restric
 
             // compute local schedule
             CUIK_TIMED_BLOCK("local sched") {
-                // tb_greedy_scheduler(f, &cfg, ws, NULL, bb);
-                tb_list_scheduler(f, &cfg, ws, NULL, bb, node_latency, node_unit_mask, FUNCTIONAL_UNIT_COUNT);
+                if (baseline) {
+                    tb_greedy_scheduler(f, &cfg, ws, NULL, bb);
+                } else {
+                    ctx.ra_stats.sched_cycles += tb_list_scheduler(f, &cfg, ws, NULL, bb, node_latency, node_unit_mask, node_throughput, FUNCTIONAL_UNIT_COUNT);
+                }
             }
 
             // a bit of slack for spills
@@ -396,10 +501,16 @@ static void compile_function(TB_Function* restrict f, TB_FunctionOutput* restric
         log_phase_end(f, og_size, "RA");
     }
 
+    if (!baseline) CUIK_TIMED_BLOCK("peephole") {
+        post_ra_peephole(&ctx);
+    }
+
+    // the jump tables aren't code, disassembly stops before them
+    size_t body_end = 0;
     CUIK_TIMED_BLOCK("emit") {
-        // allocate entire top of the code arena (we'll trim it later if possible)
-        ctx.emit.capacity = code_arena->limit - code_arena->avail;
-        ctx.emit.data = tb_arena_alloc(code_arena, ctx.emit.capacity);
+        // emit into the scratch buffer, ~8 bytes per node is a decent guess for how
+        // big the function ends up (it'll grow if we're wrong)
+        tb_cgemit_init(&ctx.emit, f->node_count * 8);
 
         // allocate more stuff now that we've run stats on the IR
         ctx.emit.label_count = cfg.block_count;
@@ -409,6 +520,10 @@ static void compile_function(TB_Function* restrict f, TB_FunctionOutput* restric
         TB_CGEmitter* e = &ctx.emit;
         pre_emit(&ctx, e, f->root_node);
 
+        // loop headers are aligned relative to the start of the function, the
+        // module's function alignment is always at least as strict.
+        const TB_CodeLayout* layout = &f->super.module->layout;
+
         FOR_N(i, 0, bb_count) {
             MachineBB* mbb = &machine_bbs[i];
             int bbid = mbb->id;
@@ -418,11 +533,23 @@ static void compile_function(TB_Function* restrict f, TB_FunctionOutput* restric
             } else {
                 ctx.fallthrough = INT_MAX;
             }
+
+            if (layout->loop_align > 1 && cfg_is_natural_loop(mbb->n)) {
+                size_t pos = GET_CODE_POS(e);
+                size_t pad = align_up(pos, layout->loop_align) - pos;
+                if (pad > 0 && pad <= layout->loop_max_pad) {
+                    emit_nop_pad(&ctx, e, pad);
+                }
+            }
+
             ctx.current_emit_bb = mbb;
             ctx.current_emit_bb_pos = GET_CODE_POS(e);
 
             // mark label
             on_basic_block(&ctx, e, bbid);
+            if (f->counter && (i == 0 || is_loop_header(f, mbb->n))) {
+                emit_counter(&ctx, e, f->counter);
+            }
             TB_OPTDEBUG(CODEGEN)(printf("BB %d\n", bbid));
 
             aarray_for(i, mbb->items) {
@@ -464,18 +591,29 @@ static void compile_function(TB_Function* restrict f, TB_FunctionOutput* restric
             }
         }
 
-        post_emit(&ctx, e);
-        log_phase_end(f, og_size, "emit");
+        body_end = GET_CODE_POS(e);
+        if (ctx.jump_tables) CUIK_TIMED_BLOCK("jump tables") {
+            size_t pad = align_up(body_end, 4) - body_end;
+            if (pad > 0) {
+                emit_nop_pad(&ctx, e, pad);
+            }
+
+            dyn_array_for(i, ctx.jump_tables) {
+                JumpTable* jt = &ctx.jump_tables[i];
+                jt->pos = GET_CODE_POS(e);
+                patch_jump_table(&ctx, e, jt->ref_pos, jt->pos);
 
-        // Fill jump table entries
-        CUIK_TIMED_BLOCK("jump tables") {
-            dyn_array_for(i, ctx.jump_table_patches) {
-                uint32_t target = ctx.emit.labels[ctx.jump_table_patches[i].target];
-                assert((target & 0x80000000) && "target label wasn't resolved... what?");
-                *ctx.jump_table_patches[i].pos = target & ~0x80000000;
+                FOR_N(j, 0, jt->count) {
+                    uint32_t target = ctx.emit.labels[ctx.jump_table_entries[jt->start + j]];
+                    assert((target & 0x80000000) && "target label wasn't resolved... what?");
+                    EMIT4(e, (target & ~0x80000000) - jt->pos);
+                }
             }
         }
 
+        post_emit(&ctx, e);
+        log_phase_end(f, og_size, "emit");
+
         nl_table_free(ctx.tmps_map);
     }
 
@@ -483,9 +621,8 @@ static void compile_function(TB_Function* restrict f, TB_FunctionOutput* restric
         ctx.locations[0].pos = 0;
     }
 
-    // trim code arena (it fits in a single chunk so just arena free the top)
-    code_arena->avail = (char*) &ctx.emit.data[ctx.emit.count];
-    tb_arena_realign(code_arena);
+    // move the code out of the scratch buffer, it's exactly sized
+    tb_cgemit_finalize(&ctx.emit, code_arena);
 
     // TODO(NeGate): move the assembly output to code arena
     if (emit_asm) CUIK_TIMED_BLOCK("dissassembly") {
@@ -511,16 +648,27 @@ static void compile_function(TB_Function* restrict f, TB_FunctionOutput* restric
             TB_Node* bb = rpo_nodes[bbid];
 
             uint32_t start = ctx.emit.labels[bbid] & ~0x80000000;
-            uint32_t end   = ctx.emit.count;
+            uint32_t end   = ctx.jump_tables ? body_end : ctx.emit.count;
             if (i + 1 < bb_count) {
                 end = ctx.emit.labels[machine_bbs[i + 1].id] & ~0x80000000;
             }
 
             disassemble(&ctx.emit, &d, bbid, start, end);
         }
+
+        dyn_array_for(i, ctx.jump_tables) {
+            JumpTable* jt = &ctx.jump_tables[i];
+            EMITA(&ctx.emit, ".jt%zu:\n", i);
+            FOR_N(j, 0, jt->count) {
+                EMITA(&ctx.emit, "  .long .bb%d - .jt%zu\n", ctx.jump_table_entries[jt->start + j], i);
+            }
+        }
     }
 
     // cleanup memory
+    dyn_array_destroy(ctx.jump_tables);
+    dyn_array_destroy(ctx.jump_table_entries);
+    dyn_array_destroy(ctx.switch_plans);
     tb_free_cfg(&cfg);
     cuikperf_region_end();
 
@@ -543,6 +691,7 @@ static void compile_function(TB_Function* restrict f, TB_FunctionOutput* restric
     func_out->prologue_length = ctx.prologue_length;
     func_out->epilogue_length = ctx.epilogue_length;
     func_out->nop_pads = ctx.nop_pads;
+    func_out->ra_stats = ctx.ra_stats;
 }
 
 static void get_data_type_size(TB_DataType dt, size_t* out_size, size_t* out_align) {
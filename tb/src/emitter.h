@@ -29,8 +29,8 @@ typedef struct {
     TB_Assembly *head_asm, *tail_asm;
     uint64_t total_asm;
 
-    // this is mapped to a giant buffer and is technically
-    // allow to use the entire rest of said buffer
+    // points into a per-thread scratch buffer which grows as needed, the
+    // final code gets copied out by tb_cgemit_finalize.
     size_t count, capacity;
     uint8_t* data;
 
@@ -143,21 +143,17 @@ static void tb_resolve_rel32(TB_CGEmitter* restrict e, uint32_t* head, uint32_t
     *head = 0x80000000 | target;
 }
 
-static void* tb_cgemit_reserve(TB_CGEmitter* restrict e, size_t count) {
-    if (e->count + count >= e->capacity) {
-        // we don't really want massive code buffers... functions shouldn't really be that big
-        size_t chunk_size = tb_arena_chunk_size(e->arena);
-        if (e->capacity >= chunk_size - sizeof(TB_Arena)) {
-            tb_panic("could not allocate code buffer (too big lmao)\n");
-        }
+// the code buffer is a per-thread scratch which gets copied out at the end (tb.c)
+void tb_cgemit_grow(TB_CGEmitter* restrict e, size_t min_cap);
+// size_hint is just a guess to skip a few regrows, it's fine if we go past it.
+void tb_cgemit_init(TB_CGEmitter* restrict e, size_t size_hint);
+// copies the emitted bytes into the code arena, only takes as much space as
+// the function needs (huge functions get their own chunk).
+uint8_t* tb_cgemit_finalize(TB_CGEmitter* restrict e, TB_Arena* code_arena);
 
-        // reallocate arena
-        size_t old_cap = e->capacity;
-        void* old = e->data;
-
-        e->capacity = (e->arena->top->limit - e->arena->top->avail) & ~0xF;
-        e->data = tb_arena_alloc(e->arena, e->capacity);
-        memcpy(e->data, old, old_cap);
+static void* tb_cgemit_reserve(TB_CGEmitter* restrict e, size_t count) {
+    if (UNLIKELY(e->count + count >= e->capacity)) {
+        tb_cgemit_grow(e, e->count + count);
     }
 
     return &e->data[e->count];
@@ -144,7 +144,9 @@ ExportList tb_module_layout_sections(TB_Module* m) {
         CUIK_TIMED_BLOCK_ARGS("layout", sec->name) {
             // place functions first
             size_t offset = 0;
+            size_t func_align = m->layout.func_align ? m->layout.func_align : 1;
             dyn_array_for(i, sec->funcs) {
+                offset = align_up(offset, func_align);
                 sec->funcs[i]->code_pos = offset;
                 offset += sec->funcs[i]->code_size;
             }
@@ -169,12 +171,17 @@ size_t tb_helper_write_section(TB_Module* m, size_t write_pos, TB_ModuleSection*
     assert(write_pos == pos);
     uint8_t* data = &output[pos];
 
-    // place functions
+    // place functions, the gaps left by aligning them are filled with INT3 on x64
+    // (zeroes elsewhere) since they're never supposed to be executed.
+    uint8_t gap_fill = m->target_arch == TB_ARCH_X86_64 ? 0xCC : 0;
+    size_t last_end = 0;
     dyn_array_for(i, section->funcs) {
         TB_FunctionOutput* out_f = section->funcs[i];
 
         if (out_f != NULL) {
+            memset(data + last_end, gap_fill, out_f->code_pos - last_end);
             memcpy(data + out_f->code_pos, out_f->code, out_f->code_size);
+            last_end = out_f->code_pos + out_f->code_size;
         }
     }
 
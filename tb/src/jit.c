@@ -31,10 +31,40 @@ void* tb_jit_wasm_obj(TB_Arena* arena, TB_Function* f) {
 #include <windows.h>
 #endif
 
+#ifndef _WIN32
+#include <dlfcn.h>
+#endif
+
+#ifdef TB_HOST_LINUX
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <signal.h>
+#include <ucontext.h>
+#endif
+
 enum {
-    ALLOC_COOKIE = 0xBAADF00D,
     ALLOC_GRANULARITY = 16,
-    STACK_SIZE = 2*1024*1024
+    STACK_SIZE = 2*1024*1024,
+    ALTSTACK_SIZE = 64*1024,
+
+    // the heap is carved into chunks, each one either holds objects of a single
+    // size class, is some thread's code bump region or is part of a large object.
+    CHUNK_SHIFT = 16,
+    CHUNK_SIZE  = 1u << CHUNK_SHIFT,
+
+    // small objects (thunks, globals) get size classes, anything past a quarter
+    // of a chunk gets chunks of its own.
+    SMALL_MAX   = 2048,
+    LARGE_MIN   = CHUNK_SIZE / 4,
+    CLASS_COUNT = 16,
+};
+
+// set on a code chunk's live count once the owning thread has moved on, whoever
+// drops it to zero after that gives the chunk back.
+#define CHUNK_RETIRED 0x80000000u
+
+static const uint16_t size_classes[CLASS_COUNT] = {
+    16, 32, 48, 64, 80, 96, 112, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048
 };
 
 typedef struct {
@@ -45,60 +75,286 @@ typedef struct {
     // least on x86), we need to restore it
     // before continuing execution.
     uint8_t prev_byte;
+
+    // the one we're resuming from stays out
+    bool active;
 } TB_Breakpoint;
 
-typedef struct {
-    uint32_t cookie;
-    uint32_t size; // if low bit is set, we're in use.
-    char data[];
-} FreeList;
+typedef enum {
+    CHUNK_FREE,
+    CHUNK_SMALL,
+    CHUNK_CODE,
+    CHUNK_LARGE,
+    CHUNK_LARGE_TAIL,
+} ChunkKind;
 
-// addr -> symbol
+// addr -> symbol, untagging just clears v.
 typedef struct {
     uint32_t k;
-    void* v;
+    _Atomic(void*) v;
 } Tag;
 
+// tags in a chunk sorted by address. allocation mostly moves upwards through
+// a chunk so new tags are usually appended in place (readers only look at the
+// first count), anything else gets a new copy swapped in and the old one
+// reclaimed once no reader could still be looking at it.
+typedef struct TagList TagList;
+struct TagList {
+    // limbo link once it's been replaced
+    TagList* next;
+    uint32_t cap;
+    _Atomic(uint32_t) count;
+    Tag tags[];
+};
+
+// kind & span are written under the heap lock but tb_jit_resolve_addr reads
+// them without it, the span is always stored before the kind.
+typedef struct {
+    _Atomic(uint8_t) kind;
+    uint8_t size_class;
+    // LARGE: number of chunks in the object
+    // LARGE_TAIL: how far back the head is
+    _Atomic(uint32_t) span;
+    // CODE: live objects (| CHUNK_RETIRED)
+    _Atomic(uint32_t) live;
+    // objects can't cross chunks (except for the large ones which are
+    // tagged at the head) so each chunk only keeps its own tags.
+    _Atomic(TagList*) tags;
+} JITChunk;
+
+typedef struct {
+    mtx_t lock;
+    void* free;
+    char* pos;
+    char* end;
+
+    // frees don't take the lock, they're pushed here and the allocator
+    // takes the whole list once its own runs dry.
+    _Atomic(void*) deferred;
+
+    // allocated objects, only for the stats
+    _Atomic(size_t) live;
+} SizeClass;
+
+// code gets bumped through a chunk owned by the thread, it only needs
+// to touch the heap lock once per chunk.
+typedef struct {
+    // the id tells the JIT apart from a newer one at the same address
+    TB_JIT* jit;
+    uint64_t jit_id;
+    size_t chunk;
+    char* pos;
+    char* end;
+} ThreadHeap;
+
+static thread_local ThreadHeap jit_thread_heap;
+static _Atomic(uint64_t) jit_next_id = 1;
+
+// a thread which moves onto another JIT (or exits) retires its code chunk, but
+// only if the JIT it came from is still alive. the key's destructor does the exits.
+static once_flag jit_live_init = ONCE_FLAG_INIT;
+static mtx_t jit_live_lock;
+static DynArray(TB_JIT*) jit_live;
+static tss_t jit_thread_key;
+
+typedef struct {
+    TB_Function* f;
+    TB_JITTier tier;
+    void* code;
+
+    // direct callers might've been placed against the baseline code before
+    // the tier up so it stays until the function is unplaced.
+    void* baseline;
+
+    // the tier thread is working on the IR without the lock, the tier can't
+    // go away until it's done.
+    bool compiling;
+
+    // the baseline code bumps this, it's a symbol of our own so nothing
+    // about it ends up in the module.
+    uint32_t* counter;
+    TB_Global counter_sym;
+} JITTier;
+
+// a direct reference to a placed function from another one's code, no
+// caller means it's a pointer in a global's initializer.
+typedef struct {
+    TB_Function* caller;
+    // executable address of the patched field (or the pointer in data), data
+    // addends are pointer sized.
+    char* pc;
+    intptr_t addend;
+} JITSite;
+
+// who refers to the function and who it refers to (so unplacing it can
+// drop its own sites from the callees).
+typedef struct {
+    DynArray(JITSite) sites;
+    DynArray(TB_Function*) callees;
+} JITRefs;
+
+// either a symbol table or a callback
+typedef struct {
+    size_t count;
+    const TB_JITSymbol* syms;
+
+    TB_JITResolver fn;
+    void* user_data;
+} JITResolver;
+
 struct TB_JIT {
-    size_t capacity;
+    uint64_t id;
+    TB_Arch arch;
+
+    // tag writers take the lock, readers just bump the counter for the current
+    // epoch. replaced lists sit in limbo until the epoch flips and its readers
+    // have drained.
     mtx_t lock;
+    _Atomic(uint32_t) tag_epoch;
+    _Atomic(uint32_t) tag_readers[2];
+    TagList* tag_limbo;
+    size_t tag_limbo_count;
+
+    // the whole heap is reserved up front so everything stays in rel32 (or BL)
+    // range of everything else, it's committed a segment at a time.
+    char* base;
+    size_t reserved;
+    size_t segment_size;
+
+    // with a dual mapping the heap has an RW view at base and an RX view at
+    // base + exec_delta, code is written through the former but run (and
+    // relocated) with the latter.
+    ptrdiff_t exec_delta;
+    int memfd;
+
+    // chunk bookkeeping, nothing below chunk_hint is free.
+    mtx_t heap_lock;
+    size_t segment_count;
+    _Atomic(size_t) committed_chunks;
+    size_t chunk_hint;
+    JITChunk* chunks;
+
+    SizeClass classes[CLASS_COUNT];
+
+    // lazy binding: unplaced callees get a stub which compiles them on the
+    // first call, everything in here is guarded by lazy_lock.
+    bool lazy;
+    bool lazy_opt;
+    bool lazy_has_features;
+    mtx_t lazy_lock;
+    TB_Worklist* lazy_ws;
+    TB_Arena* lazy_code_arena;
+    TB_FeatureSet lazy_features;
+    void* lazy_thunk;
+    NL_Map(TB_Function*, char*) lazy_stubs;
+
+    // tiering: stubs stay the only way in, the baseline code counts and the tier
+    // thread recompiles whatever gets hot. tiers & tier_map are guarded by lazy_lock.
+    bool tiered;
+    uint32_t hot_threshold;
+    _Atomic(bool) tier_quit;
+    thrd_t tier_thread;
+    TB_Worklist* tier_ws;
+    TB_Arena* tier_arenas[2];
+    DynArray(JITTier*) tiers;
+    NL_Map(TB_Function*, JITTier*) tier_map;
+
+    // host symbols, hits get cached (misses don't, a resolver might learn about
+    // them later) and far targets share one thunk each. guarded by sym_lock.
+    mtx_t sym_lock;
+    DynArray(JITResolver) resolvers;
+    DynArray(void*) libraries;
     NL_Strmap(void*) loaded_funcs;
+    NL_Map(void*, char*) far_thunks;
+
+    // the external which made the last placement fail
+    const char* undefined;
 
     DynArray(TB_Breakpoint) breakpoints;
-    DynArray(Tag) tags;
 
-    FreeList heap;
+    // unplaced code & retired objects wait in pending until the next epoch flip,
+    // then in limbo until everyone who entered before the flip has left. same as
+    // the tags except nobody waits on the readers, it's just checked every so often.
+    // refs tracks the direct calls between placed functions. guarded by gc_lock.
+    mtx_t gc_lock;
+    _Atomic(uint32_t) code_epoch;
+    _Atomic(uint32_t) code_readers[2];
+    DynArray(void*) gc_pending;
+    DynArray(void*) gc_limbo;
+    NL_Map(TB_Function*, JITRefs*) refs;
+    _Atomic(size_t) placed_count;
+
+    // perf & GDB (see jit_debug.c), only set if any of the flags were.
+    TB_JITFlags debug_flags;
+    DynArray(struct JITCodeEntry*) gdb_entries;
 };
 
 static const char* prot_names[] = {
     "RO", "RW", "RX", "RXW",
 };
 
-void tb_jit_tag_object(TB_JIT* jit, void* ptr, void* tag) {
-    assert(tag);
-    uint32_t offset = (char*) ptr - (char*) jit;
+// tags are placed by heap offset, code can be referenced by either view
+static ptrdiff_t jit_heap_offset(TB_JIT* jit, void* ptr) {
+    ptrdiff_t offset = (char*) ptr - jit->base;
+    if (jit->exec_delta && offset >= jit->exec_delta) {
+        offset -= jit->exec_delta;
+    }
+    return offset;
+}
+
+// joins the reader count of the current side of the epoch
+static uint32_t epoch_enter(_Atomic(uint32_t)* epoch, _Atomic(uint32_t) readers[2]) {
+    for (;;) {
+        uint32_t e = atomic_load(epoch) & 1;
+        atomic_fetch_add(&readers[e], 1);
 
-    size_t i = 0, count = dyn_array_length(jit->tags);
-    for (; i < count; i++) {
-        if (offset < jit->tags[i].k) break;
+        // if the epoch flipped under us the writer might not be waiting on
+        // the side we just joined.
+        if ((atomic_load(epoch) & 1) == e) {
+            return e;
+        }
+        atomic_fetch_sub(&readers[e], 1);
     }
+}
 
-    // we know where to insert
-    dyn_array_put_uninit(jit->tags, 1);
-    memmove(&jit->tags[i + 1], &jit->tags[i], (count - i) * sizeof(Tag));
-    jit->tags[i] = (Tag){ offset, tag };
+static uint32_t tag_read_begin(TB_JIT* jit) {
+    return epoch_enter(&jit->tag_epoch, jit->tag_readers);
 }
 
-void* tb_jit_resolve_addr(TB_JIT* jit, void* ptr, uint32_t* out_offset) {
-    mtx_lock(&jit->lock);
-    ptrdiff_t offset = (char*) ptr - (char*) jit;
-    if (offset < 0 || offset >= jit->capacity) goto bad;
+static void tag_read_end(TB_JIT* jit, uint32_t e) {
+    atomic_fetch_sub(&jit->tag_readers[e], 1);
+}
+
+// lock must be held
+static void tag_retire(TB_JIT* jit, TagList* list) {
+    if (list == NULL) {
+        return;
+    }
+
+    list->next = jit->tag_limbo;
+    jit->tag_limbo = list;
+    if (++jit->tag_limbo_count < 64) {
+        return;
+    }
+
+    // anyone who could've seen the limbo lists is on the old side of the epoch
+    uint32_t e = atomic_fetch_add(&jit->tag_epoch, 1) & 1;
+    while (atomic_load(&jit->tag_readers[e]) != 0) {
+        thrd_yield();
+    }
 
-    size_t left = 0;
-    size_t right = dyn_array_length(jit->tags);
-    if (right == 0) goto bad;
+    for (TagList* l = jit->tag_limbo; l;) {
+        TagList* next = l->next;
+        tb_platform_heap_free(l);
+        l = next;
+    }
+    jit->tag_limbo = NULL;
+    jit->tag_limbo_count = 0;
+}
 
-    Tag* tags = jit->tags;
+// index of the first tag past offset
+static size_t tag_search(Tag* tags, size_t count, uint32_t offset) {
+    size_t left = 0, right = count;
     while (left < right) {
         size_t middle = (left + right) / 2;
         if (tags[middle].k > offset) {
@@ -107,107 +363,555 @@ void* tb_jit_resolve_addr(TB_JIT* jit, void* ptr, uint32_t* out_offset) {
             left = middle + 1;
         }
     }
+    return right;
+}
+
+// clears the tags in [lo, hi) of chunk i, lock must be held.
+static void tag_remove_range(TB_JIT* jit, size_t i, uint32_t lo, uint32_t hi) {
+    TagList* list = atomic_load_explicit(&jit->chunks[i].tags, memory_order_relaxed);
+    if (list == NULL) {
+        return;
+    }
+
+    size_t count = atomic_load_explicit(&list->count, memory_order_relaxed);
+    for (size_t j = lo > 0 ? tag_search(list->tags, count, lo - 1) : 0; j < count && list->tags[j].k < hi; j++) {
+        atomic_store(&list->tags[j].v, NULL);
+    }
+}
 
-    size_t i = right - 1;
-    *out_offset = offset - tags[i].k;
-    return tags[i].v;
+void tb_jit_tag_object(TB_JIT* jit, void* ptr, void* tag) {
+    assert(tag);
+    uint32_t offset = jit_heap_offset(jit, ptr);
+    size_t i = offset >> CHUNK_SHIFT;
+    assert(i < jit->committed_chunks);
+
+    mtx_lock(&jit->lock);
+    TagList* old = atomic_load_explicit(&jit->chunks[i].tags, memory_order_relaxed);
+    size_t count = old ? atomic_load_explicit(&old->count, memory_order_relaxed) : 0;
+    size_t j = old ? tag_search(old->tags, count, offset) : 0;
+    if (j > 0 && old->tags[j - 1].k == offset) {
+        // retagging (or reusing a freed slot)
+        atomic_store(&old->tags[j - 1].v, tag);
+    } else if (j == count && count < (old ? old->cap : 0)) {
+        // append, it's not visible until the count goes up
+        old->tags[count].k = offset;
+        atomic_store_explicit(&old->tags[count].v, tag, memory_order_relaxed);
+        atomic_store_explicit(&old->count, count + 1, memory_order_release);
+    } else {
+        // new copy, the cleared tags get dropped while we're at it
+        size_t cap = count < 8 ? 16 : count * 2;
+        TagList* list = tb_platform_heap_alloc(sizeof(TagList) + cap*sizeof(Tag));
+        list->cap = cap;
+
+        size_t k = 0;
+        FOR_N(l, 0, count + 1) {
+            if (l == j) {
+                list->tags[k].k = offset;
+                atomic_store_explicit(&list->tags[k].v, tag, memory_order_relaxed);
+                k++;
+            }
+
+            void* v = l < count ? atomic_load_explicit(&old->tags[l].v, memory_order_relaxed) : NULL;
+            if (v != NULL) {
+                list->tags[k].k = old->tags[l].k;
+                atomic_store_explicit(&list->tags[k].v, v, memory_order_relaxed);
+                k++;
+            }
+        }
+        atomic_store_explicit(&list->count, k, memory_order_relaxed);
 
-    bad:
+        atomic_store(&jit->chunks[i].tags, list);
+        tag_retire(jit, old);
+    }
     mtx_unlock(&jit->lock);
-    return NULL;
 }
 
-void* tb_jit_alloc_obj(TB_JIT* jit, size_t size, size_t align) {
+void tb_jit_untag_object(TB_JIT* jit, void* ptr) {
+    uint32_t offset = jit_heap_offset(jit, ptr);
+    assert((offset >> CHUNK_SHIFT) < jit->committed_chunks);
+
     mtx_lock(&jit->lock);
-    size = (size + ALLOC_GRANULARITY - 1) & ~(ALLOC_GRANULARITY - 1);
+    tag_remove_range(jit, offset >> CHUNK_SHIFT, offset, offset + 1);
+    mtx_unlock(&jit->lock);
+}
 
-    FreeList* l = &jit->heap;
-    FreeList* end = (FreeList*) ((char*) jit + jit->capacity);
-    for (;;) {
-        assert(l->cookie == ALLOC_COOKIE);
-
-        // free slot, let's see if it's big enough
-        if ((l->size & 1) == 0 && (l->size >> 1) >= size) {
-            // if the node is bigger than one alloc, we need to split it
-            size_t whole_size = l->size >> 1;
-            size_t split_size = sizeof(FreeList) + size;
-            if (whole_size > split_size) {
-                // split
-                l->size = (size << 1) | 1;
-
-                // free leftovers
-                FreeList* rest = (FreeList*) &l->data[l->size >> 1];
-                rest->cookie = ALLOC_COOKIE;
-                rest->size = (whole_size - split_size) << 1;
-            } else {
-                // take entire piece
-                l->size |= 1;
+void* tb_jit_resolve_addr(TB_JIT* jit, void* ptr, uint32_t* out_offset) {
+    ptrdiff_t offset = jit_heap_offset(jit, ptr);
+    if (offset < 0 || offset >= atomic_load_explicit(&jit->committed_chunks, memory_order_acquire) * CHUNK_SIZE) {
+        return NULL;
+    }
+
+    // large objects are only tagged at the head. the chunk might be getting
+    // reused under us but the span is at least as new as the kind we saw.
+    size_t i = offset >> CHUNK_SHIFT;
+    if (atomic_load_explicit(&jit->chunks[i].kind, memory_order_acquire) == CHUNK_LARGE_TAIL) {
+        uint32_t span = atomic_load_explicit(&jit->chunks[i].span, memory_order_acquire);
+        if (span > i) {
+            return NULL;
+        }
+        i -= span;
+    }
+
+    void* result = NULL;
+    uint32_t e = tag_read_begin(jit);
+    TagList* list = atomic_load(&jit->chunks[i].tags);
+    if (list != NULL) {
+        size_t j = tag_search(list->tags, atomic_load_explicit(&list->count, memory_order_acquire), offset);
+        if (j > 0 && (result = atomic_load(&list->tags[j - 1].v)) != NULL) {
+            *out_offset = offset - list->tags[j - 1].k;
+        }
+    }
+    tag_read_end(jit, e);
+    return result;
+}
+
+////////////////////////////////
+// Code heap
+////////////////////////////////
+// maps another n chunks at the end of the committed part of the reservation, heap_lock must be held.
+static bool jit_grow(TB_JIT* jit, size_t n) {
+    size_t offset = jit->committed_chunks * CHUNK_SIZE;
+    size_t size   = n * CHUNK_SIZE;
+    if (offset + size > jit->reserved) {
+        return false;
+    }
+
+    char* ptr = jit->base + offset;
+    #if defined(_WIN32)
+    if (VirtualAlloc(ptr, size, MEM_COMMIT, PAGE_EXECUTE_READWRITE) == NULL) {
+        return false;
+    }
+    #else
+    #ifdef TB_HOST_LINUX
+    if (jit->memfd >= 0) {
+        // grow the file and map the new part of it into both views
+        if (ftruncate(jit->memfd, offset + size) != 0 ||
+            mmap(ptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, jit->memfd, offset) == MAP_FAILED ||
+            mmap(ptr + jit->exec_delta, size, PROT_READ | PROT_EXEC, MAP_SHARED | MAP_FIXED, jit->memfd, offset) == MAP_FAILED) {
+            return false;
+        }
+    } else
+    #endif
+    // a lil unsafe... im sorry momma
+    if (!tb_platform_vprotect(ptr, size, TB_PAGE_RXW)) {
+        return false;
+    }
+    #endif
+
+    log_debug("jit: mapped segment %zu (%p, %zu KiB)", jit->segment_count, ptr, size / 1024);
+    atomic_fetch_add_explicit(&jit->committed_chunks, n, memory_order_release);
+    jit->segment_count += 1;
+    return true;
+}
+
+// first fit over the chunk map, grows the heap when nothing fits. heap_lock must be held.
+static ptrdiff_t jit_acquire_chunks(TB_JIT* jit, size_t n, ChunkKind kind) {
+    size_t start = jit->chunk_hint, run = 0;
+    FOR_N(i, jit->chunk_hint, jit->committed_chunks) {
+        if (jit->chunks[i].kind != CHUNK_FREE) {
+            run = 0;
+            continue;
+        }
+
+        if (run++ == 0) {
+            start = i;
+        }
+
+        if (run == n) {
+            goto found;
+        }
+    }
+
+    // whatever free run we ended on continues into the new segment
+    if (run == 0) {
+        start = jit->committed_chunks;
+    }
+
+    size_t need = start + n - jit->committed_chunks;
+    size_t segment_chunks = jit->segment_size >> CHUNK_SHIFT;
+    if (!jit_grow(jit, align_up(need, segment_chunks)) && !jit_grow(jit, need)) {
+        return -1;
+    }
+
+    found:
+    FOR_N(i, start, start + n) {
+        atomic_store_explicit(&jit->chunks[i].span, i - start, memory_order_relaxed);
+        atomic_store_explicit(&jit->chunks[i].kind, CHUNK_LARGE_TAIL, memory_order_release);
+    }
+    atomic_store_explicit(&jit->chunks[start].span, n, memory_order_relaxed);
+    atomic_store_explicit(&jit->chunks[start].kind, kind, memory_order_release);
+    atomic_store_explicit(&jit->chunks[start].live, 0, memory_order_relaxed);
+
+    if (start == jit->chunk_hint) {
+        jit->chunk_hint = start + n;
+    }
+    return start;
+}
+
+// drops the tags in [offset, offset + size) if there's any
+static void jit_untag_range(TB_JIT* jit, size_t offset, size_t size) {
+    size_t i = offset >> CHUNK_SHIFT;
+    if (atomic_load(&jit->chunks[i].tags) != NULL) {
+        mtx_lock(&jit->lock);
+        tag_remove_range(jit, i, offset, offset + size);
+        mtx_unlock(&jit->lock);
+    }
+}
+
+static void jit_release_chunks(TB_JIT* jit, size_t i) {
+    if (atomic_load(&jit->chunks[i].tags) != NULL) {
+        mtx_lock(&jit->lock);
+        tag_retire(jit, atomic_exchange(&jit->chunks[i].tags, NULL));
+        mtx_unlock(&jit->lock);
+    }
+
+    mtx_lock(&jit->heap_lock);
+    size_t span = jit->chunks[i].span;
+    FOR_N(j, i, i + span) {
+        jit->chunks[j].kind = CHUNK_FREE;
+    }
+
+    if (i < jit->chunk_hint) {
+        jit->chunk_hint = i;
+    }
+    mtx_unlock(&jit->heap_lock);
+}
+
+static void* jit_alloc_chunks(TB_JIT* jit, size_t size, ChunkKind kind) {
+    mtx_lock(&jit->heap_lock);
+    ptrdiff_t i = jit_acquire_chunks(jit, (size + CHUNK_SIZE - 1) >> CHUNK_SHIFT, kind);
+    mtx_unlock(&jit->heap_lock);
+    return i >= 0 ? jit->base + (i << CHUNK_SHIFT) : NULL;
+}
+
+static void* jit_alloc_small(TB_JIT* jit, size_t size) {
+    int c = 0;
+    while (size_classes[c] < size) {
+        c++;
+    }
+
+    SizeClass* sc = &jit->classes[c];
+    size = size_classes[c];
+
+    mtx_lock(&sc->lock);
+    void* ptr = sc->free;
+    if (ptr == NULL) {
+        ptr = atomic_exchange(&sc->deferred, NULL);
+    }
+
+    if (ptr != NULL) {
+        sc->free = *(void**) ptr;
+    } else {
+        if (sc->end - sc->pos < size) {
+            char* chunk = jit_alloc_chunks(jit, CHUNK_SIZE, CHUNK_SMALL);
+            if (chunk == NULL) {
+                mtx_unlock(&sc->lock);
+                return NULL;
             }
 
-            mtx_unlock(&jit->lock);
-            return l->data;
+            jit->chunks[(chunk - jit->base) >> CHUNK_SHIFT].size_class = c;
+            sc->pos = chunk;
+            sc->end = chunk + CHUNK_SIZE;
         }
 
-        FreeList* next = (FreeList*) &l->data[l->size >> 1];
-        if (next == end) {
-            break;
+        ptr = sc->pos;
+        sc->pos += size;
+    }
+    mtx_unlock(&sc->lock);
+
+    atomic_fetch_add_explicit(&sc->live, 1, memory_order_relaxed);
+    return ptr;
+}
+
+static void jit_retire_chunk(TB_JIT* jit, size_t i) {
+    if (atomic_fetch_or(&jit->chunks[i].live, CHUNK_RETIRED) == 0) {
+        jit_release_chunks(jit, i);
+    }
+}
+
+// gives up the thread's code chunk, nothing happens if its JIT has already ended.
+static void jit_thread_heap_drop(ThreadHeap* th) {
+    if (th->pos != NULL) {
+        mtx_lock(&jit_live_lock);
+        dyn_array_for(i, jit_live) {
+            if (jit_live[i] == th->jit && th->jit->id == th->jit_id) {
+                jit_retire_chunk(th->jit, th->chunk);
+                break;
+            }
         }
+        mtx_unlock(&jit_live_lock);
+    }
+    *th = (ThreadHeap){ 0 };
+}
+
+static void jit_thread_exit(void* th) {
+    jit_thread_heap_drop(th);
+}
+
+static void jit_live_init_once(void) {
+    mtx_init(&jit_live_lock, mtx_plain);
+    tss_create(&jit_thread_key, jit_thread_exit);
+}
+
+static void* jit_alloc_code(TB_JIT* jit, size_t size, size_t align) {
+    assert(align <= 4096 && "the chunks are only page aligned");
+    if (size >= LARGE_MIN) {
+        return jit_alloc_chunks(jit, size, CHUNK_LARGE);
+    }
+
+    ThreadHeap* th = &jit_thread_heap;
+    if (th->jit_id != jit->id) {
+        jit_thread_heap_drop(th);
+        th->jit = jit;
+        th->jit_id = jit->id;
+        tss_set(jit_thread_key, th);
+    }
 
-        // coalesce free regions when we see them here, it'll
-        // make later walks faster
-        while ((l->size & 1) == 0 && (next->size & 1) == 0) {
-            size_t new_size = (l->size >> 1) + sizeof(FreeList) + (next->size >> 1);
-            l->size = (new_size << 1);
+    char* ptr = (char*) align_up((uintptr_t) th->pos, align);
+    if (th->pos == NULL || ptr + size > th->end) {
+        char* chunk = jit_alloc_chunks(jit, CHUNK_SIZE, CHUNK_CODE);
+        if (chunk == NULL) {
+            return NULL;
+        }
 
-            next = (FreeList*) &l->data[new_size];
+        if (th->pos != NULL) {
+            jit_retire_chunk(jit, th->chunk);
         }
 
-        l = next;
+        th->chunk = (chunk - jit->base) >> CHUNK_SHIFT;
+        th->pos = chunk;
+        th->end = chunk + CHUNK_SIZE;
+        ptr = (char*) align_up((uintptr_t) chunk, align);
     }
 
-    mtx_unlock(&jit->lock);
-    return NULL;
+    th->pos = ptr + size;
+    atomic_fetch_add_explicit(&jit->chunks[th->chunk].live, 1, memory_order_relaxed);
+    return ptr;
+}
+
+void* tb_jit_alloc_obj(TB_JIT* jit, size_t size, size_t align) {
+    assert(align == 0 || tb_is_power_of_two(align));
+    if (align < ALLOC_GRANULARITY) {
+        align = ALLOC_GRANULARITY;
+    }
+
+    size = (size + ALLOC_GRANULARITY - 1) & ~(ALLOC_GRANULARITY - 1);
+    if (size == 0) {
+        size = ALLOC_GRANULARITY;
+    }
+
+    if (size <= SMALL_MAX && align == ALLOC_GRANULARITY) {
+        return jit_alloc_small(jit, size);
+    } else {
+        return jit_alloc_code(jit, size, align);
+    }
 }
 
 void tb_jit_free_obj(TB_JIT* jit, void* ptr) {
-    FreeList* obj = ((FreeList*) ptr) - 1;
-    assert(obj->cookie == ALLOC_COOKIE);
-    obj->size &= ~1;
+    ptrdiff_t offset = jit_heap_offset(jit, ptr);
+    assert(offset >= 0 && offset < jit->committed_chunks * CHUNK_SIZE);
+
+    size_t i = offset >> CHUNK_SHIFT;
+    JITChunk* c = &jit->chunks[i];
+    switch (c->kind) {
+        case CHUNK_SMALL: {
+            // the free list lives in the RW view
+            void** obj = (void**) (jit->base + offset);
+            SizeClass* sc = &jit->classes[c->size_class];
+            jit_untag_range(jit, offset, size_classes[c->size_class]);
+
+            void* head = atomic_load_explicit(&sc->deferred, memory_order_relaxed);
+            do {
+                *obj = head;
+            } while (!atomic_compare_exchange_weak(&sc->deferred, &head, obj));
+            atomic_fetch_sub_explicit(&sc->live, 1, memory_order_relaxed);
+            break;
+        }
+
+        case CHUNK_CODE:
+        jit_untag_range(jit, offset, 1);
+        if (atomic_fetch_sub(&c->live, 1) == (CHUNK_RETIRED | 1)) {
+            jit_release_chunks(jit, i);
+        }
+        break;
+
+        case CHUNK_LARGE:
+        jit_release_chunks(jit, i);
+        break;
+
+        default:
+        tb_panic("JIT: %p isn't an allocation", ptr);
+    }
 }
 
-void tb_jit_dump_heap(TB_JIT* jit) {
-    mtx_lock(&jit->lock);
+////////////////////////////////
+// Reclamation
+////////////////////////////////
+uint32_t tb_jit_enter(TB_JIT* jit) {
+    return epoch_enter(&jit->code_epoch, jit->code_readers);
+}
 
-    FreeList* l = &jit->heap;
-    FreeList* next;
-    FreeList* end = (FreeList*) ((char*) jit + jit->capacity);
+void tb_jit_exit(TB_JIT* jit, uint32_t epoch) {
+    atomic_fetch_sub(&jit->code_readers[epoch], 1);
+}
 
-    printf("HEAP:\n");
-    size_t tag = 0, tag_count = dyn_array_length(jit->tags);
-    char* base = (char*) jit;
+// frees the limbo once the old side of the epoch has drained, then moves whatever's
+// pending into it and flips. gc_lock must be held.
+static void jit_gc_poll(TB_JIT* jit) {
     for (;;) {
-        if (l->size & 1) {
-            printf("* ALLOC [%p %u", l->data, l->size >> 1);
+        if (dyn_array_length(jit->gc_limbo) > 0) {
+            uint32_t e = (atomic_load(&jit->code_epoch) - 1) & 1;
+            if (atomic_load(&jit->code_readers[e]) != 0) {
+                return;
+            }
+
+            dyn_array_for(i, jit->gc_limbo) {
+                tb_jit_free_obj(jit, jit->gc_limbo[i]);
+            }
+            dyn_array_clear(jit->gc_limbo);
+        }
+
+        if (dyn_array_length(jit->gc_pending) == 0) {
+            return;
+        }
+
+        // anyone who entered from here on can't have seen the pending stuff
+        DynArray(void*) tmp = jit->gc_limbo;
+        jit->gc_limbo = jit->gc_pending;
+        jit->gc_pending = tmp;
+        atomic_fetch_add(&jit->code_epoch, 1);
+    }
+}
+
+static void jit_gc_retire(TB_JIT* jit, void* ptr) {
+    if (ptr != NULL) {
+        dyn_array_put(jit->gc_pending, ptr);
+    }
+}
+
+void tb_jit_retire_obj(TB_JIT* jit, void* ptr) {
+    mtx_lock(&jit->gc_lock);
+    jit_gc_retire(jit, ptr);
+    jit_gc_poll(jit);
+    mtx_unlock(&jit->gc_lock);
+}
+
+size_t tb_jit_collect(TB_JIT* jit) {
+    mtx_lock(&jit->gc_lock);
+    jit_gc_poll(jit);
+    size_t waiting = dyn_array_length(jit->gc_pending) + dyn_array_length(jit->gc_limbo);
+    mtx_unlock(&jit->gc_lock);
+    return waiting;
+}
 
-            // found the next tag here
-            if (tag < tag_count && l->data == &base[jit->tags[tag].k]) {
-                printf(" TAG=%p", jit->tags[tag].v);
-                tag += 1;
+void tb_jit_heap_stats(TB_JIT* jit, TB_JITHeapStats* out) {
+    *out = (TB_JITHeapStats){
+        .reserved = jit->reserved,
+        .placed_functions = atomic_load(&jit->placed_count),
+    };
+
+    FOR_N(i, 0, CLASS_COUNT) {
+        out->small_objects += atomic_load_explicit(&jit->classes[i].live, memory_order_relaxed);
+    }
+
+    mtx_lock(&jit->gc_lock);
+    out->retired_objects = dyn_array_length(jit->gc_pending) + dyn_array_length(jit->gc_limbo);
+    mtx_unlock(&jit->gc_lock);
+
+    mtx_lock(&jit->heap_lock);
+    out->mapped = jit->committed_chunks * CHUNK_SIZE;
+
+    size_t run = 0;
+    for (size_t i = 0; i < jit->committed_chunks;) {
+        JITChunk* c = &jit->chunks[i];
+        if (c->kind == CHUNK_FREE) {
+            run += CHUNK_SIZE;
+            out->free_bytes += CHUNK_SIZE;
+            if (out->largest_free < run) {
+                out->largest_free = run;
             }
+            i += 1;
+            continue;
+        }
+
+        run = 0;
+        switch (c->kind) {
+            case CHUNK_SMALL:
+            out->small_bytes += CHUNK_SIZE;
+            break;
+
+            case CHUNK_CODE:
+            out->code_bytes += CHUNK_SIZE;
+            out->code_objects += atomic_load(&c->live) & ~CHUNK_RETIRED;
+            break;
 
-            printf("]\n");
+            case CHUNK_LARGE:
+            out->large_bytes += c->span * CHUNK_SIZE;
+            out->code_objects += 1;
+            break;
+
+            default: tb_unreachable();
         }
+        i += c->span;
+    }
+    mtx_unlock(&jit->heap_lock);
+
+    out->fragmentation = out->free_bytes ? 1.0 - (double) out->largest_free / out->free_bytes : 0.0;
+}
+
+void tb_jit_dump_heap(TB_JIT* jit) {
+    TB_JITHeapStats stats;
+    tb_jit_heap_stats(jit, &stats);
+
+    mtx_lock(&jit->heap_lock);
+    printf("HEAP: %zu segments, %zu/%zu KiB mapped (%s)\n", jit->segment_count, (jit->committed_chunks * CHUNK_SIZE) / 1024, jit->reserved / 1024, jit->exec_delta ? "RW + RX" : "RXW");
+    printf("  live: %zu KiB small (%zu objs), %zu KiB code (%zu objs), %zu KiB large\n", stats.small_bytes / 1024, stats.small_objects, stats.code_bytes / 1024, stats.code_objects, stats.large_bytes / 1024);
+    printf("  free: %zu KiB (largest %zu KiB, %.0f%% fragmented)\n", stats.free_bytes / 1024, stats.largest_free / 1024, stats.fragmentation * 100.0);
+    printf("  %zu functions placed, %zu retired objects waiting\n", stats.placed_functions, stats.retired_objects);
+
+    for (size_t i = 0; i < jit->committed_chunks;) {
+        JITChunk* c = &jit->chunks[i];
+        char* start = jit->base + (i << CHUNK_SHIFT);
+
+        size_t span = c->kind == CHUNK_FREE ? 0 : c->span;
+        switch (c->kind) {
+            case CHUNK_FREE:
+            while (i + span < jit->committed_chunks && jit->chunks[i + span].kind == CHUNK_FREE) {
+                span++;
+            }
+            printf("* FREE  [%p %zu KiB]\n", start, (span * CHUNK_SIZE) / 1024);
+            break;
+
+            case CHUNK_SMALL:
+            printf("* SMALL [%p %u]\n", start, size_classes[c->size_class]);
+            break;
+
+            case CHUNK_CODE: {
+                uint32_t live = atomic_load(&c->live);
+                printf("* CODE  [%p live=%u%s]\n", start, live & ~CHUNK_RETIRED, live & CHUNK_RETIRED ? "" : " ACTIVE");
+                break;
+            }
 
-        next = (FreeList*) &l->data[l->size >> 1];
-        if (next == end) {
+            case CHUNK_LARGE:
+            printf("* LARGE [%p %zu KiB]\n", start, (span * CHUNK_SIZE) / 1024);
             break;
+
+            default: tb_unreachable();
         }
-        l = next;
+
+        TagList* list = atomic_load(&c->tags);
+        FOR_N(j, 0, list ? atomic_load(&list->count) : 0) {
+            void* v = atomic_load(&list->tags[j].v);
+            if (v != NULL) {
+                printf("    TAG=%p (+%zu)\n", v, list->tags[j].k - (i << CHUNK_SHIFT));
+            }
+        }
+        i += span;
     }
-    mtx_unlock(&jit->lock);
+    mtx_unlock(&jit->heap_lock);
 }
 
-static void* get_proc(TB_JIT* jit, const char* name) {
+static void* host_proc(const char* name) {
     #ifdef _WIN32
     static HMODULE kernel32, user32, gdi32, opengl32, msvcrt;
     if (user32 == NULL) {
@@ -218,155 +922,1251 @@ static void* get_proc(TB_JIT* jit, const char* name) {
         msvcrt   = LoadLibrary("msvcrt.dll");
     }
 
-    // check cache first
-    ptrdiff_t search = nl_map_get_cstr(jit->loaded_funcs, name);
-    if (search >= 0) return jit->loaded_funcs[search].v;
-
     void* addr = GetProcAddress(NULL, name);
     if (addr == NULL) addr = GetProcAddress(kernel32, name);
     if (addr == NULL) addr = GetProcAddress(user32, name);
     if (addr == NULL) addr = GetProcAddress(gdi32, name);
     if (addr == NULL) addr = GetProcAddress(opengl32, name);
     if (addr == NULL) addr = GetProcAddress(msvcrt, name);
-
-    // printf("JIT: loaded %s (%p)\n", name, addr);
-    nl_map_put_cstr(jit->loaded_funcs, name, addr);
     return addr;
     #else
-    return NULL;
+    return dlsym(RTLD_DEFAULT, name);
     #endif
 }
 
-static void* get_symbol_address(const TB_Symbol* s) {
-    if (s->tag == TB_SYMBOL_GLOBAL) {
-        return ((TB_Global*) s)->address;
-    } else if (s->tag == TB_SYMBOL_FUNCTION) {
-        return ((TB_Function*) s)->compiled_pos;
-    } else {
-        tb_todo();
+static void* get_proc(TB_JIT* jit, const char* name) {
+    mtx_lock(&jit->sym_lock);
+
+    // check cache first
+    ptrdiff_t search = nl_map_get_cstr(jit->loaded_funcs, name);
+    if (search >= 0) {
+        void* addr = jit->loaded_funcs[search].v;
+        mtx_unlock(&jit->sym_lock);
+        return addr;
     }
-}
 
-void* tb_jit_place_function(TB_JIT* jit, TB_Function* f) {
-    TB_FunctionOutput* func_out = f->output;
-    if (f->compiled_pos != NULL) {
-        return f->compiled_pos;
+    // user resolvers might take a while (or call back into the JIT) so they run
+    // on a copy of the lookup chain without the lock.
+    size_t resolver_count = dyn_array_length(jit->resolvers);
+    size_t library_count = dyn_array_length(jit->libraries);
+    JITResolver* resolvers = tb_platform_heap_alloc(resolver_count*sizeof(JITResolver) + library_count*sizeof(void*) + 1);
+    void** libraries = (void**) &resolvers[resolver_count];
+    memcpy(resolvers, jit->resolvers, resolver_count*sizeof(JITResolver));
+    memcpy(libraries, jit->libraries, library_count*sizeof(void*));
+    mtx_unlock(&jit->sym_lock);
+
+    // user tables & resolvers go first so they can override the host
+    void* addr = NULL;
+    FOR_N(i, 0, resolver_count) {
+        JITResolver* r = &resolvers[i];
+        if (r->fn) {
+            addr = r->fn(r->user_data, name);
+        } else {
+            FOR_N(j, 0, r->count) if (strcmp(r->syms[j].name, name) == 0) {
+                addr = r->syms[j].address;
+                break;
+            }
+        }
+
+        if (addr != NULL) break;
     }
 
-    // copy machine code
-    char* dst = tb_jit_alloc_obj(jit, func_out->code_size, 16);
-    memcpy(dst, func_out->code, func_out->code_size);
-    f->compiled_pos = dst;
+    if (addr == NULL) {
+        addr = host_proc(name);
+    }
+
+    FOR_N(i, 0, library_count) {
+        if (addr != NULL) break;
+
+        #ifdef _WIN32
+        addr = GetProcAddress(libraries[i], name);
+        #else
+        addr = dlsym(libraries[i], name);
+        #endif
+    }
+    tb_platform_heap_free(resolvers);
+
+    if (addr != NULL) {
+        mtx_lock(&jit->sym_lock);
+        // whoever got here first wins, everyone has to agree on the address
+        search = nl_map_get_cstr(jit->loaded_funcs, name);
+        if (search >= 0) {
+            addr = jit->loaded_funcs[search].v;
+        } else {
+            // the name might not outlive the JIT (tb_jit_resolve_symbol)
+            size_t len = strlen(name);
+            char* key = tb_platform_heap_alloc(len + 1);
+            memcpy(key, name, len + 1);
+            nl_map_put_cstr(jit->loaded_funcs, key, addr);
+        }
+        mtx_unlock(&jit->sym_lock);
+    }
+
+    log_debug("jit: resolved %s (%p)", name, addr);
+    return addr;
+}
+
+void tb_jit_add_symbols(TB_JIT* jit, size_t count, const TB_JITSymbol* syms) {
+    mtx_lock(&jit->sym_lock);
+    dyn_array_put(jit->resolvers, (JITResolver){ .count = count, .syms = syms });
+    mtx_unlock(&jit->sym_lock);
+}
+
+void tb_jit_add_resolver(TB_JIT* jit, TB_JITResolver fn, void* user_data) {
+    mtx_lock(&jit->sym_lock);
+    dyn_array_put(jit->resolvers, (JITResolver){ .fn = fn, .user_data = user_data });
+    mtx_unlock(&jit->sym_lock);
+}
+
+bool tb_jit_load_library(TB_JIT* jit, const char* path) {
+    #ifdef _WIN32
+    void* lib = LoadLibraryA(path);
+    #else
+    void* lib = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    #endif
+
+    if (lib == NULL) {
+        return false;
+    }
+
+    mtx_lock(&jit->sym_lock);
+    dyn_array_put(jit->libraries, lib);
+    mtx_unlock(&jit->sym_lock);
+    return true;
+}
+
+void* tb_jit_resolve_symbol(TB_JIT* jit, const char* name) {
+    return get_proc(jit, name);
+}
+
+static void* jit_external_address(TB_JIT* jit, TB_External* e) {
+    if (e->super.address != NULL) {
+        return e->super.address;
+    }
+
+    // jit_resolvable already went looking for it
+    void* addr = get_proc(jit, e->super.name);
+    TB_ASSERT_MSG(addr != NULL, "JIT: %s went missing", e->super.name);
+    return addr;
+}
+
+// returns t's name if it's an external nothing resolves, whatever placing t would
+// drag along goes onto the stack.
+static const char* jit_resolvable_visit(TB_JIT* jit, NL_HashSet* seen, DynArray(TB_Symbol*)* stack, TB_Symbol* t) {
+    if (t->tag == TB_SYMBOL_EXTERNAL) {
+        if (((TB_External*) t)->super.address == NULL && get_proc(jit, t->name) == NULL) {
+            return t->name;
+        }
+    } else if (t->tag == TB_SYMBOL_FUNCTION) {
+        // same as jit_function_address, stubs resolve on their first call
+        if (!jit->lazy && ((TB_Function*) t)->compiled_pos == NULL && !nl_hashset_put(seen, t)) {
+            dyn_array_put(*stack, t);
+        }
+    } else if (t->tag == TB_SYMBOL_GLOBAL) {
+        if (((TB_Global*) t)->address == NULL && !nl_hashset_put(seen, t)) {
+            dyn_array_put(*stack, t);
+        }
+    }
+    return NULL;
+}
+
+// placing s also places whatever it refers to which isn't placed yet (callees,
+// unless they'd get stubs, and globals), this walks all of that looking for
+// externals nothing resolves so placement can fail before touching anything.
+// the name ends up in jit->undefined.
+static bool jit_resolvable(TB_JIT* jit, TB_Symbol* s) {
+    const char* missing = NULL;
+    NL_HashSet seen = nl_hashset_alloc(16);
+    DynArray(TB_Symbol*) stack = dyn_array_create(TB_Symbol*, 16);
+    dyn_array_put(stack, s);
+    nl_hashset_put(&seen, s);
+
+    while (missing == NULL && dyn_array_length(stack) > 0) {
+        s = dyn_array_pop(stack);
+        if (s->tag == TB_SYMBOL_FUNCTION) {
+            TB_FunctionOutput* func_out = ((TB_Function*) s)->output;
+            for (TB_SymbolPatch* p = func_out ? func_out->first_patch : NULL; p && missing == NULL; p = p->next) {
+                missing = jit_resolvable_visit(jit, &seen, &stack, p->target);
+            }
+        } else {
+            TB_Global* g = (TB_Global*) s;
+            FOR_N(k, 0, g->obj_count) {
+                if (missing == NULL && g->objects[k].type == TB_INIT_OBJ_RELOC) {
+                    missing = jit_resolvable_visit(jit, &seen, &stack, g->objects[k].reloc);
+                }
+            }
+        }
+    }
+
+    dyn_array_destroy(stack);
+    nl_hashset_free(seen);
+
+    if (missing != NULL) {
+        log_debug("jit: undefined symbol %s", missing);
+        jit->undefined = missing;
+        return false;
+    }
+    return true;
+}
+
+static void* jit_place_function(TB_JIT* jit, TB_Function* f);
+static void* jit_place_global(TB_JIT* jit, TB_Global* g);
+static void* jit_lazy_stub(TB_JIT* jit, TB_Function* f);
+static void* jit_tier_baseline(TB_JIT* jit, TB_Function* f);
+
+// functions which get referenced before they're placed either get placed now or
+// (when lazy) they get a stub which does that on the first call.
+static void* jit_function_address(TB_JIT* jit, TB_Function* f) {
+    if (jit->tiered) {
+        // the stub is what gets retargeted when the code changes tiers
+        return jit_lazy_stub(jit, f);
+    } else if (f->compiled_pos != NULL) {
+        return f->compiled_pos;
+    }
+
+    return jit->lazy ? jit_lazy_stub(jit, f) : jit_place_function(jit, f);
+}
+
+static void* get_symbol_address(TB_JIT* jit, const TB_Symbol* s) {
+    if (s->tag == TB_SYMBOL_GLOBAL) {
+        return jit_place_global(jit, (TB_Global*) s);
+    } else if (s->tag == TB_SYMBOL_FUNCTION) {
+        return jit_function_address(jit, (TB_Function*) s);
+    } else if (s->tag == TB_SYMBOL_EXTERNAL) {
+        return jit_external_address(jit, (TB_External*) s);
+    } else {
+        tb_todo();
+    }
+}
+
+static void jit_flush_icache(void* ptr, size_t size) {
+    #if defined(_WIN32)
+    FlushInstructionCache(GetCurrentProcess(), ptr, size);
+    #elif defined(__GNUC__) || defined(__clang__)
+    // on x86 this is nothing, on ARM it's the DC CVAU + IC IVAU dance
+    __builtin___clear_cache((char*) ptr, (char*) ptr + size);
+    #endif
+}
+
+// far calls go through a thunk which holds the full address, returns
+// the thunk's executable address. there's one per target.
+static void* jit_far_thunk(TB_JIT* jit, void* addr) {
+    mtx_lock(&jit->sym_lock);
+    ptrdiff_t search = nl_map_get(jit->far_thunks, addr);
+    if (search >= 0) {
+        char* pc = jit->far_thunks[search].v;
+        mtx_unlock(&jit->sym_lock);
+        return pc;
+    }
+
+    char* thunk = tb_jit_alloc_obj(jit, 8 + sizeof(void*), 16);
+    if (jit->arch == TB_ARCH_AARCH64) {
+        static const uint32_t insts[2] = {
+            0x58000050, // ldr x16, #8
+            0xD61F0200, // br x16
+        };
+        memcpy(thunk, insts, sizeof(insts));
+        memcpy(thunk + 8, &addr, sizeof(void*));
+    } else {
+        thunk[0] = 0xFF; // jmp qword [rip]
+        thunk[1] = 0x25;
+        thunk[2] = 0x00;
+        thunk[3] = 0x00;
+        thunk[4] = 0x00;
+        thunk[5] = 0x00;
+
+        // write final address into the thunk
+        memcpy(thunk + 6, &addr, sizeof(void*));
+    }
+
+    char* pc = thunk + jit->exec_delta;
+    jit_flush_icache(pc, 8 + sizeof(void*));
+    nl_map_put(jit->far_thunks, addr, pc);
+    mtx_unlock(&jit->sym_lock);
+    return pc;
+}
+
+static void x64_apply_patch(TB_JIT* jit, char* dst, char* pc, TB_Symbol* target, void* addr) {
+    // x64 relocations are rel32 relative to the end of the field, the field
+    // already holds the addend.
+    int32_t addend;
+    memcpy(&addend, dst, sizeof(int32_t));
+
+    ptrdiff_t rel = (intptr_t)addr + addend - ((intptr_t)pc + 4);
+    int32_t rel32 = rel;
+    if (rel != rel32) {
+        // only host symbols can be out of range, the JIT heap is reserved in one piece
+        uint8_t op = dst[-1];
+        char* thunk = jit_far_thunk(jit, addr);
+        if (op == 0xE8 || op == 0xE9) {
+            // CALL/JMP rel32 just go through the thunk
+            rel = (intptr_t)thunk + addend - ((intptr_t)pc + 4);
+        } else if ((uint8_t) dst[-2] == 0x8D && (op & 0xC7) == 0x05 && addend == 0) {
+            // LEA r, [rip+disp32] => MOV r, [rip+disp32] on the thunk's copy of the address
+            dst[-2] = 0x8B;
+            rel = (intptr_t)thunk + 6 - ((intptr_t)pc + 4);
+        } else {
+            tb_panic("JIT: %s (%p) is out of rel32 range", target->name, addr);
+        }
+
+        rel32 = rel;
+    }
+
+    memcpy(dst, &rel32, sizeof(int32_t));
+}
+
+// ADRP reaches +-4GiB of its own page, a target counts as far if some part of
+// the heap can't reach it. that way both halves of an ADRP+ADD pair agree on it.
+static bool a64_is_far(TB_JIT* jit, void* addr) {
+    char* start = jit->base + jit->exec_delta;
+    intptr_t lo = (uintptr_t)start >> 12;
+    intptr_t hi = (uintptr_t)(start + jit->reserved - 1) >> 12;
+    intptr_t page = (uintptr_t)addr >> 12;
+    return page - hi < -(1ll << 20) || page - lo >= (1ll << 20);
+}
+
+static void a64_apply_patch(TB_JIT* jit, char* dst, char* pc, TB_Symbol* target, void* addr) {
+    uint32_t inst;
+    memcpy(&inst, dst, sizeof(uint32_t));
+
+    if ((inst & 0x7C000000) == 0x14000000) {
+        // B/BL: imm26 words, that's +-128MiB which the JIT heap fits in but most
+        // host functions don't, those go through a veneer.
+        ptrdiff_t rel = (intptr_t)addr - (intptr_t)pc;
+        if (rel < -(1ll << 27) || rel >= (1ll << 27)) {
+            addr = jit_far_thunk(jit, addr);
+            rel = (intptr_t)addr - (intptr_t)pc;
+        }
+        inst = (inst & 0xFC000000) | ((rel >> 2) & 0x3FFFFFF);
+    } else if ((inst & 0x9F000000) == 0x90000000) {
+        // ADRP: imm21 pages, +-4GiB. far externals point at the page of the
+        // literal in their thunk instead, the ADD turns into a load from it.
+        if (target->tag == TB_SYMBOL_EXTERNAL && a64_is_far(jit, addr)) {
+            addr = (char*) jit_far_thunk(jit, addr) + 8;
+        }
+
+        ptrdiff_t pages = (intptr_t)((uintptr_t)addr >> 12) - (intptr_t)((uintptr_t)pc >> 12);
+        if (pages < -(1ll << 20) || pages >= (1ll << 20)) {
+            tb_panic("JIT: %s is out of ADRP range", target->name);
+        }
+        inst = (inst & 0x9F00001F) | ((pages & 3) << 29) | (((pages >> 2) & 0x7FFFF) << 5);
+    } else if ((inst & 0x7F800000) == 0x11000000) {
+        // ADD (immediate) :lo12:
+        if (target->tag == TB_SYMBOL_EXTERNAL && a64_is_far(jit, addr)) {
+            // same thunk the ADRP picked, LDR xd, [xn, :lo12:literal] gets the real
+            // address so it works for data too. the literal is 8 byte aligned.
+            if ((inst >> 31) == 0) {
+                tb_panic("JIT: %s is out of ADRP range", target->name);
+            }
+
+            uintptr_t lit = (uintptr_t) jit_far_thunk(jit, addr) + 8;
+            inst = 0xF9400000 | (((lit & 0xFFF) >> 3) << 10) | (inst & 0x3FF);
+        } else {
+            inst = (inst & ~(0xFFFu << 10)) | (((uintptr_t)addr & 0xFFF) << 10);
+        }
+    } else {
+        tb_todo();
+    }
+
+    memcpy(dst, &inst, sizeof(uint32_t));
+}
+
+static void jit_debug_place(TB_JIT* jit, TB_Function* f, char* code);
+static void jit_debug_unplace(TB_JIT* jit, void* code);
+static void jit_debug_end(TB_JIT* jit);
+
+// gc_lock must be held
+static JITRefs* jit_refs(TB_JIT* jit, TB_Function* f) {
+    ptrdiff_t search = nl_map_get(jit->refs, f);
+    if (search >= 0) {
+        return jit->refs[search].v;
+    }
+
+    JITRefs* refs = tb_platform_heap_alloc(sizeof(JITRefs));
+    *refs = (JITRefs){ 0 };
+    nl_map_put(jit->refs, f, refs);
+    return refs;
+}
+
+// remembers a direct reference from caller's code to callee so it can be pointed
+// back at a stub if the callee gets unplaced.
+static void jit_track_site(TB_JIT* jit, TB_Function* caller, TB_Function* callee, char* pc, intptr_t addend) {
+    mtx_lock(&jit->gc_lock);
+    JITSite site = { caller, pc, addend };
+    dyn_array_put(jit_refs(jit, callee)->sites, site);
+
+    if (caller != NULL && caller != callee) {
+        JITRefs* refs = jit_refs(jit, caller);
+        size_t n = dyn_array_length(refs->callees);
+        if (n == 0 || refs->callees[n - 1] != callee) {
+            dyn_array_put(refs->callees, callee);
+        }
+    }
+    mtx_unlock(&jit->gc_lock);
+}
+
+static void* jit_place_function(TB_JIT* jit, TB_Function* f) {
+    TB_FunctionOutput* func_out = f->output;
+    if (f->compiled_pos != NULL) {
+        return f->compiled_pos;
+    }
+
+    // copy machine code, we write into dst but anything relative
+    // is computed against the executable view.
+    size_t align = f->super.module->layout.func_align;
+    char* dst = jit_alloc_code(jit, func_out->code_size, align > 16 ? align : 16);
+    if (dst == NULL) {
+        tb_panic("JIT: out of code heap (%zu KiB reserved)", jit->reserved / 1024);
+    }
+    memcpy(dst, func_out->code, func_out->code_size);
+
+    char* code = dst + jit->exec_delta;
+    f->compiled_pos = code;
+
+    log_debug("jit: apply function %s (%p)", f->super.name, code);
+
+    // apply relocations, any leftovers are mapped to thunks
+    for (TB_SymbolPatch* p = func_out->first_patch; p; p = p->next) {
+        TB_SymbolTag tag = p->target->tag;
+
+        void* addr;
+        if (tag == TB_SYMBOL_FUNCTION) {
+            addr = jit_function_address(jit, (TB_Function*) p->target);
+        } else if (tag == TB_SYMBOL_EXTERNAL) {
+            addr = jit_external_address(jit, (TB_External*) p->target);
+        } else if (tag == TB_SYMBOL_GLOBAL) {
+            addr = jit_place_global(jit, (TB_Global*) p->target);
+        } else {
+            tb_todo();
+        }
+
+        int32_t addend = 0;
+        if (jit->arch == TB_ARCH_AARCH64) {
+            a64_apply_patch(jit, &dst[p->pos], &code[p->pos], p->target, addr);
+        } else {
+            memcpy(&addend, &dst[p->pos], sizeof(int32_t));
+            x64_apply_patch(jit, &dst[p->pos], &code[p->pos], p->target, addr);
+        }
+
+        // stubs stay put, the code behind them might not
+        if (tag == TB_SYMBOL_FUNCTION && addr == ((TB_Function*) p->target)->compiled_pos) {
+            jit_track_site(jit, f, (TB_Function*) p->target, &code[p->pos], addend);
+        }
+    }
+
+    atomic_fetch_add_explicit(&jit->placed_count, 1, memory_order_relaxed);
+    jit_flush_icache(code, func_out->code_size);
+    if (jit->debug_flags) {
+        jit_debug_place(jit, f, code);
+    }
+    return code;
+}
+
+static void* jit_place_global(TB_JIT* jit, TB_Global* g) {
+    if (g->address != NULL) {
+        return g->address;
+    }
+
+    char* data = tb_jit_alloc_obj(jit, g->size, g->align);
+    g->address = data;
+
+    log_debug("jit: apply global %s (%p)", g->super.name ? g->super.name : "<unnamed>", data);
+
+    memset(data, 0, g->size);
+    FOR_N(k, 0, g->obj_count) {
+        if (g->objects[k].type == TB_INIT_OBJ_REGION) {
+            memcpy(&data[g->objects[k].offset], g->objects[k].region.ptr, g->objects[k].region.size);
+        }
+    }
+
+    FOR_N(k, 0, g->obj_count) {
+        if (g->objects[k].type == TB_INIT_OBJ_RELOC) {
+            TB_Symbol* s = g->objects[k].reloc;
+            uintptr_t addr = (uintptr_t) get_symbol_address(jit, s);
+
+            // function pointers are tracked like calls, unplacing sends them to the stub
+            uintptr_t* dst = (uintptr_t*) &data[g->objects[k].offset];
+            if (s->tag == TB_SYMBOL_FUNCTION && (void*) addr == ((TB_Function*) s)->compiled_pos) {
+                jit_track_site(jit, NULL, (TB_Function*) s, (char*) dst, *dst);
+            }
+            *dst += addr;
+        }
+    }
+
+    return data;
+}
+
+////////////////////////////////
+// Lazy binding
+////////////////////////////////
+// a stub looks like a function until the first call goes through it:
+//
+//   x64:   jmp [slot]       ARM64: ldr x16, slot; br x16
+//          mov r11, stub           adr x17, stub
+//          jmp lazy_thunk          b lazy_thunk
+//
+// the slot starts out pointing at the second half, the thunk saves the argument
+// registers and has the stub resolved. once it's compiled the slot points at the
+// real code and later callers only pay for the indirect jump, anyone placed after
+// that calls it directly.
+enum {
+    LAZY_STUB_SLOT = 24,
+    LAZY_STUB_FUNC = 32,
+    LAZY_STUB_JIT  = 40,
+    LAZY_STUB_SIZE = 48,
+};
+
+static void jit_lazy_retarget(TB_JIT* jit, TB_Function* f, void* code) {
+    ptrdiff_t search = nl_map_get(jit->lazy_stubs, f);
+    if (search >= 0) {
+        // slots are only ever read as data, there's no need to flush anything
+        char* stub = jit->lazy_stubs[search].v - jit->exec_delta;
+        atomic_store_explicit((_Atomic(void*)*) &stub[LAZY_STUB_SLOT], code, memory_order_release);
+    }
+}
+
+// points the stub back at its resolving half
+static void jit_lazy_reset(TB_JIT* jit, TB_Function* f) {
+    ptrdiff_t search = nl_map_get(jit->lazy_stubs, f);
+    if (search >= 0) {
+        char* pc = jit->lazy_stubs[search].v;
+        jit_lazy_retarget(jit, f, pc + (jit->arch == TB_ARCH_AARCH64 ? 8 : 6));
+    }
+}
+
+// compiles the function if it hasn't been yet, places it and points its stub at it.
+static void* jit_lazy_place(TB_JIT* jit, TB_Function* f) {
+    if (f->compiled_pos != NULL) {
+        // eager placements don't know about the stub (it's from before an unplace)
+        jit_lazy_retarget(jit, f, f->compiled_pos);
+        return f->compiled_pos;
+    }
+
+    if (f->output == NULL) {
+        if (jit->lazy_ws == NULL) {
+            tb_panic("JIT: %s was unplaced but it's not compiled anymore (and lazy compiles aren't on)", f->super.name);
+        }
+
+        log_debug("jit: lazy compile %s", f->super.name);
+
+        if (jit->lazy_opt) {
+            tb_opt(f, jit->lazy_ws, false);
+        }
+        tb_codegen(f, jit->lazy_ws, jit->lazy_code_arena, jit->lazy_has_features ? &jit->lazy_features : NULL, false);
+    }
+
+    if (!jit_resolvable(jit, &f->super)) {
+        return NULL;
+    }
+
+    void* code = jit_place_function(jit, f);
+    jit_lazy_retarget(jit, f, code);
+    return code;
+}
+
+// called by the thunk with the stub's executable address, returns where to go.
+static void* jit_lazy_resolve(char* stub) {
+    TB_Function* f;
+    TB_JIT* jit;
+    memcpy(&f, &stub[LAZY_STUB_FUNC], sizeof(f));
+    memcpy(&jit, &stub[LAZY_STUB_JIT], sizeof(jit));
+
+    mtx_lock(&jit->lazy_lock);
+    void* code = jit->tiered ? jit_tier_baseline(jit, f) : jit_lazy_place(jit, f);
+    mtx_unlock(&jit->lazy_lock);
+
+    if (code == NULL) {
+        // nobody's around to take the error, it's mid-call
+        tb_panic("JIT: %s calls undefined symbol '%s'", f->super.name, jit->undefined);
+    }
+    return code;
+}
+
+static void* jit_lazy_thunk(TB_JIT* jit);
+
+static void* jit_lazy_stub(TB_JIT* jit, TB_Function* f) {
+    ptrdiff_t search = nl_map_get(jit->lazy_stubs, f);
+    if (search >= 0) {
+        return jit->lazy_stubs[search].v;
+    }
+
+    // unplacing in an eager JIT still needs somewhere to send the callers
+    if (jit->lazy_thunk == NULL) {
+        jit->lazy_thunk = jit_lazy_thunk(jit);
+    }
+
+    char* stub = tb_jit_alloc_obj(jit, LAZY_STUB_SIZE, 16);
+    char* pc = stub + jit->exec_delta;
+    memset(stub, 0, LAZY_STUB_SIZE);
+
+    char* slot;
+    if (jit->arch == TB_ARCH_AARCH64) {
+        int32_t rel = ((char*) jit->lazy_thunk - (pc + 12)) >> 2;
+        uint32_t insts[4] = {
+            0x58000010 | ((LAZY_STUB_SLOT / 4) << 5), // ldr x16, slot
+            0xD61F0200,                               // br x16
+            0x10FFFFD1,                               // adr x17, #-8
+            0x14000000 | (rel & 0x3FFFFFF),           // b lazy_thunk
+        };
+        memcpy(stub, insts, sizeof(insts));
+        slot = pc + 8;
+    } else {
+        int32_t rel32 = LAZY_STUB_SLOT - 6;
+        stub[0] = 0xFF; // jmp qword [rip + slot]
+        stub[1] = 0x25;
+        memcpy(&stub[2], &rel32, sizeof(rel32));
+
+        stub[6] = 0x49; // mov r11, stub
+        stub[7] = 0xBB;
+        memcpy(&stub[8], &pc, sizeof(pc));
+
+        rel32 = (char*) jit->lazy_thunk - (pc + 21);
+        stub[16] = 0xE9; // jmp lazy_thunk
+        memcpy(&stub[17], &rel32, sizeof(rel32));
+        slot = pc + 6;
+    }
+
+    memcpy(&stub[LAZY_STUB_SLOT], &slot, sizeof(slot));
+    memcpy(&stub[LAZY_STUB_FUNC], &f, sizeof(f));
+    memcpy(&stub[LAZY_STUB_JIT], &jit, sizeof(jit));
+    jit_flush_icache(pc, LAZY_STUB_SIZE);
+
+    nl_map_put(jit->lazy_stubs, f, pc);
+    return pc;
+}
+
+// shared by every stub: the argument registers (and the x64 SysV vararg count in
+// rax) are all kept across the call into jit_lazy_resolve, it works for both SysV
+// and Win64 since the stub is passed in both first argument registers.
+static void* jit_lazy_thunk(TB_JIT* jit) {
+    void* resolve = (void*) jit_lazy_resolve;
+    char* thunk;
+    size_t size;
+
+    if (jit->arch == TB_ARCH_AARCH64) {
+        static const uint32_t insts[26] = {
+            0xA9BF7BFD, // stp x29, x30, [sp, #-16]!
+            0x910003FD, // mov x29, sp
+            0xA9BF07E0, // stp x0, x1, [sp, #-16]!
+            0xA9BF0FE2, // stp x2, x3, [sp, #-16]!
+            0xA9BF17E4, // stp x4, x5, [sp, #-16]!
+            0xA9BF1FE6, // stp x6, x7, [sp, #-16]!
+            0xA9BF7FE8, // stp x8, xzr, [sp, #-16]!
+            0xADBF07E0, // stp q0, q1, [sp, #-32]!
+            0xADBF0FE2, // stp q2, q3, [sp, #-32]!
+            0xADBF17E4, // stp q4, q5, [sp, #-32]!
+            0xADBF1FE6, // stp q6, q7, [sp, #-32]!
+            0xAA1103E0, // mov x0, x17
+            0x580001D0, // ldr x16, resolve
+            0xD63F0200, // blr x16
+            0xAA0003F0, // mov x16, x0
+            0xACC11FE6, // ldp q6, q7, [sp], #32
+            0xACC117E4, // ldp q4, q5, [sp], #32
+            0xACC10FE2, // ldp q2, q3, [sp], #32
+            0xACC107E0, // ldp q0, q1, [sp], #32
+            0xA8C17FE8, // ldp x8, xzr, [sp], #16
+            0xA8C11FE6, // ldp x6, x7, [sp], #16
+            0xA8C117E4, // ldp x4, x5, [sp], #16
+            0xA8C10FE2, // ldp x2, x3, [sp], #16
+            0xA8C107E0, // ldp x0, x1, [sp], #16
+            0xA8C17BFD, // ldp x29, x30, [sp], #16
+            0xD61F0200, // br x16
+        };
+
+        size = sizeof(insts) + sizeof(void*);
+        thunk = tb_jit_alloc_obj(jit, size, 16);
+        memcpy(thunk, insts, sizeof(insts));
+        memcpy(thunk + sizeof(insts), &resolve, sizeof(void*));
+    } else {
+        thunk = tb_jit_alloc_obj(jit, 192, 16);
+
+        // 7 pushes and the frame pointer keep things aligned with 168 bytes of locals,
+        // 32 for the Win64 shadow space then the XMM arguments.
+        static const uint8_t prologue[] = {
+            0x55,                                     // push rbp
+            0x48, 0x89, 0xE5,                         // mov rbp, rsp
+            0x50, 0x57, 0x56, 0x52, 0x51,             // push rax, rdi, rsi, rdx, rcx
+            0x41, 0x50, 0x41, 0x51,                   // push r8, r9
+            0x48, 0x81, 0xEC, 0xA8, 0x00, 0x00, 0x00, // sub rsp, 168
+        };
+        static const uint8_t epilogue[] = {
+            0x48, 0x81, 0xC4, 0xA8, 0x00, 0x00, 0x00, // add rsp, 168
+            0x41, 0x59, 0x41, 0x58,                   // pop r9, r8
+            0x59, 0x5A, 0x5E, 0x5F, 0x58,             // pop rcx, rdx, rsi, rdi, rax
+            0x5D,                                     // pop rbp
+            0x41, 0xFF, 0xE3,                         // jmp r11
+        };
+
+        size = 0;
+        memcpy(&thunk[size], prologue, sizeof(prologue)), size += sizeof(prologue);
+        FOR_N(i, 0, 8) {
+            // movups [rsp + 32 + i*16], xmmi
+            int32_t disp = 32 + i*16;
+            uint8_t inst[8] = { 0x0F, 0x11, 0x84 | (i << 3), 0x24 };
+            memcpy(&inst[4], &disp, sizeof(disp));
+            memcpy(&thunk[size], inst, sizeof(inst)), size += sizeof(inst);
+        }
+
+        static const uint8_t call[] = {
+            0x4C, 0x89, 0xDF, // mov rdi, r11
+            0x4C, 0x89, 0xD9, // mov rcx, r11
+            0x48, 0xB8,       // mov rax, jit_lazy_resolve
+        };
+        memcpy(&thunk[size], call, sizeof(call)), size += sizeof(call);
+        memcpy(&thunk[size], &resolve, sizeof(resolve)), size += sizeof(resolve);
+
+        static const uint8_t ret[] = {
+            0xFF, 0xD0,       // call rax
+            0x49, 0x89, 0xC3, // mov r11, rax
+        };
+        memcpy(&thunk[size], ret, sizeof(ret)), size += sizeof(ret);
+
+        FOR_N(i, 0, 8) {
+            // movups xmmi, [rsp + 32 + i*16]
+            int32_t disp = 32 + i*16;
+            uint8_t inst[8] = { 0x0F, 0x10, 0x84 | (i << 3), 0x24 };
+            memcpy(&inst[4], &disp, sizeof(disp));
+            memcpy(&thunk[size], inst, sizeof(inst)), size += sizeof(inst);
+        }
+        memcpy(&thunk[size], epilogue, sizeof(epilogue)), size += sizeof(epilogue);
+        assert(size <= 192);
+    }
+
+    char* pc = thunk + jit->exec_delta;
+    jit_flush_icache(pc, size);
+    return pc;
+}
+
+void tb_jit_enable_lazy(TB_JIT* jit, TB_Arena* code_arena, const TB_FeatureSet* features, bool optimize) {
+    if (jit->lazy) {
+        return;
+    }
+
+    jit->lazy_ws = tb_worklist_alloc();
+    jit->lazy_code_arena = code_arena;
+    jit->lazy_opt = optimize;
+    if (features != NULL) {
+        jit->lazy_features = *features;
+        jit->lazy_has_features = true;
+    }
+
+    if (jit->lazy_thunk == NULL) {
+        jit->lazy_thunk = jit_lazy_thunk(jit);
+    }
+    jit->lazy = true;
+}
+
+void* tb_jit_place_function(TB_JIT* jit, TB_Function* f) {
+    if (!jit->lazy) {
+        if (f->compiled_pos == NULL && !jit_resolvable(jit, &f->super)) {
+            return NULL;
+        }
+        return jit_place_function(jit, f);
+    }
+
+    mtx_lock(&jit->lazy_lock);
+    void* code = jit->tiered ? jit_lazy_stub(jit, f) : jit_lazy_place(jit, f);
+    mtx_unlock(&jit->lazy_lock);
+    return code;
+}
+
+void* tb_jit_place_global(TB_JIT* jit, TB_Global* g) {
+    if (!jit->lazy) {
+        if (g->address == NULL && !jit_resolvable(jit, &g->super)) {
+            return NULL;
+        }
+        return jit_place_global(jit, g);
+    }
+
+    mtx_lock(&jit->lazy_lock);
+    void* data = g->address != NULL || jit_resolvable(jit, &g->super) ? jit_place_global(jit, g) : NULL;
+    mtx_unlock(&jit->lazy_lock);
+    return data;
+}
+
+const char* tb_jit_get_undefined(TB_JIT* jit) {
+    return jit->undefined;
+}
+
+////////////////////////////////
+// Tiering
+////////////////////////////////
+// first call in tiered mode: a copy of the IR gets the baseline compile, the original
+// stays as it was for the optimizing tier.
+static void* jit_tier_baseline(TB_JIT* jit, TB_Function* f) {
+    // unplaced functions keep a NULL entry
+    ptrdiff_t search = nl_map_get(jit->tier_map, f);
+    if (search >= 0 && jit->tier_map[search].v != NULL) {
+        // someone else beat us through the stub
+        return jit->tier_map[search].v->code;
+    }
+
+    if (f->output != NULL && !jit_resolvable(jit, &f->super)) {
+        return NULL;
+    }
+
+    JITTier* t = tb_platform_heap_alloc(sizeof(JITTier));
+    *t = (JITTier){ .f = f };
+
+    if (f->output != NULL) {
+        // compiled before we got it, there's no IR left to tier up
+        t->code = jit_place_function(jit, f);
+        t->tier = TB_JIT_TIER_OPTIMIZED;
+    } else {
+        log_debug("jit: baseline compile %s", f->super.name);
+
+        t->counter = tb_jit_alloc_obj(jit, sizeof(uint32_t), sizeof(uint32_t));
+        *t->counter = 0;
+        t->counter_sym = (TB_Global){
+            .super   = { .tag = TB_SYMBOL_GLOBAL, .name = f->super.name, .module = f->super.module },
+            .address = t->counter,
+            .size    = sizeof(uint32_t),
+            .align   = sizeof(uint32_t),
+        };
+
+        TB_FeatureSet features = jit->lazy_features;
+        features.gen |= TB_FEATURE_BASELINE;
+
+        TB_Function* k = tb__clone_function(f, jit->lazy_ws, jit->tier_arenas[0], jit->tier_arenas[1]);
+        k->counter = &t->counter_sym.super;
+        tb_codegen(k, jit->lazy_ws, jit->tier_arenas[0], &features, false);
+        if (jit_resolvable(jit, &k->super)) {
+            t->code = jit_place_function(jit, k);
+            t->tier = TB_JIT_TIER_BASELINE;
+        }
+
+        tb__free_clone(k);
+        tb_arena_clear(jit->tier_arenas[0]);
+        tb_arena_clear(jit->tier_arenas[1]);
+
+        if (t->code == NULL) {
+            tb_jit_free_obj(jit, t->counter);
+            tb_platform_heap_free(t);
+            return NULL;
+        }
+    }
+
+    dyn_array_put(jit->tiers, t);
+    nl_map_put(jit->tier_map, f, t);
+    jit_lazy_retarget(jit, f, t->code);
+    return t->code;
+}
+
+static void jit_tier_nap(void) {
+    #ifdef _WIN32
+    Sleep(1);
+    #else
+    usleep(1000);
+    #endif
+}
+
+// the counters are bumped without atomics, losing a few increments to
+// races doesn't matter for this.
+static int jit_tier_main(void* arg) {
+    TB_JIT* jit = arg;
+    TB_Module* m = NULL;
+    while (!atomic_load_explicit(&jit->tier_quit, memory_order_relaxed)) {
+        JITTier* hot = NULL;
+        mtx_lock(&jit->lazy_lock);
+        dyn_array_for(i, jit->tiers) {
+            JITTier* t = jit->tiers[i];
+            if (t->tier == TB_JIT_TIER_BASELINE && *(volatile uint32_t*) t->counter >= jit->hot_threshold) {
+                hot = t;
+                hot->compiling = true;
+                break;
+            }
+        }
+        mtx_unlock(&jit->lazy_lock);
+
+        if (hot == NULL) {
+            jit_tier_nap();
+            continue;
+        }
+
+        // nobody else touches the original IR once the baseline is done (unplacing
+        // waits for us) so the slow part doesn't need the lock.
+        TB_Function* f = hot->f;
+        m = f->super.module;
+        log_debug("jit: tier up %s (%u)", f->super.name, *hot->counter);
+
+        tb_opt(f, jit->tier_ws, false);
+        tb_codegen(f, jit->tier_ws, jit->lazy_code_arena, &jit->lazy_features, false);
+
+        mtx_lock(&jit->lazy_lock);
+        hot->baseline = hot->code;
+        hot->code = jit_place_function(jit, f);
+        hot->tier = TB_JIT_TIER_OPTIMIZED;
+        hot->compiling = false;
+        jit_lazy_retarget(jit, f, hot->code);
+        mtx_unlock(&jit->lazy_lock);
+    }
+
+    // the compiles gave us thread info in the module, this thread
+    // won't be around when it's destroyed.
+    if (m != NULL) {
+        tb__thread_info_detach(m);
+    }
+    return 0;
+}
+
+void tb_jit_enable_tiering(TB_JIT* jit, TB_Arena* code_arena, const TB_FeatureSet* features, uint32_t hot_threshold) {
+    TB_ASSERT_MSG(!jit->tiered, "JIT: tiering is already on");
+    if (jit->lazy) {
+        // take over the existing lazy setup (its stubs & thunk stay), whatever it
+        // already compiled stays as it is and the rest goes through the baseline.
+        mtx_lock(&jit->lazy_lock);
+        jit->lazy_code_arena = code_arena;
+        jit->lazy_opt = true;
+        if (features != NULL) {
+            jit->lazy_features = *features;
+            jit->lazy_has_features = true;
+        }
+        mtx_unlock(&jit->lazy_lock);
+    } else {
+        tb_jit_enable_lazy(jit, code_arena, features, true);
+    }
+
+    jit->hot_threshold = hot_threshold;
+    jit->tier_ws = tb_worklist_alloc();
+    jit->tier_arenas[0] = tb_arena_create(0);
+    jit->tier_arenas[1] = tb_arena_create(0);
+    jit->tiered = true;
+
+    if (thrd_create(&jit->tier_thread, jit_tier_main, jit) != thrd_success) {
+        tb_panic("JIT: couldn't start the tiering thread");
+    }
+}
+
+TB_JITTier tb_jit_get_tier(TB_JIT* jit, TB_Function* f) {
+    if (!jit->tiered) {
+        return TB_JIT_TIER_NONE;
+    }
+
+    mtx_lock(&jit->lazy_lock);
+    ptrdiff_t search = nl_map_get(jit->tier_map, f);
+    TB_JITTier tier = search >= 0 && jit->tier_map[search].v ? jit->tier_map[search].v->tier : TB_JIT_TIER_NONE;
+    mtx_unlock(&jit->lazy_lock);
+    return tier;
+}
+
+////////////////////////////////
+// Unplacing
+////////////////////////////////
+// rewrites a tracked site to refer to addr instead, gc_lock must be held.
+static void jit_repatch_site(TB_JIT* jit, JITSite* site, TB_Function* callee, void* addr) {
+    if (site->caller == NULL) {
+        atomic_store_explicit((_Atomic(uintptr_t)*) site->pc, (uintptr_t)addr + site->addend, memory_order_relaxed);
+        return;
+    }
+
+    char* dst = site->pc - jit->exec_delta;
+    if (jit->arch == TB_ARCH_AARCH64) {
+        // BL is a single store, an ADRP & ADD pair isn't but nothing should be
+        // halfway through it when the function's being unplaced.
+        a64_apply_patch(jit, dst, site->pc, &callee->super, addr);
+    } else {
+        int32_t rel32 = (intptr_t)addr + site->addend - ((intptr_t)site->pc + 4);
+        atomic_store_explicit((_Atomic(int32_t)*) dst, rel32, memory_order_relaxed);
+    }
+    jit_flush_icache(site->pc, 4);
+}
+
+void tb_jit_unplace_function(TB_JIT* jit, TB_Function* f) {
+    mtx_lock(&jit->lazy_lock);
+
+    // everything which goes with the placed code
+    void* code[3] = { f->compiled_pos };
+    if (jit->tiered) {
+        ptrdiff_t search = nl_map_get(jit->tier_map, f);
+        JITTier* t = search >= 0 ? jit->tier_map[search].v : NULL;
+
+        // a tier up in flight is left to finish, then we unplace what it placed
+        while (t != NULL && t->compiling) {
+            mtx_unlock(&jit->lazy_lock);
+            jit_tier_nap();
+            mtx_lock(&jit->lazy_lock);
+
+            search = nl_map_get(jit->tier_map, f);
+            t = search >= 0 ? jit->tier_map[search].v : NULL;
+            code[0] = f->compiled_pos;
+        }
+
+        if (t != NULL) {
+            code[0] = t->code, code[1] = t->baseline, code[2] = t->counter;
+            jit->tier_map[search].v = NULL;
+
+            dyn_array_for(i, jit->tiers) {
+                if (jit->tiers[i] == t) {
+                    dyn_array_remove(jit->tiers, i);
+                    break;
+                }
+            }
+            tb_platform_heap_free(t);
+        }
+    }
+
+    if (code[0] == NULL) {
+        mtx_unlock(&jit->lazy_lock);
+        return;
+    }
+
+    log_debug("jit: unplace function %s (%p)", f->super.name, code[0]);
+
+    // new calls go through the stub which places it again
+    f->compiled_pos = NULL;
+    jit_lazy_reset(jit, f);
+
+    // the debugger has to forget about it before the memory can be reused
+    atomic_fetch_sub_explicit(&jit->placed_count, code[1] ? 2 : 1, memory_order_relaxed);
+    if (jit->debug_flags) {
+        FOR_N(i, 0, 2) {
+            if (code[i] != NULL) {
+                jit_debug_unplace(jit, code[i]);
+            }
+        }
+    }
+
+    mtx_lock(&jit->gc_lock);
+    ptrdiff_t search = nl_map_get(jit->refs, f);
+    if (search >= 0) {
+        JITRefs* refs = jit->refs[search].v;
+
+        // anyone calling it directly is sent to the stub (recursive calls go
+        // away with the code)
+        if (dyn_array_length(refs->sites) > 0) {
+            void* stub = jit_lazy_stub(jit, f);
+            dyn_array_for(i, refs->sites) {
+                if (refs->sites[i].caller != f) {
+                    jit_repatch_site(jit, &refs->sites[i], f, stub);
+                }
+            }
+        }
+        dyn_array_clear(refs->sites);
+
+        // our own calls aren't sites anymore
+        dyn_array_for(i, refs->callees) {
+            ptrdiff_t other = nl_map_get(jit->refs, refs->callees[i]);
+            if (other >= 0) {
+                JITRefs* callee = jit->refs[other].v;
+                for (size_t j = 0; j < dyn_array_length(callee->sites);) {
+                    if (callee->sites[j].caller == f) {
+                        dyn_array_remove(callee->sites, j);
+                    } else {
+                        j++;
+                    }
+                }
+            }
+        }
+        dyn_array_clear(refs->callees);
+    }
+
+    FOR_N(i, 0, 3) {
+        jit_gc_retire(jit, code[i]);
+    }
+    jit_gc_poll(jit);
+    mtx_unlock(&jit->gc_lock);
+    mtx_unlock(&jit->lazy_lock);
+}
+
+// reserves both views as one range (RW then RX), it keeps them close enough for
+// ADRP & BL. the segments get mapped into it by jit_grow.
+static bool jit_reserve_dual(TB_JIT* jit) {
+    #ifdef TB_HOST_LINUX
+    int fd = syscall(SYS_memfd_create, "tb_jit", 1u /* MFD_CLOEXEC */);
+    if (fd < 0) {
+        return false;
+    }
+
+    char* base = mmap(NULL, jit->reserved * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+
+    jit->base = base;
+    jit->memfd = fd;
+    jit->exec_delta = jit->reserved;
+    return true;
+    #else
+    return false;
+    #endif
+}
 
-    log_debug("jit: apply function %s (%p)", f->super.name, dst);
+static bool jit_reserve(TB_JIT* jit) {
+    #if defined(_WIN32)
+    jit->base = VirtualAlloc(NULL, jit->reserved, MEM_RESERVE, PAGE_NOACCESS);
+    #else
+    jit->base = mmap(NULL, jit->reserved, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (jit->base == MAP_FAILED) {
+        jit->base = NULL;
+    }
+    #endif
+    return jit->base != NULL;
+}
 
-    // apply relocations, any leftovers are mapped to thunks
-    for (TB_SymbolPatch* p = func_out->first_patch; p; p = p->next) {
-        size_t actual_pos = p->pos;
-        TB_SymbolTag tag = p->target->tag;
+static void jit_unmap(TB_JIT* jit) {
+    tb_platform_vfree(jit->base, jit->exec_delta ? jit->reserved * 2 : jit->reserved);
+    #ifdef TB_HOST_LINUX
+    if (jit->memfd >= 0) {
+        close(jit->memfd);
+    }
+    #endif
 
-        int32_t* patch = (int32_t*) &dst[actual_pos];
-        if (tag == TB_SYMBOL_FUNCTION) {
-            TB_Function* f = (TB_Function*) p->target;
-            void* addr = tb_jit_place_function(jit, f);
+    jit->base = NULL;
+    jit->memfd = -1;
+    jit->exec_delta = 0;
+    jit->committed_chunks = 0;
+    jit->segment_count = 0;
+}
 
-            int32_t rel32 = (intptr_t)addr - ((intptr_t)patch + 4);
-            *patch += rel32;
-        } else if (tag == TB_SYMBOL_EXTERNAL) {
-            TB_External* e = (TB_External*) p->target;
+TB_JIT* tb_jit_begin_flags(TB_Module* m, size_t jit_heap_capacity, TB_JITFlags flags) {
+    if (jit_heap_capacity == 0) {
+        jit_heap_capacity = 2*1024*1024;
+    }
 
-            void* addr = e->thunk ? e->thunk : p->target->address;
-            if (addr == NULL) {
-                addr = get_proc(jit, p->target->name);
-                if (addr == NULL) {
-                    tb_panic("Could not find procedure: %s", p->target->name);
-                }
-            }
+    // the capacity is how much we map at a time, everything in the heap has to
+    // reach everything else which is rel32 on x64 and the +-128MiB of BL on ARM64.
+    size_t segment_size = align_up(jit_heap_capacity, CHUNK_SIZE);
+    size_t reserved = m->target_arch == TB_ARCH_AARCH64 ? 128ull*1024*1024 : 1024ull*1024*1024;
+    if (reserved < segment_size) {
+        reserved = segment_size;
+    }
 
-            ptrdiff_t rel = (intptr_t)addr - ((intptr_t)patch + 4);
-            int32_t rel32 = rel;
-            if (rel == rel32) {
-                memcpy(dst + actual_pos, &rel32, sizeof(int32_t));
-            } else {
-                // generate thunk to make far call
-                char* thunk = tb_jit_alloc_obj(jit, 6 + sizeof(void*), 1);
-                thunk[0] = 0xFF; // jmp qword [rip]
-                thunk[1] = 0x25;
-                thunk[2] = 0x00;
-                thunk[3] = 0x00;
-                thunk[4] = 0x00;
-                thunk[5] = 0x00;
-
-                // write final address into the thunk
-                memcpy(thunk + 6, &addr, sizeof(void*));
-                e->thunk = thunk;
-
-                int32_t rel32 = (intptr_t)thunk - ((intptr_t)patch + 4);
-                *patch += rel32;
-            }
-        } else if (tag == TB_SYMBOL_GLOBAL) {
-            TB_Global* g = (TB_Global*) p->target;
-            void* addr = tb_jit_place_global(jit, g);
+    TB_JIT* jit = tb_platform_heap_alloc(sizeof(TB_JIT));
+    *jit = (TB_JIT){
+        .id = atomic_fetch_add(&jit_next_id, 1),
+        .arch = m->target_arch,
+        .reserved = reserved,
+        .segment_size = segment_size,
+        .memfd = -1,
+        .debug_flags = flags & (TB_JIT_PERF_MAP | TB_JIT_PERF_JITDUMP | TB_JIT_GDB),
+    };
+
+    size_t segment_chunks = segment_size >> CHUNK_SHIFT;
+    if ((flags & TB_JIT_DUAL_MAP) && jit_reserve_dual(jit) && !jit_grow(jit, segment_chunks)) {
+        jit_unmap(jit);
+    }
 
-            int32_t* patch = (int32_t*) &dst[actual_pos];
-            int32_t rel32 = (intptr_t)addr - ((intptr_t)patch + 4);
-            *patch += rel32;
-        } else {
-            tb_todo();
+    if (jit->base == NULL && jit_reserve(jit) && !jit_grow(jit, segment_chunks)) {
+        // hardened kernels (SELinux execmem, PaX) refuse RWX, the dual
+        // mapping might still get through.
+        jit_unmap(jit);
+        if (jit_reserve_dual(jit) && !jit_grow(jit, segment_chunks)) {
+            jit_unmap(jit);
         }
     }
 
-    return dst;
-}
+    if (jit->base == NULL) {
+        tb_platform_heap_free(jit);
+        return NULL;
+    }
 
-void* tb_jit_place_global(TB_JIT* jit, TB_Global* g) {
-    if (g->address != NULL) {
-        return g->address;
+    size_t chunk_count = reserved >> CHUNK_SHIFT;
+    jit->chunks = tb_platform_heap_alloc(chunk_count * sizeof(JITChunk));
+    memset(jit->chunks, 0, chunk_count * sizeof(JITChunk));
+
+    mtx_init(&jit->lock, mtx_plain);
+    mtx_init(&jit->heap_lock, mtx_plain);
+    mtx_init(&jit->sym_lock, mtx_plain);
+    mtx_init(&jit->lazy_lock, mtx_plain);
+    mtx_init(&jit->gc_lock, mtx_plain);
+    FOR_N(i, 0, CLASS_COUNT) {
+        mtx_init(&jit->classes[i].lock, mtx_plain);
     }
 
-    char* data = tb_jit_alloc_obj(jit, g->size, g->align);
-    g->address = data;
+    call_once(&jit_live_init, jit_live_init_once);
+    mtx_lock(&jit_live_lock);
+    dyn_array_put(jit_live, jit);
+    mtx_unlock(&jit_live_lock);
+    return jit;
+}
 
-    log_debug("jit: apply global %s (%p)", g->super.name ? g->super.name : "<unnamed>", data);
+TB_JIT* tb_jit_begin(TB_Module* m, size_t jit_heap_capacity) {
+    // ARM64 Linux distros increasingly refuse RWX pages, so there we
+    // map the heap twice (RW + RX) instead.
+    return tb_jit_begin_flags(m, jit_heap_capacity, m->target_arch == TB_ARCH_AARCH64 ? TB_JIT_DUAL_MAP : 0);
+}
 
-    memset(data, 0, g->size);
-    FOR_N(k, 0, g->obj_count) {
-        if (g->objects[k].type == TB_INIT_OBJ_REGION) {
-            memcpy(&data[g->objects[k].offset], g->objects[k].region.ptr, g->objects[k].region.size);
+void tb_jit_end(TB_JIT* jit) {
+    // threads still holding one of our chunks will just drop it now
+    mtx_lock(&jit_live_lock);
+    dyn_array_for(i, jit_live) {
+        if (jit_live[i] == jit) {
+            dyn_array_remove(jit_live, i);
+            break;
         }
     }
+    mtx_unlock(&jit_live_lock);
 
-    FOR_N(k, 0, g->obj_count) {
-        if (g->objects[k].type == TB_INIT_OBJ_RELOC) {
-            uintptr_t addr = (uintptr_t) get_symbol_address(g->objects[k].reloc);
+    if (jit->tiered) {
+        atomic_store(&jit->tier_quit, true);
+        thrd_join(jit->tier_thread, NULL);
 
-            uintptr_t* dst = (uintptr_t*) &data[g->objects[k].offset];
-            *dst += addr;
+        dyn_array_for(i, jit->tiers) {
+            tb_platform_heap_free(jit->tiers[i]);
         }
+        dyn_array_destroy(jit->tiers);
+        nl_map_free(jit->tier_map);
+        tb_worklist_free(jit->tier_ws);
+        tb_arena_destroy(jit->tier_arenas[0]);
+        tb_arena_destroy(jit->tier_arenas[1]);
     }
 
-    return data;
-}
+    if (jit->lazy) {
+        tb_worklist_free(jit->lazy_ws);
+    }
+    nl_map_free(jit->lazy_stubs);
+    mtx_destroy(&jit->lazy_lock);
+
+    // the retired stuff just goes with the heap
+    nl_map_for(i, jit->refs) {
+        dyn_array_destroy(jit->refs[i].v->sites);
+        dyn_array_destroy(jit->refs[i].v->callees);
+        tb_platform_heap_free(jit->refs[i].v);
+    }
+    nl_map_free(jit->refs);
+    dyn_array_destroy(jit->gc_pending);
+    dyn_array_destroy(jit->gc_limbo);
+    mtx_destroy(&jit->gc_lock);
 
-TB_JIT* tb_jit_begin(TB_Module* m, size_t jit_heap_capacity) {
-    if (jit_heap_capacity == 0) {
-        jit_heap_capacity = 2*1024*1024;
+    jit_debug_end(jit);
+
+    FOR_N(i, 0, CLASS_COUNT) {
+        mtx_destroy(&jit->classes[i].lock);
     }
+    mtx_destroy(&jit->heap_lock);
+    mtx_destroy(&jit->lock);
 
-    TB_JIT* jit = tb_platform_valloc(jit_heap_capacity);
-    mtx_init(&jit->lock, mtx_plain);
-    jit->capacity = jit_heap_capacity;
-    jit->heap.cookie = ALLOC_COOKIE;
-    jit->heap.size = (jit_heap_capacity - sizeof(TB_JIT)) << 1;
+    mtx_destroy(&jit->sym_lock);
+    nl_map_for_str(i, jit->loaded_funcs) {
+        tb_platform_heap_free((void*) jit->loaded_funcs[i].k.data);
+    }
+    nl_map_free(jit->loaded_funcs);
+    nl_map_free(jit->far_thunks);
+    dyn_array_for(i, jit->libraries) {
+        #ifdef _WIN32
+        FreeLibrary(jit->libraries[i]);
+        #else
+        dlclose(jit->libraries[i]);
+        #endif
+    }
+    dyn_array_destroy(jit->libraries);
+    dyn_array_destroy(jit->resolvers);
 
-    // a lil unsafe... im sorry momma
-    tb_platform_vprotect(jit, jit_heap_capacity, TB_PAGE_RXW);
-    return jit;
-}
+    FOR_N(i, 0, jit->committed_chunks) {
+        tb_platform_heap_free(atomic_load(&jit->chunks[i].tags));
+    }
 
-void tb_jit_end(TB_JIT* jit) {
-    mtx_destroy(&jit->lock);
-    tb_platform_vfree(jit, jit->capacity);
+    for (TagList* l = jit->tag_limbo; l;) {
+        TagList* next = l->next;
+        tb_platform_heap_free(l);
+        l = next;
+    }
+
+    jit_unmap(jit);
+    dyn_array_destroy(jit->breakpoints);
+    tb_platform_heap_free(jit->chunks);
+    tb_platform_heap_free(jit);
 }
 
 void* tb_jit_get_code_ptr(TB_Function* f) {
@@ -605,5 +2405,415 @@ bool tb_jit_thread_call(TB_CPUContext* cpu, void* pc, uint64_t* ret, size_t arg_
 
     return cpu->interrupted;
 }
+#elif defined(TB_HOST_X86_64) && defined(TB_HOST_LINUX)
+struct TB_CPUContext {
+    // used for stack crawling
+    void* pc;
+    void* sp;
+
+    // the trampoline returns through old_sp, resumed code doesn't have a host
+    // frame to go back to so it returns to exit_ra instead.
+    void* old_sp;
+    void* exit_ra;
+
+    TB_JIT* jit;
+    size_t ud_size;
+
+    volatile bool interrupted;
+    volatile bool running;
+    volatile bool resuming;
+    volatile bool traced;
+
+    // holds off reclamation (tb_jit_enter) from the call until it returns
+    bool entered;
+    uint32_t code_epoch;
+
+    // cont is where the host picks back up once the JIT code stops,
+    // state is where the JIT code stopped.
+    ucontext_t cont;
+    ucontext_t state;
+
+    // safepoint page
+    _Alignas(4096) char poll_site[4096];
+
+    char user_data[];
+};
+
+typedef struct {
+    // sysv: rdi rsi rdx rcx r8 r9
+    uint64_t gprs[6];
+} X64Params;
+
+// sysv trampoline ( sp pc params ctx -- rax )
+extern const uint8_t tb_jit__trampoline[], tb_jit__trampoline_exit[], tb_jit__trampoline_end[];
+__asm__(
+    ".pushsection .text\n"
+    ".p2align 4\n"
+    "tb_jit__trampoline:\n"
+    // save old SP, we'll come back for it later
+    "    movq %rsp, 0x10(%rcx)\n"
+    // use new SP
+    "    movq %rdi, %rsp\n"
+    // shuffle some params into volatile regs we're not passing with
+    "    movq %rsi, %rax\n"
+    "    movq %rdx, %r10\n"
+    // fill GPR params
+    "    movq 0x00(%r10), %rdi\n"
+    "    movq 0x08(%r10), %rsi\n"
+    "    movq 0x10(%r10), %rdx\n"
+    "    movq 0x18(%r10), %rcx\n"
+    "    movq 0x20(%r10), %r8\n"
+    "    movq 0x28(%r10), %r9\n"
+    "    callq *%rax\n"
+    // restore stack & return normally
+    "    andq $-0x200000, %rsp\n"
+    "    movq 0x10(%rsp), %rsp\n"
+    "    retq\n"
+    // resumed code returns here, it traps back into the host
+    "tb_jit__trampoline_exit:\n"
+    "    int3\n"
+    "tb_jit__trampoline_end:\n"
+    ".popsection\n"
+);
+
+// the thread currently running JIT code, if any
+static thread_local TB_CPUContext* jit_cpu;
+static thread_local void* jit_altstack;
+
+static once_flag jit_signals_init = ONCE_FLAG_INIT;
+static struct sigaction jit_prev_segv, jit_prev_trap;
+
+static bool jit_in_trampoline(uintptr_t pc) {
+    return pc - (uintptr_t) tb_jit__trampoline < (uintptr_t) (tb_jit__trampoline_end - tb_jit__trampoline);
+}
+
+// code is only writable through the RW view when it's dual mapped
+static void jit_poke(TB_JIT* jit, uint8_t* pc, uint8_t b) {
+    uint8_t* dst = pc;
+    if (jit->exec_delta && (char*) pc >= jit->base + jit->exec_delta && (char*) pc < jit->base + jit->exec_delta + jit->reserved) {
+        dst -= jit->exec_delta;
+    }
+    *dst = b;
+    jit_flush_icache(pc, 1);
+}
+
+static void jit_install_breakpoints(TB_JIT* jit, uintptr_t skip) {
+    dyn_array_for(i, jit->breakpoints) {
+        TB_Breakpoint* bp = &jit->breakpoints[i];
+        bp->active = (uintptr_t) bp->pos != skip;
+        if (bp->active) {
+            bp->prev_byte = *bp->pos;
+            jit_poke(jit, bp->pos, 0xCC);
+        }
+    }
+}
+
+static void jit_uninstall_breakpoints(TB_JIT* jit) {
+    dyn_array_for(i, jit->breakpoints) {
+        TB_Breakpoint* bp = &jit->breakpoints[i];
+        if (bp->active) {
+            jit_poke(jit, bp->pos, bp->prev_byte);
+            bp->active = false;
+        }
+    }
+}
+
+static bool jit_has_breakpoint(TB_JIT* jit, uintptr_t pc, bool active) {
+    dyn_array_for(i, jit->breakpoints) {
+        if ((uintptr_t) jit->breakpoints[i].pos == pc && (!active || jit->breakpoints[i].active)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void jit_chain_signal(int sig, siginfo_t* info, void* uc) {
+    struct sigaction* prev = sig == SIGSEGV ? &jit_prev_segv : &jit_prev_trap;
+    if (prev->sa_flags & SA_SIGINFO) {
+        prev->sa_sigaction(sig, info, uc);
+    } else if (prev->sa_handler == SIG_DFL) {
+        // it's blocked until we return, then the default action gets it
+        sigaction(sig, prev, NULL);
+        raise(sig);
+    } else if (prev->sa_handler != SIG_IGN) {
+        prev->sa_handler(sig);
+    }
+}
+
+// only the GPRs, RIP & RFLAGS move around, the segment bits stay whatever
+// the kernel gave us.
+static void jit_load_state(ucontext_t* uc, TB_CPUContext* cpu) {
+    memcpy(uc->uc_mcontext.gregs, cpu->state.uc_mcontext.gregs, (REG_EFL + 1) * sizeof(greg_t));
+
+    char* fp = (char*) uc->uc_mcontext.fpregs;
+    if (fp) {
+        memcpy(fp, &cpu->state.__fpregs_mem, sizeof(struct _libc_fpstate));
+
+        // xsave frames only restore the components marked present, make sure
+        // the x87 & SSE state we just put there isn't skipped.
+        uint32_t magic;
+        memcpy(&magic, fp + 464, sizeof(magic));
+        if (magic == 0x46505853) {
+            uint64_t xstate_bv;
+            memcpy(&xstate_bv, fp + 512, sizeof(xstate_bv));
+            xstate_bv |= 3;
+            memcpy(fp + 512, &xstate_bv, sizeof(xstate_bv));
+        }
+    }
+}
+
+static void jit_save_state(TB_CPUContext* cpu, ucontext_t* uc) {
+    memcpy(cpu->state.uc_mcontext.gregs, uc->uc_mcontext.gregs, (REG_EFL + 1) * sizeof(greg_t));
+    if (uc->uc_mcontext.fpregs) {
+        memcpy(&cpu->state.__fpregs_mem, uc->uc_mcontext.fpregs, sizeof(struct _libc_fpstate));
+    }
+    cpu->state.uc_mcontext.fpregs = &cpu->state.__fpregs_mem;
+}
+
+static void jit_signal_handler(int sig, siginfo_t* info, void* ptr) {
+    ucontext_t* uc = ptr;
+    greg_t* regs = uc->uc_mcontext.gregs;
+
+    TB_CPUContext* cpu = jit_cpu;
+    if (cpu == NULL || !cpu->running) {
+        jit_chain_signal(sig, info, ptr);
+        return;
+    }
+
+    if (cpu->resuming) {
+        // we raised this one ourselves, it's the way back into the JIT code
+        cpu->resuming = false;
+        jit_load_state(uc, cpu);
+        return;
+    }
+
+    uintptr_t rip = regs[REG_RIP];
+    if (sig == SIGSEGV) {
+        char* addr = info->si_addr;
+        if (addr < cpu->poll_site || addr >= &cpu->poll_site[sizeof(cpu->poll_site)]) {
+            jit_chain_signal(sig, info, ptr);
+            return;
+        }
+
+        // we hit a safepoint poll, it's disarmed so resuming gets past it
+        mprotect(cpu->poll_site, sizeof(cpu->poll_site), PROT_READ | PROT_WRITE);
+    } else if (info->si_code == SI_KERNEL) {
+        // INT3 leaves RIP past itself, we stop on the INT3 (or rather the
+        // instruction it replaced).
+        if (!jit_has_breakpoint(cpu->jit, rip - 1, true) && rip - 1 != (uintptr_t) tb_jit__trampoline_exit) {
+            jit_chain_signal(sig, info, ptr);
+            return;
+        }
+        regs[REG_RIP] = rip - 1;
+    } else if (info->si_code != TRAP_TRACE) {
+        jit_chain_signal(sig, info, ptr);
+        return;
+    }
+
+    // necessary for stack crawling later
+    cpu->pc = (void*) regs[REG_RIP];
+    cpu->sp = (void*) regs[REG_RSP];
+    cpu->traced = sig == SIGTRAP && info->si_code == TRAP_TRACE;
+    cpu->interrupted = true;
+    cpu->running = false;
+    jit_save_state(cpu, uc);
+
+    // jump out of the JIT, the host only needs what getcontext saved
+    memcpy(regs, cpu->cont.uc_mcontext.gregs, (REG_RIP + 1) * sizeof(greg_t));
+    regs[REG_EFL] &= ~0x100;
+}
+
+static void jit_signals_install(void) {
+    struct sigaction sa = { .sa_sigaction = jit_signal_handler, .sa_flags = SA_SIGINFO | SA_ONSTACK };
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGSEGV, &sa, &jit_prev_segv);
+    sigaction(SIGTRAP, &sa, &jit_prev_trap);
+}
+
+static void jit_thread_enter(TB_CPUContext* cpu) {
+    // signals go to an alternate stack, the JIT stack might be what broke and
+    // resumed code returns with the SP sitting in the TB_CPUContext.
+    if (jit_altstack == NULL) {
+        stack_t prev;
+        sigaltstack(NULL, &prev);
+        if (prev.ss_flags & SS_DISABLE) {
+            jit_altstack = tb_platform_valloc(ALTSTACK_SIZE);
+            stack_t ss = { .ss_sp = jit_altstack, .ss_size = ALTSTACK_SIZE };
+            sigaltstack(&ss, NULL);
+        } else {
+            jit_altstack = prev.ss_sp;
+        }
+    }
+
+    call_once(&jit_signals_init, jit_signals_install);
+    jit_cpu = cpu;
+}
+
+static bool jit_thread_leave(TB_CPUContext* cpu, uint64_t* ret) {
+    jit_uninstall_breakpoints(cpu->jit);
+    jit_cpu = NULL;
+
+    // stopping in the trampoline means it returned, just not the usual way
+    greg_t* regs = cpu->state.uc_mcontext.gregs;
+    if (cpu->interrupted && jit_in_trampoline(regs[REG_RIP])) {
+        cpu->interrupted = false;
+        if (ret) { *ret = regs[REG_RAX]; }
+    }
+
+    // a stopped thread is still in the code
+    if (!cpu->interrupted && cpu->entered) {
+        tb_jit_exit(cpu->jit, cpu->code_epoch);
+        cpu->entered = false;
+    }
+    return cpu->interrupted;
+}
+
+// continues from cpu->state until it stops again (or a single instruction if
+// we're stepping), returns true if it stopped rather than returned.
+static bool jit_thread_run(TB_CPUContext* cpu, uint64_t* ret, bool step) {
+    greg_t* regs = cpu->state.uc_mcontext.gregs;
+
+    jit_thread_enter(cpu);
+    jit_install_breakpoints(cpu->jit, regs[REG_RIP]);
+    if (step) {
+        regs[REG_EFL] |= 0x100;
+    }
+
+    // save our precious restore point
+    cpu->interrupted = false;
+    cpu->running = true;
+    getcontext(&cpu->cont);
+
+    if (cpu->running) {
+        // there's no host frame to return to anymore
+        cpu->exit_ra = (void*) tb_jit__trampoline_exit;
+        cpu->old_sp = &cpu->exit_ra;
+
+        // the handler swaps cpu->state in
+        cpu->resuming = true;
+        raise(SIGTRAP);
+    }
+
+    regs[REG_EFL] &= ~0x100;
+    return jit_thread_leave(cpu, ret);
+}
+
+TB_CPUContext* tb_jit_thread_create(TB_JIT* jit, size_t ud_size) {
+    TB_CPUContext* cpu = tb_jit_stack_create();
+    if (cpu == NULL) {
+        return NULL;
+    }
+
+    cpu->ud_size = ud_size;
+    cpu->jit = jit;
+    memset(cpu->user_data, 0, ud_size);
+    return cpu;
+}
+
+void tb_jit_thread_destroy(TB_CPUContext* cpu) {
+    if (cpu->entered) {
+        tb_jit_exit(cpu->jit, cpu->code_epoch);
+    }
+    tb_platform_vfree(cpu, STACK_SIZE);
+}
+
+void* tb_jit_thread_pc(TB_CPUContext* cpu) { return cpu->pc; }
+void* tb_jit_thread_sp(TB_CPUContext* cpu) { return cpu->sp; }
+
+size_t tb_jit_thread_pollsite(void) { return offsetof(TB_CPUContext, poll_site); }
+
+void* tb_jit_thread_get_userdata(TB_CPUContext* cpu) {
+    return cpu->user_data;
+}
+
+void tb_jit_thread_interrupt(TB_CPUContext* cpu) {
+    mprotect(cpu->poll_site, sizeof(cpu->poll_site), PROT_NONE);
+}
+
+void tb_jit_breakpoint(TB_JIT* jit, void* addr) {
+    TB_Breakpoint bp = { addr };
+    dyn_array_for(i, jit->breakpoints) {
+        if (jit->breakpoints[i].pos == addr) {
+            return;
+        }
+    }
+
+    dyn_array_put(jit->breakpoints, bp);
+}
+
+bool tb_jit_thread_step(TB_CPUContext* cpu, uint64_t* ret, uintptr_t pc_start, uintptr_t pc_end) {
+    // step until we're out of the current PC region
+    uintptr_t rip = cpu->state.uc_mcontext.gregs[REG_RIP];
+    while (rip >= pc_start && rip < pc_end) {
+        if (!jit_thread_run(cpu, ret, true)) {
+            return true;
+        }
+
+        rip = cpu->state.uc_mcontext.gregs[REG_RIP];
+    }
+
+    return jit_in_trampoline(rip);
+}
+
+bool tb_jit_thread_resume(TB_CPUContext* cpu, uint64_t* ret) {
+    // we don't put a breakpoint back where we stopped, so step
+    // past it first.
+    uintptr_t rip = cpu->state.uc_mcontext.gregs[REG_RIP];
+    if (jit_has_breakpoint(cpu->jit, rip, false)) {
+        if (!jit_thread_run(cpu, ret, true)) {
+            return false;
+        } else if (!cpu->traced) {
+            return true;
+        }
+    }
+
+    return jit_thread_run(cpu, ret, false);
+}
+
+bool tb_jit_thread_call(TB_CPUContext* cpu, void* pc, uint64_t* ret, size_t arg_count, void** args) {
+    if (!cpu->entered) {
+        cpu->code_epoch = tb_jit_enter(cpu->jit);
+        cpu->entered = true;
+    }
+
+    jit_thread_enter(cpu);
+    jit_install_breakpoints(cpu->jit, (uintptr_t) pc);
+
+    // save our precious restore point
+    cpu->interrupted = false;
+    cpu->running = true;
+    getcontext(&cpu->cont);
+
+    if (cpu->running) {
+        // continue in JITted code
+        X64Params params = { 0 };
+        enum { ABI_GPR_COUNT = 6 };
+
+        size_t i = 0;
+        for (; i < arg_count && i < ABI_GPR_COUNT; i++) {
+            memcpy(&params.gprs[i], &args[i], sizeof(uint64_t));
+        }
+
+        // the rest go on the stack, RSP is 16B aligned at the call. it can't start
+        // at the very top since the trampoline finds the context by masking it.
+        size_t stack_usage = 16 + align_up((arg_count > ABI_GPR_COUNT ? arg_count - ABI_GPR_COUNT : 0) * 8, 16);
+        uint8_t* sp = (uint8_t*) cpu;
+        sp += STACK_SIZE;
+        sp -= stack_usage;
+
+        // fill param slots
+        for (; i < arg_count; i++) {
+            memcpy(&sp[(i - ABI_GPR_COUNT)*8], &args[i], sizeof(uint64_t));
+        }
+
+        typedef uint64_t (*Trampoline)(void* sp, void* pc, X64Params* params, TB_CPUContext* cpu);
+        uint64_t r = ((Trampoline)(void*) tb_jit__trampoline)(sp, pc, &params, cpu);
+        if (ret) { *ret = r; }
+
+        cpu->running = false;
+    }
+
+    return jit_thread_leave(cpu, ret);
+}
 #endif
 #endif
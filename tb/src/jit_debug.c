@@ -0,0 +1,618 @@
+// Telling profilers & debuggers about JIT'd code (Linux only), everything here is
+// opt-in through TB_JITFlags and costs a flag check per placement otherwise.
+//
+//   perf map:  /tmp/perf-<pid>.map, one "start size name" line per function.
+//   jitdump:   jit-<pid>.dump in $JITDUMPDIR (or the working directory), code
+//              bytes + line tables for `perf record -k 1` & `perf inject --jit`.
+//   GDB:       the __jit_debug_register_code interface, every function gets an
+//              in-memory ELF with its symbol and a DWARF line table built from
+//              the TB_DEBUG_LOCATION nodes.
+//
+// The files & GDB's list are per process so they share one lock across JITs.
+#include <tb_elf.h>
+
+#ifdef TB_HOST_LINUX
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+typedef struct JITCodeEntry JITCodeEntry;
+struct JITCodeEntry {
+    JITCodeEntry* next_entry;
+    JITCodeEntry* prev_entry;
+    const char* symfile_addr;
+    uint64_t symfile_size;
+
+    // ours, GDB doesn't read past symfile_size
+    char* code;
+};
+
+// GDB puts a breakpoint in __jit_debug_register_code and reads the descriptor
+// whenever it's hit, the names & layout are fixed. weak so we don't clash with
+// another JIT in the same process (we'll share its list then).
+enum { JIT_NOACTION, JIT_REGISTER_FN, JIT_UNREGISTER_FN };
+struct jit_descriptor {
+    uint32_t version;
+    uint32_t action_flag;
+    JITCodeEntry* relevant_entry;
+    JITCodeEntry* first_entry;
+};
+
+__attribute__((weak)) struct jit_descriptor __jit_debug_descriptor = { 1, JIT_NOACTION, NULL, NULL };
+
+__attribute__((weak, noinline)) void __jit_debug_register_code(void) {
+    __asm__ volatile("" ::: "memory");
+}
+
+enum {
+    JITDUMP_MAGIC   = 0x4A695444,
+    JITDUMP_VERSION = 1,
+
+    JIT_CODE_LOAD       = 0,
+    JIT_CODE_DEBUG_INFO = 2,
+};
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t total_size;
+    uint32_t elf_mach;
+    uint32_t pad1;
+    uint32_t pid;
+    uint64_t timestamp;
+    uint64_t flags;
+} JitdumpHeader;
+
+typedef struct {
+    uint32_t id;
+    uint32_t total_size;
+    uint64_t timestamp;
+} JitdumpRecord;
+
+typedef struct {
+    JitdumpRecord r;
+    uint32_t pid, tid;
+    uint64_t vma;
+    uint64_t code_addr;
+    uint64_t code_size;
+    uint64_t code_index;
+    // followed by the name (NUL terminated) & the code
+} JitdumpCodeLoad;
+
+typedef struct {
+    JitdumpRecord r;
+    uint64_t code_addr;
+    uint64_t nr_entry;
+    // followed by nr_entry of { u64 addr, i32 line, i32 discrim, char filename[] }
+} JitdumpDebugInfo;
+
+static once_flag jit_debug_init = ONCE_FLAG_INIT;
+static struct {
+    mtx_t lock;
+
+    // opened on first use, -1 if that failed (we don't retry)
+    bool perf_map_opened, jitdump_opened;
+    int perf_map_fd, jitdump_fd;
+    uint64_t code_index;
+} jit_debug;
+
+static void jit_debug_init_lock(void) {
+    mtx_init(&jit_debug.lock, mtx_plain);
+}
+
+// perf's default clock for `perf record -k 1`
+static uint64_t jit_debug_timestamp(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void jit_debug_write(int fd, const void* data, size_t size) {
+    const char* p = data;
+    while (size > 0) {
+        ssize_t n = write(fd, p, size);
+        if (n < 0) {
+            log_warn("jit: couldn't write debug info (errno %d)", errno);
+            return;
+        }
+        p += n, size -= n;
+    }
+}
+
+static int jit_debug_perf_map(void) {
+    if (!jit_debug.perf_map_opened) {
+        jit_debug.perf_map_opened = true;
+
+        char path[64];
+        snprintf(path, sizeof(path), "/tmp/perf-%d.map", (int) getpid());
+        jit_debug.perf_map_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (jit_debug.perf_map_fd < 0) {
+            log_warn("jit: couldn't open %s (errno %d)", path, errno);
+        }
+    }
+    return jit_debug.perf_map_fd;
+}
+
+static int jit_debug_jitdump(TB_JIT* jit) {
+    if (!jit_debug.jitdump_opened) {
+        jit_debug.jitdump_opened = true;
+
+        const char* dir = getenv("JITDUMPDIR");
+        char path[FILENAME_MAX];
+        snprintf(path, sizeof(path), "%s/jit-%d.dump", dir ? dir : ".", (int) getpid());
+
+        int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        jit_debug.jitdump_fd = fd;
+        if (fd < 0) {
+            log_warn("jit: couldn't open %s (errno %d)", path, errno);
+            return fd;
+        }
+
+        JitdumpHeader header = {
+            .magic      = JITDUMP_MAGIC,
+            .version    = JITDUMP_VERSION,
+            .total_size = sizeof(JitdumpHeader),
+            .elf_mach   = jit->arch == TB_ARCH_AARCH64 ? TB_EM_AARCH64 : TB_EM_X86_64,
+            .pid        = getpid(),
+            .timestamp  = jit_debug_timestamp(),
+        };
+        jit_debug_write(fd, &header, sizeof(header));
+
+        // perf only finds the dump through an executable mapping of it, the
+        // mapping itself is never touched (and lives as long as the process).
+        void* marker = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ | PROT_EXEC, MAP_PRIVATE, fd, 0);
+        if (marker == MAP_FAILED) {
+            log_warn("jit: couldn't map %s, perf won't see it (errno %d)", path, errno);
+        }
+    }
+    return jit_debug.jitdump_fd;
+}
+
+static const char* jit_debug_name(TB_Function* f, char* buf, size_t len) {
+    if (f->super.name && f->super.name[0]) {
+        return f->super.name;
+    }
+
+    snprintf(buf, len, "jit_fn_%p", f);
+    return buf;
+}
+
+////////////////////////////////
+// In-memory ELF for GDB
+////////////////////////////////
+static void dwarf_uleb(TB_Emitter* e, uint64_t x) {
+    do {
+        uint8_t lo = x & 0x7F;
+        x >>= 7;
+        tb_out1b(e, x ? lo | 0x80 : lo);
+    } while (x);
+}
+
+static void dwarf_sleb(TB_Emitter* e, int64_t x) {
+    for (;;) {
+        uint8_t lo = x & 0x7F;
+        x >>= 7;
+        if ((x == 0 && (lo & 0x40) == 0) || (x == -1 && (lo & 0x40))) {
+            tb_out1b(e, lo);
+            break;
+        }
+        tb_out1b(e, lo | 0x80);
+    }
+}
+
+static void dwarf_string(TB_Emitter* e, size_t len, const void* str) {
+    tb_outs(e, len, str);
+    tb_out1b(e, 0);
+}
+
+enum {
+    DW_TAG_compile_unit = 0x11,
+    DW_TAG_subprogram   = 0x2e,
+
+    DW_AT_name       = 0x03,
+    DW_AT_stmt_list  = 0x10,
+    DW_AT_low_pc     = 0x11,
+    DW_AT_high_pc    = 0x12,
+    DW_AT_language   = 0x13,
+    DW_AT_producer   = 0x25,
+    DW_AT_external   = 0x3f,
+
+    DW_FORM_addr         = 0x01,
+    DW_FORM_data2        = 0x05,
+    DW_FORM_data8        = 0x07,
+    DW_FORM_string       = 0x08,
+    DW_FORM_sec_offset   = 0x17,
+    DW_FORM_flag_present = 0x19,
+
+    DW_LANG_C99 = 0x0c,
+
+    DW_LNS_copy         = 1,
+    DW_LNS_advance_pc   = 2,
+    DW_LNS_advance_line = 3,
+    DW_LNS_set_file     = 4,
+    DW_LNS_set_column   = 5,
+
+    DW_LNE_end_sequence = 1,
+    DW_LNE_set_address  = 2,
+};
+
+// section indices in the image
+enum {
+    ELF_TEXT = 1, ELF_SYMTAB, ELF_STRTAB, ELF_SHSTRTAB,
+    ELF_DEBUG_ABBREV, ELF_DEBUG_INFO, ELF_DEBUG_LINE,
+    ELF_SECTION_COUNT
+};
+
+static void elf_align(TB_Emitter* e) {
+    tb_out_zero(e, -e->count & 7);
+}
+
+// the files a function's locations refer to, in order of appearance (GDB's file
+// numbers are that plus one).
+static int jit_debug_file_index(DynArray(TB_SourceFile*)* files, TB_SourceFile* file) {
+    dyn_array_for(i, *files) {
+        if ((*files)[i] == file) {
+            return i;
+        }
+    }
+
+    dyn_array_put(*files, file);
+    return dyn_array_length(*files) - 1;
+}
+
+// sections are laid out right after the ELF header, the .text is NOBITS at the
+// code's real address so the symbol & line table need no relocating.
+static JITCodeEntry* jit_debug_elf(TB_JIT* jit, TB_Function* f, const char* name, char* code) {
+    TB_FunctionOutput* func_out = f->output;
+    DynArray(TB_Location) locs = func_out->locations;
+    uint64_t start = (uintptr_t) code, end = start + func_out->code_size;
+
+    TB_Emitter e = { 0 };
+    tb_out_reserve(&e, 1024);
+    tb_out_zero(&e, sizeof(JITCodeEntry) + sizeof(TB_Elf64_Ehdr));
+    size_t base = sizeof(JITCodeEntry);
+
+    TB_Elf64_Shdr sections[ELF_SECTION_COUNT] = { 0 };
+    sections[ELF_TEXT] = (TB_Elf64_Shdr){ .type = TB_SHT_NOBITS, .flags = TB_SHF_ALLOC | TB_SHF_EXECINSTR, .addr = start, .size = end - start, .addralign = 16 };
+
+    // .symtab, just the null symbol & the function
+    sections[ELF_SYMTAB] = (TB_Elf64_Shdr){ .type = TB_SHT_SYMTAB, .offset = e.count - base, .link = ELF_STRTAB, .info = 1, .addralign = 8, .entsize = sizeof(TB_Elf64_Sym) };
+    tb_out_zero(&e, sizeof(TB_Elf64_Sym));
+    TB_Elf64_Sym sym = {
+        .name  = 1,
+        .info  = TB_ELF64_ST_INFO(TB_ELF64_STB_GLOBAL, TB_ELF64_STT_FUNC),
+        .shndx = ELF_TEXT,
+        .value = start,
+        .size  = end - start,
+    };
+    tb_outs(&e, sizeof(sym), &sym);
+    sections[ELF_SYMTAB].size = e.count - base - sections[ELF_SYMTAB].offset;
+
+    size_t name_len = strlen(name);
+    sections[ELF_STRTAB] = (TB_Elf64_Shdr){ .type = TB_SHT_STRTAB, .offset = e.count - base, .size = name_len + 2, .addralign = 1 };
+    tb_out1b(&e, 0);
+    dwarf_string(&e, name_len, name);
+
+    static const char shstrtab[] = "\0.text\0.symtab\0.strtab\0.shstrtab\0.debug_abbrev\0.debug_info\0.debug_line";
+    static const uint32_t shstr_offsets[ELF_SECTION_COUNT] = { 0, 1, 7, 15, 23, 33, 47, 59 };
+    sections[ELF_SHSTRTAB] = (TB_Elf64_Shdr){ .type = TB_SHT_STRTAB, .offset = e.count - base, .size = sizeof(shstrtab), .addralign = 1 };
+    tb_outs(&e, sizeof(shstrtab), shstrtab);
+    elf_align(&e);
+
+    // .debug_abbrev
+    static const uint8_t abbrev[] = {
+        1, DW_TAG_compile_unit, 1,
+        DW_AT_producer,  DW_FORM_string,
+        DW_AT_language,  DW_FORM_data2,
+        DW_AT_name,      DW_FORM_string,
+        DW_AT_low_pc,    DW_FORM_addr,
+        DW_AT_high_pc,   DW_FORM_data8,
+        DW_AT_stmt_list, DW_FORM_sec_offset,
+        0, 0,
+
+        2, DW_TAG_subprogram, 0,
+        DW_AT_name,     DW_FORM_string,
+        DW_AT_external, DW_FORM_flag_present,
+        DW_AT_low_pc,   DW_FORM_addr,
+        DW_AT_high_pc,  DW_FORM_data8,
+        0, 0,
+
+        0,
+    };
+    sections[ELF_DEBUG_ABBREV] = (TB_Elf64_Shdr){ .type = TB_SHT_PROGBITS, .offset = e.count - base, .size = sizeof(abbrev), .addralign = 1 };
+    tb_outs(&e, sizeof(abbrev), abbrev);
+
+    // .debug_info, the CU is named after the first file we've got
+    sections[ELF_DEBUG_INFO] = (TB_Elf64_Shdr){ .type = TB_SHT_PROGBITS, .offset = e.count - base, .addralign = 1 };
+    size_t unit_start = e.count;
+    tb_out4b(&e, 0);
+    tb_out2b(&e, 4);
+    tb_out4b(&e, 0);
+    tb_out1b(&e, 8);
+
+    tb_out1b(&e, 1);
+    dwarf_string(&e, 2, "TB");
+    tb_out2b(&e, DW_LANG_C99);
+    if (dyn_array_length(locs) > 0 && locs[0].file) {
+        dwarf_string(&e, locs[0].file->len, locs[0].file->path);
+    } else {
+        dwarf_string(&e, name_len, name);
+    }
+    tb_out8b(&e, start);
+    tb_out8b(&e, end - start);
+    tb_out4b(&e, 0);
+
+    tb_out1b(&e, 2);
+    dwarf_string(&e, name_len, name);
+    tb_out8b(&e, start);
+    tb_out8b(&e, end - start);
+    tb_out1b(&e, 0);
+    tb_patch4b(&e, unit_start, e.count - unit_start - 4);
+    sections[ELF_DEBUG_INFO].size = e.count - base - sections[ELF_DEBUG_INFO].offset;
+
+    // .debug_line (v4)
+    enum { LINE_BASE = -5, LINE_RANGE = 14, OPCODE_BASE = 13 };
+    static const uint8_t std_opcode_lengths[OPCODE_BASE - 1] = { 0, 1, 1, 1, 1, 0, 0, 0, 1, 0, 0, 1 };
+
+    DynArray(TB_SourceFile*) files = NULL;
+    dyn_array_for(i, locs) {
+        if (locs[i].file) {
+            jit_debug_file_index(&files, locs[i].file);
+        }
+    }
+
+    sections[ELF_DEBUG_LINE] = (TB_Elf64_Shdr){ .type = TB_SHT_PROGBITS, .offset = e.count - base, .addralign = 1 };
+    unit_start = e.count;
+    tb_out4b(&e, 0);
+    tb_out2b(&e, 4);
+    size_t header_start = e.count;
+    tb_out4b(&e, 0);
+    tb_out1b(&e, 1); // min instruction length
+    tb_out1b(&e, 1); // max ops per instruction
+    tb_out1b(&e, 1); // default is_stmt
+    tb_out1b(&e, (uint8_t) LINE_BASE);
+    tb_out1b(&e, LINE_RANGE);
+    tb_out1b(&e, OPCODE_BASE);
+    tb_outs(&e, sizeof(std_opcode_lengths), std_opcode_lengths);
+    tb_out1b(&e, 0); // no include directories
+    dyn_array_for(i, files) {
+        dwarf_string(&e, files[i]->len, files[i]->path);
+        tb_out1b(&e, 0); // directory
+        tb_out1b(&e, 0); // mtime
+        tb_out1b(&e, 0); // length
+    }
+    tb_out1b(&e, 0);
+    tb_patch4b(&e, header_start, e.count - header_start - 4);
+
+    tb_out1b(&e, 0);
+    dwarf_uleb(&e, 9);
+    tb_out1b(&e, DW_LNE_set_address);
+    tb_out8b(&e, start);
+
+    int file = 1, line = 1, column = 0;
+    uint32_t pos = 0;
+    dyn_array_for(i, locs) {
+        TB_Location* l = &locs[i];
+        if (l->file == NULL) {
+            continue;
+        }
+
+        int l_file = jit_debug_file_index(&files, l->file) + 1;
+        if (file != l_file) {
+            tb_out1b(&e, DW_LNS_set_file);
+            dwarf_uleb(&e, l_file);
+            file = l_file;
+        }
+
+        if (column != l->column) {
+            tb_out1b(&e, DW_LNS_set_column);
+            dwarf_uleb(&e, l->column);
+            column = l->column;
+        }
+
+        if (line != l->line) {
+            tb_out1b(&e, DW_LNS_advance_line);
+            dwarf_sleb(&e, l->line - line);
+            line = l->line;
+        }
+
+        if (pos != l->pos) {
+            tb_out1b(&e, DW_LNS_advance_pc);
+            dwarf_uleb(&e, l->pos - pos);
+            pos = l->pos;
+        }
+        tb_out1b(&e, DW_LNS_copy);
+    }
+    dyn_array_destroy(files);
+
+    tb_out1b(&e, DW_LNS_advance_pc);
+    dwarf_uleb(&e, func_out->code_size - pos);
+    tb_out1b(&e, 0);
+    dwarf_uleb(&e, 1);
+    tb_out1b(&e, DW_LNE_end_sequence);
+    tb_patch4b(&e, unit_start, e.count - unit_start - 4);
+    sections[ELF_DEBUG_LINE].size = e.count - base - sections[ELF_DEBUG_LINE].offset;
+    elf_align(&e);
+
+    size_t shoff = e.count - base;
+    FOR_N(i, 0, ELF_SECTION_COUNT) {
+        sections[i].name = shstr_offsets[i];
+    }
+    tb_outs(&e, sizeof(sections), sections);
+
+    TB_Elf64_Ehdr header = {
+        .ident = {
+            [TB_EI_MAG0]    = 0x7F,
+            [TB_EI_MAG1]    = 'E',
+            [TB_EI_MAG2]    = 'L',
+            [TB_EI_MAG3]    = 'F',
+            [TB_EI_CLASS]   = 2,
+            [TB_EI_DATA]    = 1,
+            [TB_EI_VERSION] = 1,
+        },
+        .type      = TB_ET_REL,
+        .machine   = jit->arch == TB_ARCH_AARCH64 ? TB_EM_AARCH64 : TB_EM_X86_64,
+        .version   = 1,
+        .shoff     = shoff,
+        .ehsize    = sizeof(TB_Elf64_Ehdr),
+        .shentsize = sizeof(TB_Elf64_Shdr),
+        .shnum     = ELF_SECTION_COUNT,
+        .shstrndx  = ELF_SHSTRTAB,
+    };
+    memcpy(&e.data[base], &header, sizeof(header));
+
+    // the entry and its image share the allocation
+    JITCodeEntry* entry = (JITCodeEntry*) e.data;
+    *entry = (JITCodeEntry){
+        .symfile_addr = (const char*) &e.data[base],
+        .symfile_size = e.count - base,
+        .code         = code,
+    };
+    return entry;
+}
+
+// everything but the GDB entry is written as we go, the whole record goes out
+// in one write so concurrent placements don't interleave.
+static void jit_debug_place(TB_JIT* jit, TB_Function* f, char* code) {
+    TB_FunctionOutput* func_out = f->output;
+    call_once(&jit_debug_init, jit_debug_init_lock);
+
+    char buf[32];
+    const char* name = jit_debug_name(f, buf, sizeof(buf));
+    size_t name_len = strlen(name);
+
+    // built outside the lock, it's the expensive part
+    JITCodeEntry* entry = NULL;
+    if (jit->debug_flags & TB_JIT_GDB) {
+        entry = jit_debug_elf(jit, f, name, code);
+    }
+
+    mtx_lock(&jit_debug.lock);
+    if ((jit->debug_flags & TB_JIT_PERF_MAP) && jit_debug_perf_map() >= 0) {
+        char line[512];
+        int len = snprintf(line, sizeof(line), "%" PRIxPTR " %x %.*s\n", (uintptr_t) code, (unsigned) func_out->code_size, (int) sizeof(line) - 40, name);
+        jit_debug_write(jit_debug.perf_map_fd, line, len);
+    }
+
+    if ((jit->debug_flags & TB_JIT_PERF_JITDUMP) && jit_debug_jitdump(jit) >= 0) {
+        TB_Emitter e = { 0 };
+        tb_out_reserve(&e, 256 + name_len + func_out->code_size);
+        uint64_t timestamp = jit_debug_timestamp();
+
+        // perf wants the debug info before the load it's for
+        size_t count = 0;
+        dyn_array_for(i, func_out->locations) {
+            count += func_out->locations[i].file != NULL;
+        }
+
+        if (count > 0) {
+            JitdumpDebugInfo info = {
+                .r = { JIT_CODE_DEBUG_INFO, 0, timestamp },
+                .code_addr = (uintptr_t) code,
+                .nr_entry = count,
+            };
+            tb_outs(&e, sizeof(info), &info);
+            dyn_array_for(i, func_out->locations) {
+                TB_Location* l = &func_out->locations[i];
+                if (l->file) {
+                    tb_out8b(&e, (uintptr_t) code + l->pos);
+                    tb_out4b(&e, l->line);
+                    tb_out4b(&e, 0);
+                    dwarf_string(&e, l->file->len, l->file->path);
+                }
+            }
+            tb_patch4b(&e, offsetof(JitdumpRecord, total_size), e.count);
+        }
+
+        size_t load_start = e.count;
+        JitdumpCodeLoad load = {
+            .r = { JIT_CODE_LOAD, 0, timestamp },
+            .pid = getpid(),
+            .tid = syscall(SYS_gettid),
+            .vma = (uintptr_t) code,
+            .code_addr = (uintptr_t) code,
+            .code_size = func_out->code_size,
+            .code_index = jit_debug.code_index++,
+        };
+        tb_outs(&e, sizeof(load), &load);
+        dwarf_string(&e, name_len, name);
+        tb_outs(&e, func_out->code_size, code);
+        tb_patch4b(&e, load_start + offsetof(JitdumpRecord, total_size), e.count - load_start);
+
+        jit_debug_write(jit_debug.jitdump_fd, e.data, e.count);
+        tb_platform_heap_free(e.data);
+    }
+
+    if (entry) {
+        entry->next_entry = __jit_debug_descriptor.first_entry;
+        if (entry->next_entry) {
+            entry->next_entry->prev_entry = entry;
+        }
+        __jit_debug_descriptor.first_entry = entry;
+        __jit_debug_descriptor.relevant_entry = entry;
+        __jit_debug_descriptor.action_flag = JIT_REGISTER_FN;
+        __jit_debug_register_code();
+
+        dyn_array_put(jit->gdb_entries, entry);
+    }
+    mtx_unlock(&jit_debug.lock);
+}
+
+// jit_debug.lock must be held
+static void jit_debug_unregister(JITCodeEntry* entry) {
+    if (entry->prev_entry) {
+        entry->prev_entry->next_entry = entry->next_entry;
+    } else {
+        __jit_debug_descriptor.first_entry = entry->next_entry;
+    }
+
+    if (entry->next_entry) {
+        entry->next_entry->prev_entry = entry->prev_entry;
+    }
+
+    __jit_debug_descriptor.relevant_entry = entry;
+    __jit_debug_descriptor.action_flag = JIT_UNREGISTER_FN;
+    __jit_debug_register_code();
+    tb_platform_heap_free(entry);
+
+    __jit_debug_descriptor.relevant_entry = NULL;
+    __jit_debug_descriptor.action_flag = JIT_NOACTION;
+}
+
+// perf doesn't get told, it goes by timestamps and anything placed at the
+// same address later just shadows it.
+static void jit_debug_unplace(TB_JIT* jit, void* code) {
+    if (jit->gdb_entries == NULL) {
+        return;
+    }
+
+    mtx_lock(&jit_debug.lock);
+    dyn_array_for(i, jit->gdb_entries) {
+        if (jit->gdb_entries[i]->code == code) {
+            jit_debug_unregister(jit->gdb_entries[i]);
+            dyn_array_remove(jit->gdb_entries, i);
+            break;
+        }
+    }
+    mtx_unlock(&jit_debug.lock);
+}
+
+// the code's about to go away, GDB should forget about it first
+static void jit_debug_end(TB_JIT* jit) {
+    if (jit->gdb_entries == NULL) {
+        return;
+    }
+
+    mtx_lock(&jit_debug.lock);
+    dyn_array_for(i, jit->gdb_entries) {
+        jit_debug_unregister(jit->gdb_entries[i]);
+    }
+    mtx_unlock(&jit_debug.lock);
+
+    dyn_array_destroy(jit->gdb_entries);
+}
+#else
+static void jit_debug_place(TB_JIT* jit, TB_Function* f, char* code) {}
+static void jit_debug_unplace(TB_JIT* jit, void* code) {}
+static void jit_debug_end(TB_JIT* jit) {}
+#endif
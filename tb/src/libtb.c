@@ -12,11 +12,15 @@ void* tb_jit_stack_create(void);
 
 // JIT
 #include "jit.c"
+#include "jit_debug.c"
 
 // Optimizer
 #include "opt/optimizer.c"
 #include "new_builder.c"
 
+// Code cache
+#include "code_cache.c"
+
 // Regalloc
 #include "rogers_ra.c"
 #include "chaitin.c"
@@ -105,6 +109,24 @@ bool tb_platform_vprotect(void* ptr, size_t size, TB_MemProtect prot) {
 
     return mprotect(ptr, size, protect) == 0;
 }
+
+void* tb_jit_stack_create(void) {
+    size_t size = 2*1024*1024;
+
+    // natural alignment stack because it makes it easy to always find
+    // the base, mmap won't align it for us so we trim the excess.
+    char* ptr = mmap(NULL, size * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) {
+        return NULL;
+    }
+
+    char* base = (char*) (((uintptr_t) ptr + size - 1) & -size);
+    if (base != ptr) {
+        munmap(ptr, base - ptr);
+    }
+    munmap(base + size, (ptr + size*2) - (base + size));
+    return base;
+}
 #elif defined(EMSCRIPTEN)
 void* tb_platform_valloc(size_t size) {
     return mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
@@ -1,31 +1,28 @@
 #include "../tb_internal.h"
 
 #ifdef TB_HAS_MIPS
-// NOTE(NeGate): THIS IS VERY INCOMPLETE
 #include "../emitter.h"
 
-enum {
-    //   OP reg, imm
-    TILE_HAS_IMM = 1,
-};
-
 enum {
     // register classes
     REG_CLASS_GPR = 1,
     REG_CLASS_COUNT,
 };
 
-typedef struct {
-    TB_Node* base;
-    int offset;
-} AuxAddress;
+enum {
+    // single issue, the multiply/divide unit runs on the side (until someone
+    // reads HI/LO).
+    FU_ALU,
+    FU_MDU,
+    FUNCTIONAL_UNIT_COUNT,
+};
 
 typedef enum {
     ZR,                             // zero reg.
     AT,                             // reserved for assembler.
     V0, V1,                         // returns.
     A0, A1, A2, A3,                 // call params.
-    T0, T1, T2, T3, T4, T5, T6, T7, // temporaries (volatile)
+    T0, T1, T2, T3, T4, T5, T6, T7, // temporaries (volatile), a4-a7 & t0-t3 on n64
     S0, S1, S2, S3, S4, S5, S6, S7, // temporaries (non-volatile)
     T8, T9,                         // temporaries (volatile)
     K0, K1,                         // kernel regs.
@@ -35,760 +32,2706 @@ typedef enum {
     RA,                             // return addr
 } GPR;
 
-static const char* gpr_names[32] = {
-    "zr",
-    "at",
-    "v0", "v1",
-    "a0", "a1", "a2", "a3",
-    "t0", "t1", "t2", "t3", "t4", "t5", "t6", "t7",
-    "s0", "s1", "s2", "s3", "s4", "s5", "s6", "s7",
-    "t8", "t9",
-    "k0", "k1",
-    "gp",
-    "sp",
-    "fp",
-    "ra",
+enum {
+    // AT is scratch for the immediate helpers, K0 & K1 belong to the kernel, GP is
+    // left alone for the PIC code & RA is saved in the prologue whenever we call.
+    ALL_GPRS = 0x43FFFFFC,
+
+    // v0-v1, a0-a3 & t0-t9
+    CALLER_SAVED_GPRS = 0x0300FFFC,
+    // s0-s7 & fp
+    CALLEE_SAVED_GPRS = 0x40FF0000,
+};
+
+static const char* gpr_names[2][32] = {
+    // o32
+    {
+        "zero", "at", "v0", "v1", "a0", "a1", "a2", "a3",
+        "t0", "t1", "t2", "t3", "t4", "t5", "t6", "t7",
+        "s0", "s1", "s2", "s3", "s4", "s5", "s6", "s7",
+        "t8", "t9", "k0", "k1", "gp", "sp", "fp", "ra",
+    },
+    // n64
+    {
+        "zero", "at", "v0", "v1", "a0", "a1", "a2", "a3",
+        "a4", "a5", "a6", "a7", "t0", "t1", "t2", "t3",
+        "s0", "s1", "s2", "s3", "s4", "s5", "s6", "s7",
+        "t8", "t9", "k0", "k1", "gp", "sp", "fp", "ra",
+    },
 };
 
 #include "../codegen_impl.h"
+#include "../switch_lower.h"
+
+// compares, slt & sltu are the real ones, the equality checks are
+// an xor tested against zero.
+enum {
+    CMP_LT,
+    CMP_LTU,
+    CMP_EQ,
+    CMP_NE,
+};
+
+// branch conditions, xor 1 inverts them
+enum {
+    BR_EQ,  // beq a, b
+    BR_NE,  // bne a, b
+    BR_LTZ, // bltz a
+    BR_GEZ, // bgez a
+    BR_LEZ, // blez a
+    BR_GTZ, // bgtz a
+};
+
+// integer ops, the layout of inputs is:
+//   [1] src
+//   [2] rhs (compares & branches, NULL means an immediate or ZR)
+//
+// sel has the cond in [1] and the values in [2] & [3].
+typedef struct {
+    // width of the op, it's not always the node's type (extensions are
+    // 32bit shifts, compares use the operand type).
+    TB_DataType dt;
+    uint8_t cmp, cc;
+    // compares: flips the result (LE is a swapped LT)
+    bool invert;
+    int64_t imm;
+} MipsOp;
+
+// loads & stores:
+//   [0] ctrl
+//   [1] mem
+//   [2] base (the frame ptr or some GPR)
+//   [3] val (stores only, NULL means ZR)
+typedef struct {
+    TB_DataType mem_dt;
+    int32_t disp;
+    // sign extending loads (lb, lh & lw), the zero extending ones are lbu, lhu & lwu
+    bool sext;
+} MipsMemOp;
+
+typedef struct {
+    TB_Symbol* sym;
+    uint32_t clobber_gpr;
+} MipsCall;
 
-static bool fits_into_int16(uint64_t x) {
-    uint64_t hi = x >> 16ull;
-    return hi == 0 || hi == 0xFFFFFFFFFFFF;
+// machine node types
+typedef enum MipsNodeType {
+    mips_nop = TB_MACH_MIPS,
+
+    #define X(name) mips_ ## name,
+    #include "mips_nodes.inc"
+} MipsNodeType;
+
+static bool can_gvn(TB_Node* n) {
+    return true;
 }
 
-static bool try_for_imm16(int bits, TB_Node* n, int32_t* out_x) {
-    if (n->type != TB_ICONST) {
+static uint32_t node_flags(TB_Node* n) {
+    MipsNodeType type = n->type;
+    switch (type) {
+        case mips_br:
+        case mips_switch:
+        return NODE_CTRL | NODE_TERMINATOR | NODE_FORK_CTRL | NODE_BRANCH;
+
+        default: return 0;
+    }
+}
+
+static size_t extra_bytes(TB_Node* n) {
+    MipsNodeType type = n->type;
+    switch (type) {
+        case mips_nop:
+        case mips_la:
+        return 0;
+
+        case mips_addimm: case mips_andimm: case mips_orimm: case mips_xorimm:
+        case mips_sll: case mips_srl: case mips_sra: case mips_rotr:
+        case mips_cmp: case mips_sel: case mips_br:
+        return sizeof(MipsOp);
+
+        case mips_ld: case mips_st:
+        return sizeof(MipsMemOp);
+
+        case mips_switch:
+        return sizeof(TB_NodeBranch);
+
+        case mips_call: case mips_static_call:
+        return sizeof(MipsCall);
+
+        default:
+        tb_todo();
+    }
+}
+
+static const char* node_name(int n_type) {
+    switch (n_type) {
+        case mips_nop: return "nop";
+        #define X(name) case mips_ ## name: return STR(mips_ ## name);
+        #include "mips_nodes.inc"
+        default: return NULL;
+    }
+}
+
+static bool is_mips_op(TB_Node* n) {
+    switch (n->type) {
+        case mips_addimm: case mips_andimm: case mips_orimm: case mips_xorimm:
+        case mips_sll: case mips_srl: case mips_sra: case mips_rotr:
+        case mips_cmp: case mips_sel: case mips_br:
+        return true;
+
+        default:
         return false;
     }
+}
 
-    TB_NodeInt* i = TB_NODE_GET_EXTRA(n);
-    if (bits > 16) {
-        bool sign = (i->value >> 15ull) & 1;
-        uint64_t top = i->value >> 16ull;
+static void print_extra(TB_Node* n) {
+    if (is_mips_op(n)) {
+        MipsOp* op = TB_NODE_GET_EXTRA(n);
+        printf(", cmp=%d, cc=%d, invert=%d, imm=%"PRId64, op->cmp, op->cc, op->invert, op->imm);
+    } else if (n->type == mips_ld || n->type == mips_st) {
+        MipsMemOp* op = TB_NODE_GET_EXTRA(n);
+        printf(", disp=%d, sext=%d", op->disp, op->sext);
+    }
+}
 
-        // if the sign matches the rest of the top bits, we can sign extend just fine
-        if (top != (sign ? 0xFFFFFFFF : 0)) {
-            return false;
-        }
+static void print_dumb_extra(TB_Node* n) {
+    if (is_mips_op(n)) {
+        MipsOp* op = TB_NODE_GET_EXTRA(n);
+        printf("cmp=%d cc=%d invert=%d imm=%"PRId64" ", op->cmp, op->cc, op->invert, op->imm);
+    } else if (n->type == mips_ld || n->type == mips_st) {
+        MipsMemOp* op = TB_NODE_GET_EXTRA(n);
+        printf("disp=%d sext=%d ", op->disp, op->sext);
+    }
+}
+
+static bool is_mips64(TB_Function* f) { return f->super.module->target_arch == TB_ARCH_MIPS64; }
+
+static int int_bits(TB_Function* f, TB_DataType dt) { return dt.type == TB_TAG_PTR ? (is_mips64(f) ? 64 : 32) : dt.data; }
+
+// true for 64bit, everything else lives in the registers as a sign extended
+// 32bit value (the narrow ints have garbage above their width).
+static bool legalize_int(TB_Function* f, TB_DataType dt) { return int_bits(f, dt) > 32; }
+
+static bool fits_into_int16(int64_t x) { return x == (int16_t) x; }
+static bool fits_into_uint16(int64_t x) { return x >= 0 && x <= 0xFFFF; }
+
+// sign extended value of the constant
+static bool get_iconst(TB_Function* f, TB_Node* n, int64_t* out_x) {
+    if (n->type != TB_ICONST) {
+        return false;
     }
 
-    *out_x = i->value;
+    uint64_t x = TB_NODE_GET_EXTRA_T(n, TB_NodeInt)->value;
+    int shift = 64 - int_bits(f, n->dt);
+    *out_x = (int64_t) (x << shift) >> shift;
     return true;
 }
 
-static void init_ctx(Ctx* restrict ctx, TB_ABI abi) {
-    TB_Arch arch = ctx->module->target_arch;
-    assert(arch == TB_ARCH_MIPS32 || arch == TB_ARCH_MIPS64);
+static bool is_compare(TB_Node* n) {
+    return n->type >= TB_CMP_EQ && n->type <= TB_CMP_FLE;
+}
+
+static int node_2addr(TB_Node* n) {
+    return -1;
+}
 
-    ctx->sched = greedy_scheduler;
-    ctx->regalloc = tb__lsra;
-    ctx->abi_index = arch == TB_ARCH_MIPS64;
-    ctx->stack_slot_size = arch == TB_ARCH_MIPS64 ? 8 : 4;
+static bool node_remat(TB_Node* n) {
+    return n->type == mips_la || (n->type == mips_addimm && n->inputs[1]->type == TB_MACH_FRAME_PTR);
+}
 
-    uint32_t not_tmps = (1 << ZR) | (1 << AT) | (1 << SP) | (1 << K0) | (1 << K1) | (1 << GP);
+// anything past 32bits takes up to 6 instructions (see emit_loadimm)
+static bool node_hoist(TB_Node* n) {
+    if (n->type != TB_ICONST || n->dt.type != TB_TAG_INT || n->dt.data <= 32) {
+        return false;
+    }
 
-    ctx->num_regs[REG_CLASS_GPR] = 32;
-    ctx->normie_mask[REG_CLASS_GPR] = REGMASK(GPR, UINT32_MAX & ~not_tmps);
+    int64_t x = TB_NODE_GET_EXTRA_T(n, TB_NodeInt)->value;
+    return x != (int32_t) x;
+}
 
-    uint32_t volatile_gprs = ((UINT32_MAX >> 7) << 1) & ~(0xFF << S0);
-    volatile_gprs |= 1u << RA;
-    ctx->callee_saved[REG_CLASS_GPR] = ~volatile_gprs;
+// n64 hands out a0-a7 ($4-$11), o32 only gets a0-a3. The rest goes on the stack.
+static int param_reg_count(Ctx* restrict ctx) {
+    return ctx->abi_index ? 8 : 4;
 }
 
-static int bits_in_type(Ctx* restrict ctx, TB_DataType dt) {
-    switch (dt.type) {
-        case TB_TAG_INT: return dt.data;
-        case TB_TAG_PTR: return 64;
-        default: tb_todo();
+static void init_ctx(Ctx* restrict ctx, TB_ABI abi) {
+    ctx->abi_index = is_mips64(ctx->f);
+    ctx->num_regs[REG_CLASS_GPR] = 32;
+    ctx->normie_mask[REG_CLASS_GPR] = new_regmask(ctx->f, REG_CLASS_GPR, false, ALL_GPRS);
+
+    // incoming stack params are the first few STK slots, outgoing ones
+    // start at param_count.
+    TB_FunctionPrototype* proto = ctx->f->prototype;
+    int stack_params = 0;
+    FOR_N(i, 0, proto->param_count) {
+        if (TB_IS_FLOAT_TYPE(proto->params[i].dt)) {
+            tb_todo();
+        }
+        stack_params += i >= param_reg_count(ctx);
+    }
+    ctx->param_count = stack_params;
+    ctx->num_regs[REG_CLASS_STK] = stack_params;
+
+    // the first slot is the saved RA
+    ctx->num_spills = 1;
+
+    // allocate all locals, they sit right below the saved RA
+    TB_Node* root = ctx->f->root_node;
+    FOR_USERS(u, root) {
+        TB_Node* n = USERN(u);
+        if (n->type != TB_LOCAL) { continue; }
+        TB_NodeLocal* local = TB_NODE_GET_EXTRA(n);
+
+        // each stack slot is 8bytes
+        ctx->num_spills = align_up(ctx->num_spills + (local->size+7)/8, (local->align+7)/8);
+        local->stack_pos = -(ctx->num_spills*8);
+
+        if (local->type) {
+            assert(local->name);
+            TB_StackSlot s = {
+                .name = local->name,
+                .type = local->type,
+                .storage = { local->stack_pos },
+            };
+            dyn_array_put(ctx->debug_stack_slots, s);
+        }
     }
 }
 
-static RegMask normie_mask(Ctx* restrict ctx, TB_DataType dt) {
+static RegMask* normie_mask(Ctx* restrict ctx, TB_DataType dt) {
+    if (TB_IS_FLOAT_TYPE(dt)) {
+        tb_todo();
+    }
     return ctx->normie_mask[REG_CLASS_GPR];
 }
 
-static bool is_regpair(Ctx* restrict ctx, TB_DataType dt) {
-    return ctx->abi_index == 0 && dt.type == TB_TAG_INT && dt.data > 32;
+static TB_Node* mach_symbol(TB_Function* f, TB_Symbol* s) {
+    TB_Node* n = tb_alloc_node(f, TB_MACH_SYMBOL, TB_TYPE_PTR, 1, sizeof(TB_NodeMachSymbol));
+    set_input(f, n, f->root_node, 0);
+    TB_NODE_SET_EXTRA(n, TB_NodeMachSymbol, .sym = s);
+    return tb__gvn(f, n, sizeof(TB_NodeMachSymbol));
+}
+
+// only used to build up the portable fallbacks during isel, they'll get selected
+// as we walk into them.
+static TB_Node* isel_iconst(TB_Function* f, TB_DataType dt, uint64_t x) {
+    TB_Node* n = tb_alloc_node(f, TB_ICONST, dt, 1, sizeof(TB_NodeInt));
+    set_input(f, n, f->root_node, 0);
+    TB_NODE_SET_EXTRA(n, TB_NodeInt, .value = dt.data < 64 ? x & ((1ull << dt.data) - 1) : x);
+    return tb__gvn(f, n, sizeof(TB_NodeInt));
+}
+
+// ints smaller than 32bits have garbage up top, anything which reads the whole
+// register (compares, division, right shifts) extends them first.
+static TB_Node* isel_widen(TB_Function* f, TB_Node* n, bool is_signed) {
+    int bits = int_bits(f, n->dt);
+    if (bits >= 32) {
+        return n;
+    }
+
+    int64_t x;
+    if (get_iconst(f, n, &x)) {
+        return isel_iconst(f, TB_TYPE_I32, is_signed ? x : x & ((1ull << bits) - 1));
+    }
+
+    TB_Node* ext = tb_alloc_node(f, is_signed ? TB_SIGN_EXT : TB_ZERO_EXT, TB_TYPE_I32, 2, 0);
+    set_input(f, ext, n, 1);
+    return tb__gvn(f, ext, 0);
+}
+
+// the single input immediate forms (addimm, the logic ops & the constant shifts)
+static TB_Node* isel_imm(TB_Function* f, int type, TB_DataType dt, TB_DataType op_dt, TB_Node* src, int64_t imm) {
+    TB_Node* op = tb_alloc_node(f, type, dt, 2, sizeof(MipsOp));
+    set_input(f, op, src, 1);
+    TB_NODE_SET_EXTRA(op, MipsOp, .dt = op_dt, .imm = imm);
+    return op;
 }
 
-static int reg_count(Ctx* restrict ctx, TB_Node* n) {
-    if (n->dt.type == TB_TAG_INT) {
-        assert(n->dt.data <= 64);
-        return ctx->abi_index == 0 && n->dt.data > 32 ? 2 : 1;
-    } else if (n->dt.type == TB_TAG_PTR) {
-        return 1;
-    } else if (n->dt.type == TB_FLOAT) {
-        return 1;
+static TB_Node* isel_copy(Ctx* restrict ctx, TB_Function* f, TB_DataType dt, TB_Node* src) {
+    TB_Node* cpy = tb_alloc_node(f, TB_MACH_COPY, dt, 2, sizeof(TB_NodeMachCopy));
+    set_input(f, cpy, src, 1);
+    TB_NODE_SET_EXTRA(cpy, TB_NodeMachCopy, .def = normie_mask(ctx, dt), .use = normie_mask(ctx, src->dt));
+    return cpy;
+}
+
+// slt, sltu & the equality checks, LE is the inverse of a swapped LT unless it's
+// against a constant where x <= k is x < k+1.
+static TB_Node* isel_cmp(TB_Function* f, TB_Node* n) {
+    TB_DataType cmp_dt = TB_NODE_GET_EXTRA_T(n, TB_NodeCompare)->cmp_dt;
+    if (TB_IS_FLOAT_TYPE(cmp_dt)) {
+        tb_todo();
+    }
+
+    int type = n->type;
+    bool is_signed = type == TB_CMP_SLT || type == TB_CMP_SLE;
+    TB_Node* a = n->inputs[1];
+    TB_Node* b = n->inputs[2];
+    if (int_bits(f, cmp_dt) < 32) {
+        a = isel_widen(f, a, is_signed);
+        b = isel_widen(f, b, is_signed);
+        cmp_dt = TB_TYPE_I32;
+    }
+
+    TB_Node* op = tb_alloc_node(f, mips_cmp, n->dt, 3, sizeof(MipsOp));
+    MipsOp* op_extra = TB_NODE_GET_EXTRA(op);
+    op_extra->dt = cmp_dt;
+
+    int64_t x;
+    if (type == TB_CMP_EQ || type == TB_CMP_NE) {
+        op_extra->cmp = type == TB_CMP_EQ ? CMP_EQ : CMP_NE;
+        if (a->type == TB_ICONST && b->type != TB_ICONST) {
+            SWAP(TB_Node*, a, b);
+        }
+
+        // xori takes a zero extended immediate
+        if (get_iconst(f, b, &x) && fits_into_uint16(x)) {
+            op_extra->imm = x;
+            b = NULL;
+        }
     } else {
-        return 0;
+        op_extra->cmp = is_signed ? CMP_LT : CMP_LTU;
+        bool is_lt = type == TB_CMP_SLT || type == TB_CMP_ULT;
+        if (get_iconst(f, b, &x) && (is_lt ? fits_into_int16(x) : x >= INT16_MIN - 1 && x < INT16_MAX && (is_signed || x != -1))) {
+            op_extra->imm = is_lt ? x : x + 1;
+            b = NULL;
+        } else if (!is_lt) {
+            SWAP(TB_Node*, a, b);
+            op_extra->invert = true;
+        }
     }
+
+    set_input(f, op, a, 1);
+    set_input(f, op, b, 2);
+    return op;
 }
 
-#define OUT1(m) (dst->outs[0]->dt = n->dt, dst->outs[0]->mask = (m))
-static void isel_node(Ctx* restrict ctx, Tile* dst, TB_Node* n) {
-    switch (n->type) {
-        // 0-input normie ops
-        case TB_REGION:
-        case TB_NATURAL_LOOP:
-        case TB_AFFINE_LOOP:
-        case TB_REGION:
-        case TB_ROOT:
-        case TB_TRAP:
-        case TB_CALLGRAPH:
-        case TB_SPLITMEM:
-        case TB_MERGEMEM:
-        case TB_UNREACHABLE:
-        case TB_DEBUGBREAK:
-        case TB_ICONST:
-        break;
+// picks the branch for (a cmp b) being true, beq & bne compare two registers and
+// the sign tests work against zero. Anything else gets an slt which is tested
+// against zero.
+static int isel_branch_cmp(TB_Function* f, TB_Node* cmp, TB_Node** out_a, TB_Node** out_b) {
+    TB_DataType cmp_dt = TB_NODE_GET_EXTRA_T(cmp, TB_NodeCompare)->cmp_dt;
+    if (TB_IS_FLOAT_TYPE(cmp_dt)) {
+        tb_todo();
+    }
 
-        case TB_LOCAL:
-        try_init_stack_slot(ctx, n);
-        break;
+    TB_Node* a = cmp->inputs[1];
+    TB_Node* b = cmp->inputs[2];
+    int64_t x;
+    switch (cmp->type) {
+        case TB_CMP_EQ:
+        case TB_CMP_NE: {
+            a = isel_widen(f, a, false);
+            b = isel_widen(f, b, false);
+            if (a->type == TB_ICONST && b->type != TB_ICONST) {
+                SWAP(TB_Node*, a, b);
+            }
 
-        case TB_PHI:
-        if (n->dt.type == TB_TAG_INT || n->dt.type == TB_TAG_PTR || n->dt.type == TB_FLOAT) {
-            RegMask rm = normie_mask(ctx, n->dt);
-            rm.may_spill = true;
-            OUT1(rm);
+            *out_a = a;
+            *out_b = get_iconst(f, b, &x) && x == 0 ? NULL : b;
+            return cmp->type == TB_CMP_EQ ? BR_EQ : BR_NE;
         }
-        return;
 
-        case TB_PROJ: {
-            if (dst->out_count) {
-                RegMask rm = { 0 };
-                int i = TB_NODE_GET_EXTRA_T(n, TB_NodeProj)->index;
-
-                if (n->inputs[0]->type == TB_ROOT) {
-                    if (i == 2) {
-                        // RPC is the RA reg
-                        rm = REGMASK(GPR, 1u << RA);
-                    } else if (i >= 3) {
-                        rm = REGMASK(GPR, 1u << ((i - 3) + A0));
-                    }
-                } else if (n->inputs[0]->type == TB_CALL) {
-                    if (n->dt.type == TB_FLOAT) {
-                        tb_todo();
-                    } else if (i >= 2) {
-                        rm = REGMASK(GPR, 1 << (V0+i));
-                    }
-                } else if (n->inputs[0]->type == TB_BRANCH) {
-                } else if (n->inputs[0]->type == TB_SPLITMEM) {
-                } else {
-                    tb_todo();
-                }
+        case TB_CMP_SLT:
+        case TB_CMP_SLE: {
+            bool is_lt = cmp->type == TB_CMP_SLT;
+            if (get_iconst(f, b, &x) && x == 0) {
+                *out_a = isel_widen(f, a, true), *out_b = NULL;
+                return is_lt ? BR_LTZ : BR_LEZ;
+            } else if (get_iconst(f, a, &x) && x == 0) {
+                // 0 < b is b > 0
+                *out_a = isel_widen(f, b, true), *out_b = NULL;
+                return is_lt ? BR_GTZ : BR_GEZ;
+            }
+            break;
+        }
+
+        default: break;
+    }
+
+    *out_a = cmp, *out_b = NULL;
+    return BR_NE;
+}
 
-                OUT1(rm);
+// folds constant offsets into [base + disp], anything past 16bits stays in the base
+static void isel_addr(Ctx* restrict ctx, TB_Function* f, TB_Node* op, TB_Node* addr) {
+    int64_t disp = 0, x;
+    for (;;) {
+        if (addr->type == TB_PTR_OFFSET) {
+            // p[3] is an offset by (3 << 3)
+            TB_Node* index = addr->inputs[2];
+            if (index->type == TB_SHL && index->inputs[2]->type == TB_ICONST && get_iconst(f, index->inputs[1], &x)) {
+                x <<= TB_NODE_GET_EXTRA_T(index->inputs[2], TB_NodeInt)->value;
+            } else if (!get_iconst(f, index, &x)) {
+                break;
             }
-            return;
+        } else if (addr->type == mips_addimm && addr->inputs[1]->type != TB_MACH_FRAME_PTR) {
+            x = TB_NODE_GET_EXTRA_T(addr, MipsOp)->imm;
+        } else {
+            break;
         }
 
-        case TB_RETURN: {
-            int rets = (n->input_count - 3);
-            bool pair = false;
-            if (rets > 0 && is_regpair(ctx, n->inputs[3]->dt)) {
-                assert(rets == 1 && "At most 1 doubleword return :(");
-                pair = true;
-                rets = 2;
-            }
-
-            dst->ins = tb_arena_alloc(tmp_arena, (1+rets) * sizeof(TileInput));
-            dst->in_count = 1+rets;
-            dst->ins[0].mask = REGMASK(GPR, 1u << RA);
-            dst->ins[0].src = get_interval(ctx, n->inputs[2], 0);
-
-            if (pair) {
-                dst->ins[1].mask = REGMASK(GPR, 1u << V0);
-                dst->ins[1].src = get_interval(ctx, n->inputs[3], 0);
-                dst->ins[2].mask = REGMASK(GPR, 1u << V1);
-                dst->ins[2].src = get_interval(ctx, n->inputs[3], 1);
-            } else {
-                assert(rets <= 2 && "At most 2 return values :(");
-                if (rets >= 1) {
-                    dst->ins[1].mask = REGMASK(GPR, 1u << V0);
-                    dst->ins[1].src = get_interval(ctx, n->inputs[3], 0);
+        if (!fits_into_int16(disp + x)) {
+            break;
+        }
+        disp += x;
+        addr = addr->inputs[1];
+    }
+
+    // the frame offsets only get resolved at emit time, emit_ldst deals with them
+    // not fitting.
+    if (addr->type == TB_LOCAL) {
+        disp += TB_NODE_GET_EXTRA_T(addr, TB_NodeLocal)->stack_pos;
+        addr  = ctx->frame_ptr;
+    } else if (addr->type == mips_addimm && addr->inputs[1]->type == TB_MACH_FRAME_PTR) {
+        disp += TB_NODE_GET_EXTRA_T(addr, MipsOp)->imm;
+        addr  = ctx->frame_ptr;
+    }
+
+    TB_NODE_GET_EXTRA_T(op, MipsMemOp)->disp = disp;
+    set_input(f, op, addr, 2);
+}
+
+static uint32_t callee_saved_gprs(Ctx* restrict ctx) { return CALLEE_SAVED_GPRS; }
+
+static void add_to_exits(TB_Function* f, TB_Node* root, TB_Node* proj) {
+    FOR_N(i, 1, root->input_count) {
+        TB_Node* end = root->inputs[i];
+        if (end->type == TB_RETURN || end->type == TB_TAILCALL) {
+            add_input_late(f, end, proj);
+        }
+    }
+}
+
+static TB_Node* node_isel(Ctx* restrict ctx, TB_Function* f, TB_Node* n) {
+    if (n->type == TB_PROJ || n->type == TB_MACH_PROJ || n->type >= TB_MACH_MOVE) {
+        return n;
+    }
+
+    if (!ctx->abi_index && n->dt.type == TB_TAG_INT && n->dt.data > 32) {
+        tb_panic("mips32: 64bit ints aren't supported\n");
+    }
+
+    if (n->type == TB_ROOT) {
+        bool has_exit = false;
+        FOR_N(i, 1, n->input_count) {
+            has_exit |= n->inputs[i]->type == TB_RETURN || n->inputs[i]->type == TB_TAILCALL;
+        }
+
+        if (!has_exit) {
+            return n;
+        }
+
+        // add some callee-saved mach projections, every exit (returns & tailcalls)
+        // needs them back in place.
+        int j = 3 + f->prototype->param_count;
+        uint32_t callee_saved_gpr = callee_saved_gprs(ctx);
+        FOR_N(i, 0, ctx->num_regs[REG_CLASS_GPR]) {
+            if ((callee_saved_gpr >> i) & 1) {
+                RegMask* rm = intern_regmask(ctx, REG_CLASS_GPR, false, 1u << i);
+                TB_Node* proj = tb_alloc_node(f, TB_MACH_PROJ, TB_TYPE_PTR, 1, sizeof(TB_NodeMachProj));
+                TB_NODE_SET_EXTRA(proj, TB_NodeMachProj, .index = j++, .def = rm);
+
+                set_input(f, proj, n, 0);
+                add_to_exits(f, n, proj);
+            }
+        }
+
+        return n;
+    } else if (n->type == TB_PHI) {
+        if (TB_IS_SCALAR_TYPE(n->dt)) {
+            RegMask* rm = normie_mask(ctx, n->dt);
+
+            // same trick as x64, the phi gets a copy after it and moves on each
+            // of the data edges which RA will coalesce.
+            TB_Node* cpy = tb_alloc_node(f, TB_MACH_COPY, n->dt, 2, sizeof(TB_NodeMachCopy));
+            TB_NODE_SET_EXTRA(cpy, TB_NodeMachCopy, .def = rm, .use = rm);
+
+            subsume_node2(f, n, cpy);
+            set_input(f, cpy, n, 1);
+
+            FOR_N(i, 1, n->input_count) {
+                TB_Node* in = n->inputs[i];
+                assert(in->type != TB_MACH_MOVE);
+
+                TB_Node* move = tb_alloc_node(f, TB_MACH_MOVE, in->dt, 2, 0);
+                set_input(f, move, in, 1);
+                set_input(f, n, move, i);
+            }
+        }
+        return n;
+    } else if (n->type == TB_TRUNCATE && legalize_int(f, n->inputs[1]->dt) && !legalize_int(f, n->dt)) {
+        // sll by 0 sign extends the bottom half
+        return isel_imm(f, mips_sll, n->dt, TB_TYPE_I32, n->inputs[1], 0);
+    } else if (n->type == TB_BITCAST || n->type == TB_TRUNCATE) {
+        return isel_copy(ctx, f, n->dt, n->inputs[1]);
+    } else if (n->type == TB_ZERO_EXT || n->type == TB_SIGN_EXT) {
+        bool is_signed = n->type == TB_SIGN_EXT;
+        TB_Node* src = n->inputs[1];
+        int src_bits = int_bits(f, src->dt);
+
+        // single use loads can do the extension themselves
+        if (src->type == TB_LOAD && single_use(src)) {
+            TB_Node* op = tb_alloc_node(f, mips_ld, n->dt, 3, sizeof(MipsMemOp));
+            set_input(f, op, src->inputs[0], 0);
+            set_input(f, op, src->inputs[1], 1);
+            TB_NODE_SET_EXTRA(op, MipsMemOp, .mem_dt = src->dt, .sext = is_signed);
+            isel_addr(ctx, f, op, src->inputs[2]);
+            return op;
+        }
+
+        if (is_signed) {
+            if (src_bits >= 32) {
+                // already sign extended
+                return isel_copy(ctx, f, n->dt, src);
+            }
+
+            TB_Node* shl = isel_imm(f, mips_sll, TB_TYPE_I32, TB_TYPE_I32, src, 32 - src_bits);
+            return isel_imm(f, mips_sra, n->dt, TB_TYPE_I32, shl, 32 - src_bits);
+        } else if (is_compare(src)) {
+            // slt already leaves a clean 0 or 1
+            return isel_copy(ctx, f, n->dt, src);
+        } else if (src_bits <= 16) {
+            return isel_imm(f, mips_andimm, n->dt, TB_TYPE_I32, src, (1ull << src_bits) - 1);
+        } else if (src_bits < 32) {
+            TB_Node* shl = isel_imm(f, mips_sll, TB_TYPE_I32, TB_TYPE_I32, src, 32 - src_bits);
+            return isel_imm(f, mips_srl, n->dt, TB_TYPE_I32, shl, 32 - src_bits);
+        } else {
+            // clear the sign extended top half
+            TB_Node* shl = isel_imm(f, mips_sll, TB_TYPE_I64, TB_TYPE_I64, src, 32);
+            return isel_imm(f, mips_srl, n->dt, TB_TYPE_I64, shl, 32);
+        }
+    } else if (n->type == TB_LOCAL) {
+        // we don't directly ref the Local, this is the accessor op whenever we're
+        // not folding into some other op nicely.
+        TB_Node* op = isel_imm(f, mips_addimm, TB_TYPE_PTR, TB_TYPE_PTR, ctx->frame_ptr, TB_NODE_GET_EXTRA_T(n, TB_NodeLocal)->stack_pos);
+        subsume_node2(f, n, op);
+        return n;
+    } else if (n->type == TB_SYMBOL) {
+        TB_Symbol* sym = TB_NODE_GET_EXTRA_T(n, TB_NodeSymbol)->sym;
+        TB_Node* op = tb_alloc_node(f, mips_la, TB_TYPE_PTR, 2, 0);
+        subsume_node2(f, n, op);
+        set_input(f, op, mach_symbol(f, sym), 1);
+        return n;
+    } else if (n->type == TB_LOAD) {
+        TB_Node* op = tb_alloc_node(f, mips_ld, n->dt, 3, sizeof(MipsMemOp));
+        set_input(f, op, n->inputs[0], 0);
+        set_input(f, op, n->inputs[1], 1);
+        TB_NODE_SET_EXTRA(op, MipsMemOp, .mem_dt = n->dt);
+        isel_addr(ctx, f, op, n->inputs[2]);
+        return op;
+    } else if (n->type == TB_STORE) {
+        TB_Node* val = n->inputs[3];
+        TB_DataType mem_dt = val->dt;
+
+        // narrowing stores don't care about the top bits
+        if (val->type == TB_TRUNCATE && val->dt.type == TB_TAG_INT) {
+            val = val->inputs[1];
+        }
+
+        int64_t x;
+        if (get_iconst(f, val, &x) && x == 0) {
+            val = NULL;
+        }
+
+        TB_Node* op = tb_alloc_node(f, mips_st, TB_TYPE_MEMORY, 4, sizeof(MipsMemOp));
+        set_input(f, op, n->inputs[0], 0);
+        set_input(f, op, n->inputs[1], 1);
+        set_input(f, op, val, 3);
+        TB_NODE_SET_EXTRA(op, MipsMemOp, .mem_dt = mem_dt);
+        isel_addr(ctx, f, op, n->inputs[2]);
+        return op;
+    } else if ((n->type >= TB_AND && n->type <= TB_SUB) || n->type == TB_PTR_OFFSET) {
+        int type = n->type == TB_PTR_OFFSET ? TB_ADD : n->type;
+        TB_Node* a = n->inputs[1];
+        TB_Node* b = n->inputs[2];
+
+        // constants go on the right (sub can't do that)
+        if (type != TB_SUB && a->type == TB_ICONST && b->type != TB_ICONST) {
+            SWAP(TB_Node*, a, b);
+        }
+
+        int64_t x;
+        if (get_iconst(f, b, &x)) {
+            if (type == TB_ADD || type == TB_SUB) {
+                if (type == TB_SUB) { x = -(uint64_t) x; }
+                if (fits_into_int16(x)) {
+                    return isel_imm(f, mips_addimm, n->dt, n->dt, a, x);
                 }
+            } else if (type == TB_XOR && x == -1) {
+                // nor d, s, zero
+                return isel_imm(f, mips_xorimm, n->dt, n->dt, a, -1);
+            } else if (fits_into_uint16(x)) {
+                int op_type = type == TB_AND ? mips_andimm : type == TB_OR ? mips_orimm : mips_xorimm;
+                return isel_imm(f, op_type, n->dt, n->dt, a, x);
+            }
+        }
+
+        // 0 - x is neg
+        if (type == TB_SUB && get_iconst(f, a, &x) && x == 0) {
+            TB_Node* op = tb_alloc_node(f, TB_NEG, n->dt, 2, 0);
+            set_input(f, op, b, 1);
+            return op;
+        }
+
+        set_input(f, n, a, 1);
+        set_input(f, n, b, 2);
+        return n;
+    } else if (n->type >= TB_SHL && n->type <= TB_ROR && n->inputs[2]->type == TB_ICONST) {
+        int bits = int_bits(f, n->dt);
+        TB_DataType op_dt = legalize_int(f, n->dt) ? TB_TYPE_I64 : TB_TYPE_I32;
+        uint64_t k = TB_NODE_GET_EXTRA_T(n->inputs[2], TB_NodeInt)->value;
+        TB_Node* src = n->inputs[1];
 
-                if (rets >= 2) {
-                    dst->ins[2].mask = REGMASK(GPR, 1u << V1);
-                    dst->ins[2].src = get_interval(ctx, n->inputs[4], 0);
+        switch (n->type) {
+            case TB_SHL:
+            if (k >= bits) { return isel_iconst(f, n->dt, 0); }
+            return isel_imm(f, mips_sll, n->dt, op_dt, src, k);
+
+            case TB_SHR:
+            if (k >= bits) { return isel_iconst(f, n->dt, 0); }
+            return isel_imm(f, mips_srl, n->dt, op_dt, isel_widen(f, src, false), k);
+
+            case TB_SAR:
+            if (k >= bits) { k = bits - 1; }
+            return isel_imm(f, mips_sra, n->dt, op_dt, isel_widen(f, src, true), k);
+
+            case TB_ROL:
+            case TB_ROR: {
+                if (bits < 32) {
+                    tb_todo();
                 }
+
+                k &= bits - 1;
+                if (n->type == TB_ROL) { k = (bits - k) & (bits - 1); }
+                return isel_imm(f, mips_rotr, n->dt, op_dt, src, k);
             }
-            break;
+
+            default: tb_unreachable();
+        }
+    } else if (n->type >= TB_SHL && n->type <= TB_ROR) {
+        if ((n->type == TB_ROL || n->type == TB_ROR) && int_bits(f, n->dt) < 32) {
+            tb_todo();
         }
 
-        case TB_AND:
-        case TB_OR:
-        case TB_XOR:
-        case TB_ADD:
-        case TB_SUB:
-        case TB_MUL:
-        case TB_SAR:
-        case TB_SHL:
-        case TB_SHR: {
-            int32_t x;
-            if (n->type != TB_MUL && try_for_imm16(n->dt.data, n->inputs[2], &x)) {
-                tile_broadcast_ins(ctx, dst, n, 1, 2, ctx->normie_mask[REG_CLASS_GPR]);
-                dst->flags |= TILE_HAS_IMM;
-            } else {
-                tile_broadcast_ins(ctx, dst, n, 1, 3, ctx->normie_mask[REG_CLASS_GPR]);
+        // right shifts need a properly extended value
+        if (n->type == TB_SHR || n->type == TB_SAR) {
+            set_input(f, n, isel_widen(f, n->inputs[1], n->type == TB_SAR), 1);
+        }
+        return n;
+    } else if (n->type >= TB_UDIV && n->type <= TB_SMOD) {
+        bool is_signed = n->type == TB_SDIV || n->type == TB_SMOD;
+        set_input(f, n, isel_widen(f, n->inputs[1], is_signed), 1);
+        set_input(f, n, isel_widen(f, n->inputs[2], is_signed), 2);
+        return n;
+    } else if (n->type == TB_CLZ || n->type == TB_CTZ) {
+        int bits = int_bits(f, n->inputs[1]->dt);
+        if (bits < 32) {
+            TB_Node* src = isel_widen(f, n->inputs[1], false);
+            if (n->type == TB_CLZ) {
+                // clz on the zero extended value counts (32 - bits) too many
+                TB_Node* clz = tb_alloc_node(f, TB_CLZ, TB_TYPE_I32, 2, 0);
+                set_input(f, clz, src, 1);
+                return isel_imm(f, mips_addimm, TB_TYPE_I32, TB_TYPE_I32, clz, -(32 - bits));
             }
-            break;
+
+            set_input(f, n, src, 1);
+        }
+        return n;
+    } else if (n->type == TB_POPCNT) {
+        tb_todo();
+    } else if (is_compare(n)) {
+        return isel_cmp(f, n);
+    } else if (n->type == TB_SELECT) {
+        if (TB_IS_FLOAT_TYPE(n->dt)) {
+            tb_todo();
         }
 
-        // no rotate ops, we'll emulate it:
-        case TB_ROL:
-        case TB_ROR: {
-            int32_t x;
-            bool fits_16 = try_for_imm16(n->dt.data, n->inputs[2], &x);
-
-            dst->in_count = fits_16 ? 3 : 2;
-            dst->ins = tb_arena_alloc(tmp_arena, dst->in_count * sizeof(TileInput));
-            dst->ins[0].src = get_interval(ctx, n->inputs[1], 0);
-            dst->ins[0].mask = ctx->normie_mask[REG_CLASS_GPR];
-            dst->ins[1].src = NULL;
-            dst->ins[1].mask = ctx->normie_mask[REG_CLASS_GPR];
-            if (fits_16) {
-                dst->flags |= TILE_HAS_IMM;
-            } else {
-                dst->ins[2].src = get_interval(ctx, n->inputs[1], 0);
-                dst->ins[2].mask = ctx->normie_mask[REG_CLASS_GPR];
+        // movn/movz test the whole register
+        TB_Node* op = tb_alloc_node(f, mips_sel, n->dt, 4, sizeof(MipsOp));
+        set_input(f, op, isel_widen(f, n->inputs[1], false), 1);
+        set_input(f, op, n->inputs[2], 2);
+        set_input(f, op, n->inputs[3], 3);
+        TB_NODE_SET_EXTRA(op, MipsOp, .dt = n->dt);
+        return op;
+    } else if (n->type == TB_BRANCH || n->type == TB_AFFINE_LATCH) {
+        TB_Node* cond = n->inputs[1];
+        TB_NodeBranchProj* if_br = cfg_if_branch(n);
+        if (if_br == NULL) {
+            // switch, see switch_lower.h
+            n->type = mips_switch;
+            if (int_bits(f, cond->dt) < 32) {
+                switch_zext_keys(n, int_bits(f, cond->dt));
+            }
+            set_input(f, n, isel_widen(f, cond, false), 1);
+            return n;
+        }
+
+        TB_Node *a, *b = NULL;
+        int cc = BR_NE;
+        if (is_compare(cond)) {
+            cc = isel_branch_cmp(f, cond, &a, &b);
+
+            // the key is the condition for taking the default (index 0) edge
+            cc ^= (if_br->key != 0);
+        } else {
+            a = isel_widen(f, cond, false);
+            if (if_br->key != 0) {
+                b = isel_iconst(f, a->dt, if_br->key);
+            }
+        }
+
+        TB_Node* op = tb_alloc_node(f, mips_br, TB_TYPE_TUPLE, 3, sizeof(MipsOp));
+        set_input(f, op, n->inputs[0], 0);
+        set_input(f, op, a, 1);
+        set_input(f, op, b, 2);
+        TB_NODE_SET_EXTRA(op, MipsOp, .dt = a->dt, .cc = cc);
+        return op;
+    } else if (n->type == TB_CALL) {
+        TB_Node* op = tb_alloc_node(f, mips_call, n->dt, n->input_count, sizeof(MipsCall));
+        set_input(f, op, n->inputs[0], 0); // ctrl
+        set_input(f, op, n->inputs[1], 1); // mem
+        MipsCall* op_extra = TB_NODE_GET_EXTRA(op);
+
+        // check for static call
+        if (n->inputs[2]->type == TB_SYMBOL) {
+            op->type = mips_static_call;
+            op_extra->sym = TB_NODE_GET_EXTRA_T(n->inputs[2], TB_NodeSymbol)->sym;
+        } else {
+            set_input(f, op, n->inputs[2], 2);
+        }
+
+        op_extra->clobber_gpr = CALLER_SAVED_GPRS;
+
+        int stack_used = 0;
+        FOR_N(i, 3, n->input_count) {
+            if (TB_IS_FLOAT_TYPE(n->inputs[i]->dt)) {
+                tb_todo();
             }
+
+            stack_used += i - 3 >= param_reg_count(ctx);
+            set_input(f, op, n->inputs[i], i);
+        }
+
+        // outgoing stack params sit at the bottom of our frame, o32 always
+        // leaves 16 bytes for the callee to home a0-a3.
+        if (ctx->param_count + stack_used > ctx->num_regs[REG_CLASS_STK]) {
+            ctx->num_regs[REG_CLASS_STK] = ctx->param_count + stack_used;
+        }
+
+        int usage = ctx->abi_index ? stack_used*8 : 16 + stack_used*4;
+        if (usage > ctx->call_usage) {
+            ctx->call_usage = usage;
+        }
+
+        return op;
+    } else if (n->type == TB_TAILCALL) {
+        // static targets get a direct J
+        if (n->inputs[2]->type == TB_SYMBOL) {
+            TB_Symbol* sym = TB_NODE_GET_EXTRA_T(n->inputs[2], TB_NodeSymbol)->sym;
+            set_input(f, n, mach_symbol(f, sym), 2);
+        }
+        return n;
+    } else if (n->type == TB_VA_START) {
+        tb_todo();
+    }
+
+    return NULL;
+}
+
+// any cluster which isn't a single compare needs the index (and the bit test
+// or table base) in the temps.
+static bool switch_tmps(Ctx* restrict ctx, TB_Node* n) {
+    SwitchPlan* p = switch_get_plan(ctx, n);
+    FOR_N(i, 0, p->cluster_count) {
+        SwitchCluster* c = &p->clusters[i];
+        if (c->kind != SW_RANGE || c->lo != c->hi) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static int node_tmp_count(Ctx* restrict ctx, TB_Node* n) {
+    switch (n->type) {
+        case mips_switch:
+        return switch_tmps(ctx, n) ? 2 : 0;
+
+        case mips_call: case mips_static_call: {
+            MipsCall* op_extra = TB_NODE_GET_EXTRA(n);
+            return tb_popcount(op_extra->clobber_gpr);
+        }
+
+        // the byte loops walk a0, a1 & a2
+        case TB_MEMSET:
+        case TB_MEMCPY:
+        return 3;
+
+        default: return 0;
+    }
+}
+
+// exits (returns & tailcalls) keep the callee-saved registers pinned from the
+// entry projections, starting at ins[j].
+static void callee_saved_constraints(Ctx* restrict ctx, RegMask** ins, size_t j) {
+    uint32_t callee_saved_gpr = callee_saved_gprs(ctx);
+    FOR_N(i, 0, ctx->num_regs[REG_CLASS_GPR]) {
+        if ((callee_saved_gpr >> i) & 1) {
+            ins[j++] = intern_regmask(ctx, REG_CLASS_GPR, false, 1u << i);
+        }
+    }
+}
+
+static RegMask* node_constraint(Ctx* restrict ctx, TB_Node* n, RegMask** ins) {
+    switch (n->type) {
+        case TB_REGION:
+        case TB_SPLITMEM:
+        case TB_MERGEMEM:
+        case TB_TRAP:
+        case TB_UNREACHABLE:
+        case TB_DEBUGBREAK:
+        case TB_AFFINE_LOOP:
+        case TB_NATURAL_LOOP:
+        case TB_CALLGRAPH:
+        case TB_DEBUG_LOCATION:
+        if (ins) {
+            // region inputs are all control
+            FOR_N(i, 1, n->input_count) { ins[i] = &TB_REG_EMPTY; }
+        }
+        return &TB_REG_EMPTY;
+
+        case TB_POISON:
+        return normie_mask(ctx, n->dt);
+
+        case TB_LOCAL:
+        case TB_SYMBOL:
+        case TB_BRANCH_PROJ:
+        case TB_MACH_SYMBOL:
+        case TB_MACH_FRAME_PTR:
+        case TB_NEVER_BRANCH:
+        return &TB_REG_EMPTY;
+
+        case TB_MACH_COPY: {
+            TB_NodeMachCopy* move = TB_NODE_GET_EXTRA(n);
+            if (ins) { ins[1] = move->use; }
+            return move->def;
+        }
+
+        case TB_MACH_PROJ: {
+            return TB_NODE_GET_EXTRA_T(n, TB_NodeMachProj)->def;
+        }
+
+        case TB_MACH_MOVE: {
+            RegMask* rm = normie_mask(ctx, n->dt);
+            if (ins) { ins[1] = rm; }
+            return rm;
+        }
+
+        case TB_PHI: {
+            if (ins) {
+                FOR_N(i, 1, n->input_count) { ins[i] = &TB_REG_EMPTY; }
+            }
+
+            if (n->dt.type == TB_TAG_MEMORY) return &TB_REG_EMPTY;
+            return normie_mask(ctx, n->dt);
+        }
+
+        case TB_ICONST:
+        case TB_CYCLE_COUNTER:
+        return ctx->normie_mask[REG_CLASS_GPR];
+
+        case mips_la:
+        if (ins) { ins[1] = &TB_REG_EMPTY; }
+        return ctx->normie_mask[REG_CLASS_GPR];
+
+        case TB_SAFEPOINT_POLL: {
+            // only the poll address needs a register, the rest just needs to be alive
+            if (ins) {
+                FOR_N(i, 1, n->input_count) { ins[i] = &TB_REG_EMPTY; }
+                ins[2] = ctx->normie_mask[REG_CLASS_GPR];
+            }
+            return &TB_REG_EMPTY;
+        }
+
+        case TB_PROJ: {
+            if (n->dt.type == TB_TAG_MEMORY || n->dt.type == TB_TAG_CONTROL) {
+                return &TB_REG_EMPTY;
+            }
+
+            int i = TB_NODE_GET_EXTRA_T(n, TB_NodeProj)->index;
+            if (n->inputs[0]->type == TB_ROOT) {
+                assert(i >= 2);
+                if (i == 2) {
+                    // RPC is inaccessible for now
+                    return &TB_REG_EMPTY;
+                }
+
+                int param = i - 3;
+                if (param >= param_reg_count(ctx)) {
+                    return intern_regmask(ctx, REG_CLASS_STK, false, param - param_reg_count(ctx));
+                }
+                return intern_regmask(ctx, REG_CLASS_GPR, false, 1u << (A0 + param));
+            } else if (n->inputs[0]->type == mips_call || n->inputs[0]->type == mips_static_call) {
+                assert(i == 2 || i == 3);
+                return intern_regmask(ctx, REG_CLASS_GPR, false, 1u << (V0 + i - 2));
+            } else {
+                tb_todo();
+                return &TB_REG_EMPTY;
+            }
+        }
+
+        // GPR = OP(GPR, GPR)
+        case TB_AND: case TB_OR: case TB_XOR: case TB_ADD: case TB_SUB: case TB_PTR_OFFSET:
+        case TB_MUL:
+        case TB_SHL: case TB_SHR: case TB_SAR: case TB_ROL: case TB_ROR:
+        case TB_UDIV: case TB_SDIV: case TB_UMOD: case TB_SMOD:
+        {
+            RegMask* rm = ctx->normie_mask[REG_CLASS_GPR];
+            if (ins) { ins[1] = ins[2] = rm; }
+            return rm;
+        }
+
+        // GPR = OP(GPR)
+        case TB_NEG: case TB_BSWAP: case TB_CLZ: case TB_CTZ:
+        case mips_andimm: case mips_orimm: case mips_xorimm:
+        case mips_sll: case mips_srl: case mips_sra: case mips_rotr:
+        {
+            RegMask* rm = ctx->normie_mask[REG_CLASS_GPR];
+            if (ins) { ins[1] = rm; }
+            return rm;
+        }
+
+        case mips_addimm: {
+            RegMask* rm = ctx->normie_mask[REG_CLASS_GPR];
+            if (ins) { ins[1] = n->inputs[1]->type == TB_MACH_FRAME_PTR ? &TB_REG_EMPTY : rm; }
+            return rm;
+        }
+
+        // GPR = OP(GPR, GPR?)
+        case mips_cmp: {
+            RegMask* rm = ctx->normie_mask[REG_CLASS_GPR];
+            if (ins) {
+                ins[1] = rm;
+                ins[2] = n->inputs[2] ? rm : &TB_REG_EMPTY;
+            }
+            return rm;
+        }
+
+        case mips_sel: {
+            RegMask* rm = ctx->normie_mask[REG_CLASS_GPR];
+            if (ins) { ins[1] = ins[2] = ins[3] = rm; }
+            return rm;
+        }
+
+        case mips_br: {
+            if (ins) {
+                ins[1] = ctx->normie_mask[REG_CLASS_GPR];
+                ins[2] = n->inputs[2] ? ctx->normie_mask[REG_CLASS_GPR] : &TB_REG_EMPTY;
+            }
+            return &TB_REG_EMPTY;
+        }
+
+        case mips_switch: {
+            if (ins) {
+                if (switch_tmps(ctx, n)) {
+                    // the key is still needed after the temps are written, it can't alias them
+                    uint64_t tmps = (1u << T8) | (1u << T9);
+                    ins[1] = intern_regmask(ctx, REG_CLASS_GPR, false, ctx->normie_mask[REG_CLASS_GPR]->mask[0] & ~tmps);
+                    ins[2] = intern_regmask(ctx, REG_CLASS_GPR, false, 1u << T8);
+                    ins[3] = intern_regmask(ctx, REG_CLASS_GPR, false, 1u << T9);
+                } else {
+                    ins[1] = ctx->normie_mask[REG_CLASS_GPR];
+                }
+            }
+            return &TB_REG_EMPTY;
+        }
+
+        case mips_ld:
+        case mips_st: {
+            MipsMemOp* op = TB_NODE_GET_EXTRA(n);
+            if (ins) {
+                RegMask* rm = ctx->normie_mask[REG_CLASS_GPR];
+                ins[1] = &TB_REG_EMPTY;
+                ins[2] = n->inputs[2]->type == TB_MACH_FRAME_PTR ? &TB_REG_EMPTY : rm;
+                if (n->type == mips_st) {
+                    ins[3] = n->inputs[3] ? normie_mask(ctx, op->mem_dt) : &TB_REG_EMPTY;
+                }
+            }
+            return n->type == mips_st ? &TB_REG_EMPTY : normie_mask(ctx, n->dt);
+        }
+
+        case TB_MEMSET:
+        case TB_MEMCPY: {
+            if (ins) {
+                ins[1] = &TB_REG_EMPTY;
+                ins[2] = intern_regmask(ctx, REG_CLASS_GPR, false, 1u << A0);
+                ins[3] = intern_regmask(ctx, REG_CLASS_GPR, false, 1u << A1);
+                ins[4] = intern_regmask(ctx, REG_CLASS_GPR, false, 1u << A2);
+                ins[5] = intern_regmask(ctx, REG_CLASS_GPR, false, 1u << A0);
+                ins[6] = intern_regmask(ctx, REG_CLASS_GPR, false, 1u << A1);
+                ins[7] = intern_regmask(ctx, REG_CLASS_GPR, false, 1u << A2);
+            }
+            return &TB_REG_EMPTY;
+        }
+
+        case TB_RETURN: {
+            if (ins) {
+                ins[1] = &TB_REG_EMPTY; // mem
+                ins[2] = &TB_REG_EMPTY; // rpc
+
+                TB_FunctionPrototype* proto = ctx->f->prototype;
+                assert(proto->return_count <= 2 && "At most 2 return values :(");
+
+                FOR_N(i, 3, 3 + proto->return_count) {
+                    ins[i] = intern_regmask(ctx, REG_CLASS_GPR, false, 1u << (V0 + i - 3));
+                }
+
+                callee_saved_constraints(ctx, ins, 3 + proto->return_count);
+            }
+            return &TB_REG_EMPTY;
+        }
+
+        case TB_TAILCALL: {
+            if (ins) {
+                // the target can't be sitting in a param or callee-saved register
+                // since those get clobbered by the epilogue & the param moves.
+                uint32_t params = ((1u << param_reg_count(ctx)) - 1) << A0;
+                ins[1] = &TB_REG_EMPTY;
+                ins[2] = n->inputs[2]->type == TB_MACH_SYMBOL ? &TB_REG_EMPTY : intern_regmask(ctx, REG_CLASS_GPR, false, CALLER_SAVED_GPRS & ~params);
+
+                // the callee-saved inputs come after the params
+                int param_end = n->input_count - tb_popcount(callee_saved_gprs(ctx));
+                FOR_N(i, 3, param_end) {
+                    // tb_opt_tailcalls won't make tailcalls which need stack params
+                    assert(i - 3 < param_reg_count(ctx) && "tailcalls can't pass params on the stack");
+                    ins[i] = intern_regmask(ctx, REG_CLASS_GPR, false, 1u << (A0 + i - 3));
+                }
+
+                callee_saved_constraints(ctx, ins, param_end);
+            }
+            return &TB_REG_EMPTY;
+        }
+
+        case mips_static_call:
+        case mips_call: {
+            if (ins) {
+                ins[1] = &TB_REG_EMPTY;
+                ins[2] = n->type == mips_static_call ? &TB_REG_EMPTY : ctx->normie_mask[REG_CLASS_GPR];
+
+                int stack_used = 0;
+                FOR_N(i, 3, n->input_count) {
+                    if (i - 3 < param_reg_count(ctx)) {
+                        ins[i] = intern_regmask(ctx, REG_CLASS_GPR, false, 1u << (A0 + i - 3));
+                    } else {
+                        ins[i] = intern_regmask(ctx, REG_CLASS_STK, false, ctx->param_count + stack_used);
+                        stack_used += 1;
+                    }
+                }
+
+                size_t j = n->input_count;
+                MipsCall* op_extra = TB_NODE_GET_EXTRA(n);
+                for (uint64_t bits = op_extra->clobber_gpr, k = 0; bits; bits >>= 1, k++) {
+                    if (bits & 1) { ins[j++] = intern_regmask(ctx, REG_CLASS_GPR, false, 1u << k); }
+                }
+            }
+
+            // the tuple node doesn't itself produce the result
+            return &TB_REG_EMPTY;
+        }
+
+        default:
+        tb_todo();
+        return &TB_REG_EMPTY;
+    }
+}
+
+static int op_gpr_at(Ctx* ctx, TB_Node* n) {
+    assert(ctx->vreg_map[n->gvn] > 0);
+    VReg* vreg = &ctx->vregs[ctx->vreg_map[n->gvn]];
+    assert(vreg->assigned >= 0);
+    assert(vreg->class == REG_CLASS_GPR);
+    return vreg->assigned;
+}
+
+// NULL operands are ZR
+static int op_gpr_or_zr(Ctx* ctx, TB_Node* n) { return n ? op_gpr_at(ctx, n) : ZR; }
+
+static int stk_offset(Ctx* ctx, int reg) {
+    if (reg >= STACK_BASE_REG_NAMES) {
+        // spills (and locals) count down from the saved RA
+        return ctx->stack_usage - ((reg - STACK_BASE_REG_NAMES) + 1)*8;
+    } else if (reg >= ctx->param_count) {
+        // param passing slots, o32 skips the home space for a0-a3
+        int i = reg - ctx->param_count;
+        return ctx->abi_index ? i*8 : 16 + i*4;
+    } else {
+        // argument slots, they're in the caller's frame
+        return ctx->stack_usage + (ctx->abi_index ? reg*8 : 16 + reg*4);
+    }
+}
+
+// the table macros don't like div being a libc function
+#define div mips_div
+enum {
+    #define R(name, op, funct) name,
+    #define I(name, op)        name,
+    #define J(name, op)        name,
+    #define B(name, rt)        name,
+    #define S(name, funct, sa) name,
+    #include "mips_insts.inc"
+
+    INST_MAX,
+};
+
+static const uint32_t insts[INST_MAX] = {
+    #define R(name, op, funct) [name] = ((op<<26) | (funct)),
+    #define I(name, op)        [name] = (op<<26),
+    #define J(name, op)        [name] = (op<<26),
+    #define B(name, rt)        [name] = ((1<<26) | (rt<<16)),
+    #define S(name, funct, sa) [name] = ((0b011111<<26) | (sa<<6) | (funct)),
+    #include "mips_insts.inc"
+};
+
+static void jtype(TB_CGEmitter* e, int op, uint32_t imm) {
+    EMIT4(e, insts[op] | (imm & 0x3FFFFFF));
+}
+
+static void rtype(TB_CGEmitter* e, int op, uint32_t rd, uint32_t rs, uint32_t rt, uint32_t shamt) {
+    assert(op >= 0 && op < INST_MAX);
+    EMIT4(e, insts[op] | (rs<<21) | (rt<<16) | (rd<<11) | (shamt<<6));
+}
+
+static void itype(TB_CGEmitter* e, int op, uint32_t rt, uint32_t rs, uint32_t imm) {
+    assert(op >= 0 && op < INST_MAX);
+    EMIT4(e, insts[op] | (rs<<21) | (rt<<16) | (imm&0xFFFF));
+}
+
+// regimm, rt is the opcode
+static void btype(TB_CGEmitter* e, int op, uint32_t rs, uint32_t imm) {
+    EMIT4(e, insts[op] | (rs<<21) | (imm&0xFFFF));
+}
+
+// special3 bit shuffles (and rdhwr)
+static void stype(TB_CGEmitter* e, int op, uint32_t rd, uint32_t rt) {
+    EMIT4(e, insts[op] | (rt<<16) | (rd<<11));
+}
+
+// branches count in words from the delay slot
+static void tb_emit_rel16(TB_CGEmitter* restrict e, uint32_t* head, uint32_t pos) {
+    uint32_t curr = *head;
+    if (curr & 0x80000000) {
+        // the label target is resolved, we need to do the relocation now
+        uint32_t target = curr & 0x7FFFFFFF;
+        int32_t rel = ((int32_t) target - (int32_t) (pos + 4)) / 4;
+        assert(fits_into_int16(rel) && "branch out of range");
+        PATCH2(e, pos, rel);
+    } else {
+        PATCH2(e, pos, curr ? (pos - (curr - 4)) / 4 : 0);
+        *head = pos + 4;
+    }
+}
+
+static void tb_resolve_rel16(TB_CGEmitter* restrict e, uint32_t* head, uint32_t target) {
+    // walk previous relocations
+    uint32_t curr = *head;
+    while (curr != 0 && (curr & 0x80000000) == 0) {
+        uint32_t pos = curr - 4;
+
+        uint16_t link;
+        memcpy(&link, &e->data[pos], 2);
+        int32_t rel = ((int32_t) target - (int32_t) (pos + 4)) / 4;
+        assert(fits_into_int16(rel) && "branch out of range");
+        PATCH2(e, pos, rel);
+        curr = link ? (pos - link*4) + 4 : 0;
+    }
+
+    // store the target and mark it as resolved
+    *head = 0x80000000 | target;
+}
+
+// li, one instruction for the 16bit values, lui + ori for the 32bit ones & the
+// rest gets shifted in 16bits at a time.
+static void emit_loadimm(TB_CGEmitter* restrict e, GPR dst, int64_t x, bool is_64bit) {
+    if (!is_64bit) { x = (int32_t) x; }
+
+    if (fits_into_int16(x)) {
+        itype(e, addiu, dst, ZR, x);
+    } else if (fits_into_uint16(x)) {
+        itype(e, ori, dst, ZR, x);
+    } else if (x == (int32_t) x) {
+        itype(e, lui, dst, ZR, x >> 16);
+        if (x & 0xFFFF) {
+            itype(e, ori, dst, dst, x);
+        }
+    } else {
+        // the top bits first, then shift in the bottom 16
+        emit_loadimm(e, dst, x >> 16, true);
+        rtype(e, dsll, dst, ZR, dst, 16);
+        if (x & 0xFFFF) {
+            itype(e, ori, dst, dst, x);
+        }
+    }
+}
+
+// d = s + x, big immediates go through AT.
+static void emit_addimm_any(TB_CGEmitter* restrict e, GPR d, GPR s, int64_t x, bool is_64bit) {
+    if (fits_into_int16(x)) {
+        if (d != s || x != 0) {
+            itype(e, is_64bit ? daddiu : addiu, d, s, x);
+        }
+    } else {
+        emit_loadimm(e, AT, x, is_64bit);
+        rtype(e, is_64bit ? daddu : addu, d, s, AT, 0);
+    }
+}
+
+// t = [base + disp], the displacement goes through AT when it doesn't fit.
+static void emit_ldst(Ctx* restrict ctx, TB_CGEmitter* e, int op, GPR t, GPR base, int32_t disp) {
+    if (!fits_into_int16(disp)) {
+        emit_loadimm(e, AT, disp, false);
+        rtype(e, ctx->abi_index ? daddu : addu, AT, AT, base, 0);
+        base = AT, disp = 0;
+    }
+    itype(e, op, t, base, disp);
+}
+
+static int load_op(Ctx* restrict ctx, MipsMemOp* op, TB_DataType dt) {
+    int bits = int_bits(ctx->f, op->mem_dt);
+    if (bits <= 8) {
+        return op->sext ? lb : lbu;
+    } else if (bits <= 16) {
+        return op->sext ? lh : lhu;
+    } else if (bits <= 32) {
+        // plain 32bit loads are already in our sign extended form
+        return !op->sext && legalize_int(ctx->f, dt) ? lwu : lw;
+    } else {
+        return ld;
+    }
+}
+
+static int store_op(Ctx* restrict ctx, TB_DataType mem_dt) {
+    int bits = int_bits(ctx->f, mem_dt);
+    return bits <= 8 ? sb : bits <= 16 ? sh : bits <= 32 ? sw : sd;
+}
+
+static bool switch_has_table(Ctx* restrict ctx, TB_Node* n) {
+    SwitchPlan* p = switch_get_plan(ctx, n);
+    FOR_N(i, 0, p->cluster_count) {
+        if (p->clusters[i].kind == SW_TABLE) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// the frame is the outgoing args at the bottom, then the spills & locals with
+// the saved RA right at the top. Leaves don't get one at all.
+static void compute_frame(Ctx* restrict ctx) {
+    // calls & the jump tables (bal) clobber RA
+    bool needs_ra = false;
+    FOR_N(i, 0, ctx->bb_count) {
+        MachineBB* mbb = &ctx->machine_bbs[i];
+        aarray_for(k, mbb->items) {
+            TB_Node* n = mbb->items[k];
+            needs_ra |= n->type == mips_call || n->type == mips_static_call;
+            needs_ra |= n->type == mips_switch && switch_has_table(ctx, n);
+        }
+    }
+
+    ctx->stack_header = needs_ra ? 8 : 0;
+    if (needs_ra || ctx->num_spills > 1 || ctx->call_usage) {
+        ctx->stack_usage = align_up(ctx->num_spills*8 + ctx->call_usage, 16);
+    } else {
+        ctx->stack_usage = 0;
+    }
+}
+
+////////////////////////////////
+// Delay slots
+////////////////////////////////
+// every branch, jump & call runs the instruction after it before it lands. Once the
+// blocks are scheduled & allocated we look for something to put there:
+//
+//   * an instruction from the same block which the branch doesn't depend on, it's
+//     pulled out of the items & emitted right after the branch.
+//   * for jumps backwards (loop latches mostly), a copy of the target's first
+//     instruction and the jump lands right after it.
+//
+// anything else gets a nop. The fillers are keyed by the branching node or the
+// MachineBB for the jump at the end of a block (the implicit gotos & the second
+// half of a two-way branch), emit_delay_slot & emit_jump pick them up.
+enum {
+    // how many instructions we'll look back for a filler
+    DELAY_SLOT_WINDOW = 8,
+};
+
+typedef struct {
+    uint32_t reads, writes;
+    bool load, store;
+} SlotEffects;
+
+static bool emits_nothing(Ctx* restrict ctx, TB_Node* n) {
+    switch (n->type) {
+        case TB_PHI:
+        case TB_POISON:
+        case TB_REGION:
+        case TB_AFFINE_LOOP:
+        case TB_NATURAL_LOOP:
+        case TB_PROJ:
+        case TB_BRANCH_PROJ:
+        case TB_MACH_PROJ:
+        case TB_LOCAL:
+        case TB_SPLITMEM:
+        case TB_MERGEMEM:
+        case TB_MACH_SYMBOL:
+        case TB_MACH_FRAME_PTR:
+        case TB_CALLGRAPH:
+        return true;
+
+        case TB_MACH_MOVE:
+        case TB_MACH_COPY: {
+            VReg* dst = node_vreg(ctx, n);
+            VReg* src = node_vreg(ctx, n->inputs[1]);
+            return dst->assigned == src->assigned && dst->class == src->class;
+        }
+
+        case mips_addimm: {
+            if (n->inputs[1]->type == TB_MACH_FRAME_PTR) {
+                return false;
+            }
+            MipsOp* op = TB_NODE_GET_EXTRA(n);
+            return op->imm == 0 && op_gpr_at(ctx, n) == op_gpr_at(ctx, n->inputs[1]);
+        }
+
+        default:
+        return false;
+    }
+}
+
+// nothing moves across these
+static bool is_slot_barrier(TB_Node* n) {
+    switch (n->type) {
+        case mips_br: case mips_switch:
+        case mips_call: case mips_static_call:
+        case TB_RETURN: case TB_TAILCALL: case TB_NEVER_BRANCH:
+        case TB_MEMCPY: case TB_MEMSET:
+        case TB_TRAP: case TB_UNREACHABLE: case TB_DEBUGBREAK:
+        case TB_DEBUG_LOCATION: case TB_SAFEPOINT_POLL: case TB_CYCLE_COUNTER:
+        case TB_ATOMIC_LOAD: case TB_ATOMIC_XCHG: case TB_ATOMIC_ADD: case TB_ATOMIC_AND:
+        case TB_ATOMIC_XOR: case TB_ATOMIC_OR: case TB_ATOMIC_PTROFF: case TB_ATOMIC_CAS:
+        return true;
+
+        default:
+        return false;
+    }
+}
+
+// single instructions without a symbol patch, those are the only things
+// which fit in a slot.
+static bool fits_slot(Ctx* restrict ctx, TB_Node* n) {
+    switch (n->type) {
+        case TB_MACH_MOVE:
+        case TB_MACH_COPY: {
+            VReg* dst = node_vreg(ctx, n);
+            VReg* src = node_vreg(ctx, n->inputs[1]);
+            if (dst->class == REG_CLASS_STK) {
+                return fits_into_int16(stk_offset(ctx, dst->assigned));
+            } else if (src->class == REG_CLASS_STK) {
+                return fits_into_int16(stk_offset(ctx, src->assigned));
+            } else {
+                return true;
+            }
+        }
+
+        case TB_ICONST: {
+            int64_t x = TB_NODE_GET_EXTRA_T(n, TB_NodeInt)->value;
+            if (!legalize_int(ctx->f, n->dt)) { x = (int32_t) x; }
+            return fits_into_int16(x) || fits_into_uint16(x) || (x == (int32_t) x && (x & 0xFFFF) == 0);
+        }
+
+        case mips_addimm: {
+            MipsOp* op = TB_NODE_GET_EXTRA(n);
+            if (n->inputs[1]->type == TB_MACH_FRAME_PTR) {
+                return fits_into_int16(ctx->stack_usage + op->imm);
+            }
+            return true;
+        }
+
+        case mips_andimm: case mips_orimm: case mips_xorimm:
+        case mips_sll: case mips_srl: case mips_sra: case mips_rotr:
+        case TB_AND: case TB_OR: case TB_XOR: case TB_ADD: case TB_SUB: case TB_PTR_OFFSET:
+        case TB_NEG: case TB_SHL: case TB_SHR: case TB_SAR: case TB_ROR:
+        return true;
+
+        case TB_MUL:
+        return !legalize_int(ctx->f, n->dt);
+
+        case mips_cmp: {
+            MipsOp* op = TB_NODE_GET_EXTRA(n);
+            if (op->cmp == CMP_LT || op->cmp == CMP_LTU) {
+                return !op->invert;
+            }
+            // sltiu d, a, 1 or sltu d, zero, a
+            return n->inputs[2] == NULL && op->imm == 0;
+        }
+
+        case mips_ld:
+        case mips_st: {
+            MipsMemOp* op = TB_NODE_GET_EXTRA(n);
+            int32_t disp = op->disp;
+            if (n->inputs[2]->type == TB_MACH_FRAME_PTR) {
+                disp += ctx->stack_usage;
+            }
+            return fits_into_int16(disp);
+        }
+
+        case mips_sel: {
+            // one movn or movz
+            int dst = op_gpr_at(ctx, n);
+            return dst != op_gpr_at(ctx, n->inputs[1]) && (dst == op_gpr_at(ctx, n->inputs[2]) || dst == op_gpr_at(ctx, n->inputs[3]));
+        }
+
+        default:
+        return false;
+    }
+}
+
+static SlotEffects slot_effects(Ctx* restrict ctx, TB_Node* n) {
+    SlotEffects fx = { 0 };
+    VReg* def = node_vreg(ctx, n);
+    if (def && def->class == REG_CLASS_GPR) {
+        fx.writes |= 1u << def->assigned;
+    } else if (def && def->class == REG_CLASS_STK) {
+        fx.store = true;
+    }
+
+    FOR_N(i, 1, n->input_count) {
+        VReg* in = n->inputs[i] ? node_vreg(ctx, n->inputs[i]) : NULL;
+        if (in && in->class == REG_CLASS_GPR) {
+            fx.reads |= 1u << in->assigned;
+        } else if (in && in->class == REG_CLASS_STK) {
+            fx.load = true;
+        }
+    }
+
+    Tmps* tmps = nl_table_get(&ctx->tmps_map, n);
+    if (tmps) {
+        FOR_N(i, 0, tmps->count) {
+            VReg* tmp = &ctx->vregs[tmps->elems[i]];
+            if (tmp->class == REG_CLASS_GPR) {
+                fx.writes |= 1u << tmp->assigned;
+            }
+        }
+    }
+
+    fx.load  |= n->type == mips_ld;
+    fx.store |= n->type == mips_st;
+    fx.reads  &= ~(1u << ZR);
+    fx.writes &= ~(1u << ZR);
+    return fx;
+}
+
+// what the branch itself reads & writes, returns false if the slot isn't ours to fill.
+static bool branch_effects(Ctx* restrict ctx, TB_Node* n, SlotEffects* fx) {
+    *fx = (SlotEffects){ 0 };
+    switch (n->type) {
+        case mips_br: {
+            FOR_N(i, 1, 3) {
+                if (n->inputs[i]) { fx->reads |= 1u << op_gpr_at(ctx, n->inputs[i]); }
+            }
+            return true;
+        }
+
+        case mips_call:
+        fx->reads |= 1u << op_gpr_at(ctx, n->inputs[2]);
+        // fallthrough
+        case mips_static_call:
+        fx->writes |= 1u << RA;
+        return true;
+
+        // the stack teardown takes the slot if there's a frame
+        case TB_RETURN:
+        fx->reads |= 1u << RA;
+        return ctx->stack_usage == 0;
+
+        case TB_TAILCALL:
+        if (n->inputs[2]->type != TB_MACH_SYMBOL) {
+            fx->reads |= 1u << op_gpr_at(ctx, n->inputs[2]);
+        }
+        return ctx->stack_usage == 0;
+
+        default:
+        return false;
+    }
+}
+
+// can c be moved from before p to after it
+static bool slot_conflicts(SlotEffects* c, SlotEffects* p) {
+    return (c->writes & (p->reads | p->writes)) || (c->reads & p->writes) || (c->store && (p->load || p->store)) || (c->load && p->store);
+}
+
+// looks for something in items[0, end) which can move past everything up to the
+// branch, -1 if there's nothing.
+static ptrdiff_t find_delay_slot(Ctx* restrict ctx, MachineBB* mbb, ptrdiff_t end, SlotEffects* ctrl) {
+    SlotEffects passed = *ctrl;
+    for (ptrdiff_t i = end - 1, window = 0; i >= 0 && window < DELAY_SLOT_WINDOW; i--) {
+        TB_Node* n = mbb->items[i];
+        if (is_slot_barrier(n)) {
+            break;
+        } else if (emits_nothing(ctx, n)) {
+            continue;
+        }
+
+        SlotEffects fx = slot_effects(ctx, n);
+        if (fits_slot(ctx, n) && !slot_conflicts(&fx, &passed)) {
+            return i;
+        }
+
+        passed.reads  |= fx.reads;
+        passed.writes |= fx.writes;
+        passed.load   |= fx.load;
+        passed.store  |= fx.store;
+        window += 1;
+    }
+
+    return -1;
+}
+
+static void remove_item(MachineBB* mbb, ptrdiff_t i) {
+    size_t len = aarray_length(mbb->items);
+    memmove(&mbb->items[i], &mbb->items[i + 1], (len - (i + 1)) * sizeof(TB_Node*));
+    aarray_set_length(mbb->items, len - 1);
+}
+
+static TB_Node* first_emitted_item(Ctx* restrict ctx, MachineBB* mbb) {
+    aarray_for(i, mbb->items) {
+        if (!emits_nothing(ctx, mbb->items[i])) {
+            return mbb->items[i];
+        }
+    }
+    return NULL;
+}
+
+static void branch_succs(Ctx* restrict ctx, TB_Node* n, MachineBB* succ[2]) {
+    FOR_USERS(u, n) {
+        if (USERN(u)->type == TB_BRANCH_PROJ) {
+            int index = TB_NODE_GET_EXTRA_T(USERN(u), TB_NodeProj)->index;
+            succ[index] = node_to_bb(ctx, cfg_next_bb_after_cproj(USERN(u)));
+        }
+    }
+}
+
+// the unconditional jump at the end of the block (if there is one), that's the
+// implicit goto, a never branch or the second half of a two-way branch.
+static MachineBB* trailing_jump(Ctx* restrict ctx, MachineBB* mbb, int fallthrough) {
+    TB_Node* end = mbb->end_n;
+    MachineBB* succ = NULL;
+    if (!cfg_is_terminator(end)) {
+        succ = node_to_bb(ctx, cfg_next_control(end));
+    } else if (end->type == TB_NEVER_BRANCH) {
+        succ = node_to_bb(ctx, cfg_next_bb_after_cproj(USERN(proj_with_index(end, 0))));
+    } else if (end->type == mips_br) {
+        MachineBB* succs[2];
+        branch_succs(ctx, end, succs);
+        if (succs[0]->id != fallthrough) {
+            succ = succs[1];
+        }
+    }
+
+    return succ && succ->id != fallthrough ? succ : NULL;
+}
+
+static void post_ra_peephole(Ctx* restrict ctx) {
+    compute_frame(ctx);
+    ctx->delay_slots = nl_table_alloc(ctx->bb_count + 4);
+
+    FOR_N(i, 0, ctx->bb_count) {
+        MachineBB* mbb = &ctx->machine_bbs[i];
+        int fallthrough = i + 1 < ctx->bb_count ? ctx->machine_bbs[i + 1].id : INT_MAX;
+        bool has_jump = trailing_jump(ctx, mbb, fallthrough) != NULL;
+
+        // the implicit goto goes after everything
+        if (has_jump && !cfg_is_terminator(mbb->end_n)) {
+            SlotEffects none = { 0 };
+            ptrdiff_t k = find_delay_slot(ctx, mbb, aarray_length(mbb->items), &none);
+            if (k >= 0) {
+                nl_table_put(&ctx->delay_slots, mbb, mbb->items[k]);
+                remove_item(mbb, k);
+            }
+        }
+
+        for (ptrdiff_t j = aarray_length(mbb->items) - 1; j >= 0; j--) {
+            TB_Node* n = mbb->items[j];
+            void* key = n;
+
+            SlotEffects fx;
+            if (n->type == TB_NEVER_BRANCH) {
+                if (!has_jump) { continue; }
+                fx = (SlotEffects){ 0 };
+                key = mbb;
+            } else if (!branch_effects(ctx, n, &fx)) {
+                continue;
+            }
+
+            ptrdiff_t k = find_delay_slot(ctx, mbb, j, &fx);
+            if (k >= 0) {
+                nl_table_put(&ctx->delay_slots, key, mbb->items[k]);
+                remove_item(mbb, k);
+
+                // the branch moved down with it
+                j -= 1;
+            }
+        }
+    }
+
+    // the counters go right at the top of the loop headers, we'd skip them
+    if (ctx->f->counter) {
+        return;
+    }
+
+    // backwards jumps which are still empty can take a copy of the target's first
+    // instruction, the target is placed by then so emit_jump can check it's the same.
+    FOR_N(i, 0, ctx->bb_count) {
+        MachineBB* mbb = &ctx->machine_bbs[i];
+        int fallthrough = i + 1 < ctx->bb_count ? ctx->machine_bbs[i + 1].id : INT_MAX;
+        MachineBB* succ = trailing_jump(ctx, mbb, fallthrough);
+        if (succ == NULL || succ - ctx->machine_bbs > i || nl_table_get(&ctx->delay_slots, mbb)) {
+            continue;
+        }
+
+        TB_Node* first = first_emitted_item(ctx, succ);
+        if (first && !is_slot_barrier(first) && fits_slot(ctx, first)) {
+            nl_table_put(&ctx->delay_slots, mbb, first);
+        }
+    }
+}
+
+static TB_Node* delay_slot_filler(Ctx* restrict ctx, void* key) {
+    return ctx->delay_slots.data ? nl_table_get(&ctx->delay_slots, key) : NULL;
+}
+
+static void node_emit(Ctx* restrict ctx, TB_CGEmitter* e, TB_Node* n, VReg* vreg);
+
+static void emit_delay_slot(Ctx* restrict ctx, TB_CGEmitter* e, void* key) {
+    TB_Node* filler = delay_slot_filler(ctx, key);
+    ctx->ra_stats.delay_slots += 1;
+    if (filler) {
+        size_t pos = e->count;
+        node_emit(ctx, e, filler, node_vreg(ctx, filler));
+        assert(e->count == pos + 4 && "delay slot fillers are one instruction");
+        ctx->ra_stats.delay_slots_filled += 1;
+    } else {
+        EMIT4(e, 0); // nop
+    }
+}
+
+// the switch & friends have their own branches, nothing gets put in those.
+static void emit_slot_nop(Ctx* restrict ctx, TB_CGEmitter* e) {
+    ctx->ra_stats.delay_slots += 1;
+    EMIT4(e, 0);
+}
+
+static void emit_branch(TB_CGEmitter* e, int cc, GPR a, GPR b, uint32_t* label) {
+    size_t pos = e->count;
+    switch (cc) {
+        case BR_EQ:  itype(e, beq, b, a, 0); break;
+        case BR_NE:  itype(e, bne, b, a, 0); break;
+        case BR_LTZ: btype(e, bltz, a, 0); break;
+        case BR_GEZ: btype(e, bgez, a, 0); break;
+        case BR_LEZ: itype(e, blez, ZR, a, 0); break;
+        case BR_GTZ: itype(e, bgtz, ZR, a, 0); break;
+        default: tb_unreachable();
+    }
+    tb_emit_rel16(e, label, pos);
+}
+
+static bool has_patch_at(TB_CGEmitter* e, uint32_t pos) {
+    for (TB_SymbolPatch* p = e->output->first_patch; p; p = p->next) {
+        if (p->pos == pos) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// unconditional jump at the end of the current block
+static void emit_jump(Ctx* restrict ctx, TB_CGEmitter* e, MachineBB* succ) {
+    MachineBB* mbb = ctx->current_emit_bb;
+    TB_Node* filler = delay_slot_filler(ctx, mbb);
+    uint32_t label = e->labels[succ->id];
+
+    // the filler is a copy of the target's first instruction, we land after it. Anything
+    // with a symbol patch can't just be duplicated, the copy wouldn't get one.
+    if (filler && filler == first_emitted_item(ctx, succ)) {
+        assert((label & 0x80000000) && "copied delay slots are only for backwards jumps");
+        uint32_t target = label & 0x7FFFFFFF;
+        if (!has_patch_at(e, target)) {
+            size_t pos = e->count;
+            itype(e, beq, ZR, ZR, (int32_t) (target + 4 - (pos + 4)) / 4);
+            node_emit(ctx, e, filler, node_vreg(ctx, filler));
+            assert(e->count == pos + 8 && memcmp(&e->data[pos + 4], &e->data[target], 4) == 0);
+
+            ctx->ra_stats.delay_slots += 1;
+            ctx->ra_stats.delay_slots_filled += 1;
+            return;
+        }
+        filler = NULL;
+    }
+
+    size_t pos = e->count;
+    itype(e, beq, ZR, ZR, 0);
+    tb_emit_rel16(e, &e->labels[succ->id], pos);
+    if (filler) {
+        emit_delay_slot(ctx, e, mbb);
+    } else {
+        emit_slot_nop(ctx, e);
+    }
+}
+
+static void emit_goto(Ctx* ctx, TB_CGEmitter* e, MachineBB* succ) {
+    if (ctx->fallthrough != succ->id) {
+        emit_jump(ctx, e, succ);
+    }
+}
+
+////////////////////////////////
+// Switch lowering hooks (see switch_lower.h), AT is the scratch for the compares,
+// tmp[1] (t9) holds the index and tmp[0] (t8) the bit test mask or table base.
+////////////////////////////////
+static void switch_branch(Ctx* restrict ctx, TB_CGEmitter* e, int cc, GPR a, GPR b, uint32_t* label) {
+    emit_branch(e, cc, a, b, label);
+    emit_slot_nop(ctx, e);
+}
+
+// d = r < x (unsigned)
+static void switch_sltu(TB_CGEmitter* e, SwitchEmit* s, GPR d, GPR r, uint64_t x) {
+    int64_t sx = s->plan.is_64bit ? (int64_t) x : (int32_t) x;
+    if (fits_into_int16(sx)) {
+        itype(e, sltiu, d, r, sx);
+    } else {
+        emit_loadimm(e, AT, sx, s->plan.is_64bit);
+        rtype(e, sltu, d, r, AT, 0);
+    }
+}
+
+// tmp[1] = key - lo
+static void switch_index(TB_CGEmitter* e, SwitchEmit* s, uint64_t lo) {
+    emit_addimm_any(e, s->tmp[1], s->key, -(int64_t) lo, s->plan.is_64bit);
+}
+
+// jumps to miss when idx > max
+static void switch_miss(Ctx* restrict ctx, TB_CGEmitter* e, SwitchEmit* s, uint64_t max, uint32_t* miss) {
+    switch_sltu(e, s, AT, s->tmp[1], max + 1);
+    switch_branch(ctx, e, BR_EQ, AT, ZR, miss);
+}
+
+static void switch_cmp_branch(Ctx* restrict ctx, TB_CGEmitter* e, SwitchEmit* s, int cc, uint64_t x, uint32_t* label) {
+    if (cc == SW_EQ) {
+        GPR rhs = ZR;
+        if (x != 0) {
+            emit_loadimm(e, AT, x, s->plan.is_64bit);
+            rhs = AT;
+        }
+        switch_branch(ctx, e, BR_EQ, s->key, rhs, label);
+    } else if (cc == SW_LE) {
+        // key <= x is !(x < key)
+        emit_loadimm(e, AT, x, s->plan.is_64bit);
+        rtype(e, sltu, AT, AT, s->key, 0);
+        switch_branch(ctx, e, BR_EQ, AT, ZR, label);
+    } else {
+        // key >= x is !(key < x)
+        switch_sltu(e, s, AT, s->key, x);
+        switch_branch(ctx, e, BR_EQ, AT, ZR, label);
+    }
+}
+
+static void switch_range_branch(Ctx* restrict ctx, TB_CGEmitter* e, SwitchEmit* s, uint64_t lo, uint64_t hi, uint32_t* label) {
+    switch_index(e, s, lo);
+    switch_sltu(e, s, AT, s->tmp[1], hi - lo + 1);
+    switch_branch(ctx, e, BR_NE, AT, ZR, label);
+}
+
+static void switch_bit_test(Ctx* restrict ctx, TB_CGEmitter* e, SwitchEmit* s, SwitchCluster* c, uint32_t* miss) {
+    if (!ctx->abi_index) {
+        // the masks are 64bit
+        tb_todo();
+    }
+
+    switch_index(e, s, c->lo);
+    if (miss) {
+        switch_miss(ctx, e, s, c->hi - c->lo, miss);
+    }
+
+    FOR_N(i, 0, c->count) {
+        // the mask shifted down by the index has the answer in the bottom bit
+        emit_loadimm(e, s->tmp[0], c->masks[i], true);
+        rtype(e, dsrlv, s->tmp[0], s->tmp[1], s->tmp[0], 0);
+        itype(e, andi, s->tmp[0], s->tmp[0], 1);
+        switch_branch(ctx, e, BR_NE, s->tmp[0], ZR, switch_target_label(ctx, e, c->targets[i]));
+    }
+}
+
+static void switch_jump_table(Ctx* restrict ctx, TB_CGEmitter* e, SwitchEmit* s, SwitchCluster* c, uint32_t* miss) {
+    bool is_64bit = ctx->abi_index;
+    GPR base = s->tmp[0], idx = s->tmp[1];
+    switch_index(e, s, c->lo);
+    if (miss) {
+        switch_miss(ctx, e, s, c->count - 1, miss);
+    }
+
+    //    bal   1f
+    //    sll   idx, idx, 2
+    // 1: addiu base, ra, .jt - 1b
+    //    addu  idx, base, idx
+    //    lw    idx, 0(idx)
+    //    addu  base, base, idx
+    //    jr    base
+    //    nop
+    btype(e, bal, ZR, 1);
+    rtype(e, is_64bit ? dsll : sll, idx, ZR, idx, 2);
+    ctx->ra_stats.delay_slots += 1;
+    ctx->ra_stats.delay_slots_filled += 1;
+
+    switch_add_table(ctx, e->count, c);
+    itype(e, is_64bit ? daddiu : addiu, base, RA, 0);
+
+    // the entries are relative to the table
+    rtype(e, is_64bit ? daddu : addu, idx, base, idx, 0);
+    itype(e, lw, idx, idx, 0);
+    rtype(e, is_64bit ? daddu : addu, base, base, idx, 0);
+    rtype(e, jr, ZR, base, ZR, 0);
+    emit_slot_nop(ctx, e);
+}
+
+static void switch_jump(Ctx* restrict ctx, TB_CGEmitter* e, uint32_t* label) {
+    switch_branch(ctx, e, BR_EQ, ZR, ZR, label);
+}
+
+static void switch_bind(Ctx* restrict ctx, TB_CGEmitter* e, uint32_t* label) {
+    tb_resolve_rel16(e, label, e->count);
+}
+
+static void emit_two_way(Ctx* restrict ctx, TB_CGEmitter* e, TB_Node* n) {
+    MipsOp* op = TB_NODE_GET_EXTRA(n);
+
+    MachineBB* succ[2];
+    branch_succs(ctx, n, succ);
+
+    int cc = op->cc;
+    if (ctx->fallthrough == succ[0]->id) {
+        // if flipping avoids a jmp, do that
+        cc ^= 1;
+        SWAP(MachineBB*, succ[0], succ[1]);
+    }
+
+    emit_branch(e, cc, op_gpr_at(ctx, n->inputs[1]), op_gpr_or_zr(ctx, n->inputs[2]), &e->labels[succ[0]->id]);
+    emit_delay_slot(ctx, e, n);
+
+    if (ctx->fallthrough != succ[1]->id) {
+        emit_jump(ctx, e, succ[1]);
+    }
+}
+
+// restores RA & SP then jumps, the SP bump goes in the delay slot when it fits.
+static void emit_exit(Ctx* restrict ctx, TB_CGEmitter* e, TB_Node* n) {
+    bool is_64bit = ctx->abi_index;
+    int size = ctx->stack_usage;
+    if (ctx->stack_header) {
+        emit_ldst(ctx, e, is_64bit ? ld : lw, RA, SP, size - 8);
+    }
+
+    if (!fits_into_int16(size)) {
+        emit_addimm_any(e, SP, SP, size, is_64bit);
+        size = -1;
+    }
+
+    if (n->type == TB_RETURN) {
+        rtype(e, jr, ZR, RA, ZR, 0);
+    } else if (n->inputs[2]->type == TB_MACH_SYMBOL) {
+        TB_Symbol* sym = TB_NODE_GET_EXTRA_T(n->inputs[2], TB_NodeMachSymbol)->sym;
+        tb_emit_symbol_patch(e->output, sym, e->count);
+        jtype(e, j, 0);
+    } else {
+        rtype(e, jr, ZR, op_gpr_at(ctx, n->inputs[2]), ZR, 0);
+    }
+
+    if (size > 0) {
+        emit_addimm_any(e, SP, SP, size, is_64bit);
+        ctx->ra_stats.delay_slots += 1;
+        ctx->ra_stats.delay_slots_filled += 1;
+    } else if (size < 0) {
+        emit_slot_nop(ctx, e);
+    } else {
+        emit_delay_slot(ctx, e, n);
+    }
+}
+
+static void node_emit(Ctx* restrict ctx, TB_CGEmitter* e, TB_Node* n, VReg* vreg) {
+    switch (n->type) {
+        // some ops don't do shit lmao
+        case TB_PHI:
+        case TB_POISON:
+        case TB_REGION:
+        case TB_AFFINE_LOOP:
+        case TB_NATURAL_LOOP:
+        case TB_PROJ:
+        case TB_BRANCH_PROJ:
+        case TB_MACH_PROJ:
+        case TB_LOCAL:
+        case TB_SPLITMEM:
+        case TB_MERGEMEM:
+        case TB_MACH_SYMBOL:
+        case TB_MACH_FRAME_PTR:
+        case TB_CALLGRAPH:
+        break;
+
+        case TB_NEVER_BRANCH: {
+            TB_Node* proj0 = USERN(proj_with_index(n, 0));
+            TB_Node* succ_n = cfg_next_bb_after_cproj(proj0);
+            emit_goto(ctx, e, node_to_bb(ctx, succ_n));
+            break;
+        }
+
+        case TB_ICONST: {
+            uint64_t x = TB_NODE_GET_EXTRA_T(n, TB_NodeInt)->value;
+            emit_loadimm(e, op_gpr_at(ctx, n), x, legalize_int(ctx->f, n->dt));
+            break;
+        }
+
+        case TB_MACH_MOVE:
+        case TB_MACH_COPY: {
+            VReg* src_vreg = &ctx->vregs[ctx->vreg_map[n->inputs[1]->gvn]];
+            int dst = vreg->assigned, dst_class = vreg->class;
+            int src = src_vreg->assigned, src_class = src_vreg->class;
+            if (dst == src && dst_class == src_class) {
+                break;
+            }
+
+            COMMENT("%%%u = copy(%%%u)", n->gvn, n->inputs[1]->gvn);
+
+            // stack slots are always 8 bytes
+            bool is_64bit = ctx->abi_index;
+            if (dst_class == REG_CLASS_STK) {
+                assert(src_class != REG_CLASS_STK);
+                emit_ldst(ctx, e, is_64bit ? sd : sw, src, SP, stk_offset(ctx, dst));
+            } else if (src_class == REG_CLASS_STK) {
+                emit_ldst(ctx, e, is_64bit ? ld : lw, dst, SP, stk_offset(ctx, src));
+            } else {
+                rtype(e, or, dst, src, ZR, 0);
+            }
+            break;
+        }
+
+        case TB_CYCLE_COUNTER: {
+            // rdhwr rd, $2 (CC)
+            stype(e, rdhwr, 2, op_gpr_at(ctx, n));
+            break;
+        }
+
+        // unreachable blocks (like a switch's default when it can't happen) trap
+        // rather than running off into whatever comes next.
+        case TB_TRAP:
+        case TB_UNREACHABLE: {
+            rtype(e, teq, ZR, ZR, ZR, 0);
+            break;
+        }
+
+        case TB_DEBUGBREAK: {
+            EMIT4(e, 0x0000000D); // break
+            break;
+        }
+
+        // reads the poll page, when someone wants this thread to stop they protect
+        // the page and it'll fault here.
+        case TB_SAFEPOINT_POLL: {
+            itype(e, lw, ZR, op_gpr_at(ctx, n->inputs[2]), 0);
+            break;
+        }
+
+        // epilogue
+        case TB_RETURN: {
+            size_t pos = e->count;
+            emit_exit(ctx, e, n);
+            ctx->epilogue_length = e->count - pos;
+            break;
+        }
+
+        case TB_TAILCALL: {
+            emit_exit(ctx, e, n);
+            break;
+        }
+
+        case TB_AND:
+        case TB_OR:
+        case TB_XOR:
+        case TB_ADD:
+        case TB_SUB:
+        case TB_PTR_OFFSET: {
+            bool is_64bit = legalize_int(ctx->f, n->dt);
+            int op;
+            switch (n->type) {
+                case TB_AND: op = and; break;
+                case TB_OR:  op = or;  break;
+                case TB_XOR: op = xor; break;
+                case TB_SUB: op = is_64bit ? dsubu : subu; break;
+                default:     op = is_64bit ? daddu : addu; break;
+            }
+            rtype(e, op, op_gpr_at(ctx, n), op_gpr_at(ctx, n->inputs[1]), op_gpr_at(ctx, n->inputs[2]), 0);
+            break;
+        }
+
+        case TB_NEG: {
+            bool is_64bit = legalize_int(ctx->f, n->dt);
+            rtype(e, is_64bit ? dsubu : subu, op_gpr_at(ctx, n), ZR, op_gpr_at(ctx, n->inputs[1]), 0);
+            break;
+        }
+
+        case mips_addimm: {
+            MipsOp* op = TB_NODE_GET_EXTRA(n);
+            GPR dst = op_gpr_at(ctx, n);
+            if (n->inputs[1]->type == TB_MACH_FRAME_PTR) {
+                emit_addimm_any(e, dst, SP, ctx->stack_usage + op->imm, ctx->abi_index);
+            } else {
+                emit_addimm_any(e, dst, op_gpr_at(ctx, n->inputs[1]), op->imm, legalize_int(ctx->f, op->dt));
+            }
+            break;
+        }
+
+        case mips_andimm:
+        case mips_orimm:
+        case mips_xorimm: {
+            MipsOp* op = TB_NODE_GET_EXTRA(n);
+            GPR dst = op_gpr_at(ctx, n);
+            GPR src = op_gpr_at(ctx, n->inputs[1]);
+            if (op->imm == -1) {
+                rtype(e, nor, dst, src, ZR, 0);
+            } else {
+                int inst = n->type == mips_andimm ? andi : n->type == mips_orimm ? ori : xori;
+                itype(e, inst, dst, src, op->imm);
+            }
+            break;
+        }
+
+        case mips_sll:
+        case mips_srl:
+        case mips_sra:
+        case mips_rotr: {
+            static const int ops32[]  = { sll,    srl,    sra,    srl    };
+            static const int ops64[]  = { dsll,   dsrl,   dsra,   dsrl   };
+            static const int ops_hi[] = { dsll32, dsrl32, dsra32, dsrl32 };
+
+            MipsOp* op = TB_NODE_GET_EXTRA(n);
+            int i = n->type - mips_sll, k = op->imm;
+            int inst = !legalize_int(ctx->f, op->dt) ? ops32[i] : k >= 32 ? ops_hi[i] : ops64[i];
+            // rotr is srl with rs = 1
+            rtype(e, inst, op_gpr_at(ctx, n), n->type == mips_rotr, op_gpr_at(ctx, n->inputs[1]), k & 31);
+            break;
+        }
+
+        case mips_cmp: {
+            MipsOp* op = TB_NODE_GET_EXTRA(n);
+            GPR dst = op_gpr_at(ctx, n);
+            GPR a = op_gpr_at(ctx, n->inputs[1]);
+            TB_Node* b = n->inputs[2];
+            switch (op->cmp) {
+                case CMP_LT:
+                if (b) { rtype(e, slt, dst, a, op_gpr_at(ctx, b), 0); }
+                else   { itype(e, slti, dst, a, op->imm); }
+                break;
+
+                case CMP_LTU:
+                if (b) { rtype(e, sltu, dst, a, op_gpr_at(ctx, b), 0); }
+                else   { itype(e, sltiu, dst, a, op->imm); }
+                break;
+
+                case CMP_EQ:
+                case CMP_NE: {
+                    GPR src = a;
+                    if (b) {
+                        rtype(e, xor, dst, a, op_gpr_at(ctx, b), 0);
+                        src = dst;
+                    } else if (op->imm) {
+                        itype(e, xori, dst, a, op->imm);
+                        src = dst;
+                    }
+
+                    if (op->cmp == CMP_EQ) {
+                        itype(e, sltiu, dst, src, 1);
+                    } else {
+                        rtype(e, sltu, dst, ZR, src, 0);
+                    }
+                    break;
+                }
+            }
+
+            if (op->invert) {
+                itype(e, xori, dst, dst, 1);
+            }
+            break;
+        }
+
+        case mips_sel: {
+            GPR dst  = op_gpr_at(ctx, n);
+            GPR cond = op_gpr_at(ctx, n->inputs[1]);
+            GPR a    = op_gpr_at(ctx, n->inputs[2]);
+            GPR b    = op_gpr_at(ctx, n->inputs[3]);
+            if (dst == cond) {
+                rtype(e, or, AT, cond, ZR, 0);
+                cond = AT;
+            }
+
+            // movn d, s, c is d = c ? s : d
+            if (dst == a) {
+                rtype(e, movz, dst, b, cond, 0);
+            } else if (dst == b) {
+                rtype(e, movn, dst, a, cond, 0);
+            } else {
+                rtype(e, or, dst, b, ZR, 0);
+                rtype(e, movn, dst, a, cond, 0);
+            }
+            break;
+        }
+
+        case mips_la: {
+            // lui + daddiu with %hi & %lo relocations
+            TB_Symbol* sym = TB_NODE_GET_EXTRA_T(n->inputs[1], TB_NodeMachSymbol)->sym;
+            GPR dst = op_gpr_at(ctx, n);
+            tb_emit_symbol_patch(e->output, sym, e->count);
+            itype(e, lui, dst, ZR, 0);
+            tb_emit_symbol_patch(e->output, sym, e->count);
+            itype(e, ctx->abi_index ? daddiu : addiu, dst, dst, 0);
             break;
         }
 
-        case TB_SIGN_EXT:
-        case TB_ZERO_EXT: {
-            tile_broadcast_ins(ctx, dst, n, 1, n->input_count, ctx->normie_mask[REG_CLASS_GPR]);
+        case mips_br: {
+            emit_two_way(ctx, e, n);
             break;
         }
 
-        case TB_ARRAY_ACCESS: {
-            tile_broadcast_ins(ctx, dst, n, 1, n->input_count, ctx->normie_mask[REG_CLASS_GPR]);
+        case mips_switch: {
+            // the plan is cached so it has to be made outside of the labels' scratch
+            SwitchPlan* plan = switch_get_plan(ctx, n);
+            TB_Arena* arena = ctx->f->arena;
+            TB_ArenaSavepoint sp = tb_arena_save(arena);
+
+            // t8 & t9 are pinned as the temps whenever the plan needs them
+            SwitchEmit s = { *plan, arena, op_gpr_at(ctx, n->inputs[1]), { T8, T9 } };
+            switch_emit(ctx, e, &s);
+            tb_arena_restore(arena, sp);
             break;
         }
 
-        case TB_LOAD: {
-            TB_Node* base = n->inputs[2];
-            int16_t offset = 0;
+        case mips_ld:
+        case mips_st: {
+            MipsMemOp* op = TB_NODE_GET_EXTRA(n);
 
-            if (base->type == TB_MEMBER_ACCESS) {
-                uint64_t raw = TB_NODE_GET_EXTRA_T(n, TB_NodeMember)->offset;
-                if (fits_into_int16(raw)) {
-                    base = base->inputs[1];
-                    offset = raw;
-                }
+            GPR base;
+            int32_t disp = op->disp;
+            if (n->inputs[2]->type == TB_MACH_FRAME_PTR) {
+                base = SP;
+                disp += ctx->stack_usage;
+            } else {
+                base = op_gpr_at(ctx, n->inputs[2]);
             }
 
-            if (base->type == TB_LOCAL) {
-                try_init_stack_slot(ctx, base);
-
-                dst->ins = NULL;
-                dst->in_count = 0;
+            if (n->type == mips_st) {
+                emit_ldst(ctx, e, store_op(ctx, op->mem_dt), op_gpr_or_zr(ctx, n->inputs[3]), base, disp);
             } else {
-                dst->ins = tb_arena_alloc(tmp_arena, 1 * sizeof(TileInput));
-                dst->in_count = 1;
-                dst->ins[0].mask = ctx->normie_mask[REG_CLASS_GPR];
-                dst->ins[0].src = get_interval(ctx, base, 0);
+                emit_ldst(ctx, e, load_op(ctx, op, n->dt), op_gpr_at(ctx, n), base, disp);
             }
-
-            AuxAddress* aux = tb_arena_alloc(tmp_arena, sizeof(AuxAddress));
-            aux->base = base;
-            aux->offset = offset;
-            dst->aux = aux;
             break;
         }
 
-        case TB_STORE: {
-            TB_Node* base = n->inputs[2];
-            int16_t offset = 0;
-
-            if (base->type == TB_MEMBER_ACCESS) {
-                uint64_t raw = TB_NODE_GET_EXTRA_T(n, TB_NodeMember)->offset;
-                if (fits_into_int16(raw)) {
-                    base = base->inputs[1];
-                    offset = raw;
-                }
-            }
-
-            if (base->type == TB_LOCAL) {
-                try_init_stack_slot(ctx, base);
-
-                dst->ins = tb_arena_alloc(tmp_arena, 1 * sizeof(TileInput));
-                dst->in_count = 1;
+        case TB_MUL: {
+            GPR dst = op_gpr_at(ctx, n);
+            GPR lhs = op_gpr_at(ctx, n->inputs[1]);
+            GPR rhs = op_gpr_at(ctx, n->inputs[2]);
+            if (legalize_int(ctx->f, n->dt)) {
+                rtype(e, dmult, ZR, lhs, rhs, 0);
+                rtype(e, mflo, dst, ZR, ZR, 0);
             } else {
-                dst->ins = tb_arena_alloc(tmp_arena, 2 * sizeof(TileInput));
-                dst->in_count = 2;
-                dst->ins[1].mask = ctx->normie_mask[REG_CLASS_GPR];
-                dst->ins[1].src = get_interval(ctx, base, 0);
+                rtype(e, mul, dst, lhs, rhs, 0);
             }
-            dst->ins[0].mask = ctx->normie_mask[REG_CLASS_GPR];
-            dst->ins[0].src = get_interval(ctx, n->inputs[3], 0);
-
-            AuxAddress* aux = tb_arena_alloc(tmp_arena, sizeof(AuxAddress));
-            aux->base = base;
-            aux->offset = offset;
-            dst->aux = aux;
             break;
         }
 
-        case TB_CALL: {
-            uint32_t volatile_gprs = ((UINT32_MAX >> 7) << 1) & ~(0xFF << S0);
-            volatile_gprs |= 1u << RA;
-
-            int param_count = n->input_count - 3;
-            if (ctx->num_regs[0] < param_count) {
-                ctx->num_regs[0] = param_count;
-            }
+        case TB_UDIV:
+        case TB_SDIV:
+        case TB_UMOD:
+        case TB_SMOD: {
+            bool is_64bit = legalize_int(ctx->f, n->dt);
+            bool is_signed = n->type == TB_SDIV || n->type == TB_SMOD;
+            int op = is_64bit ? (is_signed ? ddiv : ddivu) : (is_signed ? div : divu);
+            rtype(e, op, ZR, op_gpr_at(ctx, n->inputs[1]), op_gpr_at(ctx, n->inputs[2]), 0);
+
+            // quotient in LO, remainder in HI
+            bool is_div = n->type == TB_UDIV || n->type == TB_SDIV;
+            rtype(e, is_div ? mflo : mfhi, op_gpr_at(ctx, n), ZR, ZR, 0);
+            break;
+        }
 
-            FOR_N(i, 0, param_count > 4 ? 4 : param_count) {
-                volatile_gprs &= ~(1u << (A0 + i));
+        case TB_SHL:
+        case TB_SHR:
+        case TB_SAR:
+        case TB_ROL:
+        case TB_ROR: {
+            static const int ops32[] = { sllv,  srlv,  srav,  srlv,  srlv  };
+            static const int ops64[] = { dsllv, dsrlv, dsrav, dsrlv, dsrlv };
+            bool is_64bit = legalize_int(ctx->f, n->dt);
+            GPR dst = op_gpr_at(ctx, n);
+            GPR lhs = op_gpr_at(ctx, n->inputs[1]);
+            GPR rhs = op_gpr_at(ctx, n->inputs[2]);
+            if (n->type == TB_ROL) {
+                // rotate left is a rotate right by the negated amount
+                rtype(e, subu, AT, ZR, rhs, 0);
+                rhs = AT;
             }
 
-            size_t clobber_count = tb_popcount(volatile_gprs);
-            size_t input_start = n->inputs[2]->type == TB_SYMBOL ? 3 : 2;
-            size_t input_count = (n->input_count - input_start) + clobber_count;
+            // rotrv is srlv with the shamt field set to 1
+            int i = n->type - TB_SHL;
+            rtype(e, is_64bit ? ops64[i] : ops32[i], dst, rhs, lhs, n->type >= TB_ROL);
+            break;
+        }
 
-            TileInput* ins;
-            if (n->inputs[2]->type == TB_SYMBOL) {
-                // CALL symbol
-                ins = dst->ins = tb_arena_alloc(tmp_arena, input_count * sizeof(TileInput));
-                dst->in_count = input_count;
+        case TB_BSWAP: {
+            int bits = int_bits(ctx->f, n->dt);
+            GPR dst = op_gpr_at(ctx, n);
+            GPR src = op_gpr_at(ctx, n->inputs[1]);
+            if (bits > 32) {
+                // swap the bytes in each halfword, then the halfwords
+                stype(e, dsbh, dst, src);
+                stype(e, dshd, dst, dst);
             } else {
-                // CALL r/m
-                ins = dst->ins = tb_arena_alloc(tmp_arena, input_count * sizeof(TileInput));
-                dst->in_count = input_count;
-
-                ins[0].src = get_interval(ctx, n->inputs[2], 0);
-                ins[0].mask = ctx->normie_mask[REG_CLASS_GPR];
-                ins += 1;
+                stype(e, wsbh, dst, src);
+                if (bits > 16) {
+                    rtype(e, srl, dst, 1, dst, 16); // rotr dst, dst, 16
+                }
             }
+            break;
+        }
 
-            FOR_N(i, 0, param_count) {
-                ins[i].src = get_interval(ctx, n->inputs[i + 3], 0);
+        case TB_CLZ: {
+            bool is_64bit = legalize_int(ctx->f, n->inputs[1]->dt);
+            GPR dst = op_gpr_at(ctx, n);
+            rtype(e, is_64bit ? dclz : clz, dst, op_gpr_at(ctx, n->inputs[1]), dst, 0);
+            break;
+        }
 
-                if (i < 4) {
-                    if (TB_IS_FLOAT_TYPE(n->inputs[i + 3]->dt)) {
-                        tb_todo();
-                    } else {
-                        ins[i].mask = REGMASK(GPR, 1u << (A0 + i));
-                    }
-                } else {
-                    // stack slots go into [RSP + 8i]
-                    ins[i].mask = REGMASK(STK, i);
-                }
-            }
+        case TB_CTZ: {
+            // ctz(x) = bits - clz(~x & (x - 1))
+            bool is_64bit = legalize_int(ctx->f, n->inputs[1]->dt);
+            GPR dst = op_gpr_at(ctx, n);
+            GPR src = op_gpr_at(ctx, n->inputs[1]);
+            itype(e, is_64bit ? daddiu : addiu, AT, src, -1);
+            rtype(e, nor, dst, src, ZR, 0);
+            rtype(e, and, dst, dst, AT, 0);
+            rtype(e, is_64bit ? dclz : clz, dst, dst, dst, 0);
+            itype(e, addiu, AT, ZR, is_64bit ? 64 : 32);
+            rtype(e, subu, dst, AT, dst, 0);
+            break;
+        }
 
-            int j = param_count;
-            FOR_N(i, 0, ctx->num_regs[1]) {
-                if (volatile_gprs & (1u << i)) {
-                    ins[j].src = NULL;
-                    ins[j].mask = REGMASK(GPR, 1u << i);
-                    j++;
-                }
-            }
+        case TB_MEMCPY: {
+            //    beq   a2, zero, 2f
+            //    nop
+            // 1: lbu   at, 0(a1)
+            //    addiu a1, a1, 1
+            //    sb    at, 0(a0)
+            //    addiu a2, a2, -1
+            //    bne   a2, zero, 1b
+            //    addiu a0, a0, 1
+            // 2:
+            int add = ctx->abi_index ? daddiu : addiu;
+            itype(e, beq, ZR, A2, 7);
+            EMIT4(e, 0);
+            itype(e, lbu, AT, A1, 0);
+            itype(e, add, A1, A1, 1);
+            itype(e, sb, AT, A0, 0);
+            itype(e, add, A2, A2, -1);
+            itype(e, bne, ZR, A2, -5);
+            itype(e, add, A0, A0, 1);
+            break;
+        }
 
-            assert(j == input_count - (n->inputs[2]->type != TB_SYMBOL));
-            return;
+        case TB_MEMSET: {
+            //    beq   a2, zero, 2f
+            //    nop
+            // 1: sb    a1, 0(a0)
+            //    addiu a2, a2, -1
+            //    bne   a2, zero, 1b
+            //    addiu a0, a0, 1
+            // 2:
+            int add = ctx->abi_index ? daddiu : addiu;
+            itype(e, beq, ZR, A2, 5);
+            EMIT4(e, 0);
+            itype(e, sb, A1, A0, 0);
+            itype(e, add, A2, A2, -1);
+            itype(e, bne, ZR, A2, -3);
+            itype(e, add, A0, A0, 1);
+            break;
         }
 
-        case TB_BRANCH: {
-            TB_Node* cmp = n->inputs[1];
-            TB_NodeBranch* br = TB_NODE_GET_EXTRA(n);
+        case mips_call: {
+            rtype(e, jalr, RA, op_gpr_at(ctx, n->inputs[2]), ZR, 0);
+            emit_delay_slot(ctx, e, n);
+            break;
+        }
 
-            if (br->succ_count > 2) {
-                tb_todo();
-            } else {
-                dst->ins = tb_arena_alloc(tmp_arena, 1 * sizeof(TileInput));
-                dst->in_count = 1;
-                dst->ins[0].src = get_interval(ctx, cmp, 0);
-                dst->ins[0].mask = ctx->normie_mask[REG_CLASS_GPR];
-            }
+        case mips_static_call: {
+            MipsCall* op_extra = TB_NODE_GET_EXTRA(n);
+            tb_emit_symbol_patch(e->output, op_extra->sym, e->count);
+            jtype(e, jal, 0);
+            emit_delay_slot(ctx, e, n);
             break;
         }
 
-        default: tb_todo();
-    }
+        case TB_DEBUG_LOCATION: {
+            TB_NodeDbgLoc* loc = TB_NODE_GET_EXTRA(n);
+            TB_Location l = {
+                .file = loc->file,
+                .line = loc->line,
+                .column = loc->column,
+                .pos = e->count
+            };
+            dyn_array_put(ctx->locations, l);
+            break;
+        }
 
-    if (dst->out_count == 1) {
-        dst->outs[0]->dt = n->dt;
-        dst->outs[0]->mask = normie_mask(ctx, n->dt);
-    } else if (dst->out_count == 2) {
-        dst->outs[0]->dt = TB_TYPE_I32;
-        dst->outs[0]->mask = normie_mask(ctx, n->dt);
-        dst->outs[1]->dt = TB_TYPE_I32;
-        dst->outs[1]->mask = normie_mask(ctx, n->dt);
-    } else if (dst->out_count != 0) {
+        default:
         tb_todo();
+        break;
     }
 }
 
-enum {
-    #define R(name, op, funct) name,
-    #define I(name, op)        name,
-    #define J(name, op)        name,
-    #include "mips_insts.inc"
+static uint64_t node_unit_mask(TB_Function* f, TB_Node* n) {
+    switch (n->type) {
+        case TB_MUL:
+        case TB_UDIV: case TB_SDIV: case TB_UMOD: case TB_SMOD:
+        return 1ull << FU_MDU;
 
-    INST_MAX,
-};
+        default:
+        return 1ull << FU_ALU;
+    }
+}
 
-#define __(t, op, ...) t ## type(e, op, __VA_ARGS__)
-#define COMMENT(...) (e->has_comments ? tb_emit_comment(e, tmp_arena, __VA_ARGS__) : (void)0)
+static int node_latency(TB_Function* f, TB_Node* n, TB_Node* end) {
+    switch (n->type) {
+        case TB_MACH_MOVE: return 0;
 
-static uint32_t insts[INST_MAX] = {
-    #define R(name, op, funct) [name] = ((op<<26) | (funct)),
-    #define I(name, op)        [name] = (op<<26),
-    #define J(name, op)        [name] = (op<<26),
-    #include "mips_insts.inc"
-};
+        case TB_MUL: return 5;
+        case TB_UDIV: case TB_SDIV: case TB_UMOD: case TB_SMOD: return 20;
 
-static void nop(TB_CGEmitter* e) {
-    EMIT4(e, 0);
-}
+        case mips_ld: return 2;
 
-static void jtype(TB_CGEmitter* e, int op, uint32_t imm) {
-    EMIT4(e, insts[op] | (imm & 0x3FFFFFF));
+        default: return 1;
+    }
 }
 
-static void rtype(TB_CGEmitter* e, int op, uint32_t rd, uint32_t rs, uint32_t rt, uint32_t shamt) {
-    assert(op >= 0 && op < INST_MAX);
-    EMIT4(e, insts[op] | (rs<<21) | (rt<<16) | (rd<<11) | (shamt<<6));
-}
+static int node_throughput(TB_Function* f, TB_Node* n) {
+    switch (n->type) {
+        case TB_UDIV: case TB_SDIV: case TB_UMOD: case TB_SMOD:
+        return 20;
 
-static void itype(TB_CGEmitter* e, int op, uint32_t rt, uint32_t rs, uint32_t imm) {
-    assert(op >= 0 && op < INST_MAX);
-    EMIT4(e, insts[op] | (rs<<21) | (rt<<16) | (imm&0xFFFF));
+        default: return 1;
+    }
 }
 
-static void tb_emit_rel16(TB_CGEmitter* restrict e, uint32_t* head, uint32_t pos) {
-    uint32_t curr = *head;
-    if (curr & 0x80000000) {
-        // the label target is resolved, we need to do the relocation now
-        uint32_t target = curr & 0x7FFFFFFF;
-        int32_t rel = target - (pos + 4);
-        PATCH2(e, pos+2, rel*4);
-    } else {
-        PATCH2(e, pos+2, curr);
-        *head = pos;
+static void pre_emit(Ctx* restrict ctx, TB_CGEmitter* e, TB_Node* root) {
+    TB_FunctionPrototype* proto = ctx->f->prototype;
+    bool is_64bit = ctx->abi_index;
+
+    //   [SP + N + K]    PARAM
+    //   [SP + N - 8]    saved RA
+    //   [SP + N - K*8]  LOCALS & SPILLS
+    //   [SP + K]        CALLEE PARAM
+    compute_frame(ctx);
+    if (ctx->stack_usage > 0) {
+        emit_addimm_any(e, SP, SP, -ctx->stack_usage, is_64bit);
     }
-}
 
-static void tb_resolve_rel16(TB_CGEmitter* restrict e, uint32_t* head, uint32_t target) {
-    // walk previous relocations
-    uint32_t curr = *head;
-    while (curr != 0 && (curr & 0x80000000) == 0) {
-        uint32_t next;
-        memcpy(&next, &e->data[curr], 4);
-        int32_t rel = target - (curr + 4);
-        PATCH2(e, curr+2, rel*4);
-        curr = next;
+    if (ctx->stack_header) {
+        emit_ldst(ctx, e, is_64bit ? sd : sw, RA, SP, ctx->stack_usage - 8);
     }
 
-    // store the target and mark it as resolved
-    *head = 0x80000000 | target;
-}
+    if (proto->has_varargs) {
+        // va_start isn't supported either
+        tb_todo();
+    }
 
-static void branch(TB_CGEmitter* e, int op, uint32_t rt, uint32_t rs, int id) {
-    assert(op == beq);
-    EMIT4(e, insts[op] | (rs<<21) | (rt<<16));
-    EMIT4(e, 0); // TODO(NeGate): delay slots
+    ctx->prologue_length = e->count;
+}
 
-    tb_emit_rel16(e, &e->labels[id], GET_CODE_POS(e) - 8);
+static void on_basic_block(Ctx* restrict ctx, TB_CGEmitter* e, int bb) {
+    tb_resolve_rel16(e, &e->labels[bb], e->count);
 }
 
-static void on_basic_block(Ctx* restrict ctx, TB_CGEmitter* e, int bbid) {
-    tb_resolve_rel16(e, &e->labels[bbid], e->count);
+static void emit_counter(Ctx* restrict ctx, TB_CGEmitter* e, TB_Symbol* counter) {
+    // the JIT doesn't run MIPS code
+    tb_todo();
 }
 
-static void loadimm(TB_CGEmitter* e, int dst, uint32_t imm) {
-    GPR curr = ZR;
-    if (imm >> 16ull) {
-        itype(e, lui, dst, curr, imm >> 16ull);
-        curr = dst;
+static void emit_nop_pad(Ctx* restrict ctx, TB_CGEmitter* e, size_t pad) {
+    for (size_t i = 0; i < pad; i += 4) {
+        EMIT4(e, 0); // nop
     }
+}
 
-    itype(e, ori, dst, curr, imm & 0xFFFF);
+static void patch_jump_table(Ctx* restrict ctx, TB_CGEmitter* e, uint32_t ref_pos, uint32_t table_pos) {
+    // addiu has a +-32KiB reach
+    int32_t disp = table_pos - ref_pos;
+    if (!fits_into_int16(disp)) {
+        tb_panic("mips: jump table out of addiu range (%d bytes)\n", disp);
+    }
+    PATCH2(e, ref_pos, disp);
 }
 
-static int stk_offset(Ctx* ctx, int reg) {
-    int pos = reg * ctx->stack_slot_size;
-    if (reg >= ctx->num_regs[0]) {
-        return (ctx->stack_usage - pos) + ctx->stack_slot_size;
-    } else {
-        return pos;
+static void post_emit(Ctx* restrict ctx, TB_CGEmitter* e) {
+    if (ctx->delay_slots.data) {
+        nl_table_free(ctx->delay_slots);
     }
 }
 
-static void pre_emit(Ctx* restrict ctx, TB_CGEmitter* e, TB_Node* n) {
-    // TODO(NeGate): optionally preserve the frame pointer
-    TB_FunctionPrototype* proto = ctx->f->prototype;
+typedef struct {
+    const char* name;
+    int id;
+} Op;
 
-    size_t stack_usage = (ctx->num_regs[0] + proto->param_count) * ctx->stack_slot_size;
-    ctx->stack_usage = stack_usage;
+static Op decode(uint32_t inst) {
+    int op = inst >> 26, funct = inst & 0b111111;
+    int rt = (inst >> 16) & 0b11111, sa = (inst >> 6) & 0b11111;
+    #define R(name, o, f)   if (op == o && funct == f) { return (Op){ #name, name }; }
+    #define I(name, o)      if (op == o) { return (Op){ #name, name }; }
+    #define J(name, o)      if (op == o) { return (Op){ #name, name }; }
+    #define B(name, r)      if (op == 1 && rt == r) { return (Op){ #name, name }; }
+    #define S(name, f, s)   if (op == 0b011111 && funct == f && sa == s) { return (Op){ #name, name }; }
+    #include "mips_insts.inc"
 
-    if (stack_usage > 0) {
-        __(i, addi, SP, SP, -stack_usage);
-    }
+    return (Op){ NULL, -1 };
+}
 
-    FOR_N(i, 0, dyn_array_length(ctx->callee_spills)) {
-        int pos = stk_offset(ctx, ctx->callee_spills[i].stk);
-        int rc = ctx->callee_spills[i].class;
-        assert(rc == REG_CLASS_GPR);
+#define E(fmt, ...) tb_asm_print(e, fmt, ## __VA_ARGS__)
+static void print_symbol(TB_CGEmitter* e, const TB_Symbol* target) {
+    if (target->name[0] == 0) {
+        E("sym%p", target);
+    } else {
+        E("%s", target->name);
+    }
+}
 
-        GPR src = ctx->callee_spills[i].reg;
-        __(i, sw, src, SP, stk_offset(ctx, pos));
+// nearest block label at or before the target
+static void print_branch_target(TB_CGEmitter* e, uint32_t target) {
+    int bb = -1;
+    uint32_t landed = 0;
+    FOR_N(i, 0, e->label_count) {
+        uint32_t l = e->labels[i];
+        if ((l & 0x80000000) && (l & 0x7FFFFFFF) <= target && (bb < 0 || (l & 0x7FFFFFFF) > landed)) {
+            bb = i, landed = l & 0x7FFFFFFF;
+        }
     }
 
-    ctx->prologue_length = ctx->emit.count;
+    if (bb < 0) {
+        E("%u", target);
+    } else if (landed != target) {
+        E(".bb%d + %d", bb, (int) target - (int) landed);
+    } else {
+        E(".bb%d", bb);
+    }
 }
 
-static GPR gpr_at(LiveInterval* l) { assert(l->class == REG_CLASS_GPR); return l->assigned; }
-static void emit_tile(Ctx* restrict ctx, TB_CGEmitter* e, Tile* t) {
-    if (t->tag == TILE_SPILL_MOVE) {
-        if (t->outs[0]->class == REG_CLASS_STK && t->ins[0].src->class == REG_CLASS_GPR) {
-            COMMENT("spill v%d -> v%d", t->outs[0]->id, t->ins[0].src->id);
-            GPR src = gpr_at(t->ins[0].src);
-            int dst = t->outs[0]->assigned;
-            itype(e, sw, src, SP, stk_offset(ctx, dst));
-        } else if (t->outs[0]->class == REG_CLASS_GPR && t->ins[0].src->class == REG_CLASS_STK) {
-            COMMENT("reload v%d -> v%d", t->outs[0]->id, t->ins[0].src->id);
-            GPR dst = gpr_at(t->outs[0]);
-            int src = t->ins[0].src->assigned;
-            itype(e, lw, dst, SP, stk_offset(ctx, src));
-        } else {
-            GPR dst = gpr_at(t->outs[0]);
-            GPR src = gpr_at(t->ins[0].src);
-            if (dst != src) {
-                rtype(e, or, dst, src, 0, 0);
-            }
+static void disasm_inst(TB_CGEmitter* e, Disasm* restrict d, const char** names, size_t pos, uint32_t inst) {
+    int rs = (inst >> 21) & 0b11111, rt = (inst >> 16) & 0b11111;
+    int rd = (inst >> 11) & 0b11111, sa = (inst >> 6) & 0b11111;
+    int16_t imm = inst & 0xFFFF;
+    uint32_t target = pos + 4 + imm*4;
+
+    // %hi/%lo & the calls
+    TB_Symbol* sym = NULL;
+    if (d->patch && d->patch->pos == pos) {
+        sym = d->patch->target;
+        d->patch = d->patch->next;
+    }
+
+    Op op = decode(inst);
+    if (inst == 0) {
+        E("  nop");
+        return;
+    } else if (inst == 0x0000000D) {
+        E("  break");
+        return;
+    } else if (op.name == NULL) {
+        E("  .word 0x%08x", inst);
+        return;
+    }
+
+    // the pseudo-ops
+    switch (op.id) {
+        case or:
+        if (rt == ZR) {
+            E("  move $%s, $%s", names[rd], names[rs]);
+            return;
         }
-    } else if (t->tag == TILE_GOTO) {
-        MachineBB* mbb = node_to_bb(ctx, t->succ);
-        if (ctx->fallthrough != mbb->id) {
-            branch(e, beq, ZR, ZR, mbb->id);
+        break;
+
+        case nor:
+        if (rt == ZR) {
+            E("  not $%s, $%s", names[rd], names[rs]);
+            return;
         }
-    } else {
-        TB_Node* n = t->n;
-        switch (n->type) {
-            // projections don't manage their own work, that's the
-            // TUPLE node's job.
-            case TB_PROJ:
-            case TB_REGION:
-            case TB_NATURAL_LOOP:
-            case TB_AFFINE_LOOP:
-            case TB_PHI:
-            case TB_ROOT:
-            case TB_POISON:
-            case TB_UNREACHABLE:
-            case TB_SPLITMEM:
-            case TB_MERGEMEM:
-            case TB_CALLGRAPH:
-            break;
-
-            case TB_RETURN: {
-                // return can run in parallel to the stack free
-                __(r, jr, 0, RA, 0, 0);
-                if (ctx->stack_usage > 0) {
-                    __(i, addi, SP, SP, ctx->stack_usage);
-                } else {
-                    nop(e);
-                }
-                break;
-            }
+        break;
 
-            case TB_BRANCH: {
-                GPR src = gpr_at(t->ins[0].src);
-                __debugbreak();
-                // branch(e, beq, src, ZR, 0);
-                // branch(e, beq, src, ZR, mbb->id);
-                break;
-            }
+        case subu: case dsubu:
+        if (rs == ZR) {
+            E("  %s $%s, $%s", op.id == subu ? "negu" : "dnegu", names[rd], names[rt]);
+            return;
+        }
+        break;
 
-            case TB_CALL: {
-                if (n->inputs[2]->type == TB_SYMBOL) {
-                    TB_Symbol* sym = TB_NODE_GET_EXTRA_T(n->inputs[2], TB_NodeSymbol)->sym;
+        case srl: case dsrl: case dsrl32:
+        if (rs == 1) {
+            E("  %s $%s, $%s, %d", op.id == srl ? "rotr" : op.id == dsrl ? "drotr" : "drotr32", names[rd], names[rt], sa);
+            return;
+        }
+        break;
 
-                    __(j, jal, 0);
-                    tb_emit_symbol_patch(e->output, sym, e->count - 4);
-                } else {
-                    tb_todo();
-                }
-                nop(e); // TODO(NeGate): delay slots
-                break;
-            }
+        case srlv: case dsrlv:
+        if (sa == 1) {
+            E("  %s $%s, $%s, $%s", op.id == srlv ? "rotrv" : "drotrv", names[rd], names[rt], names[rs]);
+            return;
+        }
+        break;
 
-            case TB_LOAD: {
-                AuxAddress* aux = t->aux;
-                GPR dst  = gpr_at(t->outs[0]);
-                int32_t offset = aux->offset;
+        case beq:
+        if (rs == ZR && rt == ZR) {
+            E("  b ");
+            print_branch_target(e, target);
+            return;
+        }
+        // fallthrough
+        case bne:
+        if (rt == ZR) {
+            E("  %s $%s, ", op.id == beq ? "beqz" : "bnez", names[rs]);
+            print_branch_target(e, target);
+            return;
+        }
+        break;
 
-                GPR base;
-                if (aux->base->type == TB_LOCAL) {
-                    offset += get_stack_slot(ctx, aux->base);
-                    base = SP;
-                } else {
-                    base = gpr_at(t->ins[0].src);
-                }
-                itype(e, lw, dst, base, offset);
-                break;
-            }
+        case addiu: case daddiu: case ori:
+        if (sym) {
+            E("  %s $%s, $%s, %%lo(", op.name, names[rt], names[rs]);
+            print_symbol(e, sym);
+            E(")");
+            return;
+        } else if (rs == ZR) {
+            E("  li $%s, %d", names[rt], op.id == ori ? (uint16_t) imm : imm);
+            return;
+        }
+        break;
 
-            case TB_STORE: {
-                AuxAddress* aux = t->aux;
-                GPR src = gpr_at(t->ins[0].src);
-                int32_t offset = aux->offset;
+        case lui:
+        if (sym) {
+            E("  lui $%s, %%hi(", names[rt]);
+            print_symbol(e, sym);
+            E(")");
+        } else {
+            E("  lui $%s, 0x%x", names[rt], (uint16_t) imm);
+        }
+        return;
 
-                GPR base;
-                if (aux->base->type == TB_LOCAL) {
-                    offset += get_stack_slot(ctx, aux->base);
-                    base = SP;
-                } else {
-                    base = gpr_at(t->ins[1].src);
-                }
-                itype(e, sw, src, base, offset);
-                break;
-            }
+        case jalr:
+        if (rd == RA) {
+            E("  jalr $%s", names[rs]);
+            return;
+        }
+        break;
 
-            case TB_LOCAL: {
-                GPR dst = gpr_at(t->outs[0]);
-                int pos = get_stack_slot(ctx, n);
-                itype(e, addi, dst, SP, pos);
-                break;
-            }
+        default: break;
+    }
 
-            case TB_ICONST: {
-                GPR dst = gpr_at(t->outs[0]);
-                uint64_t imm = TB_NODE_GET_EXTRA_T(n, TB_NodeInt)->value;
+    switch (op.id) {
+        case sll: case srl: case sra:
+        case dsll: case dsrl: case dsra: case dsll32: case dsrl32: case dsra32:
+        E("  %s $%s, $%s, %d", op.name, names[rd], names[rt], sa);
+        break;
 
-                loadimm(e, dst, imm);
-                if (t->out_count == 2) {
-                    GPR dst2 = gpr_at(t->outs[1]);
-                    loadimm(e, dst2, imm >> 32ull);
-                }
-                break;
-            }
+        case sllv: case srlv: case srav: case dsllv: case dsrlv: case dsrav:
+        E("  %s $%s, $%s, $%s", op.name, names[rd], names[rt], names[rs]);
+        break;
 
-            case TB_ARRAY_ACCESS: {
-                intptr_t offset = (intptr_t) t->aux;
-                GPR dst  = gpr_at(t->outs[0]);
-                GPR base = gpr_at(t->ins[0].src);
-                GPR idx  = gpr_at(t->ins[1].src);
-                int64_t stride = TB_NODE_GET_EXTRA_T(n, TB_NodeArray)->stride;
+        case mfhi: case mflo:
+        E("  %s $%s", op.name, names[rd]);
+        break;
 
-                uint64_t log2 = tb_ffs(stride) - 1;
-                if (UINT64_C(1) << log2 == stride) {
-                    rtype(e, sll, dst, 0, idx, log2);
-                } else {
-                    tb_todo();
-                }
-                rtype(e, add, dst, base, offset, 0);
-                break;
-            }
+        case div: case divu: case dmult: case ddiv: case ddivu: case teq:
+        E("  %s $%s, $%s", op.name, names[rs], names[rt]);
+        break;
 
-            case TB_AND:
-            case TB_OR:
-            case TB_XOR:
-            case TB_ADD:
-            case TB_SUB:
-            case TB_MUL: {
-                const static int rops[] = { and,  or,  xor,  add,  sub,  mul };
-                const static int iops[] = { andi, ori, xori, addi, addi, -1  };
-
-                GPR dst = gpr_at(t->outs[0]);
-                GPR lhs = gpr_at(t->ins[0].src);
-                if (t->flags & TILE_HAS_IMM) {
-                    assert(n->inputs[2]->type == TB_ICONST);
-                    uint64_t i = TB_NODE_GET_EXTRA_T(n->inputs[2], TB_NodeInt)->value;
-                    if (n->type == TB_SUB) {
-                        // no SUBI, we just negate and do ADDI
-                        i = -i;
-                    }
+        case jr:
+        E("  jr $%s", names[rs]);
+        break;
 
-                    itype(e, iops[n->type - TB_AND], dst, lhs, i);
-                } else {
-                    GPR rhs = gpr_at(t->ins[1].src);
-                    rtype(e, rops[n->type - TB_AND], dst, lhs, rhs, 0);
-                }
-                break;
-            }
+        case jalr:
+        E("  jalr $%s, $%s", names[rd], names[rs]);
+        break;
 
-            case TB_ZERO_EXT:
-            case TB_SIGN_EXT: {
-                GPR dst = gpr_at(t->outs[0]);
-                GPR src = gpr_at(t->ins[0].src);
-                int op = n->type == TB_SIGN_EXT ? sra : srl;
+        case clz: case dclz:
+        E("  %s $%s, $%s", op.name, names[rd], names[rs]);
+        break;
 
-                int32_t x = 64;
-                int32_t y = x - bits_in_type(ctx, n->dt);
-                rtype(e, sll, dst, 0, src, x);
-                rtype(e, op,  dst, 0, src, y);
-                break;
-            }
+        case wsbh: case dsbh: case dshd:
+        E("  %s $%s, $%s", op.name, names[rd], names[rt]);
+        break;
 
-            case TB_SAR:
-            case TB_SHL:
-            case TB_SHR: {
-                const static int rops[] = { sllv, srlv, srav };
-                const static int iops[] = { sll,  srl,  sra  };
-
-                GPR dst = gpr_at(t->outs[0]);
-                GPR lhs = gpr_at(t->ins[0].src);
-                if (t->flags & TILE_HAS_IMM) {
-                    assert(n->inputs[2]->type == TB_ICONST);
-                    uint64_t x = TB_NODE_GET_EXTRA_T(n->inputs[2], TB_NodeInt)->value;
-                    rtype(e, iops[n->type - TB_SHL], dst, 0, lhs, x);
-                } else {
-                    GPR rhs = gpr_at(t->ins[1].src);
-                    rtype(e, rops[n->type - TB_SHL], dst, lhs, rhs, 0);
-                }
-                break;
-            }
+        case rdhwr:
+        E("  rdhwr $%s, $%d", names[rt], rd);
+        break;
 
-            case TB_ROL: {
-                GPR dst = gpr_at(t->outs[0]);
-                GPR src = gpr_at(t->ins[0].src);
-                GPR tmp = gpr_at(t->ins[1].src);
+        case bltz: case bgez: case blez: case bgtz:
+        E("  %s $%s, ", op.name, names[rs]);
+        print_branch_target(e, target);
+        break;
 
-                if (t->flags & TILE_HAS_IMM) {
-                    assert(n->inputs[2]->type == TB_ICONST);
-                    uint64_t x = TB_NODE_GET_EXTRA_T(n->inputs[2], TB_NodeInt)->value;
+        case bal:
+        E("  bal ");
+        print_branch_target(e, target);
+        break;
 
-                    int32_t y = 32 - x;
-                    rtype(e, sll, tmp, 0, src, x);   //   sll     tmp,src,X
-                    rtype(e, srl, dst, 0, src, y);   //   srl     dst,src,Y
-                    rtype(e, or,  dst, dst, tmp, 0); //   or      dst,dst,tmp
-                } else {
-                    tb_todo();
-                }
-                break;
-            }
+        case beq: case bne:
+        E("  %s $%s, $%s, ", op.name, names[rs], names[rt]);
+        print_branch_target(e, target);
+        break;
 
-            default: tb_todo();
-        }
-    }
-}
+        case andi: case ori: case xori:
+        E("  %s $%s, $%s, 0x%x", op.name, names[rt], names[rs], (uint16_t) imm);
+        break;
 
-static void post_emit(Ctx* restrict ctx, TB_CGEmitter* e) {
-}
+        case addiu: case daddiu: case slti: case sltiu:
+        E("  %s $%s, $%s, %d", op.name, names[rt], names[rs], imm);
+        break;
 
-typedef struct {
-    const char* name;
-    int op;
-    enum { ITYPE, RTYPE, JTYPE } family;
-} Op;
+        case lb: case lh: case lw: case lbu: case lhu: case lwu: case ld:
+        case sb: case sh: case sw: case sd:
+        E("  %s $%s, %d($%s)", op.name, names[rt], imm, names[rs]);
+        break;
 
-static Op decode(uint32_t inst) {
-    #define R(name, op, funct) if ((inst >> 26) == op && (inst & 0b111111) == funct) { return (Op){ #name, name, RTYPE }; }
-    #define I(name, op)        if ((inst >> 26) == op) { return (Op){ #name, name, ITYPE }; }
-    #define J(name, op)        if ((inst >> 26) == op) { return (Op){ #name, name, JTYPE }; }
-    #include "mips_insts.inc"
+        case j: case jal:
+        E("  %s ", op.name);
+        if (sym) {
+            print_symbol(e, sym);
+        } else {
+            E("0x%x", (inst & 0x3FFFFFF) << 2);
+        }
+        break;
 
-    return (Op){ "error", RTYPE };
+        // the rest are rd, rs, rt
+        default:
+        E("  %s $%s, $%s, $%s", op.name, names[rd], names[rs], names[rt]);
+        break;
+    }
 }
+#undef div
 
-#define E(fmt, ...) tb_asm_print(e, fmt, ## __VA_ARGS__)
 static void disassemble(TB_CGEmitter* e, Disasm* restrict d, int bb, size_t pos, size_t end) {
+    const char** names = gpr_names[e->output->parent->super.module->target_arch == TB_ARCH_MIPS64];
     if (bb >= 0) {
         E(".bb%d:\n", bb);
     }
@@ -801,72 +2744,14 @@ static void disassemble(TB_CGEmitter* e, Disasm* restrict d, int bb, size_t pos,
 
         uint32_t inst;
         memcpy(&inst, &e->data[pos], sizeof(uint32_t));
-        pos += 4;
 
-        // special case
         uint64_t line_start = e->total_asm;
-        if (inst == 0) {
-            E("  nop");
-        } else if ((inst >> 26) == 0 && (inst & 0b111111) == 0b100101 && ((inst >> 16) & 0b11111) == 0) {
-            int a = (inst >> 11) & 0b11111;
-            int c = (inst >> 21) & 0b11111;
-            E("  move $%s, $%s", gpr_names[a], gpr_names[c]);
-        } else if ((inst >> 26) == 0b001101 && ((inst >> 21) & 0b11111) == 0) {
-            int a = (inst >> 16) & 0b11111;
-            E("  lui $%s, %d", gpr_names[a], inst & 0xFFFF);
-        } else {
-            // figure out what instruction type it is (everything else is trivial from there)
-            Op op = decode(inst);
-            E("  %s ", op.name);
-            switch (op.family) {
-                case RTYPE: {
-                    int a = (inst >> 11) & 0b11111;
-                    int b = (inst >> 16) & 0b11111;
-                    int c = (inst >> 21) & 0b11111;
-                    E("$%s, $%s, $%s", gpr_names[a], gpr_names[b], gpr_names[c]);
-                    break;
-                }
-
-                case ITYPE: {
-                    int b = (inst >> 16) & 0b11111;
-                    int c = (inst >> 21) & 0b11111;
-                    if (op.op >= lb && op.op <= sw) {
-                        E("$%s, $%s(%d)", gpr_names[b], gpr_names[c], tb__sxt(inst & 0xFFFF, 16, 64));
-                    } else {
-                        E("$%s, $%s, %d", gpr_names[b], gpr_names[c], tb__sxt(inst & 0xFFFF, 16, 64));
-                    }
-                    break;
-                }
-
-                case JTYPE: {
-                    int32_t disp = (inst & 0x3FFFFFF) * 2;
-                    if (d->patch && d->patch->pos == pos - 4) {
-                        const TB_Symbol* target = d->patch->target;
-                        d->patch = d->patch->next;
-
-                        if (target->name[0] == 0) {
-                            E("sym%p", target);
-                        } else {
-                            E("%s", target->name);
-                        }
-
-                        if (disp) {
-                            E(" + %"PRIu64, disp);
-                        }
-                    } else {
-                        E("%"PRIu64, disp);
-                    }
-                    break;
-                }
-
-                default: tb_todo();
-            }
-        }
+        disasm_inst(e, d, names, pos, inst);
 
         int offset = e->total_asm - line_start;
         if (d->comment && d->comment->pos == pos) {
             TB_OPTDEBUG(ANSI)(E("\x1b[32m"));
-            E("  // ");
+            E("%*s", 40 - offset, "// ");
             bool out_of_line = false;
             do {
                 if (out_of_line) {
@@ -882,17 +2767,26 @@ static void disassemble(TB_CGEmitter* e, Disasm* restrict d, int bb, size_t pos,
         } else {
             E("\n");
         }
+
+        pos += 4;
     }
 }
 #undef E
 
 static size_t emit_call_patches(TB_Module* restrict m, TB_FunctionOutput* out_f) {
-    return 0;
+    // jal only reaches within the 256MiB region, everything goes to the linker
+    return out_f->patch_count;
 }
 
 ICodeGen tb__mips32_codegen = {
     .minimum_addressable_size = 8,
     .pointer_size = 32,
+    .can_gvn = can_gvn,
+    .node_name = node_name,
+    .print_extra = print_extra,
+    .print_dumb_extra = print_dumb_extra,
+    .flags = node_flags,
+    .extra_bytes = extra_bytes,
     .emit_win64eh_unwind_info = NULL,
     .emit_call_patches  = emit_call_patches,
     .get_data_type_size = get_data_type_size,
@@ -902,6 +2796,12 @@ ICodeGen tb__mips32_codegen = {
 ICodeGen tb__mips64_codegen = {
     .minimum_addressable_size = 8,
     .pointer_size = 64,
+    .can_gvn = can_gvn,
+    .node_name = node_name,
+    .print_extra = print_extra,
+    .print_dumb_extra = print_dumb_extra,
+    .flags = node_flags,
+    .extra_bytes = extra_bytes,
     .emit_win64eh_unwind_info = NULL,
     .emit_call_patches  = emit_call_patches,
     .get_data_type_size = get_data_type_size,
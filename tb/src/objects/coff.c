@@ -135,6 +135,11 @@ TB_ExportBuffer tb_coff_write_output(TB_Module* m, TB_Arena* dst_arena, const ID
         ON(TB_MODULE_SECTION_WRITE, TB_COFF_SECTION_WRITE, 0);
         ON(TB_MODULE_SECTION_EXEC,  TB_COFF_SECTION_EXECUTE | TB_COFF_SECTION_CODE, TB_COFF_SECTION_INIT);
         if (sections[i].comdat.type != 0) flags |= TB_COFF_SECTION_COMDAT;
+
+        // no align bits means 16 bytes, past that it's log2(align)+1 (which is just ffs)
+        if ((sections[i].flags & TB_MODULE_SECTION_EXEC) && m->layout.func_align > 16) {
+            flags |= tb_ffs(m->layout.func_align) << 20;
+        }
         sections[i].export_flags = flags;
     }
     #undef ON
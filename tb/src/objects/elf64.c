@@ -102,7 +102,7 @@ TB_ExportBuffer tb_elf64obj_write_output(TB_Module* m, TB_Arena* dst_arena, cons
         // section headers go at the end of the file
         // and are filed in later.
         .shoff = 0,
-        .flags = 0,
+        .flags = m->target_arch == TB_ARCH_MIPS64 ? TB_EF_MIPS_ARCH_64R2 | TB_EF_MIPS_NOREORDER : 0,
 
         .ehsize = sizeof(TB_Elf64_Ehdr),
 
@@ -224,6 +224,52 @@ TB_ExportBuffer tb_elf64obj_write_output(TB_Module* m, TB_Arena* dst_arena, cons
                 }
                 assert(symbol_id != 0);
 
+                if (m->target_arch == TB_ARCH_AARCH64) {
+                    // the patch doesn't know which half of the address it's for, the
+                    // instruction does (BL, B, ADRP or the ADD for the low bits).
+                    uint32_t inst;
+                    memcpy(&inst, &func_out->code[p->pos], sizeof(uint32_t));
+
+                    TB_ELF_RelocType type;
+                    if ((inst & 0xFC000000) == 0x94000000) {
+                        type = TB_ELF_AARCH64_CALL26;
+                    } else if ((inst & 0xFC000000) == 0x14000000) {
+                        type = TB_ELF_AARCH64_JUMP26;
+                    } else if ((inst & 0x9F000000) == 0x90000000) {
+                        type = TB_ELF_AARCH64_ADR_PREL_PG_HI21;
+                    } else {
+                        type = TB_ELF_AARCH64_ADD_ABS_LO12_NC;
+                    }
+
+                    *rels++ = (TB_Elf64_Rela){
+                        .offset = actual_pos,
+                        .info   = TB_ELF64_R_INFO(symbol_id, type),
+                    };
+                    continue;
+                }
+
+                if (m->target_arch == TB_ARCH_MIPS64) {
+                    // same deal as aarch64, J/JAL or the lui + daddiu pair (the %hi/%lo
+                    // of a 32bit address). n64 packs the type into the top byte of r_info.
+                    uint32_t inst;
+                    memcpy(&inst, &func_out->code[p->pos], sizeof(uint32_t));
+
+                    TB_ELF_RelocType type;
+                    if ((inst >> 26) == 2 || (inst >> 26) == 3) {
+                        type = TB_ELF_MIPS_26;
+                    } else if ((inst >> 26) == 0xF) {
+                        type = TB_ELF_MIPS_HI16;
+                    } else {
+                        type = TB_ELF_MIPS_LO16;
+                    }
+
+                    *rels++ = (TB_Elf64_Rela){
+                        .offset = actual_pos,
+                        .info   = symbol_id | ((uint64_t) type << 56ull),
+                    };
+                    continue;
+                }
+
                 TB_ELF_RelocType type = p->target->tag == TB_SYMBOL_GLOBAL ? TB_ELF_X86_64_PC32 : TB_ELF_X86_64_PLT32;
                 *rels++ = (TB_Elf64_Rela){
                     .offset = actual_pos,
@@ -264,6 +310,9 @@ TB_ExportBuffer tb_elf64obj_write_output(TB_Module* m, TB_Arena* dst_arena, cons
 
         if (sections[i].flags & TB_MODULE_SECTION_EXEC) {
             sec.flags |= TB_SHF_EXECINSTR;
+            if (sec.addralign < m->layout.func_align) {
+                sec.addralign = m->layout.func_align;
+            }
         }
 
         WRITE(&sec, sizeof(sec));
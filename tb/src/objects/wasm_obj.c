@@ -12,6 +12,19 @@ static void emit_uint(TB_Emitter* emit, uint64_t x) {
     } while (x);
 }
 
+// sleb128 encode
+static void emit_sint(TB_Emitter* emit, int64_t x) {
+    for (;;) {
+        uint32_t lo = x & 0x7F;
+        x >>= 7;
+        if ((x == 0 && (lo & 0x40) == 0) || (x == -1 && (lo & 0x40))) {
+            tb_out1b(emit, lo);
+            break;
+        }
+        tb_out1b(emit, lo | 0x80);
+    }
+}
+
 static uint8_t* emit_uint2(uint8_t* p, uint64_t x) {
     do {
         uint32_t lo = x & 0x7F;
@@ -62,47 +75,150 @@ static TB_ExportChunk* emitter_to_chunk(TB_Arena* dst_arena, TB_Emitter* e) {
     return stuff;
 }
 
-TB_ExportBuffer tb_wasm_write_output(TB_Module* m, TB_Arena* dst_arena, const IDebugFormat* dbg) {
-    TB_Arena* arena = get_temporary_arena(m);
+// appends a section (id + size + contents) and frees the contents
+static void emit_section(TB_Emitter* emit, uint8_t id, TB_Emitter* contents) {
+    tb_out1b(emit, id);
+    emit_uint(emit, contents->count);
+    tb_outs(emit, contents->count, contents->data);
+    tb_platform_heap_free(contents->data);
+}
+
+static void emit_name(TB_Emitter* emit, const char* name) {
+    size_t len = strlen(name);
+    emit_uint(emit, len);
+    tb_outs(emit, len, name);
+}
+
+// the shadow stack gets the first page, the data sections go right after it
+#define WASM_STACK_SIZE 65536
+#define WASM_PAGE_SIZE  65536
+
+// functions with the same signature share a type
+typedef struct {
+    size_t count;
+    TB_Emitter data;
+    DynArray(uint32_t) starts;
+} WasmTypes;
+
+static uint32_t wasm_type_index(WasmTypes* types, TB_FunctionPrototype* proto) {
+    TB_Emitter* e = &types->data;
+    size_t start = e->count;
+    tb_out1b(e, 0x60);
+    emit_uint(e, proto->param_count);
+    FOR_N(k, 0, proto->param_count) {
+        tb_out1b(e, get_wasm_type(proto->params[k].dt));
+    }
+    emit_uint(e, proto->return_count);
+    FOR_N(k, 0, proto->return_count) {
+        tb_out1b(e, get_wasm_type(proto->params[proto->param_count + k].dt));
+    }
+
+    size_t len = e->count - start;
+    FOR_N(k, 0, types->count) {
+        size_t other_len = (k + 1 < types->count ? types->starts[k + 1] : start) - types->starts[k];
+        if (other_len == len && memcmp(&e->data[types->starts[k]], &e->data[start], len) == 0) {
+            e->count = start;
+            return k;
+        }
+    }
+
+    dyn_array_put(types->starts, start);
+    return types->count++;
+}
 
+static TB_Symbol* wasm_resolve(TB_Symbol* s) {
+    if (s->tag == TB_SYMBOL_EXTERNAL) {
+        TB_Symbol* resolved = atomic_load_explicit(&((TB_External*) s)->resolved, memory_order_relaxed);
+        if (resolved) return resolved;
+    }
+    return s;
+}
+
+// externals are only imported once something calls them (that's where the type
+// comes from), taking the address of one which never gets called can't work.
+static void wasm_check_import(TB_Symbol* s, const char* user) {
+    s = wasm_resolve(s);
+    if (s->tag == TB_SYMBOL_EXTERNAL && s->symbol_id == SIZE_MAX) {
+        tb_panic("wasm: %s refers to %s but nothing calls it, we can't import it without a type", user, s->name);
+    }
+}
+
+TB_ExportBuffer tb_wasm_write_output(TB_Module* m, TB_Arena* dst_arena, const IDebugFormat* dbg) {
     ExportList exports;
     CUIK_TIMED_BLOCK("layout section") {
         exports = tb_module_layout_sections(m);
     }
 
-    // Construct type section
-    size_t func_type_count = 0;
-    TB_Emitter func_types = { 0 };
-
+    WasmTypes types = { 0 };
     DynArray(TB_ModuleSection) sections = m->sections;
+
+    // Imports, calls to externals pick their types. They take the first function indices
+    FOR_N(i, 0, exports.count) {
+        exports.data[i]->super.symbol_id = SIZE_MAX;
+    }
+
+    DynArray(TB_External*) imports = NULL;
+    DynArray(uint32_t) import_types = NULL;
     dyn_array_for(i, sections) {
-        DynArray(TB_FunctionOutput*) funcs = sections[i].funcs;
-        dyn_array_for(j, funcs) {
-            funcs[j]->wasm_type = func_type_count++;
-            TB_FunctionPrototype* proto = funcs[j]->parent->prototype;
+        dyn_array_for(j, sections[i].funcs) {
+            for (TB_WasmTypePatch* p = sections[i].funcs[j]->wasm_type_patches; p; p = p->next) {
+                p->type_index = wasm_type_index(&types, p->proto);
 
-            tb_out1b(&func_types, 0x60);
-            emit_uint(&func_types, proto->param_count);
-            FOR_N(k, 0, proto->param_count) {
-                tb_out1b(&func_types, get_wasm_type(proto->params[k].dt));
-            }
-            emit_uint(&func_types, proto->return_count);
-            FOR_N(k, 0, proto->return_count) {
-                tb_out1b(&func_types, get_wasm_type(proto->params[proto->param_count + k].dt));
+                TB_Symbol* target = p->target ? wasm_resolve(p->target) : NULL;
+                if (target && target->tag == TB_SYMBOL_EXTERNAL && target->symbol_id == SIZE_MAX) {
+                    target->symbol_id = dyn_array_length(imports);
+                    dyn_array_put(imports, (TB_External*) target);
+                    dyn_array_put(import_types, p->type_index);
+                }
             }
         }
     }
 
-    size_t func_section_size = 0;
+    // Defined functions come after the imports, the table has all of them
+    // starting at slot 1 so NULL function pointers trap.
+    size_t import_count = dyn_array_length(imports);
     size_t func_count = 0;
     dyn_array_for(i, sections) {
         DynArray(TB_FunctionOutput*) funcs = sections[i].funcs;
         dyn_array_for(j, funcs) {
-            func_section_size += len_uint(funcs[j]->wasm_type);
-            func_count += 1;
+            funcs[j]->wasm_index = import_count + func_count++;
+            funcs[j]->wasm_type = wasm_type_index(&types, funcs[j]->parent->prototype);
+            funcs[j]->parent->super.symbol_id = funcs[j]->wasm_index;
+        }
+    }
+    size_t table_size = 1 + import_count + func_count;
+
+    // Data sections are placed in linear memory after the stack
+    uint32_t data_end = WASM_STACK_SIZE;
+    dyn_array_for(i, sections) {
+        if ((sections[i].flags & TB_MODULE_SECTION_EXEC) == 0) {
+            data_end = (data_end + 15) & ~15;
+            sections[i].raw_data_pos = data_end;
+            data_end += sections[i].total_size;
+
+            dyn_array_for(j, sections[i].globals) {
+                TB_Global* g = sections[i].globals[j];
+                g->super.symbol_id = sections[i].raw_data_pos + g->pos;
+            }
+        }
+    }
+
+    dyn_array_for(i, sections) {
+        dyn_array_for(j, sections[i].funcs) {
+            TB_FunctionOutput* out_f = sections[i].funcs[j];
+            for (TB_SymbolPatch* p = out_f->first_patch; p; p = p->next) {
+                wasm_check_import(p->target, out_f->parent->super.name);
+            }
+        }
+        dyn_array_for(j, sections[i].globals) {
+            TB_Global* g = sections[i].globals[j];
+            FOR_N(k, 0, g->obj_count) {
+                if (g->objects[k].type == TB_INIT_OBJ_RELOC) {
+                    wasm_check_import(g->objects[k].reloc, g->super.name);
+                }
+            }
         }
     }
-    func_section_size += len_uint(func_count);
 
     // Module header
     TB_Emitter emit = { 0 };
@@ -110,33 +226,118 @@ TB_ExportBuffer tb_wasm_write_output(TB_Module* m, TB_Arena* dst_arena, const ID
     tb_out4b(&emit, 0x1);        // VERSION 1
 
     // Type section
-    tb_out1b(&emit, 0x01);
-    emit_uint(&emit, func_types.count + len_uint(func_type_count));
-    emit_uint(&emit, func_type_count);
+    TB_Emitter type_section = { 0 };
+    emit_uint(&type_section, types.count);
+    tb_outs(&type_section, types.data.count, types.data.data);
+    tb_platform_heap_free(types.data.data);
+    dyn_array_destroy(types.starts);
+    emit_section(&emit, 0x01, &type_section);
 
-    tb_out_reserve(&emit, func_types.count + len_uint(func_type_count));
-    tb_outs_UNSAFE(&emit, func_types.count, (const uint8_t*) func_types.data);
+    // Import section, everything comes from "env"
+    if (import_count) {
+        TB_Emitter import_section = { 0 };
+        emit_uint(&import_section, import_count);
+        dyn_array_for(i, imports) {
+            emit_name(&import_section, "env");
+            emit_name(&import_section, imports[i]->super.name);
+            tb_out1b(&import_section, 0x00);
+            emit_uint(&import_section, import_types[i]);
+        }
+        emit_section(&emit, 0x02, &import_section);
+    }
+    dyn_array_destroy(imports);
+    dyn_array_destroy(import_types);
 
     // Function section
-    tb_out1b(&emit, 0x03);
-    emit_uint(&emit, func_section_size);
-    emit_uint(&emit, func_count);
+    TB_Emitter func_section = { 0 };
+    emit_uint(&func_section, func_count);
     dyn_array_for(i, sections) {
         DynArray(TB_FunctionOutput*) funcs = sections[i].funcs;
         dyn_array_for(j, funcs) {
-            emit_uint(&emit, funcs[j]->wasm_type);
+            emit_uint(&func_section, funcs[j]->wasm_type);
         }
     }
+    emit_section(&emit, 0x03, &func_section);
+
+    // Table section, funcref with a fixed size
+    TB_Emitter table = { 0 };
+    emit_uint(&table, 1);
+    tb_out1b(&table, 0x70);
+    tb_out1b(&table, 0x01);
+    emit_uint(&table, table_size);
+    emit_uint(&table, table_size);
+    emit_section(&emit, 0x04, &table);
+
+    // Memory section, the shadow stack grows down from the first page
+    TB_Emitter memory = { 0 };
+    emit_uint(&memory, 1);
+    tb_out1b(&memory, 0x00); // no max
+    emit_uint(&memory, (data_end + WASM_PAGE_SIZE - 1) / WASM_PAGE_SIZE);
+    emit_section(&emit, 0x05, &memory);
+
+    // Global section, __stack_pointer (mut i32) starts at the top of the stack
+    TB_Emitter globals = { 0 };
+    emit_uint(&globals, 1);
+    tb_out1b(&globals, 0x7F);
+    tb_out1b(&globals, 0x01);
+    tb_out1b(&globals, 0x41); // i32.const 65536
+    tb_out1b(&globals, 0x80);
+    tb_out1b(&globals, 0x80);
+    tb_out1b(&globals, 0x04);
+    tb_out1b(&globals, 0x0B);
+    emit_section(&emit, 0x06, &globals);
+
+    // Export section, public functions and the memory
+    size_t export_count = 1;
+    dyn_array_for(i, sections) {
+        dyn_array_for(j, sections[i].funcs) {
+            export_count += sections[i].funcs[j]->linkage == TB_LINKAGE_PUBLIC;
+        }
+    }
+
+    TB_Emitter export_section = { 0 };
+    emit_uint(&export_section, export_count);
+    dyn_array_for(i, sections) {
+        DynArray(TB_FunctionOutput*) funcs = sections[i].funcs;
+        dyn_array_for(j, funcs) {
+            if (funcs[j]->linkage == TB_LINKAGE_PUBLIC) {
+                emit_name(&export_section, funcs[j]->parent->super.name);
+                tb_out1b(&export_section, 0x00);
+                emit_uint(&export_section, funcs[j]->wasm_index);
+            }
+        }
+    }
+    emit_name(&export_section, "memory");
+    tb_out1b(&export_section, 0x02);
+    emit_uint(&export_section, 0);
+    emit_section(&emit, 0x07, &export_section);
+
+    // Element section, table[1 + i] = function i
+    TB_Emitter elems = { 0 };
+    emit_uint(&elems, 1);
+    tb_out1b(&elems, 0x00);
+    tb_out1b(&elems, 0x41); // i32.const 1
+    tb_out1b(&elems, 0x01);
+    tb_out1b(&elems, 0x0B);
+    emit_uint(&elems, table_size - 1);
+    FOR_N(i, 0, table_size - 1) {
+        emit_uint(&elems, i);
+    }
+    emit_section(&emit, 0x09, &elems);
 
     TB_ExportBuffer buffer = { 0 };
     tb_export_append_chunk(&buffer, emitter_to_chunk(dst_arena, &emit));
 
-    #if 1
     dyn_array_for(i, sections) {
         if ((sections[i].flags & TB_MODULE_SECTION_EXEC) == 0) {
             continue;
         }
 
+        // calls refer to function indices which we only know now
+        dyn_array_for(j, sections[i].funcs) {
+            m->codegen->emit_call_patches(m, sections[i].funcs[j]);
+        }
+
         size_t body_size = len_uint(dyn_array_length(sections[i].funcs)) + sections[i].total_size;
         TB_ExportChunk* sec = tb_export_make_chunk(dst_arena, 1 + body_size + len_uint(body_size));
 
@@ -148,7 +349,47 @@ TB_ExportBuffer tb_wasm_write_output(TB_Module* m, TB_Arena* dst_arena, const ID
 
         tb_export_append_chunk(&buffer, sec);
     }
-    #endif
+
+    // Data section, one active segment per data section with the relocations applied
+    size_t segment_count = 0;
+    dyn_array_for(i, sections) {
+        segment_count += (sections[i].flags & TB_MODULE_SECTION_EXEC) == 0 && sections[i].total_size > 0;
+    }
+
+    if (segment_count) {
+        TB_Emitter data = { 0 };
+        emit_uint(&data, segment_count);
+        dyn_array_for(i, sections) {
+            TB_ModuleSection* sec = &sections[i];
+            if ((sec->flags & TB_MODULE_SECTION_EXEC) || sec->total_size == 0) {
+                continue;
+            }
+
+            tb_out1b(&data, 0x00);
+            tb_out1b(&data, 0x41); // i32.const addr
+            emit_sint(&data, (int32_t) sec->raw_data_pos);
+            tb_out1b(&data, 0x0B);
+            emit_uint(&data, sec->total_size);
+
+            size_t pos = data.count;
+            tb_out_zero(&data, sec->total_size);
+            tb_helper_write_section(m, 0, sec, &data.data[pos], 0);
+
+            dyn_array_for(j, sec->globals) {
+                TB_Global* g = sec->globals[j];
+                FOR_N(k, 0, g->obj_count) {
+                    if (g->objects[k].type == TB_INIT_OBJ_RELOC) {
+                        TB_Symbol* target = wasm_resolve(g->objects[k].reloc);
+                        uint32_t addr = target->symbol_id + (target->tag != TB_SYMBOL_GLOBAL);
+                        memcpy(&data.data[pos + g->pos + g->objects[k].offset], &addr, sizeof(addr));
+                    }
+                }
+            }
+        }
+
+        TB_Emitter data_section = { 0 };
+        emit_section(&data_section, 0x0B, &data);
+        tb_export_append_chunk(&buffer, emitter_to_chunk(dst_arena, &data_section));
+    }
     return buffer;
 }
-
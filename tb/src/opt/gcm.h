@@ -150,8 +150,8 @@ void tb_compact_nodes(TB_Function* f, TB_Worklist* ws, TB_ArenaSavepoint sp) {
 
             // invalidate all of the GVN table since it hashes with value numbers
             f->root_node = fwd[f->root_node->gvn];
-            FOR_N(i, 0, f->param_count) {
-                f->params[i] = fwd[f->params[i]->gvn];
+            FOR_N(i, 0, 3 + f->param_count) {
+                f->params[i] = f->params[i] ? fwd[f->params[i]->gvn] : NULL;
             }
 
             nl_hashset_clear(&f->gvn_nodes);
@@ -164,6 +164,73 @@ void tb_compact_nodes(TB_Function* f, TB_Worklist* ws, TB_ArenaSavepoint sp) {
     tb_arena_restore(f->tmp_arena, sp);
 }
 
+TB_Function* tb__clone_function(TB_Function* f, TB_Worklist* ws, TB_Arena* arena1, TB_Arena* arena2) {
+    TB_Function* k = tb_platform_heap_alloc(sizeof(TB_Function));
+    *k = (TB_Function){
+        .super       = f->super,
+        .section     = f->section,
+        .linkage     = f->linkage,
+        .dbg_type    = f->dbg_type,
+        .prototype   = f->prototype,
+        .param_count = f->param_count,
+        .arena       = arena1,
+        .tmp_arena   = arena2,
+        .gvn_nodes   = nl_hashset_alloc(32),
+    };
+
+    TB_ArenaSavepoint sp = tb_arena_save(arena2);
+    TB_Node** fwd = tb_arena_alloc(arena2, f->node_count * sizeof(TB_Node*));
+    memset(fwd, 0, f->node_count * sizeof(TB_Node*));
+
+    CUIK_TIMED_BLOCK("clone") {
+        // same walk as compaction, the copies are numbered in BFS order
+        assert(dyn_array_length(ws->items) == 0);
+        worklist_push(ws, f->root_node);
+        for (size_t i = 0; i < dyn_array_length(ws->items); i++) {
+            TB_Node* n = ws->items[i];
+
+            size_t extra = extra_bytes(n);
+            TB_Node* new_n = tb_alloc_node(k, n->type, n->dt, n->input_count, extra);
+            memcpy(new_n->extra, n->extra, extra);
+            fwd[n->gvn] = new_n;
+
+            if (n->dt.type == TB_TAG_TUPLE) {
+                FOR_USERS(u, n) if (is_proj(USERN(u))) {
+                    worklist_push(ws, USERN(u));
+                }
+            }
+
+            FOR_USERS(u, n) { worklist_push(ws, USERN(u)); }
+        }
+
+        FOR_N(i, 0, dyn_array_length(ws->items)) {
+            TB_Node* old = ws->items[i];
+            TB_Node* n = fwd[old->gvn];
+            FOR_N(j, 0, old->input_count) {
+                TB_Node* in = old->inputs[j];
+                if (in) { set_input(k, n, fwd[in->gvn], j); }
+            }
+        }
+
+        k->root_node = fwd[f->root_node->gvn];
+        k->params = tb_arena_alloc(arena1, (3 + f->param_count) * sizeof(TB_Node*));
+        FOR_N(i, 0, 3 + f->param_count) {
+            k->params[i] = f->params[i] ? fwd[f->params[i]->gvn] : NULL;
+        }
+
+        worklist_clear(ws);
+    }
+
+    tb_arena_restore(arena2, sp);
+    return k;
+}
+
+void tb__free_clone(TB_Function* k) {
+    nl_hashset_free(k->gvn_nodes);
+    tb_opt_free_types(k);
+    tb_platform_heap_free(k);
+}
+
 void tb_renumber_nodes(TB_Function* f, TB_Worklist* ws) {
     CUIK_TIMED_BLOCK("renumber") {
         CUIK_TIMED_BLOCK("find live") {
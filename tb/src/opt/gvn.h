@@ -60,8 +60,10 @@ static size_t extra_bytes(TB_Node* n) {
         case TB_FMIN:
         case TB_NEG:
         case TB_PHI:
+        case TB_BSWAP:
         case TB_CLZ:
         case TB_CTZ:
+        case TB_POPCNT:
         case TB_ADC:
         case TB_VA_START:
         case TB_PTR_OFFSET:
@@ -2,6 +2,8 @@
 typedef struct {
     TB_Node* n;
     int end;
+    // pipelined units free up before the result is ready, -1 once released
+    int unit_end;
     int unit_i;
 } InFlight;
 
@@ -42,6 +44,7 @@ typedef struct {
     TB_GetUnitMask get_unit_mask;
 
     TB_Node* cmp;
+    TB_Node* end;
     Set ready_set;
     ArenaArray(ReadyNode) ready;
 } ListSched;
@@ -85,12 +88,15 @@ static bool can_ready_user(TB_Function* f, TB_Worklist* ws, TB_BasicBlock* bb, S
 // hands you the best ready candidate, the ready list is sorted by latency but
 // there's a few other bits which might skew scheduling, for now those are:
 // * Condition attached to the terminator branch should be scheduled right before it.
+// * The terminator itself goes last, it's only picked once nothing else is in flight.
 //
 // returns an index from the ready array (or -1 when it can't find an answer)
-static int best_ready_node(ListSched* sched, uint64_t in_use_mask) {
+static int best_ready_node(ListSched* sched, uint64_t in_use_mask, size_t in_flight) {
     // nothing else we could do
     int len = aarray_length(sched->ready);
     if (len == 1) {
+        if (sched->ready[0].n == sched->end && in_flight > 0) { return -1; }
+
         // machines available? if not we'll have to wait
         uint64_t avail = sched->ready[0].unit_mask & ~in_use_mask;
         return avail ? 0 : -1;
@@ -99,8 +105,8 @@ static int best_ready_node(ListSched* sched, uint64_t in_use_mask) {
     while (len--) {
         TB_Node* n = sched->ready[len].n;
 
-        // delay branch compares
-        if (n == sched->cmp) { continue; }
+        // delay branch compares & the terminator
+        if (n == sched->cmp || n == sched->end) { continue; }
 
         // actually fits on the available machines
         uint64_t avail = sched->ready[len].unit_mask & ~in_use_mask;
@@ -112,7 +118,7 @@ static int best_ready_node(ListSched* sched, uint64_t in_use_mask) {
     return -1;
 }
 
-void tb_list_scheduler(TB_Function* f, TB_CFG* cfg, TB_Worklist* ws, DynArray(PhiVal*) phi_vals, TB_BasicBlock* bb, TB_GetLatency get_lat, TB_GetUnitMask get_unit_mask, int unit_count) {
+int tb_list_scheduler(TB_Function* f, TB_CFG* cfg, TB_Worklist* ws, DynArray(PhiVal*) phi_vals, TB_BasicBlock* bb, TB_GetLatency get_lat, TB_GetUnitMask get_unit_mask, TB_GetThroughput get_tput, int unit_count) {
     assert(phi_vals == NULL && "TODO");
     TB_Arena* tmp_arena = f->tmp_arena;
     TB_ArenaSavepoint sp = tb_arena_save(tmp_arena);
@@ -147,7 +153,7 @@ void tb_list_scheduler(TB_Function* f, TB_CFG* cfg, TB_Worklist* ws, DynArray(Ph
     ArenaArray(InFlight) active = aarray_create(tmp_arena, InFlight, 32);
 
     ListSched sched = {
-        .f = f, .get_lat = get_lat, .get_unit_mask = get_unit_mask
+        .f = f, .get_lat = get_lat, .get_unit_mask = get_unit_mask, .end = end
     };
     sched.ready_set = set_create_in_arena(tmp_arena, f->node_count);
     sched.ready     = aarray_create(tmp_arena, ReadyNode, 32);
@@ -176,7 +182,7 @@ void tb_list_scheduler(TB_Function* f, TB_CFG* cfg, TB_Worklist* ws, DynArray(Ph
 
         // dispatch one instruction per machine per cycle
         while (in_use_mask != blocked_mask && aarray_length(sched.ready) > 0) {
-            int idx = best_ready_node(&sched, in_use_mask);
+            int idx = best_ready_node(&sched, in_use_mask, aarray_length(active));
             if (idx < 0) { break; }
 
             uint64_t avail = sched.ready[idx].unit_mask & ~in_use_mask;
@@ -200,9 +206,14 @@ void tb_list_scheduler(TB_Function* f, TB_CFG* cfg, TB_Worklist* ws, DynArray(Ph
                 }
             }
 
-            int end_cycle = cycle + get_lat(f, n, end);
+            // without a throughput (or 0) the unit is busy until the result is ready
+            int lat = get_lat(f, n, end);
+            int occupancy = get_tput ? get_tput(f, n) : 0;
+            if (occupancy <= 0 || occupancy > lat) { occupancy = lat; }
+
+            int end_cycle = cycle + lat;
             TB_OPTDEBUG(SCHEDULE)(printf("  T=%2d: DISPATCH ", cycle), tb_print_dumb_node(NULL, n), printf(" (on machine %d, until t=%d)\n", unit_i, end_cycle));
-            aarray_push(active, (InFlight){ n, end_cycle, unit_i });
+            aarray_push(active, (InFlight){ n, end_cycle, cycle + occupancy, unit_i });
         }
 
         if (stall) {
@@ -212,9 +223,13 @@ void tb_list_scheduler(TB_Function* f, TB_CFG* cfg, TB_Worklist* ws, DynArray(Ph
 
         for (size_t i = 0; i < aarray_length(active);) {
             TB_Node* n = active[i].n;
+            if (active[i].unit_i >= 0 && active[i].unit_end <= cycle) {
+                in_use_mask &= ~(1ull << active[i].unit_i);
+                active[i].unit_i = -1;
+            }
+
             if (active[i].end > cycle) { i++; continue; }
 
-            in_use_mask &= ~(1ull << active[i].unit_i);
             aarray_remove(active, i);
             TB_OPTDEBUG(SCHEDULE)(printf("  T=%2d: RETIRE   ", cycle), tb_print_dumb_node(NULL, n), printf("\n"));
 
@@ -248,6 +263,7 @@ void tb_list_scheduler(TB_Function* f, TB_CFG* cfg, TB_Worklist* ws, DynArray(Ph
     }
 
     tb_arena_restore(tmp_arena, sp);
+    return cycle;
 }
 
 
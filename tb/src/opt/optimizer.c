@@ -253,6 +253,7 @@ static void mark_node_n_users(TB_Function* f, TB_Node* n) {
 #include "print_c.h"
 #include "gcm.h"
 #include "libcalls.h"
+#include "tailcall.h"
 #include "mem2reg.h"
 #include "scheduler.h"
 #include "list_sched.h"
@@ -1398,6 +1399,13 @@ void tb_opt(TB_Function* f, TB_Worklist* ws, bool preserve_types) {
         TB_OPTDEBUG(PASSES)(printf("    * Loops\n"));
         DO_IF(TB_OPTDEBUG_PEEP)(printf("=== LOOPS OPTS ===\n"));
         tb_opt_loops(f);
+
+        // call followed by a return becomes a tailcall, leaves some dead
+        // projections & phi edges for the next round.
+        TB_OPTDEBUG(PASSES)(printf("    * Tailcalls\n"));
+        if (k = tb_opt_tailcalls(f), k > 0) {
+            TB_OPTDEBUG(PASSES)(printf("        * Converted %d calls\n", k));
+        }
     }
     nl_table_free(f->node2loop);
     tb_arena_restore(f->tmp_arena, tmp_sp);
@@ -1600,6 +1608,11 @@ static SCCNode* scc_walk(SCC* restrict scc, IPOSolver* ipo, TB_Function* f) {
 }
 
 static void inline_into(TB_Arena* arena, TB_Function* f, TB_Node* call_site, TB_Function* kid);
+static bool has_single_return(TB_Function* f) {
+    TB_Node* root = f->root_node;
+    return root->input_count == 2 && root->inputs[1]->type == TB_RETURN;
+}
+
 bool tb_module_ipo(TB_Module* m) {
     // fill initial worklist with all external function calls :)
     //
@@ -1653,8 +1666,9 @@ bool tb_module_ipo(TB_Module* m) {
             TB_Node* call = callgraph->inputs[i];
             TB_Function* target = static_call_site(call);
 
-            // really simple getter/setter kind of heuristic
-            if (target && target->node_count < 15) {
+            // really simple getter/setter kind of heuristic, the inliner only knows how
+            // to stitch in a single return (no tailcalls on either side).
+            if (target && target->node_count < 15 && call->type == TB_CALL && has_single_return(target)) {
                 TB_OPTDEBUG(INLINE)(printf("  -> %s (from v%u)\n", target->super.name, call->gvn));
                 inline_into(scc.arena, f, call, target);
                 progress = true;
@@ -408,9 +408,10 @@ void tb__gvn_remove(TB_Function* f, TB_Node* n);
 // Scheduler's cost model crap (talk about these in codegen_impl.h)
 typedef int (*TB_GetLatency)(TB_Function* f, TB_Node* n, TB_Node* end);
 typedef uint64_t (*TB_GetUnitMask)(TB_Function* f, TB_Node* n);
+typedef int (*TB_GetThroughput)(TB_Function* f, TB_Node* n);
 
-// Local scheduler
-void tb_list_scheduler(TB_Function* f, TB_CFG* cfg, TB_Worklist* ws, DynArray(PhiVal*) phi_vals, TB_BasicBlock* bb, TB_GetLatency get_lat, TB_GetUnitMask get_unit_mask, int unit_count);
+// Local scheduler (list scheduler returns the estimated cycle count for the block)
+int tb_list_scheduler(TB_Function* f, TB_CFG* cfg, TB_Worklist* ws, DynArray(PhiVal*) phi_vals, TB_BasicBlock* bb, TB_GetLatency get_lat, TB_GetUnitMask get_unit_mask, TB_GetThroughput get_tput, int unit_count);
 void tb_greedy_scheduler(TB_Function* f, TB_CFG* cfg, TB_Worklist* ws, DynArray(PhiVal*) phi_vals, TB_BasicBlock* bb);
 void tb_dataflow(TB_Function* f, TB_Arena* arena, TB_CFG cfg, TB_Node** rpo_nodes);
 
@@ -426,6 +427,7 @@ void tb_opt_loops(TB_Function* f);
 
 int tb_opt_peeps(TB_Function* f);
 int tb_opt_locals(TB_Function* f);
+int tb_opt_tailcalls(TB_Function* f);
 
 Lattice* latuni_get(TB_Function* f, TB_Node* n);
 
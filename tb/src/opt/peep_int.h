@@ -366,8 +366,8 @@ static TB_Node* ideal_bits(TB_Function* f, TB_Node* n) {
                 shl_amt == bits - shr_amt) {
                 // convert to rotate left
                 n->type = TB_ROL;
-                set_input(f, n, b->inputs[1], 1);
-                set_input(f, n, b->inputs[2], 2);
+                set_input(f, n, a->inputs[1], 1);
+                set_input(f, n, a->inputs[2], 2);
                 return n;
             }
         }
@@ -126,7 +126,7 @@ bool cfg_is_natural_loop(TB_Node* n) {
 }
 
 uint32_t cfg_flags(TB_Node* n) {
-    if (n->type >= TB_NODE_TYPE_MAX) {
+    if (n->type >= TB_MACH_X86) {
         int family = n->type / 0x100;
         assert(family >= 1 && family < TB_ARCH_MAX);
         return tb_codegen_families[family].flags(n);
@@ -0,0 +1,231 @@
+// Sibling call optimization, rewrites a call which is immediately returned into a
+// TB_TAILCALL:
+//
+//   r = call f(x)              tailcall f(x)
+//   return r          =>
+//
+// it's only legal when the callee can't observe our frame once it's gone (no
+// escaping locals) and it doesn't need any stack argument slots, anything past
+// the register params would need to go into the incoming argument area which
+// the backends don't rewrite.
+static bool tailcall_local_escapes(TB_Node* addr) {
+    FOR_USERS(u, addr) {
+        TB_Node* un = USERN(u);
+        if ((un->type == TB_LOAD || un->type == TB_STORE) && USERI(u) == 2) {
+            // address operand, the value going into a store would be an escape
+            continue;
+        } else if (un->type == TB_PTR_OFFSET && USERI(u) == 1) {
+            if (tailcall_local_escapes(un)) { return true; }
+        } else {
+            return true;
+        }
+    }
+    return false;
+}
+
+// do all the params fit into the ABI's param registers
+static bool tailcall_params_in_regs(TB_Module* m, TB_Node* call) {
+    int gpr_count, xmm_count;
+    bool shared = false;
+    if (m->target_arch == TB_ARCH_X86_64) {
+        if (m->target_abi == TB_ABI_WIN64) {
+            // win64 params take a slot from both register files
+            gpr_count = xmm_count = 4, shared = true;
+        } else {
+            // matches the x64 backend's param_descs, it only passes 4 XMMs
+            gpr_count = 6, xmm_count = 4;
+        }
+    } else if (m->target_arch == TB_ARCH_AARCH64) {
+        gpr_count = xmm_count = 8;
+    } else {
+        // no lowering for TB_TAILCALL
+        return false;
+    }
+
+    int gprs_used = 0, xmms_used = 0;
+    FOR_N(i, 3, call->input_count) {
+        TB_DataType dt = call->inputs[i]->dt;
+        if (!TB_IS_SCALAR_TYPE(dt)) { return false; }
+
+        if (shared) {
+            gprs_used = xmms_used = i - 3;
+        }
+
+        if (TB_IS_FLOAT_TYPE(dt)) {
+            if (xmms_used++ >= xmm_count) { return false; }
+        } else {
+            if (gprs_used++ >= gpr_count) { return false; }
+        }
+    }
+    return true;
+}
+
+// value coming into phi (or the value itself if it's not a phi of region) on the path_i edge
+static TB_Node* tailcall_path_value(TB_Node* region, TB_Node* n, int path_i) {
+    if (region && n->type == TB_PHI && n->inputs[0] == region) {
+        return n->inputs[1 + path_i];
+    }
+    return n;
+}
+
+// returns the call if the path_i edge into the return is a call -> ret, with
+// nothing else hanging off of the call's projections.
+static TB_Node* tailcall_candidate(TB_Function* f, TB_Node* ret, TB_Node* region, int path_i) {
+    TB_Node* cproj = region ? region->inputs[path_i] : ret->inputs[0];
+    if (cproj->type != TB_PROJ || cproj->inputs[0]->type != TB_CALL) {
+        return NULL;
+    }
+
+    TB_Node* call = cproj->inputs[0];
+    TB_FunctionPrototype* caller_proto = f->prototype;
+    TB_FunctionPrototype* callee_proto = TB_NODE_GET_EXTRA_T(call, TB_NodeCall)->proto;
+    if (callee_proto->has_varargs || callee_proto->call_conv != caller_proto->call_conv) {
+        return NULL;
+    }
+
+    // the call's control only flows into the return
+    if (cproj->user_count != 1) {
+        return NULL;
+    }
+
+    // the call's memory is what we return, no stores after it
+    TB_Node* mem = tailcall_path_value(region, ret->inputs[1], path_i);
+    if (mem->type != TB_PROJ || mem->inputs[0] != call || mem->user_count != 1) {
+        return NULL;
+    }
+
+    // every return value is the matching result of the call, if we return
+    // less than the callee does then the extra results are just garbage in
+    // the return registers.
+    if (callee_proto->return_count < caller_proto->return_count) {
+        return NULL;
+    }
+
+    FOR_N(i, 0, caller_proto->return_count) {
+        TB_Node* val = tailcall_path_value(region, ret->inputs[3 + i], path_i);
+        if (val->type != TB_PROJ || val->inputs[0] != call ||
+            TB_NODE_GET_EXTRA_T(val, TB_NodeProj)->index != 2 + i ||
+            val->dt.raw != TB_PROTOTYPE_RETURNS(caller_proto)[i].dt.raw) {
+            return NULL;
+        }
+    }
+
+    // the results can't be used anywhere but the return (or the phis
+    // feeding it)
+    FOR_USERS(u, call) {
+        TB_Node* un = USERN(u);
+        if (un->type == TB_CALLGRAPH || un == cproj || un == mem) { continue; }
+        if (!is_proj(un)) { return NULL; }
+
+        FOR_USERS(u2, un) {
+            TB_Node* un2 = USERN(u2);
+            if (un2 != ret && !(un2->type == TB_PHI && un2->inputs[0] == region && USERI(u2) == 1 + path_i)) {
+                return NULL;
+            }
+        }
+    }
+
+    if (!tailcall_params_in_regs(f->super.module, call)) {
+        return NULL;
+    }
+
+    return call;
+}
+
+static TB_Node* tailcall_convert(TB_Function* f, TB_Node* call) {
+    TB_Node* n = tb_alloc_node(f, TB_TAILCALL, TB_TYPE_CONTROL, call->input_count, sizeof(TB_NodeTailcall));
+    FOR_N(i, 0, call->input_count) {
+        set_input(f, n, call->inputs[i], i);
+    }
+    TB_NODE_SET_EXTRA(n, TB_NodeTailcall, .proto = TB_NODE_GET_EXTRA_T(call, TB_NodeCall)->proto);
+
+    // replace the callgraph edge
+    FOR_USERS(u, call) {
+        if (USERN(u)->type == TB_CALLGRAPH) {
+            set_input(f, USERN(u), n, USERI(u));
+            break;
+        }
+    }
+
+    return n;
+}
+
+static void tailcall_kill_call(TB_Function* f, TB_Node* call) {
+    // by this point the projections are all dead
+    while (call->user_count > 0) {
+        TB_Node* proj = USERN(&call->users[call->user_count - 1]);
+        assert(is_proj(proj) && proj->user_count == 0);
+        tb_kill_node(f, proj);
+    }
+    tb_kill_node(f, call);
+}
+
+int tb_opt_tailcalls(TB_Function* f) {
+    TB_Node* root = f->root_node;
+    if (f->prototype->has_varargs) {
+        return 0;
+    }
+
+    // if any local's address escapes the callee might see it after we've
+    // popped the frame.
+    FOR_USERS(u, root) {
+        if (USERN(u)->type == TB_LOCAL && tailcall_local_escapes(USERN(u))) {
+            return 0;
+        }
+    }
+
+    int changes = 0;
+    FOR_N(slot, 1, root->input_count) {
+        TB_Node* ret = root->inputs[slot];
+        if (ret->type != TB_RETURN) { continue; }
+
+        TB_Node* region = ret->inputs[0]->type == TB_REGION ? ret->inputs[0] : NULL;
+        if (region == NULL) {
+            // single path into the return, the tailcall just takes its place
+            TB_Node* call = tailcall_candidate(f, ret, NULL, 0);
+            if (call == NULL) { continue; }
+
+            TB_Node* n = tailcall_convert(f, call);
+            set_input(f, root, n, slot);
+            FOR_N(i, 0, ret->input_count) if (ret->inputs[i]) {
+                mark_node(f, ret->inputs[i]);
+            }
+            tb_kill_node(f, ret);
+            tailcall_kill_call(f, call);
+
+            mark_node(f, n);
+            changes++;
+            continue;
+        }
+
+        // detach every call -> ret path from the region and hang the tailcalls
+        // directly off the root.
+        size_t i = 0;
+        while (i < region->input_count && region->input_count > 1) {
+            TB_Node* call = tailcall_candidate(f, ret, region, i);
+            if (call == NULL) { i++; continue; }
+
+            TB_Node* n = tailcall_convert(f, call);
+            add_input_late(f, root, n);
+
+            FOR_USERS(u, region) {
+                TB_Node* phi = USERN(u);
+                if (phi->type == TB_PHI && USERI(u) == 0) {
+                    remove_input(f, phi, i + 1);
+                    mark_node(f, phi);
+                }
+            }
+            remove_input(f, region, i);
+            tailcall_kill_call(f, call);
+
+            mark_node(f, n);
+            mark_node(f, region);
+            changes++;
+        }
+    }
+
+    if (changes) {
+        f->invalidated_loops = true;
+    }
+    return changes;
+}
@@ -35,6 +35,7 @@ enum {
 
 // returns NO_SPILL, MANY_CONFLICTS, or a VReg ID
 static int allocate_loop(Ctx* restrict ctx, Rogers* restrict ra, TB_Arena* arena);
+static void collect_stats(Ctx* restrict ctx, TB_Arena* arena);
 static void compute_ordinals(Ctx* restrict ctx, Rogers* restrict ra, TB_Arena* arena);
 static bool interfere(Ctx* restrict ctx, Rogers* restrict ra, TB_Node* lhs, TB_Node* rhs);
 
@@ -176,6 +177,7 @@ static void rematerialize(Ctx* ctx, int* fixed_vregs, TB_Node* n) {
         }
 
         TB_OPTDEBUG(REGALLOC)(printf("\x1b[33m#   V%zu: remat (%%%u)\x1b[0m\n", reload_vreg - ctx->vregs, remat->gvn));
+        ctx->ra_stats.remats += 1;
     }
     tb_arena_restore(f->tmp_arena, sp);
 
@@ -218,6 +220,7 @@ static void spill_entire_lifetime(Ctx* ctx, VReg* to_spill, RegMask* spill_mask,
 
             TB_NodeMachCopy* cpy = TB_NODE_GET_EXTRA(use_n);
             cpy->use = spill_mask;
+            ctx->ra_stats.folded_reloads += 1;
             continue;
         }
 
@@ -235,6 +238,7 @@ static void spill_entire_lifetime(Ctx* ctx, VReg* to_spill, RegMask* spill_mask,
         reload_vreg->mask = in_mask;
 
         TB_OPTDEBUG(REGALLOC)(printf("\x1b[33m#   V%zu: reload (%%%u)\x1b[0m\n", reload_vreg - ctx->vregs, reload_n->gvn));
+        ctx->ra_stats.reloads += 1;
     }
     tb_arena_restore(f->tmp_arena, sp);
 }
@@ -265,6 +269,7 @@ static void better_spill_range(Ctx* ctx, Rogers* restrict ra, VReg* to_spill, Re
 
             TB_NodeMachCopy* cpy = TB_NODE_GET_EXTRA(use_n);
             cpy->use = spill_mask;
+            ctx->ra_stats.folded_reloads += 1;
             continue;
         }
 
@@ -302,6 +307,7 @@ static void better_spill_range(Ctx* ctx, Rogers* restrict ra, VReg* to_spill, Re
             VReg* reload_vreg = tb__set_node_vreg(ctx, reload_n[i]);
 
             TB_OPTDEBUG(REGALLOC)(printf("\x1b[33m#   V%zu: reload (%%%u)\x1b[0m\n", reload_vreg - ctx->vregs, reload_n[i]->gvn));
+            ctx->ra_stats.reloads += 1;
         }
     }
 
@@ -578,10 +584,17 @@ void tb__rogers(Ctx* restrict ctx, TB_Arena* arena) {
 
         while (dyn_array_length(ws->items) > old) {
             TB_Node* n = worklist_pop(ws);
-            if (!interfere(ctx, &ra, n, n->inputs[1])) {
+
+            // the copy might be carrying a tighter constraint than the phi (the phi
+            // feeding a return wants to land in RAX), those have to stay.
+            VReg* copy_vreg = node_vreg(ctx, n);
+            VReg* phi_vreg  = node_vreg(ctx, n->inputs[1]);
+            RegMask* mask   = tb__reg_mask_meet(ctx, copy_vreg->mask, phi_vreg->mask);
+            if (mask == phi_vreg->mask && !interfere(ctx, &ra, n, n->inputs[1])) {
                 // delete copy
                 tb__remove_node(ctx, f, n);
                 subsume_node(f, n, n->inputs[1]);
+                ctx->ra_stats.coalesced += 1;
                 changes = true;
             }
         }
@@ -617,8 +630,9 @@ void tb__rogers(Ctx* restrict ctx, TB_Arena* arena) {
 
     cuikperf_region_start("allocate", NULL);
     for (;;) {
-        #if TB_OPTDEBUG_REGALLOC
         rounds += 1;
+
+        #if TB_OPTDEBUG_REGALLOC
         printf("###############################\n");
         printf("#  ROUND %-4d                 #\n", rounds);
         printf("###############################\n");
@@ -653,6 +667,8 @@ void tb__rogers(Ctx* restrict ctx, TB_Arena* arena) {
             RegMask* vreg_mask = ctx->vregs[vreg_id].mask;
 
             TB_OPTDEBUG(REGALLOC)(printf("\x1b[33m# v%u: spilled (%%%u)\x1b[0m\n", vreg_id, n->gvn));
+            ctx->ra_stats.spills += 1;
+            ctx->ra_stats.spill_cost += get_spill_cost(ctx, &ctx->vregs[vreg_id]);
 
             // rematerialization candidates will delete the original def and for now, they'll
             // reload per use site (although we might wanna coalesce some later on).
@@ -701,6 +717,82 @@ void tb__rogers(Ctx* restrict ctx, TB_Arena* arena) {
         redo_dataflow(ctx, arena);
     }
     cuikperf_region_end();
+
+    ctx->ra_stats.rounds = rounds;
+    collect_stats(ctx, arena);
+}
+
+static int stats_vreg_id(Ctx* restrict ctx, size_t gvn) {
+    return gvn < aarray_length(ctx->vreg_map) ? ctx->vreg_map[gvn] : 0;
+}
+
+static void pressure_inc(Ctx* restrict ctx, int* pressure, Set* live, int vreg_id) {
+    VReg* vreg = vreg_at(ctx, vreg_id);
+    // callee-saved projections live across the entire function, they'd just add
+    // the same constant to every function's pressure so we skip them.
+    if (vreg && vreg->n && vreg->n->type == TB_MACH_PROJ && vreg->n->inputs[0] == ctx->f->root_node) {
+        return;
+    }
+
+    if (vreg && vreg->class > 0 && !set_get(live, vreg_id)) {
+        set_put(live, vreg_id);
+        pressure[vreg->class] += 1;
+    }
+}
+
+// walks the final schedule backwards from each block's live-outs to find the peak
+// register pressure per class, we also count which copies actually turned into moves
+// at this point (a copy into the same register is free).
+static void collect_stats(Ctx* restrict ctx, TB_Arena* arena) {
+    TB_RegAllocStats* stats = &ctx->ra_stats;
+    TB_ArenaSavepoint sp = tb_arena_save(arena);
+
+    int pressure[MAX_REG_CLASSES];
+    Set live = set_create_in_arena(arena, aarray_length(ctx->vregs));
+    FOR_N(i, 0, ctx->bb_count) {
+        MachineBB* mbb = &ctx->machine_bbs[i];
+
+        set_clear(&live);
+        FOR_N(k, 0, MAX_REG_CLASSES) { pressure[k] = 0; }
+        FOREACH_SET(j, mbb->bb->live_out) {
+            pressure_inc(ctx, pressure, &live, stats_vreg_id(ctx, j));
+        }
+
+        FOR_REV_N(j, 0, aarray_length(mbb->items)) {
+            TB_Node* n = mbb->items[j];
+            int vreg_id = stats_vreg_id(ctx, n->gvn);
+            VReg* vreg  = vreg_at(ctx, vreg_id);
+
+            FOR_N(k, 1, ctx->num_classes) {
+                if (stats->max_pressure[k] < pressure[k]) { stats->max_pressure[k] = pressure[k]; }
+            }
+
+            // def kills the value (walking backwards)
+            if (vreg && vreg->class > 0 && set_get(&live, vreg_id)) {
+                set_remove(&live, vreg_id);
+                pressure[vreg->class] -= 1;
+            }
+
+            if (n->type == TB_MACH_COPY || n->type == TB_MACH_MOVE) {
+                VReg* src = vreg_at(ctx, stats_vreg_id(ctx, n->inputs[1]->gvn));
+                if (vreg && src && (vreg->class != src->class || vreg->assigned != src->assigned)) {
+                    stats->copies += 1;
+                }
+            }
+
+            // phi inputs are live-out of the predecessors, not here
+            if (n->type != TB_PHI) {
+                FOR_N(k, 1, n->input_count) if (n->inputs[k]) {
+                    pressure_inc(ctx, pressure, &live, stats_vreg_id(ctx, n->inputs[k]->gvn));
+                }
+            }
+        }
+
+        FOR_N(k, 1, ctx->num_classes) {
+            if (stats->max_pressure[k] < pressure[k]) { stats->max_pressure[k] = pressure[k]; }
+        }
+    }
+    tb_arena_restore(arena, sp);
 }
 
 static TB_Node* phi_move_in_block(TB_BasicBlock** scheduled, TB_BasicBlock* block, TB_Node* phi) {
@@ -712,6 +804,18 @@ static TB_Node* phi_move_in_block(TB_BasicBlock** scheduled, TB_BasicBlock* bloc
     return NULL;
 }
 
+// a pre-colored 2 address op can't hand its register to one of its own non-shared
+// inputs even if that input dies right there (lea feeding a folded load on an add).
+static bool feeds_2addr(Ctx* restrict ctx, TB_Node* n, TB_Node* in) {
+    int shared_edge = ctx->node_2addr(n);
+    if (shared_edge >= 0) {
+        FOR_N(k, 1, n->input_count) if (k != shared_edge && n->inputs[k] == in) {
+            return true;
+        }
+    }
+    return false;
+}
+
 static bool interfere_in_block(Ctx* restrict ctx, Rogers* restrict ra, TB_Node* lhs, TB_Node* rhs, TB_BasicBlock* block) {
     assert(lhs != rhs && "i... why?");
 
@@ -738,6 +842,31 @@ static bool interfere_in_block(Ctx* restrict ctx, Rogers* restrict ra, TB_Node*
             // this point in the pipeline, a phi CANNOT be referenced by the "bottom half", only the
             // potential copy can.
             if (move) {
+                // the NEW range starts at the move and runs to the end of the block, anything
+                // defined after it is born inside of it and anything defined before it which
+                // is still live afterwards overlaps with it.
+                if (ctx->f->scheduled[other->gvn] == block && ra->order[other->gvn] > ra->order[move->gvn]) {
+                    return true;
+                }
+
+                bool before_move = ctx->f->scheduled[other->gvn] == block
+                    ? ra->order[other->gvn] < ra->order[move->gvn]
+                    : set_get(&block->live_in, other->gvn);
+
+                bool copied = move->type == TB_MACH_MOVE && move->inputs[1] == other;
+                if (before_move && !copied) {
+                    if (set_get(&block->live_out, other->gvn)) {
+                        return true;
+                    }
+
+                    FOR_USERS(u, other) {
+                        TB_Node* un = USERN(u);
+                        if (block == ctx->f->scheduled[un->gvn] && ra->order[un->gvn] > ra->order[move->gvn]) {
+                            return true;
+                        }
+                    }
+                }
+
                 // because we split the lifetimes, the rest of the function should treat
                 // the phi as not being live out.
                 if (lhs == phi) { lhs_live_out = false; }
@@ -878,7 +1007,7 @@ static bool allocate_reg(Ctx* restrict ctx, Rogers* restrict ra, int vreg_id, ui
     FOREACH_SET(i, ra->future_active) {
         VReg* other = &ctx->vregs[i];
         if (other->class == mask->class && (in_use & (1ull << other->assigned)) == 0) {
-            if (interfere(ctx, ra, vreg->n, other->n)) {
+            if (interfere(ctx, ra, vreg->n, other->n) || feeds_2addr(ctx, other->n, vreg->n)) {
                 TB_OPTDEBUG(REGALLOC)(printf("V%zu (%%%u) future interferes as ", i, other->n->gvn), print_reg_name(other->class, other->assigned), printf("; "));
                 in_use |= (1ull << other->assigned);
                 dyn_array_put(ra->spills, i);
@@ -1037,11 +1166,12 @@ static int allocate_loop(Ctx* restrict ctx, Rogers* restrict ra, TB_Arena* arena
                     float best_score = INFINITY;
 
                     // interfere with relevant vregs since we might've been too eager to do
-                    // fixed masks and some might overlap.
+                    // fixed masks and some might overlap (a 2addr op and its non-shared input
+                    // both fixed to the same reg count too, like "RAX = add x, call()").
                     cuikperf_region_start("interference", NULL);
                     FOREACH_SET(k, ra->future_active) if (k != vreg_id) {
                         VReg* other = &ctx->vregs[k];
-                        if (other->class == mask->class && other->assigned == reg && interfere(ctx, ra, n, other->n)) {
+                        if (other->class == mask->class && other->assigned == reg && (interfere(ctx, ra, n, other->n) || feeds_2addr(ctx, n, other->n) || feeds_2addr(ctx, other->n, n))) {
                             TB_OPTDEBUG(REGALLOC)(printf("#   V%zu (%%%u) intersected.\n", k, other->n->gvn));
                             conflict = true;
 
@@ -0,0 +1,386 @@
+// Switch lowering, shared by the x64 & aarch64 targets. A multi-way TB_BRANCH gets
+// its cases sorted & partitioned into clusters:
+//
+//   range      lo <= key <= hi all go to the same place (usually lo == hi).
+//   bit test   up to 3 targets within a 64 wide window, each one is a mask tested
+//              against (1 << (key - lo)).
+//   jump table window dense enough to index with (key - lo), the table is placed
+//              after the function body.
+//
+// the clusters are then searched with a binary tree balanced by the branch weights
+// (the profile if we've got one, case counts otherwise) and the leaves test their
+// few clusters heaviest first.
+//
+// the target only provides the handful of primitives below, all the comparisons
+// are unsigned and happen at the width of the key (32 or 64bits, smaller keys are
+// zero extended in isel, see switch_zext_keys).
+enum {
+    SW_RANGE,
+    SW_BITS,
+    SW_TABLE,
+};
+
+enum {
+    SW_EQ, // key == x
+    SW_LE, // key <= x
+    SW_GE, // key >= x
+};
+
+enum {
+    // fewer cases than this aren't worth an indirect jump
+    SW_TABLE_MIN_CASES   = 4,
+    // percent of the table entries which aren't the default
+    SW_TABLE_MIN_DENSITY = 40,
+    SW_TABLE_MAX_SPAN    = 4096,
+    SW_BITS_MAX_DESTS    = 3,
+    // leaves of the search tree test at most this many clusters in a row
+    SW_LEAF_SIZE         = 3,
+};
+
+typedef struct {
+    uint64_t lo, hi;
+    TB_Node* target;
+    uint64_t weight;
+} SwitchCase;
+
+typedef struct {
+    int kind;
+    uint64_t lo, hi;
+    uint64_t weight;
+    // SW_RANGE: targets[0]
+    // SW_BITS:  targets[i] is taken when masks[i] has the bit, heaviest first.
+    // SW_TABLE: hi - lo + 1 entries, the holes are the default.
+    int count;
+    TB_Node** targets;
+    uint64_t* masks;
+} SwitchCluster;
+
+typedef struct SwitchPlan {
+    TB_Node* n;
+    TB_Node* default_target;
+    // if the default is unreachable the key is known to hit one of the clusters
+    bool has_default;
+    bool is_64bit;
+    // largest value the (zero extended) key can have
+    uint64_t key_max;
+
+    int cluster_count;
+    SwitchCluster* clusters; // sorted by lo
+} SwitchPlan;
+
+typedef struct {
+    SwitchPlan plan;
+    TB_Arena* arena;
+    // picked by the target, the temps are only there if it asked for them.
+    int key, tmp[2];
+} SwitchEmit;
+
+// Target hooks:
+//   jumps to label if the key compares cc (SW_EQ, SW_LE or SW_GE) against x.
+static void switch_cmp_branch(Ctx* restrict ctx, TB_CGEmitter* e, SwitchEmit* s, int cc, uint64_t x, uint32_t* label);
+//   jumps to label if lo <= key <= hi.
+static void switch_range_branch(Ctx* restrict ctx, TB_CGEmitter* e, SwitchEmit* s, uint64_t lo, uint64_t hi, uint32_t* label);
+//   jumps to the cluster's targets on a hit and falls through on a miss, if miss is
+//   non-NULL the key still needs to be range checked (out of range goes to miss).
+static void switch_bit_test(Ctx* restrict ctx, TB_CGEmitter* e, SwitchEmit* s, SwitchCluster* c, uint32_t* miss);
+//   indirect jump through the table at switch_add_table's position, same rules about
+//   miss as the bit test.
+static void switch_jump_table(Ctx* restrict ctx, TB_CGEmitter* e, SwitchEmit* s, SwitchCluster* c, uint32_t* miss);
+static void switch_jump(Ctx* restrict ctx, TB_CGEmitter* e, uint32_t* label);
+//   places a label made by switch_new_label at the current position.
+static void switch_bind(Ctx* restrict ctx, TB_CGEmitter* e, uint32_t* label);
+
+static int switch_case_cmp(const void* a, const void* b) {
+    const SwitchCase* aa = a;
+    const SwitchCase* bb = b;
+    return aa->lo < bb->lo ? -1 : aa->lo > bb->lo;
+}
+
+// isel zero extends the keys smaller than 32bits, the case keys have to agree
+// with that.
+static void switch_zext_keys(TB_Node* n, int bits) {
+    FOR_USERS(u, n) {
+        if (USERN(u)->type == TB_BRANCH_PROJ) {
+            TB_NodeBranchProj* proj = TB_NODE_GET_EXTRA(USERN(u));
+            proj->key &= (1ull << bits) - 1;
+        }
+    }
+}
+
+static SwitchCluster* switch_push_cluster(SwitchPlan* p, SwitchCluster c) {
+    p->clusters[p->cluster_count] = c;
+    return &p->clusters[p->cluster_count++];
+}
+
+static SwitchPlan switch_plan(TB_Arena* arena, TB_Node* n) {
+    TB_NodeBranch* br = TB_NODE_GET_EXTRA(n);
+    TB_Node* key = n->inputs[1];
+
+    bool is_64bit = key->dt.type == TB_TAG_PTR || key->dt.data > 32;
+    SwitchPlan p = { .n = n, .is_64bit = is_64bit, .key_max = is_64bit ? UINT64_MAX : UINT32_MAX };
+
+    int case_count = 0;
+    SwitchCase* cases = tb_arena_alloc(arena, br->succ_count * sizeof(SwitchCase));
+    FOR_USERS(u, n) {
+        if (USERN(u)->type != TB_BRANCH_PROJ) { continue; }
+
+        TB_NodeBranchProj* proj = TB_NODE_GET_EXTRA(USERN(u));
+        TB_Node* target = cfg_next_bb_after_cproj(USERN(u));
+        if (proj->index == 0) {
+            p.default_target = target;
+            p.has_default = !cfg_is_unreachable(target);
+        } else {
+            uint64_t k = proj->key & p.key_max;
+            cases[case_count++] = (SwitchCase){ k, k, target, br->total_hits ? proj->taken : 1 };
+        }
+    }
+    qsort(cases, case_count, sizeof(SwitchCase), switch_case_cmp);
+
+    // merge neighboring keys with the same target into ranges
+    int range_count = 0;
+    FOR_N(i, 0, case_count) {
+        SwitchCase* prev = range_count ? &cases[range_count - 1] : NULL;
+        if (prev && prev->target == cases[i].target && prev->hi + 1 == cases[i].lo) {
+            prev->hi = cases[i].lo;
+            prev->weight += cases[i].weight;
+        } else {
+            cases[range_count++] = cases[i];
+        }
+    }
+
+    // greedy partitioning, from each range we take the biggest run which makes a
+    // dense enough table or a profitable bit test (the bit test wins ties since
+    // it doesn't touch memory).
+    p.clusters = tb_arena_alloc(arena, range_count * sizeof(SwitchCluster));
+    for (int i = 0; i < range_count;) {
+        int best = 1, kind = SW_RANGE;
+
+        uint64_t keys = 0;
+        for (int j = i; j < range_count && cases[j].hi - cases[i].lo < SW_TABLE_MAX_SPAN; j++) {
+            uint64_t span = cases[j].hi - cases[i].lo + 1;
+            keys += cases[j].hi - cases[j].lo + 1;
+            if (j - i + 1 >= SW_TABLE_MIN_CASES && keys*100 >= span*SW_TABLE_MIN_DENSITY) {
+                best = j - i + 1, kind = SW_TABLE;
+            }
+        }
+
+        int dests = 0, cmps = 0;
+        TB_Node* dest[SW_BITS_MAX_DESTS];
+        for (int j = i; j < range_count && cases[j].hi - cases[i].lo < 64; j++) {
+            int k = 0;
+            while (k < dests && dest[k] != cases[j].target) { k++; }
+            if (k == dests) {
+                if (dests == SW_BITS_MAX_DESTS) { break; }
+                dest[dests++] = cases[j].target;
+            }
+
+            // this is what the compare chain would've cost
+            cmps += cases[j].lo == cases[j].hi ? 1 : 2;
+            bool profitable = (dests == 1 && cmps >= 3) || (dests == 2 && cmps >= 5) || (dests == 3 && cmps >= 6);
+            if (profitable && j - i + 1 >= best) {
+                best = j - i + 1, kind = SW_BITS;
+            }
+        }
+
+        SwitchCase* first = &cases[i];
+        SwitchCase* last  = &cases[i + best - 1];
+        SwitchCluster* c = switch_push_cluster(&p, (SwitchCluster){ kind, first->lo, last->hi });
+        FOR_N(j, i, i + best) {
+            c->weight += cases[j].weight;
+        }
+
+        if (kind == SW_RANGE) {
+            c->count = 1;
+            c->targets = tb_arena_alloc(arena, sizeof(TB_Node*));
+            c->targets[0] = first->target;
+        } else if (kind == SW_BITS) {
+            c->targets = tb_arena_alloc(arena, SW_BITS_MAX_DESTS * sizeof(TB_Node*));
+            c->masks   = tb_arena_alloc(arena, SW_BITS_MAX_DESTS * sizeof(uint64_t));
+
+            uint64_t weights[SW_BITS_MAX_DESTS];
+            FOR_N(j, i, i + best) {
+                int k = 0;
+                while (k < c->count && c->targets[k] != cases[j].target) { k++; }
+                if (k == c->count) {
+                    c->targets[k] = cases[j].target, c->masks[k] = 0, weights[k] = 0;
+                    c->count++;
+                }
+
+                uint64_t width = cases[j].hi - cases[j].lo + 1;
+                uint64_t ones = width >= 64 ? UINT64_MAX : (1ull << width) - 1;
+                c->masks[k] |= ones << (cases[j].lo - c->lo);
+                weights[k]  += cases[j].weight;
+            }
+
+            // heaviest mask gets tested first
+            FOR_N(j, 1, c->count) {
+                for (size_t k = j; k > 0 && weights[k - 1] < weights[k]; k--) {
+                    SWAP(TB_Node*, c->targets[k - 1], c->targets[k]);
+                    SWAP(uint64_t, c->masks[k - 1], c->masks[k]);
+                    SWAP(uint64_t, weights[k - 1], weights[k]);
+                }
+            }
+        } else {
+            c->count = last->hi - first->lo + 1;
+            c->targets = tb_arena_alloc(arena, c->count * sizeof(TB_Node*));
+            FOR_N(j, 0, c->count) {
+                c->targets[j] = p.default_target;
+            }
+
+            // walks the offsets, a range can end at the top of the key space
+            FOR_N(j, i, i + best) {
+                uint64_t start = cases[j].lo - c->lo;
+                for (uint64_t d = 0; d <= cases[j].hi - cases[j].lo; d++) {
+                    c->targets[start + d] = cases[j].target;
+                }
+            }
+        }
+
+        i += best;
+    }
+
+    return p;
+}
+
+// the RA asks about the same switch over and over, so plans are made once per node.
+// they live in the IR arena so the emitter can use them too.
+static SwitchPlan* switch_get_plan(Ctx* restrict ctx, TB_Node* n) {
+    dyn_array_for(i, ctx->switch_plans) {
+        if (ctx->switch_plans[i]->n == n) {
+            return ctx->switch_plans[i];
+        }
+    }
+
+    SwitchPlan* p = tb_arena_alloc(ctx->f->arena, sizeof(SwitchPlan));
+    *p = switch_plan(ctx->f->arena, n);
+    dyn_array_put(ctx->switch_plans, p);
+    return p;
+}
+
+static uint32_t* switch_new_label(SwitchEmit* s) {
+    uint32_t* l = tb_arena_alloc(s->arena, sizeof(uint32_t));
+    *l = 0;
+    return l;
+}
+
+static uint32_t* switch_target_label(Ctx* restrict ctx, TB_CGEmitter* e, TB_Node* target) {
+    return &e->labels[node_to_bb(ctx, target)->id];
+}
+
+// records a table for the cluster, the ref_pos is wherever the target wants
+// patch_jump_table to write the table's address once it's placed.
+static void switch_add_table(Ctx* restrict ctx, uint32_t ref_pos, SwitchCluster* c) {
+    JumpTable jt = { ref_pos, 0, dyn_array_length(ctx->jump_table_entries), c->count };
+    FOR_N(i, 0, c->count) {
+        dyn_array_put(ctx->jump_table_entries, node_to_bb(ctx, c->targets[i])->id);
+    }
+    dyn_array_put(ctx->jump_tables, jt);
+}
+
+// picks the split which best balances the weight on either side, ties go towards
+// the middle.
+static int switch_split(SwitchPlan* p, int a, int b) {
+    uint64_t total = 0;
+    FOR_N(i, a, b) {
+        total += p->clusters[i].weight;
+    }
+
+    int mid = (a + b) / 2, best = mid;
+    uint64_t best_diff = UINT64_MAX, left = 0;
+    FOR_N(k, a + 1, b) {
+        left += p->clusters[k - 1].weight;
+
+        uint64_t right = total - left;
+        uint64_t diff = left > right ? left - right : right - left;
+        int dist = k > mid ? k - mid : mid - k;
+        int best_dist = best > mid ? best - mid : mid - best;
+        if (diff < best_diff || (diff == best_diff && dist < best_dist)) {
+            best = k, best_diff = diff;
+        }
+    }
+
+    return best;
+}
+
+// emits the search for clusters [a, b) where the key is known to be within [lo, hi],
+// tail is set on the last piece of code we emit for the switch.
+static void switch_emit_tree(Ctx* restrict ctx, TB_CGEmitter* e, SwitchEmit* s, int a, int b, uint64_t lo, uint64_t hi, bool tail) {
+    SwitchPlan* p = &s->plan;
+    SwitchCluster* c = p->clusters;
+    if (!p->has_default) {
+        lo = c[a].lo, hi = c[b - 1].hi;
+    }
+
+    if (b - a > SW_LEAF_SIZE) {
+        int k = switch_split(p, a, b);
+        uint32_t* right = switch_new_label(s);
+
+        switch_cmp_branch(ctx, e, s, SW_GE, c[k].lo, right);
+        switch_emit_tree(ctx, e, s, a, k, lo, c[k].lo - 1, false);
+        switch_bind(ctx, e, right);
+        switch_emit_tree(ctx, e, s, k, b, c[k].lo, hi, tail);
+        return;
+    }
+
+    // leaf, test the heaviest clusters first
+    int order[SW_LEAF_SIZE];
+    FOR_N(i, 0, b - a) {
+        int j = i;
+        for (; j > 0 && c[order[j - 1]].weight < c[a + i].weight; j--) {
+            order[j] = order[j - 1];
+        }
+        order[j] = a + i;
+    }
+
+    uint32_t* def = switch_target_label(ctx, e, p->default_target);
+    FOR_N(i, 0, b - a) {
+        SwitchCluster* curr = &c[order[i]];
+        bool last = i + 1 == b - a;
+
+        // nothing to check if it's the only thing the key could be
+        bool exact = (curr->lo <= lo && curr->hi >= hi) || (last && !p->has_default);
+        if (curr->kind == SW_RANGE) {
+            uint32_t* target = switch_target_label(ctx, e, curr->targets[0]);
+            if (exact) {
+                switch_jump(ctx, e, target);
+                return;
+            } else if (curr->lo == curr->hi) {
+                switch_cmp_branch(ctx, e, s, SW_EQ, curr->lo, target);
+            } else if (curr->lo <= lo) {
+                switch_cmp_branch(ctx, e, s, SW_LE, curr->hi, target);
+            } else if (curr->hi >= hi) {
+                switch_cmp_branch(ctx, e, s, SW_GE, curr->lo, target);
+            } else {
+                switch_range_branch(ctx, e, s, curr->lo, curr->hi, target);
+            }
+        } else {
+            uint32_t* miss = last ? def : switch_new_label(s);
+            if (curr->kind == SW_TABLE) {
+                switch_jump_table(ctx, e, s, curr, exact ? NULL : miss);
+                if (last) { return; }
+            } else {
+                switch_bit_test(ctx, e, s, curr, exact ? NULL : miss);
+            }
+
+            if (!last) {
+                switch_bind(ctx, e, miss);
+            }
+        }
+    }
+
+    // nothing matched
+    if (!tail || node_to_bb(ctx, p->default_target)->id != ctx->fallthrough) {
+        switch_jump(ctx, e, def);
+    }
+}
+
+static void switch_emit(Ctx* restrict ctx, TB_CGEmitter* e, SwitchEmit* s) {
+    if (s->plan.cluster_count == 0) {
+        MachineBB* succ = node_to_bb(ctx, s->plan.default_target);
+        if (succ->id != ctx->fallthrough) {
+            switch_jump(ctx, e, &e->labels[succ->id]);
+        }
+    } else {
+        switch_emit_tree(ctx, e, s, 0, s->plan.cluster_count, 0, s->plan.key_max, true);
+    }
+}
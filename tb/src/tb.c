@@ -1,4 +1,5 @@
 #include "tb_internal.h"
+#include "emitter.h"
 #include "host.h"
 #include "opt/passes.h"
 
@@ -92,6 +93,29 @@ TB_ThreadInfo* tb_thread_info(TB_Module* m) {
     return info;
 }
 
+// threads which die before the module does need to call this, otherwise
+// tb_module_destroy would be unlinking the info from a dead thread's chain.
+void tb__thread_info_detach(TB_Module* m) {
+    TB_ThreadInfo* info = tb_thread_info(m);
+
+    mtx_lock(info->lock);
+    if (info->prev == NULL) {
+        *info->chain = info->next;
+    } else {
+        info->prev->next = info->next;
+    }
+
+    if (info->next != NULL) {
+        info->next->prev = info->prev;
+    }
+    mtx_unlock(info->lock);
+
+    // the module still frees it, just without touching the chain
+    info->prev = info->next = NULL;
+    info->chain = NULL;
+    info->lock = NULL;
+}
+
 // we don't modify these strings
 char* tb__arena_strdup(TB_Module* m, ptrdiff_t len, const char* src) {
     if (len < 0) len = src ? strlen(src) : 0;
@@ -132,6 +156,53 @@ TB_Module* tb_module_create_for_host(bool is_jit) {
     return tb_module_create(arch, sys, is_jit);
 }
 
+bool tb_features_from_march(TB_Arch arch, const char* name, TB_FeatureSet* out) {
+    if (arch != TB_ARCH_X86_64) {
+        return false;
+    }
+
+    enum {
+        X64_V1 = TB_FEATURE_X64_SSE2,
+        X64_V2 = X64_V1 | TB_FEATURE_X64_SSE3 | TB_FEATURE_X64_SSE41 | TB_FEATURE_X64_SSE42 | TB_FEATURE_X64_POPCNT,
+        X64_V3 = X64_V2 | TB_FEATURE_X64_LZCNT | TB_FEATURE_X64_CLMUL | TB_FEATURE_X64_F16C
+            | TB_FEATURE_X64_BMI1 | TB_FEATURE_X64_BMI2 | TB_FEATURE_X64_AVX | TB_FEATURE_X64_AVX2,
+        X64_V4 = X64_V3 | TB_FEATURE_X64_AVX512,
+    };
+
+    static const struct {
+        const char* name;
+        uint32_t x64;
+        TB_X64Model model;
+    } marchs[] = {
+        { "generic",   X64_V1, TB_X64_MODEL_GENERIC },
+        { "x86-64",    X64_V1, TB_X64_MODEL_GENERIC },
+        { "x86-64-v2", X64_V2, TB_X64_MODEL_GENERIC },
+        { "x86-64-v3", X64_V3, TB_X64_MODEL_GENERIC },
+        { "x86-64-v4", X64_V4, TB_X64_MODEL_GENERIC },
+        { "haswell",   X64_V3, TB_X64_MODEL_HASWELL },
+        { "broadwell", X64_V3, TB_X64_MODEL_HASWELL },
+        { "skylake",   X64_V3, TB_X64_MODEL_SKYLAKE },
+        { "alderlake", X64_V3, TB_X64_MODEL_SKYLAKE },
+        { "skylake-avx512", X64_V4, TB_X64_MODEL_SKYLAKE },
+        { "icelake-server", X64_V4, TB_X64_MODEL_SKYLAKE },
+        { "sapphirerapids", X64_V4, TB_X64_MODEL_SKYLAKE },
+        { "znver1",    X64_V3, TB_X64_MODEL_ZEN },
+        { "znver2",    X64_V3, TB_X64_MODEL_ZEN },
+        { "znver3",    X64_V3, TB_X64_MODEL_ZEN },
+        { "znver4",    X64_V4, TB_X64_MODEL_ZEN },
+    };
+
+    FOR_N(i, 0, COUNTOF(marchs)) {
+        if (strcmp(marchs[i].name, name) == 0) {
+            out->x64 = marchs[i].x64;
+            out->x64_model = marchs[i].model;
+            return true;
+        }
+    }
+
+    return false;
+}
+
 TB_ModuleSectionHandle tb_module_create_section(TB_Module* m, ptrdiff_t len, const char* name, TB_ModuleSectionFlags flags, TB_ComdatType comdat) {
     size_t i = dyn_array_length(m->sections);
     dyn_array_put_uninit(m->sections, 1);
@@ -199,6 +270,42 @@ TB_Module* tb_module_create(TB_Arch arch, TB_System sys, bool is_jit) {
     return m;
 }
 
+// the emitter's buffer is reused across every function compiled on the thread (by
+// any target), it only ever grows to fit the biggest function so we don't hit the
+// heap per function.
+static thread_local uint8_t* tb_cgemit_scratch;
+static thread_local size_t tb_cgemit_scratch_cap;
+
+void tb_cgemit_grow(TB_CGEmitter* restrict e, size_t min_cap) {
+    size_t cap = tb_cgemit_scratch_cap ? tb_cgemit_scratch_cap : 4096;
+    while (cap <= min_cap) { cap *= 2; }
+
+    if (cap > tb_cgemit_scratch_cap) {
+        tb_cgemit_scratch = cuik_realloc(tb_cgemit_scratch, cap);
+        if (tb_cgemit_scratch == NULL) {
+            tb_panic("could not allocate code buffer (%zu bytes)\n", cap);
+        }
+        tb_cgemit_scratch_cap = cap;
+    }
+
+    e->data = tb_cgemit_scratch;
+    e->capacity = tb_cgemit_scratch_cap;
+}
+
+void tb_cgemit_init(TB_CGEmitter* restrict e, size_t size_hint) {
+    e->count = 0;
+    tb_cgemit_grow(e, size_hint);
+}
+
+uint8_t* tb_cgemit_finalize(TB_CGEmitter* restrict e, TB_Arena* code_arena) {
+    uint8_t* code = tb_arena_alloc(code_arena, e->count);
+    memcpy(code, e->data, e->count);
+
+    e->data = code;
+    e->capacity = e->count;
+    return code;
+}
+
 TB_FunctionOutput* tb_codegen(TB_Function* f, TB_Worklist* ws, TB_Arena* code_arena, const TB_FeatureSet* features, bool emit_asm) {
     assert(f->arena && "missing IR arena?");
     assert(f->tmp_arena && "missing tmp arena?");
@@ -244,6 +351,75 @@ TB_Assembly* tb_output_get_asm(TB_FunctionOutput* out) {
     return out->asm_out;
 }
 
+TB_RegAllocStats* tb_output_get_ra_stats(TB_FunctionOutput* out) {
+    return &out->ra_stats;
+}
+
+void tb_ra_stats_accumulate(TB_RegAllocStats* a, const TB_RegAllocStats* b) {
+    FOR_N(i, 0, TB_MAX_REG_CLASSES) {
+        if (a->max_pressure[i] < b->max_pressure[i]) {
+            a->max_pressure[i] = b->max_pressure[i];
+        }
+    }
+
+    a->spills         += b->spills;
+    a->reloads        += b->reloads;
+    a->folded_reloads += b->folded_reloads;
+    a->remats         += b->remats;
+    a->copies         += b->copies;
+    a->coalesced      += b->coalesced;
+    a->rounds         += b->rounds;
+    a->spill_cost     += b->spill_cost;
+    a->sched_cycles   += b->sched_cycles;
+    a->peep_copies    += b->peep_copies;
+    a->peep_zexts     += b->peep_zexts;
+    a->peep_folds     += b->peep_folds;
+    a->peep_flags     += b->peep_flags;
+    a->delay_slots    += b->delay_slots;
+    a->delay_slots_filled += b->delay_slots_filled;
+    a->wasm_insts      += b->wasm_insts;
+    a->wasm_local_ops  += b->wasm_local_ops;
+    a->wasm_stackified += b->wasm_stackified;
+}
+
+size_t tb_module_get_ra_stats(TB_Module* m, TB_RegAllocStats* out) {
+    *out = (TB_RegAllocStats){ 0 };
+
+    size_t count = 0;
+    TB_SymbolIter it = tb_symbol_iter(m);
+    for (TB_Symbol* s; (s = tb_symbol_iter_next(&it));) {
+        TB_Function* f = tb_symbol_as_function(s);
+        if (f && f->output) {
+            tb_ra_stats_accumulate(out, &f->output->ra_stats);
+            count += 1;
+        }
+    }
+    return count;
+}
+
+void tb_ra_stats_print(const TB_RegAllocStats* stats, FILE* fp) {
+    if (fp == NULL) { fp = stdout; }
+
+    fprintf(fp, "  max pressure:");
+    FOR_N(i, 1, TB_MAX_REG_CLASSES) if (stats->max_pressure[i]) {
+        fprintf(fp, " C%td=%d", i, stats->max_pressure[i]);
+    }
+    fprintf(fp, "\n");
+    fprintf(fp, "  spills:       %d (cost=%.2f)\n", stats->spills, stats->spill_cost);
+    fprintf(fp, "  reloads:      %d (+%d folded)\n", stats->reloads, stats->folded_reloads);
+    fprintf(fp, "  remats:       %d\n", stats->remats);
+    fprintf(fp, "  copies:       %d (%d coalesced)\n", stats->copies, stats->coalesced);
+    fprintf(fp, "  RA rounds:    %d\n", stats->rounds);
+    fprintf(fp, "  sched cycles: %d\n", stats->sched_cycles);
+    fprintf(fp, "  peepholes:    %d copies, %d zext, %d folds, %d flags\n", stats->peep_copies, stats->peep_zexts, stats->peep_folds, stats->peep_flags);
+    if (stats->delay_slots) {
+        fprintf(fp, "  delay slots:  %d/%d filled (%.1f%%)\n", stats->delay_slots_filled, stats->delay_slots, 100.0 * stats->delay_slots_filled / stats->delay_slots);
+    }
+    if (stats->wasm_insts) {
+        fprintf(fp, "  wasm locals:  %d/%d insts (%.1f%%), %d stackified\n", stats->wasm_local_ops, stats->wasm_insts, 100.0 * stats->wasm_local_ops / stats->wasm_insts, stats->wasm_stackified);
+    }
+}
+
 TB_Arena* tb_function_get_arena(TB_Function* f) {
     return f->arena;
 }
@@ -260,13 +436,15 @@ void tb_module_destroy(TB_Module* m) {
 
         // unlink, this needs to be synchronized in case another thread is
         // accessing while we're freeing.
-        mtx_lock(info->lock);
-        if (info->prev == NULL) {
-            *info->chain = info->next;
-        } else {
-            info->prev->next = info->next;
+        if (info->chain != NULL) {
+            mtx_lock(info->lock);
+            if (info->prev == NULL) {
+                *info->chain = info->next;
+            } else {
+                info->prev->next = info->next;
+            }
+            mtx_unlock(info->lock);
         }
-        mtx_unlock(info->lock);
 
         tb_platform_heap_free(info);
         info = next;
@@ -514,6 +692,37 @@ void tb_module_set_tls_index(TB_Module* m, ptrdiff_t len, const char* name) {
     }
 }
 
+void tb_module_set_code_layout(TB_Module* m, const TB_CodeLayout* layout) {
+    // wasm functions are bytecode bodies, there's nothing to align
+    if (m->target_arch == TB_ARCH_WASM32) {
+        return;
+    }
+
+    TB_CodeLayout l = *layout;
+    assert((l.func_align == 0 || tb_is_power_of_two(l.func_align)) && "function alignment must be a power of two");
+    assert((l.loop_align == 0 || tb_is_power_of_two(l.loop_align)) && "loop alignment must be a power of two");
+
+    // loop headers and the JCC erratum boundaries are only
+    // aligned relative to the start of the function.
+    if (l.func_align < l.loop_align) {
+        l.func_align = l.loop_align;
+    }
+
+    if (m->target_arch != TB_ARCH_X86_64) {
+        l.avoid_jcc_erratum = false;
+    }
+
+    if (l.avoid_jcc_erratum && l.func_align < 32) {
+        l.func_align = 32;
+    }
+
+    if (l.loop_max_pad == 0 && l.loop_align > 0) {
+        l.loop_max_pad = l.loop_align - 1;
+    }
+
+    m->layout = l;
+}
+
 void tb_symbol_bind_ptr(TB_Symbol* s, void* ptr) {
     s->address = ptr;
 }
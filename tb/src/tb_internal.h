@@ -104,12 +104,21 @@ struct TB_SymbolPatch {
     TB_Symbol* target;
 };
 
+// wasm call sites which need a type index, call_indirect's immediate and the calls
+// to externals (imports get their type from whoever calls them).
+typedef struct TB_WasmTypePatch TB_WasmTypePatch;
+struct TB_WasmTypePatch {
+    TB_WasmTypePatch* next;
+    uint32_t pos;
+    uint32_t type_index; // filled in by the exporter
+    TB_FunctionPrototype* proto;
+    TB_Symbol* target; // NULL for call_indirect
+};
+
 struct TB_External {
     TB_Symbol super;
     TB_ExternalType type;
 
-    void* thunk; // JIT will cache a thunk here because it's helpful
-
     // if non-NULL, the external was resolved
     _Atomic(TB_Symbol*) resolved;
 };
@@ -267,11 +276,15 @@ typedef struct TB_FunctionOutput {
 
     // export-specific
     uint32_t wasm_type;
+    uint32_t wasm_index;
     uint32_t unwind_info;
     uint32_t unwind_size;
+    TB_WasmTypePatch* wasm_type_patches;
 
     DynArray(TB_StackSlot) stack_slots;
 
+    TB_RegAllocStats ra_stats;
+
     // Part of the debug info
     DynArray(TB_Location) locations;
 
@@ -427,6 +440,10 @@ struct TB_Function {
     };
 
     TB_FunctionOutput* output;
+
+    // if non-NULL, codegen bumps this 32bit global at the entry & loop headers,
+    // the JIT's tiering uses it to find the hot functions.
+    TB_Symbol* counter;
 };
 
 struct TB_ModuleSection {
@@ -504,6 +521,7 @@ struct TB_Module {
     TB_Arch target_arch;
     TB_System target_system;
     TB_FeatureSet features;
+    TB_CodeLayout layout;
     ExportList exports;
 
     // This is a hack for windows since they've got this idea
@@ -631,6 +649,7 @@ do {                                      \
 #endif
 
 TB_ThreadInfo* tb_thread_info(TB_Module* m);
+void tb__thread_info_detach(TB_Module* m);
 
 void* tb_out_reserve(TB_Emitter* o, size_t count);
 void tb_out_commit(TB_Emitter* o, size_t count);
@@ -695,6 +714,12 @@ TB_Node* tb_alloc_node(TB_Function* f, int type, TB_DataType dt, int input_count
 TB_Node* tb__make_proj(TB_Function* f, TB_DataType dt, TB_Node* src, int index);
 void tb_kill_node(TB_Function* f, TB_Node* n);
 
+// deep copies the graph into another function object, it shares the symbol's info
+// (name, prototype, section) but nothing else so it can be optimized & compiled on
+// its own. The copy isn't part of the module, free it with tb__free_clone.
+TB_Function* tb__clone_function(TB_Function* f, TB_Worklist* ws, TB_Arena* arena1, TB_Arena* arena2);
+void tb__free_clone(TB_Function* k);
+
 ExportList tb_module_layout_sections(TB_Module* m);
 
 ////////////////////////////////
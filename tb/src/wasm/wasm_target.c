@@ -3,38 +3,79 @@
 #include "../emitter.h"
 #include "../opt/passes.h"
 
+// How a value gets materialized, the operand stack is our register file for
+// anything that's used once and right away (stackifying), everything else
+// lives in a local and the locals get colored by interference.
+enum {
+    VAL_NONE,  // not a value (control, memory, tuples) or never read
+    VAL_REMAT, // constants & stack slot addresses, recomputed at every use
+    VAL_TREE,  // single use, emitted inline as part of its user's expression
+    VAL_STACK, // root whose result is the first thing the next root pushes
+    VAL_LOCAL, // lives in a local
+    VAL_DROP,  // only computed for its side effects
+};
+
 typedef struct {
-    int id; // where in the locals it went, -1 for unallocated
-    int uses;
+    uint8_t kind;
+    // the next root reads it first, local.tee and leave it on the stack
+    bool tee;
+    // dense index for liveness, -1 if it doesn't live in a local
+    int vreg;
+    // local index
+    int id;
 } ValueDesc;
 
-// control flow element
-typedef struct WasmElem WasmElem;
-struct WasmElem {
-    enum {
-        WASM_BLOCK,
-        WASM_BLOCK2, // body goes after _then case
-        WASM_BR,
-        WASM_IF,
-        WASM_LOOP
-    } tag;
-
-    bool refs;
-    uint16_t depth;
-
-    TB_Node* body;
-    WasmElem* _then;
-    WasmElem* _else; // only relevant for WASM_IF
+enum {
+    WASM_I32 = 0x7F,
+    WASM_I64 = 0x7E,
+    WASM_F32 = 0x7D,
+    WASM_F64 = 0x7C,
 };
 
+// an edge out of a block, phi_index is which phi input we're writing back
+// along it (-1 if the target has no phis for this edge).
+typedef struct {
+    int succ;
+    int phi_index;
+} WasmEdge;
+
 typedef struct DomTree DomTree;
 struct DomTree {
     int id;
-    WasmElem* elem;
+
+    // loop headers get a wasm loop, merge points (more than one forward
+    // edge) get a wasm block which ends right before them.
+    bool loop, merge;
+
     TB_Node *start, *end;
-    DynArray(DomTree*) kids;
+
+    int kid_count;
+    DomTree** kids;
+
+    // scheduled nodes which get emitted at the top level, the terminator
+    // is always the last one.
+    int root_count;
+    TB_Node** roots;
+
+    int edge_count;
+    WasmEdge* edges;
+
+    // liveness over vregs, live_in doesn't include the phis while top does.
+    Set ue, def;
+    Set top, live_in, live_out;
 };
 
+typedef struct {
+    enum {
+        LABEL_BLOCK,
+        LABEL_LOOP,
+        LABEL_IF,
+    } tag;
+
+    // block which we'd be jumping to, -1 if we can't refer to it by name
+    int bb;
+} WasmLabel;
+
 typedef struct Ctx {
     TB_Worklist worklist;
 
@@ -43,23 +84,47 @@ typedef struct Ctx {
     TB_Module* module;
     TB_Function* f;
     TB_FeatureSet features;
+    TB_Arena* arena;
 
     TB_CFG cfg;
     size_t block_count;
 
     DomTree* doms;
-
-    DynArray(DomTree*) filtered;
-    DynArray(PhiVal) phi_vals;
-
-    int stack_n;
-    TB_Node* stack[64];
-
-    DynArray(uint8_t) local_desc;
-    ValueDesc* locals;
+    ValueDesc* values;
+
+    // vreg -> node
+    int vreg_count;
+    DynArray(TB_Node*) vregs;
+    DynArray(int)* adj;
+
+    // structured control flow, innermost label last
+    DynArray(WasmLabel) labels;
+
+    // value left on the operand stack for the next root
+    TB_Node* pending;
+    // the last thing we emitted was an unconditional transfer (br, return, unreachable)
+    bool dead;
+    // position of a trailing "br 0", it can go away if it's right before its own end.
+    int last_br0;
+    // last local.get, a local.set to the same local right after is a no-op.
+    size_t last_get_start, last_get_end;
+    int last_get;
+
+    // locals, the params come first then we have runs of each type.
+    int param_count;
+    int local_count[4];
+    int local_base[4];
+    int param_slots[4];
+    DynArray(int) param_of_type[4];
+
+    // shadow stack frame (lives in linear memory, the pointer is the first global)
+    int fp;
+    uint32_t frame_size;
+
+    TB_RegAllocStats stats;
 } Ctx;
 
-static void indent(int depth) { while (depth--) printf("  "); }
+static int type_class(uint8_t type) { return WASM_I32 - type; }
 
 // uleb128 encode
 static void emit_uint(Ctx* ctx, uint64_t x) {
@@ -73,28 +138,35 @@ static void emit_uint(Ctx* ctx, uint64_t x) {
     } while (x);
 }
 
-WasmElem* new_elem(int tag, TB_Node* body) {
-    WasmElem* e = tb_platform_heap_alloc(sizeof(WasmElem));
-    *e = (WasmElem){ .tag = tag, .body = body };
-    return e;
+// sleb128 encode
+static void emit_sint(Ctx* ctx, int64_t x) {
+    for (;;) {
+        uint32_t lo = x & 0x7F;
+        x >>= 7;
+        if ((x == 0 && (lo & 0x40) == 0) || (x == -1 && (lo & 0x40))) {
+            EMIT1(&ctx->emit, lo);
+            break;
+        }
+        EMIT1(&ctx->emit, lo | 0x80);
+    }
 }
 
 static uint8_t get_wasm_type(TB_DataType dt) {
     switch (dt.type) {
         case TB_TAG_INT: {
-            if (dt.data <= 8)  return 0x7F;
-            if (dt.data <= 16) return 0x7F;
-            if (dt.data <= 32) return 0x7F;
-            if (dt.data <= 64) return 0x7E;
+            if (dt.data <= 8)  return WASM_I32;
+            if (dt.data <= 16) return WASM_I32;
+            if (dt.data <= 32) return WASM_I32;
+            if (dt.data <= 64) return WASM_I64;
             break;
         }
         case TB_TAG_F32: {
-            return 0x7D;
+            return WASM_F32;
         }
         case TB_TAG_F64: {
-            return 0x7C;
+            return WASM_F64;
         }
-        case TB_TAG_PTR: return 0x7F;
+        case TB_TAG_PTR: return WASM_I32;
     }
 
     assert(0 && "TODO");
@@ -113,657 +185,2113 @@ static void patch_uint(uint8_t* p, uint64_t x) {
     }
 }
 
-static int use_count(TB_Node* n) {
-    int c = 0;
-    FOR_USERS(u, n) { c += 1; }
-    return c;
+static bool is_value(TB_Node* n) {
+    return n->dt.type == TB_TAG_INT || n->dt.type == TB_TAG_PTR || n->dt.type == TB_TAG_F32 || n->dt.type == TB_TAG_F64;
 }
 
-static int spill_tos(Ctx* ctx, TB_Node* n) {
-    // if there was something on top, we probably wanna spill it later
-    ValueDesc* spilled = &ctx->locals[n->gvn];
-    if (spilled->id < 0) {
-        dyn_array_put(ctx->local_desc, get_wasm_type(n->dt));
-        spilled->id = dyn_array_length(ctx->local_desc) - 1;
-    }
-    return spilled->id;
+static int int_bits(TB_DataType dt) {
+    return dt.type == TB_TAG_PTR ? 32 : dt.data;
 }
 
-static void push_val(Ctx* ctx, TB_Node* n) {
-    spill_tos(ctx, n);
-    ctx->stack[ctx->stack_n++] = n;
+static bool is_64bit(TB_DataType dt) {
+    return dt.type == TB_TAG_INT && dt.data > 32;
 }
 
-static void compile_bb(Ctx* ctx, TB_Node* bb_start, int depth) {
-    TB_BasicBlock* bb = ctx->f->scheduled[bb_start->gvn];
-    TB_Worklist* ws = &ctx->worklist;
+static bool is_remat(TB_Node* n) {
+    return n->type == TB_ICONST || n->type == TB_F32CONST || n->type == TB_F64CONST || n->type == TB_LOCAL || n->type == TB_POISON || n->type == TB_SYMBOL;
+}
+
+// pure ops (and loads) which can be moved down to their user
+static bool is_tree_op(TB_Node* n) {
+    return n->type == TB_LOAD || (n->type >= TB_PTR_OFFSET && n->type <= TB_CMP_FLE);
+}
 
-    #ifndef NDEBUG
-    TB_BasicBlock* expected = &nl_map_get_checked(ctx->cfg.node_to_block, bb_start);
-    assert(expected == bb);
-    #endif
+static bool is_multiway(TB_Node* n) {
+    return (n->type == TB_BRANCH || n->type == TB_AFFINE_LATCH) && TB_NODE_GET_EXTRA_T(n, TB_NodeBranch)->succ_count > 2;
+}
 
-    dyn_array_clear(ctx->phi_vals);
-    tb_greedy_scheduler(ctx->f, &ctx->cfg, ws, &ctx->phi_vals, bb);
+static TB_BasicBlock* node_bb(Ctx* ctx, TB_Node* n) {
+    return ctx->f->scheduled[n->gvn];
+}
 
-    FOR_N(i, ctx->cfg.block_count, dyn_array_length(ws->items)) {
-        TB_Node* bot = ws->items[i];
-        if (bot->type == TB_SYMBOL || bot->type == TB_PROJ || cfg_is_region(bot) || bot->type == TB_PHI || bot->type == TB_BRANCH) {
-            continue;
+////////////////////////////////
+// Operands
+////////////////////////////////
+// loads & stores fold constant offsets (and stack slots) into the memarg,
+// NULL means the frame pointer is the base.
+static TB_Node* mem_base(Ctx* ctx, TB_Node* addr, uint32_t* out_offset) {
+    uint64_t offset = 0;
+    for (;;) {
+        if (addr->type == TB_PTR_OFFSET && ctx->values[addr->gvn].kind == VAL_TREE && addr->inputs[2]->type == TB_ICONST) {
+            int64_t k = TB_NODE_GET_EXTRA_T(addr->inputs[2], TB_NodeInt)->value;
+            if (k < 0 || offset + k > INT32_MAX) { break; }
+            offset += k;
+            addr = addr->inputs[1];
+        } else if (addr->type == TB_LOCAL) {
+            int pos = TB_NODE_GET_EXTRA_T(addr, TB_NodeLocal)->stack_pos;
+            if (offset + pos > INT32_MAX) { break; }
+            *out_offset = offset + pos;
+            return NULL;
+        } else {
+            break;
         }
+    }
 
-        // begin building up a tree (right now they'll all be tiny)
-        ctx->stack_n  = 1;
-        ctx->stack[0] = bot;
-
-        switch (bot->type) {
-            case TB_ICONST:
-            case TB_F32CONST:
-            case TB_F64CONST:
-            break;
-
-            // integer ops
-            case TB_AND:
-            case TB_OR:
-            case TB_XOR:
-            case TB_ADD:
-            case TB_SUB:
-            case TB_MUL:
-            case TB_SHL:
-            case TB_SHR:
-            case TB_SAR:
-            case TB_CMP_EQ:
-            case TB_CMP_NE:
-            case TB_CMP_SLT:
-            case TB_CMP_SLE:
-            case TB_CMP_ULT:
-            case TB_CMP_ULE:
-            case TB_CMP_FLT:
-            case TB_CMP_FLE:
-            case TB_FADD:
-            case TB_FSUB:
-            case TB_FMUL:
-            case TB_FDIV:
-            push_val(ctx, bot->inputs[2]);
-            push_val(ctx, bot->inputs[1]);
-            break;
-
-            case TB_PTR_OFFSET:
-            push_val(ctx, bot->inputs[2]);
-            push_val(ctx, bot->inputs[1]);
-            break;
+    *out_offset = offset;
+    return addr;
+}
 
-            case TB_CALL:
-            FOR_REV_N(i, 3, bot->input_count) {
-                push_val(ctx, bot->inputs[i]);
-            }
-            break;
+static int operand_count(TB_Node* n) {
+    switch (n->type) {
+        case TB_LOAD:
+        case TB_BRANCH:
+        case TB_AFFINE_LATCH:
+        return 1;
 
-            case TB_LOAD:
-            push_val(ctx, bot->inputs[2]);
-            break;
+        case TB_STORE:
+        return 2;
 
-            case TB_STORE:
-            push_val(ctx, bot->inputs[3]);
-            push_val(ctx, bot->inputs[2]);
-            break;
+        case TB_SELECT:
+        case TB_MEMCPY:
+        case TB_MEMSET:
+        return 3;
 
-            case TB_RETURN: {
-                if (bot->input_count > 3) {
-                    push_val(ctx, bot->inputs[3]);
-                }
-                break;
-            }
+        case TB_CALL:
+        case TB_TAILCALL:
+        // call_indirect pops the table index after the arguments
+        return n->input_count - 3 + (n->inputs[2]->type != TB_SYMBOL);
 
-            default: tb_todo();
-        }
+        case TB_RETURN:
+        return n->input_count - 3;
 
-        // ok emit ops now
-        FOR_REV_N(i, 0, ctx->stack_n) {
-            TB_Node* n = ctx->stack[i];
-            ValueDesc* val = &ctx->locals[n->gvn];
+        case TB_PTR_OFFSET:
+        case TB_AND ... TB_FMAX:
+        case TB_CMP_EQ ... TB_CMP_FLE:
+        return 2;
 
-            if (i != 0 && val->id >= 0) {
-                EMIT1(&ctx->emit, 0x20);
-                emit_uint(ctx, val->id);
-                continue;
-            }
+        case TB_TRUNCATE ... TB_BITCAST:
+        case TB_BSWAP ... TB_FNEG:
+        return 1;
 
-            switch (n->type) {
-                case TB_ICONST: {
-                    TB_NodeInt* i = TB_NODE_GET_EXTRA(n);
-                    EMIT1(&ctx->emit, 0x41);
-                    emit_uint(ctx, i->value);
-                    break;
-                }
+        default:
+        return 0;
+    }
+}
 
-                case TB_F32CONST: {
-                    TB_NodeFloat32* i = TB_NODE_GET_EXTRA(n);
+// operands in the order they get pushed
+static TB_Node* operand(Ctx* ctx, TB_Node* n, int i) {
+    switch (n->type) {
+        case TB_LOAD:
+        case TB_STORE:
+        if (i == 0) {
+            uint32_t offset;
+            return mem_base(ctx, n->inputs[2], &offset);
+        }
+        return n->inputs[3];
 
-                    uint32_t x;
-                    memcpy(&x, &i->value, sizeof(x));
+        case TB_SELECT: {
+            static const int order[] = { 2, 3, 1 };
+            return n->inputs[order[i]];
+        }
 
-                    EMIT1(&ctx->emit, 0x43);
-                    EMIT4(&ctx->emit, x);
-                    break;
-                }
+        case TB_CALL:
+        case TB_TAILCALL:
+        return 3 + i < n->input_count ? n->inputs[3 + i] : n->inputs[2];
 
-                case TB_F64CONST: {
-                    TB_NodeFloat64* i = TB_NODE_GET_EXTRA(n);
+        case TB_MEMCPY:
+        case TB_MEMSET:
+        case TB_RETURN:
+        return n->inputs[2 + i + (n->type == TB_RETURN)];
 
-                    uint64_t x;
-                    memcpy(&x, &i->value, sizeof(x));
+        default:
+        return n->inputs[1 + i];
+    }
+}
 
-                    EMIT1(&ctx->emit, 0x44);
-                    EMIT8(&ctx->emit, x);
-                    break;
-                }
+// the first value which n pushes, NULL if it's something we make up
+// on the spot (constants, frame pointer) or the operand is read more
+// than once.
+static TB_Node* first_operand(Ctx* ctx, TB_Node* n) {
+    if (operand_count(n) == 0 || n->type == TB_BSWAP || is_multiway(n)) {
+        return NULL;
+    }
 
-                // integer ops
-                case TB_AND:
-                case TB_OR:
-                case TB_XOR:
-                case TB_ADD:
-                case TB_SUB:
-                case TB_MUL: {
-                    static const uint8_t ops[] = { 0x71, 0x72, 0x73, 0x6A, 0x6B, 0x6C };
-
-                    assert(n->dt.type == TB_TAG_INT);
-                    int base = n->dt.data > 32 ? 0x7C - 0x6A : 0;
-                    EMIT1(&ctx->emit, base + ops[n->type - TB_AND]);
-                    break;
-                }
+    if (n->type == TB_NEG) {
+        // we push a zero first
+        return NULL;
+    }
 
-                // float ops
-                case TB_FADD:
-                case TB_FSUB:
-                case TB_FMUL:
-                case TB_FDIV:
-                case TB_FMIN:
-                case TB_FMAX: {
-                    assert(n->dt.type == TB_TAG_F64 || n->dt.type == TB_TAG_F32);
-                    int base = n->type == TB_TAG_F64 ? 0xA0 : 0x92;
-                    EMIT1(&ctx->emit, base + (n->type - TB_FADD));
-                    break;
-                }
+    return operand(ctx, n, 0);
+}
 
-                case TB_SHL:
-                case TB_SHR:
-                case TB_SAR: {
-                    static const uint8_t ops[] = { 0 /* shl */, 2 /* shr */, 1 /* sar */ };
+static TB_Node* first_leaf(Ctx* ctx, TB_Node* n) {
+    TB_Node* x = first_operand(ctx, n);
+    while (x && ctx->values[x->gvn].kind == VAL_TREE) {
+        x = first_operand(ctx, x);
+    }
+    return x;
+}
 
-                    int base = n->dt.data > 32 ? 0x86 : 0x74;
-                    EMIT1(&ctx->emit, base + ops[n->type - TB_SHL]);
-                    break;
-                }
+// every local n's expression tree reads
+static void mark_reads(Ctx* ctx, TB_Node* n, Set* live) {
+    int count = operand_count(n);
+    FOR_N(i, 0, count) {
+        TB_Node* x = operand(ctx, n, i);
+        if (x == NULL) { continue; }
+
+        ValueDesc* v = &ctx->values[x->gvn];
+        if (v->kind == VAL_TREE) {
+            mark_reads(ctx, x, live);
+        } else if (v->kind == VAL_LOCAL) {
+            set_put(live, v->vreg);
+        }
+    }
+}
 
-                case TB_LOAD: {
-                    TB_CharUnits align = TB_NODE_GET_EXTRA_T(n, TB_NodeMemAccess)->align;
-                    if (n->dt.type == TB_TAG_INT) {
-                        if (0) {}
-                        else if (n->dt.data <= 8)  { EMIT1(&ctx->emit, 0x2D); } // i32.load8_u
-                        else if (n->dt.data <= 16) { EMIT1(&ctx->emit, 0x2E); } // i32.load16_u
-                        else if (n->dt.data <= 32) { EMIT1(&ctx->emit, 0x28); } // i32.load
-                        else if (n->dt.data <= 64) { EMIT1(&ctx->emit, 0x29); } // i64.load
-                        else tb_todo();
-                    } else {
-                        if (0) {}
-                        else if (n->dt.data == TB_TAG_F32) { EMIT1(&ctx->emit, 0x2A); } // f32.load
-                        else if (n->dt.data == TB_TAG_F64) { EMIT1(&ctx->emit, 0x2B); } // f64.load
-                        else tb_todo();
-                    }
+static void mark_edge_reads(Ctx* ctx, WasmEdge* e, Set* live) {
+    if (e->phi_index < 0) { return; }
 
-                    // memarg
-                    EMIT1(&ctx->emit, align); // align
-                    EMIT1(&ctx->emit, 0x00);  // offset
-                    break;
-                }
+    TB_Node* region = ctx->doms[e->succ].start;
+    FOR_USERS(u, region) {
+        TB_Node* phi = USERN(u);
+        if (phi->type != TB_PHI || ctx->values[phi->gvn].kind != VAL_LOCAL) { continue; }
 
-                case TB_STORE: {
-                    TB_CharUnits align = TB_NODE_GET_EXTRA_T(n, TB_NodeMemAccess)->align;
-                    TB_DataType dt = n->dt;
-                    if (dt.type == TB_TAG_INT) {
-                        if (0) {}
-                        else if (dt.data <= 8)  { EMIT1(&ctx->emit, 0x3A); } // i32.store8_u
-                        else if (dt.data <= 16) { EMIT1(&ctx->emit, 0x3B); } // i32.store16_u
-                        else if (dt.data <= 32) { EMIT1(&ctx->emit, 0x36); } // i32.store
-                        else if (dt.data <= 64) { EMIT1(&ctx->emit, 0x37); } // i64.store
-                        else tb_todo();
-                    } else {
-                        if (0) {}
-                        else if (dt.data == TB_TAG_F32) { EMIT1(&ctx->emit, 0x38); } // f32.store
-                        else if (dt.data == TB_TAG_F64) { EMIT1(&ctx->emit, 0x39); } // f64.store
-                        else tb_todo();
-                    }
+        TB_Node* x = phi->inputs[1 + e->phi_index];
+        ValueDesc* v = &ctx->values[x->gvn];
+        if (v->kind == VAL_TREE) {
+            mark_reads(ctx, x, live);
+        } else if (v->kind == VAL_LOCAL) {
+            set_put(live, v->vreg);
+        }
+    }
+}
 
-                    // memarg
-                    EMIT1(&ctx->emit, align); // align
-                    EMIT1(&ctx->emit, 0x00);
-                    break;
-                }
+// locals written by a root
+static int root_defs(Ctx* ctx, TB_Node* n, TB_Node** defs, int cap) {
+    if (n->type == TB_CALL) {
+        int count = 0;
+        FOR_USERS(u, n) {
+            TB_Node* un = USERN(u);
+            if (un->type == TB_PROJ && ctx->values[un->gvn].kind == VAL_LOCAL && count < cap) {
+                defs[count++] = un;
+            }
+        }
+        return count;
+    } else if (ctx->values[n->gvn].kind == VAL_LOCAL) {
+        defs[0] = n;
+        return 1;
+    } else {
+        return 0;
+    }
+}
 
-                case TB_PTR_OFFSET: {
-                    // i32.add
-                    EMIT1(&ctx->emit, 0x6A);
-                    break;
-                }
+// single value produced by a root, it's a candidate for staying on the stack
+static TB_Node* root_value(Ctx* ctx, TB_Node* n) {
+    if (n->type == TB_CALL) {
+        TB_NodeCall* c = TB_NODE_GET_EXTRA(n);
+        if (c->proto->return_count != 1) { return NULL; }
 
+        TB_User* u = proj_with_index(n, 2);
+        return u ? USERN(u) : NULL;
+    }
 
-                case TB_CALL: {
-                    assert(n->inputs[2]->type == TB_SYMBOL);
-                    TB_Symbol* sym = TB_NODE_GET_EXTRA_T(n->inputs[2], TB_NodeSymbol)->sym;
+    return is_value(n) ? n : NULL;
+}
 
-                    // call
-                    EMIT1(&ctx->emit, 0x10);
-                    EMIT4(&ctx->emit, 0x00808080);
-                    tb_emit_symbol_patch(ctx->emit.output, sym, ctx->emit.count - 4);
-                    break;
-                }
+////////////////////////////////
+// Liveness & local coloring
+////////////////////////////////
+static int new_vreg(Ctx* ctx, TB_Node* n) {
+    ValueDesc* v = &ctx->values[n->gvn];
+    v->kind = VAL_LOCAL;
+    v->vreg = ctx->vreg_count++;
+    dyn_array_put(ctx->vregs, n);
+    return v->vreg;
+}
 
-                case TB_CMP_EQ:
-                case TB_CMP_NE:
-                case TB_CMP_SLT:
-                case TB_CMP_SLE:
-                case TB_CMP_ULT:
-                case TB_CMP_ULE:
-                {
-                    // position of the 32bit ops, we'll relocate for 64bit ones (same offsets)
-                    static const uint8_t ops[] = { 0x46, 0x47, 0x48, 0x4C, 0x49, 0x4D };
-
-                    if (n->dt.type == TB_TAG_INT || n->dt.type == TB_TAG_PTR) {
-                        int bits = n->dt.type == TB_TAG_INT ? n->dt.data : 32;
-                        int base = bits > 32 ? 0x51 - 0x46 : 0;
-
-                        EMIT1(&ctx->emit, base + ops[n->type - TB_CMP_EQ]);
-                    } else {
-                        tb_todo();
-                    }
-                    break;
-                }
+static void add_edge(Ctx* ctx, int a, int b) {
+    TB_Node* an = ctx->vregs[a];
+    TB_Node* bn = ctx->vregs[b];
+    if (a != b && get_wasm_type(an->dt) == get_wasm_type(bn->dt)) {
+        dyn_array_put(ctx->adj[a], b);
+        dyn_array_put(ctx->adj[b], a);
+    }
+}
 
-                case TB_RETURN: {
-                    EMIT1(&ctx->emit, 0x0F);
-                    break;
-                }
+static void interfere_with_set(Ctx* ctx, int v, Set* live) {
+    size_t words = (live->capacity + 63) / 64;
+    FOR_N(i, 0, words) {
+        uint64_t bits = live->data[i];
+        while (bits) {
+            int j = i*64 + tb_ffs64(bits) - 1;
+            bits &= bits - 1;
+            add_edge(ctx, v, j);
+        }
+    }
+}
 
-                default: tb_todo();
-            }
+static void compute_liveness(Ctx* ctx) {
+    TB_Arena* arena = ctx->arena;
+    int n = ctx->vreg_count;
+
+    FOR_N(i, 0, ctx->block_count) {
+        DomTree* bb = &ctx->doms[i];
+        bb->ue       = set_create_in_arena(arena, n);
+        bb->def      = set_create_in_arena(arena, n);
+        bb->top      = set_create_in_arena(arena, n);
+        bb->live_in  = set_create_in_arena(arena, n);
+        bb->live_out = set_create_in_arena(arena, n);
+
+        // phi moves happen after everything else
+        FOR_N(j, 0, bb->edge_count) {
+            mark_edge_reads(ctx, &bb->edges[j], &bb->ue);
         }
 
-        if (bot->dt.type == TB_TAG_INT || bot->dt.type == TB_TAG_PTR || bot->dt.type == TB_TAG_F64 || bot->dt.type == TB_TAG_F32) {
-            int dst = spill_tos(ctx, bot);
-            EMIT1(&ctx->emit, 0x21);
-            emit_uint(ctx, dst);
+        FOR_REV_N(j, 0, bb->root_count) {
+            TB_Node* defs[16];
+            int def_count = root_defs(ctx, bb->roots[j], defs, 16);
+            FOR_N(k, 0, def_count) {
+                int v = ctx->values[defs[k]->gvn].vreg;
+                set_remove(&bb->ue, v);
+                set_put(&bb->def, v);
+            }
+            mark_reads(ctx, bb->roots[j], &bb->ue);
         }
     }
 
-    // if the endpoint is a not a terminator, we've hit some implicit GOTO edge
-    TB_Node* end = bb->end;
-    if (!cfg_is_terminator(end)) {
-        // writeback phis
-        FOR_N(i, 0, dyn_array_length(ctx->phi_vals)) {
-            PhiVal* v = &ctx->phi_vals[i];
+    // iterate to a fixpoint, backwards dataflow converges faster in post order
+    bool changes;
+    do {
+        changes = false;
+        FOR_REV_N(i, 0, ctx->block_count) {
+            DomTree* bb = &ctx->doms[i];
+            FOR_N(j, 0, bb->edge_count) {
+                set_union(&bb->live_out, &ctx->doms[bb->edges[j].succ].live_in);
+            }
+
+            // top = ue | (live_out - def)
+            size_t words = (n + 63) / 64;
+            FOR_N(k, 0, words) {
+                bb->top.data[k] = bb->ue.data[k] | (bb->live_out.data[k] & ~bb->def.data[k]);
+            }
+
+            // phis are defined on the edges into us
+            Set live_in = set_create_in_arena(arena, n);
+            set_copy(&live_in, &bb->top);
+            if (cfg_is_region(bb->start)) {
+                FOR_USERS(u, bb->start) {
+                    ValueDesc* v = &ctx->values[USERN(u)->gvn];
+                    if (USERN(u)->type == TB_PHI && v->kind == VAL_LOCAL) {
+                        set_remove(&live_in, v->vreg);
+                    }
+                }
+            }
 
-            // get_local src
-            int src = ctx->locals[v->n->gvn].id;
-            EMIT1(&ctx->emit, 0x20);
-            emit_uint(ctx, src);
-            // set_local dst
-            int dst = spill_tos(ctx, v->phi);
-            EMIT1(&ctx->emit, 0x21);
-            emit_uint(ctx, dst);
+            if (!set_equals(&live_in, &bb->live_in)) {
+                set_copy(&bb->live_in, &live_in);
+                changes = true;
+            }
         }
-    }
+    } while (changes);
 }
 
-static TB_Node** successors(Ctx* ctx, TB_Worklist* ws, TB_Node* end, size_t* out_succ_count) {
-    size_t succ_count = !cfg_is_endpoint(end);
-    if (end->type == TB_BRANCH) {
-        succ_count = TB_NODE_GET_EXTRA_T(end, TB_NodeBranch)->succ_count;
-    }
-    *out_succ_count = succ_count;
+static void build_interference(Ctx* ctx) {
+    TB_Arena* arena = ctx->arena;
+    int n = ctx->vreg_count;
 
-    size_t base = dyn_array_length(ws->items);
-    dyn_array_put_uninit(ws->items, succ_count);
-    TB_Node** succ_blocks = &ws->items[base];
+    ctx->adj = tb_arena_alloc(arena, n * sizeof(DynArray(int)));
+    FOR_N(i, 0, n) {
+        ctx->adj[i] = NULL;
+    }
 
-    if (end->type == TB_BRANCH) {
-        FOR_USERS(u, end) {
-            if (USERN(u)->type == TB_PROJ) {
-                TB_Node* succ = cfg_next_bb_after_cproj(USERN(u));
-                int index = TB_NODE_GET_EXTRA_T(USERN(u), TB_NodeProj)->index;
-                succ_blocks[index] = succ;
+    Set live = set_create_in_arena(arena, n);
+    FOR_N(i, 0, ctx->block_count) {
+        DomTree* bb = &ctx->doms[i];
+
+        // each edge writes the target's phis, they can't clobber anything which
+        // is live into the target (including each other).
+        FOR_N(j, 0, bb->edge_count) {
+            WasmEdge* e = &bb->edges[j];
+            if (e->phi_index < 0) { continue; }
+
+            DomTree* dst = &ctx->doms[e->succ];
+            FOR_USERS(u, dst->start) {
+                ValueDesc* v = &ctx->values[USERN(u)->gvn];
+                if (USERN(u)->type != TB_PHI || v->kind != VAL_LOCAL) { continue; }
+
+                interfere_with_set(ctx, v->vreg, &dst->top);
+                FOR_USERS(u2, dst->start) {
+                    ValueDesc* v2 = &ctx->values[USERN(u2)->gvn];
+                    if (USERN(u2)->type == TB_PHI && v2->kind == VAL_LOCAL) {
+                        add_edge(ctx, v->vreg, v2->vreg);
+                    }
+                }
             }
         }
-    } else if (!cfg_is_endpoint(end)) {
-        TB_Node* succ = cfg_next_control(end);
-        if (succ) { succ_blocks[0] = succ; }
-    }
 
-    return succ_blocks;
-}
+        set_copy(&live, &bb->live_out);
+        FOR_N(j, 0, bb->edge_count) {
+            mark_edge_reads(ctx, &bb->edges[j], &live);
+        }
+
+        FOR_REV_N(j, 0, bb->root_count) {
+            TB_Node* defs[16];
+            int def_count = root_defs(ctx, bb->roots[j], defs, 16);
+            FOR_N(k, 0, def_count) {
+                int v = ctx->values[defs[k]->gvn].vreg;
+                interfere_with_set(ctx, v, &live);
+                FOR_N(l, 0, k) {
+                    add_edge(ctx, v, ctx->values[defs[l]->gvn].vreg);
+                }
+            }
 
-static bool wasm_is_natural_loop(Ctx* ctx, TB_Node* header) {
-    if (cfg_is_region(header)) {
-        FOR_N(i, 0, header->input_count) {
-            TB_Node* pred = cfg_get_pred(&ctx->cfg, header, i);
-            if (slow_dommy(&ctx->cfg, header, pred)) {
-                return true;
+            FOR_N(k, 0, def_count) {
+                set_remove(&live, ctx->values[defs[k]->gvn].vreg);
             }
+            mark_reads(ctx, bb->roots[j], &live);
         }
     }
+}
 
-    return false;
+static int slot_of(Ctx* ctx, int vreg) {
+    return ctx->values[ctx->vregs[vreg]->gvn].id;
 }
 
-static bool has_merge_root(Ctx* ctx, TB_Node* n, int id) {
-    if (!cfg_is_region(n)) {
-        return false;
+// try to land on the same slot as whatever we're moving in/out of over phi
+// edges, that way the move disappears.
+static int coalesce_hint(Ctx* ctx, TB_Node* n, Set* taken) {
+    // conversions which don't change the wasm type are just copies
+    if ((n->type == TB_TRUNCATE || n->type == TB_BITCAST) && get_wasm_type(n->dt) == get_wasm_type(n->inputs[1]->dt)) {
+        ValueDesc* v = &ctx->values[n->inputs[1]->gvn];
+        if (v->kind == VAL_LOCAL && v->id >= 0 && !set_get(taken, v->id)) {
+            return v->id;
+        }
     }
 
-    FOR_N(i, 0, n->input_count) {
-        TB_Node* pred = cfg_get_pred(&ctx->cfg, n, i);
-        TB_BasicBlock* pred_bb = ctx->f->scheduled[pred->gvn];
+    if (n->type == TB_PHI) {
+        FOR_N(i, 1, n->input_count) {
+            ValueDesc* v = &ctx->values[n->inputs[i]->gvn];
+            if (v->kind == VAL_LOCAL && v->id >= 0 && !set_get(taken, v->id)) {
+                return v->id;
+            }
+        }
+    }
 
-        if (pred_bb->id >= id) {
-            return false;
+    FOR_USERS(u, n) {
+        ValueDesc* v = &ctx->values[USERN(u)->gvn];
+        if (USERN(u)->type == TB_PHI && v->id >= 0 && !set_get(taken, v->id)) {
+            return v->id;
         }
     }
 
-    return true;
+    return -1;
 }
 
-static WasmElem* do_dom_tree(Ctx* ctx, DomTree* node);
+// greedy coloring in definition order, the ids are slots within each type
+// for now (params of that type come first) and we map them to real local
+// indices once we know how many of each we need.
+static void color_locals(Ctx* ctx) {
+    int n = ctx->vreg_count;
+    Set taken = set_create_in_arena(ctx->arena, n + 1);
+
+    FOR_N(i, 0, n) {
+        TB_Node* vn = ctx->vregs[i];
+        ValueDesc* v = &ctx->values[vn->gvn];
+        if (v->id >= 0) { continue; }
+
+        set_clear(&taken);
+        dyn_array_for(j, ctx->adj[i]) {
+            int slot = slot_of(ctx, ctx->adj[i][j]);
+            if (slot >= 0) { set_put(&taken, slot); }
+        }
 
-static WasmElem* do_branch(Ctx* ctx, DomTree* src, TB_Node* bb_start) {
-    TB_BasicBlock* bb = ctx->f->scheduled[bb_start->gvn];
-    DomTree* dst = &ctx->doms[bb->id];
+        int slot = coalesce_hint(ctx, vn, &taken);
+        if (slot < 0) {
+            slot = 0;
+            while (set_get(&taken, slot)) { slot++; }
+        }
+        v->id = slot;
 
-    if (dst->id < src->id || has_merge_root(ctx, bb_start, dst->id)) {
-        // forward or backwards edge (continue/break)
-        WasmElem* e = new_elem(WASM_BR, NULL);
-        assert(dst->elem);
-        e->_then = dst->elem;
-        dst->elem->refs = true;
-        return e;
-    } else {
-        return do_dom_tree(ctx, dst);
+        int t = type_class(get_wasm_type(vn->dt));
+        int extra = slot - ctx->param_slots[t];
+        if (extra >= ctx->local_count[t]) {
+            ctx->local_count[t] = extra + 1;
+        }
     }
 }
 
-static WasmElem* do_dom_tree(Ctx* ctx, DomTree* node) {
-    bool loop = wasm_is_natural_loop(ctx, node->start);
-    WasmElem* e = node->elem = new_elem(loop ? WASM_LOOP : WASM_BLOCK, node->start);
+static void assign_local_indices(Ctx* ctx) {
+    // the frame pointer is one extra i32
+    int i32_count = ctx->local_count[0];
+    if (ctx->frame_size) {
+        ctx->local_count[0] += 1;
+    }
 
-    // find merges (embed within each other)
-    size_t base = dyn_array_length(ctx->filtered);
-    WasmElem* last = NULL;
-    FOR_N(i, 0, dyn_array_length(node->kids)) {
-        TB_Node* start = node->kids[i]->start;
-        TB_BasicBlock* start_bb = ctx->f->scheduled[start->gvn];
+    int base = ctx->param_count;
+    FOR_N(t, 0, 4) {
+        ctx->local_base[t] = base;
+        base += ctx->local_count[t];
+    }
+    ctx->fp = ctx->local_base[0] + i32_count;
 
-        DomTree* kid = node->kids[i];
-        if (has_merge_root(ctx, start, start_bb->id)) {
-            dyn_array_put(ctx->filtered, kid);
+    FOR_N(i, 0, ctx->vreg_count) {
+        TB_Node* vn = ctx->vregs[i];
+        ValueDesc* v = &ctx->values[vn->gvn];
 
-            if (last) {
-                WasmElem* new_e = new_elem(WASM_BLOCK2, start);
-                new_e->_then = last;
-                last = kid->elem = new_e;
-            } else {
-                // __debugbreak();
-                last = kid->elem;
-            }
+        int t = type_class(get_wasm_type(vn->dt));
+        if (v->id < ctx->param_slots[t]) {
+            v->id = ctx->param_of_type[t][v->id];
+        } else {
+            v->id = ctx->local_base[t] + (v->id - ctx->param_slots[t]);
         }
     }
 
-    // exit path of node
-    size_t succ_count;
-    TB_Node** succ_blocks = successors(ctx, &ctx->worklist, node->end, &succ_count);
-    printf("succ_count = %zu\n", succ_count);
-    if (succ_count == 1) {
-        e->_then = do_branch(ctx, node, succ_blocks[0]);
-    } else if (succ_count == 2) {
-        WasmElem* if_block = new_elem(WASM_IF, NULL);
-        e->_then = if_block;
-        if_block->_then = do_branch(ctx, node, succ_blocks[0]);
-        if_block->_else = do_branch(ctx, node, succ_blocks[1]);
-    } else if (succ_count != 0) {
-        tb_todo();
+    FOR_N(t, 0, 4) {
+        ctx->stats.max_pressure[1 + t] = ctx->param_slots[t] + ctx->local_count[t];
     }
+}
 
-    // compile merges
-    FOR_N(i, base, dyn_array_length(ctx->filtered)) {
-        do_dom_tree(ctx, ctx->filtered[i]);
+////////////////////////////////
+// Scheduling & stackification
+////////////////////////////////
+static bool can_stackify(Ctx* ctx, TB_BasicBlock* bb, TB_Node* n, int pos, int count, int* rootpos, int* effects) {
+    if (!is_tree_op(n) || n->user_count != 1) {
+        return false;
     }
-    if (ctx->filtered) {
-        dyn_array_set_length(ctx->filtered, base);
+
+    TB_Node* use = USERN(n->users);
+    int at;
+    if (use->type == TB_PHI) {
+        // phi moves happen at the end of the block, we can only do this
+        // if we're the block feeding that edge.
+        int slot = USERI(n->users);
+        if (cfg_get_pred(&ctx->cfg, use->inputs[0], slot - 1) != bb->start) {
+            return false;
+        }
+        at = count;
+    } else {
+        if (node_bb(ctx, use) != bb || use->type == TB_BSWAP || is_multiway(use)) {
+            return false;
+        }
+        at = rootpos[use->gvn];
     }
-    return e;
-}
 
-static const char* elem_name(WasmElem* elem) {
-    switch (elem->tag) {
-        case WASM_BLOCK:  return "block";
-        case WASM_BLOCK2: return "block";
-        case WASM_LOOP:   return "loop";
-        case WASM_BR:     return "br";
-        case WASM_IF:     return "if";
-        default:          return NULL;
+    if (at < pos) {
+        return false;
     }
+
+    // loads can't move past stores
+    return n->type != TB_LOAD || effects[at] == effects[pos + 1];
 }
 
-static uint8_t elem_byte(WasmElem* elem) {
-    switch (elem->tag) {
-        case WASM_BLOCK:  return 0x02;
-        case WASM_BLOCK2: return 0x02;
-        case WASM_LOOP:   return 0x03;
-        case WASM_IF:     return 0x04;
-        default:          return 0;
+static void schedule_block(Ctx* ctx, DomTree* node, int* rootpos) {
+    TB_Function* f = ctx->f;
+    TB_Worklist* ws = &ctx->worklist;
+    TB_BasicBlock* bb = node_bb(ctx, node->start);
+
+    size_t base = dyn_array_length(ws->items);
+    tb_greedy_scheduler(f, &ctx->cfg, ws, NULL, bb);
+
+    int count = dyn_array_length(ws->items) - base;
+    TB_Node** items = &ws->items[base];
+
+    // prefix counts of memory effects, we don't move loads across them
+    int* effects = tb_arena_alloc(ctx->arena, (count + 1) * sizeof(int));
+    effects[0] = 0;
+    FOR_N(i, 0, count) {
+        effects[i + 1] = effects[i] + (is_mem_out_op(items[i]) && items[i]->type != TB_PHI);
     }
-}
 
-static void render_block(Ctx* ctx, WasmElem* elem, int depth) {
-    elem->depth = depth;
+    // bottom-up so the users are classified first
+    int root_count = 0;
+    FOR_REV_N(i, 0, count) {
+        TB_Node* n = items[i];
+        ValueDesc* v = &ctx->values[n->gvn];
+        rootpos[n->gvn] = -1;
+
+        switch (n->type) {
+            case TB_ROOT:
+            case TB_REGION:
+            case TB_NATURAL_LOOP:
+            case TB_AFFINE_LOOP:
+            case TB_PHI:
+            case TB_PROJ:
+            case TB_BRANCH_PROJ:
+            case TB_MACH_PROJ:
+            case TB_SPLITMEM:
+            case TB_MERGEMEM:
+            case TB_CALLGRAPH:
+            case TB_DEBUG_LOCATION:
+            case TB_SAFEPOINT_POLL:
+            case TB_PREFETCH:
+            case TB_DEAD:
+            case TB_NEVER_BRANCH:
+            break;
+
+            case TB_LOCAL: {
+                TB_NodeLocal* l = TB_NODE_GET_EXTRA(n);
+                uint32_t align = l->align ? l->align : 1;
+                ctx->frame_size = (ctx->frame_size + align - 1) & ~(align - 1);
+                l->stack_pos = ctx->frame_size;
+                ctx->frame_size += l->size;
+                v->kind = VAL_REMAT;
+                break;
+            }
+
+            case TB_STORE:
+            case TB_MEMCPY:
+            case TB_MEMSET:
+            case TB_CALL:
+            case TB_TAILCALL:
+            case TB_RETURN:
+            case TB_BRANCH:
+            case TB_AFFINE_LATCH:
+            case TB_TRAP:
+            case TB_UNREACHABLE:
+            case TB_DEBUGBREAK:
+            rootpos[n->gvn] = i;
+            root_count++;
+            break;
 
-    // no block necessary if no one jumps to it
-    bool is_block = elem->tag == WASM_IF || elem->refs > 0;
-    if (is_block) {
-        indent(depth), printf("%s", elem_name(elem));
-        if (elem->tag != WASM_BR) {
-            printf(" (depth=%d)", depth);
+            case TB_ATOMIC_LOAD ... TB_ATOMIC_CAS:
+            // the module's memory isn't shared, there's no threads for them to sync with
+            // but we'd still need the threads proposal's encodings.
+            tb_panic("wasm: %s uses %s, atomics aren't supported", ctx->f->super.name, tb_node_get_name(n->type));
+
+            default: {
+                if (!is_value(n)) {
+                    // anything else with memory or tuples we don't know about
+                    tb_todo();
+                } else if (is_remat(n)) {
+                    v->kind = VAL_REMAT;
+                } else if (can_stackify(ctx, bb, n, i, count, rootpos, effects)) {
+                    v->kind = VAL_TREE;
+                    TB_Node* use = USERN(n->users);
+                    rootpos[n->gvn] = use->type == TB_PHI ? count : rootpos[use->gvn];
+                    ctx->stats.wasm_stackified += 1;
+                } else {
+                    v->kind = n->user_count ? VAL_LOCAL : VAL_DROP;
+                    rootpos[n->gvn] = i;
+                    root_count++;
+                }
+                break;
+            }
         }
-        printf("\n");
-    }
 
-    int inner_depth = depth + is_block;
-    switch (elem->tag) {
-        case WASM_BLOCK:
-        case WASM_LOOP:
-        if (elem->body) { indent(inner_depth), printf("v%u\n", elem->body->gvn); }
-        if (elem->_then) { render_block(ctx, elem->_then, inner_depth); }
-        break;
+        // call results
+        if (n->type == TB_PROJ && is_value(n) && n->inputs[0]->type == TB_CALL) {
+            v->kind = n->user_count ? VAL_LOCAL : VAL_DROP;
+        }
+    }
 
-        case WASM_BLOCK2:
-        if (elem->_then) { render_block(ctx, elem->_then, inner_depth); }
-        if (elem->body) { indent(inner_depth), printf("v%u\n", elem->body->gvn); }
-        break;
+    node->root_count = 0;
+    node->roots = tb_arena_alloc(ctx->arena, root_count * sizeof(TB_Node*));
+    FOR_N(i, 0, count) {
+        TB_Node* n = items[i];
+        if (rootpos[n->gvn] == i) {
+            node->roots[node->root_count++] = n;
+        }
+    }
+    assert(node->root_count == root_count);
 
-        case WASM_IF:
-        render_block(ctx, elem->_then, inner_depth);
-        indent(depth), printf("else\n");
-        render_block(ctx, elem->_else, inner_depth);
-        break;
+    // results which the very next root pushes first can stay on the stack
+    FOR_N(i, 0, root_count - 1) {
+        TB_Node* v = root_value(ctx, node->roots[i]);
+        if (v == NULL || ctx->values[v->gvn].kind != VAL_LOCAL) {
+            continue;
+        }
 
-        case WASM_BR:
-        indent(depth), printf("br %d\n", elem->_then->depth);
-        break;
+        if (first_leaf(ctx, node->roots[i + 1]) == v) {
+            if (v->user_count == 1) {
+                ctx->values[v->gvn].kind = VAL_STACK;
+                ctx->stats.wasm_stackified += 1;
+            } else {
+                ctx->values[v->gvn].tee = true;
+            }
+        }
     }
 
-    if (is_block) {
-        indent(depth), printf("end\n");
+    dyn_array_set_length(ws->items, base);
+}
+
+static void add_successor(Ctx* ctx, DomTree* node, TB_Node* edge, TB_Node* succ) {
+    WasmEdge* e = &node->edges[node->edge_count++];
+    e->succ = node_bb(ctx, succ)->id;
+    e->phi_index = -1;
+
+    // the edge feeds directly into a region
+    if (edge != succ && cfg_has_non_mem_phis(succ)) {
+        FOR_USERS(u, edge) {
+            if (USERN(u) == succ) {
+                e->phi_index = USERI(u);
+                break;
+            }
+        }
     }
 }
 
-static void compile_block(Ctx* ctx, WasmElem* elem, int depth) {
-    elem->depth = depth;
+static void find_successors(Ctx* ctx, DomTree* node) {
+    TB_Node* end = node->end;
 
-    // no block necessary if no one jumps to it
-    bool is_block = elem->tag == WASM_IF || elem->refs > 0;
-    if (is_block) {
-        EMIT1(&ctx->emit, elem_byte(elem));
-        EMIT1(&ctx->emit, 0x40);
+    size_t succ_count = !cfg_is_endpoint(end);
+    if (end->type == TB_BRANCH || end->type == TB_AFFINE_LATCH) {
+        succ_count = TB_NODE_GET_EXTRA_T(end, TB_NodeBranch)->succ_count;
     }
 
-    int inner_depth = depth + is_block;
-    switch (elem->tag) {
-        case WASM_BLOCK:
-        case WASM_LOOP:
-        if (elem->body) { compile_bb(ctx, elem->body, inner_depth); }
-        if (elem->_then) { compile_block(ctx, elem->_then, inner_depth); }
-        break;
+    node->edge_count = 0;
+    node->edges = tb_arena_alloc(ctx->arena, succ_count * sizeof(WasmEdge));
+    if (end->type == TB_BRANCH || end->type == TB_AFFINE_LATCH) {
+        // edges are in successor order
+        FOR_N(i, 0, succ_count) {
+            TB_Node* proj = USERN(proj_with_index(end, i));
+            add_successor(ctx, node, proj, cfg_next_bb_after_cproj(proj));
+        }
+    } else if (end->type == TB_NEVER_BRANCH) {
+        TB_Node* proj = USERN(proj_with_index(end, 0));
+        add_successor(ctx, node, proj, cfg_next_bb_after_cproj(proj));
+    } else if (!cfg_is_endpoint(end)) {
+        add_successor(ctx, node, end, cfg_next_control(end));
+    }
+}
 
-        case WASM_BLOCK2:
-        if (elem->_then) { compile_block(ctx, elem->_then, inner_depth); }
-        if (elem->body) { compile_bb(ctx, elem->body, inner_depth); }
-        break;
+////////////////////////////////
+// Emitting ops
+////////////////////////////////
+static void emit_op(Ctx* ctx, uint8_t op) {
+    EMIT1(&ctx->emit, op);
+}
 
-        case WASM_IF:
-        compile_block(ctx, elem->_then, inner_depth);
-        EMIT1(&ctx->emit, 0x05);
-        compile_block(ctx, elem->_else, inner_depth);
-        break;
+static void emit_local(Ctx* ctx, uint8_t op, int id) {
+    size_t start = ctx->emit.count;
+    EMIT1(&ctx->emit, op);
+    emit_uint(ctx, id);
 
-        case WASM_BR:
-        EMIT1(&ctx->emit, 0x0C);
-        emit_uint(ctx, depth - elem->_then->depth);
-        break;
+    if (op == 0x20) {
+        ctx->last_get = id;
+        ctx->last_get_start = start;
+        ctx->last_get_end = ctx->emit.count;
     }
+}
 
-    if (is_block) {
-        EMIT1(&ctx->emit, 0x0B);
+static void emit_iconst(Ctx* ctx, TB_DataType dt, uint64_t x) {
+    if (is_64bit(dt)) {
+        EMIT1(&ctx->emit, 0x42);
+        emit_sint(ctx, (int64_t) x);
+    } else {
+        EMIT1(&ctx->emit, 0x41);
+        emit_sint(ctx, (int32_t) x);
     }
 }
 
-static int dom_sort_cmp(const void* a, const void* b) {
-    DomTree* const* aa = a;
-    DomTree* const* bb = b;
-    return aa[0]->id - bb[0]->id;
+// memarg is the log2 alignment followed by the offset
+static void emit_memarg(Ctx* ctx, TB_Node* n, int size, uint32_t offset) {
+    int align = TB_NODE_GET_EXTRA_T(n, TB_NodeMemAccess)->align;
+    int lg = align > 0 ? tb_ffs(align) - 1 : 0;
+    int natural = tb_ffs(size) - 1;
+    emit_uint(ctx, lg < natural ? lg : natural);
+    emit_uint(ctx, offset);
 }
 
-static int node_latency(TB_Function* f, TB_Node* n, TB_Node* end) {
-    return 1;
+// values narrower than 32bits live in an i32 with garbage in the top bits,
+// ops which care about those bits clean them up first.
+static void emit_normalize(Ctx* ctx, TB_DataType dt, bool is_signed) {
+    if (dt.type != TB_TAG_INT || dt.data >= 32) {
+        return;
+    }
+
+    int bits = dt.data;
+    if (!is_signed) {
+        emit_iconst(ctx, TB_TYPE_I32, (1u << bits) - 1);
+        emit_op(ctx, 0x71); // i32.and
+    } else if (bits == 8) {
+        emit_op(ctx, 0xC0); // i32.extend8_s
+    } else if (bits == 16) {
+        emit_op(ctx, 0xC1); // i32.extend16_s
+    } else {
+        emit_iconst(ctx, TB_TYPE_I32, 32 - bits);
+        emit_op(ctx, 0x74); // i32.shl
+        emit_iconst(ctx, TB_TYPE_I32, 32 - bits);
+        emit_op(ctx, 0x75); // i32.shr_s
+    }
 }
 
-static void compile_function(TB_Function* restrict f, TB_FunctionOutput* restrict func_out, const TB_FeatureSet* features, TB_Arena* code_arena, bool emit_asm) {
-    TB_Arena* arena = tb_arena_create(1 << 16);
-    TB_ArenaSavepoint sp = tb_arena_save(arena);
+// moves between wasm's value types without caring about the TB types
+static void emit_convert(Ctx* ctx, TB_DataType src, TB_DataType dst) {
+    uint8_t from = get_wasm_type(src), to = get_wasm_type(dst);
+    if (from == to) {
+        return;
+    }
 
-    TB_OPTDEBUG(CODEGEN)(tb_pass_print(p));
+    if (0) {}
+    else if (from == WASM_I64 && to == WASM_I32) { emit_op(ctx, 0xA7); } // i32.wrap_i64
+    else if (from == WASM_I32 && to == WASM_I64) { emit_normalize(ctx, src, false); emit_op(ctx, 0xAD); } // i64.extend_i32_u
+    else if (from == WASM_F32 && to == WASM_I32) { emit_op(ctx, 0xBC); } // i32.reinterpret_f32
+    else if (from == WASM_F64 && to == WASM_I64) { emit_op(ctx, 0xBD); } // i64.reinterpret_f64
+    else if (from == WASM_I32 && to == WASM_F32) { emit_op(ctx, 0xBE); } // f32.reinterpret_i32
+    else if (from == WASM_I64 && to == WASM_F64) { emit_op(ctx, 0xBF); } // f64.reinterpret_i64
+    else tb_todo();
+}
 
-    Ctx ctx = {
-        .module = f->super.module,
-        .f = f,
-        .emit = {
-            .output = func_out,
-            .arena = arena,
-            .has_comments = false,
+static void emit_remat(Ctx* ctx, TB_Node* n) {
+    switch (n->type) {
+        case TB_ICONST: {
+            emit_iconst(ctx, n->dt, TB_NODE_GET_EXTRA_T(n, TB_NodeInt)->value);
+            break;
         }
-    };
 
-    // allocate entire top of the code arena (we'll trim it later if possible)
-    ctx.emit.capacity = code_arena->avail - code_arena->limit;
-    ctx.emit.data = tb_arena_alloc(code_arena, ctx.emit.capacity);
-    ctx.local_desc = dyn_array_create(uint8_t, 32);
-
-    // patch place for the code size of the function
-    EMIT4(&ctx.emit, 0x00808080);
-    EMIT4(&ctx.emit, 0x00808080);
+        case TB_F32CONST: {
+            TB_NodeFloat32* i = TB_NODE_GET_EXTRA(n);
 
-    ctx.locals = tb_arena_alloc(arena, f->node_count * sizeof(ValueDesc));
-    FOR_N(i, 0, f->node_count) {
-        ctx.locals[i].id = -1;
-    }
+            uint32_t x;
+            memcpy(&x, &i->value, sizeof(x));
 
-    FOR_USERS(u, f->root_node) if (USERN(u)->type == TB_PROJ) {
-        int i = TB_NODE_GET_EXTRA_T(USERN(u), TB_NodeProj)->index;
-        if (i >= 3) {
-            // params fit into the first few locals
-            ctx.locals[USERN(u)->gvn].id = i - 3;
-            ctx.locals[USERN(u)->gvn].uses = use_count(USERN(u));
-            dyn_array_put(ctx.local_desc, get_wasm_type(USERN(u)->dt));
+            EMIT1(&ctx->emit, 0x43);
+            EMIT4(&ctx->emit, x);
+            break;
         }
-    }
 
-    if (features == NULL) {
-        ctx.features = (TB_FeatureSet){ 0 };
-    } else {
-        ctx.features = *features;
-    }
+        case TB_F64CONST: {
+            TB_NodeFloat64* i = TB_NODE_GET_EXTRA(n);
 
-    TB_Worklist* restrict ws = &ctx.worklist;
+            uint64_t x;
+            memcpy(&x, &i->value, sizeof(x));
 
-    // legalize step takes out any of our 16bit and 8bit math ops
-    tb_opt_legalize(f, f->super.module->target_arch);
+            EMIT1(&ctx->emit, 0x44);
+            EMIT8(&ctx->emit, x);
+            break;
+        }
 
-    worklist_clear(ws);
+        case TB_POISON: {
+            if (n->dt.type == TB_TAG_F32) {
+                EMIT1(&ctx->emit, 0x43);
+                EMIT4(&ctx->emit, 0);
+            } else if (n->dt.type == TB_TAG_F64) {
+                EMIT1(&ctx->emit, 0x44);
+                EMIT8(&ctx->emit, 0);
+            } else {
+                emit_iconst(ctx, n->dt, 0);
+            }
+            break;
+        }
 
-    CUIK_TIMED_BLOCK("global sched") {
-        ctx.cfg = tb_compute_rpo(f, ws);
-        ctx.block_count = dyn_array_length(ws->items);
+        case TB_LOCAL: {
+            int pos = TB_NODE_GET_EXTRA_T(n, TB_NodeLocal)->stack_pos;
+            emit_local(ctx, 0x20, ctx->fp);
+            if (pos) {
+                emit_iconst(ctx, TB_TYPE_I32, pos);
+                emit_op(ctx, 0x6A); // i32.add
+            }
+            break;
+        }
 
-        tb_global_schedule(f, ws, ctx.cfg, true, true, node_latency);
-    }
+        case TB_SYMBOL: {
+            // functions are slots in the table and globals are linear memory
+            // addresses, neither is known until the module is laid out.
+            TB_Symbol* sym = TB_NODE_GET_EXTRA_T(n, TB_NodeSymbol)->sym;
+            EMIT1(&ctx->emit, 0x41);
+            EMIT4(&ctx->emit, 0x80808080);
+            EMIT1(&ctx->emit, 0x00);
+            tb_emit_symbol_patch(ctx->emit.output, sym, ctx->emit.count - 5);
+            break;
+        }
 
-    DomTree* doms = ctx.doms = tb_arena_alloc(arena, ctx.cfg.block_count * sizeof(DomTree));
-    FOR_N(i, 0, ctx.cfg.block_count) {
-        doms[i].id    = i;
-        doms[i].elem  = NULL;
-        doms[i].start = NULL;
-        doms[i].end   = NULL;
-        doms[i].kids  = NULL;
+        default: tb_todo();
     }
+}
 
-    FOR_N(i, 0, ctx.cfg.block_count) {
-        TB_BasicBlock* bb = ctx.f->scheduled[ws->items[i]->gvn];
-        doms[i].start = ws->items[i];
-        doms[i].end   = bb->end;
+static void emit_node(Ctx* ctx, TB_Node* n);
 
-        dyn_array_put(doms[bb->dom->id].kids, &doms[bb->id]);
+static void emit_operand(Ctx* ctx, TB_Node* n) {
+    if (ctx->pending == n) {
+        // it's already on the stack
+        ctx->pending = NULL;
+        return;
     }
 
-    FOR_N(i, 0, ctx.cfg.block_count) {
-        DomTree* node = &ctx.doms[i];
-        qsort(node->kids, dyn_array_length(node->kids), sizeof(DomTree*), dom_sort_cmp);
-    }
+    ValueDesc* v = &ctx->values[n->gvn];
+    switch (v->kind) {
+        case VAL_TREE:
+        emit_node(ctx, n);
+        break;
 
-    CUIK_TIMED_BLOCK("emit") {
-        worklist_clear_visited(ws);
+        case VAL_REMAT:
+        assert(ctx->pending == NULL);
+        emit_remat(ctx, n);
+        break;
 
-        WasmElem* root = do_dom_tree(&ctx, &doms[0]);
-        #if TB_OPTDEBUG_CODEGEN
-        render_block(&ctx, root, 0);
-        #endif
-        compile_block(&ctx, root, 0);
-    }
+        case VAL_LOCAL:
+        assert(ctx->pending == NULL);
+        emit_local(ctx, 0x20, v->id);
+        break;
+
+        default:
+        tb_todo();
+    }
+}
+
+static void emit_address(Ctx* ctx, TB_Node* addr, uint32_t* offset) {
+    TB_Node* base = mem_base(ctx, addr, offset);
+    if (base) {
+        emit_operand(ctx, base);
+    } else {
+        assert(ctx->pending == NULL);
+        emit_local(ctx, 0x20, ctx->fp);
+    }
+}
+
+// pushes an operand with the bits above its width cleaned up, compares, narrow
+// loads and constants come out that way already.
+static void emit_clean_operand(Ctx* ctx, TB_Node* n, bool is_signed) {
+    int bits = int_bits(n->dt);
+    if (n->dt.type != TB_TAG_INT || bits >= 32) {
+        emit_operand(ctx, n);
+    } else if (n->type == TB_ICONST && ctx->values[n->gvn].kind == VAL_REMAT) {
+        uint64_t x = TB_NODE_GET_EXTRA_T(n, TB_NodeInt)->value & ((1u << bits) - 1);
+        if (is_signed && (x >> (bits - 1))) {
+            x |= ~0ull << bits;
+        }
+        emit_iconst(ctx, TB_TYPE_I32, x);
+    } else if (!is_signed && (n->type == TB_LOAD || (n->type >= TB_CMP_EQ && n->type <= TB_CMP_FLE))) {
+        emit_operand(ctx, n);
+    } else {
+        emit_operand(ctx, n);
+        emit_normalize(ctx, n->dt, is_signed);
+    }
+}
+
+static void emit_binop(Ctx* ctx, TB_Node* n, uint8_t op, bool normalize, bool is_signed) {
+    if (normalize) {
+        emit_clean_operand(ctx, n->inputs[1], is_signed);
+        emit_clean_operand(ctx, n->inputs[2], is_signed);
+    } else {
+        emit_operand(ctx, n->inputs[1]);
+        emit_operand(ctx, n->inputs[2]);
+    }
+    emit_op(ctx, op);
+}
+
+static void emit_node(Ctx* ctx, TB_Node* n) {
+    // i64 versions of the integer ops are all the same distance away
+    int wide = is_64bit(n->dt) ? 0x12 : 0;
+
+    switch (n->type) {
+        // integer ops
+        case TB_AND:
+        case TB_OR:
+        case TB_XOR:
+        case TB_ADD:
+        case TB_SUB:
+        case TB_MUL: {
+            static const uint8_t ops[] = { 0x71, 0x72, 0x73, 0x6A, 0x6B, 0x6C };
+            emit_binop(ctx, n, ops[n->type - TB_AND] + wide, false, false);
+            break;
+        }
+
+        case TB_UDIV:
+        case TB_SDIV:
+        case TB_UMOD:
+        case TB_SMOD: {
+            static const uint8_t ops[] = { 0x6E, 0x6D, 0x70, 0x6F };
+            bool is_signed = n->type == TB_SDIV || n->type == TB_SMOD;
+            emit_binop(ctx, n, ops[n->type - TB_UDIV] + wide, true, is_signed);
+            break;
+        }
+
+        case TB_SHL:
+        case TB_SHR:
+        case TB_SAR:
+        case TB_ROL:
+        case TB_ROR: {
+            static const uint8_t ops[] = { 0x74, 0x76, 0x75, 0x77, 0x78 };
+            if (int_bits(n->dt) < 32 && (n->type == TB_ROL || n->type == TB_ROR)) {
+                tb_todo();
+            }
+
+            if (n->type != TB_SHL) {
+                emit_clean_operand(ctx, n->inputs[1], n->type == TB_SAR);
+            } else {
+                emit_operand(ctx, n->inputs[1]);
+            }
+            // wasm wants the shift amount in the same type
+            emit_clean_operand(ctx, n->inputs[2], false);
+            emit_convert(ctx, n->inputs[2]->dt, n->dt);
+            emit_op(ctx, ops[n->type - TB_SHL] + wide);
+            break;
+        }
+
+        case TB_NEG: {
+            emit_iconst(ctx, n->dt, 0);
+            emit_operand(ctx, n->inputs[1]);
+            emit_op(ctx, 0x6B + wide); // sub
+            break;
+        }
+
+        case TB_CLZ:
+        case TB_CTZ:
+        case TB_POPCNT: {
+            TB_Node* src = n->inputs[1];
+            int bits = int_bits(src->dt);
+
+            emit_operand(ctx, src);
+            if (bits > 32) {
+                emit_op(ctx, 0x79 + (n->type - TB_CLZ));
+                emit_convert(ctx, src->dt, n->dt);
+                break;
+            }
+
+            if (n->type == TB_CTZ) {
+                // plant a bit just above the top so zero gives us the width
+                if (bits < 32) {
+                    emit_iconst(ctx, TB_TYPE_I32, 1u << bits);
+                    emit_op(ctx, 0x72); // i32.or
+                }
+            } else {
+                emit_normalize(ctx, src->dt, false);
+            }
+
+            emit_op(ctx, 0x67 + (n->type - TB_CLZ));
+            if (n->type == TB_CLZ && bits < 32) {
+                emit_iconst(ctx, TB_TYPE_I32, 32 - bits);
+                emit_op(ctx, 0x6B); // i32.sub
+            }
+            emit_convert(ctx, TB_TYPE_I32, n->dt);
+            break;
+        }
+
+        case TB_BSWAP: {
+            // no bswap in wasm, shift each byte into place and OR it together
+            TB_Node* src = n->inputs[1];
+            int bytes = int_bits(n->dt) / 8;
+            FOR_N(i, 0, bytes) {
+                int from = i*8, to = (bytes - 1 - i)*8;
+                emit_operand(ctx, src);
+                if (from) {
+                    emit_iconst(ctx, n->dt, from);
+                    emit_op(ctx, 0x76 + wide); // shr_u
+                }
+                emit_iconst(ctx, n->dt, 0xFF);
+                emit_op(ctx, 0x71 + wide); // and
+                if (to) {
+                    emit_iconst(ctx, n->dt, to);
+                    emit_op(ctx, 0x74 + wide); // shl
+                }
+                if (i) {
+                    emit_op(ctx, 0x72 + wide); // or
+                }
+            }
+            break;
+        }
+
+        // float ops
+        case TB_FADD:
+        case TB_FSUB:
+        case TB_FMUL:
+        case TB_FDIV:
+        case TB_FMIN:
+        case TB_FMAX: {
+            assert(n->dt.type == TB_TAG_F64 || n->dt.type == TB_TAG_F32);
+            int base = n->dt.type == TB_TAG_F64 ? 0xA0 : 0x92;
+            emit_binop(ctx, n, base + (n->type - TB_FADD), false, false);
+            break;
+        }
+
+        case TB_FNEG: {
+            emit_operand(ctx, n->inputs[1]);
+            emit_op(ctx, n->dt.type == TB_TAG_F64 ? 0x9A : 0x8C);
+            break;
+        }
+
+        case TB_CMP_EQ:
+        case TB_CMP_NE:
+        case TB_CMP_ULT:
+        case TB_CMP_ULE:
+        case TB_CMP_SLT:
+        case TB_CMP_SLE:
+        case TB_CMP_FLT:
+        case TB_CMP_FLE: {
+            TB_DataType cmp_dt = TB_NODE_GET_EXTRA_T(n, TB_NodeCompare)->cmp_dt;
+            if (TB_IS_FLOAT_TYPE(cmp_dt)) {
+                // eq, ne, _, _, _, _, lt, le
+                static const uint8_t ops[] = { 0, 1, 0, 0, 0, 0, 2, 4 };
+                int base = cmp_dt.type == TB_TAG_F64 ? 0x61 : 0x5B;
+                emit_binop(ctx, n, base + ops[n->type - TB_CMP_EQ], false, false);
+            } else {
+                static const uint8_t ops[] = { 0x46, 0x47, 0x49, 0x4D, 0x48, 0x4C };
+                int shift = is_64bit(cmp_dt) ? 0x0B : 0;
+                bool is_signed = n->type == TB_CMP_SLT || n->type == TB_CMP_SLE;
+
+                TB_Node* b = n->inputs[2];
+                if (n->type == TB_CMP_EQ && b->type == TB_ICONST && TB_NODE_GET_EXTRA_T(b, TB_NodeInt)->value == 0) {
+                    emit_clean_operand(ctx, n->inputs[1], false);
+                    emit_op(ctx, 0x45 + shift); // eqz
+                } else {
+                    emit_binop(ctx, n, ops[n->type - TB_CMP_EQ] + shift, true, is_signed);
+                }
+            }
+            break;
+        }
+
+        case TB_SELECT: {
+            emit_operand(ctx, n->inputs[2]);
+            emit_operand(ctx, n->inputs[3]);
+            emit_clean_operand(ctx, n->inputs[1], false);
+            emit_op(ctx, 0x1B);
+            break;
+        }
+
+        case TB_PTR_OFFSET: {
+            emit_operand(ctx, n->inputs[1]);
+            emit_operand(ctx, n->inputs[2]);
+            emit_convert(ctx, n->inputs[2]->dt, TB_TYPE_I32);
+            emit_op(ctx, 0x6A); // i32.add
+            break;
+        }
+
+        // conversions
+        case TB_TRUNCATE: {
+            emit_operand(ctx, n->inputs[1]);
+            if (is_64bit(n->inputs[1]->dt) && !is_64bit(n->dt)) {
+                emit_op(ctx, 0xA7); // i32.wrap_i64
+            }
+            break;
+        }
+
+        case TB_ZERO_EXT:
+        case TB_SIGN_EXT: {
+            TB_DataType src = n->inputs[1]->dt;
+            bool is_signed = n->type == TB_SIGN_EXT;
+
+            emit_clean_operand(ctx, n->inputs[1], is_signed);
+            if (!is_64bit(src) && is_64bit(n->dt)) {
+                emit_op(ctx, is_signed ? 0xAC : 0xAD); // i64.extend_i32
+            }
+            break;
+        }
+
+        case TB_FLOAT_EXT: {
+            emit_operand(ctx, n->inputs[1]);
+            emit_op(ctx, 0xBB); // f64.promote_f32
+            break;
+        }
+
+        case TB_FLOAT_TRUNC: {
+            emit_operand(ctx, n->inputs[1]);
+            emit_op(ctx, 0xB6); // f32.demote_f64
+            break;
+        }
+
+        case TB_INT2FLOAT:
+        case TB_UINT2FLOAT: {
+            TB_DataType src = n->inputs[1]->dt;
+            bool is_signed = n->type == TB_INT2FLOAT;
+
+            emit_clean_operand(ctx, n->inputs[1], is_signed);
+
+            // f32.convert_i32_s is 0xB2, then _u, then i64 _s/_u. f64 is +5.
+            int op = (n->dt.type == TB_TAG_F64 ? 0xB7 : 0xB2) + (is_64bit(src) ? 2 : 0) + !is_signed;
+            emit_op(ctx, op);
+            break;
+        }
+
+        case TB_FLOAT2INT:
+        case TB_FLOAT2UINT: {
+            TB_DataType src = n->inputs[1]->dt;
+            bool is_signed = n->type == TB_FLOAT2INT;
+
+            emit_operand(ctx, n->inputs[1]);
+
+            // i32.trunc_f32_s is 0xA8, then _u, then f64 _s/_u. i64 is +6.
+            int op = (is_64bit(n->dt) ? 0xAE : 0xA8) + (src.type == TB_TAG_F64 ? 2 : 0) + !is_signed;
+            emit_op(ctx, op);
+            break;
+        }
+
+        case TB_BITCAST: {
+            emit_operand(ctx, n->inputs[1]);
+            emit_convert(ctx, n->inputs[1]->dt, n->dt);
+            break;
+        }
+
+        case TB_LOAD: {
+            uint32_t offset;
+            emit_address(ctx, n->inputs[2], &offset);
+
+            int size;
+            TB_DataType dt = n->dt;
+            if (dt.type == TB_TAG_INT) {
+                if (0) {}
+                else if (dt.data <= 8)  { emit_op(ctx, 0x2D), size = 1; } // i32.load8_u
+                else if (dt.data <= 16) { emit_op(ctx, 0x2F), size = 2; } // i32.load16_u
+                else if (dt.data <= 32) { emit_op(ctx, 0x28), size = 4; } // i32.load
+                else if (dt.data <= 64) { emit_op(ctx, 0x29), size = 8; } // i64.load
+                else tb_todo();
+            } else {
+                if (0) {}
+                else if (dt.type == TB_TAG_PTR) { emit_op(ctx, 0x28), size = 4; } // i32.load
+                else if (dt.type == TB_TAG_F32) { emit_op(ctx, 0x2A), size = 4; } // f32.load
+                else if (dt.type == TB_TAG_F64) { emit_op(ctx, 0x2B), size = 8; } // f64.load
+                else tb_todo();
+            }
+            emit_memarg(ctx, n, size, offset);
+            break;
+        }
+
+        default: tb_todo();
+    }
+}
+
+// writes the result of a root wherever it needs to go
+static void emit_def(Ctx* ctx, TB_Node* n) {
+    ValueDesc* v = n ? &ctx->values[n->gvn] : NULL;
+    if (v == NULL || v->kind == VAL_DROP || v->kind == VAL_NONE) {
+        emit_op(ctx, 0x1A); // drop
+    } else if (v->kind == VAL_STACK) {
+        ctx->pending = n;
+    } else if (ctx->last_get_end == ctx->emit.count && ctx->last_get == v->id) {
+        // copy into the same local, coloring put both ends in the same place
+        if (v->tee) {
+            ctx->pending = n;
+        } else {
+            ctx->emit.count = ctx->last_get_start;
+        }
+        ctx->stats.coalesced += 1;
+    } else if (v->tee) {
+        emit_local(ctx, 0x22, v->id);
+        ctx->pending = n;
+    } else {
+        assert(v->kind == VAL_LOCAL);
+        emit_local(ctx, 0x21, v->id);
+    }
+}
+
+static void emit_type_patch(Ctx* ctx, TB_FunctionPrototype* proto, TB_Symbol* target, size_t pos) {
+    TB_FunctionOutput* func_out = ctx->emit.output;
+    TB_WasmTypePatch* p = tb_arena_alloc(get_permanent_arena(ctx->module), sizeof(TB_WasmTypePatch));
+    *p = (TB_WasmTypePatch){ .next = func_out->wasm_type_patches, .pos = pos, .proto = proto, .target = target };
+    func_out->wasm_type_patches = p;
+}
+
+static void emit_call(Ctx* ctx, TB_Node* n) {
+    FOR_N(i, 3, n->input_count) {
+        emit_operand(ctx, n->inputs[i]);
+    }
+
+    TB_FunctionPrototype* proto = n->type == TB_CALL
+        ? TB_NODE_GET_EXTRA_T(n, TB_NodeCall)->proto
+        : TB_NODE_GET_EXTRA_T(n, TB_NodeTailcall)->proto;
+
+    TB_Node* target = n->inputs[2];
+    if (target->type != TB_SYMBOL) {
+        // function pointers are indices into the table, the type index
+        // gets patched in once the exporter has built the type section.
+        emit_operand(ctx, target);
+        EMIT1(&ctx->emit, 0x11);
+        EMIT4(&ctx->emit, 0x00808080);
+        emit_type_patch(ctx, proto, NULL, ctx->emit.count - 4);
+        EMIT1(&ctx->emit, 0x00); // table 0
+        return;
+    }
+
+    TB_Symbol* sym = TB_NODE_GET_EXTRA_T(target, TB_NodeSymbol)->sym;
+    if (sym->tag == TB_SYMBOL_GLOBAL) {
+        tb_panic("wasm: %s calls %s which is a global", ctx->f->super.name, sym->name);
+    }
+
+    // call, the function index gets patched in once we know the layout
+    EMIT1(&ctx->emit, 0x10);
+    EMIT4(&ctx->emit, 0x00808080);
+    tb_emit_symbol_patch(ctx->emit.output, sym, ctx->emit.count - 4);
+    if (sym->tag == TB_SYMBOL_EXTERNAL) {
+        emit_type_patch(ctx, proto, sym, ctx->emit.count - 4);
+    }
+}
+
+static void emit_epilogue(Ctx* ctx) {
+    if (ctx->frame_size) {
+        emit_local(ctx, 0x20, ctx->fp);
+        emit_iconst(ctx, TB_TYPE_I32, ctx->frame_size);
+        emit_op(ctx, 0x6A); // i32.add
+        emit_local(ctx, 0x24, 0); // global.set __stack_pointer
+    }
+}
+
+static void emit_root(Ctx* ctx, TB_Node* n) {
+    switch (n->type) {
+        case TB_STORE: {
+            uint32_t offset;
+            emit_address(ctx, n->inputs[2], &offset);
+            emit_operand(ctx, n->inputs[3]);
+
+            int size;
+            TB_DataType dt = n->inputs[3]->dt;
+            if (dt.type == TB_TAG_INT) {
+                if (0) {}
+                else if (dt.data <= 8)  { emit_op(ctx, 0x3A), size = 1; } // i32.store8
+                else if (dt.data <= 16) { emit_op(ctx, 0x3B), size = 2; } // i32.store16
+                else if (dt.data <= 32) { emit_op(ctx, 0x36), size = 4; } // i32.store
+                else if (dt.data <= 64) { emit_op(ctx, 0x37), size = 8; } // i64.store
+                else tb_todo();
+            } else {
+                if (0) {}
+                else if (dt.type == TB_TAG_PTR) { emit_op(ctx, 0x36), size = 4; } // i32.store
+                else if (dt.type == TB_TAG_F32) { emit_op(ctx, 0x38), size = 4; } // f32.store
+                else if (dt.type == TB_TAG_F64) { emit_op(ctx, 0x39), size = 8; } // f64.store
+                else tb_todo();
+            }
+            emit_memarg(ctx, n, size, offset);
+            break;
+        }
+
+        case TB_MEMCPY:
+        case TB_MEMSET: {
+            emit_operand(ctx, n->inputs[2]);
+            emit_operand(ctx, n->inputs[3]);
+            emit_operand(ctx, n->inputs[4]);
+            emit_convert(ctx, n->inputs[4]->dt, TB_TYPE_I32);
+
+            // memory.copy & memory.fill (bulk memory ops)
+            EMIT1(&ctx->emit, 0xFC);
+            if (n->type == TB_MEMCPY) {
+                EMIT1(&ctx->emit, 0x0A);
+                EMIT1(&ctx->emit, 0x00);
+            } else {
+                EMIT1(&ctx->emit, 0x0B);
+            }
+            EMIT1(&ctx->emit, 0x00);
+            break;
+        }
+
+        case TB_CALL: {
+            emit_call(ctx, n);
+
+            // results come out in order, so we pop them back to front
+            TB_NodeCall* c = TB_NODE_GET_EXTRA(n);
+            FOR_REV_N(i, 0, c->proto->return_count) {
+                TB_User* u = proj_with_index(n, 2 + i);
+                emit_def(ctx, u ? USERN(u) : NULL);
+            }
+            break;
+        }
+
+        case TB_DEBUGBREAK: {
+            emit_op(ctx, 0x00); // unreachable
+            break;
+        }
+
+        default: {
+            emit_node(ctx, n);
+            emit_def(ctx, n);
+            break;
+        }
+    }
+}
+
+////////////////////////////////
+// Structured control flow
+////////////////////////////////
+// We follow "Beyond Relooper" (Ramsey 2022): walk the dominator tree, loop
+// headers open a loop, and each merge point gets a block which is closed
+// right before it so forward edges are just a br out of that block.
+static void do_tree(Ctx* ctx, DomTree* node);
+
+static void push_label(Ctx* ctx, int tag, int bb) {
+    WasmLabel l = { tag, bb };
+    dyn_array_put(ctx->labels, l);
+}
+
+static int label_depth(Ctx* ctx, int tag, int bb) {
+    size_t count = dyn_array_length(ctx->labels);
+    FOR_REV_N(i, 0, count) {
+        if (ctx->labels[i].tag == tag && ctx->labels[i].bb == bb) {
+            return count - 1 - i;
+        }
+    }
+
+    tb_unreachable();
+    return 0;
+}
+
+static void emit_br(Ctx* ctx, int depth) {
+    if (depth == 0 && ctx->labels[dyn_array_length(ctx->labels) - 1].tag == LABEL_BLOCK) {
+        ctx->last_br0 = ctx->emit.count;
+    }
+
+    emit_op(ctx, 0x0C);
+    emit_uint(ctx, depth);
+    ctx->dead = true;
+}
+
+static void emit_begin(Ctx* ctx, uint8_t op, int tag, int bb) {
+    emit_op(ctx, op);
+    emit_op(ctx, 0x40); // no results
+    push_label(ctx, tag, bb);
+    ctx->dead = false;
+}
+
+static void emit_end(Ctx* ctx) {
+    WasmLabel l = dyn_array_pop(ctx->labels);
+
+    // "br 0" right before the end of its own block is a fallthrough
+    if (l.tag == LABEL_BLOCK && ctx->last_br0 >= 0 && ctx->last_br0 + 2 == ctx->emit.count) {
+        ctx->emit.count -= 2;
+    }
+    ctx->last_br0 = -1;
+
+    // the validator doesn't treat anything after an end as unreachable
+    emit_op(ctx, 0x0B);
+    ctx->dead = false;
+}
+
+// the phis in the target
+static bool has_moves(Ctx* ctx, WasmEdge* e) {
+    if (e->phi_index < 0) { return false; }
+
+    TB_Node* region = ctx->doms[e->succ].start;
+    FOR_USERS(u, region) {
+        TB_Node* phi = USERN(u);
+        if (phi->type != TB_PHI || ctx->values[phi->gvn].kind != VAL_LOCAL) { continue; }
+
+        ValueDesc* src = &ctx->values[phi->inputs[1 + e->phi_index]->gvn];
+        if (src->kind != VAL_LOCAL || src->id != ctx->values[phi->gvn].id) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void emit_moves(Ctx* ctx, WasmEdge* e) {
+    if (e->phi_index < 0) { return; }
+
+    // push all the sources then pop into the phis back to front, the operand
+    // stack gives us the parallel copy for free.
+    TB_Node* region = ctx->doms[e->succ].start;
+    TB_ArenaSavepoint sp = tb_arena_save(ctx->arena);
+    TB_Node** dsts = tb_arena_alloc(ctx->arena, region->user_count * sizeof(TB_Node*));
+
+    int count = 0;
+    FOR_USERS(u, region) {
+        TB_Node* phi = USERN(u);
+        if (phi->type != TB_PHI || ctx->values[phi->gvn].kind != VAL_LOCAL) { continue; }
+
+        TB_Node* src = phi->inputs[1 + e->phi_index];
+        ValueDesc* v = &ctx->values[src->gvn];
+        if (v->kind == VAL_LOCAL && v->id == ctx->values[phi->gvn].id) {
+            ctx->stats.coalesced += 1;
+            continue;
+        }
+
+        emit_operand(ctx, src);
+        dsts[count++] = phi;
+    }
+
+    FOR_REV_N(i, 0, count) {
+        emit_local(ctx, 0x21, ctx->values[dsts[i]->gvn].id);
+        ctx->stats.copies += 1;
+    }
+    tb_arena_restore(ctx->arena, sp);
+}
+
+static bool is_backedge(DomTree* src, DomTree* dst) {
+    return dst->id <= src->id;
+}
+
+// can the edge be a single br (no moves, no code inlined)
+static bool is_plain_br(Ctx* ctx, DomTree* src, WasmEdge* e) {
+    DomTree* dst = &ctx->doms[e->succ];
+    return (is_backedge(src, dst) || dst->merge) && !has_moves(ctx, e);
+}
+
+static int br_depth(Ctx* ctx, DomTree* src, WasmEdge* e) {
+    DomTree* dst = &ctx->doms[e->succ];
+    if (is_backedge(src, dst)) {
+        return label_depth(ctx, LABEL_LOOP, dst->id);
+    } else {
+        return label_depth(ctx, LABEL_BLOCK, dst->id);
+    }
+}
+
+static void do_branch(Ctx* ctx, DomTree* src, WasmEdge* e) {
+    DomTree* dst = &ctx->doms[e->succ];
+
+    emit_moves(ctx, e);
+    if (is_backedge(src, dst) || dst->merge) {
+        emit_br(ctx, br_depth(ctx, src, e));
+    } else {
+        do_tree(ctx, dst);
+    }
+}
+
+static void emit_if(Ctx* ctx, DomTree* node) {
+    TB_Node* end = node->end;
+    TB_Node* cond = end->inputs[1];
+    TB_NodeBranchProj* if_br = cfg_if_branch(end);
+
+    // we take the first edge when cond != key
+    WasmEdge* taken = &node->edges[0];
+    WasmEdge* not_taken = &node->edges[1];
+
+    if (if_br->key != 0) {
+        emit_clean_operand(ctx, cond, false);
+        emit_iconst(ctx, cond->dt, if_br->key);
+        emit_op(ctx, is_64bit(cond->dt) ? 0x52 : 0x47); // ne
+    } else if (is_64bit(cond->dt)) {
+        // i64.eqz flips the condition
+        emit_operand(ctx, cond);
+        emit_op(ctx, 0x50);
+        SWAP(WasmEdge*, taken, not_taken);
+    } else {
+        emit_clean_operand(ctx, cond, false);
+    }
+
+    if (is_plain_br(ctx, node, taken)) {
+        emit_op(ctx, 0x0D); // br_if
+        emit_uint(ctx, br_depth(ctx, node, taken));
+        do_branch(ctx, node, not_taken);
+    } else if (is_plain_br(ctx, node, not_taken)) {
+        emit_op(ctx, 0x45); // i32.eqz
+        emit_op(ctx, 0x0D); // br_if
+        emit_uint(ctx, br_depth(ctx, node, not_taken));
+        do_branch(ctx, node, taken);
+    } else {
+        emit_begin(ctx, 0x04, LABEL_IF, -1);
+        do_branch(ctx, node, taken);
+        emit_op(ctx, 0x05); // else
+        ctx->dead = false;
+        do_branch(ctx, node, not_taken);
+        emit_end(ctx);
+    }
+}
+
+static void emit_switch(Ctx* ctx, DomTree* node) {
+    TB_Node* end = node->end;
+    TB_Node* key = end->inputs[1];
+    int succ_count = node->edge_count;
+
+    // keys are compared against the cleaned up key, so narrow keys are zero
+    // extended and i32 keys are ordered as signed numbers.
+    int bits = int_bits(key->dt);
+    TB_ArenaSavepoint sp = tb_arena_save(ctx->arena);
+    int64_t* keys = tb_arena_alloc(ctx->arena, succ_count * sizeof(int64_t));
+    int64_t min = INT64_MAX, max = INT64_MIN;
+    FOR_N(i, 1, succ_count) {
+        TB_Node* proj = USERN(proj_with_index(end, i));
+        uint64_t k = TB_NODE_GET_EXTRA_T(proj, TB_NodeBranchProj)->key;
+        if (bits < 32) {
+            keys[i] = k & ((1u << bits) - 1);
+        } else if (bits == 32) {
+            keys[i] = (int32_t) k;
+        } else {
+            keys[i] = k;
+        }
+
+        if (keys[i] < min) { min = keys[i]; }
+        if (keys[i] > max) { max = keys[i]; }
+    }
+
+    // each case gets a block which ends right before its code, the default
+    // case is the outermost one.
+    FOR_N(i, 0, succ_count) {
+        emit_begin(ctx, 0x02, LABEL_BLOCK, -1);
+    }
+
+    uint64_t range = (uint64_t) (max - min) + 1;
+    if (bits <= 32 && range <= 4*succ_count + 4) {
+        // dense enough for a br_table, out of range keys wrap around to big
+        // unsigned numbers and hit the default.
+        emit_clean_operand(ctx, key, false);
+        if (min) {
+            emit_iconst(ctx, TB_TYPE_I32, min);
+            emit_op(ctx, 0x6B); // i32.sub
+        }
+
+        emit_op(ctx, 0x0E);
+        emit_uint(ctx, range);
+        FOR_N(k, 0, range) {
+            int target = 0;
+            FOR_N(i, 1, succ_count) {
+                if (keys[i] == min + k) { target = i; break; }
+            }
+            // case i's block is at depth i-1, default is the outermost
+            emit_uint(ctx, target ? target - 1 : succ_count - 1);
+        }
+        emit_uint(ctx, succ_count - 1);
+    } else {
+        FOR_N(i, 1, succ_count) {
+            emit_clean_operand(ctx, key, false);
+            emit_iconst(ctx, key->dt, keys[i]);
+            emit_op(ctx, is_64bit(key->dt) ? 0x51 : 0x46); // eq
+            emit_op(ctx, 0x0D); // br_if
+            emit_uint(ctx, i - 1);
+        }
+        emit_op(ctx, 0x0C);
+        emit_uint(ctx, succ_count - 1);
+    }
+    ctx->dead = true;
+    tb_arena_restore(ctx->arena, sp);
+
+    FOR_N(i, 1, succ_count) {
+        emit_end(ctx);
+        do_branch(ctx, node, &node->edges[i]);
+    }
+    emit_end(ctx);
+    do_branch(ctx, node, &node->edges[0]);
+}
+
+static void emit_block_body(Ctx* ctx, DomTree* node) {
+    TB_Node* end = node->end;
+    int count = node->root_count;
+    if (count > 0 && node->roots[count - 1] == end) {
+        count -= 1;
+    }
+
+    FOR_N(i, 0, count) {
+        emit_root(ctx, node->roots[i]);
+    }
+
+    switch (end->type) {
+        case TB_RETURN: {
+            FOR_N(i, 3, end->input_count) {
+                emit_operand(ctx, end->inputs[i]);
+            }
+            emit_epilogue(ctx);
+            emit_op(ctx, 0x0F);
+            ctx->dead = true;
+            break;
+        }
+
+        case TB_TAILCALL: {
+            // wasm's return_call isn't everywhere yet, a call+return is fine
+            emit_epilogue(ctx);
+            emit_call(ctx, end);
+            emit_op(ctx, 0x0F);
+            ctx->dead = true;
+            break;
+        }
+
+        case TB_TRAP:
+        case TB_UNREACHABLE: {
+            emit_op(ctx, 0x00);
+            ctx->dead = true;
+            break;
+        }
+
+        case TB_BRANCH:
+        case TB_AFFINE_LATCH: {
+            if (node->edge_count == 2) {
+                emit_if(ctx, node);
+            } else {
+                emit_switch(ctx, node);
+            }
+            break;
+        }
+
+        default: {
+            assert(node->edge_count == 1);
+            do_branch(ctx, node, &node->edges[0]);
+            break;
+        }
+    }
+    assert(ctx->pending == NULL);
+}
+
+static void node_within(Ctx* ctx, DomTree* node, DomTree** merges, int i, int count) {
+    if (i < count) {
+        emit_begin(ctx, 0x02, LABEL_BLOCK, merges[i]->id);
+        node_within(ctx, node, merges, i + 1, count);
+        emit_end(ctx);
+        do_tree(ctx, merges[i]);
+    } else {
+        emit_block_body(ctx, node);
+    }
+}
+
+static void code_for_node(Ctx* ctx, DomTree* node) {
+    // merge children, highest RPO first (outermost block)
+    TB_ArenaSavepoint sp = tb_arena_save(ctx->arena);
+    DomTree** merges = tb_arena_alloc(ctx->arena, node->kid_count * sizeof(DomTree*));
+
+    int count = 0;
+    FOR_REV_N(i, 0, node->kid_count) {
+        if (node->kids[i]->merge) {
+            merges[count++] = node->kids[i];
+        }
+    }
+
+    node_within(ctx, node, merges, 0, count);
+    tb_arena_restore(ctx->arena, sp);
+}
+
+static void do_tree(Ctx* ctx, DomTree* node) {
+    if (node->loop) {
+        emit_begin(ctx, 0x03, LABEL_LOOP, node->id);
+        code_for_node(ctx, node);
+        emit_end(ctx);
+    } else {
+        code_for_node(ctx, node);
+    }
+}
+
+////////////////////////////////
+// Disassembly
+////////////////////////////////
+static const char* op_names[256] = {
+    [0x00] = "unreachable", [0x01] = "nop", [0x02] = "block", [0x03] = "loop", [0x04] = "if", [0x05] = "else",
+    [0x0B] = "end", [0x0C] = "br", [0x0D] = "br_if", [0x0E] = "br_table", [0x0F] = "return",
+    [0x10] = "call", [0x11] = "call_indirect", [0x1A] = "drop", [0x1B] = "select",
+    [0x20] = "local.get", [0x21] = "local.set", [0x22] = "local.tee", [0x23] = "global.get", [0x24] = "global.set",
+    [0x28] = "i32.load", [0x29] = "i64.load", [0x2A] = "f32.load", [0x2B] = "f64.load",
+    [0x2C] = "i32.load8_s", [0x2D] = "i32.load8_u", [0x2E] = "i32.load16_s", [0x2F] = "i32.load16_u",
+    [0x30] = "i64.load8_s", [0x31] = "i64.load8_u", [0x32] = "i64.load16_s", [0x33] = "i64.load16_u",
+    [0x34] = "i64.load32_s", [0x35] = "i64.load32_u",
+    [0x36] = "i32.store", [0x37] = "i64.store", [0x38] = "f32.store", [0x39] = "f64.store",
+    [0x3A] = "i32.store8", [0x3B] = "i32.store16", [0x3C] = "i64.store8", [0x3D] = "i64.store16", [0x3E] = "i64.store32",
+    [0x3F] = "memory.size", [0x40] = "memory.grow",
+    [0x41] = "i32.const", [0x42] = "i64.const", [0x43] = "f32.const", [0x44] = "f64.const",
+    [0x45] = "i32.eqz", [0x46] = "i32.eq", [0x47] = "i32.ne", [0x48] = "i32.lt_s", [0x49] = "i32.lt_u",
+    [0x4A] = "i32.gt_s", [0x4B] = "i32.gt_u", [0x4C] = "i32.le_s", [0x4D] = "i32.le_u", [0x4E] = "i32.ge_s", [0x4F] = "i32.ge_u",
+    [0x50] = "i64.eqz", [0x51] = "i64.eq", [0x52] = "i64.ne", [0x53] = "i64.lt_s", [0x54] = "i64.lt_u",
+    [0x55] = "i64.gt_s", [0x56] = "i64.gt_u", [0x57] = "i64.le_s", [0x58] = "i64.le_u", [0x59] = "i64.ge_s", [0x5A] = "i64.ge_u",
+    [0x5B] = "f32.eq", [0x5C] = "f32.ne", [0x5D] = "f32.lt", [0x5E] = "f32.gt", [0x5F] = "f32.le", [0x60] = "f32.ge",
+    [0x61] = "f64.eq", [0x62] = "f64.ne", [0x63] = "f64.lt", [0x64] = "f64.gt", [0x65] = "f64.le", [0x66] = "f64.ge",
+    [0x67] = "i32.clz", [0x68] = "i32.ctz", [0x69] = "i32.popcnt", [0x6A] = "i32.add", [0x6B] = "i32.sub",
+    [0x6C] = "i32.mul", [0x6D] = "i32.div_s", [0x6E] = "i32.div_u", [0x6F] = "i32.rem_s", [0x70] = "i32.rem_u",
+    [0x71] = "i32.and", [0x72] = "i32.or", [0x73] = "i32.xor", [0x74] = "i32.shl", [0x75] = "i32.shr_s",
+    [0x76] = "i32.shr_u", [0x77] = "i32.rotl", [0x78] = "i32.rotr",
+    [0x79] = "i64.clz", [0x7A] = "i64.ctz", [0x7B] = "i64.popcnt", [0x7C] = "i64.add", [0x7D] = "i64.sub",
+    [0x7E] = "i64.mul", [0x7F] = "i64.div_s", [0x80] = "i64.div_u", [0x81] = "i64.rem_s", [0x82] = "i64.rem_u",
+    [0x83] = "i64.and", [0x84] = "i64.or", [0x85] = "i64.xor", [0x86] = "i64.shl", [0x87] = "i64.shr_s",
+    [0x88] = "i64.shr_u", [0x89] = "i64.rotl", [0x8A] = "i64.rotr",
+    [0x8B] = "f32.abs", [0x8C] = "f32.neg", [0x8D] = "f32.ceil", [0x8E] = "f32.floor", [0x8F] = "f32.trunc",
+    [0x90] = "f32.nearest", [0x91] = "f32.sqrt", [0x92] = "f32.add", [0x93] = "f32.sub", [0x94] = "f32.mul",
+    [0x95] = "f32.div", [0x96] = "f32.min", [0x97] = "f32.max", [0x98] = "f32.copysign",
+    [0x99] = "f64.abs", [0x9A] = "f64.neg", [0x9B] = "f64.ceil", [0x9C] = "f64.floor", [0x9D] = "f64.trunc",
+    [0x9E] = "f64.nearest", [0x9F] = "f64.sqrt", [0xA0] = "f64.add", [0xA1] = "f64.sub", [0xA2] = "f64.mul",
+    [0xA3] = "f64.div", [0xA4] = "f64.min", [0xA5] = "f64.max", [0xA6] = "f64.copysign",
+    [0xA7] = "i32.wrap_i64", [0xA8] = "i32.trunc_f32_s", [0xA9] = "i32.trunc_f32_u", [0xAA] = "i32.trunc_f64_s",
+    [0xAB] = "i32.trunc_f64_u", [0xAC] = "i64.extend_i32_s", [0xAD] = "i64.extend_i32_u", [0xAE] = "i64.trunc_f32_s",
+    [0xAF] = "i64.trunc_f32_u", [0xB0] = "i64.trunc_f64_s", [0xB1] = "i64.trunc_f64_u", [0xB2] = "f32.convert_i32_s",
+    [0xB3] = "f32.convert_i32_u", [0xB4] = "f32.convert_i64_s", [0xB5] = "f32.convert_i64_u", [0xB6] = "f32.demote_f64",
+    [0xB7] = "f64.convert_i32_s", [0xB8] = "f64.convert_i32_u", [0xB9] = "f64.convert_i64_s", [0xBA] = "f64.convert_i64_u",
+    [0xBB] = "f64.promote_f32", [0xBC] = "i32.reinterpret_f32", [0xBD] = "i64.reinterpret_f64",
+    [0xBE] = "f32.reinterpret_i32", [0xBF] = "f64.reinterpret_i64",
+    [0xC0] = "i32.extend8_s", [0xC1] = "i32.extend16_s", [0xC2] = "i64.extend8_s", [0xC3] = "i64.extend16_s",
+    [0xC4] = "i64.extend32_s",
+};
+
+static uint64_t read_uint(const uint8_t** p) {
+    uint64_t x = 0;
+    int shift = 0;
+    uint8_t b;
+    do {
+        b = *(*p)++;
+        x |= (uint64_t) (b & 0x7F) << shift;
+        shift += 7;
+    } while (b & 0x80);
+    return x;
+}
+
+static int64_t read_sint(const uint8_t** p) {
+    int64_t x = 0;
+    int shift = 0;
+    uint8_t b;
+    do {
+        b = *(*p)++;
+        x |= (int64_t) (b & 0x7F) << shift;
+        shift += 7;
+    } while (b & 0x80);
+
+    if (shift < 64 && (b & 0x40)) {
+        x |= -((int64_t) 1 << shift);
+    }
+    return x;
+}
+
+static const char* type_name(uint8_t t) {
+    switch (t) {
+        case WASM_I32: return "i32";
+        case WASM_I64: return "i64";
+        case WASM_F32: return "f32";
+        case WASM_F64: return "f64";
+        default:       return "???";
+    }
+}
+
+// walks the instructions, counting them (and how many just shuffle locals)
+// while printing them if we're asked to.
+// symbol which gets patched in at pos, NULL if it's just a number
+static TB_Symbol* patch_at(Ctx* ctx, size_t pos) {
+    for (TB_SymbolPatch* patch = ctx->emit.output->first_patch; patch; patch = patch->next) {
+        if (patch->pos == pos) { return patch->target; }
+    }
+    return NULL;
+}
+
+static void disassemble(Ctx* ctx, const uint8_t* p, const uint8_t* end, bool print) {
+    TB_CGEmitter* e = &ctx->emit;
+
+    int depth = 1;
+    while (p < end) {
+        uint8_t op = *p++;
+        ctx->stats.wasm_insts += 1;
+        if (op >= 0x20 && op <= 0x22) {
+            ctx->stats.wasm_local_ops += 1;
+        }
+
+        if (op == 0x05 || op == 0x0B) { depth--; }
+        if (print) {
+            FOR_N(i, 0, depth) { EMITA(e, "  "); }
+            if (op == 0xFC) {
+                EMITA(e, "%s", *p == 0x0A ? "memory.copy" : *p == 0x0B ? "memory.fill" : "0xFC");
+            } else {
+                EMITA(e, "%s", op_names[op] ? op_names[op] : "???");
+            }
+        }
+
+        switch (op) {
+            case 0x02: case 0x03: case 0x04: {
+                uint8_t bt = *p++;
+                if (print && bt != 0x40) { EMITA(e, " (result %s)", type_name(bt)); }
+                depth++;
+                break;
+            }
+
+            case 0x05: depth++; break;
+
+            case 0x10: case 0x41: {
+                TB_Symbol* sym = print ? patch_at(ctx, p - e->data) : NULL;
+                int64_t x = op == 0x10 ? read_uint(&p) : read_sint(&p);
+                if (sym) {
+                    EMITA(e, " %s", sym->name);
+                } else if (print) {
+                    EMITA(e, " %"PRId64, x);
+                }
+                break;
+            }
+
+            case 0x11: read_uint(&p), p++; break;
+
+            case 0x0C: case 0x0D:
+            case 0x20: case 0x21: case 0x22: case 0x23: case 0x24: {
+                uint64_t x = read_uint(&p);
+                if (print) { EMITA(e, " %"PRIu64, x); }
+                break;
+            }
+
+            case 0x0E: {
+                uint64_t count = read_uint(&p);
+                FOR_N(i, 0, count + 1) {
+                    uint64_t x = read_uint(&p);
+                    if (print) { EMITA(e, " %"PRIu64, x); }
+                }
+                break;
+            }
+
+            case 0x28 ... 0x3E: {
+                uint64_t align = read_uint(&p);
+                uint64_t offset = read_uint(&p);
+                if (print) {
+                    if (offset) { EMITA(e, " offset=%"PRIu64, offset); }
+                    EMITA(e, " align=%d", 1 << align);
+                }
+                break;
+            }
+
+            case 0x3F: case 0x40: p++; break;
+
+            case 0x42: {
+                int64_t x = read_sint(&p);
+                if (print) { EMITA(e, " %"PRId64, x); }
+                break;
+            }
+
+            case 0x43: {
+                float x;
+                memcpy(&x, p, sizeof(x)), p += 4;
+                if (print) { EMITA(e, " %f", x); }
+                break;
+            }
+
+            case 0x44: {
+                double x;
+                memcpy(&x, p, sizeof(x)), p += 8;
+                if (print) { EMITA(e, " %f", x); }
+                break;
+            }
+
+            case 0xFC: {
+                uint64_t sub = read_uint(&p);
+                if (sub == 0x0A) { p += 2; }
+                else if (sub == 0x0B) { p += 1; }
+                break;
+            }
+
+            default: break;
+        }
+
+        if (print) { EMITA(e, "\n"); }
+    }
+}
+
+static int node_latency(TB_Function* f, TB_Node* n, TB_Node* end) {
+    return 1;
+}
+
+static void compile_function(TB_Function* restrict f, TB_FunctionOutput* restrict func_out, const TB_FeatureSet* features, TB_Arena* code_arena, bool emit_asm) {
+    TB_Arena* arena = f->tmp_arena;
+    TB_ArenaSavepoint sp = tb_arena_save(arena);
+
+    TB_OPTDEBUG(CODEGEN)(tb_pass_print(p));
+
+    Ctx ctx = {
+        .module = f->super.module,
+        .f = f,
+        .arena = arena,
+        .last_br0 = -1,
+        .emit = {
+            .output = func_out,
+            .arena = arena,
+            .has_comments = false,
+        }
+    };
+
+    if (features == NULL) {
+        ctx.features = (TB_FeatureSet){ 0 };
+    } else {
+        ctx.features = *features;
+    }
+
+    TB_Worklist* restrict ws = &ctx.worklist;
+
+    // legalize step takes out any of our 16bit and 8bit math ops, it marks nodes
+    // in the caller's worklist which has to be clean for whoever uses it next.
+    tb_opt_legalize(f, f->super.module->target_arch);
+    worklist_clear(f->worklist);
+
+    worklist_clear(ws);
+
+    CUIK_TIMED_BLOCK("global sched") {
+        ctx.cfg = tb_compute_rpo(f, ws);
+        ctx.block_count = dyn_array_length(ws->items);
+
+        tb_global_schedule(f, ws, ctx.cfg, true, false, node_latency);
+    }
+
+    ctx.values = tb_arena_alloc(arena, f->node_count * sizeof(ValueDesc));
+    FOR_N(i, 0, f->node_count) {
+        ctx.values[i] = (ValueDesc){ .kind = VAL_NONE, .vreg = -1, .id = -1 };
+    }
+
+    // build dominator tree
+    DomTree* doms = ctx.doms = tb_arena_alloc(arena, ctx.block_count * sizeof(DomTree));
+    FOR_N(i, 0, ctx.block_count) {
+        TB_BasicBlock* bb = node_bb(&ctx, ws->items[i]);
+        doms[i] = (DomTree){ .id = i, .start = ws->items[i], .end = bb->end };
+        if (i > 0) {
+            doms[bb->dom->id].kid_count++;
+        }
+    }
+
+    FOR_N(i, 0, ctx.block_count) {
+        doms[i].kids = tb_arena_alloc(arena, doms[i].kid_count * sizeof(DomTree*));
+        doms[i].kid_count = 0;
+    }
+
+    // kids end up in RPO order
+    FOR_N(i, 1, ctx.block_count) {
+        TB_BasicBlock* bb = node_bb(&ctx, ws->items[i]);
+        DomTree* parent = &doms[bb->dom->id];
+        parent->kids[parent->kid_count++] = &doms[i];
+    }
+
+    FOR_N(i, 0, ctx.block_count) {
+        DomTree* node = &doms[i];
+        if (cfg_is_region(node->start)) {
+            int forward = 0;
+            FOR_N(j, 0, node->start->input_count) {
+                TB_Node* pred = cfg_get_pred(&ctx.cfg, node->start, j);
+                if (pred->type == TB_DEAD) { continue; }
+
+                if (node_bb(&ctx, pred)->id < i) {
+                    forward++;
+                } else {
+                    // wasm loops are structured, the header has to dominate the latch
+                    if (!slow_dommy(&ctx.cfg, node->start, pred)) {
+                        tb_panic("wasm: irreducible control flow in %s", f->super.name);
+                    }
+                    node->loop = true;
+                }
+            }
+            node->merge = forward > 1;
+        }
+        find_successors(&ctx, node);
+    }
+
+    CUIK_TIMED_BLOCK("stackify") {
+        int* rootpos = tb_arena_alloc(arena, f->node_count * sizeof(int));
+
+        worklist_clear_visited(ws);
+        FOR_N(i, 0, ctx.block_count) {
+            schedule_block(&ctx, &doms[i], rootpos);
+        }
+    }
+
+    CUIK_TIMED_BLOCK("locals") {
+        // params fit into the first few locals
+        TB_FunctionPrototype* proto = f->prototype;
+        ctx.param_count = proto->param_count;
+        FOR_N(i, 0, proto->param_count) {
+            int t = type_class(get_wasm_type(proto->params[i].dt));
+            dyn_array_put(ctx.param_of_type[t], i);
+            ctx.param_slots[t] += 1;
+        }
+
+        ctx.vregs = dyn_array_create(TB_Node*, 64);
+        FOR_USERS(u, f->root_node) {
+            TB_Node* un = USERN(u);
+            if (un->type == TB_PROJ && is_value(un) && un->user_count > 0) {
+                // the return address isn't something wasm lets us see
+                int i = TB_NODE_GET_EXTRA_T(un, TB_NodeProj)->index;
+                if (i < 3) { continue; }
+
+                new_vreg(&ctx, un);
+
+                // slot within the params of the same type
+                int t = type_class(get_wasm_type(un->dt));
+                dyn_array_for(j, ctx.param_of_type[t]) {
+                    if (ctx.param_of_type[t][j] == i - 3) {
+                        ctx.values[un->gvn].id = j;
+                        break;
+                    }
+                }
+            }
+        }
+
+        FOR_N(i, 0, ctx.block_count) {
+            DomTree* node = &doms[i];
+            if (cfg_is_region(node->start)) {
+                FOR_USERS(u, node->start) {
+                    TB_Node* phi = USERN(u);
+                    if (phi->type == TB_PHI && is_value(phi) && phi->user_count > 0) {
+                        new_vreg(&ctx, phi);
+                    }
+                }
+            }
+
+            FOR_N(j, 0, node->root_count) {
+                TB_Node* n = node->roots[j];
+                if (n->type == TB_CALL) {
+                    FOR_USERS(u, n) {
+                        if (ctx.values[USERN(u)->gvn].kind == VAL_LOCAL) {
+                            new_vreg(&ctx, USERN(u));
+                        }
+                    }
+                } else if (ctx.values[n->gvn].kind == VAL_LOCAL) {
+                    new_vreg(&ctx, n);
+                }
+            }
+        }
+
+        compute_liveness(&ctx);
+        build_interference(&ctx);
+        color_locals(&ctx);
+        assign_local_indices(&ctx);
+    }
+
+    ctx.frame_size = (ctx.frame_size + 15) & ~15;
+
+    // allocate entire top of the code arena (we'll trim it later if possible)
+    tb_cgemit_init(&ctx.emit, f->node_count * 4);
+
+    // body size goes here once we know it
+    EMIT4(&ctx.emit, 0);
+    EMIT1(&ctx.emit, 0);
+
+    // locals, one run per type
+    int runs = 0;
+    FOR_N(t, 0, 4) { runs += ctx.local_count[t] > 0; }
+    emit_uint(&ctx, runs);
+    FOR_N(t, 0, 4) {
+        if (ctx.local_count[t] > 0) {
+            emit_uint(&ctx, ctx.local_count[t]);
+            EMIT1(&ctx.emit, WASM_I32 - t);
+        }
+    }
+    size_t body_start = ctx.emit.count;
+
+    CUIK_TIMED_BLOCK("emit") {
+        if (ctx.frame_size) {
+            emit_local(&ctx, 0x23, 0); // global.get __stack_pointer
+            emit_iconst(&ctx, TB_TYPE_I32, ctx.frame_size);
+            emit_op(&ctx, 0x6B); // i32.sub
+            emit_local(&ctx, 0x22, ctx.fp);
+            emit_local(&ctx, 0x24, 0); // global.set __stack_pointer
+        }
+
+        do_tree(&ctx, &doms[0]);
+
+        // the validator doesn't know we never fall off the end
+        if (!ctx.dead && f->prototype->return_count > 0) {
+            emit_op(&ctx, 0x00);
+        }
+        emit_op(&ctx, 0x0B);
+    }
+
+    // write the body size right before the locals, we reserved 5 bytes for
+    // the uleb so the function starts wherever it ends up starting.
+    size_t body_size = ctx.emit.count - 5;
+    int size_len = 0;
+    for (uint64_t x = body_size; size_len == 0 || x; x >>= 7) { size_len++; }
+
+    int skip = 5 - size_len;
+    uint8_t* p = &ctx.emit.data[skip];
+    for (uint64_t x = body_size;;) {
+        uint32_t lo = x & 0x7F;
+        x >>= 7;
+        *p++ = lo | (x ? 0x80 : 0);
+        if (x == 0) break;
+    }
+
+    memmove(ctx.emit.data, &ctx.emit.data[skip], ctx.emit.count - skip);
+    ctx.emit.count -= skip;
+    body_start -= skip;
+    for (TB_SymbolPatch* patch = func_out->first_patch; patch; patch = patch->next) {
+        patch->pos -= skip;
+    }
+    for (TB_WasmTypePatch* patch = func_out->wasm_type_patches; patch; patch = patch->next) {
+        patch->pos -= skip;
+    }
 
     tb_free_cfg(&ctx.cfg);
-    dyn_array_destroy(ctx.phi_vals);
 
-    // uleb code size patch
-    patch_uint(ctx.emit.data,     ctx.emit.count - 4);
-    patch_uint(&ctx.emit.data[4], 0);
+    // move the code out of the scratch buffer, it's exactly sized
+    tb_cgemit_finalize(&ctx.emit, code_arena);
+
+    CUIK_TIMED_BLOCK("dissassembly") {
+        if (emit_asm) {
+            EMITA(&ctx.emit, "%s:\n", f->super.name);
+            FOR_N(t, 0, 4) {
+                if (ctx.local_count[t]) {
+                    EMITA(&ctx.emit, "  local %s x%d\n", type_name(WASM_I32 - t), ctx.local_count[t]);
+                }
+            }
+        }
 
-    // trim code arena (it fits in a single chunk so just arena free the top)
-    code_arena->avail = (char*) &ctx.emit.data[ctx.emit.count];
-    tb_arena_realign(code_arena);
+        // we're always counting instructions for the stats
+        disassemble(&ctx, &ctx.emit.data[body_start], &ctx.emit.data[ctx.emit.count], emit_asm);
+    }
 
-    // TODO(NeGate): move the assembly output to code arena
-    if (emit_asm) CUIK_TIMED_BLOCK("dissassembly") {
-        // __debugbreak();
+    log_debug("%s: code_arena=%.1f KiB, locals=%d/%d ops", f->super.name, tb_arena_current_size(code_arena) / 1024.0f, ctx.stats.wasm_local_ops, ctx.stats.wasm_insts);
+
+    FOR_N(i, 0, ctx.vreg_count) {
+        dyn_array_destroy(ctx.adj[i]);
+    }
+    FOR_N(t, 0, 4) {
+        dyn_array_destroy(ctx.param_of_type[t]);
     }
+    dyn_array_destroy(ctx.vregs);
+    dyn_array_destroy(ctx.labels);
 
-    log_debug("%s: code_arena=%.1f KiB", f->super.name, tb_arena_current_size(code_arena) / 1024.0f);
     tb_arena_restore(arena, sp);
     f->scheduled = NULL;
 
@@ -771,35 +2299,50 @@ static void compile_function(TB_Function* restrict f, TB_FunctionOutput* restric
     func_out->asm_out = ctx.emit.head_asm;
     func_out->code = ctx.emit.data;
     func_out->code_size = ctx.emit.count;
-    // func_out->locations = ctx.locations;
-    // func_out->stack_slots = ctx.debug_stack_slots;
-    // func_out->stack_usage = ctx.stack_usage;
-    // func_out->prologue_length = ctx.prologue_length;
-    // func_out->epilogue_length = ctx.epilogue_length;
+    func_out->stack_usage = ctx.frame_size;
+    func_out->ra_stats = ctx.stats;
 }
 
-static size_t emit_call_patches(TB_Module* restrict m, TB_FunctionOutput* out_f) {
-    size_t r = 0;
-    uint32_t src_section = out_f->section;
+// sleb128 encode, padded to 5 bytes
+static void patch_sint(uint8_t* p, int32_t x) {
+    for (int i = 0; i < 5; i++) {
+        uint32_t lo = x & 0x7F;
+        x >>= 7;
+        if (i < 4) {
+            lo |= 0x80;
+        }
+        *p++ = lo;
+    }
+}
 
+// the exporter leaves the function index (imports first) or the global's
+// address in symbol_id, nothing is relative so it's all resolved here.
+static size_t emit_call_patches(TB_Module* restrict m, TB_FunctionOutput* out_f) {
     for (TB_SymbolPatch* patch = out_f->first_patch; patch; patch = patch->next) {
-        if (patch->target->tag == TB_SYMBOL_FUNCTION) {
-            uint32_t dst_section = ((TB_Function*) patch->target)->output->section;
-
-            // we can relocate across section on WASM, the "object" file isn't really
-            // relocatable in the same sense as other objects.
-            assert(patch->pos < out_f->code_size);
-            size_t actual_pos = out_f->code_pos + patch->pos + 4;
+        TB_Symbol* target = patch->target;
+        if (target->tag == TB_SYMBOL_EXTERNAL) {
+            TB_Symbol* resolved = atomic_load_explicit(&((TB_External*) target)->resolved, memory_order_relaxed);
+            if (resolved) target = resolved;
+        }
 
-            uint32_t p = ((TB_Function*) patch->target)->output->code_pos - actual_pos;
-            patch_uint(&out_f->code[patch->pos], p);
+        assert(patch->pos < out_f->code_size);
+        if (out_f->code[patch->pos - 1] == 0x10) {
+            patch_uint(&out_f->code[patch->pos], target->symbol_id);
+        } else {
+            // i32.const, function pointers are table slots (0 is NULL)
+            assert(out_f->code[patch->pos - 1] == 0x41);
+            patch_sint(&out_f->code[patch->pos], target->symbol_id + (target->tag != TB_SYMBOL_GLOBAL));
+        }
+        patch->internal = true;
+    }
 
-            r += 1;
-            patch->internal = true;
+    for (TB_WasmTypePatch* patch = out_f->wasm_type_patches; patch; patch = patch->next) {
+        if (patch->target == NULL) {
+            patch_uint(&out_f->code[patch->pos], patch->type_index);
         }
     }
 
-    return out_f->patch_count - r;
+    return 0;
 }
 
 static void get_data_type_size(TB_DataType dt, size_t* out_size, size_t* out_align) {
@@ -827,8 +2370,8 @@ static void get_data_type_size(TB_DataType dt, size_t* out_size, size_t* out_ali
             break;
         }
         case TB_TAG_PTR: {
-            *out_size = 8;
-            *out_align = 8;
+            *out_size = 4;
+            *out_align = 4;
             break;
         }
         default: tb_unreachable();
@@ -32,6 +32,10 @@ typedef enum {
     XMM0, XMM1, XMM2,  XMM3,  XMM4,  XMM5,  XMM6,  XMM7,
     XMM8, XMM9, XMM10, XMM11, XMM12, XMM13, XMM14, XMM15,
 
+    // AVX-512 only (EVEX)
+    XMM16, XMM17, XMM18, XMM19, XMM20, XMM21, XMM22, XMM23,
+    XMM24, XMM25, XMM26, XMM27, XMM28, XMM29, XMM30, XMM31,
+
     XMM_NONE = -1
 } XMM;
 
@@ -192,7 +196,8 @@ static bool is_value_match(const Val* a, const Val* b) {
 #pragma GCC diagnostic ignored "-Wunused-variable"
 #endif
 static const char* GPR_NAMES[] = { "RAX", "RCX", "RDX", "RBX", "RSP", "RBP", "RSI", "RDI", "R8",  "R9", "R10", "R11", "R12", "R13", "R14", "R15" };
-static const char* XMM_NAMES[] = { "XMM0", "XMM1", "XMM2", "XMM3", "XMM4", "XMM5", "XMM6", "XMM7", "XMM8",  "XMM9", "XMM10", "XMM11", "XMM12", "XMM13", "XMM14", "XMM15" };
+static const char* XMM_NAMES[] = { "XMM0", "XMM1", "XMM2", "XMM3", "XMM4", "XMM5", "XMM6", "XMM7", "XMM8",  "XMM9", "XMM10", "XMM11", "XMM12", "XMM13", "XMM14", "XMM15",
+    "XMM16", "XMM17", "XMM18", "XMM19", "XMM20", "XMM21", "XMM22", "XMM23", "XMM24", "XMM25", "XMM26", "XMM27", "XMM28", "XMM29", "XMM30", "XMM31" };
 static const char* COND_NAMES[] = {
     "O", "NO", "B", "NB", "E", "NE", "BE", "A",
     "S", "NS", "P", "NP", "L", "GE", "LE", "G"
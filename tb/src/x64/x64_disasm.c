@@ -42,9 +42,61 @@ bool tb_x86_disasm(TB_X86_Inst* restrict inst, size_t length, const uint8_t* dat
 
     // rex/vex
     done_prefixing:;
+    uint32_t vex_map = 0, vvvv = 0xFF;
+    int evex_ll = -1;
     if ((b & 0xF0) == 0x40) {
         rex = b;
         b = data[current++];
+    } else if (b == 0xC4 || b == 0xC5) {
+        // VEX is just REX, the legacy prefix & the escape bytes packed together
+        // (with the bits inverted) plus an extra source reg.
+        //   C5 RvvvvLpp
+        //   C4 RXBmmmmm WvvvvLpp
+        uint8_t b1 = data[current++], b2 = b1;
+        if (b == 0xC4) {
+            b2 = data[current++];
+            vex_map = b1 & 0x1F;
+            rex = ((~b1 >> 5) & 7) | ((b2 >> 4) & 8);
+        } else {
+            vex_map = 1;
+            rex = (~b1 >> 5) & 4;
+        }
+
+        if (vex_map < 1 || vex_map > 3) {
+            return false;
+        }
+
+        vvvv = (~b2 >> 3) & 15;
+        switch (b2 & 3) {
+            case 1: inst->dt = TB_X86_WORD;      break;
+            case 2: flags |= TB_X86_INSTR_REP;   break;
+            case 3: flags |= TB_X86_INSTR_REPNE; break;
+        }
+        if (b2 & 4) {
+            flags |= TB_X86_INSTR_VEX256;
+        }
+        flags |= TB_X86_INSTR_VEX;
+        b = data[current++];
+    } else if (b == 0x62) {
+        // EVEX is VEX with a 5th bit on each register (R', V' and X when r/m is
+        // a register), we don't decode the AVX-512 masking or broadcasts.
+        //   62 RXBR'00mm Wvvvv1pp zL'LbV'aaa
+        uint8_t p0 = data[current++], p1 = data[current++], p2 = data[current++];
+        vex_map = p0 & 3;
+        if (vex_map == 0 || (p0 & 0x0C) || (p1 & 4) == 0 || (p2 & 0x97)) {
+            return false;
+        }
+
+        rex = ((~p0 >> 5) & 7) | ((p1 >> 4) & 8) | (~p0 & 0x10);
+        vvvv = ((~p1 >> 3) & 15) | ((~p2 & 8) << 1);
+        evex_ll = (p2 >> 5) & 3;
+        switch (p1 & 3) {
+            case 1: inst->dt = TB_X86_WORD;      break;
+            case 2: flags |= TB_X86_INSTR_REP;   break;
+            case 3: flags |= TB_X86_INSTR_REPNE; break;
+        }
+        flags |= TB_X86_INSTR_VEX;
+        b = data[current++];
     }
 
     // opcode translation (from 1-3 bytes to 10bits):
@@ -53,7 +105,9 @@ bool tb_x86_disasm(TB_X86_Inst* restrict inst, size_t length, const uint8_t* dat
     //   0F 38 op => 10________
     //   0F 3A op => 11________
     uint32_t op = 0;
-    if (b == 0x0F) {
+    if (vex_map) {
+        op = (vex_map << 8) | b;
+    } else if (b == 0x0F) {
         b = data[current++];
         switch (b) {
             case 0x38: b = data[current++], op = 0x200 | b; break;
@@ -91,6 +145,14 @@ bool tb_x86_disasm(TB_X86_Inst* restrict inst, size_t length, const uint8_t* dat
         OP_RAX    = 2048,
         // vector op
         OP_SSE    = 4096,
+        // the 66/F3/F2 prefix picks the op (lzcnt vs bsr, shlx vs sarx)
+        OP_PP     = 8192,
+        // VEX.vvvv is a source operand
+        OP_NDS    = 16384,
+        // vector op with no ss/sd/ps/pd forms, the 66 is part of the opcode
+        OP_PACKED = 32768,
+        // rx is an XMM while r/m is a GPR (movd/movq)
+        OP_XMMRX  = 65536,
     };
 
     #define NORMIE_BINOP(op) [op+0] = OP_MODRM | OP_8BIT, [op+1] = OP_MODRM, [op+2] = OP_MODRM | OP_DIR | OP_8BIT, [op+3] = OP_MODRM | OP_DIR, [op+4] = OP_RAX | OP_IMM8, [op+5] = OP_RAX | OP_IMM
@@ -193,12 +255,30 @@ bool tb_x86_disasm(TB_X86_Inst* restrict inst, size_t length, const uint8_t* dat
         _0F(0x1F)        = OP_MODRM,
         // SSE: ucomi
         _0F(0x2E)        = OP_MODRM | OP_SSE,
+        // SSE2: movd/movq xmm, r/m and back
+        _0F(0x6E)        = OP_MODRM | OP_XMMRX | OP_DIR,
+        _0F(0x7E)        = OP_MODRM | OP_XMMRX,
+        // SSE2: pshufd
+        _0F(0x70)        = OP_MODRM | OP_PACKED | OP_DIR | OP_IMM8,
+        // AVX: vinsertf128
+        [0x318]          = OP_MODRM | OP_PACKED | OP_DIR | OP_NDS | OP_IMM8,
         // imul reg, r/m
         _0F(0xAF)        = OP_MODRM,
+        // bt r/m, reg
+        _0F(0xA3)        = OP_MODRM,
         // cmovcc reg, r/m
         _0F2(0x40, 0x4F) = OP_MODRM | OP_DIR,
         // SSE: add, mul, sub, min, div, max
-        _0F2(0x51, 0x5F) = OP_MODRM | OP_DIR | OP_SSE,
+        _0F2(0x51, 0x5F) = OP_MODRM | OP_DIR | OP_SSE | OP_NDS,
+        // vzeroupper
+        _0F(0x77)        = OP_0ARY,
+        // popcnt, bsf/tzcnt, bsr/lzcnt
+        _0F(0xB8)        = OP_MODRM | OP_DIR | OP_PP,
+        _0F2(0xBC, 0xBD) = OP_MODRM | OP_DIR | OP_PP,
+        // BMI: andn, blsr, shlx/sarx/shrx
+        [0x2F2]          = OP_MODRM | OP_DIR | OP_NDS,
+        [0x2F3]          = OP_MODRM | OP_DIR | OP_NDS | OP_FAKERX,
+        [0x2F7]          = OP_MODRM | OP_DIR | OP_NDS | OP_PP,
         // movzx reg, r/m
         _0F(0xB6)        = OP_MODRM | OP_2DT | OP_DIR,
         _0F(0xB7)        = OP_MODRM | OP_2DT | OP_DIR,
@@ -218,13 +298,30 @@ bool tb_x86_disasm(TB_X86_Inst* restrict inst, size_t length, const uint8_t* dat
         return false;
     }
 
-    uint32_t regs = 0;
+    uint32_t regs = (props & OP_NDS ? vvvv : 0xFF) << 24;
     int32_t  disp = 0;
     uint8_t  scale = 0;
 
+    if (props & OP_PP) {
+        // mandatory prefixes are part of the opcode (bits 10 & 11)
+        int pp = 0;
+        if (flags & TB_X86_INSTR_REP)        { pp = 2; }
+        else if (flags & TB_X86_INSTR_REPNE) { pp = 3; }
+        else if (vex_map && inst->dt == TB_X86_WORD) { pp = 1; }
+
+        op |= pp << 10;
+        flags &= ~(TB_X86_INSTR_REP | TB_X86_INSTR_REPNE);
+    }
+
     // in the "default" "type" "system", REX.W is 64bit, certain ops
     // will mark they're 8bit and most will just be 32bit (with 16bit on ADDR16)
-    if (props & OP_SSE) {
+    TB_X86_DataType dt2 = TB_X86_NONE;
+    if (props & OP_PACKED) {
+        inst->dt = TB_X86_PDWORD;
+    } else if (props & OP_XMMRX) {
+        inst->dt = rex & 8 ? TB_X86_QWORD : TB_X86_DWORD;
+        dt2 = TB_X86_PDWORD;
+    } else if (props & OP_SSE) {
         if (0) {}
         else if (flags & TB_X86_INSTR_REPNE) { inst->dt = TB_X86_F64x1; } // sd     REPNE  OPCODE
         else if (flags & TB_X86_INSTR_REP)   { inst->dt = TB_X86_F32x1; } // ss     REP    OPCODE
@@ -237,6 +334,8 @@ bool tb_x86_disasm(TB_X86_Inst* restrict inst, size_t length, const uint8_t* dat
     } else if (props & OP_8BIT) {
         inst->dt = TB_X86_BYTE;
     } else {
+        // VEX GPR ops are only ever 32bit or 64bit (VEX.W)
+        if (vex_map) inst->dt = TB_X86_DWORD;
         if (rex & 8) inst->dt = TB_X86_QWORD;
     }
 
@@ -254,12 +353,13 @@ bool tb_x86_disasm(TB_X86_Inst* restrict inst, size_t length, const uint8_t* dat
             regs |= 0xFF0000; // no rx since it's reserved
             op  |= rx << 12;
         } else {
-            // unpack rx
-            regs |= ((rex&4 ? 8 : 0) | rx) << 16;
+            // unpack rx (EVEX.R' is stashed in bit 4 of the rex)
+            regs |= ((rex&0x10 ? 16 : 0) | (rex&4 ? 8 : 0) | rx) << 16;
         }
 
         if (mod == MOD_DIRECT) {
-            // unpack base
+            // unpack base, EVEX.X is the 5th bit of vector regs
+            if (evex_ll >= 0 && (props & OP_SSE) && (rex & 2)) { rm |= 16; }
             regs |= (rex&1 ? 8 : 0) | rm;
         } else {
             flags |= TB_X86_INSTR_INDIRECT;
@@ -292,6 +392,13 @@ bool tb_x86_disasm(TB_X86_Inst* restrict inst, size_t length, const uint8_t* dat
             inst->disp_pos = current;
             if (mod == MOD_INDIRECT_DISP8) {
                 inst->disp = (int8_t) data[current++];
+                if (evex_ll >= 0) {
+                    // EVEX compresses disp8 into a multiple of the operand size (disp8*N)
+                    if (inst->dt == TB_X86_F32x1)      { inst->disp *= 4; }
+                    else if (inst->dt == TB_X86_F64x1) { inst->disp *= 8; }
+                    else if (props & OP_SSE)           { inst->disp *= 16 << evex_ll; }
+                    else                               { inst->disp *= rex & 8 ? 8 : 4; }
+                }
             } else if (mod == MOD_INDIRECT_DISP32 || (regs & 0xFFFF) == 0xFFFF) {
                 memcpy(&inst->disp, &data[current], sizeof(disp));
                 current += 4;
@@ -317,6 +424,11 @@ bool tb_x86_disasm(TB_X86_Inst* restrict inst, size_t length, const uint8_t* dat
         regs |= 0xFFFFFF;
     }
 
+    if (vex_map && !(props & OP_NDS) && vvvv != 0) {
+        // vvvv has to be 1111 when unused
+        return false;
+    }
+
     if (props & OP_IMM8) {
         inst->imm = (int8_t) data[current++];
         flags |= TB_X86_INSTR_IMMEDIATE;
@@ -340,7 +452,7 @@ bool tb_x86_disasm(TB_X86_Inst* restrict inst, size_t length, const uint8_t* dat
         flags |= TB_X86_INSTR_DIRECTION;
     }
 
-    inst->dt2 = inst->dt;
+    inst->dt2 = dt2 ? dt2 : inst->dt;
     inst->opcode = op;
     inst->scale  = scale;
     inst->regs   = regs;
@@ -746,6 +858,7 @@ const char* tb_x86_mnemonic(TB_X86_Inst* inst) {
     #define _0F(op)      0x100+op
     #define _0Fx(op, rx) 0x100+op+(rx<<12)
     #define _Rx(op, rx)  op+(rx<<12)
+    #define _PP(op, pp)  op+(pp<<10)
     #define NORMIE_BINOP(op) case 0x80 + (op<<12): case 0x81 + (op<<12): case 0x83 + (op<<12)
     switch (inst->opcode) {
         case _0F(0x0B): return "ud2";
@@ -800,11 +913,28 @@ const char* tb_x86_mnemonic(TB_X86_Inst* inst) {
         case _0F(0x54): return "and";
         case _0F(0x56): return "or";
         case _0F(0x57): return "xor";
+        case _0F(0x6E): case _0F(0x7E): return inst->dt == TB_X86_QWORD ? "movq" : "movd";
+        case _0F(0x70): return "pshufd";
+        case 0x318: return "vinsertf128";
 
         case 0xB0 ... 0xBF: return "mov";
         case _0F(0xB6): case _0F(0xB7): return "movzx";
         case _0F(0xBE): case _0F(0xBF): return "movsx";
 
+        case _0F(0x77): return "vzeroupper";
+        case _0F(0xA3): return "bt";
+        case _0F(0xBC): return "bsf";
+        case _0F(0xBD): return "bsr";
+        case _PP(_0F(0xB8), 2): return "popcnt";
+        case _PP(_0F(0xBC), 2): return "tzcnt";
+        case _PP(_0F(0xBD), 2): return "lzcnt";
+
+        case 0x2F2: return "andn";
+        case _Rx(0x2F3, 1): return "blsr";
+        case _PP(0x2F7, 1): return "shlx";
+        case _PP(0x2F7, 2): return "sarx";
+        case _PP(0x2F7, 3): return "shrx";
+
         case 0x8D: return "lea";
         case 0x90: return "nop";
         case 0xC3: return "ret";
@@ -893,10 +1023,21 @@ const char* tb_x86_reg_name(int8_t reg, TB_X86_DataType dt) {
 
     if (dt >= TB_X86_BYTE && dt <= TB_X86_QWORD) {
         return X86__GPR_NAMES[dt - TB_X86_BYTE][reg];
-    } else if (dt >= TB_X86_F32x1 && dt <= TB_X86_F64x2) {
+    } else if (dt == TB_X86_YMMWORD) {
+        static const char* X86__YMM_NAMES[] = {
+            "ymm0", "ymm1", "ymm2",  "ymm3",  "ymm4",  "ymm5",  "ymm6",  "ymm7",
+            "ymm8", "ymm9", "ymm10", "ymm11", "ymm12", "ymm13", "ymm14", "ymm15",
+            "ymm16", "ymm17", "ymm18", "ymm19", "ymm20", "ymm21", "ymm22", "ymm23",
+            "ymm24", "ymm25", "ymm26", "ymm27", "ymm28", "ymm29", "ymm30", "ymm31",
+        };
+
+        return X86__YMM_NAMES[reg];
+    } else if (dt >= TB_X86_PBYTE && dt <= TB_X86_XMMWORD) {
         static const char* X86__XMM_NAMES[] = {
             "xmm0", "xmm1", "xmm2",  "xmm3",  "xmm4",  "xmm5",  "xmm6",  "xmm7",
             "xmm8", "xmm9", "xmm10", "xmm11", "xmm12", "xmm13", "xmm14", "xmm15",
+            "xmm16", "xmm17", "xmm18", "xmm19", "xmm20", "xmm21", "xmm22", "xmm23",
+            "xmm24", "xmm25", "xmm26", "xmm27", "xmm28", "xmm29", "xmm30", "xmm31",
         };
 
         return X86__XMM_NAMES[reg];
@@ -915,6 +1056,9 @@ const char* tb_x86_type_name(TB_X86_DataType dt) {
         case TB_X86_F64x1: return "qword";
         case TB_X86_F32x4: return "xmmword";
         case TB_X86_F64x2: return "xmmword";
+        case TB_X86_PBYTE ... TB_X86_PQWORD: return "xmmword";
+        case TB_X86_XMMWORD: return "xmmword";
+        case TB_X86_YMMWORD: return "ymmword";
 
         default: return "??";
     }
@@ -932,6 +1076,20 @@ static const char* x86_fmts[] = {
     // "%#"PRIx64,
 };
 
+// VEX ops print as dst, vvvv, r/m except for the shifts which go dst, r/m, count
+static bool x86_vvvv_last(TB_X86_Inst* inst) {
+    return (inst->opcode & 0x3FF) == 0x2F7;
+}
+
+// VEX.256 keeps the types of the 128bit form, only the vector regs get wider
+// (except for the r/m of vinsertf128 which is always an xmm)
+static TB_X86_DataType x86_operand_dt(TB_X86_Inst* inst, TB_X86_DataType dt, bool is_rm) {
+    if ((inst->flags & TB_X86_INSTR_VEX256) && dt >= TB_X86_PBYTE && dt <= TB_X86_XMMWORD) {
+        return is_rm && inst->opcode == 0x318 ? dt : TB_X86_YMMWORD;
+    }
+    return dt;
+}
+
 static void print_memory_operand(FILE* fp, TB_X86_Inst* restrict inst) {
     uint8_t base = inst->regs & 0xFF;
     uint8_t index = (inst->regs >> 8) & 0xFF;
@@ -940,7 +1098,7 @@ static void print_memory_operand(FILE* fp, TB_X86_Inst* restrict inst) {
         if ((inst->regs & 0xFFFF) == 0xFFFF) {
             fprintf(fp, "[rip");
         } else {
-            fprintf(fp, "%s [", tb_x86_type_name(inst->dt));
+            fprintf(fp, "%s [", tb_x86_type_name(x86_operand_dt(inst, inst->dt, true)));
             if (base != 0xFF) {
                 fprintf(fp, "%s", tb_x86_reg_name(base, TB_X86_QWORD));
             }
@@ -957,7 +1115,7 @@ static void print_memory_operand(FILE* fp, TB_X86_Inst* restrict inst) {
         }
         fprintf(fp, "]");
     } else if (base != 0xFF) {
-        fprintf(fp, "%s", tb_x86_reg_name(base, inst->dt));
+        fprintf(fp, "%s", tb_x86_reg_name(base, x86_operand_dt(inst, inst->dt, true)));
     }
 }
 
@@ -967,29 +1125,36 @@ void tb_x86_print_inst(FILE* fp, TB_X86_Inst* inst) {
     const char* mnemonic = tb_x86_mnemonic(inst);
     if (inst->dt >= TB_X86_F32x1 && inst->dt <= TB_X86_F64x2) {
         static const char* strs[] = { "ss", "sd", "ps", "pd" };
-        fprintf(fp, "%s", mnemonic);
+        fprintf(fp, "%s%s", inst->flags & TB_X86_INSTR_VEX ? "v" : "", mnemonic);
         fprintf(fp, "%-6s", strs[inst->dt - TB_X86_F32x1]);
     } else {
         fprintf(fp, "%-8s", mnemonic);
     }
 
     uint8_t rx = (inst->regs >> 16) & 0xFF;
+    uint8_t vvvv = inst->regs >> 24;
     if (inst->flags & TB_X86_INSTR_DIRECTION) {
         if (rx != 255) {
-            fprintf(fp, "%s", tb_x86_reg_name(rx, inst->dt));
+            fprintf(fp, "%s", tb_x86_reg_name(rx, x86_operand_dt(inst, inst->dt2, false)));
             fprintf(fp, ", ");
         }
+        if (vvvv != 255 && !x86_vvvv_last(inst)) {
+            fprintf(fp, "%s, ", tb_x86_reg_name(vvvv, x86_operand_dt(inst, inst->dt2, false)));
+        }
         print_memory_operand(fp, inst);
+        if (vvvv != 255 && x86_vvvv_last(inst)) {
+            fprintf(fp, ", %s", tb_x86_reg_name(vvvv, x86_operand_dt(inst, inst->dt2, false)));
+        }
     } else {
         print_memory_operand(fp, inst);
         if (rx != 255) {
             fprintf(fp, ", ");
-            fprintf(fp, "%s", tb_x86_reg_name(rx, inst->dt));
+            fprintf(fp, "%s", tb_x86_reg_name(rx, x86_operand_dt(inst, inst->dt2, false)));
         }
     }
 
     if (inst->flags & TB_X86_INSTR_IMMEDIATE) {
-        if (inst->regs != 0xFFFFFF) {
+        if ((inst->regs & 0xFFFFFF) != 0xFFFFFF) {
             fprintf(fp, ", ");
         }
 
@@ -20,7 +20,36 @@ static void jcc(TB_CGEmitter* restrict e, Cond cc, int label) {
     tb_emit_rel32(e, &e->labels[label], GET_CODE_POS(e) - 4);
 }
 
-static void emit_memory_operand(TB_CGEmitter* restrict e, uint8_t rx, const Val* a) {
+// multi-byte NOPs from Intel's optimization manual, longer pads are made out of
+// several of these since piling on 66 prefixes makes some decoders choke.
+static void fill_nops(uint8_t* dst, size_t pad) {
+    static const uint8_t nops[9][9] = {
+        { 0x90 },
+        { 0x66, 0x90 },
+        { 0x0F, 0x1F, 0x00 },
+        { 0x0F, 0x1F, 0x40, 0x00 },
+        { 0x0F, 0x1F, 0x44, 0x00, 0x00 },
+        { 0x66, 0x0F, 0x1F, 0x44, 0x00, 0x00 },
+        { 0x0F, 0x1F, 0x80, 0x00, 0x00, 0x00, 0x00 },
+        { 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 },
+        { 0x66, 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    };
+
+    while (pad > 0) {
+        size_t n = pad < 9 ? pad : 9;
+        memcpy(dst, nops[n - 1], n);
+        dst += n, pad -= n;
+    }
+}
+
+static void emit_nops(TB_CGEmitter* restrict e, size_t pad) {
+    fill_nops(tb_cgemit_reserve(e, pad), pad);
+    tb_cgemit_commit(e, pad);
+}
+
+// EVEX scales disp8 by the operand size (disp8*N) which we don't bother tracking,
+// those forms only get a disp8 when it's zero.
+static void emit_memory_operand_ex(TB_CGEmitter* restrict e, uint8_t rx, const Val* a, bool evex) {
     // Operand encoding
     if (a->type == VAL_GPR || a->type == VAL_XMM) {
         EMIT1(e, mod_rx_rm(MOD_DIRECT, rx, a->reg));
@@ -35,7 +64,7 @@ static void emit_memory_operand(TB_CGEmitter* restrict e, uint8_t rx, const Val*
         // and write the real base into the SIB
         uint8_t mod = MOD_INDIRECT_DISP32;
         if (disp == 0 && (base & 7) != RBP) mod = MOD_INDIRECT;
-        else if (disp == (int8_t)disp) mod = MOD_INDIRECT_DISP8;
+        else if (disp == (int8_t)disp && (!evex || disp == 0)) mod = MOD_INDIRECT_DISP8;
 
         EMIT1(e, mod_rx_rm(mod, rx, needs_index ? RSP : base));
         if (needs_index) {
@@ -57,6 +86,34 @@ static void emit_memory_operand(TB_CGEmitter* restrict e, uint8_t rx, const Val*
     }
 }
 
+static void emit_memory_operand(TB_CGEmitter* restrict e, uint8_t rx, const Val* a) {
+    emit_memory_operand_ex(e, rx, a, false);
+}
+
+// 4 byte EVEX prefix (62), same fields as the VEX one except each register gets a
+// 5th bit which is the only way to reach XMM16 - XMM31. no masking or broadcasts.
+//   62 RXBR'00mm Wvvvv1pp 0L'LbV'aaa
+static void emit_evex(TB_CGEmitter* restrict e, int map, int pp, bool w, bool l, uint8_t rx, uint8_t vvvv, const Val* rm, uint8_t op) {
+    uint8_t base = 0, index = 0;
+    if (rm->type == VAL_MEM) {
+        base  = rm->reg;
+        index = rm->index != GPR_NONE ? rm->index : 0;
+    } else if (rm->type == VAL_GPR) {
+        base  = rm->reg;
+    } else if (rm->type == VAL_XMM) {
+        // X is the 5th bit of a register r/m
+        base  = rm->reg;
+        index = rm->reg >> 1;
+    }
+
+    EMIT1(e, 0x62);
+    EMIT1(e, ((~rx & 8) << 4) | ((~index & 8) << 3) | ((~base & 8) << 2) | (~rx & 16) | map);
+    EMIT1(e, (w << 7) | ((~vvvv & 15) << 3) | 4 | pp);
+    EMIT1(e, (l << 5) | ((~vvvv & 16) >> 1));
+    EMIT1(e, op);
+    emit_memory_operand_ex(e, rx, rm, true);
+}
+
 static void inst0(TB_CGEmitter* restrict e, InstType type, TB_X86_DataType dt) {
     assert(type < COUNTOF(inst_table));
     const InstDesc* restrict inst = &inst_table[type];
@@ -80,7 +137,9 @@ static void inst2(TB_CGEmitter* restrict e, InstType type, const Val* a, const V
 
     const InstDesc* restrict inst = &inst_table[type];
     bool dir = b->type == VAL_MEM || b->type == VAL_GLOBAL;
-    if (dir || inst->op == 0x63 || inst->op == 0x69 || inst->op == 0x6E || (type >= CMOVO && type <= CMOVG) || inst->op == 0xAF || inst->cat == INST_BINOP_EXT2) {
+    // CMOVcc's low opcode bits are the condition, they can't double as size & direction
+    bool is_cmov = type >= CMOVO && type <= CMOVG;
+    if (dir || inst->op == 0x63 || inst->op == 0x69 || inst->op == 0x6E || is_cmov || inst->op == 0xAF || inst->cat == INST_BINOP_EXT2) {
         SWAP(const Val*, a, b);
     }
 
@@ -93,7 +152,13 @@ static void inst2(TB_CGEmitter* restrict e, InstType type, const Val* a, const V
 
     // the destination can only be a GPR, no direction flag
     bool is_gpr_only_dst = (inst->op & 1);
-    bool dir_flag = (dir != is_gpr_only_dst) && inst->op != 0x69;
+    bool dir_flag = (dir != is_gpr_only_dst) && inst->op != 0x69 && !is_cmov;
+
+    if (inst->cat == INST_BINOP_EXT3 && (b->reg >= 16 || (a->type == VAL_XMM && a->reg >= 16))) {
+        // EVEX.128.66.0F.W{0,1} 6E/7E, vmovd/vmovq
+        emit_evex(e, 1, 1, dt == TB_X86_QWORD, false, b->reg, 0, a, inst->op);
+        return;
+    }
 
     if (inst->cat != INST_BINOP_EXT3) {
         // Address size prefix
@@ -224,6 +289,36 @@ static void inst2sse(TB_CGEmitter* restrict e, InstType type, const Val* a, cons
         tb_todo();
     }
 
+    if (rx >= 16 || base >= 16) {
+        // XMM16-31 don't exist in the legacy encoding, use the EVEX version of
+        // the AVX op with the destination doubling as the first source.
+        int pp = 0;
+        if (type == FP_MOV && b->type == VAL_XMM) {
+            // register copies don't need the merging vmovss, just take the whole thing
+            pp = is_double ? 1 : 0;
+        } else if (type != FP_XOR && type != FP_AND && type != FP_OR) {
+            if (!packed && type != FP_UCOMI) {
+                pp = is_double ? 3 : 2;
+            } else if (is_double) {
+                pp = 1;
+            }
+        }
+
+        bool w = is_double;
+        if (type == FP_CVT32 || type == FP_CVT64 || type == FP_CVTT || type == FP_CVTT64) {
+            // W is the size of the integer side
+            w = type == FP_CVT64 || type == FP_CVTT64;
+        } else if (type == FP_XOR || type == FP_AND || type == FP_OR) {
+            w = false;
+        }
+
+        bool nds = !(type == FP_MOV || type == FP_UCOMI || type == FP_CVTT || type == FP_CVTT64 || (packed && (type == FP_SQRT || type == FP_CVT)));
+        assert(type != FP_RSQRT && type != FP_CMP && "no EVEX form");
+
+        emit_evex(e, 1, pp, w, false, rx, nds ? rx : 0, b, inst->op + (supports_mem_dst ? dir : 0));
+        return;
+    }
+
     if (type != FP_XOR && type != FP_AND && type != FP_OR) {
         if (!packed && type != FP_UCOMI) {
             EMIT1(e, is_double ? 0xF2 : 0xF3);
@@ -233,8 +328,9 @@ static void inst2sse(TB_CGEmitter* restrict e, InstType type, const Val* a, cons
         }
     }
 
-    if (type == FP_CVT64 || rx >= 8 || base >= 8 || index >= 8) {
-        EMIT1(e, rex(false, rx, base, index));
+    bool w = type == FP_CVT64 || type == FP_CVTT64;
+    if (w || rx >= 8 || base >= 8 || index >= 8) {
+        EMIT1(e, rex(w, rx, base, index));
     }
 
     // extension prefix
@@ -243,6 +339,30 @@ static void inst2sse(TB_CGEmitter* restrict e, InstType type, const Val* a, cons
     emit_memory_operand(e, rx, b);
 }
 
+// 3 byte VEX prefix (C4), map is 1 (0F), 2 (0F38) or 3 (0F3A) and pp is the
+// implied legacy prefix (0 none, 1 66, 2 F3, 3 F2). vvvv is the extra source
+// register which lets us skip the 2-address copies.
+static void emit_vex(TB_CGEmitter* restrict e, int map, int pp, bool w, bool l, uint8_t rx, uint8_t vvvv, const Val* rm, uint8_t op) {
+    if (rx >= 16 || vvvv >= 16 || (rm->type == VAL_XMM && rm->reg >= 16)) {
+        emit_evex(e, map, pp, w, l, rx, vvvv, rm, op);
+        return;
+    }
+
+    uint8_t base = 0, index = 0;
+    if (rm->type == VAL_MEM) {
+        base  = rm->reg;
+        index = rm->index != GPR_NONE ? rm->index : 0;
+    } else if (rm->type == VAL_GPR || rm->type == VAL_XMM) {
+        base  = rm->reg;
+    }
+
+    EMIT1(e, 0xC4);
+    EMIT1(e, ((~rx & 8) << 4) | ((~index & 8) << 3) | ((~base & 8) << 2) | map);
+    EMIT1(e, (w << 7) | ((~vvvv & 15) << 3) | (l << 2) | pp);
+    EMIT1(e, op);
+    emit_memory_operand(e, rx, rm);
+}
+
 static void asm_inst1(TB_CGEmitter* e, int type, TB_X86_DataType dt, const Val* r) {
     assert(type < COUNTOF(inst_table));
     const InstDesc* restrict inst = &inst_table[type];
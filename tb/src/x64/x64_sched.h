@@ -0,0 +1,171 @@
+// Pipeline models for the list scheduler, each machine node maps to a class which
+// says which ports it can issue on, how long until the result is usable and how
+// long it keeps that port busy (reciprocal throughput, 1 means fully pipelined).
+//
+// Numbers are rounded off Agner Fog's instruction tables & uops.info, they only
+// need to be in the right ballpark for the scheduler to interleave independent
+// chains, we don't model the frontend, the ROB or uop splitting.
+#pragma once
+
+typedef enum {
+    X86_SCHED_ALU,     // add, sub, and, or, xor, cmp, test, mov
+    X86_SCHED_SHIFT,   // shl, shr, sar, rol, ror
+    X86_SCHED_LEA,
+    X86_SCHED_IMUL,
+    X86_SCHED_DIV32,
+    X86_SCHED_DIV64,
+    X86_SCHED_CMOV,
+    X86_SCHED_MOVX,    // movsx, movzx
+    X86_SCHED_BRANCH,  // fused cmp+jcc, test+jcc...
+    X86_SCHED_LOAD,    // added on top of the op's latency for memory operands
+    X86_SCHED_STORE,
+    X86_SCHED_VMOV,
+    X86_SCHED_VADD,    // addss, subss...
+    X86_SCHED_VMUL,
+    X86_SCHED_VDIV,
+    X86_SCHED_VLOGIC,  // xorps & zeroing
+    X86_SCHED_VMINMAX,
+    X86_SCHED_UCOMI,
+    X86_SCHED_CALL,
+    X86_SCHED_BULK,    // memcpy, memset & locked ops, mostly serializing
+    X86_SCHED_BITCNT,  // lzcnt, tzcnt, popcnt (or bsr & bsf)
+    X86_SCHED_COUNT
+} X86SchedClass;
+
+typedef struct {
+    uint16_t ports;
+    uint8_t lat;
+    // 0 means it's not pipelined (port is busy until the result is ready)
+    uint8_t tput;
+} X86SchedInfo;
+
+typedef struct {
+    const char* name;
+    int port_count;
+    X86SchedInfo info[X86_SCHED_COUNT];
+} X86Model;
+
+enum {
+    // Intel big cores (Haswell & Skylake), bit i is port i:
+    //   0, 1, 5, 6 are integer ALUs (0 & 6 do branches), 2 & 3 are load/AGU,
+    //   4 is store data and 7 is a store AGU.
+    PORT_0 = 1u << 0, PORT_1 = 1u << 1, PORT_2 = 1u << 2, PORT_3 = 1u << 3,
+    PORT_4 = 1u << 4, PORT_5 = 1u << 5, PORT_6 = 1u << 6, PORT_7 = 1u << 7,
+
+    PORT_0156 = PORT_0 | PORT_1 | PORT_5 | PORT_6,
+    PORT_015  = PORT_0 | PORT_1 | PORT_5,
+    PORT_01   = PORT_0 | PORT_1,
+    PORT_06   = PORT_0 | PORT_6,
+    PORT_15   = PORT_1 | PORT_5,
+    PORT_23   = PORT_2 | PORT_3,
+
+    // Zen: 4 integer ALUs, 2 AGUs and 4 FP pipes (FP0/FP1 multiply, FP2/FP3 add)
+    ZEN_ALU0 = 1u << 0, ZEN_ALU1 = 1u << 1, ZEN_ALU2 = 1u << 2, ZEN_ALU3 = 1u << 3,
+    ZEN_AGU0 = 1u << 4, ZEN_AGU1 = 1u << 5,
+    ZEN_FP0  = 1u << 6, ZEN_FP1  = 1u << 7, ZEN_FP2  = 1u << 8, ZEN_FP3  = 1u << 9,
+
+    ZEN_ALU  = ZEN_ALU0 | ZEN_ALU1 | ZEN_ALU2 | ZEN_ALU3,
+    ZEN_AGU  = ZEN_AGU0 | ZEN_AGU1,
+    ZEN_FP   = ZEN_FP0 | ZEN_FP1 | ZEN_FP2 | ZEN_FP3,
+};
+
+static const X86Model x86_models[TB_X64_MODEL_COUNT] = {
+    // single-issue and nothing's pipelined, this is what the scheduler always
+    // did before the real models.
+    [TB_X64_MODEL_GENERIC] = { "generic", 1, {
+            [X86_SCHED_ALU]     = { 1, 1,  0 },
+            [X86_SCHED_SHIFT]   = { 1, 1,  0 },
+            [X86_SCHED_LEA]     = { 1, 2,  0 },
+            [X86_SCHED_IMUL]    = { 1, 3,  0 },
+            [X86_SCHED_DIV32]   = { 1, 1,  0 },
+            [X86_SCHED_DIV64]   = { 1, 1,  0 },
+            [X86_SCHED_CMOV]    = { 1, 1,  0 },
+            [X86_SCHED_MOVX]    = { 1, 2,  0 },
+            [X86_SCHED_BRANCH]  = { 1, 1,  0 },
+            [X86_SCHED_LOAD]    = { 1, 3,  0 },
+            [X86_SCHED_STORE]   = { 1, 4,  0 },
+            [X86_SCHED_VMOV]    = { 1, 1,  0 },
+            [X86_SCHED_VADD]    = { 1, 1,  0 },
+            [X86_SCHED_VMUL]    = { 1, 1,  0 },
+            [X86_SCHED_VDIV]    = { 1, 11, 0 },
+            [X86_SCHED_VLOGIC]  = { 1, 1,  0 },
+            [X86_SCHED_VMINMAX] = { 1, 1,  0 },
+            [X86_SCHED_UCOMI]   = { 1, 1,  0 },
+            [X86_SCHED_CALL]    = { 1, 1,  0 },
+            [X86_SCHED_BULK]    = { 1, 20, 0 },
+            [X86_SCHED_BITCNT]  = { 1, 3,  0 },
+        }
+    },
+    [TB_X64_MODEL_HASWELL] = { "haswell", 8, {
+            [X86_SCHED_ALU]     = { PORT_0156, 1,  1  },
+            [X86_SCHED_SHIFT]   = { PORT_06,   1,  1  },
+            [X86_SCHED_LEA]     = { PORT_15,   1,  1  },
+            [X86_SCHED_IMUL]    = { PORT_1,    3,  1  },
+            [X86_SCHED_DIV32]   = { PORT_0,    26, 9  },
+            [X86_SCHED_DIV64]   = { PORT_0,    40, 25 },
+            [X86_SCHED_CMOV]    = { PORT_06,   2,  1  },
+            [X86_SCHED_MOVX]    = { PORT_0156, 1,  1  },
+            [X86_SCHED_BRANCH]  = { PORT_06,   1,  1  },
+            [X86_SCHED_LOAD]    = { PORT_23,   4,  1  },
+            [X86_SCHED_STORE]   = { PORT_4,    1,  1  },
+            [X86_SCHED_VMOV]    = { PORT_5,    1,  1  },
+            [X86_SCHED_VADD]    = { PORT_1,    3,  1  },
+            [X86_SCHED_VMUL]    = { PORT_01,   5,  1  },
+            [X86_SCHED_VDIV]    = { PORT_0,    14, 8  },
+            [X86_SCHED_VLOGIC]  = { PORT_5,    1,  1  },
+            [X86_SCHED_VMINMAX] = { PORT_1,    3,  1  },
+            [X86_SCHED_UCOMI]   = { PORT_1,    3,  1  },
+            [X86_SCHED_CALL]    = { PORT_6,    1,  1  },
+            [X86_SCHED_BULK]    = { PORT_0156, 20, 20 },
+            [X86_SCHED_BITCNT]  = { PORT_1,    3,  1  },
+        }
+    },
+    [TB_X64_MODEL_SKYLAKE] = { "skylake", 8, {
+            [X86_SCHED_ALU]     = { PORT_0156, 1,  1  },
+            [X86_SCHED_SHIFT]   = { PORT_06,   1,  1  },
+            [X86_SCHED_LEA]     = { PORT_15,   1,  1  },
+            [X86_SCHED_IMUL]    = { PORT_1,    3,  1  },
+            [X86_SCHED_DIV32]   = { PORT_0,    26, 6  },
+            [X86_SCHED_DIV64]   = { PORT_0,    42, 24 },
+            [X86_SCHED_CMOV]    = { PORT_06,   1,  1  },
+            [X86_SCHED_MOVX]    = { PORT_0156, 1,  1  },
+            [X86_SCHED_BRANCH]  = { PORT_06,   1,  1  },
+            [X86_SCHED_LOAD]    = { PORT_23,   4,  1  },
+            [X86_SCHED_STORE]   = { PORT_4,    1,  1  },
+            [X86_SCHED_VMOV]    = { PORT_015,  1,  1  },
+            [X86_SCHED_VADD]    = { PORT_01,   4,  1  },
+            [X86_SCHED_VMUL]    = { PORT_01,   4,  1  },
+            [X86_SCHED_VDIV]    = { PORT_0,    14, 4  },
+            [X86_SCHED_VLOGIC]  = { PORT_015,  1,  1  },
+            [X86_SCHED_VMINMAX] = { PORT_01,   4,  1  },
+            [X86_SCHED_UCOMI]   = { PORT_0,    2,  1  },
+            [X86_SCHED_CALL]    = { PORT_6,    1,  1  },
+            [X86_SCHED_BULK]    = { PORT_0156, 20, 20 },
+            [X86_SCHED_BITCNT]  = { PORT_1,    3,  1  },
+        }
+    },
+    [TB_X64_MODEL_ZEN] = { "zen", 10, {
+            [X86_SCHED_ALU]     = { ZEN_ALU,             1,  1  },
+            [X86_SCHED_SHIFT]   = { ZEN_ALU1 | ZEN_ALU2, 1,  1  },
+            [X86_SCHED_LEA]     = { ZEN_ALU,             1,  1  },
+            [X86_SCHED_IMUL]    = { ZEN_ALU1,            3,  1  },
+            [X86_SCHED_DIV32]   = { ZEN_ALU2,            25, 14 },
+            [X86_SCHED_DIV64]   = { ZEN_ALU2,            41, 41 },
+            [X86_SCHED_CMOV]    = { ZEN_ALU0 | ZEN_ALU3, 1,  1  },
+            [X86_SCHED_MOVX]    = { ZEN_ALU,             1,  1  },
+            [X86_SCHED_BRANCH]  = { ZEN_ALU0 | ZEN_ALU3, 1,  1  },
+            [X86_SCHED_LOAD]    = { ZEN_AGU,             4,  1  },
+            [X86_SCHED_STORE]   = { ZEN_AGU,             1,  1  },
+            [X86_SCHED_VMOV]    = { ZEN_FP,              1,  1  },
+            [X86_SCHED_VADD]    = { ZEN_FP2 | ZEN_FP3,   3,  1  },
+            [X86_SCHED_VMUL]    = { ZEN_FP0 | ZEN_FP1,   3,  1  },
+            [X86_SCHED_VDIV]    = { ZEN_FP3,             13, 5  },
+            [X86_SCHED_VLOGIC]  = { ZEN_FP,              1,  1  },
+            [X86_SCHED_VMINMAX] = { ZEN_FP0 | ZEN_FP1,   1,  1  },
+            [X86_SCHED_UCOMI]   = { ZEN_FP0 | ZEN_FP1,   3,  1  },
+            [X86_SCHED_CALL]    = { ZEN_ALU0 | ZEN_ALU3, 1,  1  },
+            [X86_SCHED_BULK]    = { ZEN_ALU,             20, 20 },
+            [X86_SCHED_BITCNT]  = { ZEN_ALU,             1,  1  },
+        }
+    },
+};
@@ -2,6 +2,7 @@
 #include <tb_x64.h>
 #include "x64_emitter.h"
 #include "x64_disasm.c"
+#include "x64_sched.h"
 
 #ifdef TB_HAS_X64
 enum {
@@ -11,11 +12,16 @@ enum {
     REG_CLASS_COUNT,
 };
 
-enum {
-    FUNCTIONAL_UNIT_COUNT = 1,
-};
+// the scheduler callbacks only get the function so init_ctx stashes the
+// pipeline model for whatever we're compiling on this thread.
+static thread_local const X86Model* x86_model;
+
+// every port is a unit to the list scheduler, it needs the exact count to
+// tell when they're all busy.
+#define FUNCTIONAL_UNIT_COUNT (x86_model->port_count)
 
 #include "../codegen_impl.h"
+#include "../switch_lower.h"
 
 enum {
     MODE_REG,
@@ -30,7 +36,12 @@ enum {
 typedef struct {
     uint8_t mode : 2;
     Scale scale  : 2;
-    char cond    : 4;
+    uint8_t cond : 4;
+    // set by the peepholes on compares against zero when the previous op already
+    // set the flags, only the jcc/setcc part gets emitted.
+    bool reuse_flags;
+    // float ops with AVX get the VEX encoding, dst = op(lhs, rhs) so they're not 2addr
+    bool vex;
     TB_DataType dt;
     int32_t disp;
     int32_t imm;
@@ -38,6 +49,8 @@ typedef struct {
 
 typedef struct {
     int cc;
+    // the cmp against zero is skipped, see X86MemOp
+    bool reuse_flags;
 } X86Cmov;
 
 typedef struct {
@@ -47,6 +60,14 @@ typedef struct {
     uint32_t clobber_xmm;
 } X86Call;
 
+// unrolled memcpy/memset, the size is known at compile time:
+//   [2] dst
+//   [3] src (or the fill byte, NULL if it's a constant)
+typedef struct {
+    int32_t size;
+    uint8_t fill;
+} X86Bulk;
+
 // machine node types
 typedef enum X86NodeType {
     x86_int3 = TB_MACH_X86,
@@ -79,6 +100,8 @@ static size_t extra_bytes(TB_Node* n) {
     switch (type) {
         case x86_int3:
         case x86_vzero:
+        case x86_shlx: case x86_shrx: case x86_sarx:
+        case x86_andn: case x86_blsr:
         return 0;
 
         case x86_idiv: case x86_div:
@@ -103,6 +126,9 @@ static size_t extra_bytes(TB_Node* n) {
         case x86_cmovcc:
         return sizeof(X86Cmov);
 
+        case x86_memcpy: case x86_memset:
+        return sizeof(X86Bulk);
+
         default:
         tb_todo();
     }
@@ -158,6 +184,13 @@ static void print_extra(TB_Node* n) {
             printf(", scale=%d, disp=%d, mode=%s, imm=%d", 1<<op->scale, op->disp, modes[op->mode], op->imm);
             break;
         }
+
+        case x86_memcpy: case x86_memset:
+        {
+            X86Bulk* op = TB_NODE_GET_EXTRA(n);
+            printf(", size=%d", op->size);
+            break;
+        }
     }
 }
 
@@ -184,6 +217,13 @@ static void print_dumb_extra(TB_Node* n) {
             printf("scale=%d disp=%d mode=%s imm=%d ", 1<<op->scale, op->disp, modes[op->mode], op->imm);
             break;
         }
+
+        case x86_memcpy: case x86_memset:
+        {
+            X86Bulk* op = TB_NODE_GET_EXTRA(n);
+            printf("size=%d ", op->size);
+            break;
+        }
     }
 }
 
@@ -288,6 +328,9 @@ static int node_2addr(TB_Node* n) {
         case x86_vmin: case x86_vmax: case x86_vdiv: case x86_vxor:
         {
             X86MemOp* op = TB_NODE_GET_EXTRA(n);
+            if (op->vex) {
+                return -1;
+            }
             return op->mode != MODE_ST ? 4 : 0;
         }
 
@@ -303,9 +346,9 @@ static int node_2addr(TB_Node* n) {
             return op->mode == MODE_REG ? 2 : 0;
         }
 
-        // ANY_GPR = OP(COND, shared: ANY_GPR, ANY_GPR)
+        // ANY_GPR = OP(CMP, CMP, shared: ANY_GPR, ANY_GPR)
         case x86_cmovcc:
-        return 2;
+        return 3;
 
         // ANY_GPR = OP(ANY_GPR, ...)
         case TB_SHL: case TB_SHR: case TB_ROL: case TB_ROR: case TB_SAR:
@@ -333,18 +376,58 @@ static int node_2addr(TB_Node* n) {
     }
 }
 
+// loads from the constant pool don't depend on memory, they can be redone
+// anywhere the same way the constant would've been.
+static bool is_const_load(TB_Node* n) {
+    if (n->type != x86_vmov && n->type != x86_mov) {
+        return false;
+    }
+
+    X86MemOp* op = TB_NODE_GET_EXTRA(n);
+    return op->mode == MODE_LD && n->inputs[1] == NULL && n->inputs[3] == NULL && n->inputs[2]->type == TB_MACH_SYMBOL;
+}
+
 static bool node_remat(TB_Node* n) {
-    return n->type == x86_lea;
+    switch (n->type) {
+        // xor zero idiom
+        case x86_vzero:
+        case x86_lea:
+        case TB_SYMBOL:
+        return true;
+
+        default:
+        return is_const_load(n);
+    }
+}
+
+static bool node_hoist(TB_Node* n) {
+    switch (n->type) {
+        // movabs is a 10byte instruction, the smaller immediates are basically free
+        case TB_ICONST: {
+            uint64_t x = TB_NODE_GET_EXTRA_T(n, TB_NodeInt)->value;
+            return (x >> 32ull) != 0 && x != (int32_t) x;
+        }
+
+        // RIP-relative symbol addresses (not the frame or register based ones)
+        case x86_lea:
+        return n->inputs[3] == NULL && n->inputs[2]->type == TB_MACH_SYMBOL;
+
+        default:
+        return is_const_load(n);
+    }
 }
 
 static void init_ctx(Ctx* restrict ctx, TB_ABI abi) {
     ctx->abi_index = abi == TB_ABI_SYSTEMV ? 1 : 0;
 
-    // currently only using 16 GPRs and 16 XMMs, AVX gives us
-    // 32 YMMs (which double as XMMs) and later on APX will do
-    // 32 GPRs.
+    uint32_t model = ctx->features.x64_model;
+    x86_model = &x86_models[model < TB_X64_MODEL_COUNT ? model : TB_X64_MODEL_GENERIC];
+
+    // AVX-512 gives us 32 XMMs (the upper 16 are only reachable with EVEX),
+    // APX would do the same for GPRs but we don't have the REX2 encodings
+    // so those stay at 16.
     ctx->num_regs[REG_CLASS_GPR] = 16;
-    ctx->num_regs[REG_CLASS_XMM] = 16;
+    ctx->num_regs[REG_CLASS_XMM] = ctx->features.x64 & TB_FEATURE_X64_AVX512 ? 32 : 16;
 
     uint16_t all_gprs = 0xFFFF & ~(1 << RSP);
     if (ctx->features.gen & TB_FEATURE_FRAME_PTR) {
@@ -355,7 +438,7 @@ static void init_ctx(Ctx* restrict ctx, TB_ABI abi) {
     }
 
     ctx->normie_mask[REG_CLASS_GPR]   = new_regmask(ctx->f, REG_CLASS_GPR,   false, all_gprs);
-    ctx->normie_mask[REG_CLASS_XMM]   = new_regmask(ctx->f, REG_CLASS_XMM,   false, 0xFFFF);
+    ctx->normie_mask[REG_CLASS_XMM]   = new_regmask(ctx->f, REG_CLASS_XMM,   false, (1ull << ctx->num_regs[REG_CLASS_XMM]) - 1);
 
     TB_FunctionPrototype* proto = ctx->f->prototype;
     TB_Node** params = ctx->f->params;
@@ -462,6 +545,20 @@ static bool is_tls_symbol(TB_Symbol* sym) {
     }
 }
 
+// JIT modules can't count on externals being in rel32 range and the JIT only knows
+// how to redirect calls & LEAs, so those don't get folded into memory operands.
+static bool is_far_symbol(TB_Node* n) {
+    TB_Symbol* sym;
+    if (n->type == TB_SYMBOL) {
+        sym = TB_NODE_GET_EXTRA_T(n, TB_NodeSymbol)->sym;
+    } else if (n->type == TB_MACH_SYMBOL) {
+        sym = TB_NODE_GET_EXTRA_T(n, TB_NodeMachSymbol)->sym;
+    } else {
+        return false;
+    }
+    return sym->tag == TB_SYMBOL_EXTERNAL && sym->module->is_jit;
+}
+
 static TB_Node* mach_symbol(TB_Function* f, TB_Symbol* s) {
     TB_Node* n = tb_alloc_node(f, TB_MACH_SYMBOL, TB_TYPE_PTR, 1, sizeof(TB_NodeMachSymbol));
     set_input(f, n, f->root_node, 0);
@@ -469,39 +566,200 @@ static TB_Node* mach_symbol(TB_Function* f, TB_Symbol* s) {
     return tb__gvn(f, n, sizeof(TB_NodeMachSymbol));
 }
 
+// rep movsb/stosb have a pretty high startup cost so small known sizes get
+// unrolled into vector moves (YMM if we've got AVX), past a handful of those
+// the rep is about as good.
+static int bulk_width(Ctx* restrict ctx) {
+    return ctx->features.x64 & TB_FEATURE_X64_AVX ? 32 : 16;
+}
+
+static int bulk_limit(Ctx* restrict ctx) {
+    return 8 * bulk_width(ctx);
+}
+
+// copies of 16 bytes or more are all vector moves, the pattern and the GPR
+// tails are the only things which go through RCX.
+static bool bulk_uses_rcx(TB_Node* n) {
+    return n->type == x86_memset || TB_NODE_GET_EXTRA_T(n, X86Bulk)->size < 16;
+}
+
+static bool has_feature(Ctx* restrict ctx, uint32_t bits) {
+    return (ctx->features.x64 & bits) == bits;
+}
+
+// only used to build up the portable fallbacks during isel, they'll get selected
+// as we walk into them.
+static TB_Node* isel_iconst(TB_Function* f, TB_DataType dt, uint64_t x) {
+    TB_Node* n = tb_alloc_node(f, TB_ICONST, dt, 1, sizeof(TB_NodeInt));
+    set_input(f, n, f->root_node, 0);
+    TB_NODE_SET_EXTRA(n, TB_NodeInt, .value = dt.data < 64 ? x & ((1ull << dt.data) - 1) : x);
+    return tb__gvn(f, n, sizeof(TB_NodeInt));
+}
+
+static TB_Node* isel_binop(TB_Function* f, int type, TB_Node* a, TB_Node* b) {
+    TB_Node* n = tb_alloc_node(f, type, a->dt, 3, sizeof(TB_NodeBinopInt));
+    set_input(f, n, a, 1);
+    set_input(f, n, b, 2);
+    return n;
+}
+
+static TB_Node* isel_shrimm(TB_Function* f, TB_Node* src, int imm) {
+    TB_Node* op = tb_alloc_node(f, x86_shrimm, src->dt, 3, sizeof(X86MemOp));
+    set_input(f, op, src, 2);
+    TB_NODE_SET_EXTRA(op, X86MemOp, .imm = imm);
+    return op;
+}
+
+// clz, ctz & popcnt only come in 32bit and 64bit flavors (and 16bit but nobody
+// wants that prefix), smaller ints get zero extended first.
+static TB_Node* isel_bitcount(Ctx* restrict ctx, TB_Function* f, TB_Node* n) {
+    TB_Node* src = n->inputs[1];
+    int bits = src->dt.type == TB_TAG_PTR ? 64 : src->dt.data;
+    if (bits < 32) {
+        TB_Node* ext = tb_alloc_node(f, TB_ZERO_EXT, TB_TYPE_I32, 2, 0);
+        set_input(f, ext, src, 1);
+        src = ext;
+
+        if (n->type == TB_CLZ) {
+            // the extension added 32-bits leading zeros
+            TB_Node* clz = tb_alloc_node(f, TB_CLZ, TB_TYPE_I32, 2, 0);
+            set_input(f, clz, src, 1);
+
+            TB_Node* op = tb_alloc_node(f, x86_subimm, TB_TYPE_I32, 3, sizeof(X86MemOp));
+            set_input(f, op, clz, 2);
+            TB_NODE_SET_EXTRA(op, X86MemOp, .imm = 32 - bits);
+            return op;
+        }
+        set_input(f, n, src, 1);
+        bits = 32;
+    } else if (bits != 32 && bits != 64) {
+        tb_todo();
+    }
+
+    if (n->type != TB_POPCNT || has_feature(ctx, TB_FEATURE_X64_POPCNT)) {
+        // lzcnt/tzcnt or bsr/bsf, we pick at emit time
+        return n;
+    }
+
+    // no popcnt, the usual SWAR sum:
+    //   x = x - ((x >> 1) & 0x55...)
+    //   x = (x & 0x33...) + ((x >> 2) & 0x33...)
+    //   x = (x + (x >> 4)) & 0x0F...
+    //   r = (x * 0x01...) >> (bits - 8)
+    TB_DataType dt = src->dt;
+    uint64_t m1 = 0x5555555555555555ull, m2 = 0x3333333333333333ull;
+    uint64_t m4 = 0x0F0F0F0F0F0F0F0Full, h01 = 0x0101010101010101ull;
+
+    TB_Node* x = src;
+    TB_Node* t = isel_binop(f, TB_AND, isel_shrimm(f, x, 1), isel_iconst(f, dt, m1));
+    x = isel_binop(f, TB_SUB, x, t);
+
+    TB_Node* lo = isel_binop(f, TB_AND, x, isel_iconst(f, dt, m2));
+    TB_Node* hi = isel_binop(f, TB_AND, isel_shrimm(f, x, 2), isel_iconst(f, dt, m2));
+    x = isel_binop(f, TB_ADD, lo, hi);
+
+    x = isel_binop(f, TB_ADD, x, isel_shrimm(f, x, 4));
+    x = isel_binop(f, TB_AND, x, isel_iconst(f, dt, m4));
+    x = isel_binop(f, TB_MUL, x, isel_iconst(f, dt, h01));
+
+    TB_Node* r = isel_shrimm(f, x, bits - 8);
+    if (bits == 64) {
+        RegMask* rm = ctx->normie_mask[REG_CLASS_GPR];
+        TB_Node* cpy = tb_alloc_node(f, TB_MACH_COPY, TB_TYPE_I32, 2, sizeof(TB_NodeMachCopy));
+        set_input(f, cpy, r, 1);
+        TB_NODE_SET_EXTRA(cpy, TB_NodeMachCopy, .def = rm, .use = rm);
+        return cpy;
+    }
+    return r;
+}
+
+// matches ~x, (xor x -1)
+static TB_Node* isel_not(TB_Node* n) {
+    int32_t x;
+    if (n->type == TB_XOR && try_for_imm32(n->dt.data, n->inputs[2], &x) && x == -1) {
+        return n->inputs[1];
+    }
+    return NULL;
+}
+
+// matches x - 1, (add x -1) or (sub x 1)
+static bool isel_is_dec(TB_Node* n, TB_Node* x) {
+    int32_t imm;
+    if (n->inputs[1] != x || !try_for_imm32(n->dt.data, n->inputs[2], &imm)) {
+        return false;
+    }
+    return (n->type == TB_ADD && imm == -1) || (n->type == TB_SUB && imm == 1);
+}
+
+static uint32_t callee_saved_gprs(Ctx* restrict ctx) {
+    uint32_t callee_saved_gpr = ~param_descs[ctx->abi_index].caller_saved_gprs;
+    callee_saved_gpr &= (1u << ctx->num_regs[REG_CLASS_GPR]) - 1;
+    callee_saved_gpr &= ~(1u << RSP);
+    if (ctx->features.gen & TB_FEATURE_FRAME_PTR) {
+        callee_saved_gpr &= ~(1 << RBP);
+    }
+    return callee_saved_gpr;
+}
+
+// the ABIs only describe XMM0-15, the upper 16 are volatile everywhere
+static uint32_t caller_saved_xmms(Ctx* restrict ctx) {
+    uint32_t caller_saved_xmm = (1u << param_descs[ctx->abi_index].caller_saved_xmms) - 1;
+    if (ctx->num_regs[REG_CLASS_XMM] > 16) {
+        caller_saved_xmm |= 0xFFFF0000;
+    }
+    return caller_saved_xmm;
+}
+
+static uint32_t callee_saved_xmms(Ctx* restrict ctx) {
+    return ~caller_saved_xmms(ctx) & 0xFFFF;
+}
+
+static void add_to_exits(TB_Function* f, TB_Node* root, TB_Node* proj) {
+    FOR_N(i, 1, root->input_count) {
+        TB_Node* end = root->inputs[i];
+        if (end->type == TB_RETURN || end->type == TB_TAILCALL) {
+            add_input_late(f, end, proj);
+        }
+    }
+}
+
 static TB_Node* node_isel(Ctx* restrict ctx, TB_Function* f, TB_Node* n) {
     if (n->type == TB_PROJ) {
         return n;
     } else if (n->type == TB_ROOT) {
-        TB_Node* ret = n->inputs[1];
-        if (ret->type == TB_RETURN) {
-            // add some callee-saved mach projections
-            int j = 3 + f->prototype->param_count;
+        bool has_exit = false;
+        FOR_N(i, 1, n->input_count) {
+            has_exit |= n->inputs[i]->type == TB_RETURN || n->inputs[i]->type == TB_TAILCALL;
+        }
 
-            uint32_t callee_saved_gpr = ~param_descs[ctx->abi_index].caller_saved_gprs;
-            callee_saved_gpr &= ~(1u << RSP);
-            if (ctx->features.gen & TB_FEATURE_FRAME_PTR) {
-                callee_saved_gpr &= ~(1 << RBP);
-            }
+        if (!has_exit) {
+            return n;
+        }
 
-            FOR_N(i, 0, ctx->num_regs[REG_CLASS_GPR]) {
-                if ((callee_saved_gpr >> i) & 1) {
-                    RegMask* rm = intern_regmask(ctx, REG_CLASS_GPR, false, 1u << i);
-                    TB_Node* proj = tb_alloc_node(f, TB_MACH_PROJ, TB_TYPE_I64, 1, sizeof(TB_NodeMachProj));
-                    TB_NODE_SET_EXTRA(proj, TB_NodeMachProj, .index = j++, .def = rm);
+        // add some callee-saved mach projections, every exit (returns & tailcalls)
+        // needs them back in place.
+        int j = 3 + f->prototype->param_count;
+        uint32_t callee_saved_gpr = callee_saved_gprs(ctx);
+        FOR_N(i, 0, ctx->num_regs[REG_CLASS_GPR]) {
+            if ((callee_saved_gpr >> i) & 1) {
+                RegMask* rm = intern_regmask(ctx, REG_CLASS_GPR, false, 1u << i);
+                TB_Node* proj = tb_alloc_node(f, TB_MACH_PROJ, TB_TYPE_I64, 1, sizeof(TB_NodeMachProj));
+                TB_NODE_SET_EXTRA(proj, TB_NodeMachProj, .index = j++, .def = rm);
 
-                    set_input(f, proj, n, 0);
-                    add_input_late(f, ret, proj);
-                }
+                set_input(f, proj, n, 0);
+                add_to_exits(f, n, proj);
             }
+        }
 
-            FOR_N(i, param_descs[ctx->abi_index].caller_saved_xmms, ctx->num_regs[REG_CLASS_XMM]) {
+        uint32_t callee_saved_xmm = callee_saved_xmms(ctx);
+        FOR_N(i, 0, ctx->num_regs[REG_CLASS_XMM]) {
+            if ((callee_saved_xmm >> i) & 1) {
                 RegMask* rm = intern_regmask(ctx, REG_CLASS_XMM, false, 1u << i);
                 TB_Node* proj = tb_alloc_node(f, TB_MACH_PROJ, TB_TYPE_F64, 1, sizeof(TB_NodeMachProj));
                 TB_NODE_SET_EXTRA(proj, TB_NodeMachProj, .index = j++, .def = rm);
 
                 set_input(f, proj, n, 0);
-                add_input_late(f, ret, proj);
+                add_to_exits(f, n, proj);
             }
         }
 
@@ -689,18 +947,18 @@ static TB_Node* node_isel(Ctx* restrict ctx, TB_Function* f, TB_Node* n) {
     } else if (n->type == TB_SELECT) {
         TB_Node* op = tb_alloc_node(f, x86_cmovcc, n->dt, 5, sizeof(X86Cmov));
 
+        // the cmov moves the false side in when cc holds so it's the inverse of
+        // the condition, float compares don't fit in the integer CMP.
         Cond cc = E;
         TB_Node* cond = n->inputs[1];
-        if (cond->type >= TB_CMP_EQ && cond->type <= TB_CMP_FLE) {
+        if (cond->type >= TB_CMP_EQ && cond->type <= TB_CMP_SLE) {
             switch (cond->type) {
-                case TB_CMP_EQ:  cc = E;  break;
-                case TB_CMP_NE:  cc = NE; break;
-                case TB_CMP_SLT: cc = L;  break;
-                case TB_CMP_SLE: cc = LE; break;
-                case TB_CMP_ULT: cc = B;  break;
-                case TB_CMP_ULE: cc = BE; break;
-                case TB_CMP_FLT: cc = B;  break;
-                case TB_CMP_FLE: cc = BE; break;
+                case TB_CMP_EQ:  cc = NE; break;
+                case TB_CMP_NE:  cc = E;  break;
+                case TB_CMP_SLT: cc = GE; break;
+                case TB_CMP_SLE: cc = G;  break;
+                case TB_CMP_ULT: cc = NB; break;
+                case TB_CMP_ULE: cc = A;  break;
                 default: tb_unreachable();
             }
 
@@ -734,7 +992,7 @@ static TB_Node* node_isel(Ctx* restrict ctx, TB_Function* f, TB_Node* n) {
 
         const struct ParamDesc* abi = &param_descs[ctx->abi_index];
         op_extra->clobber_gpr = abi->caller_saved_gprs;
-        op_extra->clobber_xmm = abi->caller_saved_xmms;
+        op_extra->clobber_xmm = caller_saved_xmms(ctx);
 
         int gprs_used = 0, xmms_used = 0;
         FOR_N(i, 3, n->input_count) {
@@ -763,6 +1021,32 @@ static TB_Node* node_isel(Ctx* restrict ctx, TB_Function* f, TB_Node* n) {
         }
 
         return op;
+    } else if (n->type == TB_TAILCALL) {
+        // static targets get a direct JMP rel32
+        if (n->inputs[2]->type == TB_SYMBOL) {
+            TB_Symbol* sym = TB_NODE_GET_EXTRA_T(n->inputs[2], TB_NodeSymbol)->sym;
+            set_input(f, n, mach_symbol(f, sym), 2);
+        }
+        return n;
+    } else if (n->type == TB_MEMCPY || n->type == TB_MEMSET) {
+        int32_t size;
+        if (try_for_imm32(64, n->inputs[4], &size) && size >= 0 && size <= bulk_limit(ctx)) {
+            TB_Node* op = tb_alloc_node(f, n->type == TB_MEMCPY ? x86_memcpy : x86_memset, TB_TYPE_MEMORY, 4, sizeof(X86Bulk));
+            set_input(f, op, n->inputs[0], 0);
+            set_input(f, op, n->inputs[1], 1);
+            set_input(f, op, n->inputs[2], 2);
+
+            uint8_t fill = 0;
+            if (n->type == TB_MEMSET && n->inputs[3]->type == TB_ICONST) {
+                fill = TB_NODE_GET_EXTRA_T(n->inputs[3], TB_NodeInt)->value;
+            } else {
+                set_input(f, op, n->inputs[3], 3);
+            }
+
+            TB_NODE_SET_EXTRA(op, X86Bulk, .size = size, .fill = fill);
+            return op;
+        }
+        return n;
     } else if (n->type == TB_VA_START) {
         assert(ctx->module->target_abi == TB_ABI_WIN64 && "How does va_start even work on SysV?");
 
@@ -898,22 +1182,69 @@ static TB_Node* node_isel(Ctx* restrict ctx, TB_Function* f, TB_Node* n) {
                 TB_NODE_SET_EXTRA(mach_cond, X86MemOp, .dt = cond->dt);
                 set_input(f, mach_cond, cond, 2);
                 set_input(f, mach_cond, cond, 4);
-                if_br->key = E;
+                // the key is the condition for taking the default (index 0) edge
+                if_br->key = NE;
             } else {
                 mach_cond = tb_alloc_node(f, x86_cmpimmjcc, TB_TYPE_TUPLE, 5, sizeof(X86MemOp));
                 TB_NODE_SET_EXTRA(mach_cond, X86MemOp, .dt = cond->dt, .imm = if_br->key);
                 set_input(f, mach_cond, cond, 2);
-                if_br->key = E;
+                if_br->key = NE;
             }
 
             set_input(f, mach_cond, n->inputs[0], 0);
             return mach_cond;
         } else {
+            // switch, we compare at 32bits or 64bits so small keys get zero extended
+            int bits = cond->dt.type == TB_TAG_PTR ? 64 : cond->dt.data;
+            if (bits < 32) {
+                TB_Node* ext = tb_alloc_node(f, TB_ZERO_EXT, TB_TYPE_I32, 2, 0);
+                set_input(f, ext, cond, 1);
+                set_input(f, n, ext, 1);
+                switch_zext_keys(n, bits);
+            }
+
             n->type = x86_AAAAAHHHH;
             return n;
         }
     }
 
+    if (n->type == TB_CLZ || n->type == TB_CTZ || n->type == TB_POPCNT) {
+        return isel_bitcount(ctx, f, n);
+    }
+
+    bool is_32or64 = n->dt.type == TB_TAG_INT && (n->dt.data == 32 || n->dt.data == 64);
+    if ((n->type == TB_SHL || n->type == TB_SHR || n->type == TB_SAR) && is_32or64 && has_feature(ctx, TB_FEATURE_X64_BMI2)) {
+        // shlx/shrx/sarx take the count from any GPR and don't write the flags
+        X86NodeType type = n->type == TB_SHL ? x86_shlx : n->type == TB_SHR ? x86_shrx : x86_sarx;
+        TB_Node* op = tb_alloc_node(f, type, n->dt, 3, 0);
+        set_input(f, op, n->inputs[1], 1);
+        set_input(f, op, n->inputs[2], 2);
+        return op;
+    }
+
+    if (n->type == TB_AND && is_32or64 && has_feature(ctx, TB_FEATURE_X64_BMI1)) {
+        // (and a (xor b -1)) => (andn b a)
+        FOR_N(i, 1, 3) {
+            TB_Node* b = isel_not(n->inputs[i]);
+            if (b != NULL) {
+                TB_Node* op = tb_alloc_node(f, x86_andn, n->dt, 3, 0);
+                set_input(f, op, b, 1);
+                set_input(f, op, n->inputs[3 - i], 2);
+                return op;
+            }
+        }
+
+        // (and x (add x -1)) => (blsr x), clears the lowest set bit
+        FOR_N(i, 1, 3) {
+            TB_Node* x = n->inputs[3 - i];
+            if ((n->inputs[i]->type == TB_ADD || n->inputs[i]->type == TB_SUB) && isel_is_dec(n->inputs[i], x)) {
+                TB_Node* op = tb_alloc_node(f, x86_blsr, n->dt, 2, 0);
+                set_input(f, op, x, 1);
+                return op;
+            }
+        }
+    }
+
     int32_t x;
     if (n->type == TB_MUL && try_for_imm32(n->dt.data, n->inputs[2], &x)) {
         TB_Node* op = tb_alloc_node(f, x86_imulimm, n->dt, 2, sizeof(X86MemOp));
@@ -1006,6 +1337,7 @@ static TB_Node* node_isel(Ctx* restrict ctx, TB_Function* f, TB_Node* n) {
                 n = n->inputs[2];
             } else if (n->type >= TB_FADD && n->type <= TB_FMAX) {
                 op_extra->mode = MODE_REG;
+                op_extra->vex = has_feature(ctx, TB_FEATURE_X64_AVX);
                 op->type = fops[n->type - TB_FADD];
                 set_input(f, op, n->inputs[1], 4);
                 n = n->inputs[2];
@@ -1034,7 +1366,9 @@ static TB_Node* node_isel(Ctx* restrict ctx, TB_Function* f, TB_Node* n) {
         }
 
         if (n->type == TB_SYMBOL) {
-            n = mach_symbol(f, TB_NODE_GET_EXTRA_T(n, TB_NodeSymbol)->sym);
+            if (!is_far_symbol(n)) {
+                n = mach_symbol(f, TB_NODE_GET_EXTRA_T(n, TB_NodeSymbol)->sym);
+            }
         } else if (n->type == TB_PTR_OFFSET) {
             set_input(f, op, n->inputs[2], 3);
             if (n->inputs[2]->type == TB_SHL && n->inputs[2]->inputs[2]->type == TB_ICONST) {
@@ -1050,12 +1384,12 @@ static TB_Node* node_isel(Ctx* restrict ctx, TB_Function* f, TB_Node* n) {
         }
 
         // sometimes introduced by other isel bits
-        if (n->type == x86_lea && n->inputs[3] == NULL) {
+        if (n->type == x86_lea && n->inputs[3] == NULL && !is_far_symbol(n->inputs[2])) {
             op_extra->disp += TB_NODE_GET_EXTRA_T(n, X86MemOp)->disp;
             n = n->inputs[2];
         }
 
-        if (n->type == TB_SYMBOL && n->inputs[3] == NULL) {
+        if (n->type == TB_SYMBOL && !is_far_symbol(n) && n->inputs[3] == NULL) {
             TB_Node* base = mach_symbol(f, TB_NODE_GET_EXTRA_T(n, TB_NodeSymbol)->sym);
             set_input(f, op, base, 2);
         } else if (n->type == TB_LOCAL) {
@@ -1071,11 +1405,32 @@ static TB_Node* node_isel(Ctx* restrict ctx, TB_Function* f, TB_Node* n) {
     return NULL;
 }
 
+// the compare chain only needs the key, bit tests, tables, range checks & big
+// immediates need R10 & R11 for scratch.
+static bool switch_tmps(Ctx* restrict ctx, TB_Node* n) {
+    SwitchPlan* p = switch_get_plan(ctx, n);
+    FOR_N(i, 0, p->cluster_count) {
+        SwitchCluster* c = &p->clusters[i];
+        if (c->kind != SW_RANGE || c->lo != c->hi) {
+            return true;
+        }
+
+        if (p->is_64bit && (int64_t) c->lo != (int32_t) c->lo) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 static int node_tmp_count(Ctx* restrict ctx, TB_Node* n) {
     switch (n->type) {
+        case x86_AAAAAHHHH:
+        return switch_tmps(ctx, n) ? 2 : 0;
+
         case x86_call: case x86_static_call: {
             X86Call* op_extra = TB_NODE_GET_EXTRA(n);
-            return tb_popcount(op_extra->clobber_gpr) + op_extra->clobber_xmm;
+            return tb_popcount(op_extra->clobber_gpr) + tb_popcount(op_extra->clobber_xmm);
         }
 
         case TB_MEMSET:
@@ -1084,6 +1439,10 @@ static int node_tmp_count(Ctx* restrict ctx, TB_Node* n) {
         case TB_MEMCPY:
         return 3;
 
+        // vector temp & RCX for the pattern and the small tails
+        case x86_memcpy: case x86_memset:
+        return bulk_uses_rcx(n) ? 2 : 1;
+
         case x86_idiv: case x86_div: // clobber RDX
         return 1;
 
@@ -1094,12 +1453,31 @@ static int node_tmp_count(Ctx* restrict ctx, TB_Node* n) {
     }
 }
 
+// exits (returns & tailcalls) keep the callee-saved registers pinned from the
+// entry projections, starting at ins[j].
+static void callee_saved_constraints(Ctx* restrict ctx, RegMask** ins, size_t j) {
+    uint32_t callee_saved_gpr = callee_saved_gprs(ctx);
+    FOR_N(i, 0, ctx->num_regs[REG_CLASS_GPR]) {
+        if ((callee_saved_gpr >> i) & 1) {
+            ins[j++] = intern_regmask(ctx, REG_CLASS_GPR, false, 1u << i);
+        }
+    }
+
+    uint32_t callee_saved_xmm = callee_saved_xmms(ctx);
+    FOR_N(i, 0, ctx->num_regs[REG_CLASS_XMM]) {
+        if ((callee_saved_xmm >> i) & 1) {
+            ins[j++] = intern_regmask(ctx, REG_CLASS_XMM, false, 1u << i);
+        }
+    }
+}
+
 static RegMask* node_constraint(Ctx* restrict ctx, TB_Node* n, RegMask** ins) {
     switch (n->type) {
         case TB_REGION:
         case TB_SPLITMEM:
         case TB_MERGEMEM:
         case TB_TRAP:
+        case TB_UNREACHABLE:
         case TB_DEBUGBREAK:
         case TB_AFFINE_LOOP:
         case TB_NATURAL_LOOP:
@@ -1118,6 +1496,15 @@ static RegMask* node_constraint(Ctx* restrict ctx, TB_Node* n, RegMask** ins) {
             return ctx->normie_mask[REG_CLASS_GPR];
         }
 
+        case TB_SAFEPOINT_POLL: {
+            // only the poll address needs a register, the rest just needs to be alive
+            if (ins) {
+                FOR_N(i, 1, n->input_count) { ins[i] = &TB_REG_EMPTY; }
+                ins[2] = ctx->normie_mask[REG_CLASS_GPR];
+            }
+            return &TB_REG_EMPTY;
+        }
+
         case TB_CYCLE_COUNTER: {
             ins[1] = intern_regmask(ctx, REG_CLASS_GPR, false, 1u << RAX);
             ins[2] = intern_regmask(ctx, REG_CLASS_GPR, false, 1u << RDX);
@@ -1174,18 +1561,31 @@ static RegMask* node_constraint(Ctx* restrict ctx, TB_Node* n, RegMask** ins) {
                     return &TB_REG_EMPTY;
                 } else {
                     int param_id = i - 3;
-                    if (n->dt.type == TB_TAG_F32 || n->dt.type == TB_TAG_F64) {
-                        if (param_id >= params->xmm_count) {
+                    bool is_float = n->dt.type == TB_TAG_F32 || n->dt.type == TB_TAG_F64;
+
+                    // win64 gives each param the same slot in both register files, sysv counts
+                    // the GPRs and XMMs separately (same as the calls do).
+                    int reg_id = param_id;
+                    if (ctx->abi_index != 0) {
+                        TB_FunctionPrototype* proto = ctx->f->prototype;
+                        reg_id = 0;
+                        FOR_N(k, 0, param_id) {
+                            reg_id += TB_IS_FLOAT_TYPE(proto->params[k].dt) == is_float;
+                        }
+                    }
+
+                    if (is_float) {
+                        if (reg_id >= params->xmm_count) {
                             return intern_regmask(ctx, REG_CLASS_STK, false, param_id);
                         }
 
-                        return intern_regmask(ctx, REG_CLASS_XMM, false, 1u << param_id);
+                        return intern_regmask(ctx, REG_CLASS_XMM, false, 1u << reg_id);
                     } else {
-                        if (param_id >= params->gpr_count) {
+                        if (reg_id >= params->gpr_count) {
                             return intern_regmask(ctx, REG_CLASS_STK, false, param_id);
                         }
 
-                        return intern_regmask(ctx, REG_CLASS_GPR, false, 1u << params->gprs[param_id]);
+                        return intern_regmask(ctx, REG_CLASS_GPR, false, 1u << params->gprs[reg_id]);
                     }
                 }
             } else if (n->inputs[0]->type == x86_call || n->inputs[0]->type == x86_static_call) {
@@ -1211,7 +1611,15 @@ static RegMask* node_constraint(Ctx* restrict ctx, TB_Node* n, RegMask** ins) {
 
         case x86_AAAAAHHHH:
         if (ins) {
-            ins[1] = ctx->normie_mask[REG_CLASS_GPR];
+            if (switch_tmps(ctx, n)) {
+                // the key is still needed after the temps are written, it can't alias them
+                uint64_t tmps = (1u << R10) | (1u << R11);
+                ins[1] = intern_regmask(ctx, REG_CLASS_GPR, false, ctx->normie_mask[REG_CLASS_GPR]->mask[0] & ~tmps);
+                ins[2] = intern_regmask(ctx, REG_CLASS_GPR, false, 1u << R10);
+                ins[3] = intern_regmask(ctx, REG_CLASS_GPR, false, 1u << R11);
+            } else {
+                ins[1] = ctx->normie_mask[REG_CLASS_GPR];
+            }
         }
         return &TB_REG_EMPTY;
 
@@ -1282,8 +1690,8 @@ static RegMask* node_constraint(Ctx* restrict ctx, TB_Node* n, RegMask** ins) {
 
         case TB_FLOAT2INT:
         case TB_FLOAT2UINT: {
-            if (ins) { ins[1] = ctx->normie_mask[REG_CLASS_GPR]; }
-            return ctx->normie_mask[REG_CLASS_XMM];
+            if (ins) { ins[1] = ctx->normie_mask[REG_CLASS_XMM]; }
+            return ctx->normie_mask[REG_CLASS_GPR];
         }
 
         case TB_NEG: {
@@ -1293,8 +1701,8 @@ static RegMask* node_constraint(Ctx* restrict ctx, TB_Node* n, RegMask** ins) {
 
         case TB_INT2FLOAT:
         case TB_UINT2FLOAT: {
-            if (ins) { ins[1] = ctx->normie_mask[REG_CLASS_XMM]; }
-            return ctx->normie_mask[REG_CLASS_GPR];
+            if (ins) { ins[1] = ctx->normie_mask[REG_CLASS_GPR]; }
+            return ctx->normie_mask[REG_CLASS_XMM];
         }
 
         case x86_lea:
@@ -1332,7 +1740,8 @@ static RegMask* node_constraint(Ctx* restrict ctx, TB_Node* n, RegMask** ins) {
         case x86_div:
         case x86_idiv:
         {
-            RegMask* rm = ctx->normie_mask[REG_CLASS_GPR];
+            // RDX gets zero'd (or sign extended into) before the operand is read
+            RegMask* rm = intern_regmask(ctx, REG_CLASS_GPR, false, ctx->normie_mask[REG_CLASS_GPR]->mask[0] & ~(1u << RDX));
             if (ins) {
                 ins[1] = &TB_REG_EMPTY;
                 // dividend operand (might be an address)
@@ -1387,6 +1796,22 @@ static RegMask* node_constraint(Ctx* restrict ctx, TB_Node* n, RegMask** ins) {
             return rm;
         }
 
+        // ANY_GPR = OP(ANY_GPR)
+        case TB_CLZ: case TB_CTZ: case TB_POPCNT: case x86_blsr:
+        {
+            RegMask* rm = ctx->normie_mask[REG_CLASS_GPR];
+            if (ins) { ins[1] = rm; }
+            return rm;
+        }
+
+        // ANY_GPR = OP(ANY_GPR, ANY_GPR), VEX encoded so not 2addr
+        case x86_shlx: case x86_shrx: case x86_sarx: case x86_andn:
+        {
+            RegMask* rm = ctx->normie_mask[REG_CLASS_GPR];
+            if (ins) { ins[1] = ins[2] = rm; }
+            return rm;
+        }
+
         {
             RegMask* rm = ctx->normie_mask[REG_CLASS_GPR];
             if (ins) {
@@ -1436,6 +1861,25 @@ static RegMask* node_constraint(Ctx* restrict ctx, TB_Node* n, RegMask** ins) {
             return &TB_REG_EMPTY;
         }
 
+        case x86_memcpy: case x86_memset:
+        {
+            if (ins) {
+                // RCX is a temp so the pointers can't live there, the tmps would
+                // happily alias with inputs which die here.
+                RegMask* rm = ctx->normie_mask[REG_CLASS_GPR];
+                if (bulk_uses_rcx(n)) {
+                    rm = intern_regmask(ctx, REG_CLASS_GPR, false, rm->mask[0] & ~(1u << RCX));
+                    ins[5] = intern_regmask(ctx, REG_CLASS_GPR, false, 1u << RCX);
+                }
+                ins[1] = &TB_REG_EMPTY;
+                ins[2] = rm;
+                ins[3] = n->type == x86_memcpy ? rm : (n->inputs[3] ? ctx->normie_mask[REG_CLASS_GPR] : &TB_REG_EMPTY);
+                // the splat & tails are hand encoded SSE, no XMM16-31 there
+                ins[4] = intern_regmask(ctx, REG_CLASS_XMM, false, 0xFFFF);
+            }
+            return &TB_REG_EMPTY;
+        }
+
         case TB_NEVER_BRANCH:
         return &TB_REG_EMPTY;
 
@@ -1460,22 +1904,47 @@ static RegMask* node_constraint(Ctx* restrict ctx, TB_Node* n, RegMask** ins) {
                     }
                 }
 
-                uint32_t callee_saved_gpr = ~param_descs[ctx->abi_index].caller_saved_gprs;
-                callee_saved_gpr &= ~(1u << RSP);
-                if (ctx->features.gen & TB_FEATURE_FRAME_PTR) {
-                    callee_saved_gpr &= ~(1 << RBP);
-                }
+                callee_saved_constraints(ctx, ins, 3 + proto->return_count);
+            }
+            return &TB_REG_EMPTY;
+        }
+
+        case TB_TAILCALL:
+        {
+            if (ins) {
+                const struct ParamDesc* abi = &param_descs[ctx->abi_index];
+
+                int abi_index = ctx->abi_index;
+                int gprs_used = 0, xmms_used = 0;
+
+                // the target can't be sitting in a param or callee-saved register
+                // since those get clobbered by the epilogue & the param moves.
+                uint32_t param_gprs = 0;
+                FOR_N(i, 0, abi->gpr_count) { param_gprs |= 1u << abi->gprs[i]; }
 
-                size_t j = 3 + proto->return_count;
-                FOR_N(i, 0, ctx->num_regs[REG_CLASS_GPR]) {
-                    if ((callee_saved_gpr >> i) & 1) {
-                        ins[j++] = intern_regmask(ctx, REG_CLASS_GPR, false, 1u << i);
+                ins[1] = &TB_REG_EMPTY;
+                ins[2] = n->inputs[2]->type == TB_MACH_SYMBOL ? &TB_REG_EMPTY : intern_regmask(ctx, REG_CLASS_GPR, false, abi->caller_saved_gprs & ~param_gprs);
+
+                // the callee-saved inputs come after the params
+                int callee_saved_count = tb_popcount(callee_saved_gprs(ctx)) + tb_popcount(callee_saved_xmms(ctx));
+                int param_end = n->input_count - callee_saved_count;
+                FOR_N(i, 3, param_end) {
+                    int param_num = i - 3;
+                    if (abi_index == 0) { xmms_used = gprs_used = param_num; }
+
+                    // tb_opt_tailcalls won't make tailcalls which need stack params
+                    if (TB_IS_FLOAT_TYPE(n->inputs[i]->dt)) {
+                        assert(xmms_used < abi->xmm_count && "tailcalls can't pass params on the stack");
+                        ins[i] = intern_regmask(ctx, REG_CLASS_XMM, false, 1u << xmms_used);
+                        xmms_used += 1;
+                    } else {
+                        assert(gprs_used < abi->gpr_count && "tailcalls can't pass params on the stack");
+                        ins[i] = intern_regmask(ctx, REG_CLASS_GPR, false, 1u << abi->gprs[gprs_used]);
+                        gprs_used += 1;
                     }
                 }
 
-                FOR_N(i, param_descs[ctx->abi_index].caller_saved_xmms, ctx->num_regs[REG_CLASS_XMM]) {
-                    ins[j++] = intern_regmask(ctx, REG_CLASS_XMM, false, 1u << i);
-                }
+                callee_saved_constraints(ctx, ins, param_end);
             }
             return &TB_REG_EMPTY;
         }
@@ -1524,8 +1993,8 @@ static RegMask* node_constraint(Ctx* restrict ctx, TB_Node* n, RegMask** ins) {
                     if (bits & 1) { ins[j++] = intern_regmask(ctx, REG_CLASS_GPR, false, 1u << k); }
                 }
 
-                FOR_N(k, 0, op_extra->clobber_xmm) {
-                    ins[j++] = intern_regmask(ctx, REG_CLASS_XMM, false, 1u << k);
+                for (uint64_t bits = op_extra->clobber_xmm, k = 0; bits; bits >>= 1, k++) {
+                    if (bits & 1) { ins[j++] = intern_regmask(ctx, REG_CLASS_XMM, false, 1u << k); }
                 }
             }
 
@@ -1573,13 +2042,154 @@ static Val op_at(Ctx* ctx, TB_Node* n) {
     }
 }
 
+// ZERO_EXT from 32bits is lowered into a plain copy since 32bit moves will clear the
+// top half, it's still got to be emitted when the registers match.
+static bool is_zext_copy(TB_Node* n) {
+    TB_DataType src_dt = n->inputs[1]->dt;
+    return n->dt.type == TB_TAG_INT && src_dt.type == TB_TAG_INT && n->dt.data > 32 && src_dt.data <= 32;
+}
+
+// Intel's JCC erratum: a jump (or CALL, RET, macro-fused CMP+Jcc) which crosses or ends
+// on a 32 byte boundary can't be cached in the decoded icache so we NOP pad it onto the
+// next boundary. start is where the branch begins and len is how big it'll be, anything
+// between start and the current position (the CMP of a fused pair, an indirect CALL)
+// gets slid forward so it can't hold label references, a symbol patch is fine.
+static void pad_jcc_erratum(Ctx* restrict ctx, TB_CGEmitter* e, size_t start, size_t len) {
+    if (!ctx->module->layout.avoid_jcc_erratum || (start >> 5) == ((start + len) >> 5)) {
+        return;
+    }
+
+    size_t pad = 32 - (start & 31);
+    size_t moved = e->count - start;
+    tb_cgemit_reserve(e, pad);
+    memmove(&e->data[start + pad], &e->data[start], moved);
+    fill_nops(&e->data[start], pad);
+    tb_cgemit_commit(e, pad);
+
+    // it's a single instruction, so at most one patch.
+    TB_SymbolPatch* p = e->output->last_patch;
+    if (moved > 0 && p != NULL && p->pos >= start) {
+        p->pos += pad;
+    }
+}
+
 static void emit_goto(Ctx* ctx, TB_CGEmitter* e, MachineBB* succ) {
     if (ctx->fallthrough != succ->id) {
+        pad_jcc_erratum(ctx, e, e->count, 5);
         EMIT1(e, 0xE9); EMIT4(e, 0);
         tb_emit_rel32(e, &e->labels[succ->id], GET_CODE_POS(e) - 4);
     }
 }
 
+////////////////////////////////
+// Switch lowering hooks (see switch_lower.h), the key lives in s->key and the
+// temps are R10 & R11 when they're around.
+////////////////////////////////
+static void switch_movimm(TB_CGEmitter* e, GPR dst, uint64_t x) {
+    if (x == (uint32_t) x || (int64_t) x == (int32_t) x) {
+        __(MOV, x == (uint32_t) x ? TB_X86_DWORD : TB_X86_QWORD, Vgpr(dst), Vimm(x));
+    } else {
+        EMIT1(e, rex(true, 0, dst, 0));
+        EMIT1(e, 0xB8 + (dst & 0b111));
+        EMIT8(e, x);
+    }
+}
+
+// cmp r, x and returns where it started (the jcc fuses with it)
+static size_t switch_cmp(TB_CGEmitter* e, SwitchEmit* s, GPR r, uint64_t x) {
+    TB_X86_DataType dt = s->plan.is_64bit ? TB_X86_QWORD : TB_X86_DWORD;
+    if (!s->plan.is_64bit || (int64_t) x == (int32_t) x) {
+        size_t pos = e->count;
+        __(CMP, dt, Vgpr(r), Vimm(x));
+        return pos;
+    } else {
+        switch_movimm(e, s->tmp[0], x);
+        size_t pos = e->count;
+        __(CMP, dt, Vgpr(r), Vgpr(s->tmp[0]));
+        return pos;
+    }
+}
+
+static void switch_jcc(Ctx* restrict ctx, TB_CGEmitter* e, size_t cmp_pos, Cond cc, uint32_t* label) {
+    pad_jcc_erratum(ctx, e, cmp_pos, (e->count - cmp_pos) + 6);
+    EMIT1(e, 0x0F); EMIT1(e, 0x80 + cc); EMIT4(e, 0);
+    tb_emit_rel32(e, label, GET_CODE_POS(e) - 4);
+}
+
+// tmp[1] = key - lo, zero extended to 64bits
+static void switch_index(TB_CGEmitter* e, SwitchEmit* s, uint64_t lo) {
+    GPR dst = s->tmp[1];
+    if (!s->plan.is_64bit) {
+        __(LEA, TB_X86_DWORD, Vgpr(dst), Vbase(s->key, -(int32_t) lo));
+    } else if ((int64_t) -lo == (int32_t) -lo) {
+        __(LEA, TB_X86_QWORD, Vgpr(dst), Vbase(s->key, (int32_t) -lo));
+    } else {
+        switch_movimm(e, dst, -lo);
+        __(ADD, TB_X86_QWORD, Vgpr(dst), Vgpr(s->key));
+    }
+}
+
+static void switch_cmp_branch(Ctx* restrict ctx, TB_CGEmitter* e, SwitchEmit* s, int cc, uint64_t x, uint32_t* label) {
+    static const Cond conds[] = { [SW_EQ] = E, [SW_LE] = BE, [SW_GE] = NB };
+    size_t pos = switch_cmp(e, s, s->key, x);
+    switch_jcc(ctx, e, pos, conds[cc], label);
+}
+
+static void switch_range_branch(Ctx* restrict ctx, TB_CGEmitter* e, SwitchEmit* s, uint64_t lo, uint64_t hi, uint32_t* label) {
+    switch_index(e, s, lo);
+    size_t pos = switch_cmp(e, s, s->tmp[1], hi - lo);
+    switch_jcc(ctx, e, pos, BE, label);
+}
+
+static void switch_bit_test(Ctx* restrict ctx, TB_CGEmitter* e, SwitchEmit* s, SwitchCluster* c, uint32_t* miss) {
+    switch_index(e, s, c->lo);
+    if (miss) {
+        size_t pos = switch_cmp(e, s, s->tmp[1], c->hi - c->lo);
+        switch_jcc(ctx, e, pos, A, miss);
+    }
+
+    FOR_N(i, 0, c->count) {
+        // bt mask, idx
+        switch_movimm(e, s->tmp[0], c->masks[i]);
+        size_t pos = e->count;
+        __(BT, TB_X86_QWORD, Vgpr(s->tmp[0]), Vgpr(s->tmp[1]));
+        switch_jcc(ctx, e, pos, B, switch_target_label(ctx, e, c->targets[i]));
+    }
+}
+
+static void switch_jump_table(Ctx* restrict ctx, TB_CGEmitter* e, SwitchEmit* s, SwitchCluster* c, uint32_t* miss) {
+    GPR base = s->tmp[0], idx = s->tmp[1];
+    switch_index(e, s, c->lo);
+    if (miss) {
+        size_t pos = switch_cmp(e, s, idx, c->count - 1);
+        switch_jcc(ctx, e, pos, A, miss);
+    }
+
+    // lea base, [rip + table]
+    EMIT1(e, rex(true, base, 0, 0));
+    EMIT1(e, 0x8D);
+    EMIT1(e, mod_rx_rm(MOD_INDIRECT, base, RBP));
+    EMIT4(e, 0);
+    switch_add_table(ctx, GET_CODE_POS(e) - 4, c);
+
+    // the entries are relative to the table
+    Val entry = val_base_index_disp(base, idx, SCALE_X4, 0);
+    __(MOVSXD, TB_X86_QWORD, Vgpr(idx), &entry);
+    __(ADD, TB_X86_QWORD, Vgpr(base), Vgpr(idx));
+    pad_jcc_erratum(ctx, e, e->count, 3);
+    __(JMP, TB_X86_QWORD, Vgpr(base));
+}
+
+static void switch_jump(Ctx* restrict ctx, TB_CGEmitter* e, uint32_t* label) {
+    pad_jcc_erratum(ctx, e, e->count, 5);
+    EMIT1(e, 0xE9); EMIT4(e, 0);
+    tb_emit_rel32(e, label, GET_CODE_POS(e) - 4);
+}
+
+static void switch_bind(Ctx* restrict ctx, TB_CGEmitter* e, uint32_t* label) {
+    tb_resolve_rel32(e, label, e->count);
+}
+
 static Val parse_cisc_operand(Ctx* restrict ctx, TB_Node* n, Val* rhs, X86MemOp* op) {
     if (rhs) {
         if ((n->type >= x86_addimm && n->type <= x86_rorimm) || n->type == x86_imulimm || n->type == x86_cmpimmjcc || n->type == x86_testimmjcc) {
@@ -1614,7 +2224,10 @@ static Val parse_cisc_operand(Ctx* restrict ctx, TB_Node* n, Val* rhs, X86MemOp*
     } else {
         VReg* vreg = &ctx->vregs[ctx->vreg_map[n->inputs[2]->gvn]];
         assert(vreg->assigned >= 0);
-        if (vreg->class == REG_CLASS_GPR) {
+        if (vreg->class == REG_CLASS_STK) {
+            // the peepholes might've folded a reload into here
+            return val_stack(stk_offset(ctx, vreg->assigned));
+        } else if (vreg->class == REG_CLASS_GPR) {
             rm.type = VAL_GPR;
         } else if (vreg->class == REG_CLASS_XMM) {
             rm.type = VAL_XMM;
@@ -1624,8 +2237,163 @@ static Val parse_cisc_operand(Ctx* restrict ctx, TB_Node* n, Val* rhs, X86MemOp*
     return rm;
 }
 
-static void node_emit(Ctx* restrict ctx, TB_CGEmitter* e, TB_Node* n, VReg* vreg) {
-    switch (n->type) {
+// tears down the frame, shared by returns & tailcalls
+static void emit_epilogue(Ctx* restrict ctx, TB_CGEmitter* e) {
+    int stack_usage = ctx->stack_usage;
+    if (stack_usage) {
+        // add rsp, N
+        if (stack_usage == (int8_t)stack_usage) {
+            EMIT1(e, rex(true, 0x00, RSP, 0));
+            EMIT1(e, 0x83);
+            EMIT1(e, mod_rx_rm(MOD_DIRECT, 0x00, RSP));
+            EMIT1(e, (int8_t) stack_usage);
+        } else {
+            EMIT1(e, rex(true, 0x00, RSP, 0));
+            EMIT1(e, 0x81);
+            EMIT1(e, mod_rx_rm(MOD_DIRECT, 0x00, RSP));
+            EMIT4(e, stack_usage);
+        }
+    }
+
+    // pop rbp (if we even used the frameptr)
+    if ((ctx->features.gen & TB_FEATURE_FRAME_PTR) && stack_usage > 0) {
+        EMIT1(e, 0x58 + RBP);
+    }
+}
+
+// VEX.256.0F 10/11 /r, vmovups ymm <-> m256
+static void emit_vmovups256(TB_CGEmitter* e, bool store, int ymm, const Val* mem) {
+    emit_vex(e, 1, 0, false, true, ymm, 0, mem, store ? 0x11 : 0x10);
+}
+
+static void emit_bulk_move(TB_CGEmitter* e, bool is_copy, int width, const Val* vec, GPR dst, GPR src, int disp) {
+    Val rcx = val_gpr(RCX);
+    Val d = val_base_disp(dst, disp);
+    Val s = val_base_disp(src, disp);
+    if (width == 32) {
+        if (is_copy) { emit_vmovups256(e, false, vec->reg, &s); }
+        emit_vmovups256(e, true, vec->reg, &d);
+    } else if (width == 16) {
+        if (is_copy) { __(FP_MOV, TB_X86_F32x4, vec, &s); }
+        __(FP_MOV, TB_X86_F32x4, &d, vec);
+    } else {
+        TB_X86_DataType dt = width == 8 ? TB_X86_QWORD : width == 4 ? TB_X86_DWORD : width == 2 ? TB_X86_WORD : TB_X86_BYTE;
+        if (is_copy) { __(MOV, dt, &rcx, &s); }
+        __(MOV, dt, &d, &rcx);
+    }
+}
+
+// unrolled memcpy/memset, odd sizes are handled by letting the last move
+// overlap with the one before it rather than stepping down the widths.
+static void emit_bulk(Ctx* restrict ctx, TB_CGEmitter* e, TB_Node* n) {
+    X86Bulk* op = TB_NODE_GET_EXTRA(n);
+    Tmps* tmps = nl_table_get(&ctx->tmps_map, n);
+    int x = ctx->vregs[tmps->elems[0]].assigned;
+    Val vec = val_xmm(x);
+
+    bool is_copy = n->type == x86_memcpy;
+    int size = op->size;
+    if (size == 0) {
+        return;
+    }
+
+    int width = size >= 32 ? bulk_width(ctx) : 16;
+
+    GPR dst = op_at(ctx, n->inputs[2]).reg;
+    GPR src = is_copy ? op_at(ctx, n->inputs[3]).reg : GPR_NONE;
+
+    if (!is_copy) {
+        // splat the byte across ECX
+        if (n->inputs[3]) {
+            GPR v = op_at(ctx, n->inputs[3]).reg;
+
+            // movzx ecx, v8
+            EMIT1(e, rex(false, RCX, v, 0));
+            EMIT1(e, 0x0F);
+            EMIT1(e, 0xB6);
+            EMIT1(e, mod_rx_rm(MOD_DIRECT, RCX, v));
+            // imul ecx, ecx, 0x01010101
+            EMIT1(e, 0x69);
+            EMIT1(e, mod_rx_rm(MOD_DIRECT, RCX, RCX));
+            EMIT4(e, 0x01010101);
+        } else if (op->fill == 0) {
+            // xor ecx, ecx
+            EMIT1(e, 0x31);
+            EMIT1(e, mod_rx_rm(MOD_DIRECT, RCX, RCX));
+        } else {
+            // mov ecx, imm32
+            EMIT1(e, 0xB8 + RCX);
+            EMIT4(e, op->fill * 0x01010101u);
+        }
+
+        // then across the vector, the 8 byte tails read it back out into RCX
+        if (size >= 8) {
+            // movd xmm, ecx
+            EMIT1(e, 0x66);
+            if (x >= 8) { EMIT1(e, rex(false, x, RCX, 0)); }
+            EMIT1(e, 0x0F);
+            EMIT1(e, 0x6E);
+            EMIT1(e, mod_rx_rm(MOD_DIRECT, x, RCX));
+            // pshufd xmm, xmm, 0
+            EMIT1(e, 0x66);
+            if (x >= 8) { EMIT1(e, rex(false, x, x, 0)); }
+            EMIT1(e, 0x0F);
+            EMIT1(e, 0x70);
+            EMIT1(e, mod_rx_rm(MOD_DIRECT, x, x));
+            EMIT1(e, 0x00);
+
+            if (width == 32) {
+                // vinsertf128 ymm, ymm, xmm, 1
+                emit_vex(e, 3, 1, false, true, x, x, &vec, 0x18);
+                EMIT1(e, 0x01);
+            } else if (size < 16) {
+                // movq rcx, xmm
+                EMIT1(e, 0x66);
+                EMIT1(e, rex(true, x, RCX, 0));
+                EMIT1(e, 0x0F);
+                EMIT1(e, 0x7E);
+                EMIT1(e, mod_rx_rm(MOD_DIRECT, x, RCX));
+            }
+        }
+    }
+
+    if (size >= 16) {
+        for (int i = 0; i < size; i += width) {
+            emit_bulk_move(e, is_copy, width, &vec, dst, src, i + width > size ? size - width : i);
+        }
+    } else if (size > 0) {
+        // two overlapping GPR moves cover anything between the power of two sizes
+        int w = size >= 8 ? 8 : size >= 4 ? 4 : size >= 2 ? 2 : 1;
+        emit_bulk_move(e, is_copy, w, &vec, dst, src, 0);
+        if (size > w) {
+            emit_bulk_move(e, is_copy, w, &vec, dst, src, size - w);
+        }
+    }
+
+    if (width == 32) {
+        // vzeroupper, we don't want the SSE transition penalty in the rest of the code
+        EMIT1(e, 0xC5);
+        EMIT1(e, 0xF8);
+        EMIT1(e, 0x77);
+    }
+}
+
+// [F3] [REX] 0F op /r, lzcnt/tzcnt/popcnt are the F3 forms of bsr/bsf (and
+// nothing for popcnt).
+static void emit_bitcount(TB_CGEmitter* e, bool rep, uint8_t op, bool is_64bit, GPR dst, GPR src) {
+    if (rep) {
+        EMIT1(e, 0xF3);
+    }
+    if (is_64bit || dst >= 8 || src >= 8) {
+        EMIT1(e, rex(is_64bit, dst, src, 0));
+    }
+    EMIT1(e, 0x0F);
+    EMIT1(e, op);
+    EMIT1(e, mod_rx_rm(MOD_DIRECT, dst, src));
+}
+
+static void node_emit(Ctx* restrict ctx, TB_CGEmitter* e, TB_Node* n, VReg* vreg) {
+    switch (n->type) {
         // some ops don't do shit lmao
         case TB_PHI:
         case TB_POISON:
@@ -1647,6 +2415,7 @@ static void node_emit(Ctx* restrict ctx, TB_CGEmitter* e, TB_Node* n, VReg* vreg
             TB_Node* succ_n = cfg_next_bb_after_cproj(proj0);
             int succ = node_to_bb(ctx, succ_n)->id;
             if (ctx->fallthrough != succ) {
+                pad_jcc_erratum(ctx, e, e->count, 5);
                 __(JMP, TB_X86_QWORD, Vlbl(succ));
             }
             break;
@@ -1668,10 +2437,14 @@ static void node_emit(Ctx* restrict ctx, TB_CGEmitter* e, TB_Node* n, VReg* vreg
             GPR dst = op_gpr_at(ctx, n);
             if (x == 0) {
                 __(XOR, TB_X86_DWORD, Vgpr(dst), Vgpr(dst));
-            } else if (hi == 0 || dt == TB_X86_QWORD) {
-                EMIT1(e, rex(dt == TB_X86_QWORD, 0, dst, 0));
+            } else if (hi == 0 || (dt == TB_X86_QWORD && x != (int32_t) x)) {
+                // mov r32, imm32 zero extends so only the big ones need movabs
+                bool is_64bit = hi != 0;
+                if (is_64bit || dst >= 8) {
+                    EMIT1(e, rex(is_64bit, 0, dst, 0));
+                }
                 EMIT1(e, 0xB8 + (dst & 0b111));
-                if (dt != TB_X86_QWORD) {
+                if (!is_64bit) {
                     EMIT4(e, x);
                 } else {
                     EMIT8(e, x);
@@ -1688,14 +2461,22 @@ static void node_emit(Ctx* restrict ctx, TB_CGEmitter* e, TB_Node* n, VReg* vreg
 
             Val dst = op_at(ctx, n);
             Val src = op_at(ctx, n->inputs[1]);
-            if (!is_value_match(&dst, &src)) {
+            if (n->type == TB_MACH_COPY && dst.type == VAL_GPR && src.type == VAL_GPR && is_zext_copy(n)) {
+                // 32bit moves clear the top half so even mov eax, eax does work here
+                COMMENT("%%%u = zext(%%%u)", n->gvn, n->inputs[1]->gvn);
+                __(MOV, TB_X86_DWORD, &dst, &src);
+            } else if (n->type == TB_MACH_COPY && dst.type == VAL_GPR && src.type == VAL_MEM && is_zext_copy(n) && n->inputs[1]->dt.data == 32) {
+                // reloading a spilled 32bit value, only the low half of the slot was stored
+                COMMENT("%%%u = zext(%%%u)", n->gvn, n->inputs[1]->gvn);
+                __(MOV, TB_X86_DWORD, &dst, &src);
+            } else if (!is_value_match(&dst, &src)) {
                 COMMENT("%%%u = copy(%%%u)", n->gvn, n->inputs[1]->gvn);
 
                 if (dst.type == VAL_GPR && src.type == VAL_XMM) {
-                    __(MOV_I2F, dt, &dst, &src);
+                    __(MOV_F2I, dt, &dst, &src);
                 } else if (dst.type == VAL_XMM && src.type == VAL_GPR) {
                     TB_X86_DataType src_dt = legalize(n->inputs[1]->dt);
-                    __(MOV_F2I, src_dt, &dst, &src);
+                    __(MOV_I2F, src_dt, &dst, &src);
                 } else {
                     int op = dt < TB_X86_F32x1 ? MOV : FP_MOV;
                     __(op, dt, &dst, &src);
@@ -1714,33 +2495,32 @@ static void node_emit(Ctx* restrict ctx, TB_CGEmitter* e, TB_Node* n, VReg* vreg
         // epilogue
         case TB_RETURN: {
             size_t pos = e->count;
-            TB_FunctionPrototype* proto = ctx->f->prototype;
-
-            int stack_usage = ctx->stack_usage;
-            if (stack_usage) {
-                // add rsp, N
-                if (stack_usage == (int8_t)stack_usage) {
-                    EMIT1(e, rex(true, 0x00, RSP, 0));
-                    EMIT1(e, 0x83);
-                    EMIT1(e, mod_rx_rm(MOD_DIRECT, 0x00, RSP));
-                    EMIT1(e, (int8_t) stack_usage);
-                } else {
-                    EMIT1(e, rex(true, 0x00, RSP, 0));
-                    EMIT1(e, 0x81);
-                    EMIT1(e, mod_rx_rm(MOD_DIRECT, 0x00, RSP));
-                    EMIT4(e, stack_usage);
-                }
-            }
-
-            // pop rbp (if we even used the frameptr)
-            if ((ctx->features.gen & TB_FEATURE_FRAME_PTR) && stack_usage > 0) {
-                EMIT1(e, 0x58 + RBP);
-            }
+            emit_epilogue(ctx, e);
+            pad_jcc_erratum(ctx, e, e->count, 1);
             EMIT1(e, 0xC3);
             ctx->epilogue_length = e->count - pos;
             break;
         }
 
+        case TB_TAILCALL: {
+            emit_epilogue(ctx, e);
+            if (n->inputs[2]->type == TB_MACH_SYMBOL) {
+                TB_Symbol* sym = TB_NODE_GET_EXTRA_T(n->inputs[2], TB_NodeMachSymbol)->sym;
+
+                // JMP rel32
+                EMIT1(e, 0xE9);
+                EMIT4(e, 0);
+                tb_emit_symbol_patch(e->output, sym, e->count - 4);
+                pad_jcc_erratum(ctx, e, e->count - 5, 5);
+            } else {
+                size_t pos = e->count;
+                Val target = op_at(ctx, n->inputs[2]);
+                __(JMP, TB_X86_QWORD, &target);
+                pad_jcc_erratum(ctx, e, pos, e->count - pos);
+            }
+            break;
+        }
+
         case x86_vzero: {
             Val dst = op_at(ctx, n);
             __(FP_XOR, TB_X86_F32x4, &dst, &dst); // xorps
@@ -1826,9 +2606,11 @@ static void node_emit(Ctx* restrict ctx, TB_CGEmitter* e, TB_Node* n, VReg* vreg
             // F3 REX.W 0F 2C /r      CVTTSS2SI xmm1, r/m64
             // F2 0F 2C /r            CVTTSD2SI xmm1, r/m32
             // F2 REX.W 0F 2C /r      CVTTSD2SI xmm1, r/m64
+            bool is_64bit = n->dt.data > 32;
+
             Val dst = op_at(ctx, n);
             Val lhs = op_at(ctx, n->inputs[1]);
-            __(FP_CVTT, dt, &dst, &lhs);
+            __(is_64bit ? FP_CVTT64 : FP_CVTT, dt, &dst, &lhs);
 
             // TODO(NeGate): that conversion into a 64bit unsigned number requires fixups we
             // don't do quite yet, go fiddle with godbolt later.
@@ -1855,6 +2637,12 @@ static void node_emit(Ctx* restrict ctx, TB_CGEmitter* e, TB_Node* n, VReg* vreg
             int op_type = ops[n->type - x86_vmov];
             if (op->mode == MODE_ST) {
                 __(op_type, dt, &rm, &rx);
+            } else if (op->vex) {
+                // VEX.LIG.{NP,66,F3,F2}.0F.W{0,1} op /r, dst = lhs op rm (W only matters to EVEX)
+                static const uint8_t pps[] = { 2, 3, 0, 1 };
+                Val dst = op_at(ctx, n);
+                bool is_double = dt == TB_X86_F64x1 || dt == TB_X86_F64x2;
+                emit_vex(e, 1, pps[dt - TB_X86_F32x1], is_double, false, dst.reg, rx.reg, &rm, inst_table[op_type].op);
             } else {
                 Val dst = op_at(ctx, n);
                 if (rx.type != VAL_NONE && !is_value_match(&dst, &rx)) {
@@ -1903,7 +2691,7 @@ static void node_emit(Ctx* restrict ctx, TB_CGEmitter* e, TB_Node* n, VReg* vreg
                 if (!is_value_match(&dst, &rm)) {
                     __(MOV, dt, &dst, &rm);
                 }
-                __(op_type, dt, &rm, &rx);
+                __(op_type, dt, &dst, &rx);
             } else {
                 Val dst = op_at(ctx, n);
                 if (rx.type != VAL_NONE) {
@@ -1947,34 +2735,21 @@ static void node_emit(Ctx* restrict ctx, TB_CGEmitter* e, TB_Node* n, VReg* vreg
         }
 
         case x86_AAAAAHHHH: {
-            TB_NodeBranch* br = TB_NODE_GET_EXTRA(n);
-
-            // the arena on the function should also be available at this time, we're
-            // in the TB_Passes
+            // the plan was made back when the RA asked about temps, it stays
+            // outside of the scratch we use for the labels.
+            SwitchPlan* plan = switch_get_plan(ctx, n);
             TB_Arena* arena = ctx->f->arena;
             TB_ArenaSavepoint sp = tb_arena_save(arena);
-            TB_Node** succ = tb_arena_alloc(arena, br->succ_count * sizeof(TB_Node*));
-
-            // fill successors
-            bool has_default = false;
-            FOR_USERS(u, n) {
-                if (USERN(u)->type == TB_BRANCH_PROJ) {
-                    int index = TB_NODE_GET_EXTRA_T(USERN(u), TB_NodeProj)->index;
-                    succ[index] = USERN(u);
-                }
-            }
 
-            Val key = op_at(ctx, n->inputs[1]);
-            FOR_N(i, 1, br->succ_count) {
-                uint64_t imm = TB_NODE_GET_EXTRA_T(succ[i], TB_NodeBranchProj)->key;
-                MachineBB* succ_bb = node_to_bb(ctx, cfg_next_bb_after_cproj(succ[i]));
-
-                __(CMP, TB_X86_QWORD, &key, Vimm(imm));
-                __(JE, TB_X86_QWORD, Vlbl(succ_bb->id));
+            SwitchEmit s = { *plan, arena, op_gpr_at(ctx, n->inputs[1]), { GPR_NONE, GPR_NONE } };
+            Tmps* tmps = nl_table_get(&ctx->tmps_map, n);
+            if (tmps) {
+                s.tmp[0] = ctx->vregs[tmps->elems[0]].assigned;
+                s.tmp[1] = ctx->vregs[tmps->elems[1]].assigned;
             }
 
-            MachineBB* succ_bb = node_to_bb(ctx, cfg_next_bb_after_cproj(succ[0]));
-            __(JMP, TB_X86_QWORD, Vlbl(succ_bb->id));
+            switch_emit(ctx, e, &s);
+            tb_arena_restore(arena, sp);
             break;
         }
 
@@ -2006,8 +2781,11 @@ static void node_emit(Ctx* restrict ctx, TB_CGEmitter* e, TB_Node* n, VReg* vreg
                 case x86_ucomijcc:   op_type = FP_UCOMI; break;
             }
 
+            size_t pos = e->count;
             Val rx, rm = parse_cisc_operand(ctx, n, &rx, op);
-            __(op_type, dt, &rm, &rx);
+            if (!op->reuse_flags) {
+                __(op_type, dt, &rm, &rx);
+            }
             if (n->type >= x86_cmpjcc && n->type <= x86_testimmjcc) {
                 int succ_count = 0;
                 FOR_USERS(u, n) {
@@ -2045,8 +2823,11 @@ static void node_emit(Ctx* restrict ctx, TB_CGEmitter* e, TB_Node* n, VReg* vreg
                         SWAP(int, succ[0], succ[1]);
                     }
 
+                    // the CMP+Jcc pair is macro-fused so it's treated as one branch
+                    pad_jcc_erratum(ctx, e, pos, (e->count - pos) + 6);
                     __(JO+cc, TB_X86_QWORD, Vlbl(succ[0]));
                     if (ctx->fallthrough != succ[1]) {
+                        pad_jcc_erratum(ctx, e, e->count, 5);
                         __(JMP, TB_X86_QWORD, Vlbl(succ[1]));
                     }
                 } else {
@@ -2069,12 +2850,14 @@ static void node_emit(Ctx* restrict ctx, TB_CGEmitter* e, TB_Node* n, VReg* vreg
                 __(MOV, dt, &dst, &lhs);
             }
 
+            // compared at the condition's width, a bool from a setcc only has the low byte
+            TB_X86_DataType cmp_dt = legalize_int2(n->inputs[1]->dt);
             Val cmp1 = op_at(ctx, n->inputs[1]);
             if (n->inputs[2]) {
                 Val cmp2 = op_at(ctx, n->inputs[2]);
-                __(CMP, dt, &cmp1, &cmp2);
-            } else {
-                __(CMP, dt, &cmp1, Vimm(0));
+                __(CMP, cmp_dt, &cmp1, &cmp2);
+            } else if (!TB_NODE_GET_EXTRA_T(n, X86Cmov)->reuse_flags) {
+                __(CMP, cmp_dt, &cmp1, Vimm(0));
             }
 
             Val rhs = op_at(ctx, n->inputs[4]);
@@ -2109,6 +2892,65 @@ static void node_emit(Ctx* restrict ctx, TB_CGEmitter* e, TB_Node* n, VReg* vreg
             break;
         }
 
+        case TB_CLZ: case TB_CTZ: case TB_POPCNT: {
+            static const uint8_t ops[] = { 0xBD, 0xBC, 0xB8 };
+            static const uint32_t features[] = { TB_FEATURE_X64_LZCNT, TB_FEATURE_X64_BMI1, TB_FEATURE_X64_POPCNT };
+
+            TB_Node* src = n->inputs[1];
+            bool is_64bit = src->dt.type == TB_TAG_PTR || src->dt.data > 32;
+            GPR dst = op_gpr_at(ctx, n);
+            GPR x = op_gpr_at(ctx, src);
+
+            int i = n->type - TB_CLZ;
+            if (has_feature(ctx, features[i])) {
+                // these have a false dependency on the dst on a bunch of Intel cores
+                if (dst != x) {
+                    __(XOR, TB_X86_DWORD, Vgpr(dst), Vgpr(dst));
+                }
+                emit_bitcount(e, true, ops[i], is_64bit, dst, x);
+            } else {
+                // no popcnt got lowered during isel, bsr & bsf leave the dst
+                // undefined on zero (same as __builtin_clz/ctz).
+                assert(n->type != TB_POPCNT);
+                emit_bitcount(e, false, ops[i], is_64bit, dst, x);
+                if (n->type == TB_CLZ) {
+                    // bsr gives the index of the top bit, clz = (bits-1) - idx
+                    __(XOR, TB_X86_DWORD, Vgpr(dst), Vimm(is_64bit ? 63 : 31));
+                }
+            }
+            break;
+        }
+
+        case x86_shlx: case x86_shrx: case x86_sarx: {
+            // VEX.LZ.{66,F3,F2}.0F38.W F7 /r, the count goes in vvvv
+            static const uint8_t pps[] = { 1, 3, 2 };
+            bool is_64bit = n->dt.data == 64;
+            Val src = op_at(ctx, n->inputs[1]);
+            GPR dst = op_gpr_at(ctx, n);
+            GPR count = op_gpr_at(ctx, n->inputs[2]);
+            emit_vex(e, 2, pps[n->type - x86_shlx], is_64bit, false, dst, count, &src, 0xF7);
+            break;
+        }
+
+        case x86_andn: {
+            // VEX.LZ.0F38.W F2 /r, dst = ~vvvv & rm
+            bool is_64bit = n->dt.data == 64;
+            Val rhs = op_at(ctx, n->inputs[2]);
+            GPR dst = op_gpr_at(ctx, n);
+            GPR lhs = op_gpr_at(ctx, n->inputs[1]);
+            emit_vex(e, 2, 0, is_64bit, false, dst, lhs, &rhs, 0xF2);
+            break;
+        }
+
+        case x86_blsr: {
+            // VEX.LZ.0F38.W F3 /1, the dst goes in vvvv
+            bool is_64bit = n->dt.data == 64;
+            Val src = op_at(ctx, n->inputs[1]);
+            GPR dst = op_gpr_at(ctx, n);
+            emit_vex(e, 2, 0, is_64bit, false, 1, dst, &src, 0xF3);
+            break;
+        }
+
         case x86_movsx8:
         case x86_movzx8:
         case x86_movsx16:
@@ -2145,7 +2987,15 @@ static void node_emit(Ctx* restrict ctx, TB_CGEmitter* e, TB_Node* n, VReg* vreg
             break;
         }
 
-        case TB_TRAP: {
+        case x86_memcpy: case x86_memset: {
+            emit_bulk(ctx, e, n);
+            break;
+        }
+
+        // the unreachable blocks (like a switch's default when it can't happen) get
+        // a trap rather than running off into whatever comes next.
+        case TB_TRAP:
+        case TB_UNREACHABLE: {
             EMIT1(e, 0x0F);
             EMIT1(e, 0x0B);
             break;
@@ -2156,6 +3006,14 @@ static void node_emit(Ctx* restrict ctx, TB_CGEmitter* e, TB_Node* n, VReg* vreg
             break;
         }
 
+        // reads the poll page, when someone wants this thread to stop they protect
+        // the page and it'll fault here.
+        case TB_SAFEPOINT_POLL: {
+            GPR src = op_gpr_at(ctx, n->inputs[2]);
+            __(TEST, TB_X86_DWORD, Vbase(src, 0), Vgpr(RAX));
+            break;
+        }
+
         case TB_ATOMIC_LOAD:
         case TB_ATOMIC_XCHG:
         case TB_ATOMIC_ADD:
@@ -2202,8 +3060,10 @@ static void node_emit(Ctx* restrict ctx, TB_CGEmitter* e, TB_Node* n, VReg* vreg
 
         case x86_call: {
             X86Call* op_extra = TB_NODE_GET_EXTRA(n);
+            size_t pos = e->count;
             Val target = op_at(ctx, n->inputs[2]);
             __(CALL, TB_X86_QWORD, &target);
+            pad_jcc_erratum(ctx, e, pos, e->count - pos);
             break;
         }
 
@@ -2214,6 +3074,7 @@ static void node_emit(Ctx* restrict ctx, TB_CGEmitter* e, TB_Node* n, VReg* vreg
             EMIT1(e, 0xE8);
             EMIT4(e, 0);
             tb_emit_symbol_patch(e->output, op_extra->sym, e->count - 4);
+            pad_jcc_erratum(ctx, e, e->count - 5, 5);
             break;
         }
 
@@ -2235,50 +3096,79 @@ static void node_emit(Ctx* restrict ctx, TB_CGEmitter* e, TB_Node* n, VReg* vreg
     }
 }
 
-// don't care about functional units on x86
-static uint64_t node_unit_mask(TB_Function* f, TB_Node* n) { return 1; }
-static int node_latency(TB_Function* f, TB_Node* n, TB_Node* end) {
-    switch (n->type) {
-        case x86_movsx8: case x86_movsx16: case x86_movsx32:
-        case x86_movzx8: case x86_movzx16: {
-            X86MemOp* op = TB_NODE_GET_EXTRA(n);
-            return 2 + (op->mode == MODE_LD ? 3 : 0);
-        }
-
-        // doesn't atually load shit so it's cheaper than the other similar ops
-        case x86_lea:
-        return 2;
+static X86SchedInfo node_sched_info(TB_Node* n, TB_Node* end) {
+    const X86Model* m = x86_model;
+    bool has_mem = true;
 
-        // load/store ops should count as a bit slower
+    X86SchedClass c;
+    switch (n->type) {
         case x86_add: case x86_or:  case x86_and: case x86_sub:
         case x86_xor: case x86_cmp: case x86_mov: case x86_test:
-        case x86_vmov: case x86_vadd: case x86_vmul: case x86_vsub:
-        case x86_vmin: case x86_vmax: case x86_vdiv: case x86_vxor:
         case x86_addimm: case x86_orimm:  case x86_andimm: case x86_subimm:
-        case x86_xorimm: case x86_cmpimm: case x86_movimm: case x86_testimm: case x86_imulimm:
+        case x86_xorimm: case x86_cmpimm: case x86_movimm: case x86_testimm:
+        c = X86_SCHED_ALU;
+        break;
+
         case x86_shlimm: case x86_shrimm: case x86_sarimm: case x86_rolimm: case x86_rorimm:
-        {
-            X86MemOp* op = TB_NODE_GET_EXTRA(n);
-            if (end && end->type >= x86_cmpjcc && end->type <= x86_testimmjcc && end->inputs[2] == n) {
-                return 0;
-            }
+        c = X86_SCHED_SHIFT;
+        break;
 
-            int clk;
-            switch (n->type) {
-                case x86_vdiv:    clk = 11; break;
-                case x86_imulimm: clk = 3;  break;
-                default:          clk = 1;  break;
-            }
+        case x86_shlx: case x86_shrx: case x86_sarx:
+        c = X86_SCHED_SHIFT;
+        has_mem = false;
+        break;
+
+        case TB_CLZ: case TB_CTZ: case TB_POPCNT:
+        c = X86_SCHED_BITCNT;
+        has_mem = false;
+        break;
+
+        case x86_movsx8: case x86_movsx16: case x86_movsx32:
+        case x86_movzx8: case x86_movzx16:
+        c = X86_SCHED_MOVX;
+        break;
+
+        case x86_imulimm: c = X86_SCHED_IMUL; break;
+        case x86_vmov:    c = X86_SCHED_VMOV; break;
+        case x86_vmul:    c = X86_SCHED_VMUL; break;
+        case x86_vdiv:    c = X86_SCHED_VDIV; break;
+        case x86_vxor:    c = X86_SCHED_VLOGIC; break;
+        case x86_ucomi:   c = X86_SCHED_UCOMI; break;
+
+        case x86_vadd: case x86_vsub:
+        c = X86_SCHED_VADD;
+        break;
 
-            if (op->mode == MODE_LD) clk += 3;
-            // every store op except for x86_mov will do both a ld(3 clks) + st(4 clks)
-            if (op->mode == MODE_ST) clk += (n->type != x86_mov ? 7 : 4);
-            return clk;
+        case x86_vmin: case x86_vmax:
+        c = X86_SCHED_VMINMAX;
+        break;
+
+        case x86_div: case x86_idiv: {
+            X86MemOp* op = TB_NODE_GET_EXTRA(n);
+            bool is_64bit = op->dt.type == TB_TAG_PTR || (op->dt.type == TB_TAG_INT && op->dt.data > 32);
+            c = is_64bit ? X86_SCHED_DIV64 : X86_SCHED_DIV32;
+            break;
         }
 
-        case TB_MEMSET: case TB_MEMCPY:
-        return 20;
+        case x86_cmpjcc: case x86_cmpimmjcc:
+        case x86_testjcc: case x86_testimmjcc:
+        case x86_ucomijcc:
+        c = X86_SCHED_BRANCH;
+        break;
+
+        // doesn't atually load shit so it's cheaper than the other similar ops
+        case x86_lea:       c = X86_SCHED_LEA;    has_mem = false; break;
+        case x86_vzero:     c = X86_SCHED_VLOGIC; has_mem = false; break;
+        case x86_cmovcc:    c = X86_SCHED_CMOV;   has_mem = false; break;
+        case x86_AAAAAHHHH: c = X86_SCHED_BRANCH; has_mem = false; break;
+
+        case x86_call: case x86_static_call:
+        c = X86_SCHED_CALL;
+        has_mem = false;
+        break;
 
+        case TB_MEMSET: case TB_MEMCPY:
+        case x86_memset: case x86_memcpy:
         case TB_ATOMIC_LOAD:
         case TB_ATOMIC_XCHG:
         case TB_ATOMIC_ADD:
@@ -2286,13 +3176,526 @@ static int node_latency(TB_Function* f, TB_Node* n, TB_Node* end) {
         case TB_ATOMIC_XOR:
         case TB_ATOMIC_OR:
         case TB_ATOMIC_PTROFF:
-        return 20;
+        c = X86_SCHED_BULK;
+        has_mem = false;
+        break;
 
+        // cheapest op so that it tries to schedule it later
         case TB_MACH_MOVE:
-        return 0; // cheapest op so that it tries to schedule it later
+        return (X86SchedInfo){ m->info[X86_SCHED_ALU].ports, 0, 0 };
+
+        default:
+        c = X86_SCHED_ALU;
+        has_mem = false;
+        break;
+    }
 
-        default: return 1;
+    X86SchedInfo info = m->info[c];
+    if (has_mem) {
+        X86MemOp* op = TB_NODE_GET_EXTRA(n);
+        bool is_move = n->type == x86_mov || n->type == x86_vmov;
+        if (op->mode == MODE_LD) {
+            // plain loads go down the load ports, everything else is micro-fused
+            // so we just wait on the load.
+            info.lat += m->info[X86_SCHED_LOAD].lat;
+            if (is_move) {
+                info.ports = m->info[X86_SCHED_LOAD].ports;
+                info.tput  = m->info[X86_SCHED_LOAD].tput;
+            }
+        } else if (op->mode == MODE_ST) {
+            // every store op except for the moves will do both a load + store
+            if (!is_move) {
+                info.lat += m->info[X86_SCHED_LOAD].lat;
+            }
+            info.lat  += m->info[X86_SCHED_STORE].lat;
+            info.ports = m->info[X86_SCHED_STORE].ports;
+            info.tput  = m->info[X86_SCHED_STORE].tput;
+        }
+    }
+
+    // compares are macro-fused with the branch so they're free
+    if (end && end->type >= x86_cmpjcc && end->type <= x86_testimmjcc && end->inputs[2] == n) {
+        info.lat = 0;
     }
+
+    return info;
+}
+
+static uint64_t node_unit_mask(TB_Function* f, TB_Node* n) {
+    return node_sched_info(n, NULL).ports;
+}
+
+static int node_latency(TB_Function* f, TB_Node* n, TB_Node* end) {
+    return node_sched_info(n, end).lat;
+}
+
+static int node_throughput(TB_Function* f, TB_Node* n) {
+    return node_sched_info(n, NULL).tput;
+}
+
+////////////////////////////////
+// Post-RA peepholes
+////////////////////////////////
+// runs over the allocated machine nodes in their final order, a rule can either
+// rewrite the node in place or NULL it out of the block (the items get compacted
+// after). Within a block we track which value each location (register or stack
+// slot) holds so we can tell when a move doesn't actually do anything.
+typedef struct {
+    int loc;
+    TB_Node* val;
+} X86LocVal;
+
+typedef struct {
+    TB_Node** items;
+    size_t count;
+    ArenaArray(X86LocVal) locs;
+} X86Peephole;
+
+typedef bool (*X86PeepFn)(Ctx* restrict ctx, X86Peephole* p, size_t i);
+
+// packs (class, reg) into a single int, -1 means the node doesn't have a location
+static int peep_loc(Ctx* restrict ctx, TB_Node* n) {
+    if (n->gvn >= aarray_length(ctx->vreg_map)) { return -1; }
+    int id = ctx->vreg_map[n->gvn];
+    if (id <= 0 || ctx->vregs[id].assigned < 0) { return -1; }
+    return (ctx->vregs[id].class << 16) | ctx->vregs[id].assigned;
+}
+
+static int peep_loc_class(int loc) { return loc < 0 ? -1 : loc >> 16; }
+
+static bool is_peep_copy(TB_Node* n) {
+    return n->type == TB_MACH_COPY || n->type == TB_MACH_MOVE;
+}
+
+// copies which don't change the type are still the same value
+static TB_Node* peep_value(TB_Node* n) {
+    while (is_peep_copy(n) && n->dt.raw == n->inputs[1]->dt.raw) {
+        n = n->inputs[1];
+    }
+    return n;
+}
+
+static TB_Node* peep_loc_get(X86Peephole* p, int loc) {
+    aarray_for(i, p->locs) {
+        if (p->locs[i].loc == loc) { return p->locs[i].val; }
+    }
+    return NULL;
+}
+
+static void peep_loc_set(X86Peephole* p, int loc, TB_Node* val) {
+    if (loc < 0) { return; }
+    aarray_for(i, p->locs) {
+        if (p->locs[i].loc == loc) {
+            p->locs[i].val = val;
+            return;
+        }
+    }
+    aarray_push(p->locs, (X86LocVal){ loc, val });
+}
+
+// nodes which write nothing but their own location, anything else (calls, div,
+// memcpy...) forgets what we know about the block so far.
+static bool peep_is_simple(Ctx* restrict ctx, TB_Node* n) {
+    if (nl_table_get(&ctx->tmps_map, n) != NULL) {
+        return false;
+    }
+
+    switch (n->type) {
+        case TB_PHI: case TB_PROJ: case TB_MACH_PROJ:
+        case TB_MACH_COPY: case TB_MACH_MOVE:
+        case TB_ICONST: case TB_SYMBOL: case TB_POISON:
+        case x86_add: case x86_or: case x86_and: case x86_sub:
+        case x86_xor: case x86_cmp: case x86_mov: case x86_test:
+        case x86_lea: case x86_cmovcc: case x86_imulimm:
+        case x86_cmpimm: case x86_testimm: case x86_movimm:
+        case x86_movsx8: case x86_movzx8: case x86_movsx16:
+        case x86_movzx16: case x86_movsx32:
+        case x86_vmov: case x86_vadd: case x86_vmul: case x86_vsub:
+        case x86_vdiv: case x86_vmin: case x86_vmax: case x86_vxor:
+        case x86_vzero: case x86_ucomi:
+        case x86_addimm: case x86_orimm:  case x86_andimm: case x86_subimm:
+        case x86_xorimm: case x86_shlimm: case x86_shrimm: case x86_sarimm:
+        case x86_rolimm: case x86_rorimm:
+        return true;
+
+        default:
+        return false;
+    }
+}
+
+// true if every bit at & above `bits` is zero in the register n was put in (the
+// instruction which wrote it cleared the top).
+static bool peep_zero_above(Ctx* restrict ctx, TB_Node* n, int bits, int depth) {
+    if (depth > 8) {
+        return false;
+    }
+
+    switch (n->type) {
+        case TB_MACH_COPY:
+        case TB_MACH_MOVE: {
+            TB_Node* src = n->inputs[1];
+            int dst_loc = peep_loc(ctx, n);
+            int src_loc = peep_loc(ctx, src);
+            if (peep_loc_class(dst_loc) != REG_CLASS_GPR || n->dt.type != TB_TAG_INT || src->dt.type != TB_TAG_INT) {
+                return false;
+            }
+
+            if (n->type == TB_MACH_COPY && is_zext_copy(n) && peep_loc_class(src_loc) == REG_CLASS_GPR) {
+                return bits >= 32 || peep_zero_above(ctx, src, bits, depth + 1);
+            } else if (dst_loc == src_loc) {
+                // nothing was emitted, it's whatever was there before
+                return peep_zero_above(ctx, src, bits, depth + 1);
+            }
+
+            TB_X86_DataType dt = legalize_int2(n->dt);
+            if (dt == TB_X86_DWORD) {
+                return bits >= 32 || peep_zero_above(ctx, src, bits, depth + 1);
+            } else if (dt == TB_X86_QWORD && peep_loc_class(src_loc) == REG_CLASS_GPR) {
+                return peep_zero_above(ctx, src, bits, depth + 1);
+            }
+            return false;
+        }
+
+        case TB_ICONST: {
+            // emitted as xor r32 or mov r32 when the top half is zero
+            uint64_t x = TB_NODE_GET_EXTRA_T(n, TB_NodeInt)->value;
+            return (x >> bits) == 0;
+        }
+
+        case x86_movzx8:  return bits >= 8;
+        case x86_movzx16: return bits >= 16;
+
+        case x86_add: case x86_or:  case x86_and: case x86_sub:
+        case x86_xor: case x86_mov: case x86_imulimm:
+        case x86_addimm: case x86_orimm:  case x86_andimm: case x86_subimm:
+        case x86_xorimm: case x86_movimm: case x86_shlimm: case x86_shrimm:
+        case x86_sarimm: case x86_rolimm: case x86_rorimm: {
+            X86MemOp* op = TB_NODE_GET_EXTRA(n);
+            if (op->mode == MODE_ST || n->dt.type != TB_TAG_INT) {
+                return false;
+            }
+
+            TB_X86_DataType dt = legalize_int2(n->dt);
+            if (n->type == x86_andimm && dt >= TB_X86_DWORD && op->imm >= 0 && bits < 32 && (op->imm >> bits) == 0) {
+                return true;
+            }
+            return bits >= 32 && dt == TB_X86_DWORD;
+        }
+
+        // the counts are at most 64 no matter how wide the op was
+        case TB_CLZ: case TB_CTZ: case TB_POPCNT:
+        return bits >= 7;
+
+        case x86_shlx: case x86_shrx: case x86_sarx:
+        case x86_andn: case x86_blsr:
+        return bits >= 32 && n->dt.data == 32;
+
+        default:
+        return false;
+    }
+}
+
+// mov eax, eax after a 32bit op already cleared the top half
+static bool peep_zext(Ctx* restrict ctx, X86Peephole* p, size_t i) {
+    TB_Node* n = p->items[i];
+    if (n->type != TB_MACH_COPY || !is_zext_copy(n)) {
+        return false;
+    }
+
+    int loc = peep_loc(ctx, n);
+    if (peep_loc_class(loc) != REG_CLASS_GPR || loc != peep_loc(ctx, n->inputs[1])) {
+        return false;
+    }
+
+    if (!peep_zero_above(ctx, n->inputs[1], 32, 0)) {
+        return false;
+    }
+
+    peep_loc_set(p, loc, n);
+    p->items[i] = NULL;
+    return true;
+}
+
+// movzx eax, al when the top of eax is already clear
+static bool peep_movzx(Ctx* restrict ctx, X86Peephole* p, size_t i) {
+    TB_Node* n = p->items[i];
+    if (n->type != x86_movzx8 && n->type != x86_movzx16) {
+        return false;
+    }
+
+    X86MemOp* op = TB_NODE_GET_EXTRA(n);
+    int loc = peep_loc(ctx, n);
+    if (op->mode != MODE_REG || peep_loc_class(loc) != REG_CLASS_GPR || loc != peep_loc(ctx, n->inputs[2])) {
+        return false;
+    }
+
+    if (!peep_zero_above(ctx, n->inputs[2], n->type == x86_movzx8 ? 8 : 16, 0)) {
+        return false;
+    }
+
+    peep_loc_set(p, loc, n);
+    p->items[i] = NULL;
+    return true;
+}
+
+// move into a location which already holds the value, this is mostly a reload right
+// after the spill or copies which the coalescing couldn't get rid of.
+static bool peep_copy(Ctx* restrict ctx, X86Peephole* p, size_t i) {
+    TB_Node* n = p->items[i];
+    if (!is_peep_copy(n) || n->dt.raw != n->inputs[1]->dt.raw) {
+        return false;
+    }
+
+    // same location copies don't emit anything anyways
+    int loc = peep_loc(ctx, n);
+    if (loc < 0 || loc == peep_loc(ctx, n->inputs[1])) {
+        return false;
+    }
+
+    if (peep_loc_get(p, loc) != peep_value(n)) {
+        return false;
+    }
+
+    p->items[i] = NULL;
+    return true;
+}
+
+// reload with a single use which can take a memory operand:
+//   mov rcx, [rsp + 8]
+//   add rax, rcx
+// becomes
+//   add rax, [rsp + 8]
+static bool peep_fold(Ctx* restrict ctx, X86Peephole* p, size_t i) {
+    TB_Node* n = p->items[i];
+    if (n->type != TB_MACH_COPY || n->user_count != 1 || n->dt.type != TB_TAG_INT || n->dt.raw != n->inputs[1]->dt.raw) {
+        return false;
+    }
+
+    int dst_loc = peep_loc(ctx, n);
+    int src_loc = peep_loc(ctx, n->inputs[1]);
+    if (peep_loc_class(dst_loc) != REG_CLASS_GPR || peep_loc_class(src_loc) != REG_CLASS_STK) {
+        return false;
+    }
+
+    // the use has to be later in this block with nothing writing the slot in between
+    TB_Node* use = USERN(n->users);
+    size_t j = i + 1;
+    for (; j < p->count; j++) {
+        TB_Node* m = p->items[j];
+        if (m == use) { break; }
+        if (m && peep_loc(ctx, m) == src_loc) { return false; }
+    }
+
+    if (j == p->count) {
+        return false;
+    }
+
+    TB_X86_DataType dt;
+    switch (use->type) {
+        case x86_add: case x86_or: case x86_and: case x86_sub: case x86_xor:
+        dt = legalize_int2(use->dt);
+        break;
+
+        case x86_cmp: case x86_test: case x86_cmpimm: case x86_testimm:
+        case x86_cmpjcc: case x86_testjcc: case x86_cmpimmjcc: case x86_testimmjcc:
+        dt = legalize(((X86MemOp*) TB_NODE_GET_EXTRA(use))->dt);
+        break;
+
+        default:
+        return false;
+    }
+
+    X86MemOp* op = TB_NODE_GET_EXTRA(use);
+    if (op->mode != MODE_REG || use->inputs[2] != n || dt != legalize_int2(n->dt)) {
+        return false;
+    }
+
+    // x86 can't have both operands in memory
+    TB_Node* rhs = use->input_count > 4 ? use->inputs[4] : NULL;
+    if (rhs && (rhs == n || peep_loc_class(peep_loc(ctx, rhs)) != REG_CLASS_GPR)) {
+        return false;
+    }
+
+    set_input(ctx->f, use, n->inputs[1], 2);
+    p->items[i] = NULL;
+    return true;
+}
+
+// doesn't emit anything which writes to the flags
+static bool peep_keeps_flags(TB_Node* n) {
+    switch (n->type) {
+        case TB_PHI: case TB_PROJ: case TB_MACH_PROJ:
+        case TB_MACH_COPY: case TB_MACH_MOVE:
+        case TB_SYMBOL: case x86_lea: case x86_mov: case x86_movimm:
+        case x86_shlx: case x86_shrx: case x86_sarx:
+        case x86_movsx8: case x86_movzx8: case x86_movsx16:
+        case x86_movzx16: case x86_movsx32:
+        return true;
+
+        // zero is emitted as a xor
+        case TB_ICONST:
+        return TB_NODE_GET_EXTRA_T(n, TB_NodeInt)->value != 0;
+
+        default:
+        return false;
+    }
+}
+
+// test/cmp against zero right after an op which already set ZF & SF based on
+// the same result:
+//   and eax, ecx
+//   test eax, eax
+//   je ...
+static bool peep_flags(Ctx* restrict ctx, X86Peephole* p, size_t i) {
+    TB_Node* n = p->items[i];
+
+    // which value is compared against zero, at what width and which condition
+    // reads it (-1 if we can't tell, setcc's result might also feed a cmov)
+    TB_Node* x;
+    TB_X86_DataType dt;
+    int cc = -1;
+    bool* reuse_flags;
+    if (n->type == x86_cmovcc) {
+        // cmov does its own cmp against zero
+        X86Cmov* cmov = TB_NODE_GET_EXTRA(n);
+        if (n->inputs[2] != NULL || cmov->reuse_flags) {
+            return false;
+        }
+
+        x  = n->inputs[1];
+        dt = legalize_int2(x->dt);
+        cc = cmov->cc;
+        reuse_flags = &cmov->reuse_flags;
+    } else if (n->type == x86_test || n->type == x86_testjcc || n->type == x86_cmpimm || n->type == x86_cmpimmjcc) {
+        X86MemOp* op = TB_NODE_GET_EXTRA(n);
+        if (op->mode != MODE_REG || op->reuse_flags) {
+            return false;
+        }
+
+        if (n->type == x86_test || n->type == x86_testjcc) {
+            if (n->inputs[2] != n->inputs[4]) { return false; }
+        } else if (op->imm != 0) {
+            return false;
+        }
+
+        if (n->type == x86_testjcc || n->type == x86_cmpimmjcc) {
+            TB_NodeBranchProj* if_br = cfg_if_branch(n);
+            if (if_br == NULL) { return false; }
+            cc = if_br->key;
+        }
+
+        x  = n->inputs[2];
+        dt = legalize(op->dt);
+        reuse_flags = &op->reuse_flags;
+    } else {
+        return false;
+    }
+
+    // find the previous instruction which could've touched the flags
+    TB_Node* prev = NULL;
+    for (size_t j = i; j-- > 0;) {
+        TB_Node* m = p->items[j];
+        if (m != NULL && !peep_keeps_flags(m)) {
+            prev = m;
+            break;
+        }
+    }
+
+    if (prev == NULL || prev != peep_value(x)) {
+        return false;
+    }
+
+    bool is_logic;
+    switch (prev->type) {
+        case x86_and: case x86_or: case x86_xor:
+        case x86_andimm: case x86_orimm: case x86_xorimm:
+        is_logic = true;
+        break;
+
+        case x86_add: case x86_sub:
+        case x86_addimm: case x86_subimm:
+        is_logic = false;
+        break;
+
+        default:
+        return false;
+    }
+
+    X86MemOp* prev_op = TB_NODE_GET_EXTRA(prev);
+    if (prev_op->mode == MODE_ST || legalize_int2(prev->dt) != dt) {
+        return false;
+    }
+
+    // logic ops clear CF & OF just like test does, add & sub don't so only
+    // conditions on ZF or SF can use those.
+    if (!is_logic && (cc < 0 || ((cc & ~1) != E && (cc & ~1) != S))) {
+        return false;
+    }
+
+    *reuse_flags = true;
+    return true;
+}
+
+static const struct {
+    const char* name;
+    X86PeepFn fn;
+    // which counter in TB_RegAllocStats it bumps
+    size_t stat;
+} x86_peepholes[] = {
+    { "zext",  peep_zext,  offsetof(TB_RegAllocStats, peep_zexts)  },
+    { "movzx", peep_movzx, offsetof(TB_RegAllocStats, peep_zexts)  },
+    { "copy",  peep_copy,  offsetof(TB_RegAllocStats, peep_copies) },
+    { "fold",  peep_fold,  offsetof(TB_RegAllocStats, peep_folds)  },
+    { "flags", peep_flags, offsetof(TB_RegAllocStats, peep_flags)  },
+};
+
+static void post_ra_peephole(Ctx* restrict ctx) {
+    TB_Arena* arena = ctx->f->tmp_arena;
+    TB_ArenaSavepoint sp = tb_arena_save(arena);
+
+    // folded reloads lose their last user, set_input would push them onto the
+    // worklist and they'd still be sitting there for the next function.
+    TB_Worklist* ws = ctx->f->worklist;
+    ctx->f->worklist = NULL;
+
+    X86Peephole p = { .locs = aarray_create(arena, X86LocVal, 32) };
+    FOR_N(i, 0, ctx->bb_count) {
+        MachineBB* mbb = &ctx->machine_bbs[i];
+        p.items = mbb->items;
+        p.count = aarray_length(mbb->items);
+        aarray_clear(p.locs);
+
+        FOR_N(j, 0, p.count) {
+            TB_Node* n = p.items[j];
+            if (n == NULL) { continue; }
+
+            FOR_N(k, 0, COUNTOF(x86_peepholes)) {
+                if (x86_peepholes[k].fn(ctx, &p, j)) {
+                    TB_OPTDEBUG(CODEGEN)(printf("  peephole %s: ", x86_peepholes[k].name), tb_print_dumb_node(NULL, n), printf("\n"));
+                    *(int*) ((char*) &ctx->ra_stats + x86_peepholes[k].stat) += 1;
+                    break;
+                }
+            }
+
+            // removed nodes already updated the locations themselves
+            if (p.items[j] != NULL) {
+                if (peep_is_simple(ctx, n)) {
+                    peep_loc_set(&p, peep_loc(ctx, n), peep_value(n));
+                } else {
+                    aarray_clear(p.locs);
+                }
+            }
+        }
+
+        size_t k = 0;
+        FOR_N(j, 0, p.count) {
+            if (p.items[j] != NULL) { p.items[k++] = p.items[j]; }
+        }
+        aarray_set_length(mbb->items, k);
+    }
+
+    ctx->f->worklist = ws;
+    tb_arena_restore(arena, sp);
 }
 
 static void pre_emit(Ctx* restrict ctx, TB_CGEmitter* e, TB_Node* root) {
@@ -2385,32 +3788,29 @@ static void on_basic_block(Ctx* restrict ctx, TB_CGEmitter* e, int bb) {
     tb_resolve_rel32(e, &e->labels[bb], e->count);
 }
 
-static void post_emit(Ctx* restrict ctx, TB_CGEmitter* e) {
-    // pad to 16bytes
-    static const uint8_t nops[8][8] = {
-        { 0x90 },
-        { 0x66, 0x90 },
-        { 0x0F, 0x1F, 0x00 },
-        { 0x0F, 0x1F, 0x40, 0x00 },
-        { 0x0F, 0x1F, 0x44, 0x00, 0x00 },
-        { 0x66, 0x0F, 0x1F, 0x44, 0x00, 0x00 },
-        { 0x0F, 0x1F, 0x80, 0x00, 0x00, 0x00, 0x00 },
-        { 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 },
-    };
+static void emit_counter(Ctx* restrict ctx, TB_CGEmitter* e, TB_Symbol* counter) {
+    // add dword [rip + counter], 1 (rip is the end of the instruction, that's
+    // one byte past the disp because of the imm8)
+    Val sym = val_global(counter, -1);
+    __(ADD, TB_X86_DWORD, &sym, Vimm(1));
+}
 
+static void emit_nop_pad(Ctx* restrict ctx, TB_CGEmitter* e, size_t pad) {
+    emit_nops(e, pad);
+}
+
+static void patch_jump_table(Ctx* restrict ctx, TB_CGEmitter* e, uint32_t ref_pos, uint32_t table_pos) {
+    // rip-relative lea
+    PATCH4(e, ref_pos, table_pos - (ref_pos + 4));
+}
+
+static void post_emit(Ctx* restrict ctx, TB_CGEmitter* e) {
+    // pad to 16bytes, stricter function alignment (TB_CodeLayout) is
+    // done when placing the function.
     size_t pad = 16 - (ctx->emit.count & 15);
     if (pad < 16) {
         ctx->nop_pads = pad;
-
-        uint8_t* dst = tb_cgemit_reserve(&ctx->emit, pad);
-        tb_cgemit_commit(&ctx->emit, pad);
-
-        if (pad > 8) {
-            size_t rem = pad - 8;
-            memset(dst, 0x66, rem);
-            pad -= rem, dst += rem;
-        }
-        memcpy(dst, nops[pad - 1], pad);
+        emit_nops(e, pad);
     }
 }
 
@@ -2447,12 +3847,12 @@ static void our_print_memory_operand(TB_CGEmitter* e, Disasm* restrict d, TB_X86
 
     if (inst->flags & TB_X86_INSTR_INDIRECT) {
         if ((inst->regs & 0xFFFF) == 0xFFFF) {
-            E("%s [", tb_x86_type_name(inst->dt));
+            E("%s [", tb_x86_type_name(x86_operand_dt(inst, inst->dt, true)));
             our_print_rip32(e, d, inst, pos, inst->disp_pos, inst->disp);
             E("]");
             return;
         } else {
-            E("%s [", tb_x86_type_name(inst->dt));
+            E("%s [", tb_x86_type_name(x86_operand_dt(inst, inst->dt, true)));
             if (base != 0xFF) {
                 E("%s", tb_x86_reg_name(base, TB_X86_QWORD));
             }
@@ -2469,7 +3869,7 @@ static void our_print_memory_operand(TB_CGEmitter* e, Disasm* restrict d, TB_X86
         }
         E("]");
     } else if (base != 0xFF) {
-        E("%s", tb_x86_reg_name(base, inst->dt));
+        E("%s", tb_x86_reg_name(base, x86_operand_dt(inst, inst->dt, true)));
     }
 }
 
@@ -2530,30 +3930,38 @@ static void disassemble(TB_CGEmitter* e, Disasm* restrict d, int bb, size_t pos,
         if (inst.flags & TB_X86_INSTR_LOCK) {
             E("lock ");
         }
-        E("%s", mnemonic);
         if (inst.dt >= TB_X86_F32x1 && inst.dt <= TB_X86_F64x2) {
             static const char* strs[] = { "ss", "sd", "ps", "pd" };
-            E("%s", strs[inst.dt - TB_X86_F32x1]);
+            E("%s%s%s", inst.flags & TB_X86_INSTR_VEX ? "v" : "", mnemonic, strs[inst.dt - TB_X86_F32x1]);
+        } else {
+            E("%s", mnemonic);
         }
         E(" ");
 
         uint8_t rx = (inst.regs >> 16) & 0xFF;
+        uint8_t vvvv = inst.regs >> 24;
         if (inst.flags & TB_X86_INSTR_DIRECTION) {
             if (rx != 255) {
-                E("%s", tb_x86_reg_name(rx, inst.dt2));
+                E("%s", tb_x86_reg_name(rx, x86_operand_dt(&inst, inst.dt2, false)));
                 E(", ");
             }
+            if (vvvv != 255 && !x86_vvvv_last(&inst)) {
+                E("%s, ", tb_x86_reg_name(vvvv, x86_operand_dt(&inst, inst.dt2, false)));
+            }
             our_print_memory_operand(e, d, &inst, pos);
+            if (vvvv != 255 && x86_vvvv_last(&inst)) {
+                E(", %s", tb_x86_reg_name(vvvv, x86_operand_dt(&inst, inst.dt2, false)));
+            }
         } else {
             our_print_memory_operand(e, d, &inst, pos);
             if (rx != 255) {
                 E(", ");
-                E("%s", tb_x86_reg_name(rx, inst.dt2));
+                E("%s", tb_x86_reg_name(rx, x86_operand_dt(&inst, inst.dt2, false)));
             }
         }
 
         if (inst.flags & TB_X86_INSTR_IMMEDIATE) {
-            if ((inst.flags & TB_X86_INSTR_INDIRECT) || (inst.regs != 0xFFFFFF)) {
+            if ((inst.flags & TB_X86_INSTR_INDIRECT) || ((inst.regs & 0xFFFFFF) != 0xFFFFFF)) {
                 E(", ");
             }
 
@@ -0,0 +1,289 @@
+// AArch64 JIT patching tests
+//   places aarch64 code on whatever the host is and decodes what the JIT patched
+//   back into symbols: BL to JIT functions and near externals, BL to far externals
+//   through a veneer (ldr x16, #8; br x16; .quad addr), ADRP+ADD to globals & near
+//   externals and ADRP+LDR off the veneer's literal for far externals. None of it
+//   gets run so the externals are bound to made up addresses around the heap.
+//   The listing gets diffed against tb/tests/a64_jit_test.gold.
+//
+//   a64_jit_test -S           prints the listing (to regenerate the gold)
+//   a64_jit_test [gold path]  checks it
+#include <tb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+enum {
+    // bound relative to callee, near is within BL & ADRP range and far is neither
+    NEAR_OFFSET = 1 << 20,
+    MAX_SYMS    = 16,
+};
+
+#define FAR_FN_OFFSET   (1ull << 40)
+#define FAR_DATA_OFFSET (1ull << 36)
+
+static const uint32_t veneer_insts[2] = {
+    0x58000050, // ldr x16, #8
+    0xD61F0200, // br x16
+};
+
+typedef struct {
+    const char* name;
+    uintptr_t addr;
+} Sym;
+
+static Sym syms[MAX_SYMS];
+static int sym_count;
+
+// distinct veneers in the order they showed up
+static uintptr_t veneers[MAX_SYMS];
+static int veneer_count;
+
+static void add_sym(const char* name, void* addr) {
+    syms[sym_count++] = (Sym){ name, (uintptr_t) addr };
+}
+
+static const char* sym_at(uintptr_t addr) {
+    for (int i = 0; i < sym_count; i++) {
+        if (syms[i].addr == addr) return syms[i].name;
+    }
+    return NULL;
+}
+
+static int64_t sxt(uint64_t x, int bits) {
+    return (int64_t) (x << (64 - bits)) >> (64 - bits);
+}
+
+// names addr, veneers are named after whoever their literal points to. lit
+// is set if we're pointing at the literal rather than the code.
+static void name_of(char* buf, size_t len, uintptr_t addr, bool lit, uintptr_t heap) {
+    const char* name = sym_at(addr);
+    if (name != NULL) {
+        snprintf(buf, len, "%s", name);
+        return;
+    }
+
+    // only peek at the heap (aarch64 JITs reserve 128MiB), anything else is just wrong
+    uintptr_t thunk = lit ? addr - 8 : addr;
+    if (thunk - heap < (128u << 20) && memcmp((void*) thunk, veneer_insts, sizeof(veneer_insts)) == 0) {
+        uint64_t target;
+        memcpy(&target, (void*) (thunk + 8), sizeof(target));
+        if ((name = sym_at(target)) != NULL) {
+            int i = 0;
+            while (i < veneer_count && veneers[i] != thunk) i++;
+            if (i == veneer_count) veneers[veneer_count++] = thunk;
+
+            snprintf(buf, len, "%s@veneer", name);
+            return;
+        }
+    }
+
+    snprintf(buf, len, "???");
+}
+
+// prints the patched instructions, everything else is the same as the codegen
+// listing so it's skipped.
+static void print_patches(FILE* out, const char* name, const uint8_t* code, size_t size, uintptr_t heap) {
+    // pages from the last ADRP into each reg
+    uintptr_t pages[32];
+    int adrp_at[32];
+    for (int i = 0; i < 32; i++) adrp_at[i] = -1;
+
+    fprintf(out, "%s:\n", name);
+    for (size_t i = 0; i + 4 <= size; i += 4) {
+        uint32_t w;
+        memcpy(&w, &code[i], 4);
+
+        uintptr_t pc = (uintptr_t) &code[i];
+        char target[64];
+        if ((w & 0x7C000000) == 0x14000000) {
+            name_of(target, sizeof(target), pc + sxt(w & 0x3FFFFFF, 26) * 4, false, heap);
+            fprintf(out, "  +%-3zu %s %s\n", i, w >> 31 ? "bl" : "b", target);
+        } else if ((w & 0x9F000000) == 0x90000000) {
+            int rd = w & 31;
+            int64_t imm = sxt((((w >> 5) & 0x7FFFF) << 2) | ((w >> 29) & 3), 21);
+            pages[rd] = (pc & ~(uintptr_t) 0xFFF) + imm * 4096;
+            adrp_at[rd] = i;
+        } else if ((w & 0x7F800000) == 0x11000000 || (w & 0xFFC00000) == 0xF9400000) {
+            // ADD xd, xn, :lo12: or LDR xd, [xn, :lo12:], only the ones after an ADRP
+            int rd = w & 31, rn = (w >> 5) & 31;
+            if (adrp_at[rn] < 0) continue;
+
+            bool is_ldr = (w >> 22) == (0xF9400000 >> 22);
+            uintptr_t addr = pages[rn] + ((w >> 10) & 0xFFF) * (is_ldr ? 8 : 1);
+            name_of(target, sizeof(target), addr, is_ldr, heap);
+
+            fprintf(out, "  +%-3d adrp x%d, %s\n", adrp_at[rn], rn, target);
+            if (is_ldr) {
+                fprintf(out, "  +%-3zu ldr x%d, [x%d, :lo12:%s]\n", i, rd, rn, target);
+            } else {
+                fprintf(out, "  +%-3zu add x%d, x%d, :lo12:%s\n", i, rd, rn, target);
+            }
+            adrp_at[rn] = -1;
+        }
+    }
+
+    for (int i = 0; i < 32; i++) {
+        if (adrp_at[i] >= 0) fprintf(out, "  +%-3d adrp x%d, (no :lo12:)\n", adrp_at[i], i);
+    }
+}
+
+static TB_FunctionPrototype* proto_of(TB_Module* m, int param_count) {
+    TB_PrototypeParam params[1] = { { TB_TYPE_I64 } };
+    TB_PrototypeParam ret = { TB_TYPE_I64 };
+    return tb_prototype_create(m, TB_CDECL, param_count, params, 1, &ret, false);
+}
+
+static TB_Function* declare(TB_Module* m, const char* name, TB_FunctionPrototype* proto) {
+    TB_Function* f = tb_function_create(m, -1, name, TB_LINKAGE_PUBLIC);
+    tb_function_set_arenas(f, tb_arena_create(0), tb_arena_create(0));
+    tb_function_set_prototype(f, tb_module_get_text(m), proto);
+    return f;
+}
+
+static TB_Node* call(TB_Function* f, TB_FunctionPrototype* proto, TB_Symbol* target, TB_Node* x) {
+    return tb_inst_call(f, proto, tb_inst_get_symbol_address(f, target), 1, &x).single;
+}
+
+static char* read_file(const char* path) {
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL) {
+        return NULL;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    long len = ftell(fp);
+    rewind(fp);
+
+    char* buf = malloc(len + 1);
+    buf[fread(buf, 1, len, fp)] = 0;
+    fclose(fp);
+    return buf;
+}
+
+// the first line which differs, ignoring \r so a CRLF checkout still matches
+static int first_diff(const char* a, const char* b) {
+    int line = 1;
+    for (;;) {
+        while (*a == '\r') a++;
+        while (*b == '\r') b++;
+        if (*a != *b) return line;
+        if (*a == 0) return 0;
+        line += *a == '\n';
+        a++, b++;
+    }
+}
+
+int main(int argc, char** argv) {
+    bool print = argc > 1 && strcmp(argv[1], "-S") == 0;
+    const char* gold_path = argc > 1 && !print ? argv[1] : "tb/tests/a64_jit_test.gold";
+
+    TB_Module* m = tb_module_create(TB_ARCH_AARCH64, TB_SYSTEM_LINUX, true);
+    TB_FunctionPrototype* unary = proto_of(m, 1);
+    TB_FunctionPrototype* nullary = proto_of(m, 0);
+
+    TB_External* near_fn  = tb_extern_create(m, -1, "near_fn",  TB_EXTERNAL_SO_LOCAL);
+    TB_External* far_fn   = tb_extern_create(m, -1, "far_fn",   TB_EXTERNAL_SO_LOCAL);
+    TB_External* far_data = tb_extern_create(m, -1, "far_data", TB_EXTERNAL_SO_LOCAL);
+
+    TB_Global* g = tb_global_create(m, -1, "g", NULL, TB_LINKAGE_PRIVATE);
+    tb_global_set_storage(m, tb_module_get_data(m), g, sizeof(int64_t), sizeof(int64_t), 0);
+
+    // callee(x) = x + 1
+    TB_Function* callee = declare(m, "callee", unary);
+    {
+        TB_Node* r = tb_inst_add(callee, tb_inst_param(callee, 0), tb_inst_sint(callee, TB_TYPE_I64, 1), 0);
+        tb_inst_ret(callee, 1, &r);
+    }
+
+    // calls(x) = r + far_fn(r) where r = callee(x) + near_fn(x) + far_fn(x),
+    // both of the far calls should share a veneer.
+    TB_Function* calls = declare(m, "calls", unary);
+    {
+        TB_Node* x = tb_inst_param(calls, 0);
+        TB_Node* r = call(calls, unary, (TB_Symbol*) callee, x);
+        r = tb_inst_add(calls, r, call(calls, unary, (TB_Symbol*) near_fn, x), 0);
+        r = tb_inst_add(calls, r, call(calls, unary, (TB_Symbol*) far_fn, x), 0);
+        r = tb_inst_add(calls, r, call(calls, unary, (TB_Symbol*) far_fn, r), 0);
+        tb_inst_ret(calls, 1, &r);
+    }
+
+    // addrs() = &g + &near_fn + &far_data, the last one is loaded out of a veneer
+    TB_Function* addrs = declare(m, "addrs", nullary);
+    {
+        TB_Node* r = tb_inst_get_symbol_address(addrs, (TB_Symbol*) g);
+        r = tb_inst_ptr2int(addrs, r, TB_TYPE_I64);
+        TB_Node* b = tb_inst_ptr2int(addrs, tb_inst_get_symbol_address(addrs, (TB_Symbol*) near_fn), TB_TYPE_I64);
+        TB_Node* c = tb_inst_ptr2int(addrs, tb_inst_get_symbol_address(addrs, (TB_Symbol*) far_data), TB_TYPE_I64);
+        r = tb_inst_add(addrs, r, b, 0);
+        r = tb_inst_add(addrs, r, c, 0);
+        tb_inst_ret(addrs, 1, &r);
+    }
+
+    TB_Function* funcs[] = { callee, calls, addrs };
+    enum { FUNCS = sizeof(funcs) / sizeof(funcs[0]) };
+
+    TB_Worklist* ws = tb_worklist_alloc();
+    TB_Arena* code_arena = tb_arena_create(0);
+    TB_FeatureSet features = { 0 };
+    TB_FunctionOutput* outs[FUNCS];
+    for (int i = 0; i < FUNCS; i++) {
+        tb_opt(funcs[i], ws, false);
+        outs[i] = tb_codegen(funcs[i], ws, code_arena, &features, false);
+    }
+    tb_worklist_free(ws);
+
+    // callee goes first so the externals can be bound around it
+    TB_JIT* jit = tb_jit_begin(m, 0);
+    char* heap = tb_jit_place_function(jit, callee);
+    add_sym("callee", heap);
+    add_sym("near_fn", heap + NEAR_OFFSET);
+    add_sym("far_fn", heap + FAR_FN_OFFSET);
+    add_sym("far_data", heap + FAR_DATA_OFFSET);
+    add_sym("g", tb_jit_place_global(jit, g));
+    tb_symbol_bind_ptr((TB_Symbol*) near_fn, heap + NEAR_OFFSET);
+    tb_symbol_bind_ptr((TB_Symbol*) far_fn, heap + FAR_FN_OFFSET);
+    tb_symbol_bind_ptr((TB_Symbol*) far_data, heap + FAR_DATA_OFFSET);
+
+    FILE* listing = tmpfile();
+    for (int i = 1; i < FUNCS; i++) {
+        uint8_t* code = tb_jit_place_function(jit, funcs[i]);
+        size_t size;
+        tb_output_get_code(outs[i], &size);
+        print_patches(listing, tb_symbol_get_name((TB_Symbol*) funcs[i]), code, size, (uintptr_t) heap);
+    }
+
+    fprintf(listing, "veneers:\n");
+    for (int i = 0; i < veneer_count; i++) {
+        uint64_t target;
+        memcpy(&target, (void*) (veneers[i] + 8), sizeof(target));
+        fprintf(listing, "  ldr x16, #8; br x16; .quad %s\n", sym_at(target));
+    }
+    tb_jit_end(jit);
+    tb_module_destroy(m);
+
+    long len = ftell(listing);
+    rewind(listing);
+    char* got = malloc(len + 1);
+    got[fread(got, 1, len, listing)] = 0;
+    fclose(listing);
+
+    if (print) {
+        fputs(got, stdout);
+        return 0;
+    }
+
+    char* gold = read_file(gold_path);
+    if (gold == NULL) {
+        printf("can't read %s\n", gold_path);
+        return 1;
+    }
+
+    int line = first_diff(got, gold);
+    printf("patches %s", line ? "FAILED" : "OK\n");
+    if (line) {
+        printf(" (differs from %s at line %d)\n", gold_path, line);
+    }
+    return line != 0;
+}
@@ -0,0 +1,211 @@
+// x64 memcpy/memset lowering tests
+//   known sizes get unrolled into GPR moves (under 16 bytes), SSE moves (up to
+//   128 bytes) or AVX moves (up to 256 bytes with AVX), anything bigger or not
+//   known is a rep movsb/stosb. Every case is compiled for x86-64 and haswell
+//   and the listing gets diffed against tb/tests/bulk_test.x64.gold, on an x64
+//   host they're also JIT'd and run on unaligned buffers so the overlapping
+//   tails get checked against libc.
+//
+//   bulk_test -S           prints the listing (to regenerate the gold)
+//   bulk_test [gold path]  checks it
+#include <tb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+enum { COPY, SET, FILL };
+
+typedef struct {
+    int kind;
+    // -1 is passed in at runtime
+    int size;
+} Case;
+
+// the comments are for x86-64 / haswell
+static const Case cases[] = {
+    { COPY,    8 }, // one GPR move
+    { COPY,   13 }, // two overlapping GPR moves
+    { COPY,   24 }, // two overlapping XMMs (YMMs only start at 32)
+    { COPY,  100 }, // 7 XMMs / 4 YMMs, the last one overlaps
+    { COPY,  128 }, // SSE limit
+    { COPY,  129 }, // rep / 5 YMMs
+    { COPY,  256 }, // rep / AVX limit
+    { COPY,  257 }, // rep
+    { COPY,   -1 }, // rep
+    { SET,    13 }, // splat through XMM0 back into RCX, two overlapping GPR moves
+    { SET,   100 }, // splat across the vector
+    { SET,   300 }, // rep
+    { SET,    -1 }, // rep
+    { FILL,   48 }, // constant fill, no movzx/imul
+};
+
+enum { CASES = sizeof(cases) / sizeof(cases[0]), MARCHS = 2, PAD = 64 };
+
+static const char* marchs[MARCHS] = { "x86-64", "haswell" };
+
+static const char* kind_names[] = { "copy", "set", "fill" };
+
+static void case_name(char* name, size_t len, const Case* c) {
+    if (c->size < 0) {
+        snprintf(name, len, "%s_n", kind_names[c->kind]);
+    } else {
+        snprintf(name, len, "%s_%d", kind_names[c->kind], c->size);
+    }
+}
+
+static TB_Function* build(TB_Module* m, const Case* c) {
+    char name[32];
+    case_name(name, sizeof(name), c);
+
+    // (dst, src or the byte, size) -> dst
+    TB_PrototypeParam params[3] = { { TB_TYPE_PTR }, { c->kind == COPY ? TB_TYPE_PTR : TB_TYPE_I8 }, { TB_TYPE_I64 } };
+    TB_PrototypeParam ret = { TB_TYPE_PTR };
+    TB_FunctionPrototype* proto = tb_prototype_create(m, TB_CDECL, 3, params, 1, &ret, false);
+
+    TB_Function* f = tb_function_create(m, -1, name, TB_LINKAGE_PUBLIC);
+    tb_function_set_arenas(f, tb_arena_create(0), tb_arena_create(0));
+    tb_function_set_prototype(f, tb_module_get_text(m), proto);
+
+    TB_Node* dst = tb_inst_param(f, 0);
+    TB_Node* size = c->size < 0 ? tb_inst_param(f, 2) : tb_inst_uint(f, TB_TYPE_I64, c->size);
+    switch (c->kind) {
+        case COPY: tb_inst_memcpy(f, dst, tb_inst_param(f, 1), size, 1); break;
+        case SET:  tb_inst_memset(f, dst, tb_inst_param(f, 1), size, 1); break;
+        case FILL: tb_inst_memset(f, dst, tb_inst_uint(f, TB_TYPE_I8, 0x5A), size, 1); break;
+    }
+    tb_inst_ret(f, 1, &dst);
+    return f;
+}
+
+// the src is off by 3 and the dst by 1, a guard byte on either side of the dst
+static int run(const Case* c, void* fn) {
+    typedef void* (*CopyFn)(uint8_t*, const uint8_t*, int64_t);
+    typedef void* (*SetFn)(uint8_t*, uint8_t, int64_t);
+
+    static uint8_t src[300 + PAD], dst[300 + PAD], expected[300 + PAD];
+    int size = c->size < 0 ? 77 : c->size;
+    for (int i = 0; i < sizeof(src); i++) {
+        src[i] = i * 131 + 7;
+    }
+
+    memset(dst, 0xEE, sizeof(dst));
+    memset(expected, 0xEE, sizeof(expected));
+    switch (c->kind) {
+        case COPY:
+        ((CopyFn) fn)(dst + 1, src + 3, size);
+        memcpy(expected + 1, src + 3, size);
+        break;
+
+        case SET:
+        ((SetFn) fn)(dst + 1, 0xC3, size);
+        memset(expected + 1, 0xC3, size);
+        break;
+
+        case FILL:
+        ((SetFn) fn)(dst + 1, 0, size);
+        memset(expected + 1, 0x5A, size);
+        break;
+    }
+    return memcmp(dst, expected, sizeof(dst)) != 0;
+}
+
+static char* read_file(const char* path) {
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL) {
+        return NULL;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    long len = ftell(fp);
+    rewind(fp);
+
+    char* buf = malloc(len + 1);
+    buf[fread(buf, 1, len, fp)] = 0;
+    fclose(fp);
+    return buf;
+}
+
+// the first line which differs, ignoring \r so a CRLF checkout still matches
+static int first_diff(const char* a, const char* b) {
+    int line = 1;
+    for (;;) {
+        while (*a == '\r') a++;
+        while (*b == '\r') b++;
+        if (*a != *b) return line;
+        if (*a == 0) return 0;
+        line += *a == '\n';
+        a++, b++;
+    }
+}
+
+int main(int argc, char** argv) {
+    bool print = argc > 1 && strcmp(argv[1], "-S") == 0;
+    const char* gold_path = argc > 1 && !print ? argv[1] : "tb/tests/bulk_test.x64.gold";
+
+    FILE* listing = tmpfile();
+    TB_Worklist* ws = tb_worklist_alloc();
+
+    int failed = 0;
+    for (int j = 0; j < MARCHS; j++) {
+        TB_FeatureSet features = { 0 };
+        tb_features_from_march(TB_ARCH_X86_64, marchs[j], &features);
+
+        // the listing is always sysv so the gold doesn't depend on the host
+        TB_Module* m = tb_module_create(TB_ARCH_X86_64, TB_SYSTEM_LINUX, true);
+        TB_Arena* code_arena = tb_arena_create(0);
+
+        TB_Function* funcs[CASES];
+        fprintf(listing, "# -march=%s\n", marchs[j]);
+        for (int i = 0; i < CASES; i++) {
+            funcs[i] = build(m, &cases[i]);
+            tb_opt(funcs[i], ws, false);
+            tb_output_print_asm(tb_codegen(funcs[i], ws, code_arena, &features, true), listing);
+        }
+
+        #if defined(__x86_64__) && !defined(_WIN32)
+        if (j == 0 || __builtin_cpu_supports("avx2")) {
+            TB_JIT* jit = tb_jit_begin(m, 0);
+            for (int i = 0; i < CASES; i++) {
+                int bad = run(&cases[i], tb_jit_place_function(jit, funcs[i]));
+                if (bad) {
+                    char name[32];
+                    case_name(name, sizeof(name), &cases[i]);
+                    printf("%s (-march=%s) FAILED\n", name, marchs[j]);
+                }
+                failed += bad;
+            }
+            tb_jit_end(jit);
+        }
+        #endif
+
+        tb_module_destroy(m);
+    }
+    tb_worklist_free(ws);
+
+    long len = ftell(listing);
+    rewind(listing);
+    char* got = malloc(len + 1);
+    got[fread(got, 1, len, listing)] = 0;
+    fclose(listing);
+
+    if (print) {
+        fputs(got, stdout);
+        return failed != 0;
+    }
+
+    char* gold = read_file(gold_path);
+    if (gold == NULL) {
+        printf("can't read %s\n", gold_path);
+        return 1;
+    }
+
+    int line = first_diff(got, gold);
+    printf("listing %s", line ? "FAILED" : "OK\n");
+    if (line) {
+        printf(" (differs from %s at line %d)\n", gold_path, line);
+    }
+
+    printf("run     %s\n", failed ? "FAILED" : "OK");
+    return failed != 0 || line != 0;
+}
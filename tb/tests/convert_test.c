@@ -0,0 +1,119 @@
+// GPR <-> XMM tests
+//   int2float, float2int and bitcasts between the integer and float register
+//   files, each gets JIT'd on the host and checked against plain C with values
+//   which don't survive a 32bit conversion or a move in the wrong direction.
+#include <tb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef enum {
+    I64_TO_F64, I64_TO_F32, I32_TO_F64, F64_TO_I64, F32_TO_I64, BITS_TO_F64, F64_TO_BITS,
+    MIXED_PARAMS,
+    CONVERT_COUNT
+} Convert;
+
+static const char* names[CONVERT_COUNT] = {
+    "i64->f64", "i64->f32", "i32->f64", "f64->i64", "f32->i64", "bits->f64", "f64->bits", "i64,f64"
+};
+
+// x + 0.5 or x + 1 around the conversion so it's not just a move from the param register
+// into the return register, the value has to cross over and get used on the other side.
+// The mixed one takes (i64, f64) which on sysv is RDI & XMM0, not XMM1.
+static TB_Function* build(TB_Module* m, Convert kind) {
+    static const TB_DataType src_dts[CONVERT_COUNT] = {
+        TB_TYPE_I64, TB_TYPE_I64, TB_TYPE_I32, TB_TYPE_F64, TB_TYPE_F32, TB_TYPE_I64, TB_TYPE_F64, TB_TYPE_I64
+    };
+    static const TB_DataType dst_dts[CONVERT_COUNT] = {
+        TB_TYPE_F64, TB_TYPE_F32, TB_TYPE_F64, TB_TYPE_I64, TB_TYPE_I64, TB_TYPE_F64, TB_TYPE_I64, TB_TYPE_F64
+    };
+
+    TB_PrototypeParam params[2] = { { src_dts[kind] }, { TB_TYPE_F64 } };
+    TB_PrototypeParam ret = { dst_dts[kind] };
+    TB_FunctionPrototype* proto = tb_prototype_create(m, TB_CDECL, kind == MIXED_PARAMS ? 2 : 1, params, 1, &ret, false);
+
+    TB_Function* f = tb_function_create(m, -1, names[kind], TB_LINKAGE_PUBLIC);
+    tb_function_set_arenas(f, tb_arena_create(0), tb_arena_create(0));
+    tb_function_set_prototype(f, tb_module_get_text(m), proto);
+
+    TB_Node* x = tb_inst_param(f, 0);
+    TB_Node* v = NULL;
+    switch (kind) {
+        case I64_TO_F64: case I64_TO_F32: case I32_TO_F64:
+        v = tb_inst_int2float(f, x, dst_dts[kind], true);
+        v = tb_inst_fadd(f, v, dst_dts[kind].type == TB_TAG_F64 ? tb_inst_float64(f, 0.5) : tb_inst_float32(f, 0.5f));
+        break;
+
+        case F64_TO_I64: case F32_TO_I64:
+        v = tb_inst_float2int(f, x, TB_TYPE_I64, true);
+        v = tb_inst_add(f, v, tb_inst_sint(f, TB_TYPE_I64, 1), 0);
+        break;
+
+        case BITS_TO_F64:
+        v = tb_inst_bitcast(f, tb_inst_add(f, x, tb_inst_sint(f, TB_TYPE_I64, 1), 0), TB_TYPE_F64);
+        v = tb_inst_fadd(f, v, tb_inst_float64(f, 0.5));
+        break;
+
+        case F64_TO_BITS:
+        v = tb_inst_bitcast(f, tb_inst_fadd(f, x, tb_inst_float64(f, 0.5)), TB_TYPE_I64);
+        v = tb_inst_add(f, v, tb_inst_sint(f, TB_TYPE_I64, 1), 0);
+        break;
+
+        case MIXED_PARAMS:
+        v = tb_inst_fadd(f, tb_inst_int2float(f, x, TB_TYPE_F64, true), tb_inst_param(f, 1));
+        break;
+
+        default: abort();
+    }
+    tb_inst_ret(f, 1, &v);
+    return f;
+}
+
+static int check(Convert kind, int bad) {
+    printf("%-10s %s\n", names[kind], bad ? "FAILED" : "OK");
+    return bad;
+}
+
+int main(int argc, char** argv) {
+    TB_Module* m = tb_module_create_for_host(true);
+    TB_Worklist* ws = tb_worklist_alloc();
+    TB_Arena* code_arena = tb_arena_create(0);
+
+    TB_Function* funcs[CONVERT_COUNT];
+    for (int i = 0; i < CONVERT_COUNT; i++) {
+        funcs[i] = build(m, i);
+        tb_opt(funcs[i], ws, false);
+        tb_codegen(funcs[i], ws, code_arena, NULL, false);
+    }
+
+    TB_JIT* jit = tb_jit_begin(m, 0);
+    void* fns[CONVERT_COUNT];
+    for (int i = 0; i < CONVERT_COUNT; i++) {
+        fns[i] = tb_jit_place_function(jit, funcs[i]);
+    }
+
+    // the upper halves matter, a 32bit cvtsi2sd or cvttsd2si would drop them
+    int64_t big = (INT64_C(1) << 40) + 3;
+    double big_f64 = 1e12 + 0.25;
+    float big_f32 = -3e10f;
+    double bits_f64;
+    memcpy(&bits_f64, &(int64_t){ big + 1 }, sizeof(double));
+    int64_t f64_bits;
+    memcpy(&f64_bits, &(double){ big_f64 + 0.5 }, sizeof(int64_t));
+
+    int failed = 0;
+    failed += check(I64_TO_F64,  ((double (*)(int64_t)) fns[I64_TO_F64])(big) != (double) big + 0.5);
+    failed += check(I64_TO_F32,  ((float (*)(int64_t)) fns[I64_TO_F32])(big) != (float) big + 0.5f);
+    failed += check(I32_TO_F64,  ((double (*)(int32_t)) fns[I32_TO_F64])(-7) != -6.5);
+    failed += check(F64_TO_I64,  ((int64_t (*)(double)) fns[F64_TO_I64])(big_f64) != (int64_t) big_f64 + 1);
+    failed += check(F32_TO_I64,  ((int64_t (*)(float)) fns[F32_TO_I64])(big_f32) != (int64_t) big_f32 + 1);
+    failed += check(BITS_TO_F64, ((double (*)(int64_t)) fns[BITS_TO_F64])(big) != bits_f64 + 0.5);
+    failed += check(F64_TO_BITS, ((int64_t (*)(double)) fns[F64_TO_BITS])(big_f64) != f64_bits + 1);
+    failed += check(MIXED_PARAMS, ((double (*)(int64_t, double)) fns[MIXED_PARAMS])(big, 0.25) != (double) big + 0.25);
+
+    tb_jit_end(jit);
+    tb_worklist_free(ws);
+    tb_module_destroy(m);
+    return failed != 0;
+}
@@ -0,0 +1,1186 @@
+// Multi-threaded JIT placement benchmark
+//   compiles a pile of small functions up front then places them into a fresh
+//   JIT from 1..N threads while they also churn through some data objects, the
+//   placed functions are called afterwards to check they survived. Just as many
+//   threads keep resolving placed addresses back to their tags the whole time.
+//
+//   Before that it times the first call into a big call tree, compiling it all
+//   up front vs lazily compiling whatever the call ends up touching (with and
+//   without tiering), then the throughput of a hot loop in each tier (tiering
+//   also gets turned on over the top of lazy binding). On x64
+//   Linux it also runs that loop with a safepoint poll on a JIT thread to see
+//   what polling costs and how quickly an interrupt lands. Host symbols get
+//   checked (and their lookups timed) through each kind of resolver, placing
+//   something which needs a symbol nobody has has to fail cleanly, and the
+//   same function goes through the on-disk code cache to compare a cold
+//   compile against hashing the IR & loading the entry. On Linux the perf map,
+//   jitdump & GDB registration get checked and their cost on placement timed.
+//   Unplacing gets checked against a direct caller and a reader holding off
+//   reclamation, then timed by churning every function in and out of a small
+//   heap which shouldn't keep growing. Code chunks left behind by a thread
+//   switching JITs or exiting have to get freed too.
+#include <tb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <threads.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+enum {
+    FUNC_COUNT   = 4096,
+    CHURN_COUNT  = 64,
+    // each resolver keeps going until the placement is done and it's done at least this many
+    MIN_LOOKUPS  = 1 << 16,
+    MAX_THREADS  = 16,
+    // full binary tree, the second half are leaves
+    TREE_COUNT   = 4095,
+    // hot loop trip count per call
+    LOOP_TRIPS   = 1 << 20,
+    LOOP_CALLS   = 32,
+};
+
+typedef enum {
+    MODE_EAGER,
+    MODE_LAZY,
+    MODE_TIERED,
+} Mode;
+
+typedef struct {
+    TB_JIT* jit;
+    TB_Function** funcs;
+    _Atomic(void*)* placed;
+    int id, stride;
+} Worker;
+
+typedef struct {
+    TB_JIT* jit;
+    TB_Function** funcs;
+    _Atomic(void*)* placed;
+    atomic_bool* done;
+    uint32_t seed;
+    uint64_t lookups, bad;
+} Resolver;
+
+static int worker_main(void* arg) {
+    Worker* w = arg;
+    void* objs[CHURN_COUNT];
+
+    int k = 0;
+    for (int i = w->id; i < FUNC_COUNT; i += w->stride) {
+        void* fn = tb_jit_place_function(w->jit, w->funcs[i]);
+        tb_jit_tag_object(w->jit, fn, w->funcs[i]);
+        atomic_store(&w->placed[i], fn);
+
+        // thunks and globals get allocated in between functions, half
+        // of them die every so often.
+        objs[k] = tb_jit_alloc_obj(w->jit, 16 + (i % 2048), 16);
+        tb_jit_tag_object(w->jit, objs[k], objs);
+        if (++k == CHURN_COUNT) {
+            k = 0;
+            for (int j = 0; j < CHURN_COUNT; j += 2) {
+                tb_jit_free_obj(w->jit, objs[j]);
+            }
+        }
+    }
+    return 0;
+}
+
+static int resolver_main(void* arg) {
+    Resolver* r = arg;
+    while (!atomic_load(r->done) || r->lookups < MIN_LOOKUPS) {
+        r->seed = r->seed*1103515245 + 12345;
+        int i = (r->seed >> 8) % FUNC_COUNT;
+
+        char* fn = atomic_load(&r->placed[i]);
+        if (fn != NULL) {
+            uint32_t offset;
+            void* tag = tb_jit_resolve_addr(r->jit, fn + 1, &offset);
+            r->bad += tag != r->funcs[i] || offset != 1;
+            r->lookups += 1;
+        }
+    }
+    return 0;
+}
+
+static uint64_t now_in_nanos(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static TB_Function** compile_funcs(TB_Module* m) {
+    TB_Arena* ir_arenas[2] = { tb_arena_create(0), tb_arena_create(0) };
+    TB_Arena* code_arena = tb_arena_create(0);
+    TB_Worklist* ws = tb_worklist_alloc();
+
+    TB_PrototypeParam param = { TB_TYPE_I64 };
+    TB_FunctionPrototype* proto = tb_prototype_create(m, TB_CDECL, 1, &param, 1, &param, false);
+
+    TB_Function** funcs = malloc(FUNC_COUNT * sizeof(TB_Function*));
+    for (int i = 0; i < FUNC_COUNT; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "f%d", i);
+
+        // f(x) = x*(i+3) + i
+        TB_Function* f = tb_function_create(m, -1, name, TB_LINKAGE_PUBLIC);
+        tb_function_set_arenas(f, ir_arenas[0], ir_arenas[1]);
+        tb_function_set_prototype(f, tb_module_get_text(m), proto);
+
+        TB_Node* v = tb_inst_mul(f, tb_inst_param(f, 0), tb_inst_sint(f, TB_TYPE_I64, i + 3), 0);
+        v = tb_inst_add(f, v, tb_inst_sint(f, TB_TYPE_I64, i), 0);
+        tb_inst_ret(f, 1, &v);
+
+        tb_opt(f, ws, false);
+        tb_codegen(f, ws, code_arena, NULL, false);
+        funcs[i] = f;
+    }
+
+    tb_worklist_free(ws);
+    return funcs;
+}
+
+// f(x) = (x & 1 ? right : left)(x >> 1) and the leaves are x*(i+3) + i, only
+// one path of the tree gets called but every function refers to both children.
+static TB_Function** build_tree(TB_Module* m, TB_Arena* ir_arenas[2]) {
+    TB_PrototypeParam param = { TB_TYPE_I64 };
+    TB_FunctionPrototype* proto = tb_prototype_create(m, TB_CDECL, 1, &param, 1, &param, false);
+
+    TB_Function** funcs = malloc(TREE_COUNT * sizeof(TB_Function*));
+    for (int i = 0; i < TREE_COUNT; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "t%d", i);
+        funcs[i] = tb_function_create(m, -1, name, TB_LINKAGE_PUBLIC);
+    }
+
+    for (int i = 0; i < TREE_COUNT; i++) {
+        TB_Function* f = funcs[i];
+        tb_function_set_arenas(f, ir_arenas[0], ir_arenas[1]);
+        tb_function_set_prototype(f, tb_module_get_text(m), proto);
+
+        TB_Node* x = tb_inst_param(f, 0);
+        TB_Node* v;
+        if (i < TREE_COUNT / 2) {
+            TB_Node* bit = tb_inst_cmp_ne(f, tb_inst_and(f, x, tb_inst_sint(f, TB_TYPE_I64, 1)), tb_inst_sint(f, TB_TYPE_I64, 0));
+            TB_Node* target = tb_inst_select(f, bit,
+                tb_inst_get_symbol_address(f, (TB_Symbol*) funcs[2*i + 2]),
+                tb_inst_get_symbol_address(f, (TB_Symbol*) funcs[2*i + 1]));
+
+            TB_Node* arg = tb_inst_shr(f, x, tb_inst_sint(f, TB_TYPE_I64, 1));
+            v = tb_inst_call(f, proto, target, 1, &arg).single;
+        } else {
+            v = tb_inst_mul(f, x, tb_inst_sint(f, TB_TYPE_I64, i + 3), 0);
+            v = tb_inst_add(f, v, tb_inst_sint(f, TB_TYPE_I64, i), 0);
+        }
+        tb_inst_ret(f, 1, &v);
+    }
+
+    return funcs;
+}
+
+static int64_t tree_eval(int64_t x) {
+    uint64_t y = x;
+    int i = 0;
+    while (i < TREE_COUNT / 2) {
+        i = 2*i + 1 + (y & 1);
+        y >>= 1;
+    }
+    return y*(i + 3) + i;
+}
+
+// time from having the IR to the first call returning
+static int first_call(Mode mode, TB_JITFlags flags, double* out_ms, int* out_compiled) {
+    TB_Module* m = tb_module_create_for_host(true);
+    TB_Arena* ir_arenas[2] = { tb_arena_create(0), tb_arena_create(0) };
+    TB_Arena* code_arena = tb_arena_create(0);
+    TB_Function** funcs = build_tree(m, ir_arenas);
+    TB_JIT* jit = tb_jit_begin_flags(m, 0, flags);
+
+    uint64_t start = now_in_nanos();
+    if (mode == MODE_TIERED) {
+        tb_jit_enable_tiering(jit, code_arena, NULL, 1000);
+    } else if (mode == MODE_LAZY) {
+        tb_jit_enable_lazy(jit, code_arena, NULL, true);
+    } else {
+        TB_Worklist* ws = tb_worklist_alloc();
+        for (int i = 0; i < TREE_COUNT; i++) {
+            tb_opt(funcs[i], ws, false);
+            tb_codegen(funcs[i], ws, code_arena, NULL, false);
+        }
+        tb_worklist_free(ws);
+    }
+
+    int64_t (*root)(int64_t) = tb_jit_place_function(jit, funcs[0]);
+    int bad = root(12345) != tree_eval(12345);
+    *out_ms = (now_in_nanos() - start) / 1000000.0;
+
+    *out_compiled = 0;
+    for (int i = 0; i < TREE_COUNT; i++) {
+        *out_compiled += tb_jit_get_code_ptr(funcs[i]) != NULL || tb_jit_get_tier(jit, funcs[i]) != TB_JIT_TIER_NONE;
+    }
+
+    // the rest of the tree still works (and gets compiled as we go)
+    for (int64_t x = 0; x < 4096; x += 7) {
+        bad += root(x) != tree_eval(x);
+        bad += root(-x) != tree_eval(-x);
+    }
+
+    tb_jit_end(jit);
+    tb_module_destroy(m);
+    free(funcs);
+    return bad;
+}
+
+// h(n): acc = 0; for (i = 0; i < n; i++) acc = acc*31 + (i ^ (i >> 3)); return acc
+// it's written like a frontend would (locals, loads & stores) so the baseline tier
+// is stuck with all the memory traffic. with poll it takes the poll site as a second
+// param and polls once per trip.
+static TB_Function* build_hot_loop(TB_Module* m, TB_Arena* ir_arenas[2], bool poll) {
+    TB_PrototypeParam params[2] = { { TB_TYPE_I64 }, { TB_TYPE_PTR } };
+    TB_FunctionPrototype* proto = tb_prototype_create(m, TB_CDECL, poll ? 2 : 1, params, 1, params, false);
+
+    TB_Function* f = tb_function_create(m, -1, "hot_loop", TB_LINKAGE_PUBLIC);
+    tb_function_set_arenas(f, ir_arenas[0], ir_arenas[1]);
+    tb_function_set_prototype(f, tb_module_get_text(m), proto);
+
+    TB_Node* n = tb_inst_param(f, 0);
+    TB_Node* acc = tb_inst_local(f, 8, 8);
+    TB_Node* i = tb_inst_local(f, 8, 8);
+    tb_inst_store(f, TB_TYPE_I64, acc, tb_inst_sint(f, TB_TYPE_I64, 0), 8, false);
+    tb_inst_store(f, TB_TYPE_I64, i, tb_inst_sint(f, TB_TYPE_I64, 0), 8, false);
+
+    TB_Node* header = tb_inst_region(f);
+    TB_Node* body = tb_inst_region(f);
+    TB_Node* exit = tb_inst_region(f);
+    tb_inst_goto(f, header);
+
+    tb_inst_set_control(f, header);
+    TB_Node* iv = tb_inst_load(f, TB_TYPE_I64, i, 8, false);
+    tb_inst_if(f, tb_inst_cmp_ilt(f, iv, n, true), body, exit);
+
+    tb_inst_set_control(f, body);
+    if (poll) {
+        tb_inst_safepoint_poll(f, NULL, tb_inst_param(f, 1), 0, NULL);
+    }
+    iv = tb_inst_load(f, TB_TYPE_I64, i, 8, false);
+    TB_Node* mix = tb_inst_xor(f, iv, tb_inst_shr(f, iv, tb_inst_sint(f, TB_TYPE_I64, 3)));
+    TB_Node* v = tb_inst_mul(f, tb_inst_load(f, TB_TYPE_I64, acc, 8, false), tb_inst_sint(f, TB_TYPE_I64, 31), 0);
+    tb_inst_store(f, TB_TYPE_I64, acc, tb_inst_add(f, v, mix, 0), 8, false);
+    tb_inst_store(f, TB_TYPE_I64, i, tb_inst_add(f, iv, tb_inst_sint(f, TB_TYPE_I64, 1), 0), 8, false);
+    tb_inst_goto(f, header);
+
+    tb_inst_set_control(f, exit);
+    TB_Node* ret = tb_inst_load(f, TB_TYPE_I64, acc, 8, false);
+    tb_inst_ret(f, 1, &ret);
+    return f;
+}
+
+static int64_t hot_loop_eval(int64_t n) {
+    uint64_t acc = 0;
+    for (int64_t i = 0; i < n; i++) {
+        acc = acc*31 + (i ^ (i >> 3));
+    }
+    return acc;
+}
+
+typedef struct {
+    // compile + first call
+    double first_ms;
+    // per trip, once it's in its final tier
+    double steady_ns;
+    // calls made before the optimized code showed up
+    int warmup_calls;
+} LoopTimes;
+
+// eager is optimized from the start, tiered starts out in the baseline and
+// a threshold of 0 means it stays there. lazy is tiered too but lazy binding
+// gets turned on first so tiering has to take it over.
+static int hot_loop(Mode mode, uint32_t threshold, TB_JITFlags flags, LoopTimes* out) {
+    TB_Module* m = tb_module_create_for_host(true);
+    TB_Arena* ir_arenas[2] = { tb_arena_create(0), tb_arena_create(0) };
+    TB_Arena* code_arena = tb_arena_create(0);
+    TB_Function* f = build_hot_loop(m, ir_arenas, false);
+    TB_JIT* jit = tb_jit_begin_flags(m, 0, flags);
+
+    uint64_t start = now_in_nanos();
+    if (mode != MODE_EAGER) {
+        if (mode == MODE_LAZY) {
+            tb_jit_enable_lazy(jit, code_arena, NULL, false);
+        }
+        tb_jit_enable_tiering(jit, code_arena, NULL, threshold ? threshold : UINT32_MAX);
+    } else {
+        TB_Worklist* ws = tb_worklist_alloc();
+        tb_opt(f, ws, false);
+        tb_codegen(f, ws, code_arena, NULL, false);
+        tb_worklist_free(ws);
+    }
+
+    int64_t (*fn)(int64_t) = tb_jit_place_function(jit, f);
+    int bad = fn(1000) != hot_loop_eval(1000);
+    out->first_ms = (now_in_nanos() - start) / 1000000.0;
+
+    // keep calling until the optimized code's in, give up after a second
+    int64_t expected = hot_loop_eval(LOOP_TRIPS);
+    out->warmup_calls = 0;
+    if (mode != MODE_EAGER && threshold) {
+        uint64_t deadline = now_in_nanos() + 1000000000ull;
+        while (tb_jit_get_tier(jit, f) != TB_JIT_TIER_OPTIMIZED && now_in_nanos() < deadline) {
+            bad += fn(LOOP_TRIPS) != expected;
+            out->warmup_calls += 1;
+        }
+        bad += tb_jit_get_tier(jit, f) != TB_JIT_TIER_OPTIMIZED;
+    }
+
+    uint64_t steady_start = now_in_nanos();
+    for (int i = 0; i < LOOP_CALLS; i++) {
+        bad += fn(LOOP_TRIPS) != expected;
+    }
+    out->steady_ns = (double) (now_in_nanos() - steady_start) / ((double) LOOP_CALLS * LOOP_TRIPS);
+
+    tb_jit_end(jit);
+    tb_module_destroy(m);
+    return bad;
+}
+
+typedef struct {
+    double miss_ns, hit_ns;
+} ResolveTimes;
+
+// these live in the host image, they're usually well out of rel32 range of the JIT heap
+static const char host_message[] = "hello from the host";
+static int resolver_calls;
+
+static int64_t host_scale(int64_t x) {
+    return x * 3;
+}
+
+static void* host_resolver(void* user_data, const char* name) {
+    resolver_calls += 1;
+    return strcmp(name, "host_scale") == 0 ? (void*) host_scale : NULL;
+}
+
+// resolvers are allowed to ask the JIT about other symbols
+static void* alias_resolver(void* user_data, const char* name) {
+    return strcmp(name, "scale_alias") == 0 ? tb_jit_resolve_symbol(user_data, "host_scale") : NULL;
+}
+
+// strlen(host_message) + host_message[1] + scale_ptr(x) where scale_ptr is a global
+// which points to host_scale, so every kind of resolver and relocation gets a go.
+static TB_Function* build_host_calls(TB_Module* m, TB_Arena* ir_arenas[2]) {
+    TB_External* strlen_sym = tb_extern_create(m, -1, "strlen", TB_EXTERNAL_SO_LOCAL);
+    TB_External* message_sym = tb_extern_create(m, -1, "host_message", TB_EXTERNAL_SO_LOCAL);
+    TB_External* scale_sym = tb_extern_create(m, -1, "host_scale", TB_EXTERNAL_SO_LOCAL);
+
+    TB_Global* scale_ptr = tb_global_create(m, -1, "scale_ptr", NULL, TB_LINKAGE_PRIVATE);
+    tb_global_set_storage(m, tb_module_get_data(m), scale_ptr, sizeof(void*), sizeof(void*), 1);
+    tb_global_add_symbol_reloc(m, scale_ptr, 0, (TB_Symbol*) scale_sym);
+
+    TB_PrototypeParam params[1] = { { TB_TYPE_I64 } };
+    TB_PrototypeParam ptr_param[1] = { { TB_TYPE_PTR } };
+    TB_FunctionPrototype* proto = tb_prototype_create(m, TB_CDECL, 1, params, 1, params, false);
+    TB_FunctionPrototype* strlen_proto = tb_prototype_create(m, TB_CDECL, 1, ptr_param, 1, params, false);
+
+    TB_Function* f = tb_function_create(m, -1, "host_calls", TB_LINKAGE_PUBLIC);
+    tb_function_set_arenas(f, ir_arenas[0], ir_arenas[1]);
+    tb_function_set_prototype(f, tb_module_get_text(m), proto);
+
+    TB_Node* msg = tb_inst_get_symbol_address(f, (TB_Symbol*) message_sym);
+    TB_Node* len = tb_inst_call(f, strlen_proto, tb_inst_get_symbol_address(f, (TB_Symbol*) strlen_sym), 1, &msg).single;
+    TB_Node* ch = tb_inst_load(f, TB_TYPE_I8, tb_inst_member_access(f, msg, 1), 1, false);
+
+    TB_Node* x = tb_inst_param(f, 0);
+    TB_Node* scale = tb_inst_load(f, TB_TYPE_PTR, tb_inst_get_symbol_address(f, (TB_Symbol*) scale_ptr), sizeof(void*), false);
+    TB_Node* scaled = tb_inst_call(f, proto, scale, 1, &x).single;
+
+    TB_Node* ret = tb_inst_add(f, tb_inst_add(f, len, tb_inst_zxt(f, ch, TB_TYPE_I64), 0), scaled, 0);
+    tb_inst_ret(f, 1, &ret);
+    return f;
+}
+
+// outer(x) = inner(x) + 1, inner(x) = late_scale(x) where nothing knows late_scale
+// at first, placing outer has to fail without leaving anything half placed.
+static TB_Function* build_undefined_calls(TB_Module* m, TB_Arena* ir_arenas[2], TB_Arena* code_arena) {
+    TB_External* late_sym = tb_extern_create(m, -1, "late_scale", TB_EXTERNAL_SO_LOCAL);
+
+    TB_PrototypeParam params[1] = { { TB_TYPE_I64 } };
+    TB_FunctionPrototype* proto = tb_prototype_create(m, TB_CDECL, 1, params, 1, params, false);
+
+    TB_Function* inner = tb_function_create(m, -1, "inner", TB_LINKAGE_PRIVATE);
+    tb_function_set_arenas(inner, ir_arenas[0], ir_arenas[1]);
+    tb_function_set_prototype(inner, tb_module_get_text(m), proto);
+    TB_Node* x = tb_inst_param(inner, 0);
+    TB_Node* ret = tb_inst_call(inner, proto, tb_inst_get_symbol_address(inner, (TB_Symbol*) late_sym), 1, &x).single;
+    tb_inst_ret(inner, 1, &ret);
+
+    TB_Function* outer = tb_function_create(m, -1, "outer", TB_LINKAGE_PUBLIC);
+    tb_function_set_arenas(outer, ir_arenas[0], ir_arenas[1]);
+    tb_function_set_prototype(outer, tb_module_get_text(m), proto);
+    x = tb_inst_param(outer, 0);
+    ret = tb_inst_call(outer, proto, tb_inst_get_symbol_address(outer, (TB_Symbol*) inner), 1, &x).single;
+    ret = tb_inst_add(outer, ret, tb_inst_sint(outer, TB_TYPE_I64, 1), 0);
+    tb_inst_ret(outer, 1, &ret);
+
+    TB_Worklist* ws = tb_worklist_alloc();
+    tb_opt(inner, ws, false);
+    tb_codegen(inner, ws, code_arena, NULL, false);
+    tb_opt(outer, ws, false);
+    tb_codegen(outer, ws, code_arena, NULL, false);
+    tb_worklist_free(ws);
+    return outer;
+}
+
+static int host_symbols(TB_JITFlags flags, ResolveTimes* out) {
+    TB_Module* m = tb_module_create_for_host(true);
+    TB_Arena* ir_arenas[2] = { tb_arena_create(0), tb_arena_create(0) };
+    TB_Arena* code_arena = tb_arena_create(0);
+    TB_Function* f = build_host_calls(m, ir_arenas);
+    TB_JIT* jit = tb_jit_begin_flags(m, 0, flags);
+
+    static const TB_JITSymbol table[] = {
+        { "host_message", (void*) host_message },
+    };
+    tb_jit_add_symbols(jit, 1, table);
+    tb_jit_add_resolver(jit, host_resolver, NULL);
+
+    TB_Worklist* ws = tb_worklist_alloc();
+    tb_opt(f, ws, false);
+    tb_codegen(f, ws, code_arena, NULL, false);
+    tb_worklist_free(ws);
+
+    int64_t (*fn)(int64_t) = tb_jit_place_function(jit, f);
+    int bad = fn(7) != (int64_t) (strlen(host_message) + host_message[1] + host_scale(7));
+
+    // the table answers for host_message before the resolver's asked, host_scale
+    // only gets asked for once.
+    bad += resolver_calls != 2;
+    bad += tb_jit_resolve_symbol(jit, "host_scale") != (void*) host_scale;
+    bad += tb_jit_resolve_symbol(jit, "not_a_real_symbol") != NULL;
+    bad += resolver_calls != 3;
+
+    // this one calls back into the JIT (it'd deadlock if resolvers ran under the lock)
+    tb_jit_add_resolver(jit, alias_resolver, jit);
+    bad += tb_jit_resolve_symbol(jit, "scale_alias") != (void*) host_scale;
+
+    // placement fails up front, once something knows the symbol it goes through
+    TB_Function* outer = build_undefined_calls(m, ir_arenas, code_arena);
+    bad += tb_jit_place_function(jit, outer) != NULL;
+    bad += tb_jit_get_undefined(jit) == NULL || strcmp(tb_jit_get_undefined(jit), "late_scale") != 0;
+    bad += tb_jit_get_code_ptr(outer) != NULL;
+
+    static const TB_JITSymbol late[] = {
+        { "late_scale", (void*) host_scale },
+    };
+    tb_jit_add_symbols(jit, 1, late);
+    int64_t (*outer_fn)(int64_t) = tb_jit_place_function(jit, outer);
+    bad += outer_fn == NULL || outer_fn(5) != host_scale(5) + 1;
+
+    // misses walk the whole chain (resolver, dlsym & libraries), hits are one lookup
+    enum { LOOKUPS = 1 << 12 };
+    uint64_t start = now_in_nanos();
+    for (int i = 0; i < LOOKUPS; i++) {
+        bad += tb_jit_resolve_symbol(jit, "not_a_real_symbol") != NULL;
+    }
+    out->miss_ns = (double) (now_in_nanos() - start) / LOOKUPS;
+
+    start = now_in_nanos();
+    for (int i = 0; i < LOOKUPS; i++) {
+        bad += tb_jit_resolve_symbol(jit, "host_scale") != (void*) host_scale;
+    }
+    out->hit_ns = (double) (now_in_nanos() - start) / LOOKUPS;
+
+    tb_jit_end(jit);
+    tb_module_destroy(m);
+    return bad;
+}
+
+typedef struct {
+    // hashing the IR, opt + codegen on a miss & reading the entry back on a hit
+    double key_us, compile_us, load_us;
+} CacheTimes;
+
+static int code_cache(TB_JITFlags flags, CacheTimes* out) {
+    const char* tmp = getenv("TMPDIR");
+    if (tmp == NULL) tmp = getenv("TEMP");
+    if (tmp == NULL) tmp = ".";
+
+    char dir[FILENAME_MAX];
+    snprintf(dir, sizeof(dir), "%s/tb_jit_bench_cache", tmp);
+
+    // so we never hit on whatever an older run left behind
+    uint64_t nonce = now_in_nanos();
+    TB_CacheKey keys[2];
+    int bad = 0;
+
+    // cold: misses, compiles and fills the cache
+    {
+        TB_Module* m = tb_module_create_for_host(true);
+        TB_Arena* ir_arenas[2] = { tb_arena_create(0), tb_arena_create(0) };
+        TB_Arena* code_arena = tb_arena_create(0);
+        TB_Function* f = build_host_calls(m, ir_arenas);
+
+        uint64_t start = now_in_nanos();
+        bad += !tb_cache_key(f, code_arena, NULL, &keys[0]);
+        tb_cache_key_salt(&keys[0], sizeof(nonce), &nonce);
+        out->key_us = (now_in_nanos() - start) / 1000.0;
+        bad += tb_cache_load(dir, &keys[0], f, code_arena);
+
+        start = now_in_nanos();
+        TB_Worklist* ws = tb_worklist_alloc();
+        tb_opt(f, ws, false);
+        tb_codegen(f, ws, code_arena, NULL, false);
+        tb_worklist_free(ws);
+        out->compile_us = (now_in_nanos() - start) / 1000.0;
+
+        bad += !tb_cache_store(dir, &keys[0], f);
+        tb_module_destroy(m);
+    }
+
+    // warm: the same IR in a fresh module never sees the optimizer or codegen
+    {
+        TB_Module* m = tb_module_create_for_host(true);
+        TB_Arena* ir_arenas[2] = { tb_arena_create(0), tb_arena_create(0) };
+        TB_Arena* code_arena = tb_arena_create(0);
+        TB_Function* f = build_host_calls(m, ir_arenas);
+
+        bad += !tb_cache_key(f, code_arena, NULL, &keys[1]);
+        tb_cache_key_salt(&keys[1], sizeof(nonce), &nonce);
+        bad += memcmp(keys[0].hash, keys[1].hash, sizeof(keys[0].hash)) != 0;
+
+        uint64_t start = now_in_nanos();
+        bad += !tb_cache_load(dir, &keys[1], f, code_arena);
+        out->load_us = (now_in_nanos() - start) / 1000.0;
+
+        // relocations get bound to this module's symbols
+        TB_JIT* jit = tb_jit_begin_flags(m, 0, flags);
+        static const TB_JITSymbol table[] = {
+            { "host_message", (void*) host_message },
+        };
+        tb_jit_add_symbols(jit, 1, table);
+        tb_jit_add_resolver(jit, host_resolver, NULL);
+
+        int64_t (*fn)(int64_t) = tb_jit_place_function(jit, f);
+        bad += fn(7) != (int64_t) (strlen(host_message) + host_message[1] + host_scale(7));
+
+        // different IR, different key
+        TB_CacheKey other;
+        TB_Function* g = build_hot_loop(m, ir_arenas, false);
+        bad += !tb_cache_key(g, code_arena, NULL, &other);
+        tb_cache_key_salt(&other, sizeof(nonce), &nonce);
+        bad += tb_cache_load(dir, &other, g, code_arena);
+
+        tb_jit_end(jit);
+        tb_module_destroy(m);
+    }
+
+    char path[FILENAME_MAX + 40];
+    int len = snprintf(path, sizeof(path), "%s/", dir);
+    for (int i = 0; i < 16; i++) {
+        len += snprintf(&path[len], sizeof(path) - len, "%02x", keys[1].hash[i]);
+    }
+    remove(path);
+    remove(dir);
+    return bad;
+}
+
+typedef struct {
+    // per function, placing it again after the first round vs unplacing it
+    double place_ns, unplace_ns;
+    // after the first round and the last one
+    size_t first_mapped, last_mapped;
+    double fragmentation;
+} GCTimes;
+
+// g(x) = callee(x) + 1, called directly once it's placed
+static TB_Function* build_caller(TB_Module* m, TB_Arena* ir_arenas[2], TB_Function* callee) {
+    TB_PrototypeParam param = { TB_TYPE_I64 };
+    TB_FunctionPrototype* proto = tb_prototype_create(m, TB_CDECL, 1, &param, 1, &param, false);
+
+    TB_Function* f = tb_function_create(m, -1, "caller", TB_LINKAGE_PUBLIC);
+    tb_function_set_arenas(f, ir_arenas[0], ir_arenas[1]);
+    tb_function_set_prototype(f, tb_module_get_text(m), proto);
+
+    TB_Node* x = tb_inst_param(f, 0);
+    TB_Node* v = tb_inst_call(f, proto, tb_inst_get_symbol_address(f, (TB_Symbol*) callee), 1, &x).single;
+    v = tb_inst_add(f, v, tb_inst_sint(f, TB_TYPE_I64, 1), 0);
+    tb_inst_ret(f, 1, &v);
+    return f;
+}
+
+typedef struct {
+    TB_JIT* jit;
+    TB_Function* f;
+} PlaceOne;
+
+static int place_one_main(void* arg) {
+    PlaceOne* p = arg;
+    tb_jit_place_function(p->jit, p->f);
+    return 0;
+}
+
+static int gc(TB_JITFlags flags, GCTimes* out) {
+    enum { ROUNDS = 8 };
+
+    TB_Module* m = tb_module_create_for_host(true);
+    TB_Arena* ir_arenas[2] = { tb_arena_create(0), tb_arena_create(0) };
+    TB_Arena* code_arena = tb_arena_create(0);
+    TB_Function** funcs = compile_funcs(m);
+
+    TB_Function* g = build_caller(m, ir_arenas, funcs[5]);
+    TB_Worklist* ws = tb_worklist_alloc();
+    tb_opt(g, ws, false);
+    tb_codegen(g, ws, code_arena, NULL, false);
+    tb_worklist_free(ws);
+
+    // pointers to the callee in a global, one past 4GiB and one negative
+    static const int64_t offsets[2] = { 1ll << 32, -16 };
+    TB_Global* table = tb_global_create(m, -1, "table", NULL, TB_LINKAGE_PRIVATE);
+    tb_global_set_storage(m, tb_module_get_data(m), table, sizeof(offsets), sizeof(void*), 3);
+    memcpy(tb_global_add_region(m, table, 0, sizeof(offsets)), offsets, sizeof(offsets));
+    tb_global_add_symbol_reloc(m, table, 0, (TB_Symbol*) funcs[5]);
+    tb_global_add_symbol_reloc(m, table, 8, (TB_Symbol*) funcs[5]);
+
+    // small capacity so reuse matters
+    TB_JIT* jit = tb_jit_begin_flags(m, 256*1024, flags);
+    int64_t (*caller)(int64_t) = tb_jit_place_function(jit, g);
+    int bad = caller(7) != 7*8 + 5 + 1;
+    intptr_t* ptrs = tb_jit_place_global(jit, table);
+
+    // the caller goes through the stub which places it again, the old code
+    // stays around while someone could still be in it. the pointers get sent
+    // to the stub with their offsets intact.
+    uint32_t epoch = tb_jit_enter(jit);
+    tb_jit_unplace_function(jit, funcs[5]);
+    bad += tb_jit_get_code_ptr(funcs[5]) != NULL;
+    for (int i = 0; i < 2; i++) {
+        int64_t (*fn)(int64_t) = (void*) (ptrs[i] - offsets[i]);
+        bad += fn(7) != 7*8 + 5;
+    }
+    bad += caller(7) != 7*8 + 5 + 1;
+    bad += tb_jit_get_code_ptr(funcs[5]) == NULL;
+    bad += tb_jit_collect(jit) == 0;
+    tb_jit_exit(jit, epoch);
+    bad += tb_jit_collect(jit) != 0;
+
+    TB_JITHeapStats stats;
+    uint64_t place_time = 0, unplace_time = 0;
+    for (int r = 0; r < ROUNDS; r++) {
+        uint64_t start = now_in_nanos();
+        for (int i = 0; i < FUNC_COUNT; i++) {
+            tb_jit_place_function(jit, funcs[i]);
+        }
+        uint64_t mid = now_in_nanos();
+
+        tb_jit_heap_stats(jit, &stats);
+        bad += stats.placed_functions != FUNC_COUNT + 1;
+        bad += caller(7) != 7*8 + 5 + 1;
+        for (int i = r; i < FUNC_COUNT; i += 97) {
+            int64_t (*fn)(int64_t) = tb_jit_get_code_ptr(funcs[i]);
+            bad += fn(7) != 7*(i + 3) + i;
+        }
+
+        if (r == 0) {
+            out->first_mapped = stats.mapped;
+        } else {
+            place_time += mid - start;
+        }
+
+        start = now_in_nanos();
+        for (int i = 0; i < FUNC_COUNT; i++) {
+            tb_jit_unplace_function(jit, funcs[i]);
+        }
+        unplace_time += now_in_nanos() - start;
+        bad += tb_jit_collect(jit) != 0;
+    }
+
+    tb_jit_heap_stats(jit, &stats);
+    bad += stats.placed_functions != 1 || stats.retired_objects != 0;
+    out->last_mapped = stats.mapped;
+    out->fragmentation = stats.fragmentation;
+    out->place_ns = (double) place_time / ((ROUNDS - 1) * FUNC_COUNT);
+    out->unplace_ns = (double) unplace_time / (ROUNDS * FUNC_COUNT);
+
+    // whatever the first round needed is all it ever needs (give or take
+    // the chunk we're bumping through)
+    bad += out->last_mapped > out->first_mapped + 256*1024;
+
+    // a thread which bounces between JITs (or exits) gives up its code chunk each
+    // time, those have to go away once nothing's placed in them.
+    TB_JIT* other = tb_jit_begin_flags(m, 256*1024, flags);
+    for (int i = 0; i < CHURN_COUNT; i += 2) {
+        tb_jit_place_function(jit, funcs[i]);
+        tb_jit_place_function(other, funcs[i + 1]);
+    }
+
+    thrd_t thread;
+    PlaceOne p = { other, funcs[CHURN_COUNT] };
+    thrd_create(&thread, place_one_main, &p);
+    thrd_join(thread, NULL);
+
+    for (int i = 0; i < CHURN_COUNT; i += 2) {
+        tb_jit_unplace_function(jit, funcs[i]);
+        tb_jit_unplace_function(other, funcs[i + 1]);
+    }
+    tb_jit_unplace_function(other, funcs[CHURN_COUNT]);
+    bad += tb_jit_collect(jit) != 0 || tb_jit_collect(other) != 0;
+
+    // the caller's chunk and the one we're still bumping through in other are
+    // all that's left.
+    tb_jit_heap_stats(jit, &stats);
+    bad += stats.code_bytes > 64*1024;
+    tb_jit_heap_stats(other, &stats);
+    bad += stats.code_bytes > 64*1024;
+    tb_jit_end(other);
+
+    tb_jit_end(jit);
+    tb_module_destroy(m);
+    free(funcs);
+    return bad;
+}
+
+#ifdef __linux__
+// GDB's side of the JIT interface, the layout is fixed by GDB
+struct jit_code_entry {
+    struct jit_code_entry* next_entry;
+    struct jit_code_entry* prev_entry;
+    const char* symfile_addr;
+    uint64_t symfile_size;
+};
+
+extern struct {
+    uint32_t version;
+    uint32_t action_flag;
+    struct jit_code_entry* relevant_entry;
+    struct jit_code_entry* first_entry;
+} __jit_debug_descriptor;
+
+typedef struct {
+    // per function placed, with none of the debug flags vs all of them
+    double plain_ns, debug_ns;
+} DebugTimes;
+
+// p[0] = x*3; then p[1] = x+7; return p[0] + p[1]; on the next line
+static TB_Function* build_debug_lines(TB_Module* m, TB_Arena* ir_arenas[2]) {
+    TB_PrototypeParam params[2] = { { TB_TYPE_PTR }, { TB_TYPE_I64 } };
+    TB_FunctionPrototype* proto = tb_prototype_create(m, TB_CDECL, 2, params, 1, &params[1], false);
+    TB_SourceFile* file = tb_get_source_file(m, -1, "jit_bench_lines.c");
+
+    TB_Function* f = tb_function_create(m, -1, "debug_lines", TB_LINKAGE_PUBLIC);
+    tb_function_set_arenas(f, ir_arenas[0], ir_arenas[1]);
+    tb_function_set_prototype(f, tb_module_get_text(m), proto);
+
+    TB_Node* p = tb_inst_param(f, 0);
+    TB_Node* x = tb_inst_param(f, 1);
+
+    tb_inst_location(f, file, 10, 5);
+    TB_Node* a = tb_inst_mul(f, x, tb_inst_sint(f, TB_TYPE_I64, 3), 0);
+    tb_inst_store(f, TB_TYPE_I64, p, a, 8, false);
+
+    tb_inst_location(f, file, 11, 5);
+    TB_Node* b = tb_inst_add(f, x, tb_inst_sint(f, TB_TYPE_I64, 7), 0);
+    tb_inst_store(f, TB_TYPE_I64, tb_inst_member_access(f, p, 8), b, 8, false);
+
+    TB_Node* ret = tb_inst_add(f, a, b, 0);
+    tb_inst_ret(f, 1, &ret);
+    return f;
+}
+
+static char* read_file(const char* path, size_t* out_size) {
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL) {
+        return NULL;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    size_t size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    char* data = malloc(size + 1);
+    size = fread(data, 1, size, fp);
+    data[size] = 0;
+    fclose(fp);
+
+    *out_size = size;
+    return data;
+}
+
+static bool contains(const char* data, size_t size, const void* needle, size_t len) {
+    for (size_t i = 0; i + len <= size; i++) {
+        if (memcmp(&data[i], needle, len) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int debug_info(TB_JITFlags flags, DebugTimes* out) {
+    const char* tmp = getenv("TMPDIR");
+    if (tmp == NULL) tmp = "/tmp";
+    setenv("JITDUMPDIR", tmp, 1);
+
+    TB_JITFlags debug_flags = TB_JIT_PERF_MAP | TB_JIT_PERF_JITDUMP | TB_JIT_GDB;
+    struct jit_code_entry* old_first = __jit_debug_descriptor.first_entry;
+    int bad = 0;
+
+    {
+        TB_Module* m = tb_module_create_for_host(true);
+        TB_Arena* ir_arenas[2] = { tb_arena_create(0), tb_arena_create(0) };
+        TB_Arena* code_arena = tb_arena_create(0);
+        TB_Function* f = build_debug_lines(m, ir_arenas);
+
+        // no tb_opt, it drops the locations (it's how the baseline tier compiles)
+        TB_Worklist* ws = tb_worklist_alloc();
+        TB_FunctionOutput* out_f = tb_codegen(f, ws, code_arena, NULL, false);
+        tb_worklist_free(ws);
+
+        size_t loc_count, code_size;
+        tb_output_get_locations(out_f, &loc_count);
+        tb_output_get_code(out_f, &code_size);
+        bad += loc_count != 2;
+
+        TB_JIT* jit = tb_jit_begin_flags(m, 0, flags | debug_flags);
+        int64_t (*fn)(int64_t*, int64_t) = tb_jit_place_function(jit, f);
+
+        int64_t slots[2];
+        bad += fn(slots, 5) != 15 + 12 || slots[0] != 15 || slots[1] != 12;
+
+        // GDB: the newest entry is ours, an ELF with the symbol & line table's file
+        struct jit_code_entry* e = __jit_debug_descriptor.first_entry;
+        bad += e == NULL || e->next_entry != old_first || __jit_debug_descriptor.relevant_entry != e;
+        if (e) {
+            bad += e->symfile_size < 64 || memcmp(e->symfile_addr, "\x7F" "ELF", 4) != 0;
+            bad += !contains(e->symfile_addr, e->symfile_size, "debug_lines", 12);
+            bad += !contains(e->symfile_addr, e->symfile_size, "jit_bench_lines.c", 18);
+
+            // readelf -wl (or gdb's add-symbol-file) on this should make sense
+            const char* elf_path = getenv("JIT_BENCH_ELF");
+            if (elf_path) {
+                FILE* fp = fopen(elf_path, "wb");
+                fwrite(e->symfile_addr, 1, e->symfile_size, fp);
+                fclose(fp);
+            }
+        }
+
+        // perf map: "<start> <size> debug_lines"
+        char path[FILENAME_MAX], line[64];
+        size_t size;
+        snprintf(path, sizeof(path), "/tmp/perf-%d.map", (int) getpid());
+        int len = snprintf(line, sizeof(line), "%" PRIxPTR " %x debug_lines\n", (uintptr_t) fn, (unsigned) code_size);
+        char* data = read_file(path, &size);
+        bad += data == NULL || !contains(data, size, line, len);
+        free(data);
+
+        // jitdump: the header & our code bytes
+        snprintf(path, sizeof(path), "%s/jit-%d.dump", tmp, (int) getpid());
+        data = read_file(path, &size);
+        bad += data == NULL || size < 40 || memcmp(data, "DTiJ", 4) != 0;
+        bad += data == NULL || !contains(data, size, (void*) fn, code_size);
+        free(data);
+
+        // and GDB forgets about it once the code's gone
+        tb_jit_unplace_function(jit, f);
+        bad += __jit_debug_descriptor.first_entry != old_first;
+        tb_jit_end(jit);
+        bad += __jit_debug_descriptor.first_entry != old_first;
+        tb_module_destroy(m);
+    }
+
+    for (int pass = 0; pass < 2; pass++) {
+        TB_Module* m = tb_module_create_for_host(true);
+        TB_Function** funcs = compile_funcs(m);
+        TB_JIT* jit = tb_jit_begin_flags(m, 0, pass ? flags | debug_flags : flags);
+
+        uint64_t start = now_in_nanos();
+        for (int i = 0; i < FUNC_COUNT; i++) {
+            tb_jit_place_function(jit, funcs[i]);
+        }
+        double ns = (double) (now_in_nanos() - start) / FUNC_COUNT;
+        *(pass ? &out->debug_ns : &out->plain_ns) = ns;
+
+        for (int i = 0; i < FUNC_COUNT; i += 97) {
+            int64_t (*fn)(int64_t) = tb_jit_get_code_ptr(funcs[i]);
+            bad += fn(7) != 7*(i + 3) + i;
+        }
+
+        tb_jit_end(jit);
+        tb_module_destroy(m);
+        free(funcs);
+    }
+    bad += __jit_debug_descriptor.first_entry != old_first;
+
+    char path[FILENAME_MAX];
+    snprintf(path, sizeof(path), "/tmp/perf-%d.map", (int) getpid());
+    remove(path);
+    snprintf(path, sizeof(path), "%s/jit-%d.dump", tmp, (int) getpid());
+    remove(path);
+    return bad;
+}
+#endif
+
+#if defined(__x86_64__) && defined(__linux__)
+typedef struct {
+    // per trip, plain call vs polling on a JIT thread
+    double plain_ns;
+    double poll_ns;
+    // from tb_jit_thread_interrupt to being back in the host
+    double interrupt_us;
+    // breakpoint stops on the poll after the interrupt
+    int bp_hits;
+} PollTimes;
+
+typedef struct {
+    TB_CPUContext* cpu;
+    _Atomic(uint64_t) when;
+} Interrupter;
+
+static int interrupter_main(void* arg) {
+    Interrupter* in = arg;
+    thrd_sleep(&(struct timespec){ .tv_nsec = 1000000 }, NULL);
+    atomic_store(&in->when, now_in_nanos());
+    tb_jit_thread_interrupt(in->cpu);
+    return 0;
+}
+
+static int safepoints(TB_JITFlags flags, PollTimes* out) {
+    TB_Module* m = tb_module_create_for_host(true);
+    TB_Arena* ir_arenas[2] = { tb_arena_create(0), tb_arena_create(0) };
+    TB_Arena* code_arena = tb_arena_create(0);
+    TB_Function* plain = build_hot_loop(m, ir_arenas, false);
+    TB_Function* polled = build_hot_loop(m, ir_arenas, true);
+    TB_JIT* jit = tb_jit_begin_flags(m, 0, flags);
+
+    TB_Worklist* ws = tb_worklist_alloc();
+    TB_Function* funcs[2] = { plain, polled };
+    TB_FunctionOutput* outs[2];
+    for (int i = 0; i < 2; i++) {
+        tb_opt(funcs[i], ws, false);
+        outs[i] = tb_codegen(funcs[i], ws, code_arena, NULL, false);
+    }
+    tb_worklist_free(ws);
+
+    int64_t (*plain_fn)(int64_t) = tb_jit_place_function(jit, plain);
+    char* polled_fn = tb_jit_place_function(jit, polled);
+
+    TB_CPUContext* cpu = tb_jit_thread_create(jit, 0);
+    void* poll_site = (char*) cpu + tb_jit_thread_pollsite();
+
+    int bad = 0;
+    int64_t expected = hot_loop_eval(LOOP_TRIPS);
+    uint64_t start = now_in_nanos();
+    for (int i = 0; i < LOOP_CALLS; i++) {
+        bad += plain_fn(LOOP_TRIPS) != expected;
+    }
+    out->plain_ns = (double) (now_in_nanos() - start) / ((double) LOOP_CALLS * LOOP_TRIPS);
+
+    start = now_in_nanos();
+    for (int i = 0; i < LOOP_CALLS; i++) {
+        uint64_t ret;
+        void* args[2] = { (void*) (intptr_t) LOOP_TRIPS, poll_site };
+        bad += tb_jit_thread_call(cpu, polled_fn, &ret, 2, args) || ret != expected;
+    }
+    out->poll_ns = (double) (now_in_nanos() - start) / ((double) LOOP_CALLS * LOOP_TRIPS);
+
+    // interrupt a long run from another thread then let it finish
+    {
+        Interrupter in = { cpu };
+        thrd_t t;
+        thrd_create(&t, interrupter_main, &in);
+
+        uint64_t ret = 0;
+        void* args[2] = { (void*) (intptr_t) (LOOP_TRIPS * 1024ll), poll_site };
+        bool stopped = tb_jit_thread_call(cpu, polled_fn, &ret, 2, args);
+        uint64_t end = now_in_nanos();
+        thrd_join(t, NULL);
+
+        out->interrupt_us = (end - atomic_load(&in.when)) / 1000.0;
+        bad += !stopped || tb_jit_thread_resume(cpu, &ret) || ret != hot_loop_eval(LOOP_TRIPS * 1024ll);
+    }
+
+    // stop on the first poll, put a breakpoint there and it should stop on
+    // every trip after that.
+    {
+        enum { TRIPS = 16 };
+        uint64_t ret = 0;
+        void* args[2] = { (void*) (intptr_t) TRIPS, poll_site };
+        tb_jit_thread_interrupt(cpu);
+        bad += !tb_jit_thread_call(cpu, polled_fn, &ret, 2, args);
+
+        void* pc = tb_jit_thread_pc(cpu);
+        tb_jit_breakpoint(jit, pc);
+
+        out->bp_hits = 0;
+        while (tb_jit_thread_resume(cpu, &ret)) {
+            bad += tb_jit_thread_pc(cpu) != pc;
+            out->bp_hits += 1;
+        }
+        bad += out->bp_hits != TRIPS - 1 || ret != hot_loop_eval(TRIPS);
+
+        // single-step the whole thing from the first poll
+        tb_jit_thread_interrupt(cpu);
+        bad += !tb_jit_thread_call(cpu, polled_fn, &ret, 2, args);
+        ret = 0;
+
+        size_t size;
+        tb_output_get_code(outs[1], &size);
+        bad += !tb_jit_thread_step(cpu, &ret, (uintptr_t) polled_fn, (uintptr_t) polled_fn + size) || ret != hot_loop_eval(TRIPS);
+    }
+
+    tb_jit_thread_destroy(cpu);
+    tb_jit_end(jit);
+    tb_module_destroy(m);
+    return bad;
+}
+#endif
+
+// usage: jit_bench [max threads] [-dual] [-dump]
+int main(int argc, char** argv) {
+    int max_threads = 8;
+    bool dump = false;
+    TB_JITFlags flags = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-dual") == 0) {
+            flags |= TB_JIT_DUAL_MAP;
+        } else if (strcmp(argv[i], "-dump") == 0) {
+            dump = true;
+        } else {
+            max_threads = atoi(argv[i]);
+        }
+    }
+
+    if (max_threads < 1) max_threads = 1;
+    if (max_threads > MAX_THREADS) max_threads = MAX_THREADS;
+
+    int failed = 0;
+    {
+        double eager_ms, lazy_ms, tiered_ms;
+        int eager_compiled, lazy_compiled, tiered_compiled;
+        int bad = first_call(MODE_EAGER, flags, &eager_ms, &eager_compiled);
+        bad += first_call(MODE_LAZY, flags, &lazy_ms, &lazy_compiled);
+        bad += first_call(MODE_TIERED, flags, &tiered_ms, &tiered_compiled);
+
+        printf("first call: funcs=%d  eager: %8.3f ms (%4d compiled)  lazy: %8.3f ms (%4d compiled)  tiered: %8.3f ms (%4d compiled)  %s\n", TREE_COUNT, eager_ms, eager_compiled, lazy_ms, lazy_compiled, tiered_ms, tiered_compiled, bad ? "FAILED" : "OK");
+        failed += bad;
+    }
+
+    {
+        LoopTimes opt, baseline, tiered, late;
+        int bad = hot_loop(MODE_EAGER, 0, flags, &opt);
+        bad += hot_loop(MODE_TIERED, 0, flags, &baseline);
+        bad += hot_loop(MODE_TIERED, 10000, flags, &tiered);
+        bad += hot_loop(MODE_LAZY, 10000, flags, &late);
+
+        printf("hot loop:   first call  optimized: %6.3f ms  baseline: %6.3f ms\n", opt.first_ms, baseline.first_ms);
+        printf("            steady      optimized: %6.3f ns/trip  baseline: %6.3f ns/trip  tiered: %6.3f ns/trip (after %d calls)  tiered over lazy: %6.3f ns/trip (after %d calls)  %s\n", opt.steady_ns, baseline.steady_ns, tiered.steady_ns, tiered.warmup_calls, late.steady_ns, late.warmup_calls, bad ? "FAILED" : "OK");
+        failed += bad;
+    }
+
+    {
+        ResolveTimes rt;
+        int bad = host_symbols(flags, &rt);
+        printf("host symbols: resolve  miss: %6.0f ns  hit: %6.0f ns  %s\n", rt.miss_ns, rt.hit_ns, bad ? "FAILED" : "OK");
+        failed += bad;
+    }
+
+    {
+        CacheTimes ct;
+        int bad = code_cache(flags, &ct);
+        printf("code cache: key: %8.3f us  compile: %8.3f us  load: %8.3f us  %s\n", ct.key_us, ct.compile_us, ct.load_us, bad ? "FAILED" : "OK");
+        failed += bad;
+    }
+
+    {
+        GCTimes gt = { 0 };
+        int bad = gc(flags, &gt);
+        printf("gc: place again: %6.0f ns/func  unplace: %6.0f ns/func  mapped: %zu KiB -> %zu KiB (%.0f%% fragmented)  %s\n", gt.place_ns, gt.unplace_ns, gt.first_mapped / 1024, gt.last_mapped / 1024, gt.fragmentation * 100.0, bad ? "FAILED" : "OK");
+        failed += bad;
+    }
+
+    #ifdef __linux__
+    {
+        DebugTimes dt;
+        int bad = debug_info(flags, &dt);
+        printf("debug info: place  plain: %6.0f ns/func  perf+gdb: %6.0f ns/func  %s\n", dt.plain_ns, dt.debug_ns, bad ? "FAILED" : "OK");
+        failed += bad;
+    }
+    #endif
+
+    #if defined(__x86_64__) && defined(__linux__)
+    {
+        PollTimes pt;
+        int bad = safepoints(flags, &pt);
+        printf("safepoints: plain: %6.3f ns/trip  polled: %6.3f ns/trip  interrupt: %8.3f us  breakpoint hits: %d  %s\n", pt.plain_ns, pt.poll_ns, pt.interrupt_us, pt.bp_hits, bad ? "FAILED" : "OK");
+        failed += bad;
+    }
+    #endif
+
+    for (int t = 1; t <= max_threads; t *= 2) {
+        TB_Module* m = tb_module_create_for_host(true);
+        TB_Function** funcs = compile_funcs(m);
+        _Atomic(void*)* placed = calloc(FUNC_COUNT, sizeof(void*));
+
+        // small capacity so we see the heap grow
+        TB_JIT* jit = tb_jit_begin_flags(m, 256*1024, flags);
+
+        Worker workers[MAX_THREADS];
+        Resolver resolvers[MAX_THREADS];
+        thrd_t threads[MAX_THREADS], resolver_threads[MAX_THREADS];
+
+        atomic_bool done = false;
+        for (int i = 0; i < t; i++) {
+            resolvers[i] = (Resolver){ jit, funcs, placed, &done, i + 1 };
+            thrd_create(&resolver_threads[i], resolver_main, &resolvers[i]);
+        }
+
+        uint64_t start = now_in_nanos();
+        for (int i = 0; i < t; i++) {
+            workers[i] = (Worker){ jit, funcs, placed, i, t };
+            thrd_create(&threads[i], worker_main, &workers[i]);
+        }
+
+        for (int i = 0; i < t; i++) {
+            thrd_join(threads[i], NULL);
+        }
+        uint64_t elapsed = now_in_nanos() - start;
+
+        atomic_store(&done, true);
+        uint64_t lookups = 0, bad_lookups = 0;
+        for (int i = 0; i < t; i++) {
+            thrd_join(resolver_threads[i], NULL);
+            lookups += resolvers[i].lookups;
+            bad_lookups += resolvers[i].bad;
+        }
+
+        // uncontended resolves
+        uint64_t resolve_start = now_in_nanos();
+        for (int i = 0; i < MIN_LOOKUPS; i++) {
+            uint32_t offset;
+            char* fn = placed[(i * 7919) % FUNC_COUNT];
+            bad_lookups += tb_jit_resolve_addr(jit, fn + 1, &offset) != funcs[(i * 7919) % FUNC_COUNT];
+        }
+        uint64_t resolve_elapsed = now_in_nanos() - resolve_start;
+
+        int bad = bad_lookups != 0;
+        for (int i = 0; i < FUNC_COUNT; i++) {
+            int64_t (*fn)(int64_t) = placed[i];
+            if (fn == NULL || fn(7) != 7*(i + 3) + i) {
+                bad++;
+            }
+        }
+
+        printf("threads=%-2d funcs=%d  place: %8.3f ms (%6.0f ns/func)  resolve: %4.0f ns (%llu concurrent)  %s\n", t, FUNC_COUNT, elapsed / 1000000.0, (double) elapsed / FUNC_COUNT, (double) resolve_elapsed / MIN_LOOKUPS, (unsigned long long) lookups, bad ? "FAILED" : "OK");
+        if (dump) {
+            tb_jit_dump_heap(jit);
+        }
+
+        failed += bad;
+        tb_jit_end(jit);
+        tb_module_destroy(m);
+        free((void*) placed);
+        free(funcs);
+    }
+
+    return failed != 0;
+}
@@ -0,0 +1,295 @@
+// Register allocator regression tests
+//   each case is a shape which used to come out of the Rogers allocator wrong,
+//   they get JIT'd on the host and their results checked against plain C. Where
+//   the old output was only worse (not wrong) the RA stats are checked instead.
+#include <tb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+enum {
+    CASES = 4,
+    LEN   = 40,
+};
+
+static int64_t table[8] = { 5, 7, 11, 13, 17, 19, 23, 29 };
+
+static const char message[] = "hello";
+static int64_t length(const char* str) { return strlen(str); }
+static int64_t twice(int64_t x) { return x * 2; }
+
+static TB_Function* declare(TB_Module* m, const char* name, TB_FunctionPrototype* proto) {
+    TB_Function* f = tb_function_create(m, -1, name, TB_LINKAGE_PUBLIC);
+    tb_function_set_arenas(f, tb_arena_create(0), tb_arena_create(0));
+    tb_function_set_prototype(f, tb_module_get_text(m), proto);
+    return f;
+}
+
+// phi_copy(k): switch (k) { case i: return (uint64_t) k ^ (1000 + i); default: trap }
+//   the copy into the return register used to get coalesced into the phi, which
+//   pinned the phi to RAX and left one move per case instead of one at the join.
+static void build_phi_copy(TB_Function* f) {
+    TB_Node* key = tb_inst_param(f, 0);
+    TB_Node* def = tb_inst_region(f);
+    TB_Node* arms[CASES];
+    TB_SwitchEntry entries[CASES];
+    for (int i = 0; i < CASES; i++) {
+        arms[i] = tb_inst_region(f);
+        entries[i] = (TB_SwitchEntry){ i, arms[i] };
+    }
+    tb_inst_branch(f, TB_TYPE_I32, key, def, CASES, entries);
+
+    for (int i = 0; i < CASES; i++) {
+        tb_inst_set_control(f, arms[i]);
+        TB_Node* v = tb_inst_xor(f, tb_inst_zxt(f, key, TB_TYPE_I64), tb_inst_sint(f, TB_TYPE_I64, 1000 + i));
+        tb_inst_ret(f, 1, &v);
+    }
+
+    tb_inst_set_control(f, def);
+    tb_inst_trap(f);
+}
+
+// table_sum(a, n): s = 1, i = 0; do { s += a[i] + table[i & 7]; } while (++i < n); return s
+//   the last add folds the table load and flows into the return so it's pre-colored
+//   to RAX, the table's lea feeds that load and used to be handed RAX too.
+static void build_table_sum(TB_Function* f, TB_Global* g) {
+    TB_Node* a = tb_inst_param(f, 0);
+    TB_Node* n = tb_inst_param(f, 1);
+    TB_Node* s = tb_inst_local(f, 8, 8);
+    TB_Node* i = tb_inst_local(f, 8, 8);
+    tb_inst_store(f, TB_TYPE_I64, s, tb_inst_sint(f, TB_TYPE_I64, 1), 8, false);
+    tb_inst_store(f, TB_TYPE_I64, i, tb_inst_sint(f, TB_TYPE_I64, 0), 8, false);
+
+    TB_Node* body = tb_inst_region(f);
+    TB_Node* exit = tb_inst_region(f);
+    tb_inst_goto(f, body);
+
+    tb_inst_set_control(f, body);
+    TB_Node* iv = tb_inst_load(f, TB_TYPE_I64, i, 8, false);
+    TB_Node* x = tb_inst_load(f, TB_TYPE_I64, tb_inst_array_access(f, a, iv, 8), 8, false);
+    TB_Node* slot = tb_inst_array_access(f, tb_inst_get_symbol_address(f, (TB_Symbol*) g), tb_inst_and(f, iv, tb_inst_sint(f, TB_TYPE_I64, 7)), 8);
+    TB_Node* t = tb_inst_load(f, TB_TYPE_I64, slot, 8, false);
+    TB_Node* sv = tb_inst_add(f, tb_inst_load(f, TB_TYPE_I64, s, 8, false), x, 0);
+    tb_inst_store(f, TB_TYPE_I64, s, tb_inst_add(f, sv, t, 0), 8, false);
+
+    TB_Node* next = tb_inst_add(f, iv, tb_inst_sint(f, TB_TYPE_I64, 1), 0);
+    tb_inst_store(f, TB_TYPE_I64, i, next, 8, false);
+    tb_inst_if(f, tb_inst_cmp_ilt(f, next, n, true), body, exit);
+
+    tb_inst_set_control(f, exit);
+    TB_Node* ret = tb_inst_load(f, TB_TYPE_I64, s, 8, false);
+    tb_inst_ret(f, 1, &ret);
+}
+
+static int64_t table_sum(const int64_t* a, int64_t n) {
+    int64_t s = 1, i = 0;
+    do {
+        s += a[i] + table[i & 7];
+    } while (++i < n);
+    return s;
+}
+
+// hash_loop(a, n): h = 0, i = 0; do { h = (h * 31) ^ a[i]; h += h >> 3; } while (++i + 1 <= n); return h
+//   the exit reads the last h straight out of the loop while the copy into i's phi
+//   sits after it, the phi's register used to get handed to h since the phi was
+//   dead in between.
+static void build_hash_loop(TB_Function* f) {
+    TB_Node* a = tb_inst_param(f, 0);
+    TB_Node* h = tb_inst_local(f, 8, 8);
+    TB_Node* i = tb_inst_local(f, 8, 8);
+    tb_inst_store(f, TB_TYPE_I64, h, tb_inst_sint(f, TB_TYPE_I64, 0), 8, false);
+    tb_inst_store(f, TB_TYPE_I64, i, tb_inst_sint(f, TB_TYPE_I64, 0), 8, false);
+
+    TB_Node* body = tb_inst_region(f);
+    TB_Node* exit = tb_inst_region(f);
+    tb_inst_goto(f, body);
+
+    tb_inst_set_control(f, body);
+    TB_Node* iv = tb_inst_load(f, TB_TYPE_I64, i, 8, false);
+    TB_Node* x = tb_inst_load(f, TB_TYPE_I64, tb_inst_array_access(f, a, iv, 8), 8, false);
+    TB_Node* hv = tb_inst_mul(f, tb_inst_load(f, TB_TYPE_I64, h, 8, false), tb_inst_sint(f, TB_TYPE_I64, 31), 0);
+    hv = tb_inst_xor(f, hv, x);
+    hv = tb_inst_add(f, hv, tb_inst_shr(f, hv, tb_inst_sint(f, TB_TYPE_I64, 3)), 0);
+    tb_inst_store(f, TB_TYPE_I64, h, hv, 8, false);
+
+    TB_Node* next = tb_inst_add(f, iv, tb_inst_sint(f, TB_TYPE_I64, 1), 0);
+    tb_inst_store(f, TB_TYPE_I64, i, next, 8, false);
+    TB_Node* more = tb_inst_add(f, next, tb_inst_sint(f, TB_TYPE_I64, 1), 0);
+    tb_inst_if(f, tb_inst_cmp_ile(f, more, tb_inst_param(f, 1), false), body, exit);
+
+    tb_inst_set_control(f, exit);
+    TB_Node* ret = tb_inst_load(f, TB_TYPE_I64, h, 8, false);
+    tb_inst_ret(f, 1, &ret);
+}
+
+static uint64_t hash_loop(const int64_t* a, uint64_t n) {
+    uint64_t h = 0, i = 0;
+    do {
+        h = (h * 31) ^ a[i];
+        h += h >> 3;
+    } while (++i + 1 <= n);
+    return h;
+}
+
+// log2_loop(a, n): s = 0, i = 0; do { s += 63 - clz(a[i] | 1); } while (++i + 1 <= n); return s
+//   built for haswell, its schedule puts the copy into i's phi before the sum and
+//   the sum is pre-colored to RAX for the return. The phi's register used to get
+//   handed to it since nothing checked values born after the copy.
+static void build_log2_loop(TB_Function* f) {
+    TB_Node* a = tb_inst_param(f, 0);
+    TB_Node* s = tb_inst_local(f, 8, 8);
+    TB_Node* i = tb_inst_local(f, 8, 8);
+    tb_inst_store(f, TB_TYPE_I64, s, tb_inst_sint(f, TB_TYPE_I64, 0), 8, false);
+    tb_inst_store(f, TB_TYPE_I64, i, tb_inst_sint(f, TB_TYPE_I64, 0), 8, false);
+
+    TB_Node* body = tb_inst_region(f);
+    TB_Node* exit = tb_inst_region(f);
+    tb_inst_goto(f, body);
+
+    tb_inst_set_control(f, body);
+    TB_Node* iv = tb_inst_load(f, TB_TYPE_I64, i, 8, false);
+    TB_Node* x = tb_inst_load(f, TB_TYPE_I64, tb_inst_array_access(f, a, iv, 8), 8, false);
+    TB_Node* bits = tb_inst_sub(f, tb_inst_sint(f, TB_TYPE_I32, 63), tb_inst_clz(f, tb_inst_or(f, x, tb_inst_sint(f, TB_TYPE_I64, 1))), 0);
+    TB_Node* sv = tb_inst_add(f, tb_inst_load(f, TB_TYPE_I64, s, 8, false), tb_inst_zxt(f, bits, TB_TYPE_I64), 0);
+    tb_inst_store(f, TB_TYPE_I64, s, sv, 8, false);
+
+    TB_Node* next = tb_inst_add(f, iv, tb_inst_sint(f, TB_TYPE_I64, 1), 0);
+    tb_inst_store(f, TB_TYPE_I64, i, next, 8, false);
+    TB_Node* more = tb_inst_add(f, next, tb_inst_sint(f, TB_TYPE_I64, 1), 0);
+    tb_inst_if(f, tb_inst_cmp_ile(f, more, tb_inst_param(f, 1), false), body, exit);
+
+    tb_inst_set_control(f, exit);
+    TB_Node* ret = tb_inst_load(f, TB_TYPE_I64, s, 8, false);
+    tb_inst_ret(f, 1, &ret);
+}
+
+static uint64_t log2_loop(const int64_t* a, uint64_t n) {
+    uint64_t s = 0, i = 0;
+    do {
+        s += 63 - __builtin_clzll(a[i] | 1);
+    } while (++i + 1 <= n);
+    return s;
+}
+
+// call_sum(x) = (length(message) + message[1]) + (*twice_ptr)(x)
+//   the last add is pre-colored to RAX and so is the call result it consumes, the
+//   pre-colored pass used to let both keep RAX ("RAX = add x, call()").
+static void build_call_sum(TB_Module* m, TB_Function* f, TB_Global* twice_ptr, TB_FunctionPrototype* unary_proto) {
+    TB_External* message_sym = tb_extern_create(m, -1, "message", TB_EXTERNAL_SO_LOCAL);
+    TB_External* length_sym = tb_extern_create(m, -1, "length", TB_EXTERNAL_SO_LOCAL);
+
+    TB_Node* msg = tb_inst_get_symbol_address(f, (TB_Symbol*) message_sym);
+    TB_Node* len = tb_inst_call(f, unary_proto, tb_inst_get_symbol_address(f, (TB_Symbol*) length_sym), 1, &msg).single;
+    TB_Node* ch = tb_inst_load(f, TB_TYPE_I8, tb_inst_member_access(f, msg, 1), 1, false);
+
+    TB_Node* x = tb_inst_param(f, 0);
+    TB_Node* target = tb_inst_load(f, TB_TYPE_PTR, tb_inst_get_symbol_address(f, (TB_Symbol*) twice_ptr), sizeof(void*), false);
+    TB_Node* scaled = tb_inst_call(f, unary_proto, target, 1, &x).single;
+
+    TB_Node* ret = tb_inst_add(f, tb_inst_add(f, len, tb_inst_zxt(f, ch, TB_TYPE_I64), 0), scaled, 0);
+    tb_inst_ret(f, 1, &ret);
+}
+
+static int check(const char* name, int bad) {
+    printf("%-10s %s\n", name, bad ? "FAILED" : "OK");
+    return bad;
+}
+
+int main(int argc, char** argv) {
+    TB_Module* m = tb_module_create_for_host(true);
+    TB_Worklist* ws = tb_worklist_alloc();
+    TB_Arena* code_arena = tb_arena_create(0);
+
+    TB_PrototypeParam key_param = { TB_TYPE_I32 };
+    TB_PrototypeParam ret = { TB_TYPE_I64 };
+    TB_FunctionPrototype* key_proto = tb_prototype_create(m, TB_CDECL, 1, &key_param, 1, &ret, false);
+
+    TB_PrototypeParam sum_params[2] = { { TB_TYPE_PTR }, { TB_TYPE_I64 } };
+    TB_FunctionPrototype* sum_proto = tb_prototype_create(m, TB_CDECL, 2, sum_params, 1, &ret, false);
+
+    TB_Global* g = tb_global_create(m, -1, "table", NULL, TB_LINKAGE_PRIVATE);
+    tb_global_set_storage(m, tb_module_get_data(m), g, sizeof(table), 8, 1);
+    memcpy(tb_global_add_region(m, g, 0, sizeof(table)), table, sizeof(table));
+
+    TB_PrototypeParam unary_param = { TB_TYPE_I64 };
+    TB_FunctionPrototype* unary_proto = tb_prototype_create(m, TB_CDECL, 1, &unary_param, 1, &ret, false);
+
+    TB_External* twice_sym = tb_extern_create(m, -1, "twice", TB_EXTERNAL_SO_LOCAL);
+    TB_Global* twice_ptr = tb_global_create(m, -1, "twice_ptr", NULL, TB_LINKAGE_PRIVATE);
+    tb_global_set_storage(m, tb_module_get_data(m), twice_ptr, sizeof(void*), sizeof(void*), 1);
+    tb_global_add_symbol_reloc(m, twice_ptr, 0, (TB_Symbol*) twice_sym);
+
+    TB_Function* phi_copy = declare(m, "phi_copy", key_proto);
+    TB_Function* table_sum_f = declare(m, "table_sum", sum_proto);
+    TB_Function* call_sum = declare(m, "call_sum", unary_proto);
+    TB_Function* hash_loop_f = declare(m, "hash_loop", sum_proto);
+    TB_Function* log2_loop_f = declare(m, "log2_loop", sum_proto);
+    build_phi_copy(phi_copy);
+    build_table_sum(table_sum_f, g);
+    build_call_sum(m, call_sum, twice_ptr, unary_proto);
+    build_hash_loop(hash_loop_f);
+    build_log2_loop(log2_loop_f);
+
+    // only log2_loop cares, it needs haswell's schedule
+    TB_FeatureSet haswell = { 0 };
+    tb_features_from_march(TB_ARCH_X86_64, "haswell", &haswell);
+
+    TB_Function* funcs[] = { phi_copy, table_sum_f, call_sum, hash_loop_f, log2_loop_f };
+    TB_RegAllocStats stats[5];
+    for (int i = 0; i < 5; i++) {
+        tb_opt(funcs[i], ws, false);
+        stats[i] = *tb_output_get_ra_stats(tb_codegen(funcs[i], ws, code_arena, i == 4 ? &haswell : NULL, false));
+    }
+
+    static const TB_JITSymbol syms[] = {
+        { "message", (void*) message },
+        { "length",  (void*) length  },
+        { "twice",   (void*) twice   },
+    };
+    TB_JIT* jit = tb_jit_begin(m, 0);
+    tb_jit_add_symbols(jit, 3, syms);
+    tb_jit_place_global(jit, g);
+    tb_jit_place_global(jit, twice_ptr);
+    int64_t (*phi_copy_fn)(int32_t) = tb_jit_place_function(jit, phi_copy);
+    int64_t (*table_sum_fn)(const int64_t*, int64_t) = tb_jit_place_function(jit, table_sum_f);
+    int64_t (*call_sum_fn)(int64_t) = tb_jit_place_function(jit, call_sum);
+    uint64_t (*hash_loop_fn)(const int64_t*, uint64_t) = tb_jit_place_function(jit, hash_loop_f);
+    uint64_t (*log2_loop_fn)(const int64_t*, uint64_t) = tb_jit_place_function(jit, log2_loop_f);
+
+    // the zext of the key and the move at the join, none in the cases
+    int failed = 0, bad = stats[0].copies > 2;
+    for (int i = 0; i < CASES; i++) {
+        bad |= phi_copy_fn(i) != (i ^ (1000 + i));
+    }
+    failed += check("phi_copy", bad);
+
+    int64_t a[LEN];
+    for (int i = 0; i < LEN; i++) {
+        a[i] = i * 7919 - 300;
+    }
+
+    bad = 0;
+    for (int n = 1; n <= LEN; n += 13) {
+        bad |= table_sum_fn(a, n) != table_sum(a, n);
+    }
+    failed += check("table_sum", bad);
+    failed += check("call_sum", call_sum_fn(21) != length(message) + message[1] + twice(21));
+
+    bad = 0;
+    for (int n = 1; n <= LEN; n += 13) {
+        bad |= hash_loop_fn(a, n) != hash_loop(a, n);
+    }
+    failed += check("hash_loop", bad);
+
+    bad = 0;
+    for (int n = 1; n <= LEN; n += 13) {
+        bad |= log2_loop_fn(a, n) != log2_loop(a, n);
+    }
+    failed += check("log2_loop", bad);
+
+    tb_jit_end(jit);
+    tb_worklist_free(ws);
+    tb_module_destroy(m);
+    return failed != 0;
+}
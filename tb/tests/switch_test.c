@@ -0,0 +1,271 @@
+// Switch lowering tests
+//   builds a pile of multi-way branches (dense tables, bit tests, sparse trees,
+//   ranges at either end of the key space, with and without a default) and JITs
+//   them, each case returns key ^ (1000 + target*7) so both the target and the
+//   key it saw get checked. every key gets probed along with its neighbours and
+//   a bunch of random ones.
+#include <tb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+enum {
+    MAX_SPECS = 32,
+    MAX_CASES = 300,
+    MAX_TARGETS = 64,
+};
+
+typedef struct {
+    int64_t key;
+    int target;
+} Case;
+
+typedef struct {
+    const char* name;
+    int bits;
+    // the default is unreachable, only the keys get probed
+    bool no_default;
+    int count;
+    Case cases[MAX_CASES];
+} Spec;
+
+static Spec specs[MAX_SPECS];
+static int spec_count;
+
+static Spec* add(const char* name, int bits, bool no_default) {
+    Spec* s = &specs[spec_count++];
+    memset(s, 0, sizeof(*s));
+    s->name = name, s->bits = bits, s->no_default = no_default;
+    return s;
+}
+
+static void put(Spec* s, int64_t key, int target) {
+    s->cases[s->count++] = (Case){ key, target };
+}
+
+static uint64_t mask_of(int bits) {
+    return bits == 64 ? UINT64_MAX : (1ull << bits) - 1;
+}
+
+static TB_DataType dt_of(int bits) {
+    return bits == 8 ? TB_TYPE_I8 : bits == 16 ? TB_TYPE_I16 : bits == 32 ? TB_TYPE_I32 : TB_TYPE_I64;
+}
+
+// small keys come in as 32bit params and get truncated
+static TB_Function* build(TB_Module* m, TB_Worklist* ws, TB_Arena* code_arena, Spec* s, int idx) {
+    char name[32];
+    snprintf(name, sizeof(name), "sw%d", idx);
+
+    TB_Function* f = tb_function_create(m, -1, name, TB_LINKAGE_PUBLIC);
+    tb_function_set_arenas(f, tb_arena_create(0), tb_arena_create(0));
+
+    TB_DataType dt = dt_of(s->bits);
+    TB_PrototypeParam param = { s->bits < 32 ? TB_TYPE_I32 : dt };
+    TB_PrototypeParam ret = { TB_TYPE_I64 };
+    TB_FunctionPrototype* proto = tb_prototype_create(m, TB_CDECL, 1, &param, 1, &ret, false);
+    tb_function_set_prototype(f, tb_module_get_text(m), proto);
+
+    TB_Node* key = tb_inst_param(f, 0);
+    if (s->bits < 32) {
+        key = tb_inst_trunc(f, key, dt);
+    }
+
+    int target_count = 0;
+    for (int i = 0; i < s->count; i++) {
+        if (target_count <= s->cases[i].target) {
+            target_count = s->cases[i].target + 1;
+        }
+    }
+
+    TB_Node* regions[MAX_TARGETS];
+    for (int t = 0; t < target_count; t++) {
+        regions[t] = tb_inst_region(f);
+    }
+    TB_Node* def = tb_inst_region(f);
+
+    TB_SwitchEntry entries[MAX_CASES];
+    for (int i = 0; i < s->count; i++) {
+        entries[i] = (TB_SwitchEntry){ s->cases[i].key, regions[s->cases[i].target] };
+    }
+    tb_inst_branch(f, dt, key, def, s->count, entries);
+
+    for (int t = 0; t < target_count; t++) {
+        tb_inst_set_control(f, regions[t]);
+        TB_Node* k = s->bits == 64 ? key : tb_inst_zxt(f, key, TB_TYPE_I64);
+        TB_Node* r = tb_inst_xor(f, k, tb_inst_sint(f, TB_TYPE_I64, 1000 + t*7));
+        tb_inst_ret(f, 1, &r);
+    }
+
+    tb_inst_set_control(f, def);
+    if (s->no_default) {
+        tb_inst_unreachable(f);
+    } else {
+        TB_Node* r = tb_inst_sint(f, TB_TYPE_I64, -1);
+        tb_inst_ret(f, 1, &r);
+    }
+
+    tb_opt(f, ws, false);
+    tb_codegen(f, ws, code_arena, NULL, false);
+    return f;
+}
+
+static int64_t expected(Spec* s, uint64_t k) {
+    uint64_t mask = mask_of(s->bits);
+    for (int i = 0; i < s->count; i++) {
+        if (((uint64_t) s->cases[i].key & mask) == (k & mask)) {
+            return (int64_t) ((k & mask) ^ (1000 + s->cases[i].target*7));
+        }
+    }
+    return -1;
+}
+
+static int64_t call(void* fn, int bits, uint64_t k) {
+    if (bits == 64) {
+        return ((int64_t(*)(uint64_t)) fn)(k);
+    } else {
+        return ((int64_t(*)(uint32_t)) fn)(k);
+    }
+}
+
+static int check(Spec* s, void* fn, int seed) {
+    static const uint64_t extra[] = {
+        0, 1, 63, 64, 65, 12345, 0x7FFFFFFF, 0x80000000, 0xFFFFFFFF,
+        0x100000000, INT64_MAX, INT64_MIN, UINT64_MAX,
+    };
+
+    uint64_t probes[MAX_CASES*5 + 256];
+    int probe_count = 0;
+    for (int i = 0; i < s->count; i++) {
+        for (int d = -2; d <= 2; d++) {
+            probes[probe_count++] = s->cases[i].key + d;
+        }
+    }
+
+    if (!s->no_default) {
+        for (int i = 0; i < sizeof(extra) / sizeof(extra[0]); i++) {
+            probes[probe_count++] = extra[i];
+        }
+
+        srand(seed);
+        for (int i = 0; i < 200; i++) {
+            probes[probe_count++] = ((uint64_t) rand() << 33) ^ rand();
+        }
+    }
+
+    int bad = 0;
+    for (int i = 0; i < probe_count; i++) {
+        uint64_t k = probes[i] & mask_of(s->bits);
+        int64_t want = expected(s, k);
+        if (s->no_default && want == -1) {
+            continue;
+        }
+
+        int64_t got = call(fn, s->bits, k);
+        if (got != want && bad++ < 4) {
+            printf("  %s: key=%#llx got=%lld want=%lld\n", s->name, (unsigned long long) k, (long long) got, (long long) want);
+        }
+    }
+    return bad;
+}
+
+int main(int argc, char** argv) {
+    Spec* s = add("dense", 32, false);
+    for (int i = 0; i < 10; i++) put(s, i, i);
+
+    s = add("dense with holes", 32, false);
+    for (int i = 100; i < 140; i++) {
+        if (i % 3) put(s, i, i % 5);
+    }
+
+    s = add("sparse", 32, false);
+    static const int64_t sparse[] = { 1, 100, 1000, 10000, 100000, 7, 55, 999999, -3, 0x7FFFFFFF };
+    for (int i = 0; i < 10; i++) put(s, sparse[i], i);
+
+    s = add("bit test", 32, false);
+    for (int i = 0; i < 16; i += 2) put(s, i, 0);
+    for (int i = 1; i < 6; i += 2) put(s, i, 1);
+
+    s = add("bit test (offset)", 64, false);
+    static const char vowels[] = "aeiouAEIOU";
+    for (int i = 0; i < 10; i++) put(s, vowels[i], i < 5 ? 0 : 1);
+    put(s, ' ', 2), put(s, '\t', 2), put(s, '\n', 2);
+
+    s = add("ranges", 32, false);
+    for (int i = 10; i <= 20; i++) put(s, i, 0);
+    for (int i = 30; i <= 40; i++) put(s, i, 1);
+    for (int i = 70; i <= 90; i++) put(s, i, 3);
+    put(s, 50, 2), put(s, 200, 4), put(s, 5000, 5);
+
+    s = add("big 64bit keys", 64, false);
+    static const int64_t big[] = {
+        0x123456789ABCll, -5, 0, 1, 2, 3, 4, 5, 6, 7, INT64_MIN, INT64_MAX, 0x80000000ll,
+        0xFFFFFFFFll, 0x100000000ll, 1ll << 40, (1ll << 40) + 1, (1ll << 40) + 2, (1ll << 40) + 3, (1ll << 40) + 5,
+    };
+    for (int i = 0; i < 20; i++) put(s, big[i], i);
+
+    // a table & a range which end at the very top of the key space
+    s = add("64bit table ending at -1", 64, false);
+    for (int i = -8; i <= -1; i++) put(s, i, (i + 8) % 5);
+    s = add("64bit range ending at -1", 64, false);
+    for (int i = -8; i <= -1; i++) put(s, i, 0);
+    put(s, 0, 1), put(s, 1, 2);
+    s = add("32bit table ending at -1", 32, false);
+    for (int i = -8; i <= -1; i++) put(s, i & 0xFFFFFFFF, (i + 8) % 5);
+
+    s = add("i8", 8, false);
+    for (int i = -8; i < 8; i++) put(s, i & 0xFF, (i + 8) % 6);
+    put(s, 100, 6), put(s, -100 & 0xFF, 7);
+
+    s = add("i16", 16, false);
+    for (int i = 0; i < 12; i++) put(s, (-20000 + i*3000) & 0xFFFF, i);
+
+    s = add("full u8", 8, false);
+    for (int i = 0; i < 256; i++) put(s, i, i % 5);
+
+    s = add("no default, dense", 32, true);
+    for (int i = 0; i < 9; i++) put(s, i + 3, i);
+
+    s = add("no default, sparse", 64, true);
+    for (int i = 0; i < 12; i++) put(s, (int64_t) i*i*977 - 40, i);
+
+    s = add("no default, bit test", 32, true);
+    for (int i = 0; i < 20; i++) put(s, i, i % 3);
+
+    s = add("mixed", 32, false);
+    for (int i = 0; i < 30; i++) put(s, 1000 + i, i % 11);
+    for (int i = 0; i < 40; i += 3) put(s, 5000 + i, (i / 3) % 2);
+    for (int i = 0; i < 8; i++) put(s, 100000 * (i + 1), 11 + i);
+    put(s, 0, 19), put(s, 1, 19), put(s, 2, 19);
+
+    s = add("three cases", 32, false);
+    put(s, 5, 0), put(s, 9, 1), put(s, 13, 2);
+
+    s = add("one case", 64, false);
+    put(s, 42, 0);
+
+    s = add("big table", 32, false);
+    for (int i = 0; i < 256; i++) put(s, i * 2, i % 37);
+
+    TB_Module* m = tb_module_create_for_host(true);
+    TB_Worklist* ws = tb_worklist_alloc();
+    TB_Arena* code_arena = tb_arena_create(0);
+
+    TB_Function* funcs[MAX_SPECS];
+    for (int i = 0; i < spec_count; i++) {
+        funcs[i] = build(m, ws, code_arena, &specs[i], i);
+    }
+
+    TB_JIT* jit = tb_jit_begin(m, 0);
+    int failed = 0;
+    for (int i = 0; i < spec_count; i++) {
+        int bad = check(&specs[i], tb_jit_place_function(jit, funcs[i]), i);
+        printf("%-28s %s\n", specs[i].name, bad ? "FAILED" : "OK");
+        failed += bad != 0;
+    }
+
+    tb_jit_end(jit);
+    tb_worklist_free(ws);
+    tb_module_destroy(m);
+    return failed != 0;
+}
@@ -0,0 +1,176 @@
+// Tail call tests
+//   builds the usual shapes of `return f(...)` (self recursion, mutual recursion
+//   and threaded dispatch through a table of handlers) and checks tb_opt turned
+//   every one of them into a TB_TAILCALL. Then they get JIT'd and the frame address
+//   seen at the bottom of a deep recursion has to match a shallow one, if any
+//   of them still called the stack would grow with the depth.
+#include <tb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+enum {
+    DEPTH = 20000,
+};
+
+// frame address of whoever the recursion bottoms out into
+static char* volatile bottom;
+static uint64_t probe(int64_t acc) {
+    char x;
+    bottom = &x;
+    return (uintptr_t) bottom;
+}
+
+// (i64) -> i64 for probe & the parity pair, (i64, i64) for count, (ptr, i64) for the handlers
+static TB_FunctionPrototype *unary_proto, *count_proto, *handler_proto;
+
+static TB_FunctionPrototype* proto_of(TB_Module* m, int param_count, TB_DataType first) {
+    TB_PrototypeParam params[2] = { { first }, { TB_TYPE_I64 } };
+    TB_PrototypeParam ret = { TB_TYPE_I64 };
+    return tb_prototype_create(m, TB_CDECL, param_count, params, 1, &ret, false);
+}
+
+static TB_Function* declare(TB_Module* m, const char* name, TB_FunctionPrototype* proto) {
+    TB_Function* f = tb_function_create(m, -1, name, TB_LINKAGE_PUBLIC);
+    tb_function_set_arenas(f, tb_arena_create(0), tb_arena_create(0));
+    tb_function_set_prototype(f, tb_module_get_text(m), proto);
+    return f;
+}
+
+static void ret_call(TB_Function* f, TB_FunctionPrototype* proto, TB_Node* target, int param_count, TB_Node** params) {
+    TB_Node* r = tb_inst_call(f, proto, target, param_count, params).single;
+    tb_inst_ret(f, 1, &r);
+}
+
+// if (cond) return probe(acc); otherwise the caller builds the other return
+static void probe_if(TB_Function* f, TB_External* probe_sym, TB_Node* cond, TB_Node* acc) {
+    TB_Node* done = tb_inst_region(f);
+    TB_Node* next = tb_inst_region(f);
+    tb_inst_if(f, cond, done, next);
+
+    tb_inst_set_control(f, done);
+    ret_call(f, unary_proto, tb_inst_get_symbol_address(f, (TB_Symbol*) probe_sym), 1, &acc);
+    tb_inst_set_control(f, next);
+}
+
+// count(n, acc): if (n == 0) return probe(acc); return count(n - 1, acc + 1);
+static void build_count(TB_Function* f, TB_External* probe_sym) {
+    TB_Node* n = tb_inst_param(f, 0);
+    TB_Node* acc = tb_inst_param(f, 1);
+    probe_if(f, probe_sym, tb_inst_cmp_eq(f, n, tb_inst_sint(f, TB_TYPE_I64, 0)), acc);
+
+    TB_Node* args[2] = {
+        tb_inst_sub(f, n, tb_inst_sint(f, TB_TYPE_I64, 1), 0),
+        tb_inst_add(f, acc, tb_inst_sint(f, TB_TYPE_I64, 1), 0),
+    };
+    ret_call(f, count_proto, tb_inst_get_symbol_address(f, (TB_Symbol*) f), 2, args);
+}
+
+// even(n): if (n == 0) return probe(parity); return odd(n - 1); and odd is the same
+static void build_parity(TB_Function* f, TB_Function* other, TB_External* probe_sym, int parity) {
+    TB_Node* n = tb_inst_param(f, 0);
+    probe_if(f, probe_sym, tb_inst_cmp_eq(f, n, tb_inst_sint(f, TB_TYPE_I64, 0)), tb_inst_sint(f, TB_TYPE_I64, parity));
+
+    TB_Node* arg = tb_inst_sub(f, n, tb_inst_sint(f, TB_TYPE_I64, 1), 0);
+    ret_call(f, unary_proto, tb_inst_get_symbol_address(f, (TB_Symbol*) other), 1, &arg);
+}
+
+// handler(pc, acc) = dispatch[pc[delta]] which gets called with (pc + delta, acc + step)
+static void dispatch_next(TB_Function* f, TB_Global* dispatch, TB_Node* pc, TB_Node* acc, int delta, int step) {
+    TB_Node* op = tb_inst_load(f, TB_TYPE_I8, tb_inst_member_access(f, pc, delta), 1, false);
+    TB_Node* slot = tb_inst_array_access(f, tb_inst_get_symbol_address(f, (TB_Symbol*) dispatch), tb_inst_zxt(f, op, TB_TYPE_I64), sizeof(void*));
+    TB_Node* handler = tb_inst_load(f, TB_TYPE_PTR, slot, sizeof(void*), false);
+
+    TB_Node* args[2] = { tb_inst_member_access(f, pc, delta), acc };
+    if (step) {
+        args[1] = tb_inst_add(f, acc, tb_inst_sint(f, TB_TYPE_I64, step), 0);
+    }
+    ret_call(f, handler_proto, handler, 2, args);
+}
+
+// op_inc(pc, acc):  return dispatch[pc[1]](pc + 1, acc + 1);
+// op_loop(pc, acc): return acc < DEPTH ? dispatch[pc[-1]](pc - 1, acc) : probe(acc);
+static void build_dispatch(TB_Function* op_inc, TB_Function* op_loop, TB_Global* dispatch, TB_External* probe_sym) {
+    dispatch_next(op_inc, dispatch, tb_inst_param(op_inc, 0), tb_inst_param(op_inc, 1), 1, 1);
+
+    TB_Node* pc = tb_inst_param(op_loop, 0);
+    TB_Node* acc = tb_inst_param(op_loop, 1);
+    TB_Node* limit = tb_inst_sint(op_loop, TB_TYPE_I64, DEPTH);
+    probe_if(op_loop, probe_sym, tb_inst_cmp_ige(op_loop, acc, limit, true), acc);
+    dispatch_next(op_loop, dispatch, pc, acc, -1, 0);
+}
+
+// tb_opt hangs the tailcalls off the root, every exit but the probe's should be one
+static int count_tailcalls(TB_Function* f) {
+    TB_Node* root = tb_inst_root_node(f);
+    int count = 0;
+    for (int i = 0; i < root->input_count; i++) {
+        count += root->inputs[i] && root->inputs[i]->type == TB_TAILCALL;
+    }
+    return count;
+}
+
+static int check(const char* name, int tailcalls, int want_tailcalls, uint64_t shallow, uint64_t deep) {
+    int bad = tailcalls < want_tailcalls || shallow != deep;
+    printf("%-10s tailcalls=%d  %s\n", name, tailcalls, bad ? (shallow != deep ? "GROWS" : "FAILED") : "OK");
+    return bad;
+}
+
+int main(int argc, char** argv) {
+    TB_Module* m = tb_module_create_for_host(true);
+    TB_Worklist* ws = tb_worklist_alloc();
+    TB_Arena* code_arena = tb_arena_create(0);
+
+    TB_External* probe_sym = tb_extern_create(m, -1, "probe", TB_EXTERNAL_SO_LOCAL);
+
+    unary_proto = proto_of(m, 1, TB_TYPE_I64);
+    count_proto = proto_of(m, 2, TB_TYPE_I64);
+    handler_proto = proto_of(m, 2, TB_TYPE_PTR);
+
+    TB_Function* count = declare(m, "count", count_proto);
+    TB_Function* even = declare(m, "even", unary_proto);
+    TB_Function* odd = declare(m, "odd", unary_proto);
+    TB_Function* op_inc = declare(m, "op_inc", handler_proto);
+    TB_Function* op_loop = declare(m, "op_loop", handler_proto);
+
+    TB_Global* dispatch = tb_global_create(m, -1, "dispatch", NULL, TB_LINKAGE_PRIVATE);
+    tb_global_set_storage(m, tb_module_get_data(m), dispatch, 2*sizeof(void*), sizeof(void*), 2);
+    tb_global_add_symbol_reloc(m, dispatch, 0, (TB_Symbol*) op_inc);
+    tb_global_add_symbol_reloc(m, dispatch, sizeof(void*), (TB_Symbol*) op_loop);
+
+    build_count(count, probe_sym);
+    build_parity(even, odd, probe_sym, 0);
+    build_parity(odd, even, probe_sym, 1);
+    build_dispatch(op_inc, op_loop, dispatch, probe_sym);
+
+    TB_Function* funcs[] = { count, even, odd, op_inc, op_loop };
+    int tailcalls[5];
+    for (int i = 0; i < 5; i++) {
+        tb_opt(funcs[i], ws, false);
+        tailcalls[i] = count_tailcalls(funcs[i]);
+        tb_codegen(funcs[i], ws, code_arena, NULL, false);
+    }
+
+    static const TB_JITSymbol syms[] = {
+        { "probe", (void*) probe },
+    };
+    TB_JIT* jit = tb_jit_begin(m, 0);
+    tb_jit_add_symbols(jit, 1, syms);
+
+    uint64_t (*count_fn)(int64_t, int64_t) = tb_jit_place_function(jit, count);
+    uint64_t (*even_fn)(int64_t) = tb_jit_place_function(jit, even);
+    uint64_t (*op_inc_fn)(const uint8_t*, int64_t) = tb_jit_place_function(jit, op_inc);
+
+    // both probe calls are tail calls too so their frames line up no matter the depth
+    static const uint8_t program[] = { 0, 1 };
+    int failed = 0;
+    failed += check("count", tailcalls[0], 2, count_fn(1, 0), count_fn(DEPTH, 0));
+    failed += check("even/odd", tailcalls[1] + tailcalls[2], 4, even_fn(2), even_fn(DEPTH));
+    failed += check("dispatch", tailcalls[3] + tailcalls[4], 3, op_inc_fn(&program[0], DEPTH - 1), op_inc_fn(&program[0], 0));
+
+    tb_jit_end(jit);
+    tb_worklist_free(ws);
+    tb_module_destroy(m);
+    return failed != 0;
+}
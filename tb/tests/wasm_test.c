@@ -0,0 +1,265 @@
+// Wasm module tests
+//   builds a module which calls externals, calls through function pointers and
+//   takes the address of functions & globals (in code and in a global's
+//   relocations). Then it exports it and reads the sections back: the called
+//   externals have to be imported from "env", function pointers are slots in
+//   the table (index + 1) and globals are addresses in the data segment.
+#include <tb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+static TB_Module* m;
+static TB_FunctionPrototype *unary_proto, *binary_proto, *ptr_proto;
+
+static TB_FunctionPrototype* proto_of(int param_count, TB_DataType param, TB_DataType ret) {
+    TB_PrototypeParam params[2] = { { param }, { TB_TYPE_I32 } };
+    TB_PrototypeParam rets = { ret };
+    return tb_prototype_create(m, TB_CDECL, param_count, params, 1, &rets, false);
+}
+
+static TB_Function* declare(const char* name, TB_FunctionPrototype* proto) {
+    TB_Function* f = tb_function_create(m, -1, name, TB_LINKAGE_PUBLIC);
+    tb_function_set_arenas(f, tb_arena_create(0), tb_arena_create(0));
+    tb_function_set_prototype(f, tb_module_get_text(m), proto);
+    return f;
+}
+
+static TB_Node* sym(TB_Function* f, void* s) {
+    return tb_inst_get_symbol_address(f, (TB_Symbol*) s);
+}
+
+static TB_FunctionOutput* finish(TB_Function* f, TB_Node* r, TB_Worklist* ws, TB_Arena* code_arena) {
+    tb_inst_ret(f, 1, &r);
+    tb_opt(f, ws, false);
+    return tb_codegen(f, ws, code_arena, NULL, false);
+}
+
+////////////////////////////////
+// Reading it back
+////////////////////////////////
+typedef struct {
+    const uint8_t *p, *end;
+} Reader;
+
+static uint64_t read_uint(Reader* r) {
+    uint64_t x = 0;
+    for (int shift = 0; r->p < r->end; shift += 7) {
+        uint8_t b = *r->p++;
+        x |= (uint64_t) (b & 0x7F) << shift;
+        if ((b & 0x80) == 0) { break; }
+    }
+    return x;
+}
+
+static int64_t read_sint(Reader* r) {
+    int64_t x = 0;
+    int shift = 0;
+    uint8_t b = 0;
+    while (r->p < r->end) {
+        b = *r->p++;
+        x |= (int64_t) (b & 0x7F) << shift;
+        shift += 7;
+        if ((b & 0x80) == 0) { break; }
+    }
+    if (shift < 64 && (b & 0x40)) { x |= -((int64_t) 1 << shift); }
+    return x;
+}
+
+static int read_name(Reader* r, char* out, size_t cap) {
+    size_t len = read_uint(r);
+    if (len >= cap || r->p + len > r->end) { return 0; }
+    memcpy(out, r->p, len), out[len] = 0;
+    r->p += len;
+    return 1;
+}
+
+static Reader find_section(const uint8_t* data, size_t size, int id) {
+    Reader r = { data + 8, data + size };
+    while (r.p < r.end) {
+        int sec = *r.p++;
+        size_t len = read_uint(&r);
+        if (sec == id) { return (Reader){ r.p, r.p + len }; }
+        r.p += len;
+    }
+    return (Reader){ NULL, NULL };
+}
+
+static int find_import(Reader r, const char* name, uint64_t* type) {
+    char module[64], field[64];
+    uint64_t count = read_uint(&r);
+    for (uint64_t i = 0; i < count; i++) {
+        if (!read_name(&r, module, sizeof(module)) || !read_name(&r, field, sizeof(field))) { return -1; }
+        r.p++; // kind
+        uint64_t t = read_uint(&r);
+        if (strcmp(module, "env") == 0 && strcmp(field, name) == 0) {
+            if (type) { *type = t; }
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int find_export(Reader r, const char* name) {
+    char field[64];
+    uint64_t count = read_uint(&r);
+    for (uint64_t i = 0; i < count; i++) {
+        if (!read_name(&r, field, sizeof(field))) { return -1; }
+        r.p++; // kind
+        uint64_t index = read_uint(&r);
+        if (strcmp(field, name) == 0) { return index; }
+    }
+    return -1;
+}
+
+// does the type section say (i32) -> i32
+static int is_unary_type(Reader r, uint64_t index) {
+    uint64_t count = read_uint(&r);
+    for (uint64_t i = 0; i < count; i++) {
+        if (*r.p++ != 0x60) { return 0; }
+        uint64_t params = read_uint(&r);
+        const uint8_t* param_types = r.p;
+        r.p += params;
+        uint64_t rets = read_uint(&r);
+        const uint8_t* ret_types = r.p;
+        r.p += rets;
+
+        if (i == index) {
+            return params == 1 && param_types[0] == 0x7F && rets == 1 && ret_types[0] == 0x7F;
+        }
+    }
+    return 0;
+}
+
+// first operand of op in the function's code, the patched ones are padded LEBs
+// so they're never the same byte as part of the locals or another immediate.
+static int64_t code_operand(TB_FunctionOutput* out, uint8_t op) {
+    size_t size;
+    uint8_t* code = tb_output_get_code(out, &size);
+    for (size_t i = 0; i + 5 < size; i++) {
+        if (code[i] == op && (code[i + 1] & 0x80) && (code[i + 2] & 0x80) && (code[i + 3] & 0x80)) {
+            Reader r = { &code[i + 1], &code[size] };
+            return op == 0x41 ? read_sint(&r) : (int64_t) read_uint(&r);
+        }
+    }
+    return -1;
+}
+
+static int check(const char* name, int ok) {
+    printf("%-24s %s\n", name, ok ? "OK" : "FAILED");
+    return !ok;
+}
+
+int main(int argc, char** argv) {
+    m = tb_module_create(TB_ARCH_WASM32, TB_SYSTEM_WASM, false);
+    TB_Worklist* ws = tb_worklist_alloc();
+    TB_Arena* code_arena = tb_arena_create(0);
+
+    unary_proto  = proto_of(1, TB_TYPE_I32, TB_TYPE_I32);
+    binary_proto = proto_of(2, TB_TYPE_I32, TB_TYPE_I32);
+    ptr_proto    = proto_of(0, TB_TYPE_I32, TB_TYPE_PTR);
+    TB_FunctionPrototype* apply_proto = proto_of(2, TB_TYPE_PTR, TB_TYPE_I32);
+
+    TB_External* host_add = tb_extern_create(m, -1, "host_add", TB_EXTERNAL_SO_LOCAL);
+    TB_External* host_neg = tb_extern_create(m, -1, "host_neg", TB_EXTERNAL_SO_LOCAL);
+    tb_extern_create(m, -1, "never_called", TB_EXTERNAL_SO_LOCAL);
+
+    // int counter = 5;
+    TB_Global* counter = tb_global_create(m, -1, "counter", NULL, TB_LINKAGE_PRIVATE);
+    tb_global_set_storage(m, tb_module_get_data(m), counter, 4, 4, 1);
+    int32_t five = 5;
+    memcpy(tb_global_add_region(m, counter, 0, 4), &five, 4);
+
+    // int dbl(int x) { return x * 2; }
+    TB_Function* dbl = declare("dbl", unary_proto);
+    finish(dbl, tb_inst_mul(dbl, tb_inst_param(dbl, 0), tb_inst_sint(dbl, TB_TYPE_I32, 2), 0), ws, code_arena);
+
+    // void* table[] = { dbl, &counter, host_add };
+    TB_Global* table = tb_global_create(m, -1, "table", NULL, TB_LINKAGE_PRIVATE);
+    tb_global_set_storage(m, tb_module_get_data(m), table, 12, 4, 3);
+    tb_global_add_symbol_reloc(m, table, 0, (TB_Symbol*) dbl);
+    tb_global_add_symbol_reloc(m, table, 4, (TB_Symbol*) counter);
+    tb_global_add_symbol_reloc(m, table, 8, (TB_Symbol*) host_add);
+
+    // int ext(int a, int b) { return host_add(a, b) + host_neg(a); }
+    TB_Function* ext = declare("ext", binary_proto);
+    {
+        TB_Node* args[2] = { tb_inst_param(ext, 0), tb_inst_param(ext, 1) };
+        TB_Node* x = tb_inst_call(ext, binary_proto, sym(ext, host_add), 2, args).single;
+        TB_Node* y = tb_inst_call(ext, unary_proto, sym(ext, host_neg), 1, args).single;
+        finish(ext, tb_inst_add(ext, x, y, 0), ws, code_arena);
+    }
+
+    // int apply(int (*fp)(int), int x) { return fp(x) + 1; }
+    TB_Function* apply = declare("apply", apply_proto);
+    TB_FunctionOutput* apply_out;
+    {
+        TB_Node* x = tb_inst_param(apply, 1);
+        TB_Node* r = tb_inst_call(apply, unary_proto, tb_inst_param(apply, 0), 1, &x).single;
+        apply_out = finish(apply, tb_inst_add(apply, r, tb_inst_sint(apply, TB_TYPE_I32, 1), 0), ws, code_arena);
+    }
+
+    // void* addr_dbl(void) { return dbl; } and the same for &counter
+    TB_Function* addr_dbl = declare("addr_dbl", ptr_proto);
+    TB_FunctionOutput* addr_dbl_out = finish(addr_dbl, sym(addr_dbl, dbl), ws, code_arena);
+    TB_Function* addr_counter = declare("addr_counter", ptr_proto);
+    TB_FunctionOutput* addr_counter_out = finish(addr_counter, sym(addr_counter, counter), ws, code_arena);
+
+    TB_ExportBuffer buffer = tb_module_object_export(m, tb_arena_create(0), TB_DEBUGFMT_NONE);
+    uint8_t* data = malloc(buffer.total);
+    for (TB_ExportChunk* c = buffer.head; c; c = c->next) {
+        memcpy(&data[c->pos], c->data, c->size);
+    }
+
+    Reader types   = find_section(data, buffer.total, 1);
+    Reader imports = find_section(data, buffer.total, 2);
+    Reader exports = find_section(data, buffer.total, 7);
+    Reader elems   = find_section(data, buffer.total, 9);
+    Reader segs    = find_section(data, buffer.total, 11);
+
+    int failed = 0;
+    uint64_t neg_type = -1;
+    int add_index = imports.p ? find_import(imports, "host_add", NULL) : -1;
+    int neg_index = imports.p ? find_import(imports, "host_neg", &neg_type) : -1;
+    failed += check("imports", add_index >= 0 && neg_index >= 0 && find_import(imports, "never_called", NULL) < 0);
+    failed += check("import types", neg_index >= 0 && is_unary_type(types, neg_type));
+
+    // the element segment fills the table from slot 1 in function index order
+    int dbl_index = find_export(exports, "dbl");
+    int elems_ok = elems.p != NULL && read_uint(&elems) == 1 && *elems.p++ == 0x00 && *elems.p++ == 0x41 && read_sint(&elems) == 1;
+    failed += check("table", elems_ok && dbl_index >= 2 && *elems.p++ == 0x0B && read_uint(&elems) >= (uint64_t) dbl_index + 1);
+
+    int64_t dbl_slot = code_operand(addr_dbl_out, 0x41);
+    int64_t counter_addr = code_operand(addr_counter_out, 0x41);
+    failed += check("function address", dbl_slot == dbl_index + 1);
+    failed += check("call_indirect type", is_unary_type(types, code_operand(apply_out, 0x11)));
+
+    // the table global is { dbl, &counter, host_add } and counter's address has to hold 5
+    int data_ok = 0, counter_ok = 0;
+    if (segs.p) {
+        uint64_t count = read_uint(&segs);
+        for (uint64_t i = 0; i < count; i++) {
+            segs.p++;
+            segs.p++; // i32.const
+            int64_t base = read_sint(&segs);
+            segs.p++; // end
+            uint64_t size = read_uint(&segs);
+
+            for (uint64_t j = 0; j + 4 <= size; j += 4) {
+                int32_t w[3] = { 0 };
+                memcpy(w, &segs.p[j], j + 12 <= size ? 12 : 4);
+                counter_ok |= base + j == counter_addr && w[0] == 5;
+                data_ok |= j + 12 <= size && w[0] == dbl_slot && w[1] == counter_addr && w[2] == add_index + 1;
+            }
+            segs.p += size;
+        }
+    }
+    failed += check("global address", counter_ok);
+    failed += check("data relocations", data_ok);
+
+    free(data);
+    tb_worklist_free(ws);
+    tb_module_destroy(m);
+    return failed != 0;
+}
@@ -0,0 +1,900 @@
+// x64 codegen benchmark
+//   builds a few kernels through the TB API the way a frontend would (locals,
+//   loads & stores, tb_opt cleans it up), compiles each of them for a couple of
+//   -march style feature sets, JITs them on the host and checks them against
+//   plain C. Every line has the time per element next to the RA stats which
+//   should explain it.
+//
+//   ilp: kernels with independent dependency chains, the x86-64-v3 feature set
+//   uses the generic (single issue) pipeline model so it's the list scheduler
+//   without any port or throughput info to go on.
+//
+//   peephole: small functions which leave work for the post-RA peepholes, the
+//   stats say which of them fired.
+//
+//   bits: clz/ctz/popcount and variable shifts, x86-64 has to make do with
+//   bsr/bsf and a SWAR popcount where haswell has lzcnt/tzcnt/popcnt & BMI.
+//
+//   fpressure: more live doubles than x86-64-v3 has XMMs, x86-64-v4 gets
+//   another 16 of them with AVX-512.
+//
+//   bulk: known size memcpy/memset, x86-64 unrolls them into SSE moves and
+//   haswell into AVX ones next to the rep movsb/stosb they'd be otherwise.
+#include <tb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+enum {
+    // elements per call
+    LEN          = 4096,
+    // calls per timed run, the best of REPEATS runs is the one reported
+    CALLS        = 256,
+    REPEATS      = 7,
+
+    MAX_KERNELS  = 8,
+};
+
+typedef TB_Function* (*BuildFn)(TB_Module* m);
+
+// one module per feature set, every kernel of a section gets compiled into it
+typedef struct {
+    TB_Module* m;
+    TB_JIT* jit;
+    void* fns[MAX_KERNELS];
+    TB_RegAllocStats stats[MAX_KERNELS];
+} Variant;
+
+static uint64_t now_in_nanos(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static TB_FeatureSet march(const char* name) {
+    TB_FeatureSet features = { 0 };
+    if (!tb_features_from_march(TB_ARCH_X86_64, name, &features)) {
+        fprintf(stderr, "unknown -march=%s\n", name);
+        abort();
+    }
+    return features;
+}
+
+static Variant compile(int count, const BuildFn* builders, const TB_FeatureSet* features) {
+    Variant v = { tb_module_create_for_host(true) };
+    TB_Worklist* ws = tb_worklist_alloc();
+    TB_Arena* code_arena = tb_arena_create(0);
+
+    TB_Function* funcs[MAX_KERNELS];
+    for (int i = 0; i < count; i++) {
+        funcs[i] = builders[i](v.m);
+        tb_opt(funcs[i], ws, false);
+        v.stats[i] = *tb_output_get_ra_stats(tb_codegen(funcs[i], ws, code_arena, features, false));
+    }
+
+    v.jit = tb_jit_begin(v.m, 0);
+    for (int i = 0; i < count; i++) {
+        v.fns[i] = tb_jit_place_function(v.jit, funcs[i]);
+    }
+
+    tb_worklist_free(ws);
+    return v;
+}
+
+static void release(Variant* v) {
+    tb_jit_end(v->jit);
+    tb_module_destroy(v->m);
+}
+
+static TB_Function* declare(TB_Module* m, const char* name, int param_count, const TB_DataType* params, TB_DataType ret) {
+    TB_PrototypeParam proto_params[8];
+    for (int i = 0; i < param_count; i++) {
+        proto_params[i] = (TB_PrototypeParam){ params[i] };
+    }
+
+    TB_PrototypeParam proto_ret = { ret };
+    TB_FunctionPrototype* proto = tb_prototype_create(m, TB_CDECL, param_count, proto_params, 1, &proto_ret, false);
+
+    TB_Function* f = tb_function_create(m, -1, name, TB_LINKAGE_PUBLIC);
+    tb_function_set_arenas(f, tb_arena_create(0), tb_arena_create(0));
+    tb_function_set_prototype(f, tb_module_get_text(m), proto);
+    return f;
+}
+
+////////////////////////////////
+// Frontend-ish helpers
+////////////////////////////////
+static TB_Node* var(TB_Function* f, TB_DataType dt, TB_Node* init) {
+    TB_Node* addr = tb_inst_local(f, 8, 8);
+    tb_inst_store(f, dt, addr, init, 8, false);
+    return addr;
+}
+
+static TB_Node* get(TB_Function* f, TB_DataType dt, TB_Node* addr) {
+    return tb_inst_load(f, dt, addr, 8, false);
+}
+
+static void set(TB_Function* f, TB_DataType dt, TB_Node* addr, TB_Node* v) {
+    tb_inst_store(f, dt, addr, v, 8, false);
+}
+
+static TB_Node* i64(TB_Function* f, uint64_t imm) {
+    return tb_inst_uint(f, TB_TYPE_I64, imm);
+}
+
+static TB_Node* i32(TB_Function* f, uint32_t imm) {
+    return tb_inst_uint(f, TB_TYPE_I32, imm);
+}
+
+// elem(base, i + k) of elem_size
+static TB_Node* load_elem(TB_Function* f, TB_DataType dt, TB_Node* base, TB_Node* i, int k, int elem_size) {
+    TB_Node* addr = tb_inst_array_access(f, base, k ? tb_inst_add(f, i, i64(f, k), 0) : i, elem_size);
+    return tb_inst_load(f, dt, addr, elem_size, false);
+}
+
+// for (i = 0; i + step <= n; i += step) but as a do-while, the control is in
+// the body after loop_begin and it's in the exit after loop_end. n has to be
+// at least step.
+typedef struct {
+    TB_Node *body, *exit, *i, *n;
+} Loop;
+
+static TB_Node* loop_begin(TB_Function* f, Loop* l, TB_Node* n) {
+    l->i = var(f, TB_TYPE_I64, i64(f, 0));
+    l->n = n;
+    l->body = tb_inst_region(f);
+    l->exit = tb_inst_region(f);
+    tb_inst_goto(f, l->body);
+
+    tb_inst_set_control(f, l->body);
+    return get(f, TB_TYPE_I64, l->i);
+}
+
+static void loop_end(TB_Function* f, Loop* l, int step) {
+    TB_Node* next = tb_inst_add(f, get(f, TB_TYPE_I64, l->i), i64(f, step), 0);
+    set(f, TB_TYPE_I64, l->i, next);
+    tb_inst_if(f, tb_inst_cmp_ile(f, tb_inst_add(f, next, i64(f, step), 0), l->n, false), l->body, l->exit);
+    tb_inst_set_control(f, l->exit);
+}
+
+////////////////////////////////
+// ILP
+////////////////////////////////
+static const uint64_t mix_keys[4] = { 0x9E3779B97F4A7C15ull, 0xC2B2AE3D27D4EB4Full, 0x165667B19E3779F9ull, 0x27D4EB2F165667C5ull };
+
+// 4 independent integer chains
+static uint64_t mix4(const uint64_t* p, size_t n) {
+    uint64_t a = 1, b = 2, c = 3, d = 4;
+    for (size_t i = 0; i + 4 <= n; i += 4) {
+        a = (a ^ p[i + 0]) * mix_keys[0];
+        b = (b ^ p[i + 1]) * mix_keys[1];
+        c = (c ^ p[i + 2]) * mix_keys[2];
+        d = (d ^ p[i + 3]) * mix_keys[3];
+    }
+    return a + b + c + d;
+}
+
+static TB_Function* build_mix4(TB_Module* m) {
+    TB_Function* f = declare(m, "mix4", 2, (TB_DataType[]){ TB_TYPE_PTR, TB_TYPE_I64 }, TB_TYPE_I64);
+    TB_Node* p = tb_inst_param(f, 0);
+
+    TB_Node* acc[4];
+    for (int k = 0; k < 4; k++) {
+        acc[k] = var(f, TB_TYPE_I64, i64(f, k + 1));
+    }
+
+    Loop l;
+    TB_Node* i = loop_begin(f, &l, tb_inst_param(f, 1));
+    for (int k = 0; k < 4; k++) {
+        TB_Node* v = tb_inst_xor(f, get(f, TB_TYPE_I64, acc[k]), load_elem(f, TB_TYPE_I64, p, i, k, 8));
+        set(f, TB_TYPE_I64, acc[k], tb_inst_mul(f, v, i64(f, mix_keys[k]), 0));
+    }
+    loop_end(f, &l, 4);
+
+    TB_Node* ret = get(f, TB_TYPE_I64, acc[0]);
+    for (int k = 1; k < 4; k++) {
+        ret = tb_inst_add(f, ret, get(f, TB_TYPE_I64, acc[k]), 0);
+    }
+    tb_inst_ret(f, 1, &ret);
+    return f;
+}
+
+// long latency float ops, the mul and add chains don't depend on each other
+static double dot4(const double* x, const double* y, size_t n) {
+    double s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+    for (size_t i = 0; i + 4 <= n; i += 4) {
+        s0 += x[i + 0] * y[i + 0];
+        s1 += x[i + 1] * y[i + 1];
+        s2 += x[i + 2] * y[i + 2];
+        s3 += x[i + 3] * y[i + 3];
+    }
+    return (s0 + s1) + (s2 + s3);
+}
+
+static TB_Function* build_dot4(TB_Module* m) {
+    TB_Function* f = declare(m, "dot4", 3, (TB_DataType[]){ TB_TYPE_PTR, TB_TYPE_PTR, TB_TYPE_I64 }, TB_TYPE_F64);
+    TB_Node* x = tb_inst_param(f, 0);
+    TB_Node* y = tb_inst_param(f, 1);
+
+    TB_Node* s[4];
+    for (int k = 0; k < 4; k++) {
+        s[k] = var(f, TB_TYPE_F64, tb_inst_float64(f, 0.0));
+    }
+
+    Loop l;
+    TB_Node* i = loop_begin(f, &l, tb_inst_param(f, 2));
+    for (int k = 0; k < 4; k++) {
+        TB_Node* v = tb_inst_fmul(f, load_elem(f, TB_TYPE_F64, x, i, k, 8), load_elem(f, TB_TYPE_F64, y, i, k, 8));
+        set(f, TB_TYPE_F64, s[k], tb_inst_fadd(f, get(f, TB_TYPE_F64, s[k]), v));
+    }
+    loop_end(f, &l, 4);
+
+    TB_Node* lo = tb_inst_fadd(f, get(f, TB_TYPE_F64, s[0]), get(f, TB_TYPE_F64, s[1]));
+    TB_Node* hi = tb_inst_fadd(f, get(f, TB_TYPE_F64, s[2]), get(f, TB_TYPE_F64, s[3]));
+    TB_Node* ret = tb_inst_fadd(f, lo, hi);
+    tb_inst_ret(f, 1, &ret);
+    return f;
+}
+
+// one slow divide next to cheap ALU work which should fill the shadow
+static uint32_t div_shadow(const uint32_t* p, size_t n, uint32_t d) {
+    uint32_t q = 0, h = 0;
+    for (size_t i = 0; i < n; i++) {
+        q += p[i] / d;
+        h = ((h << 5) | (h >> 27)) ^ p[i];
+        h += (h >> 3) & 0xFF;
+    }
+    return q ^ h;
+}
+
+static TB_Function* build_div_shadow(TB_Module* m) {
+    TB_Function* f = declare(m, "div_shadow", 3, (TB_DataType[]){ TB_TYPE_PTR, TB_TYPE_I64, TB_TYPE_I32 }, TB_TYPE_I32);
+    TB_Node* p = tb_inst_param(f, 0);
+    TB_Node* q = var(f, TB_TYPE_I32, i32(f, 0));
+    TB_Node* h = var(f, TB_TYPE_I32, i32(f, 0));
+
+    Loop l;
+    TB_Node* i = loop_begin(f, &l, tb_inst_param(f, 1));
+    TB_Node* x = load_elem(f, TB_TYPE_I32, p, i, 0, 4);
+    set(f, TB_TYPE_I32, q, tb_inst_add(f, get(f, TB_TYPE_I32, q), tb_inst_div(f, x, tb_inst_param(f, 2), false), 0));
+
+    TB_Node* hv = get(f, TB_TYPE_I32, h);
+    hv = tb_inst_xor(f, tb_inst_or(f, tb_inst_shl(f, hv, i32(f, 5), 0), tb_inst_shr(f, hv, i32(f, 27))), x);
+    hv = tb_inst_add(f, hv, tb_inst_and(f, tb_inst_shr(f, hv, i32(f, 3)), i32(f, 0xFF)), 0);
+    set(f, TB_TYPE_I32, h, hv);
+    loop_end(f, &l, 1);
+
+    TB_Node* ret = tb_inst_xor(f, get(f, TB_TYPE_I32, q), get(f, TB_TYPE_I32, h));
+    tb_inst_ret(f, 1, &ret);
+    return f;
+}
+
+// shifts compete for fewer ports than plain ALU ops
+static uint32_t shift_heavy(uint32_t x, uint32_t y, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        x = (x << 3) ^ (x >> 7) ^ y;
+        y = (y << 11) + (y >> 2) + x;
+    }
+    return x ^ y;
+}
+
+static TB_Function* build_shift_heavy(TB_Module* m) {
+    TB_Function* f = declare(m, "shift_heavy", 3, (TB_DataType[]){ TB_TYPE_I32, TB_TYPE_I32, TB_TYPE_I64 }, TB_TYPE_I32);
+    TB_Node* x = var(f, TB_TYPE_I32, tb_inst_param(f, 0));
+    TB_Node* y = var(f, TB_TYPE_I32, tb_inst_param(f, 1));
+
+    Loop l;
+    loop_begin(f, &l, tb_inst_param(f, 2));
+    TB_Node* xv = get(f, TB_TYPE_I32, x);
+    TB_Node* yv = get(f, TB_TYPE_I32, y);
+    xv = tb_inst_xor(f, tb_inst_xor(f, tb_inst_shl(f, xv, i32(f, 3), 0), tb_inst_shr(f, xv, i32(f, 7))), yv);
+    yv = tb_inst_add(f, tb_inst_add(f, tb_inst_shl(f, yv, i32(f, 11), 0), tb_inst_shr(f, yv, i32(f, 2)), 0), xv, 0);
+    set(f, TB_TYPE_I32, x, xv);
+    set(f, TB_TYPE_I32, y, yv);
+    loop_end(f, &l, 1);
+
+    TB_Node* ret = tb_inst_xor(f, get(f, TB_TYPE_I32, x), get(f, TB_TYPE_I32, y));
+    tb_inst_ret(f, 1, &ret);
+    return f;
+}
+
+static uint64_t a64[LEN];
+static uint32_t a32[LEN];
+static double   xs[LEN], ys[LEN];
+
+// returns the best ns/element, bad gets bumped if any call disagrees with expected
+static double time_ilp(int kernel, void* fn, uint64_t expected, int* bad) {
+    double best = 1e30;
+    for (int r = 0; r < REPEATS; r++) {
+        uint64_t start = now_in_nanos();
+        for (int c = 0; c < CALLS; c++) {
+            uint64_t got = 0;
+            switch (kernel) {
+                case 0: got = ((uint64_t (*)(const uint64_t*, size_t)) fn)(a64, LEN); break;
+                case 1: { double d = ((double (*)(const double*, const double*, size_t)) fn)(xs, ys, LEN); memcpy(&got, &d, 8); break; }
+                case 2: got = ((uint32_t (*)(const uint32_t*, size_t, uint32_t)) fn)(a32, LEN, 7); break;
+                case 3: got = ((uint32_t (*)(uint32_t, uint32_t, size_t)) fn)(12345, 678910, LEN); break;
+            }
+            *bad += got != expected;
+        }
+
+        double ns = (double) (now_in_nanos() - start) / ((double) CALLS * LEN);
+        if (ns < best) best = ns;
+    }
+    return best;
+}
+
+static int ilp(void) {
+    static const char* names[] = { "mix4", "dot4", "div_shadow", "shift_heavy" };
+    static const BuildFn builders[] = { build_mix4, build_dot4, build_div_shadow, build_shift_heavy };
+    static const char* marchs[] = { "x86-64-v3", "haswell", "skylake", "znver1" };
+    enum { KERNELS = 4, MARCHS = 4 };
+
+    for (int i = 0; i < LEN; i++) {
+        a64[i] = i * 0x9E3779B97F4A7C15ull;
+        a32[i] = i * 2654435761u;
+        xs[i]  = i * 0.5;
+        ys[i]  = 1.0 / (i + 1);
+    }
+
+    uint64_t expected[KERNELS];
+    double dot = dot4(xs, ys, LEN);
+    expected[0] = mix4(a64, LEN);
+    memcpy(&expected[1], &dot, 8);
+    expected[2] = div_shadow(a32, LEN, 7);
+    expected[3] = shift_heavy(12345, 678910, LEN);
+
+    Variant variants[MARCHS];
+    for (int j = 0; j < MARCHS; j++) {
+        TB_FeatureSet features = march(marchs[j]);
+        variants[j] = compile(KERNELS, builders, &features);
+    }
+
+    int failed = 0;
+    for (int i = 0; i < KERNELS; i++) {
+        int bad = 0;
+        printf("ilp: %-12s", names[i]);
+        for (int j = 0; j < MARCHS; j++) {
+            double ns = time_ilp(i, variants[j].fns[i], expected[i], &bad);
+            printf("  %s: %6.3f ns/elem (%3d cycles)", marchs[j], ns, variants[j].stats[i].sched_cycles);
+        }
+        printf("  %s\n", bad ? "FAILED" : "OK");
+        failed += bad != 0;
+    }
+
+    for (int j = 0; j < MARCHS; j++) {
+        release(&variants[j]);
+    }
+    return failed;
+}
+
+////////////////////////////////
+// Peepholes
+////////////////////////////////
+// more values live across the product than there are GPRs, the second pass
+// reloads the spilled ones as the rhs of an add which gets folded into a
+// memory operand.
+enum { TERMS = 18 };
+
+static int32_t pressure(int32_t a, int32_t b, int32_t c, int32_t d, int32_t e, int32_t f) {
+    uint32_t t[TERMS];
+    for (int i = 0; i < TERMS; i++) {
+        uint32_t x = (i & 1 ? c : d) + i;
+        uint32_t y = (i & 2 ? e : f) ^ (i * 7);
+        t[i] = (a * x) ^ (b + y);
+    }
+
+    uint32_t prod = 1;
+    for (int i = 0; i < TERMS; i++) {
+        prod *= t[i];
+    }
+
+    uint32_t sum = prod;
+    for (int i = TERMS; i--;) {
+        sum += t[i];
+    }
+    return sum;
+}
+
+static TB_Function* build_pressure(TB_Module* m) {
+    TB_DataType params[6] = { TB_TYPE_I32, TB_TYPE_I32, TB_TYPE_I32, TB_TYPE_I32, TB_TYPE_I32, TB_TYPE_I32 };
+    TB_Function* f = declare(m, "pressure", 6, params, TB_TYPE_I32);
+
+    TB_Node *a = tb_inst_param(f, 0), *b = tb_inst_param(f, 1), *c = tb_inst_param(f, 2);
+    TB_Node *d = tb_inst_param(f, 3), *e = tb_inst_param(f, 4), *g = tb_inst_param(f, 5);
+
+    TB_Node* t[TERMS];
+    for (int i = 0; i < TERMS; i++) {
+        TB_Node* x = tb_inst_add(f, i & 1 ? c : d, i32(f, i), 0);
+        TB_Node* y = tb_inst_xor(f, i & 2 ? e : g, i32(f, i * 7));
+        t[i] = tb_inst_xor(f, tb_inst_mul(f, a, x, 0), tb_inst_add(f, b, y, 0));
+    }
+
+    TB_Node* prod = i32(f, 1);
+    for (int i = 0; i < TERMS; i++) {
+        prod = tb_inst_mul(f, prod, t[i], 0);
+    }
+
+    TB_Node* sum = prod;
+    for (int i = TERMS; i--;) {
+        sum = tb_inst_add(f, sum, t[i], 0);
+    }
+    tb_inst_ret(f, 1, &sum);
+    return f;
+}
+
+// the xor already cleared the top 32bits, the zero extension is free
+static uint64_t widen(uint32_t a, uint32_t b, uint64_t c) {
+    return (a ^ b) + c;
+}
+
+static TB_Function* build_widen(TB_Module* m) {
+    TB_Function* f = declare(m, "widen", 3, (TB_DataType[]){ TB_TYPE_I32, TB_TYPE_I32, TB_TYPE_I64 }, TB_TYPE_I64);
+    TB_Node* x = tb_inst_xor(f, tb_inst_param(f, 0), tb_inst_param(f, 1));
+    TB_Node* ret = tb_inst_add(f, tb_inst_zxt(f, x, TB_TYPE_I64), tb_inst_param(f, 2), 0);
+    tb_inst_ret(f, 1, &ret);
+    return f;
+}
+
+// the and sets ZF, no need for a test/cmp against zero
+static int32_t masked(int32_t a, int32_t b) {
+    if ((a & b) == 0) return 1;
+    return 2;
+}
+
+static TB_Function* build_masked(TB_Module* m) {
+    TB_Function* f = declare(m, "masked", 2, (TB_DataType[]){ TB_TYPE_I32, TB_TYPE_I32 }, TB_TYPE_I32);
+    TB_Node* is_zero = tb_inst_region(f);
+    TB_Node* not_zero = tb_inst_region(f);
+    TB_Node* x = tb_inst_and(f, tb_inst_param(f, 0), tb_inst_param(f, 1));
+    tb_inst_if(f, tb_inst_cmp_eq(f, x, i32(f, 0)), is_zero, not_zero);
+
+    tb_inst_set_control(f, is_zero);
+    TB_Node* one = i32(f, 1);
+    tb_inst_ret(f, 1, &one);
+
+    tb_inst_set_control(f, not_zero);
+    TB_Node* two = i32(f, 2);
+    tb_inst_ret(f, 1, &two);
+    return f;
+}
+
+// returns the best ns/call, the results are summed up and checked against the C versions
+static double time_peephole(int kernel, void* fn, int* bad) {
+    double best = 1e30;
+    for (int r = 0; r < REPEATS; r++) {
+        uint64_t got = 0, expected = 0;
+        uint64_t start = now_in_nanos();
+        for (uint32_t i = 0; i < CALLS * LEN; i++) {
+            switch (kernel) {
+                case 0: got += ((int32_t (*)(int32_t, int32_t, int32_t, int32_t, int32_t, int32_t)) fn)(i, i + 1, i ^ 7, i * 3, i >> 1, 5); break;
+                case 1: got += ((uint64_t (*)(uint32_t, uint32_t, uint64_t)) fn)(i, i * 2654435761u, got); break;
+                case 2: got += ((int32_t (*)(int32_t, int32_t)) fn)(i, 0x55); break;
+            }
+        }
+        double ns = (double) (now_in_nanos() - start) / ((double) CALLS * LEN);
+        if (ns < best) best = ns;
+
+        for (uint32_t i = 0; i < CALLS * LEN; i++) {
+            switch (kernel) {
+                case 0: expected += pressure(i, i + 1, i ^ 7, i * 3, i >> 1, 5); break;
+                case 1: expected += widen(i, i * 2654435761u, expected); break;
+                case 2: expected += masked(i, 0x55); break;
+            }
+        }
+        *bad += got != expected;
+    }
+    return best;
+}
+
+static int peephole(void) {
+    static const char* names[] = { "pressure", "widen", "masked" };
+    static const BuildFn builders[] = { build_pressure, build_widen, build_masked };
+    enum { KERNELS = 3 };
+
+    TB_FeatureSet features = march("x86-64-v3");
+    Variant v = compile(KERNELS, builders, &features);
+
+    int failed = 0;
+    for (int i = 0; i < KERNELS; i++) {
+        int bad = 0;
+        double ns = time_peephole(i, v.fns[i], &bad);
+
+        TB_RegAllocStats* s = &v.stats[i];
+        printf("peephole: %-9s %6.3f ns/call  spills: %d  peepholes: %d copies, %d zext, %d folds, %d flags  %s\n", names[i], ns, s->spills, s->peep_copies, s->peep_zexts, s->peep_folds, s->peep_flags, bad ? "FAILED" : "OK");
+        failed += bad != 0;
+    }
+
+    release(&v);
+    return failed;
+}
+
+////////////////////////////////
+// Bit tricks
+////////////////////////////////
+static uint64_t log2_sum(const uint64_t* p, size_t n) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        sum += 63 - __builtin_clzll(p[i] | 1);
+    }
+    return sum;
+}
+
+static uint64_t popcount_sum(const uint64_t* p, size_t n) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        sum += __builtin_popcountll(p[i]);
+    }
+    return sum;
+}
+
+// walk the set bits, lowest first
+static uint64_t index_sum(const uint64_t* p, size_t n) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        uint64_t mask = p[i] | 1;
+        do {
+            sum += __builtin_ctzll(mask);
+            mask &= mask - 1;
+        } while (mask);
+    }
+    return sum;
+}
+
+// variable shifts don't need the count in RCX with BMI2 (shlx/shrx) and
+// the ~x & y is a single andn
+static uint64_t shifty(const uint64_t* p, size_t n) {
+    uint64_t acc = 1;
+    for (size_t i = 0; i < n; i++) {
+        uint64_t s = i & 31;
+        acc = (acc << s) ^ (p[i] >> (s + 1)) ^ (~acc & p[i]);
+    }
+    return acc;
+}
+
+// sum += op(p[i]) where op gives an i32
+static TB_Function* build_bit_sum(TB_Module* m, const char* name, TB_Node* (*op)(TB_Function* f, TB_Node* x)) {
+    TB_Function* f = declare(m, name, 2, (TB_DataType[]){ TB_TYPE_PTR, TB_TYPE_I64 }, TB_TYPE_I64);
+    TB_Node* sum = var(f, TB_TYPE_I64, i64(f, 0));
+
+    Loop l;
+    TB_Node* i = loop_begin(f, &l, tb_inst_param(f, 1));
+    TB_Node* v = op(f, load_elem(f, TB_TYPE_I64, tb_inst_param(f, 0), i, 0, 8));
+    set(f, TB_TYPE_I64, sum, tb_inst_add(f, get(f, TB_TYPE_I64, sum), tb_inst_zxt(f, v, TB_TYPE_I64), 0));
+    loop_end(f, &l, 1);
+
+    TB_Node* ret = get(f, TB_TYPE_I64, sum);
+    tb_inst_ret(f, 1, &ret);
+    return f;
+}
+
+static TB_Node* log2_op(TB_Function* f, TB_Node* x) {
+    return tb_inst_sub(f, i32(f, 63), tb_inst_clz(f, tb_inst_or(f, x, i64(f, 1))), 0);
+}
+
+static TB_Node* popcount_op(TB_Function* f, TB_Node* x) {
+    return tb_inst_popcount(f, x);
+}
+
+static TB_Function* build_log2_sum(TB_Module* m)     { return build_bit_sum(m, "log2_sum", log2_op); }
+static TB_Function* build_popcount_sum(TB_Module* m) { return build_bit_sum(m, "popcount_sum", popcount_op); }
+
+static TB_Function* build_index_sum(TB_Module* m) {
+    TB_Function* f = declare(m, "index_sum", 2, (TB_DataType[]){ TB_TYPE_PTR, TB_TYPE_I64 }, TB_TYPE_I64);
+    TB_Node* sum = var(f, TB_TYPE_I64, i64(f, 0));
+    TB_Node* mask = var(f, TB_TYPE_I64, i64(f, 0));
+
+    Loop l;
+    TB_Node* i = loop_begin(f, &l, tb_inst_param(f, 1));
+    set(f, TB_TYPE_I64, mask, tb_inst_or(f, load_elem(f, TB_TYPE_I64, tb_inst_param(f, 0), i, 0, 8), i64(f, 1)));
+
+    TB_Node* walk = tb_inst_region(f);
+    TB_Node* done = tb_inst_region(f);
+    tb_inst_goto(f, walk);
+    tb_inst_set_control(f, walk);
+
+    TB_Node* mv = get(f, TB_TYPE_I64, mask);
+    set(f, TB_TYPE_I64, sum, tb_inst_add(f, get(f, TB_TYPE_I64, sum), tb_inst_zxt(f, tb_inst_ctz(f, mv), TB_TYPE_I64), 0));
+    mv = tb_inst_and(f, mv, tb_inst_sub(f, mv, i64(f, 1), 0));
+    set(f, TB_TYPE_I64, mask, mv);
+    tb_inst_if(f, tb_inst_cmp_ne(f, mv, i64(f, 0)), walk, done);
+
+    tb_inst_set_control(f, done);
+    loop_end(f, &l, 1);
+
+    TB_Node* ret = get(f, TB_TYPE_I64, sum);
+    tb_inst_ret(f, 1, &ret);
+    return f;
+}
+
+static TB_Function* build_shifty(TB_Module* m) {
+    TB_Function* f = declare(m, "shifty", 2, (TB_DataType[]){ TB_TYPE_PTR, TB_TYPE_I64 }, TB_TYPE_I64);
+    TB_Node* acc = var(f, TB_TYPE_I64, i64(f, 1));
+
+    Loop l;
+    TB_Node* i = loop_begin(f, &l, tb_inst_param(f, 1));
+    TB_Node* x = load_elem(f, TB_TYPE_I64, tb_inst_param(f, 0), i, 0, 8);
+    TB_Node* s = tb_inst_and(f, i, i64(f, 31));
+    TB_Node* av = get(f, TB_TYPE_I64, acc);
+    av = tb_inst_xor(f, tb_inst_xor(f,
+            tb_inst_shl(f, av, s, 0),
+            tb_inst_shr(f, x, tb_inst_add(f, s, i64(f, 1), 0))),
+        tb_inst_and(f, tb_inst_not(f, av), x));
+    set(f, TB_TYPE_I64, acc, av);
+    loop_end(f, &l, 1);
+
+    TB_Node* ret = get(f, TB_TYPE_I64, acc);
+    tb_inst_ret(f, 1, &ret);
+    return f;
+}
+
+static uint64_t bits_in[LEN];
+
+static double time_bits(void* fn, uint64_t expected, int* bad) {
+    double best = 1e30;
+    for (int r = 0; r < REPEATS; r++) {
+        uint64_t start = now_in_nanos();
+        for (int c = 0; c < CALLS; c++) {
+            *bad += ((uint64_t (*)(const uint64_t*, size_t)) fn)(bits_in, LEN) != expected;
+        }
+
+        double ns = (double) (now_in_nanos() - start) / ((double) CALLS * LEN);
+        if (ns < best) best = ns;
+    }
+    return best;
+}
+
+static int bits(void) {
+    static const char* names[] = { "log2_sum", "popcount_sum", "index_sum", "shifty" };
+    static const BuildFn builders[] = { build_log2_sum, build_popcount_sum, build_index_sum, build_shifty };
+    static const char* marchs[] = { "x86-64", "haswell" };
+    enum { KERNELS = 4, MARCHS = 2 };
+
+    // a mix of sparse and dense words
+    for (int i = 0; i < LEN; i++) {
+        uint64_t x = i * 0x9E3779B97F4A7C15ull;
+        bits_in[i] = i & 1 ? x : x >> (i & 63);
+    }
+
+    uint64_t expected[KERNELS];
+    expected[0] = log2_sum(bits_in, LEN);
+    expected[1] = popcount_sum(bits_in, LEN);
+    expected[2] = index_sum(bits_in, LEN);
+    expected[3] = shifty(bits_in, LEN);
+
+    Variant variants[MARCHS];
+    for (int j = 0; j < MARCHS; j++) {
+        TB_FeatureSet features = march(marchs[j]);
+        variants[j] = compile(KERNELS, builders, &features);
+    }
+
+    int failed = 0;
+    for (int i = 0; i < KERNELS; i++) {
+        int bad = 0;
+        printf("bits: %-12s", names[i]);
+        for (int j = 0; j < MARCHS; j++) {
+            printf("  %s: %6.3f ns/elem", marchs[j], time_bits(variants[j].fns[i], expected[i], &bad));
+        }
+        printf("  %s\n", bad ? "FAILED" : "OK");
+        failed += bad != 0;
+    }
+
+    for (int j = 0; j < MARCHS; j++) {
+        release(&variants[j]);
+    }
+    return failed;
+}
+
+////////////////////////////////
+// Float pressure
+////////////////////////////////
+// more than 16 doubles live across the horner loop, x86-64-v4 has XMM16-31
+// (EVEX) to keep them in where x86-64-v3 has to spill.
+enum { HORNER_TERMS = 24 };
+
+static double horner_pairs(const double* p, double x) {
+    double t[HORNER_TERMS];
+    for (int i = 0; i < HORNER_TERMS; i++) {
+        t[i] = p[i] * p[(i + 1) % HORNER_TERMS] + p[i];
+    }
+
+    double acc = x;
+    for (int i = HORNER_TERMS - 1; i >= 0; i--) {
+        acc = acc * x + t[i] * (double) (i + 1);
+    }
+    return acc;
+}
+
+static TB_Function* build_horner_pairs(TB_Module* m) {
+    TB_Function* f = declare(m, "horner_pairs", 2, (TB_DataType[]){ TB_TYPE_PTR, TB_TYPE_F64 }, TB_TYPE_F64);
+    TB_Node* p = tb_inst_param(f, 0);
+    TB_Node* x = tb_inst_param(f, 1);
+
+    TB_Node* t[HORNER_TERMS];
+    for (int i = 0; i < HORNER_TERMS; i++) {
+        TB_Node* a = load_elem(f, TB_TYPE_F64, p, i64(f, i), 0, 8);
+        TB_Node* b = load_elem(f, TB_TYPE_F64, p, i64(f, (i + 1) % HORNER_TERMS), 0, 8);
+        t[i] = tb_inst_fadd(f, tb_inst_fmul(f, a, b), a);
+    }
+
+    TB_Node* acc = x;
+    for (int i = HORNER_TERMS - 1; i >= 0; i--) {
+        acc = tb_inst_fadd(f, tb_inst_fmul(f, acc, x), tb_inst_fmul(f, t[i], tb_inst_float64(f, i + 1)));
+    }
+    tb_inst_ret(f, 1, &acc);
+    return f;
+}
+
+static int fpressure(void) {
+    static const BuildFn builders[] = { build_horner_pairs };
+    static const char* marchs[] = { "x86-64-v3", "x86-64-v4" };
+    enum { MARCHS = 2 };
+
+    double p[HORNER_TERMS];
+    for (int i = 0; i < HORNER_TERMS; i++) {
+        p[i] = 1.0 + i * 0.37;
+    }
+
+    // x86-64-v4 is only worth running on something with AVX-512
+    int marchs_to_run = __builtin_cpu_supports("avx512f") ? MARCHS : 1;
+
+    int bad = 0;
+    printf("fpressure: horner_pairs");
+    for (int j = 0; j < marchs_to_run; j++) {
+        TB_FeatureSet features = march(marchs[j]);
+        Variant v = compile(1, builders, &features);
+        double (*fn)(const double*, double) = v.fns[0];
+
+        double best = 1e30;
+        for (int r = 0; r < REPEATS; r++) {
+            double got = 0.0, expected = 0.0;
+            uint64_t start = now_in_nanos();
+            for (int i = 0; i < CALLS * LEN; i++) {
+                got += fn(p, 0.5 + (i & 7) * 0.0625);
+            }
+            double ns = (double) (now_in_nanos() - start) / ((double) CALLS * LEN);
+            if (ns < best) best = ns;
+
+            for (int i = 0; i < CALLS * LEN; i++) {
+                expected += horner_pairs(p, 0.5 + (i & 7) * 0.0625);
+            }
+            bad += got != expected;
+        }
+
+        printf("  %s: %6.3f ns/call (%2d spills)", marchs[j], best, v.stats[0].spills);
+        release(&v);
+    }
+    printf("  %s\n", bad ? "FAILED" : "OK");
+    return bad != 0;
+}
+
+////////////////////////////////
+// Bulk copies
+////////////////////////////////
+// every kernel walks a buffer of BULK_BYTES in bulk_size steps, the sizes
+// straddle the unrolled limits (128 bytes with SSE, 256 with AVX) and the odd
+// ones need an overlapping tail. The _var kernels take the size as a param
+// so they're always the rep movsb/stosb.
+enum { BULK_BYTES = 64 * 1024 };
+
+static int bulk_size;
+static uint8_t bulk_src[BULK_BYTES + 64], bulk_dst[BULK_BYTES + 64];
+
+static TB_Function* build_bulk(TB_Module* m, const char* name, bool is_set, bool is_var) {
+    TB_DataType params[4] = { TB_TYPE_PTR, is_set ? TB_TYPE_I8 : TB_TYPE_PTR, TB_TYPE_I64, TB_TYPE_I64 };
+    TB_Function* f = declare(m, name, 4, params, TB_TYPE_PTR);
+    TB_Node* dst = tb_inst_param(f, 0);
+    TB_Node* size = is_var ? tb_inst_param(f, 3) : i64(f, bulk_size);
+
+    Loop l;
+    TB_Node* i = loop_begin(f, &l, tb_inst_param(f, 2));
+    TB_Node* d = tb_inst_array_access(f, dst, i, 1);
+    if (is_set) {
+        tb_inst_memset(f, d, tb_inst_param(f, 1), size, 1);
+    } else {
+        tb_inst_memcpy(f, d, tb_inst_array_access(f, tb_inst_param(f, 1), i, 1), size, 1);
+    }
+    loop_end(f, &l, bulk_size);
+
+    tb_inst_ret(f, 1, &dst);
+    return f;
+}
+
+static TB_Function* build_copy(TB_Module* m)     { return build_bulk(m, "copy",     false, false); }
+static TB_Function* build_copy_var(TB_Module* m) { return build_bulk(m, "copy_var", false, true);  }
+static TB_Function* build_set(TB_Module* m)      { return build_bulk(m, "set",      true,  false); }
+static TB_Function* build_set_var(TB_Module* m)  { return build_bulk(m, "set_var",  true,  true);  }
+
+// returns the best ns per copy, dst and src are off by a few bytes so none of
+// the vector moves are aligned.
+static double time_bulk(int kernel, void* fn, int* bad) {
+    typedef void* (*CopyFn)(uint8_t*, const uint8_t*, uint64_t, uint64_t);
+    typedef void* (*SetFn)(uint8_t*, uint8_t, uint64_t, uint64_t);
+
+    uint64_t bytes = (BULK_BYTES / bulk_size) * bulk_size;
+    uint8_t* dst = bulk_dst + 1;
+    uint8_t* src = bulk_src + 3;
+
+    double best = 1e30;
+    for (int r = 0; r < REPEATS; r++) {
+        memset(bulk_dst, 0, sizeof(bulk_dst));
+
+        uint64_t start = now_in_nanos();
+        for (int c = 0; c < CALLS; c++) {
+            if (kernel < 2) {
+                ((CopyFn) fn)(dst, src, bytes, bulk_size);
+            } else {
+                ((SetFn) fn)(dst, c, bytes, bulk_size);
+            }
+        }
+        double ns = (double) (now_in_nanos() - start) / ((double) CALLS * (bytes / bulk_size));
+        if (ns < best) best = ns;
+
+        // the last call is the one left in dst, nothing past it got touched
+        if (kernel < 2) {
+            *bad += memcmp(dst, src, bytes) != 0;
+        } else {
+            for (uint64_t i = 0; i < bytes; i++) {
+                *bad += dst[i] != (uint8_t) (CALLS - 1);
+            }
+        }
+        *bad += dst[bytes] != 0 || bulk_dst[0] != 0;
+    }
+    return best;
+}
+
+static int bulk(void) {
+    static const char* names[] = { "memcpy", "memcpy", "memset", "memset" };
+    static const BuildFn builders[] = { build_copy, build_copy_var, build_set, build_set_var };
+    static const int sizes[] = { 24, 48, 100, 256, 1024 };
+    static const char* marchs[] = { "x86-64", "haswell" };
+    enum { KERNELS = 4, SIZES = 5, MARCHS = 2 };
+
+    for (int i = 0; i < sizeof(bulk_src); i++) {
+        bulk_src[i] = i * 131 + 7;
+    }
+
+    int failed = 0;
+    for (int s = 0; s < SIZES; s++) {
+        bulk_size = sizes[s];
+
+        Variant variants[MARCHS];
+        for (int j = 0; j < MARCHS; j++) {
+            TB_FeatureSet features = march(marchs[j]);
+            variants[j] = compile(KERNELS, builders, &features);
+        }
+
+        // the rep is the same code for both, it's only timed once
+        for (int i = 0; i < KERNELS; i += 2) {
+            int bad = 0;
+            printf("bulk: %s %4d  rep: %7.3f ns", names[i], bulk_size, time_bulk(i + 1, variants[0].fns[i + 1], &bad));
+            for (int j = 0; j < MARCHS; j++) {
+                printf("  %s: %7.3f ns", marchs[j], time_bulk(i, variants[j].fns[i], &bad));
+            }
+            printf("  %s\n", bad ? "FAILED" : "OK");
+            failed += bad != 0;
+        }
+
+        for (int j = 0; j < MARCHS; j++) {
+            release(&variants[j]);
+        }
+    }
+    return failed;
+}
+
+int main(int argc, char** argv) {
+    #if !defined(__x86_64__) && !defined(_M_X64)
+    printf("x64_bench: not an x64 host, skipping\n");
+    return 0;
+    #else
+    int failed = 0;
+    failed += ilp();
+    failed += peephole();
+    failed += bits();
+    failed += fpressure();
+    failed += bulk();
+    return failed != 0;
+    #endif
+}
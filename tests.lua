@@ -19,6 +19,25 @@ function test_single(path, args, flags)
     end
 end
 
+-- codegen tests, diffs the -S output against <path>.<arch>.gold
+function test_asm(path, arch, target)
+    tally = tally + 1
+    print("testing "..path.." ("..arch..")...")
+
+    if not os.execute(string.format("cuik -O -S -c -target %s tests/collection/%s > tests/collection/foo.txt", target, path)) then
+        print("  NAY COMPILE")
+        return
+    end
+
+    local exit = os.execute(string.format("git diff -b --no-index tests/collection/foo.txt tests/collection/%s.%s.gold", path, arch))
+    if exit ~= 0 then
+        print("  NAY")
+    else
+        print("  Yay")
+        succ = succ + 1
+    end
+end
+
 function test(path, args, flags)
     print("testing "..path.."...")
     test_single(path, args, "")
@@ -29,5 +48,8 @@ end
 
 test("crc32.c", "")
 test("mur.c", "tests/collection/mur.c")
+test_asm("a64_mem.c", "aarch64", "aarch64_linux_gnu")
+test_asm("wasm_locals.c", "wasm", "wasm32")
+test_asm("mips_delay.c", "mips", "mips64_linux_gnu")
 
 print(string.format("run %d / %d", succ, tally))
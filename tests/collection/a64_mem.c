@@ -0,0 +1,5 @@
+// aarch64 addressing modes, compare `cuik -O -S -c -target aarch64_linux_gnu`
+// against the golden disassembly.
+long ld_index(long* p, long i) { return p[i] + p[3]; }
+void st_const(int* p, int x) { p[5] = x; }
+void st_zero(long* p) { p[2] = 0; }
@@ -0,0 +1,11 @@
+// MIPS delay slot filling, compare `cuik -O -S -c -target mips64_linux_gnu`
+// against the golden disassembly.
+long ld_index(long* p, long i) { return p[i] + p[3]; }
+void st_const(int* p, int x) { p[5] = x; }
+void st_zero(long* p) { p[2] = 0; }
+long pick(long a, long b) { if (a > b) return a * 2; return b - 1; }
+long big(void) { return 0x123456789ABCLL; }
+long mix(long a, long b) { return (a ^ b) * 3 + (a & 255) - (b | 16); }
+long shifts(long a, long b) { return (a << 3) + (a >> b) + (b << a); }
+long divs(long a, long b) { return a / b + a % b; }
+long locals(long a, long b, long i) { long t[4]; t[0] = a; t[1] = b; t[2] = a + b; t[3] = a - b; return t[i] * 2; }
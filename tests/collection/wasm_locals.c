@@ -0,0 +1,5 @@
+// wasm stackification & local coloring, compare `cuik -O -S -c -target wasm32`
+// against the golden disassembly.
+int mix(int a, int b) { return (a + b) * 3 - (a ^ 7); }
+int pick(int a, int b) { if (a > b) return a * 2; return b - 1; }
+int both(int a, int b) { int x = a * b; int y = x + a; return y * x; }